@@ -1747,3 +1747,56 @@ AsyncSocket_WaitForReadMultiple(AsyncSocket **asock,  // IN
    }
    return ret;
 }
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocket_WaitSetAdd --
+ * AsyncSocket_WaitSetRemove --
+ *
+ *      Add a connected or listening socket to a wait set, or take it out.
+ *      A socket can be in one wait set at most. Closed sockets leave their
+ *      set by themselves during the next AsyncSocket_WaitSetWait.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, ASOCKERR_INVAL on invalid parameters, if the
+ *      socket is in the wrong state or set, or if this socket type can not
+ *      be waited on in a set. ASOCKERR_GENERIC if it could not be added.
+ *
+ * Side effects:
+ *      The set holds a reference on its sockets.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+AsyncSocket_WaitSetAdd(AsyncSocketWaitSet *waitSet,  // IN
+                       AsyncSocket *asock)           // IN
+{
+   int ret;
+   if (waitSet != NULL && VALID(asock, waitSetAdd)) {
+      AsyncSocketLock(asock);
+      ret = VT(asock)->waitSetAdd(asock, waitSet);
+      AsyncSocketUnlock(asock);
+   } else {
+      ret = ASOCKERR_INVAL;
+   }
+   return ret;
+}
+
+
+int
+AsyncSocket_WaitSetRemove(AsyncSocketWaitSet *waitSet,  // IN
+                          AsyncSocket *asock)           // IN
+{
+   int ret;
+   if (waitSet != NULL && VALID(asock, waitSetRemove)) {
+      AsyncSocketLock(asock);
+      ret = VT(asock)->waitSetRemove(asock, waitSet);
+      AsyncSocketUnlock(asock);
+   } else {
+      ret = ASOCKERR_INVAL;
+   }
+   return ret;
+}
@@ -0,0 +1,933 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*********************************************************
+ * The contents of this file are subject to the terms of the Common
+ * Development and Distribution License (the "License") version 1.0
+ * and no later version.  You may not use this file except in
+ * compliance with the License.
+ *
+ * You can obtain a copy of the License at
+ *         http://www.opensource.org/licenses/cddl1.php
+ *
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ *********************************************************/
+
+/*
+ * asyncSocketUring.c --
+ *
+ *      A single, process wide io_uring instance for the AsyncTCPSocket data
+ *      path. Sockets submit reads, sends and connects as SQEs; completions
+ *      are reaped from a Poll device callback on the ring fd (the ring fd
+ *      polls readable while the completion queue is not empty), or by the
+ *      blocking AsyncSocket helpers which poll the ring fd themselves.
+ *
+ *      SQEs queued while completions are being dispatched are submitted
+ *      together once the batch is done, so a receive that triggers a reply
+ *      and re-arms the next receive costs a single io_uring_enter().
+ *
+ *      Receives land in ring owned buffers, registered with the kernel when
+ *      RLIMIT_MEMLOCK allows it, and are copied out by the socket code. The
+ *      kernel therefore never writes into a client buffer that may have
+ *      been withdrawn by AsyncSocket_CancelRecv() or AsyncSocket_Close().
+ *      Sends are likewise staged in a ring owned buffer.
+ *
+ *      The ring is set up with raw system calls; there is no dependency on
+ *      liburing. Kernels without IORING_FEAT_FAST_POLL (5.7) are not used.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "vmware.h"
+#include "asyncsocket.h"
+#include "asyncSocketUring.h"
+#include "err.h"
+#include "log.h"
+#include "poll.h"
+#include "userlock.h"
+#include "util.h"
+
+#define LOGLEVEL_MODULE asyncsocket
+#include "loglevel_user.h"
+
+/*
+ * Ring sizing. The completion queue is larger than the submission queue
+ * since every connected socket keeps a receive outstanding.
+ */
+#define ASYNC_URING_SQ_ENTRIES   256
+#define ASYNC_URING_CQ_ENTRIES   4096
+
+/*
+ * Number of ring owned buffers. With registered buffers this is locked
+ * memory (2 MB), so keep it modest; sockets beyond the pool get private,
+ * unregistered buffers.
+ */
+#define ASYNC_URING_NUM_BUFS     128
+
+/* Maximum number of completions dispatched per batch. */
+#define ASYNC_URING_REAP_BATCH   64
+
+/* user_data of internal SQEs (cancel), ignored when reaped. */
+#define ASYNC_URING_INTERNAL     0
+
+/*
+ * A POLL_ADD linked in front of an op carries the op pointer with this bit
+ * set, so that AsyncUring_Cancel can find the op while it is still queued
+ * behind its poll. Its completion is ignored as well.
+ */
+#define ASYNC_URING_POLL_TAG     1
+
+
+typedef struct AsyncUring {
+   int fd;
+   Bool active;
+   MXUserExclLock *lock;
+   Bool pollRegistered;
+
+   /* Submission queue. */
+   void *sqRing;
+   size_t sqRingSize;
+   uint32 *sqHead;
+   uint32 *sqTail;
+   uint32 sqMask;
+   uint32 sqEntries;
+   uint32 *sqArray;
+   struct io_uring_sqe *sqes;
+   size_t sqesSize;
+   uint32 sqPending;          /* Queued but not yet handed to the kernel. */
+
+   /* Completion queue; shares the SQ ring mapping (IORING_FEAT_SINGLE_MMAP). */
+   uint32 *cqHead;
+   uint32 *cqTail;
+   uint32 cqMask;
+   struct io_uring_cqe *cqes;
+
+   /* Completion dispatch state, see AsyncUringMaybeFlushLocked. */
+   int reapDepth;
+   pthread_t reaper;
+
+   /* Buffer pool. */
+   uint8 *bufPool;
+   Bool bufsRegistered;
+   int freeBufs[ASYNC_URING_NUM_BUFS];
+   int numFreeBufs;
+} AsyncUring;
+
+static AsyncUring asyncUring = { -1 };
+static Atomic_Ptr asyncUringInitLockStorage;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringSetup --
+ * AsyncUringEnter --
+ * AsyncUringRegister --
+ *
+ *      Thin wrappers for the io_uring system calls.
+ *
+ * Results:
+ *      Those of the system calls.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+AsyncUringSetup(unsigned int entries,           // IN
+                struct io_uring_params *params) // IN/OUT
+{
+   return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+AsyncUringEnter(unsigned int toSubmit,          // IN
+                unsigned int minComplete,       // IN
+                unsigned int flags)             // IN
+{
+   return (int)syscall(__NR_io_uring_enter, asyncUring.fd, toSubmit,
+                       minComplete, flags, NULL, 0);
+}
+
+static int
+AsyncUringRegister(unsigned int opcode,         // IN
+                   const void *arg,             // IN
+                   unsigned int numArgs)        // IN
+{
+   return (int)syscall(__NR_io_uring_register, asyncUring.fd, opcode, arg,
+                       numArgs);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringInitBuffers --
+ *
+ *      Allocate the buffer pool and try to register it with the ring.
+ *      Failure to register (typically RLIMIT_MEMLOCK) is not fatal; the
+ *      pool is then used with plain receives.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Allocates memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncUringInitBuffers(void)
+{
+   struct iovec iov[ASYNC_URING_NUM_BUFS];
+   void *pool;
+   int i;
+
+   if (posix_memalign(&pool, 4096,
+                      (size_t)ASYNC_URING_NUM_BUFS * ASYNC_URING_BUF_SIZE)) {
+      Log(ASOCKPREFIX "io_uring: no memory for the buffer pool\n");
+      return;
+   }
+   asyncUring.bufPool = pool;
+
+   for (i = 0; i < ASYNC_URING_NUM_BUFS; i++) {
+      iov[i].iov_base = asyncUring.bufPool + i * ASYNC_URING_BUF_SIZE;
+      iov[i].iov_len = ASYNC_URING_BUF_SIZE;
+      asyncUring.freeBufs[i] = ASYNC_URING_NUM_BUFS - 1 - i;
+   }
+   asyncUring.numFreeBufs = ASYNC_URING_NUM_BUFS;
+
+   if (AsyncUringRegister(IORING_REGISTER_BUFFERS, iov,
+                          ASYNC_URING_NUM_BUFS) == 0) {
+      asyncUring.bufsRegistered = TRUE;
+   } else {
+      int err = errno;
+
+      Log(ASOCKPREFIX "io_uring: not using registered buffers: %s\n",
+          Err_Errno2String(err));
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_Init --
+ *
+ *      Set up the process wide ring. Safe to call more than once.
+ *
+ * Results:
+ *      TRUE if the ring is usable.
+ *
+ * Side effects:
+ *      Creates the ring and maps its queues.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+AsyncUring_Init(void)
+{
+   static const uint32 required = IORING_FEAT_SINGLE_MMAP |
+                                  IORING_FEAT_NODROP |
+                                  IORING_FEAT_FAST_POLL;
+   MXUserExclLock *initLock;
+   struct io_uring_params params;
+   uint8 *sqRing;
+   uint32 i;
+   int fd;
+
+   initLock = MXUser_CreateSingletonExclLock(&asyncUringInitLockStorage,
+                                             "asyncUringInitLock",
+                                             RANK_UNRANKED);
+   MXUser_AcquireExclLock(initLock);
+
+   if (asyncUring.active) {
+      goto exit;
+   }
+
+   memset(&params, 0, sizeof params);
+   params.flags = IORING_SETUP_CQSIZE;
+   params.cq_entries = ASYNC_URING_CQ_ENTRIES;
+
+   fd = AsyncUringSetup(ASYNC_URING_SQ_ENTRIES, &params);
+   if (fd < 0) {
+      int err = errno;
+
+      Log(ASOCKPREFIX "io_uring: setup failed: %s\n", Err_Errno2String(err));
+      goto exit;
+   }
+   if ((params.features & required) != required) {
+      Log(ASOCKPREFIX "io_uring: kernel lacks required features (0x%x)\n",
+          params.features);
+      close(fd);
+      goto exit;
+   }
+
+   asyncUring.sqRingSize = MAX(params.sq_off.array +
+                               params.sq_entries * sizeof(uint32),
+                               params.cq_off.cqes +
+                               params.cq_entries *
+                               sizeof(struct io_uring_cqe));
+   asyncUring.sqRing = mmap(NULL, asyncUring.sqRingSize,
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_SQ_RING);
+   if (asyncUring.sqRing == MAP_FAILED) {
+      Log(ASOCKPREFIX "io_uring: failed to map the rings\n");
+      close(fd);
+      goto exit;
+   }
+
+   asyncUring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+   asyncUring.sqes = mmap(NULL, asyncUring.sqesSize,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+   if (asyncUring.sqes == MAP_FAILED) {
+      Log(ASOCKPREFIX "io_uring: failed to map the SQEs\n");
+      munmap(asyncUring.sqRing, asyncUring.sqRingSize);
+      close(fd);
+      goto exit;
+   }
+
+   sqRing = asyncUring.sqRing;
+   asyncUring.fd = fd;
+   asyncUring.sqHead = (uint32 *)(sqRing + params.sq_off.head);
+   asyncUring.sqTail = (uint32 *)(sqRing + params.sq_off.tail);
+   asyncUring.sqMask = *(uint32 *)(sqRing + params.sq_off.ring_mask);
+   asyncUring.sqEntries = *(uint32 *)(sqRing + params.sq_off.ring_entries);
+   asyncUring.sqArray = (uint32 *)(sqRing + params.sq_off.array);
+   asyncUring.cqHead = (uint32 *)(sqRing + params.cq_off.head);
+   asyncUring.cqTail = (uint32 *)(sqRing + params.cq_off.tail);
+   asyncUring.cqMask = *(uint32 *)(sqRing + params.cq_off.ring_mask);
+   asyncUring.cqes = (struct io_uring_cqe *)(sqRing + params.cq_off.cqes);
+
+   /* SQE slots are used in ring order, so the index array is the identity. */
+   for (i = 0; i < asyncUring.sqEntries; i++) {
+      asyncUring.sqArray[i] = i;
+   }
+
+   asyncUring.lock = MXUser_CreateExclLock("asyncUringLock", RANK_UNRANKED);
+   AsyncUringInitBuffers();
+   asyncUring.active = TRUE;
+
+   Log(ASOCKPREFIX "io_uring: ring ready (%u/%u entries, %sregistered "
+       "buffers)\n", params.sq_entries, params.cq_entries,
+       asyncUring.bufsRegistered ? "" : "no ");
+
+exit:
+   MXUser_ReleaseExclLock(initLock);
+
+   return asyncUring.active;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_IsActive --
+ * AsyncUring_GetFd --
+ *
+ *      Accessors.
+ *
+ * Results:
+ *      Whether the ring was set up; the ring fd or -1.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+AsyncUring_IsActive(void)
+{
+   return asyncUring.active;
+}
+
+int
+AsyncUring_GetFd(void)
+{
+   return asyncUring.active ? asyncUring.fd : -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_GetBuf --
+ * AsyncUring_PutBuf --
+ *
+ *      Take / return an ASYNC_URING_BUF_SIZE buffer. Buffers come from the
+ *      registered pool while it lasts, and from the heap afterwards.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May allocate memory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+AsyncUring_GetBuf(AsyncUringBuf *buf)   // OUT
+{
+   int idx = -1;
+
+   ASSERT(asyncUring.active);
+
+   MXUser_AcquireExclLock(asyncUring.lock);
+   if (asyncUring.numFreeBufs > 0) {
+      idx = asyncUring.freeBufs[--asyncUring.numFreeBufs];
+   }
+   MXUser_ReleaseExclLock(asyncUring.lock);
+
+   if (idx >= 0) {
+      buf->base = asyncUring.bufPool + idx * ASYNC_URING_BUF_SIZE;
+      buf->index = asyncUring.bufsRegistered ? idx : -1;
+   } else {
+      buf->base = Util_SafeMalloc(ASYNC_URING_BUF_SIZE);
+      buf->index = -1;
+   }
+}
+
+void
+AsyncUring_PutBuf(AsyncUringBuf *buf)   // IN/OUT
+{
+   uint8 *poolEnd = asyncUring.bufPool +
+                    ASYNC_URING_NUM_BUFS * ASYNC_URING_BUF_SIZE;
+
+   if (buf->base == NULL) {
+      return;
+   }
+
+   if (asyncUring.bufPool != NULL &&
+       buf->base >= asyncUring.bufPool && buf->base < poolEnd) {
+      MXUser_AcquireExclLock(asyncUring.lock);
+      ASSERT(asyncUring.numFreeBufs < ASYNC_URING_NUM_BUFS);
+      asyncUring.freeBufs[asyncUring.numFreeBufs++] =
+         (int)((buf->base - asyncUring.bufPool) / ASYNC_URING_BUF_SIZE);
+      MXUser_ReleaseExclLock(asyncUring.lock);
+   } else {
+      free(buf->base);
+   }
+   buf->base = NULL;
+   buf->index = -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringFlushLocked --
+ *
+ *      Hand all queued SQEs to the kernel.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      io_uring_enter(). On transient failures (EAGAIN, EBUSY) the SQEs
+ *      stay queued for the next flush.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncUringFlushLocked(void)
+{
+   while (asyncUring.sqPending > 0) {
+      int ret = AsyncUringEnter(asyncUring.sqPending, 0, 0);
+
+      if (ret > 0) {
+         ASSERT(ret <= asyncUring.sqPending);
+         asyncUring.sqPending -= ret;
+      } else if (ret < 0 && errno == EINTR) {
+         continue;
+      } else {
+         if (ret < 0) {
+            LOG(1, (ASOCKPREFIX "io_uring: submit deferred: %s\n",
+                    Err_Errno2String(errno)));
+         }
+         break;
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringMaybeFlushLocked --
+ *
+ *      Called after queueing SQEs. Submission is deferred while this thread
+ *      is dispatching completions, so that everything the callbacks queue
+ *      goes to the kernel in one go; otherwise it happens right away.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May call io_uring_enter().
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncUringMaybeFlushLocked(void)
+{
+   if (asyncUring.reapDepth > 0 &&
+       pthread_equal(asyncUring.reaper, pthread_self())) {
+      return;
+   }
+   AsyncUringFlushLocked();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringGetSqe --
+ *
+ *      Reserve the next SQE slot. The caller fills it in and then calls
+ *      AsyncUringCommitSqe.
+ *
+ * Results:
+ *      The SQE, or NULL if the submission queue is full even after
+ *      flushing.
+ *
+ * Side effects:
+ *      May call io_uring_enter().
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static struct io_uring_sqe *
+AsyncUringGetSqe(uint32 *tail)      // IN/OUT: next tail to publish
+{
+   struct io_uring_sqe *sqe;
+   uint32 head = __atomic_load_n(asyncUring.sqHead, __ATOMIC_ACQUIRE);
+
+   if (*tail - head >= asyncUring.sqEntries) {
+      AsyncUringFlushLocked();
+      head = __atomic_load_n(asyncUring.sqHead, __ATOMIC_ACQUIRE);
+      if (*tail - head >= asyncUring.sqEntries) {
+         return NULL;
+      }
+   }
+
+   sqe = &asyncUring.sqes[*tail & asyncUring.sqMask];
+   memset(sqe, 0, sizeof *sqe);
+   (*tail)++;
+
+   return sqe;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringRegisterPoll --
+ *
+ *      Install the Poll device callback that reaps the ring. Done on first
+ *      use rather than in AsyncUring_Init, which may run before the Poll
+ *      implementation is initialized.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Registers a periodic Poll callback.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void AsyncUringPollCallback(void *clientData);
+
+static void
+AsyncUringRegisterPoll(void)
+{
+   Bool doRegister;
+   VMwareStatus status;
+
+   MXUser_AcquireExclLock(asyncUring.lock);
+   doRegister = !asyncUring.pollRegistered;
+   asyncUring.pollRegistered = TRUE;
+   MXUser_ReleaseExclLock(asyncUring.lock);
+
+   if (doRegister) {
+      status = Poll_Callback(POLL_CS_MAIN,
+                             POLL_FLAG_READ | POLL_FLAG_PERIODIC,
+                             AsyncUringPollCallback, NULL, POLL_DEVICE,
+                             asyncUring.fd, NULL);
+      VERIFY(status == VMWARE_STATUS_SUCCESS);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringSubmit --
+ *
+ *      Queue one operation, optionally preceded by a linked POLL_ADD so
+ *      that it only runs once the fd is ready (used to retry operations
+ *      that completed with -EAGAIN).
+ *
+ * Results:
+ *      TRUE if queued.
+ *
+ * Side effects:
+ *      Marks the op in flight. May call io_uring_enter().
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+AsyncUringSubmit(AsyncUringOp *op,              // IN
+                 const struct io_uring_sqe *tmpl, // IN
+                 short pollEvents)              // IN: 0 for no linked poll
+{
+   struct io_uring_sqe *sqe;
+   uint32 tail;
+   Bool ok = FALSE;
+
+   ASSERT(asyncUring.active);
+   ASSERT(!op->inFlight);
+
+   if (UNLIKELY(!asyncUring.pollRegistered)) {
+      AsyncUringRegisterPoll();
+   }
+
+   MXUser_AcquireExclLock(asyncUring.lock);
+   tail = *asyncUring.sqTail;
+
+   if (pollEvents != 0) {
+      sqe = AsyncUringGetSqe(&tail);
+      if (sqe == NULL) {
+         goto exit;
+      }
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = tmpl->fd;
+      sqe->poll_events = pollEvents;
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = (uintptr_t)op | ASYNC_URING_POLL_TAG;
+   }
+
+   sqe = AsyncUringGetSqe(&tail);
+   if (sqe == NULL) {
+      goto exit;
+   }
+   *sqe = *tmpl;
+   sqe->user_data = (uintptr_t)op;
+
+   __atomic_store_n(asyncUring.sqTail, tail, __ATOMIC_RELEASE);
+   asyncUring.sqPending += pollEvents != 0 ? 2 : 1;
+   op->inFlight = TRUE;
+   ok = TRUE;
+
+   AsyncUringMaybeFlushLocked();
+
+exit:
+   MXUser_ReleaseExclLock(asyncUring.lock);
+   if (!ok) {
+      Log(ASOCKPREFIX "io_uring: submission queue full\n");
+   }
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_Read --
+ * AsyncUring_Send --
+ * AsyncUring_Connect --
+ *
+ *      Submit a read into a ring buffer, a send out of one, or a connect.
+ *      op->doneFn is called with the result once the operation completes.
+ *      Reads use IORING_OP_READ_FIXED when the buffer is registered. If
+ *      afterPoll is set, the operation waits for the fd to become
+ *      readable / writable first.
+ *
+ * Results:
+ *      TRUE if submitted, FALSE if the submission queue is full.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+AsyncUring_Read(AsyncUringOp *op,       // IN
+                int fd,                 // IN
+                AsyncUringBuf *buf,     // IN
+                int len,                // IN
+                Bool afterPoll)         // IN
+{
+   struct io_uring_sqe sqe;
+
+   ASSERT(len > 0 && len <= ASYNC_URING_BUF_SIZE);
+
+   memset(&sqe, 0, sizeof sqe);
+   sqe.fd = fd;
+   sqe.addr = (uintptr_t)buf->base;
+   sqe.len = len;
+   if (buf->index >= 0) {
+      sqe.opcode = IORING_OP_READ_FIXED;
+      sqe.buf_index = buf->index;
+   } else {
+      sqe.opcode = IORING_OP_RECV;
+   }
+
+   return AsyncUringSubmit(op, &sqe, afterPoll ? POLLIN : 0);
+}
+
+Bool
+AsyncUring_Send(AsyncUringOp *op,       // IN
+                int fd,                 // IN
+                AsyncUringBuf *buf,     // IN
+                int len,                // IN
+                Bool afterPoll)         // IN
+{
+   struct io_uring_sqe sqe;
+
+   ASSERT(len > 0 && len <= ASYNC_URING_BUF_SIZE);
+
+   memset(&sqe, 0, sizeof sqe);
+   sqe.opcode = IORING_OP_SEND;
+   sqe.fd = fd;
+   sqe.addr = (uintptr_t)buf->base;
+   sqe.len = len;
+   sqe.msg_flags = MSG_NOSIGNAL;
+
+   return AsyncUringSubmit(op, &sqe, afterPoll ? POLLOUT : 0);
+}
+
+Bool
+AsyncUring_Connect(AsyncUringOp *op,            // IN
+                   int fd,                      // IN
+                   const struct sockaddr *addr, // IN: valid until done
+                   socklen_t addrLen)           // IN
+{
+   struct io_uring_sqe sqe;
+
+   memset(&sqe, 0, sizeof sqe);
+   sqe.opcode = IORING_OP_CONNECT;
+   sqe.fd = fd;
+   sqe.addr = (uintptr_t)addr;
+   sqe.off = addrLen;
+
+   return AsyncUringSubmit(op, &sqe, 0);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_Cancel --
+ *
+ *      Ask the kernel to cancel an in-flight operation. The op still
+ *      completes through its doneFn, normally with -ECANCELED, so any
+ *      memory it references must stay valid until then.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May call io_uring_enter().
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+AsyncUring_Cancel(AsyncUringOp *op)     // IN
+{
+   int i;
+
+   if (!op->inFlight) {
+      return;
+   }
+
+   /*
+    * Cancel both the op and its linked poll, if any; whichever of the two
+    * the kernel is currently holding goes away and the op completes.
+    */
+   MXUser_AcquireExclLock(asyncUring.lock);
+   for (i = 0; i < 2; i++) {
+      uint32 tail = *asyncUring.sqTail;
+      struct io_uring_sqe *sqe = AsyncUringGetSqe(&tail);
+
+      if (sqe == NULL) {
+         Log(ASOCKPREFIX "io_uring: submission queue full, cancel lost\n");
+         break;
+      }
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = (uintptr_t)op | (i == 0 ? ASYNC_URING_POLL_TAG : 0);
+      sqe->user_data = ASYNC_URING_INTERNAL;
+      __atomic_store_n(asyncUring.sqTail, tail, __ATOMIC_RELEASE);
+      asyncUring.sqPending++;
+   }
+   AsyncUringMaybeFlushLocked();
+   MXUser_ReleaseExclLock(asyncUring.lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_Reap --
+ *
+ *      Dispatch all available completions, then submit whatever the
+ *      completion callbacks queued.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Calls completion callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+AsyncUring_Reap(void)
+{
+   int n;
+
+   if (!asyncUring.active) {
+      return;
+   }
+
+   do {
+      struct {
+         uint64 userData;
+         int res;
+      } done[ASYNC_URING_REAP_BATCH];
+      uint32 head;
+      uint32 tail;
+      int i;
+
+      MXUser_AcquireExclLock(asyncUring.lock);
+      head = *asyncUring.cqHead;
+      tail = __atomic_load_n(asyncUring.cqTail, __ATOMIC_ACQUIRE);
+      for (n = 0; head != tail && n < ARRAYSIZE(done); head++) {
+         struct io_uring_cqe *cqe = &asyncUring.cqes[head & asyncUring.cqMask];
+
+         if (cqe->user_data != ASYNC_URING_INTERNAL &&
+             (cqe->user_data & ASYNC_URING_POLL_TAG) == 0) {
+            done[n].userData = cqe->user_data;
+            done[n].res = cqe->res;
+            n++;
+         }
+      }
+      __atomic_store_n(asyncUring.cqHead, head, __ATOMIC_RELEASE);
+      if (asyncUring.reapDepth++ == 0) {
+         asyncUring.reaper = pthread_self();
+      }
+      MXUser_ReleaseExclLock(asyncUring.lock);
+
+      for (i = 0; i < n; i++) {
+         AsyncUringOp *op = (AsyncUringOp *)(uintptr_t)done[i].userData;
+
+         op->doneFn(op, done[i].res);
+      }
+
+      MXUser_AcquireExclLock(asyncUring.lock);
+      asyncUring.reapDepth--;
+      AsyncUringMaybeFlushLocked();
+      MXUser_ReleaseExclLock(asyncUring.lock);
+   } while (n == ASYNC_URING_REAP_BATCH);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUring_Wait --
+ *
+ *      Wait up to timeoutMS (-1 for ever) for completions and dispatch
+ *      them. Used by blocking helpers that need an operation to finish.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Calls completion callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+AsyncUring_Wait(int timeoutMS)          // IN
+{
+   struct pollfd pfd;
+
+   if (!asyncUring.active) {
+      return;
+   }
+
+   pfd.fd = asyncUring.fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   if (poll(&pfd, 1, timeoutMS) > 0) {
+      AsyncUring_Reap();
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncUringPollCallback --
+ *
+ *      Poll device callback for the ring fd.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Calls completion callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncUringPollCallback(void *clientData)        // IN: unused
+{
+   AsyncUring_Reap();
+}
@@ -0,0 +1,99 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*********************************************************
+ * The contents of this file are subject to the terms of the Common
+ * Development and Distribution License (the "License") version 1.0
+ * and no later version.  You may not use this file except in
+ * compliance with the License.
+ *
+ * You can obtain a copy of the License at
+ *         http://www.opensource.org/licenses/cddl1.php
+ *
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ *********************************************************/
+
+/*
+ * asyncSocketUring.h --
+ *
+ *      Process wide io_uring instance used by the AsyncTCPSocket data path
+ *      when the io_uring backend is enabled (see AsyncSocket_EnableIoUring).
+ *      Only available on Linux builds that found <linux/io_uring.h>.
+ */
+
+#ifndef __ASYNC_SOCKET_URING_H__
+#define __ASYNC_SOCKET_URING_H__
+
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#define ASOCK_URING 1
+#endif
+
+#ifdef ASOCK_URING
+
+#include <sys/socket.h>
+
+/*
+ * Size of each ring owned buffer. Matches the AsyncTCPSocket receive
+ * read-ahead buffer, which is backed by one of these in io_uring mode.
+ */
+#define ASYNC_URING_BUF_SIZE 16384
+
+typedef struct AsyncUringOp AsyncUringOp;
+
+/*
+ * Completion callback. Called from AsyncUring_Reap() without any lock
+ * held; res is the CQE result (bytes transferred or -errno). The callback
+ * owns the op again and must clear inFlight itself, under whatever lock
+ * protects the op.
+ */
+typedef void (*AsyncUringDoneFn)(AsyncUringOp *op, int res);
+
+struct AsyncUringOp {
+   AsyncUringDoneFn doneFn;
+   void *clientData;
+   Bool inFlight;
+};
+
+typedef struct AsyncUringBuf {
+   uint8 *base;
+   int index;        /* Registered buffer index, -1 if not registered. */
+} AsyncUringBuf;
+
+Bool AsyncUring_Init(void);
+Bool AsyncUring_IsActive(void);
+int AsyncUring_GetFd(void);
+
+void AsyncUring_GetBuf(AsyncUringBuf *buf);
+void AsyncUring_PutBuf(AsyncUringBuf *buf);
+
+Bool AsyncUring_Read(AsyncUringOp *op, int fd, AsyncUringBuf *buf, int len,
+                     Bool afterPoll);
+Bool AsyncUring_Send(AsyncUringOp *op, int fd, AsyncUringBuf *buf, int len,
+                     Bool afterPoll);
+Bool AsyncUring_Connect(AsyncUringOp *op, int fd,
+                        const struct sockaddr *addr, socklen_t addrLen);
+void AsyncUring_Cancel(AsyncUringOp *op);
+
+void AsyncUring_Reap(void);
+void AsyncUring_Wait(int timeoutMS);
+
+#endif // ASOCK_URING
+
+#endif // __ASYNC_SOCKET_URING_H__
@@ -129,6 +129,8 @@ typedef struct AsyncSocketVTable {
    int (*waitForConnection)(AsyncSocket *s, int timeoutMS);
    int (*waitForReadMultiple)(AsyncSocket **asock, int numSock, int timeoutMS,
                               int *outIdx);
+   int (*waitSetAdd)(AsyncSocket *asock, AsyncSocketWaitSet *waitSet);
+   int (*waitSetRemove)(AsyncSocket *asock, AsyncSocketWaitSet *waitSet);
 
 
    /*
@@ -72,13 +72,19 @@
 #include <sys/types.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 #endif
 
 #include "vmware.h"
@@ -86,11 +92,13 @@
 #include "random.h"
 #include "asyncsocket.h"
 #include "asyncSocketBase.h"
+#include "asyncSocketUring.h"
 #include "poll.h"
 #include "log.h"
 #include "err.h"
 #include "hostinfo.h"
 #include "util.h"
+#include "userlock.h"
 #include "msg.h"
 #include "posix.h"
 #include "vm_basic_asm.h"
@@ -152,6 +160,42 @@
  */
 #define ADDR_STRING_LEN (INET6_ADDRSTRLEN + 2 + PORT_STRING_LEN)
 
+/*
+ * Maximum number of queued send buffers handed to a single SSL_Writev().
+ */
+#ifndef _WIN32
+#ifdef IOV_MAX
+#define ASOCK_SEND_IOV_MAX MIN(IOV_MAX, 64)
+#else
+#define ASOCK_SEND_IOV_MAX 16
+#endif
+#endif
+
+/*
+ * Size of the per-socket receive read-ahead buffer. Callers that receive
+ * many small messages (headers, then bodies) otherwise pay one read()
+ * syscall per message.
+ */
+#define ASOCK_RECV_AHEAD_SIZE 16384
+
+/*
+ * Blocking helpers waiting for an io_uring completion re-check their
+ * socket at least this often, in case another thread reaped it.
+ */
+#define ASOCK_URING_WAIT_SLICE_MS 100
+
+/*
+ * Number of kernel readiness events AsyncSocket_WaitSetWait picks up per
+ * epoll_wait().
+ */
+#define ASOCK_WAITSET_BATCH 64
+
+/*
+ * AsyncTCPSocketWaitForReadMultiple waits on at least this many sockets
+ * through a wait set it keeps, instead of building a poll() array per call.
+ */
+#define ASOCK_WAITSET_READ_MULTIPLE_MIN 16
+
 
 /* Local types. */
 
@@ -230,9 +274,90 @@ typedef struct AsyncTCPSocket {
       int fd;
    } passFd;
 
+   /*
+    * Receive read-ahead buffer, see AsyncTCPSocketReadAhead. Only enabled
+    * for sockets that can not carry file descriptors. 'err' is an error
+    * that came after data already returned, for the next read.
+    */
+   struct {
+      Bool enabled;
+      uint8 *buf;
+      int start;
+      int count;
+      int err;
+   } recvAhead;
+
+#ifdef ASOCK_URING
+   /*
+    * io_uring data path, see AsyncSocket_EnableIoUring. Once engaged,
+    * recvAhead.buf is uring.recvBuf, filled by recvOp, and sendCb means
+    * that sendOp is in flight.
+    */
+   struct {
+      Bool allowed;
+      Bool engaged;
+      AsyncUringOp connectOp;
+      AsyncUringOp recvOp;
+      AsyncUringOp sendOp;
+      AsyncUringBuf recvBuf;
+      AsyncUringBuf sendBuf;
+      Bool recvEof;
+      int recvErrno;
+   } uring;
+#endif
+
+   /*
+    * Wait set membership, see AsyncSocket_WaitSetAdd. waitSetIdx and
+    * waitSetGen are only used by the thread waiting on the set.
+    * readMultipleSet is the set AsyncTCPSocketWaitForReadMultiple keeps
+    * for the sockets it is called with, when this one comes first.
+    */
+   AsyncSocketWaitSet *waitSet;
+   int waitSetIdx;
+   unsigned int waitSetGen;
+   Bool waitSetQueued;
+   AsyncSocketWaitSet *readMultipleSet;
+
 } AsyncTCPSocket;
 
 
+#ifndef _WIN32
+/*
+ * Persistent set of sockets to wait on, see AsyncSocket_WaitSetCreate.
+ */
+struct AsyncSocketWaitSet {
+   AsyncTCPSocket **members;      /* One reference each. */
+   int numMembers;
+   int maxMembers;
+   unsigned int gen;              /* See AsyncTCPSocketWaitForReadMultiple. */
+   AsyncTCPSocket *readMultipleOwner; /* Socket keeping this set for
+                                         AsyncTCPSocketWaitForReadMultiple,
+                                         NULL for AsyncSocket_WaitSetCreate
+                                         callers' sets. */
+   int queueTurn;                 /* 0 or 1, see AsyncSocket_WaitSetWait. */
+#ifdef __linux__
+   int epfd;
+   int wakeFd;                    /* eventfd, see AsyncTCPSocketWaitSetQueue. */
+   Bool ringAdded;                /* io_uring fd is in the epoll set. */
+#else
+   struct pollfd *pfd;            /* Two per member, for dual stack listeners. */
+#endif
+
+   /*
+    * Sockets that may have buffered data, one reference each: those the
+    * last wait returned, and those an io_uring receive completed for. The
+    * lock covers the queue, ringAdded and sleeping; io_uring completions
+    * may run on other threads.
+    */
+   MXUserExclLock *lock;
+   AsyncTCPSocket **queue;
+   int queueLen;
+   int queueMax;
+   Bool sleeping;
+};
+#endif
+
+
 
 /*
  * Local Functions
@@ -250,6 +375,7 @@ static int AsyncTCPSocketResolveAddr(const char *hostname,
 static AsyncTCPSocket *AsyncTCPSocketAttachToFd(
    int fd, AsyncSocketPollParams *pollParams, int *outError);
 static Bool AsyncTCPSocketHasDataPending(AsyncTCPSocket *asock);
+static int AsyncTCPSocketReadAhead(AsyncTCPSocket *s, void *buf, int len);
 static int AsyncTCPSocketMakeNonBlocking(int fd);
 static void AsyncTCPSocketAcceptCallback(void *clientData);
 static void AsyncTCPSocketConnectCallback(void *clientData);
@@ -354,6 +480,12 @@ static int AsyncTCPSocketSendBlocking(AsyncSocket *s, void *buf, int len,
 static int AsyncTCPSocketDoOneMsg(AsyncSocket *s, Bool read, int timeoutMS);
 static int AsyncTCPSocketWaitForReadMultiple(AsyncSocket **asock, int numSock,
                                              int timeoutMS, int *outIdx);
+#ifndef _WIN32
+static int AsyncTCPSocketWaitSetAdd(AsyncSocket *asock,
+                                    AsyncSocketWaitSet *waitSet);
+static int AsyncTCPSocketWaitSetRemove(AsyncSocket *asock,
+                                       AsyncSocketWaitSet *waitSet);
+#endif
 static int AsyncTCPSocketSetOption(AsyncSocket *asyncSocket,
                                    AsyncSocketOpts_Layer layer,
                                    AsyncSocketOpts_ID optID,
@@ -364,9 +496,28 @@ static int AsyncTCPSocketGetOption(AsyncSocket *asyncSocket,
                                    AsyncSocketOpts_ID optID,
                                    void *valuePtr,
                                    socklen_t *outBufLen);
+#ifdef ASOCK_URING
+static void AsyncTCPSocketUringConnectDone(AsyncUringOp *op, int res);
+static void AsyncTCPSocketUringRecvDone(AsyncUringOp *op, int res);
+static void AsyncTCPSocketUringSendDone(AsyncUringOp *op, int res);
+static void AsyncTCPSocketUringEngage(AsyncTCPSocket *s);
+static Bool AsyncTCPSocketUringDisallow(AsyncTCPSocket *s);
+static void AsyncTCPSocketUringArmRecv(AsyncTCPSocket *s, Bool afterPoll);
+static Bool AsyncTCPSocketUringSend(AsyncTCPSocket *s, Bool afterPoll);
+static Bool AsyncTCPSocketUringConnect(AsyncTCPSocket *s);
+static int AsyncTCPSocketUringWait(AsyncTCPSocket *s, AsyncUringOp *op,
+                                   int timeoutMS);
+static void AsyncTCPSocketUringCancel(AsyncTCPSocket *s);
+#endif
 static void AsyncTCPSocketListenerError(int error,
                                         AsyncSocket *asock,
                                         void *clientData);
+#ifndef _WIN32
+static Bool AsyncTCPSocketWaitSetCtl(AsyncTCPSocket *s, Bool add);
+static void AsyncTCPSocketWaitSetQueue(AsyncTCPSocket *s);
+static void AsyncTCPSocketWaitSetRemoveMember(AsyncTCPSocket *s);
+static void AsyncTCPSocketWaitSetRemoveAll(AsyncSocketWaitSet *waitSet);
+#endif
 
 
 /* Local constants. */
@@ -409,6 +560,13 @@ static const AsyncSocketVTable asyncTCPSocketVTable = {
    AsyncTCPSocketDoOneMsg,
    AsyncTCPSocketWaitForConnection,
    AsyncTCPSocketWaitForReadMultiple,
+#ifndef _WIN32
+   AsyncTCPSocketWaitSetAdd,
+   AsyncTCPSocketWaitSetRemove,
+#else
+   NULL,                        /* waitSetAdd */
+   NULL,                        /* waitSetRemove */
+#endif
    AsyncTCPSocketDestroy
 };
 
@@ -527,6 +685,16 @@ AsyncTCPSocketHandleError(AsyncTCPSocket *asock, int error)
    AsyncSocketHandleError(BaseSocket(asock), error);
 }
 
+static INLINE Bool
+AsyncTCPSocketUringEngaged(AsyncTCPSocket *asock)
+{
+#ifdef ASOCK_URING
+   return asock->uring.engaged;
+#else
+   return FALSE;
+#endif
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -577,6 +745,42 @@ AsyncTCPSocket_Init(void)
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocket_EnableIoUring --
+ *
+ *      Opt in to the io_uring data path (Linux only). Sockets created by
+ *      AsyncSocket_Connect*, accepted by a listener or wrapped by
+ *      AsyncSocket_AttachToFd afterwards submit their receives, sends and
+ *      connects to a process wide io_uring and are completed from its
+ *      completion queue instead of from Poll readiness callbacks.
+ *
+ *      Excluded, and still Poll driven: listening sockets, Unix domain
+ *      sockets (fd passing), SSL sockets and sockets using IVmdbPoll.
+ *      Existing sockets are not affected.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if the io_uring data path is available,
+ *      ASOCKERR_GENERIC if the kernel or the build does not support it.
+ *
+ * Side effects:
+ *      Creates the io_uring instance.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+AsyncSocket_EnableIoUring(void)
+{
+#ifdef ASOCK_URING
+   return AsyncUring_Init() ? ASOCKERR_SUCCESS : ASOCKERR_GENERIC;
+#else
+   return ASOCKERR_GENERIC;
+#endif
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -1991,6 +2195,17 @@ AsyncTCPSocketConnect(struct sockaddr_storage *addr,         // IN
     */
 
    AsyncTCPSocketLock(asock);
+#ifdef ASOCK_URING
+   if (asock->uring.allowed) {
+      /* The kernel reads the address when it gets to the connect. */
+      memcpy(&(asock->remoteAddr), addr, addrLen);
+      asock->remoteAddrLen = addrLen;
+
+      TCPSOCKLOG(1, asock, ("submitting io_uring connect\n"));
+      pollStatus = AsyncTCPSocketUringConnect(asock) ? VMWARE_STATUS_SUCCESS
+                                                     : VMWARE_STATUS_ERROR;
+   } else
+#endif
    if (connect(asock->fd, (struct sockaddr *)addr, addrLen) != 0) {
       if (ASOCK_LASTERROR() == ASOCK_ECONNECTING) {
          ASSERT(!(vmx86_server && addr->ss_family == AF_UNIX));
@@ -2158,6 +2373,25 @@ AsyncTCPSocketAttachToSSLSock(SSLSock sslSock,                   // IN
    SSL_SetCloseOnShutdownFlag(sslSock);
    TCPSOCKLOG(1, s, ("new asock id %u attached to fd %d\n", s->base.id, s->fd));
 
+   /*
+    * Read ahead on everything but Unix domain sockets: those may carry
+    * file descriptors (see AsyncSocket_RecvPassedFd), and an over-eager
+    * read would consume the ancillary data along with the payload.
+    */
+#ifndef _WIN32
+   {
+      struct sockaddr_storage addr;
+      socklen_t addrLen = sizeof addr;
+
+      if (getsockname(fd, (struct sockaddr *)&addr, &addrLen) == 0 &&
+          addr.ss_family != AF_UNIX) {
+         s->recvAhead.enabled = TRUE;
+      }
+   }
+#else
+   s->recvAhead.enabled = TRUE;
+#endif
+
    return s;
 
 error:
@@ -2209,6 +2443,22 @@ AsyncTCPSocketAttachToFd(int fd,                             // IN
    }
    asock = AsyncTCPSocketAttachToSSLSock(sslSock, pollParams, outError);
    if (asock) {
+#ifdef ASOCK_URING
+      /*
+       * Plain sockets we created or were handed may use io_uring; the
+       * switch happens on the first Recv/Send, see
+       * AsyncTCPSocketUringEngage.
+       */
+      asock->uring.allowed = AsyncUring_IsActive() &&
+                             asock->recvAhead.enabled &&
+                             AsyncTCPSocketPollParams(asock)->iPoll == NULL;
+      asock->uring.connectOp.doneFn = AsyncTCPSocketUringConnectDone;
+      asock->uring.connectOp.clientData = asock;
+      asock->uring.recvOp.doneFn = AsyncTCPSocketUringRecvDone;
+      asock->uring.recvOp.clientData = asock;
+      asock->uring.sendOp.doneFn = AsyncTCPSocketUringSendDone;
+      asock->uring.sendOp.clientData = asock;
+#endif
       return asock;
    }
    SSL_Shutdown(sslSock);
@@ -2294,6 +2544,20 @@ AsyncTCPSocketRegisterRecvCb(AsyncTCPSocket *asock) // IN:
 {
    int retVal = ASOCKERR_SUCCESS;
 
+#ifdef ASOCK_URING
+   if (asock->uring.engaged) {
+      /*
+       * Nothing to register with Poll: the receive completion fires the
+       * callback. It fails the socket if it can not be submitted, which is
+       * then reported through the RTime callback below.
+       */
+      asock->recvCb = TRUE;
+      if (!AsyncTCPSocketHasDataPending(asock)) {
+         AsyncTCPSocketUringArmRecv(asock, FALSE);
+      }
+   }
+#endif
+
    if (!asock->recvCb) {
       VMwareStatus pollStatus;
 
@@ -2415,6 +2679,12 @@ AsyncTCPSocketRecv(AsyncSocket *base,   // IN:
       return ASOCKERR_INVAL;
    }
 
+#ifdef ASOCK_URING
+   if (asock->uring.allowed && !asock->uring.engaged) {
+      AsyncTCPSocketUringEngage(asock);
+   }
+#endif
+
    retVal = AsyncTCPSocketRegisterRecvCb(asock);
    if (retVal != ASOCKERR_SUCCESS) {
       return retVal;
@@ -2475,6 +2745,92 @@ AsyncTCPSocketRecvPassedFd(AsyncSocket *base,   // IN/OUT: socket
 }
 
 
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketPollFds --
+ *
+ *      poll() for AsyncTCPSocketPollWork. Entries for sockets using io_uring
+ *      wait on the ring fd; if it fires, the completions are dispatched
+ *      before returning.
+ *
+ * Results:
+ *      As poll().
+ *
+ * Side effects:
+ *      May fire io_uring completion callbacks.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketPollFds(struct pollfd *pfd,   // IN/OUT
+                      int numSock,          // IN
+                      int timeoutMS)        // IN
+{
+   int retval = poll(pfd, numSock, timeoutMS);
+#ifdef ASOCK_URING
+   int ringFd = AsyncUring_GetFd();
+   int i;
+
+   for (i = 0; retval > 0 && ringFd != -1 && i < numSock; i++) {
+      if (pfd[i].fd == ringFd && pfd[i].revents != 0) {
+         int sysErr = errno;
+
+         AsyncUring_Reap();
+         errno = sysErr;
+         break;
+      }
+   }
+#endif
+
+   return retval;
+}
+#endif
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketLookupSockErr --
+ *
+ *      Record the pending error of a socket that poll() or epoll_wait()
+ *      flagged, in genericErrno.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Clears the socket's SO_ERROR.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketLookupSockErr(AsyncTCPSocket *asock)   // IN
+{
+   int sockErr = 0;
+   int sysErr;
+   int sockErrLen = sizeof sockErr;
+
+   if (getsockopt(asock->fd, SOL_SOCKET, SO_ERROR,
+                  (void *) &sockErr, (void *) &sockErrLen) == 0) {
+      if (sockErr) {
+         asock->genericErrno = sockErr;
+         TCPSOCKLG0(asock, ("%s: Socket error lookup returned %d: %s\n",
+                            __FUNCTION__, sockErr,
+                            Err_Errno2String(sockErr)));
+      }
+   } else {
+      sysErr = ASOCK_LASTERROR();
+      asock->genericErrno = sysErr;
+      TCPSOCKLG0(asock, ("%s: Last socket error %d: %s\n",
+                         __FUNCTION__, sysErr, Err_Errno2String(sysErr)));
+   }
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -2520,33 +2876,74 @@ AsyncTCPSocketPollWork(AsyncTCPSocket **asock,     // IN:
 #endif
    int i;
    int retval;
+#ifdef ASOCK_URING
+   Bool uring = FALSE;
+   VmTimeType deadline = 0;
+#endif
 
    ASSERT(outAsock != NULL && *outAsock == NULL && asock != NULL &&
           numSock > 0);
 
+#ifdef ASOCK_URING
    for (i = 0; i < numSock; i++) {
-      if (read && SSL_Pending(asock[i]->sslSock)) {
-         *outAsock = asock[i];
-         return ASOCKERR_SUCCESS;
-      }
+      uring |= asock[i]->uring.engaged;
+   }
+   if (uring && timeoutMS >= 0) {
+      deadline = Hostinfo_SystemTimerUS() / 1000 + timeoutMS;
    }
+#endif
 
    while (1) {
+#ifndef _WIN32
+      int waitMS = timeoutMS;
+#endif
+
+      for (i = 0; i < numSock; i++) {
+         if (read && AsyncTCPSocketHasDataPending(asock[i])) {
+            *outAsock = asock[i];
+            return ASOCKERR_SUCCESS;
+         }
+      }
+
 #ifndef _WIN32
       for (i = 0; i < numSock; i++) {
          pfd[i].fd = asock[i]->fd;
          pfd[i].events = read ? POLLIN : POLLOUT;
+#ifdef ASOCK_URING
+         /*
+          * Engaged sockets wait for their receive, or for the send in
+          * flight, to complete on the ring.
+          */
+         if (asock[i]->uring.engaged && (read || asock[i]->sendCb)) {
+            if (read) {
+               AsyncTCPSocketUringArmRecv(asock[i], FALSE);
+            }
+            pfd[i].fd = AsyncUring_GetFd();
+            pfd[i].events = POLLIN;
+         }
+#endif
+      }
+
+#ifdef ASOCK_URING
+      if (uring) {
+         waitMS = ASOCK_URING_WAIT_SLICE_MS;
+         if (timeoutMS >= 0) {
+            VmTimeType left = deadline - Hostinfo_SystemTimerUS() / 1000;
+
+            waitMS = MAX(0, MIN(waitMS, left));
+         }
       }
+#endif
 
       if (parentSock != NULL) {
          AsyncTCPSocketUnlock(parentSock);
-         retval = poll(pfd, numSock, timeoutMS);
+         retval = AsyncTCPSocketPollFds(pfd, numSock, waitMS);
          AsyncTCPSocketLock(parentSock);
       } else {
          for (i = numSock - 1; i >= 0; i--) {
             AsyncTCPSocketUnlock(asock[i]);
          }
-         retval = poll(pfd, numSock, timeoutMS);
+         retval = AsyncTCPSocketPollFds(pfd, numSock, waitMS);
          for (i = 0; i < numSock; i++) {
             AsyncTCPSocketLock(asock[i]);
          }
@@ -2582,6 +2979,13 @@ AsyncTCPSocketPollWork(AsyncTCPSocket **asock,     // IN:
 
       switch (retval) {
       case 0:
+#ifdef ASOCK_URING
+         if (uring && (timeoutMS < 0 ||
+                       Hostinfo_SystemTimerUS() / 1000 < deadline)) {
+            /* Only a wait slice ran out. */
+            continue;
+         }
+#endif
          /*
           * No sockets were ready within the specified time.
           */
@@ -2620,7 +3024,8 @@ AsyncTCPSocketPollWork(AsyncTCPSocket **asock,     // IN:
 
 #ifndef _WIN32
          for (i = 0; i < numSock; i++) {
-            if (pfd[i].revents & (POLLERR | POLLNVAL)) {
+            if ((pfd[i].revents & (POLLERR | POLLNVAL)) &&
+                pfd[i].fd == asock[i]->fd) {
                failed = TRUE;
             }
          }
@@ -2633,27 +3038,8 @@ AsyncTCPSocketPollWork(AsyncTCPSocket **asock,     // IN:
 #endif
 
          if (failed) {
-            int sockErr = 0;
-            int sysErr;
-            int sockErrLen = sizeof sockErr;
-
             for (i = 0; i < numSock; i++) {
-               if (getsockopt(asock[i]->fd, SOL_SOCKET, SO_ERROR,
-                              (void *) &sockErr, (void *) &sockErrLen) == 0) {
-                  if (sockErr) {
-                     asock[i]->genericErrno = sockErr;
-                     TCPSOCKLG0(asock[i],
-                              ("%s: Socket error lookup returned %d: %s\n",
-                               __FUNCTION__, sockErr,
-                               Err_Errno2String(sockErr)));
-                  }
-               } else {
-                  sysErr = ASOCK_LASTERROR();
-                  asock[i]->genericErrno = sysErr;
-                  TCPSOCKLG0(asock[i],
-                           ("%s: Last socket error %d: %s\n",
-                            __FUNCTION__, sysErr, Err_Errno2String(sysErr)));
-               }
+               AsyncTCPSocketLookupSockErr(asock[i]);
             }
 
             return ASOCKERR_GENERIC;
@@ -2666,11 +3052,26 @@ AsyncTCPSocketPollWork(AsyncTCPSocket **asock,     // IN:
 
 #ifndef _WIN32
          for (i = 0; i < numSock; i++) {
-            if (pfd[i].revents & (read ? POLLIN : POLLOUT)) {
+            if (pfd[i].fd != asock[i]->fd) {
+               /*
+                * Waited on the ring. A completed receive is picked up at the
+                * top of the loop; a completed send makes the socket ready.
+                */
+               if (!read && !asock[i]->sendCb) {
+                  *outAsock = asock[i];
+                  return ASOCKERR_SUCCESS;
+               }
+            } else if (pfd[i].revents & (read ? POLLIN : POLLOUT)) {
                *outAsock = asock[i];
                return ASOCKERR_SUCCESS;
             }
          }
+#ifdef ASOCK_URING
+         if (uring) {
+            /* Completions for other sockets. */
+            continue;
+         }
+#endif
 #else
          for (i = 0; i < numSock; i++) {
             if (FD_ISSET(asock[i]->fd, &rwfds)) {
@@ -2747,133 +3148,173 @@ AsyncTCPSocketPoll(AsyncTCPSocket *s,          // IN:
 }
 
 
+#ifdef __linux__
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketWaitForReadMultiple --
- *
- *      Blocks on the list of sockets until there's data readable or a
- *      timeout occurs.
+ * AsyncTCPSocketReadMultipleSetFree --
  *
- *      Please see the comment in asyncSocketInterface.c for more
- *      information about using this function.
+ *      Free a set AsyncTCPSocketWaitForReadMultiple kept for its owner.
  *
  * Results:
- *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on system call
- *        failures
- *      ASOCKERR_TIMEOUT if no sockets were ready with readable data.
+ *      None.
  *
  * Side effects:
- *      None.
+ *      All of the set's sockets leave it.
+ *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketWaitForReadMultiple(AsyncSocket **asock,   // IN:
-                                  int numSock,           // IN:
-                                  int timeoutMS,         // IN:
-                                  int *outIdx)           // OUT:
+static void
+AsyncTCPSocketReadMultipleSetFree(AsyncSocketWaitSet *ws)   // IN
 {
-   int i;
-   int err;
-   AsyncTCPSocket *outAsock  = NULL;
-#ifndef _WIN32
-   struct pollfd *p          = Util_SafeCalloc(numSock, sizeof *p);
-#else
-   void *p                   = NULL;
-#endif
+   AsyncTCPSocket *owner = ws->readMultipleOwner;
 
-   for (i = 0; i < numSock; i++) {
-      ASSERT(AsyncTCPSocketIsLocked(TCPSocket(asock[i])));
-   }
-   err = AsyncTCPSocketPollWork((AsyncTCPSocket **)asock, numSock, p, TRUE,
-                                timeoutMS, NULL, &outAsock);
-   for (i = numSock - 1; i >= 0; i--) {
-      AsyncTCPSocket *tcpAsock = TCPSocket(asock[i]);
-      if (outAsock == tcpAsock) {
-         *outIdx = i;
-      }
-   }
+   ASSERT(owner != NULL && owner->readMultipleSet == ws);
 
-   free(p);
-   return err;
+   AsyncTCPSocketLock(owner);
+   owner->readMultipleSet = NULL;
+   AsyncTCPSocketUnlock(owner);
+   AsyncSocket_WaitSetDestroy(ws);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketRecvBlocking --
- * AsyncTCPSocketRecvPartialBlocking --
- * AsyncTCPSocketSendBlocking --
+ * AsyncTCPSocketWaitForReadMultipleSet --
  *
- *      Implement "blocking + timeout" operations on the socket. These are
- *      simple wrappers around the AsyncTCPSocketBlockingWork function, which
- *      operates on the actual non-blocking socket, using poll to determine
- *      when it's ok to keep reading/writing. If we can't finish within the
- *      specified time, we give up and return the ASOCKERR_TIMEOUT error.
+ *      AsyncTCPSocketWaitForReadMultiple through a wait set kept by the
+ *      first socket, so that a caller waiting on the same sockets over and
+ *      over registers them with the kernel once instead of passing them all
+ *      to poll() on every call. Sockets the previous call waited on and
+ *      this one does not leave the set.
  *
- *      Note that if these are called from a callback and a lock is being
- *      used (pollParams.lock), the whole blocking operation takes place
- *      with that lock held.  Regardless, it is the caller's responsibility
- *      to make sure the synchronous and asynchronous operations do not mix.
+ *      The set is kept by the first socket. If the first socket has none,
+ *      but some of the sockets are still in the set kept for an earlier
+ *      call which listed them in another order, this call takes that set
+ *      over. Any socket still in another such set moves to this one; that
+ *      set is freed, and the sockets only it waited on leave it.
+ *
+ *      An error on a socket makes it ready; it is reported by the next
+ *      operation on that socket.
  *
  * Results:
- *      ASOCKERR_SUCCESS if we finished the operation, ASOCKERR_* error codes
- *      otherwise.
+ *      FALSE if the sockets can not all be waited on in a set, e.g. one is
+ *      in a set of the caller's or not connected: the caller falls back to
+ *      poll(). TRUE otherwise, with the result of the wait in *err.
  *
  * Side effects:
- *      Reads/writes the socket.
+ *      Creates, takes over or updates the first socket's set, may free
+ *      other sockets' sets.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketRecvBlocking(AsyncSocket *base,     // IN
-                           void *buf,             // OUT
-                           int len,               // IN
-                           int *received,         // OUT
-                           int timeoutMS)         // IN
+static Bool
+AsyncTCPSocketWaitForReadMultipleSet(AsyncSocket **asock,   // IN:
+                                     int numSock,           // IN:
+                                     int timeoutMS,         // IN:
+                                     int *outIdx,           // OUT:
+                                     int *err)              // OUT:
 {
-   AsyncTCPSocket *s = TCPSocket(base);
-   return AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received, timeoutMS,
-                                     FALSE);
-}
+   AsyncTCPSocket *first = TCPSocket(asock[0]);
+   AsyncSocketWaitSet *ws = first->readMultipleSet;
+   AsyncSocketWaitSet *stale = NULL;
+   AsyncSocket *ready;
+   int numReady;
+   int i;
 
-static int
-AsyncTCPSocketRecvPartialBlocking(AsyncSocket *base,     // IN
-                                  void *buf,             // OUT
-                                  int len,               // IN
-                                  int *received,         // OUT
-                                  int timeoutMS)         // IN
-{
-   AsyncTCPSocket *s = TCPSocket(base);
-   return AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received, timeoutMS,
-                                     TRUE);
-}
+   /* Check up front, so that nothing is registered for a set not used. */
+   for (i = 0; i < numSock; i++) {
+      AsyncTCPSocket *s = TCPSocket(asock[i]);
+      AsyncSocketState state = AsyncTCPSocketGetState(s);
 
-static int
-AsyncTCPSocketSendBlocking(AsyncSocket *base,         // IN
-                           void *buf,                 // OUT
-                           int len,                   // IN
-                           int *sent,                 // OUT
-                           int timeoutMS)             // IN
-{
-   AsyncTCPSocket *s = TCPSocket(base);
-   return AsyncTCPSocketBlockingWork(s, FALSE, buf, len, sent, timeoutMS, FALSE);
+      if ((s->waitSet != NULL && s->waitSet->readMultipleOwner == NULL) ||
+          (state != AsyncSocketConnected && state != AsyncSocketListening)) {
+         return FALSE;
+      }
+      if (stale == NULL) {
+         stale = s->waitSet;
+      }
+   }
+
+   if (ws == NULL && stale != NULL) {
+      /* Most likely the same sockets in another order: take the set over. */
+      ws = stale;
+      AsyncTCPSocketLock(ws->readMultipleOwner);
+      ws->readMultipleOwner->readMultipleSet = NULL;
+      AsyncTCPSocketUnlock(ws->readMultipleOwner);
+      ws->readMultipleOwner = first;
+      first->readMultipleSet = ws;
+   } else if (ws == NULL) {
+      ws = AsyncSocket_WaitSetCreate(NULL);
+      if (ws == NULL) {
+         return FALSE;
+      }
+      ws->readMultipleOwner = first;
+      first->readMultipleSet = ws;
+   }
+
+   ws->gen++;
+   for (i = 0; i < numSock; i++) {
+      AsyncTCPSocket *s = TCPSocket(asock[i]);
+
+      if (s->waitSet != NULL && s->waitSet != ws) {
+         AsyncTCPSocketReadMultipleSetFree(s->waitSet);
+      }
+      if (s->waitSet != ws &&
+          AsyncTCPSocketWaitSetAdd(asock[i], ws) != ASOCKERR_SUCCESS) {
+         /* Could not register it: keep the set, but empty. */
+         AsyncTCPSocketWaitSetRemoveAll(ws);
+
+         return FALSE;
+      }
+      s->waitSetGen = ws->gen;
+   }
+
+   /* Members are swapped down on removal; walk down to visit them all. */
+   for (i = ws->numMembers - 1; i >= 0; i--) {
+      AsyncTCPSocket *s = ws->members[i];
+
+      if (s->waitSetGen != ws->gen) {
+         AsyncTCPSocketLock(s);
+         AsyncTCPSocketWaitSetRemoveMember(s);
+         AsyncTCPSocketUnlock(s);
+      }
+   }
+
+   *err = AsyncSocket_WaitSetWait(ws, timeoutMS, &ready, 1, &numReady);
+   if (*err == ASOCKERR_SUCCESS) {
+      for (i = 0; i < numSock; i++) {
+         if (asock[i] == ready) {
+            *outIdx = i;
+            break;
+         }
+      }
+   }
+
+   return TRUE;
 }
+#endif
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketBlockingWork --
+ * AsyncTCPSocketWaitForReadMultiple --
  *
- *      Try to complete the specified read/write operation within the
- *      specified time.
+ *      Blocks on the list of sockets until there's data readable or a
+ *      timeout occurs. On Linux, long lists are waited on through a wait
+ *      set, see AsyncTCPSocketWaitForReadMultipleSet.
+ *
+ *      Please see the comment in asyncSocketInterface.c for more
+ *      information about using this function.
  *
  * Results:
- *      ASOCKERR_*.
+ *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on system call
+ *        failures
+ *      ASOCKERR_TIMEOUT if no sockets were ready with readable data.
  *
  * Side effects:
  *      None.
@@ -2881,882 +3322,894 @@ AsyncTCPSocketSendBlocking(AsyncSocket *base,         // IN
  */
 
 static int
-AsyncTCPSocketBlockingWork(AsyncTCPSocket *s,  // IN:
-                           Bool read,          // IN:
-                           void *buf,          // IN/OUT:
-                           int len,            // IN:
-                           int *completed,     // OUT:
-                           int timeoutMS,      // IN:
-                           Bool partial)       // IN:
+AsyncTCPSocketWaitForReadMultiple(AsyncSocket **asock,   // IN:
+                                  int numSock,           // IN:
+                                  int timeoutMS,         // IN:
+                                  int *outIdx)           // OUT:
 {
-   VmTimeType now, done;
-   int sysErr;
-
-   if (s == NULL || buf == NULL || len <= 0) {
-      Warning(ASOCKPREFIX "Recv called with invalid arguments!\n");
+   int i;
+   int err;
+   AsyncTCPSocket *outAsock  = NULL;
+#ifndef _WIN32
+   struct pollfd *p;
+#else
+   void *p                   = NULL;
+#endif
 
-      return ASOCKERR_INVAL;
+   for (i = 0; i < numSock; i++) {
+      ASSERT(AsyncTCPSocketIsLocked(TCPSocket(asock[i])));
    }
 
-   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
-      TCPSOCKWARN(s, ("recv called but state is not connected!\n"));
-      return ASOCKERR_NOTCONNECTED;
+#ifdef __linux__
+   if (numSock >= ASOCK_WAITSET_READ_MULTIPLE_MIN &&
+       AsyncTCPSocketWaitForReadMultipleSet(asock, numSock, timeoutMS,
+                                            outIdx, &err)) {
+      return err;
    }
+#endif
 
-   if (completed) {
-      *completed = 0;
+#ifndef _WIN32
+   p = Util_SafeCalloc(numSock, sizeof *p);
+#endif
+   err = AsyncTCPSocketPollWork((AsyncTCPSocket **)asock, numSock, p, TRUE,
+                                timeoutMS, NULL, &outAsock);
+   for (i = numSock - 1; i >= 0; i--) {
+      AsyncTCPSocket *tcpAsock = TCPSocket(asock[i]);
+      if (outAsock == tcpAsock) {
+         *outIdx = i;
+      }
    }
-   now = Hostinfo_SystemTimerUS() / 1000;
-   done = now + timeoutMS;
-   do {
-      int numBytes, error;
-      AsyncTCPSocket *asock = NULL;
 
-      if ((numBytes = read ? SSL_Read(s->sslSock, buf, len)
-                           : SSL_Write(s->sslSock, buf, len)) > 0) {
-         if (completed) {
-            *completed += numBytes;
-         }
-         len -= numBytes;
-         if (len == 0 || partial) {
-            return ASOCKERR_SUCCESS;
-         }
-         buf = (uint8*)buf + numBytes;
-      } else if (numBytes == 0) {
-         TCPSOCKLG0(s, ("blocking %s detected peer closed connection\n",
-                        read ? "recv" : "send"));
-         return ASOCKERR_REMOTE_DISCONNECT;
-      } else if ((sysErr = ASOCK_LASTERROR()) != ASOCK_EWOULDBLOCK) {
-         s->genericErrno = sysErr;
-         TCPSOCKWARN(s, ("blocking %s error %d: %s\n", read ? "recv" : "send",
-                         sysErr, Err_Errno2String(sysErr)));
+   free(p);
+   return err;
+}
 
-         return ASOCKERR_GENERIC;
-      }
 
-      now = Hostinfo_SystemTimerUS() / 1000;
-      if (now >= done && timeoutMS >= 0) {
-         return ASOCKERR_TIMEOUT;
-      }
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitSetFds --
+ *
+ *      The fds a wait set member is waited on with: its own, or those of
+ *      both listeners of a dual stack listener. Sockets using io_uring have
+ *      none; their receive completions queue them instead.
+ *
+ * Results:
+ *      Number of fds stored in fds.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-      /*
-       * Only call in to Poll if we weren't able to send/recv directly
-       * off the socket.  But always make sure that the call to Poll()
-       * is followed by a read/send.
-       */
-      error = AsyncTCPSocketPoll(s, read, done - now, &asock);
-      if (error != ASOCKERR_SUCCESS) {
-         return error;
+static int
+AsyncTCPSocketWaitSetFds(AsyncTCPSocket *s,    // IN
+                         int fds[2])           // OUT
+{
+   int n = 0;
+
+   if (s->fd != -1) {
+      if (!AsyncTCPSocketUringEngaged(s)) {
+         fds[n++] = s->fd;
       }
-      ASSERT(asock == s);
-   } while (TRUE);
+   } else {
+      if (s->listenAsock6 != NULL && s->listenAsock6->fd != -1) {
+         fds[n++] = s->listenAsock6->fd;
+      }
+      if (s->listenAsock4 != NULL && s->listenAsock4->fd != -1) {
+         fds[n++] = s->listenAsock4->fd;
+      }
+   }
+
+   return n;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketSend --
- *
- *      Queues the provided data for sending on the socket. If a send callback
- *      is provided, the callback is fired after the data has been written to
- *      the socket. Note that this only guarantees that the data has been
- *      copied to the transmit buffer, we make no promises about whether it
- *      has actually been transmitted, or received by the client, when the
- *      callback is fired.
+ * AsyncTCPSocketWaitSetCtl --
  *
- *      Send callbacks should also be able to deal with being called if none
- *      or only some of the queued buffer has been transmitted, since the send
- *      callbacks for any remaining buffers are fired by AsyncSocket_Close().
- *      This condition can be detected by checking the len parameter passed to
- *      the send callback.
+ *      Start or stop waiting on a member's fds. Sockets using io_uring get
+ *      the ring fd added to the set instead, and a receive in flight.
  *
  * Results:
- *      ASOCKERR_*.
+ *      FALSE if the fds could not be added, genericErrno is set.
  *
  * Side effects:
- *      May register poll callback or perform I/O.
+ *      None.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketSend(AsyncSocket *base,         // IN
-                   void *buf,                 // IN
-                   int len,                   // IN
-                   AsyncSocketSendFn sendFn,  // IN
-                   void *clientData)          // IN
+static Bool
+AsyncTCPSocketWaitSetCtl(AsyncTCPSocket *s,    // IN
+                         Bool add)             // IN
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
-   int retVal;
-   Bool bufferListWasEmpty = FALSE;
-   SendBufList **pcur;
-   SendBufList *newBuf;
+   AsyncSocketWaitSet *ws = s->waitSet;
+   int fds[2];
+   int n = AsyncTCPSocketWaitSetFds(s, fds);
+   int i;
 
-   /*
-    * Note: I think it should be fine to send with a length of zero and a
-    * buffer of NULL or any other garbage value.  However the code
-    * downstream of here is unprepared for it (silently misbehaves).  Hence
-    * the <= zero check instead of just a < zero check.  --Jeremy.
-    */
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(ws != NULL);
 
-   if (!buf || len <= 0) {
-      Warning(ASOCKPREFIX "Send called with invalid arguments!"
-              "buffer: %p length: %d\n", buf, len);
+#ifdef __linux__
+   for (i = 0; i < n; i++) {
+      struct epoll_event ev;
+
+      ev.events = EPOLLIN;
+      ev.data.ptr = s;
+      if (add) {
+         if (epoll_ctl(ws->epfd, EPOLL_CTL_ADD, fds[i], &ev) != 0) {
+            s->genericErrno = errno;
+            TCPSOCKWARN(s, ("epoll_ctl failed: %s\n",
+                            Err_Errno2String(s->genericErrno)));
+            while (i-- > 0) {
+               epoll_ctl(ws->epfd, EPOLL_CTL_DEL, fds[i], &ev);
+            }
 
-      return ASOCKERR_INVAL;
+            return FALSE;
+         }
+      } else {
+         /* May fail if the fd is already closed, which is fine. */
+         epoll_ctl(ws->epfd, EPOLL_CTL_DEL, fds[i], &ev);
+      }
    }
 
-   LOG(2, ("%s: sending %d bytes\n", __FUNCTION__, len));
-
-   ASSERT(AsyncTCPSocketIsLocked(asock));
-
-   /*
-    * In low-latency mode, we want to guard against recursive calls to
-    * Send from within the send callback, as these have the capacity
-    * to blow up the stack.  However some operations generate implicit
-    * sends (such as Close on a websocket) seem like they should be
-    * legal from the send callback.  So, allow a small degree of
-    * recursive use of the send callback to accomodate these internal
-    * paths.
-    */
-   ASSERT(asock->inLowLatencySendCb < 2);
+#ifdef ASOCK_URING
+   if (add && s->uring.engaged) {
+      MXUser_AcquireExclLock(ws->lock);
+      if (!ws->ringAdded) {
+         struct epoll_event ev;
 
-   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
-      TCPSOCKWARN(asock, ("send called but state is not connected!\n"));
-      return ASOCKERR_NOTCONNECTED;
+         ev.events = EPOLLIN;
+         ev.data.ptr = NULL;
+         ws->ringAdded = epoll_ctl(ws->epfd, EPOLL_CTL_ADD,
+                                   AsyncUring_GetFd(), &ev) == 0;
+      }
+      MXUser_ReleaseExclLock(ws->lock);
+      AsyncTCPSocketUringArmRecv(s, FALSE);
+   }
+#endif
+#else
+   {
+      struct pollfd *pfd = &ws->pfd[2 * s->waitSetIdx];
+
+      pfd[0].fd = -1;
+      pfd[1].fd = -1;
+      for (i = 0; add && i < n; i++) {
+         pfd[i].fd = fds[i];
+         pfd[i].events = POLLIN;
+         pfd[i].revents = 0;
+      }
    }
+#endif
 
-   /*
-    * Allocate and initialize new send buffer entry
-    */
-   newBuf = Util_SafeCalloc(1, sizeof *newBuf);
-   newBuf->buf = buf;
-   newBuf->len = len;
-   newBuf->sendFn = sendFn;
-   newBuf->clientData = clientData;
+   return TRUE;
+}
 
-   /*
-    * Append new send buffer to the tail of list.
-    */
-   *asock->sendBufTail = newBuf;
-   asock->sendBufTail = &(newBuf->next);
-   bufferListWasEmpty = (asock->sendBufList == newBuf);
 
-   if (bufferListWasEmpty && !asock->sendCb) {
-      if (asock->sendLowLatency) {
-         /*
-          * For low-latency sockets, call the callback directly from
-          * this thread.  It is non-blocking and will schedule device
-          * callbacks if necessary to complete the operation.
-          *
-          * Unfortunately we can't make this the default as current
-          * consumers of asyncsocket are not expecting the completion
-          * callback to be invoked prior to the call to
-          * AsyncTCPSocket_Send() returning.
-          */
-         asock->inLowLatencySendCb++;
-         asock->internalSendFn((void *)asock);
-         asock->inLowLatencySendCb--;
-      } else {
-#ifdef _WIN32
-         /*
-          * If the send buffer list was empty, we schedule a one-time
-          * callback to "prime" the output. This is necessary to
-          * support the FD_WRITE network event semantic for sockets on
-          * Windows (see WSAEventSelect documentation). The event
-          * won't signal unless a previous write() on the socket
-          * failed with WSAEWOULDBLOCK, so we have to perform at least
-          * one partial write before we can start polling for write.
-          *
-          * XXX: This can be a device callback once all poll
-          * implementations know to get around this Windows quirk.
-          * Both PollVMX and PollDefault already make 0-byte send() to
-          * force WSAEWOULDBLOCK.
-          */
-         if (AsyncTCPSocketPollAdd(asock, FALSE, 0, asock->internalSendFn,
-                                   AsyncTCPSocketPollParams(asock)->iPoll
-                                   != NULL ? 1 : 0)
-             != VMWARE_STATUS_SUCCESS) {
-            retVal = ASOCKERR_POLL;
-            TCPSOCKLOG(1, asock,
-                       ("Failed to register poll callback for send\n"));
-            goto outUndoAppend;
-         }
-         asock->sendCbTimer = TRUE;
-         asock->sendCb = TRUE;
-#else
-         if (AsyncTCPSocketPollAdd(asock, TRUE, POLL_FLAG_WRITE,
-                                   asock->internalSendFn)
-             != VMWARE_STATUS_SUCCESS) {
-            retVal = ASOCKERR_POLL;
-            TCPSOCKLOG(1, asock,
-                       ("Failed to register poll callback for send\n"));
-            goto outUndoAppend;
-         }
-         asock->sendCb = TRUE;
-#endif
-      }
-   }
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitSetQueue --
+ *
+ *      Have the next AsyncSocket_WaitSetWait look at a member that may have
+ *      data buffered, which its fd does not tell about. Wakes the waiting
+ *      thread if needed.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Takes a reference on the socket.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-   return ASOCKERR_SUCCESS;
+static void
+AsyncTCPSocketWaitSetQueue(AsyncTCPSocket *s)   // IN
+{
+   AsyncSocketWaitSet *ws = s->waitSet;
 
-outUndoAppend:
-   /*
-    * Remove the appended buffer from the sendBufList. We always append the
-    * buffer to the tail of the list.
-    */
-   pcur = &asock->sendBufList;
-   if (*pcur != NULL) {
-      if (!bufferListWasEmpty) {
-         do {
-            pcur = &((*pcur)->next);
-         } while ((*pcur)->next != NULL);
-      }
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(ws != NULL);
 
-      if ((*pcur)->buf == buf) {
-         free(*pcur);
-         *pcur = NULL;
-         asock->sendBufTail = pcur;
-      }
+   if (s->waitSetQueued) {
+      return;
+   }
+   AsyncTCPSocketAddRef(s);
+   s->waitSetQueued = TRUE;
+
+   MXUser_AcquireExclLock(ws->lock);
+   if (ws->queueLen == ws->queueMax) {
+      ws->queueMax = MAX(16, 2 * ws->queueMax);
+      ws->queue = Util_SafeRealloc(ws->queue,
+                                   ws->queueMax * sizeof *ws->queue);
    }
+   ws->queue[ws->queueLen++] = s;
+#ifdef __linux__
+   if (ws->sleeping) {
+      uint64 one = 1;
 
-   return retVal;
+      if (write(ws->wakeFd, &one, sizeof one) < 0) {
+         /* The counter can only be saturated, i.e. already signalled. */
+      }
+   }
+#endif
+   MXUser_ReleaseExclLock(ws->lock);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketResolveAddr --
+ * AsyncTCPSocketWaitSetRemoveMember --
  *
- *      Resolves a hostname and port.
+ *      Take a socket out of its wait set.
  *
  * Results:
- *      Zero upon success.  This returns whatever getaddrinfo() returns.
+ *      None.
  *
  * Side effects:
- *      None.
+ *      Drops the set's reference, which may free the socket.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketResolveAddr(const char *hostname,          // IN
-                          unsigned int port,             // IN
-                          int family,                    // IN
-                          Bool passive,                  // IN
-                          struct sockaddr_storage *addr, // OUT
-                          socklen_t *addrLen,            // OUT
-                          char **addrString)             // OUT
+static void
+AsyncTCPSocketWaitSetRemoveMember(AsyncTCPSocket *s)   // IN
 {
-   struct addrinfo hints;
-   struct addrinfo *aiTop = NULL;
-   struct addrinfo *aiIterator = NULL;
-   int getaddrinfoError = 0;
-   char portString[PORT_STRING_LEN];
-
-   ASSERT(NULL != addr);
+   AsyncSocketWaitSet *ws = s->waitSet;
+   AsyncTCPSocket *last;
 
-   if (port > MAX_UINT16) {
-      Log(ASOCKPREFIX "port number requested (%d) is out of range.\n", port);
-      return EAI_SERVICE;
-   }
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(ws != NULL && ws->members[s->waitSetIdx] == s);
 
-   Str_Sprintf(portString, sizeof(portString), "%d", port);
-   memset(&hints, 0, sizeof(hints));
-   hints.ai_family = family;
-   hints.ai_socktype = SOCK_STREAM;
-   if (passive) {
-      hints.ai_flags = AI_PASSIVE;
-   }
+   AsyncTCPSocketWaitSetCtl(s, FALSE);
 
-   getaddrinfoError = Posix_GetAddrInfo(hostname, portString, &hints, &aiTop);
-   if (0 != getaddrinfoError) {
-      Log(ASOCKPREFIX "getaddrinfo failed for host %s: %s\n", hostname,
-                      gai_strerror(getaddrinfoError));
-      goto bye;
-   }
+   last = ws->members[--ws->numMembers];
+   ws->members[s->waitSetIdx] = last;
+#ifndef __linux__
+   ws->pfd[2 * s->waitSetIdx] = ws->pfd[2 * ws->numMembers];
+   ws->pfd[2 * s->waitSetIdx + 1] = ws->pfd[2 * ws->numMembers + 1];
+#endif
+   last->waitSetIdx = s->waitSetIdx;
 
-   for (aiIterator = aiTop; NULL != aiIterator ; aiIterator =
-                                                       aiIterator->ai_next) {
-      if ((family == AF_UNSPEC && (aiIterator->ai_family == AF_INET ||
-                                   aiIterator->ai_family == AF_INET6)) ||
-          family == aiIterator->ai_family) {
-         if (addrString != NULL) {
-            char tempAddrString[ADDR_STRING_LEN];
-            static char unknownAddr[] = "(Unknown)";
-#if defined(_WIN32)
-            DWORD len = ARRAYSIZE(tempAddrString);
+   s->waitSet = NULL;
+   AsyncTCPSocketRelease(s);
+}
 
-            if (WSAAddressToStringA(aiIterator->ai_addr, aiIterator->ai_addrlen,
-                                    NULL, tempAddrString, &len)) {
-               *addrString = Util_SafeStrdup(unknownAddr);
-            } else {
-               *addrString = Util_SafeStrdup(tempAddrString);
-            }
-#else
 
-            if (aiIterator->ai_family == AF_INET &&
-                !inet_ntop(aiIterator->ai_family,
-                     &(((struct sockaddr_in *)aiIterator->ai_addr)->sin_addr),
-                     tempAddrString, INET6_ADDRSTRLEN)) {
-               *addrString = Util_SafeStrdup(unknownAddr);
-            } else if (aiIterator->ai_family == AF_INET6 &&
-                       !inet_ntop(aiIterator->ai_family,
-                  &(((struct sockaddr_in6 *)aiIterator->ai_addr)->sin6_addr),
-                  tempAddrString, INET6_ADDRSTRLEN)) {
-               *addrString = Util_SafeStrdup(unknownAddr);
-            } else {
-               *addrString = Str_SafeAsprintf(NULL, aiIterator->ai_family ==
-                                                    AF_INET6 ? "[%s]:%u" :
-                                                               "%s:%u",
-                                              tempAddrString, port);
-            }
-#endif
-         }
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitSetIsReady --
+ *
+ *      Whether a member is already in the batch AsyncSocket_WaitSetWait is
+ *      about to return.
+ *
+ * Results:
+ *      TRUE if it is.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-         memcpy(addr, aiIterator->ai_addr, aiIterator->ai_addrlen);
-         *addrLen = aiIterator->ai_addrlen;
+static Bool
+AsyncTCPSocketWaitSetIsReady(AsyncTCPSocket *s,       // IN
+                             AsyncSocket **ready,     // IN
+                             int numReady)            // IN
+{
+   int i;
 
-         break;
+   for (i = 0; i < numReady; i++) {
+      if (ready[i] == BaseSocket(s)) {
+         return TRUE;
       }
    }
 
-bye:
-   if (NULL != aiTop) {
-      Posix_FreeAddrInfo(aiTop);
-   }
+   return FALSE;
+}
 
-   return getaddrinfoError;
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitSetReport --
+ *
+ *      Add a ready member to the batch returned by AsyncSocket_WaitSetWait,
+ *      and queue it so that the next wait checks it for buffered data.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketWaitSetReport(AsyncTCPSocket *s,       // IN
+                            AsyncSocket **ready,     // IN/OUT
+                            int *numReady)           // IN/OUT
+{
+   AsyncTCPSocketWaitSetQueue(s);
+   if (!AsyncTCPSocketWaitSetIsReady(s, ready, *numReady)) {
+      ready[(*numReady)++] = BaseSocket(s);
+   }
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketFillRecvBuffer --
+ * AsyncTCPSocketWaitSetTakeQueue --
  *
- *      Called when an asock has data ready to be read via the poll callback.
+ *      Take the queue of members that may have data buffered, leaving it
+ *      empty. Called with the set's lock held.
  *
  * Results:
- *      ASOCKERR_SUCCESS if everything worked,
- *      ASOCKERR_REMOTE_DISCONNECT if peer closed connection gracefully,
- *      ASOCKERR_CLOSED if trying to read from a closed socket.
- *      ASOCKERR_GENERIC for other errors.
+ *      The number of queued members, *queue the array to pass to
+ *      AsyncTCPSocketWaitSetCheckQueued.
  *
  * Side effects:
- *      Reads data, could fire recv completion or trigger socket destruction.
+ *      None.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketFillRecvBuffer(AsyncTCPSocket *s)         // IN
+AsyncTCPSocketWaitSetTakeQueue(AsyncSocketWaitSet *ws,   // IN
+                               AsyncTCPSocket ***queue)  // OUT
 {
-   int recvd;
-   int needed;
-   int sysErr = 0;
-   int result;
-   int pending = 0;
+   int queueLen = ws->queueLen;
 
-   ASSERT(AsyncTCPSocketIsLocked(s));
-   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+   *queue = ws->queue;
+   ws->queue = NULL;
+   ws->queueLen = 0;
+   ws->queueMax = 0;
 
-   /*
-    * When a socket has received all its desired content and FillRecvBuffer is
-    * called again for the same socket, just return ASOCKERR_SUCCESS. The
-    * reason we need this hack is that if a client which registered a receive
-    * callback asynchronously later changes its mind to do it synchronously,
-    * (e.g. aioMgr wait function), then FillRecvBuffer can be potentially be
-    * called twice for the same receive event.
-    */
+   return queueLen;
+}
 
-   needed = s->base.recvLen - s->base.recvPos;
-   if (!s->base.recvBuf && needed == 0) {
-      return ASOCKERR_SUCCESS;
-   }
 
-   ASSERT(needed > 0);
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitSetCheckQueued --
+ *
+ *      Report the members of a queue taken by AsyncTCPSocketWaitSetTakeQueue
+ *      that have data buffered, up to maxReady, and queue them again.
+ *      Members already reported by this wait are queued again too. Others
+ *      are dropped from the queue, after making sure those using io_uring
+ *      have a receive in flight. Closed members (whose base was torn down
+ *      by AsyncSocket_Close) leave the set.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the queue.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-   AsyncTCPSocketAddRef(s);
+static void
+AsyncTCPSocketWaitSetCheckQueued(AsyncSocketWaitSet *ws,   // IN
+                                 AsyncTCPSocket **queue,   // IN
+                                 int queueLen,             // IN
+                                 AsyncSocket **ready,      // IN/OUT
+                                 int maxReady,             // IN
+                                 int *numReady)            // IN/OUT
+{
+   int i;
 
-   /*
-    * See comment in AsyncTCPSocket_Recv
-    */
+   for (i = 0; i < queueLen; i++) {
+      AsyncTCPSocket *s = queue[i];
 
-   s->inRecvLoop = TRUE;
-
-   do {
-
-      /*
-       * Try to read the remaining bytes to complete the current recv request.
-       */
-
-      if (s->passFd.expected) {
-         int fd;
-
-         recvd = SSL_RecvDataAndFd(s->sslSock,
-                                   (uint8 *) s->base.recvBuf +
-                                   s->base.recvPos,
-                                   needed, &fd);
-         if (fd != -1) {
-            s->passFd.fd = fd;
-            s->passFd.expected = FALSE;
+      AsyncTCPSocketLock(s);
+      s->waitSetQueued = FALSE;
+      if (s->waitSet == ws) {
+         if (!s->base.inited) {
+            AsyncTCPSocketWaitSetRemoveMember(s);
+         } else if (AsyncTCPSocketWaitSetIsReady(s, ready, *numReady)) {
+            AsyncTCPSocketWaitSetQueue(s);
+         } else if (AsyncTCPSocketHasDataPending(s)) {
+            if (*numReady < maxReady) {
+               AsyncTCPSocketWaitSetReport(s, ready, numReady);
+            } else {
+               AsyncTCPSocketWaitSetQueue(s);
+            }
          }
-      } else {
-         recvd = SSL_Read(s->sslSock,
-                          (uint8 *) s->base.recvBuf +
-                          s->base.recvPos,
-                          needed);
-      }
-      /*
-       * Do NOT make any system call directly or indirectly here
-       * unless you can preserve the system error number
-       */
-      if (recvd > 0) {
-         TCPSOCKLOG(3, s, ("need\t%d\trecv\t%d\tremain\t%d\n", needed, recvd,
-                           needed - recvd));
-         s->sslConnected = TRUE;
-         s->base.recvPos += recvd;
-         if (AsyncSocketCheckAndDispatchRecv(&s->base, &result)) {
-            goto exit;
+#ifdef ASOCK_URING
+         else if (s->uring.engaged &&
+                  AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
+            AsyncTCPSocketUringArmRecv(s, FALSE);
          }
-      } else if (recvd == 0) {
-         TCPSOCKLG0(s, ("recv detected client closed connection\n"));
-         /*
-          * We treat this as an error so that the owner can detect closing
-          * of connection by peer (via the error handler callback).
-          */
-         result = ASOCKERR_REMOTE_DISCONNECT;
-         goto exit;
-      } else if ((sysErr = ASOCK_LASTERROR()) == ASOCK_EWOULDBLOCK) {
-         TCPSOCKLOG(4, s, ("recv would block\n"));
-         break;
-      } else {
-         TCPSOCKLG0(s, ("recv error %d: %s\n", sysErr,
-                      Err_Errno2String(sysErr)));
-         s->genericErrno = sysErr;
-         result = ASOCKERR_GENERIC;
-         goto exit;
+#endif
       }
+      AsyncTCPSocketRelease(s);
+      AsyncTCPSocketUnlock(s);
+   }
+   free(queue);
+}
 
-      /*
-       * At this point, s->recvFoo have been updated to point to the
-       * next chained Recv buffer. By default we're done at this
-       * point, but we may want to continue if the SSL socket has data
-       * buffered in userspace already (SSL_Pending).
-       */
 
-      needed = s->base.recvLen - s->base.recvPos;
-      ASSERT(needed > 0);
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocket_WaitSetCreate --
+ *
+ *      Create an empty wait set: a persistent set of sockets to wait on for
+ *      readable data. Unlike AsyncSocket_WaitForReadMultiple, sockets are
+ *      registered once, ready sockets come back in batches and, on Linux
+ *      where the set is an epoll instance, a wait does not cost more with
+ *      more (idle) sockets in the set.
+ *
+ *      A wait set must only be used by one thread at a time. The sockets in
+ *      it may still be closed, or complete io_uring receives, elsewhere.
+ *
+ * Results:
+ *      The new wait set, or NULL with *outError set on failure.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-      pending = SSL_Pending(s->sslSock);
-      needed = MIN(needed, pending);
+AsyncSocketWaitSet *
+AsyncSocket_WaitSetCreate(int *outError)   // OUT: optional
+{
+   AsyncSocketWaitSet *ws = Util_SafeCalloc(1, sizeof *ws);
 
-   } while (needed);
+#ifdef __linux__
+   struct epoll_event ev;
+
+   ws->epfd = epoll_create1(EPOLL_CLOEXEC);
+   ws->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   ev.events = EPOLLIN;
+   ev.data.ptr = ws;
+   if (ws->epfd == -1 || ws->wakeFd == -1 ||
+       epoll_ctl(ws->epfd, EPOLL_CTL_ADD, ws->wakeFd, &ev) != 0) {
+      Warning(ASOCKPREFIX "Could not create wait set: %s\n",
+              Err_Errno2String(errno));
+      if (ws->epfd != -1) {
+         close(ws->epfd);
+      }
+      if (ws->wakeFd != -1) {
+         close(ws->wakeFd);
+      }
+      free(ws);
+      if (outError != NULL) {
+         *outError = ASOCKERR_GENERIC;
+      }
 
-   /*
-    * Reach this point only when previous SSL_Pending returns 0 or
-    * error is ASOCK_EWOULDBLOCK
-    */
+      return NULL;
+   }
+#endif
 
-   ASSERT(pending == 0 || sysErr == ASOCK_EWOULDBLOCK);
+   ws->lock = MXUser_CreateExclLock("asyncSocketWaitSetLock", RANK_UNRANKED);
 
-   /*
-    * Both a spurious wakeup and receiving any data even if it wasn't enough
-    * to fire the callback are both success.  We were ready and now
-    * presumably we aren't ready anymore.
-    */
+   return ws;
+}
 
-   result = ASOCKERR_SUCCESS;
 
-exit:
-   s->inRecvLoop = FALSE;
-   AsyncTCPSocketRelease(s);
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitSetRemoveAll --
+ *
+ *      Take all sockets out of a wait set.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Drops the set's references on its sockets.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-   return result;
+static void
+AsyncTCPSocketWaitSetRemoveAll(AsyncSocketWaitSet *waitSet)   // IN
+{
+   while (waitSet->numMembers > 0) {
+      AsyncTCPSocket *s = waitSet->members[waitSet->numMembers - 1];
+
+      AsyncTCPSocketLock(s);
+      AsyncTCPSocketWaitSetRemoveMember(s);
+      AsyncTCPSocketUnlock(s);
+   }
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketDispatchSentBuffer --
+ * AsyncSocket_WaitSetDestroy --
  *
- *      Pop off the head of the send buffer list and call its callback.
+ *      Take all sockets out of a wait set and free it. The sockets are
+ *      not closed.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Drops the set's references on its sockets.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketDispatchSentBuffer(AsyncTCPSocket *s)         // IN
+void
+AsyncSocket_WaitSetDestroy(AsyncSocketWaitSet *waitSet)   // IN
 {
-   int result = ASOCKERR_SUCCESS;
-
-   /*
-    * We're done with the current buffer, so pop it off and nuke it.
-    * We do the list management *first*, so that the list is in a
-    * consistent state.
-    */
+   AsyncSocket *ignored[1];
+   int numIgnored = 0;
+   AsyncTCPSocket **queue;
+   int queueLen;
 
-   SendBufList *head = s->sendBufList;
-   SendBufList tmp = *head;
-
-   s->sendBufList = head->next;
-   if (s->sendBufList == NULL) {
-      s->sendBufTail = &(s->sendBufList);
+   if (waitSet == NULL) {
+      return;
    }
-   s->sendPos = 0;
-   free(head);
 
-   if (tmp.sendFn) {
-      /*
-       * Firing the send completion cannot trigger immediate
-       * destruction of the socket because we hold a refCount across
-       * this and all other application callbacks.  If the socket is
-       * closed, however, we need to bubble the information up to the
-       * caller in the same way as we do in the Recv callback case.
-       */
-      ASSERT(s->base.refCount > 1);
-      tmp.sendFn(tmp.buf, tmp.len, BaseSocket(s), tmp.clientData);
-      if (AsyncTCPSocketGetState(s) == AsyncSocketClosed) {
-         TCPSOCKLG0(s, ("owner closed connection in send callback\n"));
-         result = ASOCKERR_CLOSED;
-      }
-   }
+   AsyncTCPSocketWaitSetRemoveAll(waitSet);
 
-   return result;
+   /* With no members left, this only drops the queue's references. */
+   MXUser_AcquireExclLock(waitSet->lock);
+   queueLen = AsyncTCPSocketWaitSetTakeQueue(waitSet, &queue);
+   MXUser_ReleaseExclLock(waitSet->lock);
+   AsyncTCPSocketWaitSetCheckQueued(waitSet, queue, queueLen, ignored, 0,
+                                    &numIgnored);
+
+#ifdef __linux__
+   close(waitSet->epfd);
+   close(waitSet->wakeFd);
+#else
+   free(waitSet->pfd);
+#endif
+   MXUser_DestroyExclLock(waitSet->lock);
+   free(waitSet->members);
+   free(waitSet);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketWriteBuffers --
+ * AsyncTCPSocketWaitSetAdd --
+ * AsyncTCPSocketWaitSetRemove --
  *
- *      The meat of AsyncTCPSocket's sending functionality.  This function
- *      actually writes to the wire assuming there's space in the buffers
- *      for the socket.
+ *      Add a connected or listening socket to a wait set, or take it out.
+ *      A socket can be in one wait set at most. Closed sockets leave their
+ *      set by themselves during the next wait.
  *
  * Results:
- *      ASOCKERR_SUCCESS if everything worked, else ASOCKERR_GENERIC.
+ *      ASOCKERR_SUCCESS, ASOCKERR_INVAL if the socket is in the wrong
+ *      state or set, ASOCKERR_GENERIC if it could not be added.
  *
  * Side effects:
- *      None.
+ *      The set holds a reference on its sockets.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketWriteBuffers(AsyncTCPSocket *s)         // IN
+AsyncTCPSocketWaitSetAdd(AsyncSocket *base,             // IN
+                         AsyncSocketWaitSet *waitSet)   // IN
 {
-   int result;
+   AsyncTCPSocket *s = TCPSocket(base);
+   AsyncSocketState state;
 
    ASSERT(AsyncTCPSocketIsLocked(s));
 
-   if (s->sendBufList == NULL) {
-      return ASOCKERR_SUCCESS;     /* Vacuously true */
+   state = AsyncTCPSocketGetState(s);
+   if (s->waitSet != NULL ||
+       (state != AsyncSocketConnected && state != AsyncSocketListening)) {
+      return ASOCKERR_INVAL;
    }
 
-   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
-      TCPSOCKWARN(s, ("write buffers on a disconnected socket!\n"));
-      return ASOCKERR_GENERIC;
+   if (waitSet->numMembers == waitSet->maxMembers) {
+      waitSet->maxMembers = MAX(16, 2 * waitSet->maxMembers);
+      waitSet->members = Util_SafeRealloc(waitSet->members,
+                                          waitSet->maxMembers *
+                                          sizeof *waitSet->members);
+#ifndef __linux__
+      waitSet->pfd = Util_SafeRealloc(waitSet->pfd, 2 * waitSet->maxMembers *
+                                      sizeof *waitSet->pfd);
+#endif
    }
 
+   s->waitSet = waitSet;
+   s->waitSetIdx = waitSet->numMembers;
+   if (!AsyncTCPSocketWaitSetCtl(s, TRUE)) {
+      s->waitSet = NULL;
+      return ASOCKERR_GENERIC;
+   }
+   waitSet->members[waitSet->numMembers++] = s;
    AsyncTCPSocketAddRef(s);
 
-   while (s->sendBufList && AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
-      SendBufList *head = s->sendBufList;
-      int error = 0;
-      int sent = 0;
-      int left = head->len - s->sendPos;
-      int sizeToSend = head->len;
+   if (AsyncTCPSocketHasDataPending(s)) {
+      AsyncTCPSocketWaitSetQueue(s);
+   }
 
-      sent = SSL_Write(s->sslSock,
-                       (uint8 *) head->buf + s->sendPos, left);
-      /*
-       * Do NOT make any system call directly or indirectly here
-       * unless you can preserve the system error number
-       */
-      if (sent > 0) {
-         TCPSOCKLOG(3, s, ("left\t%d\tsent\t%d\tremain\t%d\n",
-                        left, sent, left - sent));
-         s->sendBufFull = FALSE;
-         s->sslConnected = TRUE;
-         if ((s->sendPos += sent) == sizeToSend) {
-            result = AsyncTCPSocketDispatchSentBuffer(s);
-            if (result != ASOCKERR_SUCCESS) {
-               goto exit;
-            }
-         }
-      } else if (sent == 0) {
-         TCPSOCKLG0(s, ("socket write() should never return 0.\n"));
-         NOT_REACHED();
-      } else if ((error = ASOCK_LASTERROR()) != ASOCK_EWOULDBLOCK) {
-         TCPSOCKLG0(s, ("send error %d: %s\n", error, Err_Errno2String(error)));
-         s->genericErrno = error;
-         if (error == ASOCK_EPIPE || error == ASOCK_ECONNRESET) {
-            result = ASOCKERR_REMOTE_DISCONNECT;
-         } else {
-            result = ASOCKERR_GENERIC;
-         }
-         goto exit;
-      } else {
-         /*
-          * Ran out of space to send. This is actually successful completion
-          * (our contract obligates us to send as much data as space allows
-          * and we fulfilled that).
-          *
-          * Indicate send buffer is full.
-          */
+   return ASOCKERR_SUCCESS;
+}
 
-         s->sendBufFull = TRUE;
-         break;
-      }
-   }
 
-   result = ASOCKERR_SUCCESS;
+static int
+AsyncTCPSocketWaitSetRemove(AsyncSocket *base,             // IN
+                            AsyncSocketWaitSet *waitSet)   // IN
+{
+   AsyncTCPSocket *s = TCPSocket(base);
 
-exit:
-   AsyncTCPSocketRelease(s);
+   ASSERT(AsyncTCPSocketIsLocked(s));
 
-   return result;
+   if (s->waitSet != waitSet) {
+      return ASOCKERR_INVAL;
+   }
+   AsyncTCPSocketWaitSetRemoveMember(s);
+
+   return ASOCKERR_SUCCESS;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketAcceptInternal --
+ * AsyncSocket_WaitSetWait --
  *
- *      The meat of 'accept'.  This function can be invoked either via a
- *      poll callback or blocking. We call accept to get the new socket fd,
- *      create a new asock, and call the newFn callback previously supplied
- *      by the call to AsyncTCPSocket_Listen.
+ *      Wait until sockets in the set are ready for read, and return up to
+ *      maxReady of them. A socket is ready when it has data buffered, has
+ *      data or an EOF pending in the kernel, is in error (see
+ *      AsyncSocket_GetGenericErrno) or, for listeners, has a connection to
+ *      accept. Sockets returned are only guaranteed to stay valid until
+ *      the caller takes them out of the set or closes them.
+ *
+ *      Sockets with data buffered, which their fds do not tell about, do
+ *      not keep the others from being returned: while there are any, the
+ *      kernel is still polled, without sleeping, and the batch is shared.
+ *      The odd slot of the batch, and so all of a batch of one, goes to
+ *      either side in turn.
+ *
+ *      Sockets are not locked while waiting; as with
+ *      AsyncSocket_WaitForReadMultiple, callers must not mix this with
+ *      asynchronous receives on the same sockets.
  *
  * Results:
- *      ASOCKERR_SUCCESS if everything works, else an error code.
- *      ASOCKERR_GENERIC is returned to hide accept() system call's
- *        nitty-gritty, it implies that we should try accept() again and not
- *        report error to client.
- *      ASOCKERR_ACCEPT to report accept operation's error to client.
+ *      ASOCKERR_SUCCESS with *numReady > 0, ASOCKERR_TIMEOUT if no socket
+ *      got ready in time, ASOCKERR_GENERIC on system call failures.
  *
  * Side effects:
- *      Accepts on listening fd, creates new asock.
+ *      May dispatch io_uring completions.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketAcceptInternal(AsyncTCPSocket *s)         // IN
+int
+AsyncSocket_WaitSetWait(AsyncSocketWaitSet *waitSet,   // IN
+                        int timeoutMS,                 // IN
+                        AsyncSocket **ready,           // OUT
+                        int maxReady,                  // IN
+                        int *numReady)                 // OUT
 {
-   AsyncTCPSocket *newsock;
-   int sysErr;
-   int fd;
-   struct sockaddr_storage remoteAddr;
-   socklen_t remoteAddrLen = sizeof remoteAddr;
+   VmTimeType deadline = 0;
+#ifdef __linux__
+   struct epoll_event events[ASOCK_WAITSET_BATCH];
+#endif
 
-   ASSERT(AsyncTCPSocketIsLocked(s));
-   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketListening);
+   if (waitSet == NULL || ready == NULL || maxReady <= 0 ||
+       numReady == NULL) {
+      return ASOCKERR_INVAL;
+   }
 
-   if ((fd = accept(s->fd, (struct sockaddr *)&remoteAddr,
-                    &remoteAddrLen)) == -1) {
-      sysErr = ASOCK_LASTERROR();
-      s->genericErrno = sysErr;
-      if (sysErr == ASOCK_EWOULDBLOCK) {
-         TCPSOCKWARN(s, ("spurious accept notification\n"));
-#if TARGET_OS_IPHONE
-         /*
-          * For iOS, while the app is suspended and device's screen is locked,
-          * system will reclaim resources from underneath socket(see Apple
-          * Technical Note TN2277), the callback function AsyncTCPSocketAcceptCallback()
-          * will be invoked repeatedly, to deal with this issue, we need to
-          * handle error EWOULDBLOCK.
-          */
-         return ASOCKERR_ACCEPT;
-#else
-         return ASOCKERR_GENERIC;
-#endif
-#ifndef _WIN32
-         /*
-          * This sucks. Linux accept() can return ECONNABORTED for connections
-          * that closed before we got to actually call accept(), but Windows
-          * just ignores this case. So we have to special case for Linux here.
-          * We return ASOCKERR_GENERIC here because we still want to continue
-          * accepting new connections.
-          */
-
-      } else if (sysErr == ECONNABORTED) {
-         TCPSOCKLG0(s, ("accept: new connection was aborted\n"));
-
-         return ASOCKERR_GENERIC;
-#endif
-      } else {
-         TCPSOCKWARN(s, ("accept failed on fd %d, error %d: %s\n",
-                       s->fd, sysErr, Err_Errno2String(sysErr)));
-
-         return ASOCKERR_ACCEPT;
-      }
+   *numReady = 0;
+   if (timeoutMS >= 0) {
+      deadline = Hostinfo_SystemTimerUS() / 1000 + timeoutMS;
    }
 
-   if (remoteAddr.ss_family == AF_INET6 &&
-       AsyncTCPSocketOSVersionSupportsV4Mapped()) {
-      struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&remoteAddr;
-
-      /*
-       * Remote address should not be a V4MAPPED address. Validate for the rare
-       * case that IPV6_V6ONLY is not defined and V4MAPPED is enabled by
-       * default when setting up socket listener.
-       */
-
-      if (IN6_IS_ADDR_V4MAPPED(&(addr6->sin6_addr))) {
-         TCPSOCKWARN(s,
-                   ("accept rejected on fd %d due to a IPv4-mapped IPv6 "
-                    "remote connection address.\n", s->fd));
-         SSLGeneric_close(fd);
+   while (TRUE) {
+      AsyncTCPSocket **queue;
+      int queueLen;
+      int waitMS = -1;
+      int room;
+      int sysErr;
+      int n;
+      int i;
 
-         return ASOCKERR_ACCEPT;
+      if (timeoutMS >= 0) {
+         waitMS = MAX(0, deadline - Hostinfo_SystemTimerUS() / 1000);
       }
-   }
-
-   newsock = AsyncTCPSocketAttachToFd(fd, AsyncTCPSocketPollParams(s), NULL);
-   if (!newsock) {
-      SSLGeneric_close(fd);
-
-      return ASOCKERR_ACCEPT;
-   }
 
-   newsock->remoteAddr = remoteAddr;
-   newsock->remoteAddrLen = remoteAddrLen;
-   AsyncTCPSocketSetState(newsock, AsyncSocketConnected);
-   newsock->internalRecvFn = s->internalRecvFn;
-   newsock->internalSendFn = s->internalSendFn;
+      MXUser_AcquireExclLock(waitSet->lock);
+      queueLen = AsyncTCPSocketWaitSetTakeQueue(waitSet, &queue);
+      waitSet->sleeping = queueLen == 0 && waitMS != 0;
+      MXUser_ReleaseExclLock(waitSet->lock);
 
-   /*
-    * Fire the connect callback:
-    */
-   s->connectFn(BaseSocket(newsock), s->clientData);
+      room = maxReady;
+      if (queueLen > 0) {
+         waitMS = 0;
+         room -= MIN(queueLen, (maxReady + waitSet->queueTurn) / 2);
+         waitSet->queueTurn ^= 1;
+      }
 
-   return ASOCKERR_SUCCESS;
-}
+      n = 0;
+      sysErr = 0;
+      if (room > 0) {
+#ifdef __linux__
+         n = epoll_wait(waitSet->epfd, events,
+                        MIN(room, ASOCK_WAITSET_BATCH), waitMS);
+#else
+         n = poll(waitSet->pfd, 2 * waitSet->numMembers, waitMS);
+#endif
+         sysErr = errno;
+      }
 
+      MXUser_AcquireExclLock(waitSet->lock);
+      waitSet->sleeping = FALSE;
+      MXUser_ReleaseExclLock(waitSet->lock);
 
-/*
- *----------------------------------------------------------------------------
- *
- * AsyncTCPSocketConnectInternal --
- *
- *      The meat of connect.  This function is invoked either via a poll
- *      callback or the blocking API and verifies that connect() succeeded
- *      or reports is failure.  On success we call the registered 'new
- *      connection' function.
- *
- * Results:
- *      ASOCKERR_SUCCESS if it all worked out or ASOCKERR_GENERIC.
- *
- * Side effects:
- *      Creates new asock, fires newFn callback.
- *
- *----------------------------------------------------------------------------
- */
+#ifdef __linux__
+      for (i = 0; i < n; i++) {
+         AsyncTCPSocket *s = events[i].data.ptr;
 
-static int
-AsyncTCPSocketConnectInternal(AsyncTCPSocket *s)         // IN
-{
-   int optval = 0, optlen = sizeof optval, sysErr;
+         if (s == NULL) {
+#ifdef ASOCK_URING
+            /* Receive completions queue their sockets. */
+            AsyncUring_Reap();
+#endif
+            continue;
+         } else if (events[i].data.ptr == waitSet) {
+            uint64 count;
 
-   ASSERT(AsyncTCPSocketIsLocked(s));
-   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnecting);
+            if (read(waitSet->wakeFd, &count, sizeof count) < 0) {
+               /* Already drained; the queue is what matters. */
+            }
+            continue;
+         }
 
-   /* Remove when bug 859728 is fixed */
-   if (vmx86_server && s->remoteAddr.ss_family == AF_UNIX) {
-      goto done;
-   }
+         AsyncTCPSocketLock(s);
+         if (s->waitSet == waitSet) {
+            if (!s->base.inited) {
+               /* Leaves the set once this batch no longer refers to it. */
+               AsyncTCPSocketWaitSetQueue(s);
+            } else {
+               if ((events[i].events & EPOLLERR) && s->fd != -1) {
+                  AsyncTCPSocketLookupSockErr(s);
+               }
+               AsyncTCPSocketWaitSetReport(s, ready, numReady);
+            }
+         }
+         AsyncTCPSocketUnlock(s);
+      }
+#else
+      for (i = 0; n > 0 && i < 2 * waitSet->numMembers && *numReady < room;
+           i++) {
+         AsyncTCPSocket *s = waitSet->members[i / 2];
 
-   if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR,
-                  (void *) &optval, (void *)&optlen) != 0) {
-      sysErr = ASOCK_LASTERROR();
-      s->genericErrno = sysErr;
-      Warning(ASOCKPREFIX "getsockopt for connect on fd %d failed with "
-              "error %d : %s\n", s->fd, sysErr, Err_Errno2String(sysErr));
+         if (waitSet->pfd[i].fd == -1 || waitSet->pfd[i].revents == 0) {
+            continue;
+         }
 
-      return ASOCKERR_GENERIC;
-   }
+         AsyncTCPSocketLock(s);
+         if (!s->base.inited) {
+            AsyncTCPSocketWaitSetQueue(s);
+         } else {
+            if ((waitSet->pfd[i].revents & (POLLERR | POLLNVAL)) &&
+                s->fd != -1) {
+               AsyncTCPSocketLookupSockErr(s);
+            }
+            AsyncTCPSocketWaitSetReport(s, ready, numReady);
+         }
+         AsyncTCPSocketUnlock(s);
+      }
+#endif
 
-   if (optval != 0) {
-      s->genericErrno = optval;
-      TCPSOCKLOG(1, s, ("connection SO_ERROR: %s\n", Err_Errno2String(optval)));
+      AsyncTCPSocketWaitSetCheckQueued(waitSet, queue, queueLen, ready,
+                                       maxReady, numReady);
+      if (*numReady > 0) {
+         return ASOCKERR_SUCCESS;
+      }
 
-      return ASOCKERR_GENERIC;
-   }
+      if (n < 0) {
+         if (sysErr == EINTR) {
+            continue;
+         }
+         Warning(ASOCKPREFIX "%s: Failed with error %d: %s\n", __FUNCTION__,
+                 sysErr, Err_Errno2String(sysErr));
 
-   s->localAddrLen = sizeof s->localAddr;
-   if (getsockname(s->fd, (struct sockaddr *)&s->localAddr,
-                   &s->localAddrLen) != 0) {
-      sysErr = ASOCK_LASTERROR();
-      s->genericErrno = sysErr;
-      Warning(ASOCKPREFIX "getsockname for connect on fd %d failed with "
-              "error %d: %s\n", s->fd, sysErr, Err_Errno2String(sysErr));
+         return ASOCKERR_GENERIC;
+      }
 
-      return ASOCKERR_GENERIC;
+      if (timeoutMS >= 0 && Hostinfo_SystemTimerUS() / 1000 >= deadline) {
+         return ASOCKERR_TIMEOUT;
+      }
    }
-
-done:
-   AsyncTCPSocketSetState(s, AsyncSocketConnected);
-   s->connectFn(BaseSocket(s), s->clientData);
-
-   return ASOCKERR_SUCCESS;
 }
+#endif // _WIN32
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketGetGenericErrno --
+ * AsyncTCPSocketRecvBlocking --
+ * AsyncTCPSocketRecvPartialBlocking --
+ * AsyncTCPSocketSendBlocking --
  *
- *      Used when an ASOCKERR_GENERIC is returned due to a system error.
- *      The errno that was returned by the system is stored in the asock
- *      struct and returned to the user in this function.
+ *      Implement "blocking + timeout" operations on the socket. These are
+ *      simple wrappers around the AsyncTCPSocketBlockingWork function, which
+ *      operates on the actual non-blocking socket, using poll to determine
+ *      when it's ok to keep reading/writing. If we can't finish within the
+ *      specified time, we give up and return the ASOCKERR_TIMEOUT error.
  *
- *      XXX: This function is not thread-safe.  The errno should be returned
- *      in a parameter to any function that can return ASOCKERR_GENERIC.
+ *      Note that if these are called from a callback and a lock is being
+ *      used (pollParams.lock), the whole blocking operation takes place
+ *      with that lock held.  Regardless, it is the caller's responsibility
+ *      to make sure the synchronous and asynchronous operations do not mix.
  *
  * Results:
- *      int error code
+ *      ASOCKERR_SUCCESS if we finished the operation, ASOCKERR_* error codes
+ *      otherwise.
  *
  * Side effects:
- *      None
+ *      Reads/writes the socket.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketGetGenericErrno(AsyncSocket *base)  // IN:
+AsyncTCPSocketRecvBlocking(AsyncSocket *base,     // IN
+                           void *buf,             // OUT
+                           int len,               // IN
+                           int *received,         // OUT
+                           int timeoutMS)         // IN
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
-   ASSERT(asock);
-   return asock->genericErrno;
+   AsyncTCPSocket *s = TCPSocket(base);
+   return AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received, timeoutMS,
+                                     FALSE);
+}
+
+static int
+AsyncTCPSocketRecvPartialBlocking(AsyncSocket *base,     // IN
+                                  void *buf,             // OUT
+                                  int len,               // IN
+                                  int *received,         // OUT
+                                  int timeoutMS)         // IN
+{
+   AsyncTCPSocket *s = TCPSocket(base);
+   return AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received, timeoutMS,
+                                     TRUE);
+}
+
+static int
+AsyncTCPSocketSendBlocking(AsyncSocket *base,         // IN
+                           void *buf,                 // OUT
+                           int len,                   // IN
+                           int *sent,                 // OUT
+                           int timeoutMS)             // IN
+{
+   AsyncTCPSocket *s = TCPSocket(base);
+   return AsyncTCPSocketBlockingWork(s, FALSE, buf, len, sent, timeoutMS, FALSE);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketWaitForConnection --
+ * AsyncTCPSocketBlockingWork --
  *
- *      Spins a socket currently listening or connecting until the
- *      connection completes or the allowed time elapses.
+ *      Try to complete the specified read/write operation within the
+ *      specified time.
  *
  * Results:
- *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on failures, and
- *      ASOCKERR_TIMEOUT if nothing happened in the allotted time.
+ *      ASOCKERR_*.
  *
  * Side effects:
  *      None.
@@ -3764,257 +4217,1893 @@ AsyncTCPSocketGetGenericErrno(AsyncSocket *base)  // IN:
  */
 
 static int
-AsyncTCPSocketWaitForConnection(AsyncSocket *base,  // IN:
-                                int timeoutMS)      // IN:
+AsyncTCPSocketBlockingWork(AsyncTCPSocket *s,  // IN:
+                           Bool read,          // IN:
+                           void *buf,          // IN/OUT:
+                           int len,            // IN:
+                           int *completed,     // OUT:
+                           int timeoutMS,      // IN:
+                           Bool partial)       // IN:
 {
-   AsyncTCPSocket *s = TCPSocket(base);
-   Bool read = FALSE;
-   int error;
    VmTimeType now, done;
-   Bool removed = FALSE;
+   int sysErr;
 
-   ASSERT(AsyncTCPSocketIsLocked(s));
+   if (s == NULL || buf == NULL || len <= 0) {
+      Warning(ASOCKPREFIX "Recv called with invalid arguments!\n");
 
-   if (AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
-      return ASOCKERR_SUCCESS;
+      return ASOCKERR_INVAL;
    }
 
-   if (AsyncTCPSocketGetState(s) != AsyncSocketListening &&
-       AsyncTCPSocketGetState(s) != AsyncSocketConnecting) {
-      return ASOCKERR_GENERIC;
+   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
+      TCPSOCKWARN(s, ("recv called but state is not connected!\n"));
+      return ASOCKERR_NOTCONNECTED;
    }
 
-   read = AsyncTCPSocketGetState(s) == AsyncSocketListening;
+   if (completed) {
+      *completed = 0;
+   }
 
+#ifdef ASOCK_URING
    /*
-    * For listening sockets, unregister AsyncTCPSocketAcceptCallback before
-    * starting polling and re-register before returning.
-    *
-    * ConnectCallback() is either registered as a device or rtime callback
-    * depending on the prior return value of connect(). So we try to remove it
-    * from both.
+    * Blocking sends write the socket directly; let queued io_uring sends
+    * go first so that the stream stays in order.
     */
-   if (read) {
-      if (s->fd == -1) {
-         if (s->listenAsock4) {
-            ASSERT(AsyncTCPSocketIsLocked(s->listenAsock4));
-            AsyncTCPSocketCancelListenCb(s->listenAsock4);
-         }
-         if (s->listenAsock6) {
-            ASSERT(AsyncTCPSocketIsLocked(s->listenAsock6));
-            AsyncTCPSocketCancelListenCb(s->listenAsock6);
-         }
-      } else {
-         AsyncTCPSocketCancelListenCb(s);
-      }
+   if (!read && s->uring.engaged && (s->sendBufList || s->sendCb)) {
+      int error = AsyncTCPSocketFlush(BaseSocket(s), timeoutMS);
 
-      removed = TRUE;
-   } else {
-      removed = (AsyncTCPSocketPollRemove(s, TRUE, POLL_FLAG_WRITE,
-                                          AsyncTCPSocketConnectCallback) ||
-                 AsyncTCPSocketPollRemove(s, FALSE, 0,
-                                          AsyncTCPSocketConnectCallback));
-      ASSERT(removed);
-      if (s->internalConnectFn) {
-         removed = AsyncTCPSocketPollRemove(s, FALSE, POLL_FLAG_PERIODIC,
-                                            AsyncTCPSocketConnectErrorCheck);
-         ASSERT(removed);
-         s->internalConnectFn = NULL;
+      if (error != ASOCKERR_SUCCESS) {
+         return error;
       }
    }
+#endif
 
    now = Hostinfo_SystemTimerUS() / 1000;
    done = now + timeoutMS;
-
    do {
+      int numBytes, error;
       AsyncTCPSocket *asock = NULL;
 
-      error = AsyncTCPSocketPoll(s, read, done - now, &asock);
-      if (error != ASOCKERR_SUCCESS) {
-         goto out;
-      }
-
-      now = Hostinfo_SystemTimerUS() / 1000;
-
       if (read) {
-         if (AsyncTCPSocketAcceptInternal(asock) != ASOCKERR_SUCCESS) {
-            TCPSOCKLG0(s, ("wait for connection: accept failed\n"));
-
-            /*
-             * Just fall through, we'll loop and try again as long as we still
-             * have time remaining.
-             */
-
-         } else {
-            error = ASOCKERR_SUCCESS;
-            goto out;
-         }
+         numBytes = s->recvAhead.enabled ? AsyncTCPSocketReadAhead(s, buf, len)
+                                         : SSL_Read(s->sslSock, buf, len);
       } else {
-         error = AsyncTCPSocketConnectInternal(asock);
-         goto out;
+         numBytes = SSL_Write(s->sslSock, buf, len);
       }
-   } while ((now < done && timeoutMS > 0) || (timeoutMS < 0));
-
-   error = ASOCKERR_TIMEOUT;
-
-out:
-   if (read && removed) {
-      if (s->fd == -1) {
-         if (s->listenAsock4 &&
-             AsyncTCPSocketGetState(s->listenAsock4) != AsyncSocketClosed) {
-            if (!AsyncTCPSocketAddListenCb(s->listenAsock4)) {
-               error = ASOCKERR_POLL;
-            }
-         }
-
-         if (s->listenAsock6 &&
-             AsyncTCPSocketGetState(s->listenAsock6) != AsyncSocketClosed) {
-            if (!AsyncTCPSocketAddListenCb(s->listenAsock6)) {
-               error = ASOCKERR_POLL;
-            }
+      if (numBytes > 0) {
+         if (completed) {
+            *completed += numBytes;
          }
-      } else if (AsyncTCPSocketGetState(s) != AsyncSocketClosed) {
-         if (!AsyncTCPSocketAddListenCb(s)) {
-            error = ASOCKERR_POLL;
+         len -= numBytes;
+         if (len == 0 || partial) {
+            return ASOCKERR_SUCCESS;
          }
+         buf = (uint8*)buf + numBytes;
+      } else if (numBytes == 0) {
+         TCPSOCKLG0(s, ("blocking %s detected peer closed connection\n",
+                        read ? "recv" : "send"));
+         return ASOCKERR_REMOTE_DISCONNECT;
+      } else if ((sysErr = ASOCK_LASTERROR()) != ASOCK_EWOULDBLOCK) {
+         s->genericErrno = sysErr;
+         TCPSOCKWARN(s, ("blocking %s error %d: %s\n", read ? "recv" : "send",
+                         sysErr, Err_Errno2String(sysErr)));
+
+         return ASOCKERR_GENERIC;
       }
-   }
 
-   return error;
+      now = Hostinfo_SystemTimerUS() / 1000;
+      if (now >= done && timeoutMS >= 0) {
+         return ASOCKERR_TIMEOUT;
+      }
+
+      /*
+       * Only call in to Poll if we weren't able to send/recv directly
+       * off the socket.  But always make sure that the call to Poll()
+       * is followed by a read/send.
+       */
+      error = AsyncTCPSocketPoll(s, read, done - now, &asock);
+      if (error != ASOCKERR_SUCCESS) {
+         return error;
+      }
+      ASSERT(asock == s);
+   } while (TRUE);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketDoOneMsg --
+ * AsyncTCPSocketSend --
  *
- *      Spins a socket until the specified amount of time has elapsed or
- *      data has arrived / been sent.
+ *      Queues the provided data for sending on the socket. If a send callback
+ *      is provided, the callback is fired after the data has been written to
+ *      the socket. Note that this only guarantees that the data has been
+ *      copied to the transmit buffer, we make no promises about whether it
+ *      has actually been transmitted, or received by the client, when the
+ *      callback is fired.
+ *
+ *      Send callbacks should also be able to deal with being called if none
+ *      or only some of the queued buffer has been transmitted, since the send
+ *      callbacks for any remaining buffers are fired by AsyncSocket_Close().
+ *      This condition can be detected by checking the len parameter passed to
+ *      the send callback.
  *
  * Results:
- *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on system call
- *         failures
- *      ASOCKERR_BUSY if another thread is in the read callback.
- *      ASOCKERR_TIMEOUT if nothing happened in the allotted time.
+ *      ASOCKERR_*.
  *
  * Side effects:
- *      None.
+ *      May register poll callback or perform I/O.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketDoOneMsg(AsyncSocket *base, // IN
-                       Bool read,         // IN
-                       int timeoutMS)     // IN
+AsyncTCPSocketSend(AsyncSocket *base,         // IN
+                   void *buf,                 // IN
+                   int len,                   // IN
+                   AsyncSocketSendFn sendFn,  // IN
+                   void *clientData)          // IN
 {
-   AsyncTCPSocket *s = TCPSocket(base);
-   AsyncTCPSocket *asock = NULL;
+   AsyncTCPSocket *asock = TCPSocket(base);
    int retVal;
+   Bool bufferListWasEmpty = FALSE;
+   SendBufList **pcur;
+   SendBufList *newBuf;
 
-   ASSERT(AsyncTCPSocketIsLocked(s));
-   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+   /*
+    * Note: I think it should be fine to send with a length of zero and a
+    * buffer of NULL or any other garbage value.  However the code
+    * downstream of here is unprepared for it (silently misbehaves).  Hence
+    * the <= zero check instead of just a < zero check.  --Jeremy.
+    */
 
-   if (read) {
-      if (s->inRecvLoop) {
-         /*
-          * The recv loop would read the data if there is any and it is
-          * not safe to proceed and race with the recv loop.
-          */
-         TCPSOCKLG0(s, ("busy: another thread in recv loop\n"));
-         return ASOCKERR_BUSY;
-      }
+   if (!buf || len <= 0) {
+      Warning(ASOCKPREFIX "Send called with invalid arguments!"
+              "buffer: %p length: %d\n", buf, len);
 
-      /*
-       * Bug 158571: There could other threads polling on the same asyncsocket.
-       * If two threads land up polling  on the same socket at the same time,
-       * the first thread to be scheduled reads the data from the socket,
-       * while the second one blocks infinitely. This hangs the VM. To prevent
-       * this, we temporarily remove the poll callback and then reinstate it
-       * after reading the data.
-       */
+      return ASOCKERR_INVAL;
+   }
 
-      ASSERT(s->recvCb); /* We are supposed to call someone... */
-      AsyncTCPSocketAddRef(s);
-      AsyncTCPSocketCancelRecvCb(s);
-      s->recvCb = TRUE;  /* We need to know if the callback cancel recv. */
+   LOG(2, ("%s: sending %d bytes\n", __FUNCTION__, len));
 
-      s->inBlockingRecv++;
-      retVal = AsyncTCPSocketPoll(s, read, timeoutMS, &asock);
-      if (retVal != ASOCKERR_SUCCESS) {
-         if (retVal == ASOCKERR_GENERIC) {
-            TCPSOCKWARN(s, ("%s: failed to poll on the socket during read.\n",
-                       __FUNCTION__));
-         }
-      } else {
-         ASSERT(asock == s);
-         retVal = AsyncTCPSocketFillRecvBuffer(s);
-      }
-      s->inBlockingRecv--;
+   ASSERT(AsyncTCPSocketIsLocked(asock));
 
-      /*
-       * If socket got closed in AsyncTCPSocketFillRecvBuffer, we
-       * cannot add poll callback - AsyncSocket_Close() would remove
-       * it if we would not remove it above.
-       */
+   /*
+    * In low-latency mode, we want to guard against recursive calls to
+    * Send from within the send callback, as these have the capacity
+    * to blow up the stack.  However some operations generate implicit
+    * sends (such as Close on a websocket) seem like they should be
+    * legal from the send callback.  So, allow a small degree of
+    * recursive use of the send callback to accomodate these internal
+    * paths.
+    */
+   ASSERT(asock->inLowLatencySendCb < 2);
 
-      if (AsyncTCPSocketGetState(s) != AsyncSocketClosed && s->recvCb) {
-         ASSERT(s->base.refCount > 1); /* We shouldn't be last user of socket. */
-         ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
-         /*
-          * If AsyncTCPSocketPoll or AsyncTCPSocketFillRecvBuffer fails, do not
-          * add the recv callback as it may never fire.
-          */
-         s->recvCb = FALSE;  /* For re-registering the poll callback. */
-         if (retVal == ASOCKERR_SUCCESS || retVal == ASOCKERR_TIMEOUT) {
-            retVal = AsyncTCPSocketRegisterRecvCb(s);
-            Log("SOCKET reregister recvCb after DoOneMsg (ref %d)\n",
-                BaseSocket(s)->refCount);
-         }
-         if (retVal != ASOCKERR_SUCCESS) {
-            s->base.recvBuf = NULL;
-         }
-      }
-      AsyncTCPSocketRelease(s);
-   } else {
-      AsyncTCPSocketAddRef(s);
-      retVal = AsyncTCPSocketPoll(s, read, timeoutMS, &asock);
-      if (retVal != ASOCKERR_SUCCESS) {
-         if (retVal == ASOCKERR_GENERIC) {
-            TCPSOCKWARN(s, ("%s: failed to poll on the socket during write.\n",
-                            __FUNCTION__));
-         }
-      } else {
-         ASSERT(asock == s);
-         retVal = AsyncTCPSocketWriteBuffers(s);
-      }
-      AsyncTCPSocketRelease(s);
+   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
+      TCPSOCKWARN(asock, ("send called but state is not connected!\n"));
+      return ASOCKERR_NOTCONNECTED;
    }
 
-   return retVal;
-}
+#ifdef ASOCK_URING
+   if (asock->uring.allowed && !asock->uring.engaged) {
+      AsyncTCPSocketUringEngage(asock);
+   }
+#endif
 
+   /*
+    * Allocate and initialize new send buffer entry
+    */
+   newBuf = Util_SafeCalloc(1, sizeof *newBuf);
+   newBuf->buf = buf;
+   newBuf->len = len;
+   newBuf->sendFn = sendFn;
+   newBuf->clientData = clientData;
 
-/*
- *----------------------------------------------------------------------------
- *
+   /*
+    * Append new send buffer to the tail of list.
+    */
+   *asock->sendBufTail = newBuf;
+   asock->sendBufTail = &(newBuf->next);
+   bufferListWasEmpty = (asock->sendBufList == newBuf);
+
+   if (bufferListWasEmpty && !asock->sendCb) {
+#ifdef ASOCK_URING
+      if (asock->uring.engaged) {
+         /*
+          * Low-latency sockets submit right away. Otherwise, like the
+          * Poll write callback, a one-time callback gathers everything
+          * queued until it runs into a single io_uring send; submitting
+          * each small Send on its own leaves the tail to Nagle.
+          */
+         if (asock->sendLowLatency) {
+            if (!AsyncTCPSocketUringSend(asock, FALSE)) {
+               retVal = ASOCKERR_POLL;
+               TCPSOCKLOG(1, asock, ("Failed to submit io_uring send\n"));
+               goto outUndoAppend;
+            }
+         } else {
+            if (AsyncTCPSocketPollAdd(asock, FALSE, 0, asock->internalSendFn,
+                                      0) != VMWARE_STATUS_SUCCESS) {
+               retVal = ASOCKERR_POLL;
+               TCPSOCKLOG(1, asock,
+                          ("Failed to register poll callback for send\n"));
+               goto outUndoAppend;
+            }
+            asock->sendCbTimer = TRUE;
+            asock->sendCb = TRUE;
+         }
+      } else
+#endif
+      if (asock->sendLowLatency) {
+         /*
+          * For low-latency sockets, call the callback directly from
+          * this thread.  It is non-blocking and will schedule device
+          * callbacks if necessary to complete the operation.
+          *
+          * Unfortunately we can't make this the default as current
+          * consumers of asyncsocket are not expecting the completion
+          * callback to be invoked prior to the call to
+          * AsyncTCPSocket_Send() returning.
+          */
+         asock->inLowLatencySendCb++;
+         asock->internalSendFn((void *)asock);
+         asock->inLowLatencySendCb--;
+      } else {
+#ifdef _WIN32
+         /*
+          * If the send buffer list was empty, we schedule a one-time
+          * callback to "prime" the output. This is necessary to
+          * support the FD_WRITE network event semantic for sockets on
+          * Windows (see WSAEventSelect documentation). The event
+          * won't signal unless a previous write() on the socket
+          * failed with WSAEWOULDBLOCK, so we have to perform at least
+          * one partial write before we can start polling for write.
+          *
+          * XXX: This can be a device callback once all poll
+          * implementations know to get around this Windows quirk.
+          * Both PollVMX and PollDefault already make 0-byte send() to
+          * force WSAEWOULDBLOCK.
+          */
+         if (AsyncTCPSocketPollAdd(asock, FALSE, 0, asock->internalSendFn,
+                                   AsyncTCPSocketPollParams(asock)->iPoll
+                                   != NULL ? 1 : 0)
+             != VMWARE_STATUS_SUCCESS) {
+            retVal = ASOCKERR_POLL;
+            TCPSOCKLOG(1, asock,
+                       ("Failed to register poll callback for send\n"));
+            goto outUndoAppend;
+         }
+         asock->sendCbTimer = TRUE;
+         asock->sendCb = TRUE;
+#else
+         if (AsyncTCPSocketPollAdd(asock, TRUE, POLL_FLAG_WRITE,
+                                   asock->internalSendFn)
+             != VMWARE_STATUS_SUCCESS) {
+            retVal = ASOCKERR_POLL;
+            TCPSOCKLOG(1, asock,
+                       ("Failed to register poll callback for send\n"));
+            goto outUndoAppend;
+         }
+         asock->sendCb = TRUE;
+#endif
+      }
+   }
+
+   return ASOCKERR_SUCCESS;
+
+outUndoAppend:
+   /*
+    * Remove the appended buffer from the sendBufList. We always append the
+    * buffer to the tail of the list.
+    */
+   pcur = &asock->sendBufList;
+   if (*pcur != NULL) {
+      if (!bufferListWasEmpty) {
+         do {
+            pcur = &((*pcur)->next);
+         } while ((*pcur)->next != NULL);
+      }
+
+      if ((*pcur)->buf == buf) {
+         free(*pcur);
+         *pcur = NULL;
+         asock->sendBufTail = pcur;
+      }
+   }
+
+   return retVal;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketResolveAddr --
+ *
+ *      Resolves a hostname and port.
+ *
+ * Results:
+ *      Zero upon success.  This returns whatever getaddrinfo() returns.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketResolveAddr(const char *hostname,          // IN
+                          unsigned int port,             // IN
+                          int family,                    // IN
+                          Bool passive,                  // IN
+                          struct sockaddr_storage *addr, // OUT
+                          socklen_t *addrLen,            // OUT
+                          char **addrString)             // OUT
+{
+   struct addrinfo hints;
+   struct addrinfo *aiTop = NULL;
+   struct addrinfo *aiIterator = NULL;
+   int getaddrinfoError = 0;
+   char portString[PORT_STRING_LEN];
+
+   ASSERT(NULL != addr);
+
+   if (port > MAX_UINT16) {
+      Log(ASOCKPREFIX "port number requested (%d) is out of range.\n", port);
+      return EAI_SERVICE;
+   }
+
+   Str_Sprintf(portString, sizeof(portString), "%d", port);
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = family;
+   hints.ai_socktype = SOCK_STREAM;
+   if (passive) {
+      hints.ai_flags = AI_PASSIVE;
+   }
+
+   getaddrinfoError = Posix_GetAddrInfo(hostname, portString, &hints, &aiTop);
+   if (0 != getaddrinfoError) {
+      Log(ASOCKPREFIX "getaddrinfo failed for host %s: %s\n", hostname,
+                      gai_strerror(getaddrinfoError));
+      goto bye;
+   }
+
+   for (aiIterator = aiTop; NULL != aiIterator ; aiIterator =
+                                                       aiIterator->ai_next) {
+      if ((family == AF_UNSPEC && (aiIterator->ai_family == AF_INET ||
+                                   aiIterator->ai_family == AF_INET6)) ||
+          family == aiIterator->ai_family) {
+         if (addrString != NULL) {
+            char tempAddrString[ADDR_STRING_LEN];
+            static char unknownAddr[] = "(Unknown)";
+#if defined(_WIN32)
+            DWORD len = ARRAYSIZE(tempAddrString);
+
+            if (WSAAddressToStringA(aiIterator->ai_addr, aiIterator->ai_addrlen,
+                                    NULL, tempAddrString, &len)) {
+               *addrString = Util_SafeStrdup(unknownAddr);
+            } else {
+               *addrString = Util_SafeStrdup(tempAddrString);
+            }
+#else
+
+            if (aiIterator->ai_family == AF_INET &&
+                !inet_ntop(aiIterator->ai_family,
+                     &(((struct sockaddr_in *)aiIterator->ai_addr)->sin_addr),
+                     tempAddrString, INET6_ADDRSTRLEN)) {
+               *addrString = Util_SafeStrdup(unknownAddr);
+            } else if (aiIterator->ai_family == AF_INET6 &&
+                       !inet_ntop(aiIterator->ai_family,
+                  &(((struct sockaddr_in6 *)aiIterator->ai_addr)->sin6_addr),
+                  tempAddrString, INET6_ADDRSTRLEN)) {
+               *addrString = Util_SafeStrdup(unknownAddr);
+            } else {
+               *addrString = Str_SafeAsprintf(NULL, aiIterator->ai_family ==
+                                                    AF_INET6 ? "[%s]:%u" :
+                                                               "%s:%u",
+                                              tempAddrString, port);
+            }
+#endif
+         }
+
+         memcpy(addr, aiIterator->ai_addr, aiIterator->ai_addrlen);
+         *addrLen = aiIterator->ai_addrlen;
+
+         break;
+      }
+   }
+
+bye:
+   if (NULL != aiTop) {
+      Posix_FreeAddrInfo(aiTop);
+   }
+
+   return getaddrinfoError;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketReadAhead --
+ *
+ *      SSL_Read() replacement that reads the socket in ASOCK_RECV_AHEAD_SIZE
+ *      chunks and serves small requests out of the per-socket read-ahead
+ *      buffer.
+ *
+ *      The buffer is not a ring: it is only refilled once empty. A request
+ *      larger than what is buffered takes the buffered bytes and then reads
+ *      the socket for the rest, so a message that straddles the end of the
+ *      buffer still costs a single read() and no extra poll wakeup. The rest
+ *      of a request at least as large as the buffer is read directly into
+ *      the caller's buffer.
+ *
+ * Results:
+ *      Same as SSL_Read(): bytes copied, 0 on EOF, -1 on error with the
+ *      system error number preserved. An error that comes after some bytes
+ *      were copied is returned by the next call.
+ *
+ * Side effects:
+ *      Allocates the read-ahead buffer on first use.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketReadAhead(AsyncTCPSocket *s,   // IN
+                        void *buf,           // OUT
+                        int len)             // IN
+{
+   int copied;
+   int n;
+
+   ASSERT(s->recvAhead.enabled);
+   ASSERT(len > 0);
+
+   copied = MIN(len, s->recvAhead.count);
+   if (copied > 0) {
+      memcpy(buf, s->recvAhead.buf + s->recvAhead.start, copied);
+      s->recvAhead.start += copied;
+      s->recvAhead.count -= copied;
+      if (copied == len) {
+         return copied;
+      }
+   }
+
+   if (s->recvAhead.err != 0) {
+      ASSERT(copied == 0);
+#ifdef _WIN32
+      WSASetLastError(s->recvAhead.err);
+#else
+      errno = s->recvAhead.err;
+#endif
+      s->recvAhead.err = 0;
+
+      return -1;
+   }
+
+#ifdef ASOCK_URING
+   /*
+    * With io_uring the buffer is only ever filled by the receive
+    * completion; an empty buffer means "would block" until then.
+    */
+   if (s->uring.engaged) {
+      if (copied > 0) {
+         return copied;
+      }
+      if (s->uring.recvEof) {
+         return 0;
+      }
+      AsyncTCPSocketUringArmRecv(s, FALSE);
+      errno = s->uring.recvErrno != 0 ? s->uring.recvErrno : EWOULDBLOCK;
+
+      return -1;
+   }
+#endif
+
+   if (len - copied >= ASOCK_RECV_AHEAD_SIZE) {
+      n = SSL_Read(s->sslSock, (char *)buf + copied, len - copied);
+   } else {
+      if (s->recvAhead.buf == NULL) {
+         s->recvAhead.buf = Util_SafeMalloc(ASOCK_RECV_AHEAD_SIZE);
+      }
+      n = SSL_Read(s->sslSock, (char *)s->recvAhead.buf,
+                   ASOCK_RECV_AHEAD_SIZE);
+      if (n > 0) {
+         s->recvAhead.start = MIN(len - copied, n);
+         s->recvAhead.count = n - s->recvAhead.start;
+         memcpy((char *)buf + copied, s->recvAhead.buf, s->recvAhead.start);
+         n = s->recvAhead.start;
+      }
+   }
+
+   if (n > 0) {
+      return copied + n;
+   }
+   if (copied == 0) {
+      return n;
+   }
+
+   /*
+    * Return what was buffered. EOF is seen again by the next read, but a
+    * socket error is only reported once.
+    */
+   if (n < 0 && ASOCK_LASTERROR() != ASOCK_EWOULDBLOCK) {
+      s->recvAhead.err = ASOCK_LASTERROR();
+   }
+
+   return copied;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketFillRecvBuffer --
+ *
+ *      Called when an asock has data ready to be read via the poll callback.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if everything worked,
+ *      ASOCKERR_REMOTE_DISCONNECT if peer closed connection gracefully,
+ *      ASOCKERR_CLOSED if trying to read from a closed socket.
+ *      ASOCKERR_GENERIC for other errors.
+ *
+ * Side effects:
+ *      Reads data, could fire recv completion or trigger socket destruction.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketFillRecvBuffer(AsyncTCPSocket *s)         // IN
+{
+   int recvd;
+   int needed;
+   int sysErr = 0;
+   int result;
+   int pending = 0;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+
+   /*
+    * When a socket has received all its desired content and FillRecvBuffer is
+    * called again for the same socket, just return ASOCKERR_SUCCESS. The
+    * reason we need this hack is that if a client which registered a receive
+    * callback asynchronously later changes its mind to do it synchronously,
+    * (e.g. aioMgr wait function), then FillRecvBuffer can be potentially be
+    * called twice for the same receive event.
+    */
+
+   needed = s->base.recvLen - s->base.recvPos;
+   if (!s->base.recvBuf && needed == 0) {
+      return ASOCKERR_SUCCESS;
+   }
+
+   ASSERT(needed > 0);
+
+   AsyncTCPSocketAddRef(s);
+
+   /*
+    * See comment in AsyncTCPSocket_Recv
+    */
+
+   s->inRecvLoop = TRUE;
+
+   do {
+
+      /*
+       * Try to read the remaining bytes to complete the current recv request.
+       */
+
+      if (s->passFd.expected) {
+         int fd;
+
+         recvd = SSL_RecvDataAndFd(s->sslSock,
+                                   (uint8 *) s->base.recvBuf +
+                                   s->base.recvPos,
+                                   needed, &fd);
+         if (fd != -1) {
+            s->passFd.fd = fd;
+            s->passFd.expected = FALSE;
+         }
+      } else if (s->recvAhead.enabled) {
+         recvd = AsyncTCPSocketReadAhead(s,
+                                         (uint8 *) s->base.recvBuf +
+                                         s->base.recvPos,
+                                         needed);
+      } else {
+         recvd = SSL_Read(s->sslSock,
+                          (uint8 *) s->base.recvBuf +
+                          s->base.recvPos,
+                          needed);
+      }
+      /*
+       * Do NOT make any system call directly or indirectly here
+       * unless you can preserve the system error number
+       */
+      if (recvd > 0) {
+         TCPSOCKLOG(3, s, ("need\t%d\trecv\t%d\tremain\t%d\n", needed, recvd,
+                           needed - recvd));
+         s->sslConnected = TRUE;
+         s->base.recvPos += recvd;
+         if (AsyncSocketCheckAndDispatchRecv(&s->base, &result)) {
+            goto exit;
+         }
+      } else if (recvd == 0) {
+         TCPSOCKLG0(s, ("recv detected client closed connection\n"));
+         /*
+          * We treat this as an error so that the owner can detect closing
+          * of connection by peer (via the error handler callback).
+          */
+         result = ASOCKERR_REMOTE_DISCONNECT;
+         goto exit;
+      } else if ((sysErr = ASOCK_LASTERROR()) == ASOCK_EWOULDBLOCK) {
+         TCPSOCKLOG(4, s, ("recv would block\n"));
+         break;
+      } else {
+         TCPSOCKLG0(s, ("recv error %d: %s\n", sysErr,
+                      Err_Errno2String(sysErr)));
+         s->genericErrno = sysErr;
+         result = ASOCKERR_GENERIC;
+         goto exit;
+      }
+
+      /*
+       * At this point, s->recvFoo have been updated to point to the
+       * next chained Recv buffer. By default we're done at this
+       * point, but we may want to continue if the SSL socket or the
+       * read-ahead buffer has data buffered in userspace already.
+       */
+
+      needed = s->base.recvLen - s->base.recvPos;
+      ASSERT(needed > 0);
+
+      pending = SSL_Pending(s->sslSock) + s->recvAhead.count;
+#ifdef ASOCK_URING
+      if (pending == 0 && (s->uring.recvEof || s->uring.recvErrno != 0)) {
+         /* No further completion will report it, so do it now. */
+         pending = 1;
+      }
+#endif
+      needed = MIN(needed, pending);
+
+   } while (needed);
+
+   /*
+    * Reach this point only when nothing was left pending or
+    * error is ASOCK_EWOULDBLOCK
+    */
+
+   ASSERT(pending == 0 || sysErr == ASOCK_EWOULDBLOCK);
+
+   /*
+    * Both a spurious wakeup and receiving any data even if it wasn't enough
+    * to fire the callback are both success.  We were ready and now
+    * presumably we aren't ready anymore.
+    */
+
+   result = ASOCKERR_SUCCESS;
+
+exit:
+   s->inRecvLoop = FALSE;
+   AsyncTCPSocketRelease(s);
+
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketRetireSentBuffers --
+ *
+ *      Account for 'sent' bytes written from the head of the send buffer
+ *      list. Buffers that were written completely are unlinked first and
+ *      only then have their callbacks fired, so that a callback which
+ *      sends or flushes sees a consistent list and position.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, or ASOCKERR_CLOSED if the owner closed the socket
+ *      in a send callback.
+ *
+ * Side effects:
+ *      Fires send callbacks.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketRetireSentBuffers(AsyncTCPSocket *s,         // IN
+                                int sent)                  // IN
+{
+   SendBufList *done = NULL;
+   SendBufList **doneTail = &done;
+   int result = ASOCKERR_SUCCESS;
+
+   while (sent > 0) {
+      SendBufList *head = s->sendBufList;
+      int left;
+
+      ASSERT(head != NULL);
+      left = head->len - s->sendPos;
+      if (sent < left) {
+         s->sendPos += sent;
+         break;
+      }
+      sent -= left;
+      s->sendPos = 0;
+      s->sendBufList = head->next;
+      if (s->sendBufList == NULL) {
+         s->sendBufTail = &(s->sendBufList);
+      }
+      head->next = NULL;
+      *doneTail = head;
+      doneTail = &head->next;
+   }
+
+   while (done != NULL) {
+      SendBufList tmp = *done;
+
+      free(done);
+      done = tmp.next;
+
+      /*
+       * Once the owner has closed the socket, the remaining callbacks are
+       * still owed; fire them like AsyncTCPSocketCancelCbForClose would.
+       */
+      if (tmp.sendFn) {
+         ASSERT(s->base.refCount > 1);
+         tmp.sendFn(tmp.buf, tmp.len, BaseSocket(s), tmp.clientData);
+         if (result == ASOCKERR_SUCCESS &&
+             AsyncTCPSocketGetState(s) == AsyncSocketClosed) {
+            TCPSOCKLG0(s, ("owner closed connection in send callback\n"));
+            result = ASOCKERR_CLOSED;
+         }
+      }
+   }
+
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWriteBuffers --
+ *
+ *      The meat of AsyncTCPSocket's sending functionality.  This function
+ *      actually writes to the wire assuming there's space in the buffers
+ *      for the socket.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if everything worked, else ASOCKERR_GENERIC.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketWriteBuffers(AsyncTCPSocket *s)         // IN
+{
+   int result;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   if (s->sendBufList == NULL) {
+      return ASOCKERR_SUCCESS;     /* Vacuously true */
+   }
+
+   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
+      TCPSOCKWARN(s, ("write buffers on a disconnected socket!\n"));
+      return ASOCKERR_GENERIC;
+   }
+
+#ifdef ASOCK_URING
+   if (s->uring.engaged) {
+      /*
+       * One io_uring send at a time; its completion retires the buffers.
+       */
+      if (!s->sendCb && !AsyncTCPSocketUringSend(s, FALSE)) {
+         s->genericErrno = ENOBUFS;
+         return ASOCKERR_GENERIC;
+      }
+
+      return ASOCKERR_SUCCESS;
+   }
+#endif
+
+   AsyncTCPSocketAddRef(s);
+
+   while (s->sendBufList && AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
+      SendBufList *head = s->sendBufList;
+      int error = 0;
+      int sent = 0;
+      int left = head->len - s->sendPos;
+#ifndef _WIN32
+      struct iovec iov[ASOCK_SEND_IOV_MAX];
+      int iovcnt = 0;
+      SendBufList *cur;
+
+      /*
+       * Hand as many queued buffers as possible to the SSL layer at once,
+       * so that a burst of small sends costs one syscall (and, with SSL,
+       * one record) instead of one per buffer.
+       */
+      for (cur = head; cur != NULL && iovcnt < ASOCK_SEND_IOV_MAX;
+           cur = cur->next) {
+         int pos = cur == head ? s->sendPos : 0;
+
+         iov[iovcnt].iov_base = (uint8 *) cur->buf + pos;
+         iov[iovcnt].iov_len = cur->len - pos;
+         if (iovcnt > 0) {
+            left += iov[iovcnt].iov_len;
+         }
+         iovcnt++;
+      }
+
+      sent = SSL_Writev(s->sslSock, iov, iovcnt);
+#else
+      sent = SSL_Write(s->sslSock,
+                       (uint8 *) head->buf + s->sendPos, left);
+#endif
+      /*
+       * Do NOT make any system call directly or indirectly here
+       * unless you can preserve the system error number
+       */
+      if (sent > 0) {
+         TCPSOCKLOG(3, s, ("left\t%d\tsent\t%d\tremain\t%d\n",
+                        left, sent, left - sent));
+         s->sendBufFull = FALSE;
+         s->sslConnected = TRUE;
+
+         result = AsyncTCPSocketRetireSentBuffers(s, sent);
+         if (result != ASOCKERR_SUCCESS) {
+            goto exit;
+         }
+      } else if (sent == 0) {
+         TCPSOCKLG0(s, ("socket write() should never return 0.\n"));
+         NOT_REACHED();
+      } else if ((error = ASOCK_LASTERROR()) != ASOCK_EWOULDBLOCK) {
+         TCPSOCKLG0(s, ("send error %d: %s\n", error, Err_Errno2String(error)));
+         s->genericErrno = error;
+         if (error == ASOCK_EPIPE || error == ASOCK_ECONNRESET) {
+            result = ASOCKERR_REMOTE_DISCONNECT;
+         } else {
+            result = ASOCKERR_GENERIC;
+         }
+         goto exit;
+      } else {
+         /*
+          * Ran out of space to send. This is actually successful completion
+          * (our contract obligates us to send as much data as space allows
+          * and we fulfilled that).
+          *
+          * Indicate send buffer is full.
+          */
+
+         s->sendBufFull = TRUE;
+         break;
+      }
+   }
+
+   result = ASOCKERR_SUCCESS;
+
+exit:
+   AsyncTCPSocketRelease(s);
+
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptInternal --
+ *
+ *      The meat of 'accept'.  This function can be invoked either via a
+ *      poll callback or blocking. We call accept to get the new socket fd,
+ *      create a new asock, and call the newFn callback previously supplied
+ *      by the call to AsyncTCPSocket_Listen.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if everything works, else an error code.
+ *      ASOCKERR_GENERIC is returned to hide accept() system call's
+ *        nitty-gritty, it implies that we should try accept() again and not
+ *        report error to client.
+ *      ASOCKERR_ACCEPT to report accept operation's error to client.
+ *
+ * Side effects:
+ *      Accepts on listening fd, creates new asock.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketAcceptInternal(AsyncTCPSocket *s)         // IN
+{
+   AsyncTCPSocket *newsock;
+   int sysErr;
+   int fd;
+   struct sockaddr_storage remoteAddr;
+   socklen_t remoteAddrLen = sizeof remoteAddr;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketListening);
+
+   if ((fd = accept(s->fd, (struct sockaddr *)&remoteAddr,
+                    &remoteAddrLen)) == -1) {
+      sysErr = ASOCK_LASTERROR();
+      s->genericErrno = sysErr;
+      if (sysErr == ASOCK_EWOULDBLOCK) {
+         TCPSOCKWARN(s, ("spurious accept notification\n"));
+#if TARGET_OS_IPHONE
+         /*
+          * For iOS, while the app is suspended and device's screen is locked,
+          * system will reclaim resources from underneath socket(see Apple
+          * Technical Note TN2277), the callback function AsyncTCPSocketAcceptCallback()
+          * will be invoked repeatedly, to deal with this issue, we need to
+          * handle error EWOULDBLOCK.
+          */
+         return ASOCKERR_ACCEPT;
+#else
+         return ASOCKERR_GENERIC;
+#endif
+#ifndef _WIN32
+         /*
+          * This sucks. Linux accept() can return ECONNABORTED for connections
+          * that closed before we got to actually call accept(), but Windows
+          * just ignores this case. So we have to special case for Linux here.
+          * We return ASOCKERR_GENERIC here because we still want to continue
+          * accepting new connections.
+          */
+
+      } else if (sysErr == ECONNABORTED) {
+         TCPSOCKLG0(s, ("accept: new connection was aborted\n"));
+
+         return ASOCKERR_GENERIC;
+#endif
+      } else {
+         TCPSOCKWARN(s, ("accept failed on fd %d, error %d: %s\n",
+                       s->fd, sysErr, Err_Errno2String(sysErr)));
+
+         return ASOCKERR_ACCEPT;
+      }
+   }
+
+   if (remoteAddr.ss_family == AF_INET6 &&
+       AsyncTCPSocketOSVersionSupportsV4Mapped()) {
+      struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&remoteAddr;
+
+      /*
+       * Remote address should not be a V4MAPPED address. Validate for the rare
+       * case that IPV6_V6ONLY is not defined and V4MAPPED is enabled by
+       * default when setting up socket listener.
+       */
+
+      if (IN6_IS_ADDR_V4MAPPED(&(addr6->sin6_addr))) {
+         TCPSOCKWARN(s,
+                   ("accept rejected on fd %d due to a IPv4-mapped IPv6 "
+                    "remote connection address.\n", s->fd));
+         SSLGeneric_close(fd);
+
+         return ASOCKERR_ACCEPT;
+      }
+   }
+
+   newsock = AsyncTCPSocketAttachToFd(fd, AsyncTCPSocketPollParams(s), NULL);
+   if (!newsock) {
+      SSLGeneric_close(fd);
+
+      return ASOCKERR_ACCEPT;
+   }
+
+   newsock->remoteAddr = remoteAddr;
+   newsock->remoteAddrLen = remoteAddrLen;
+   AsyncTCPSocketSetState(newsock, AsyncSocketConnected);
+   newsock->internalRecvFn = s->internalRecvFn;
+   newsock->internalSendFn = s->internalSendFn;
+
+   /*
+    * Fire the connect callback:
+    */
+   s->connectFn(BaseSocket(newsock), s->clientData);
+
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketConnectInternal --
+ *
+ *      The meat of connect.  This function is invoked either via a poll
+ *      callback or the blocking API and verifies that connect() succeeded
+ *      or reports is failure.  On success we call the registered 'new
+ *      connection' function.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if it all worked out or ASOCKERR_GENERIC.
+ *
+ * Side effects:
+ *      Creates new asock, fires newFn callback.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketConnectInternal(AsyncTCPSocket *s)         // IN
+{
+   int optval = 0, optlen = sizeof optval, sysErr;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnecting);
+
+   /* Remove when bug 859728 is fixed */
+   if (vmx86_server && s->remoteAddr.ss_family == AF_UNIX) {
+      goto done;
+   }
+
+   if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR,
+                  (void *) &optval, (void *)&optlen) != 0) {
+      sysErr = ASOCK_LASTERROR();
+      s->genericErrno = sysErr;
+      Warning(ASOCKPREFIX "getsockopt for connect on fd %d failed with "
+              "error %d : %s\n", s->fd, sysErr, Err_Errno2String(sysErr));
+
+      return ASOCKERR_GENERIC;
+   }
+
+   if (optval != 0) {
+      s->genericErrno = optval;
+      TCPSOCKLOG(1, s, ("connection SO_ERROR: %s\n", Err_Errno2String(optval)));
+
+      return ASOCKERR_GENERIC;
+   }
+
+   s->localAddrLen = sizeof s->localAddr;
+   if (getsockname(s->fd, (struct sockaddr *)&s->localAddr,
+                   &s->localAddrLen) != 0) {
+      sysErr = ASOCK_LASTERROR();
+      s->genericErrno = sysErr;
+      Warning(ASOCKPREFIX "getsockname for connect on fd %d failed with "
+              "error %d: %s\n", s->fd, sysErr, Err_Errno2String(sysErr));
+
+      return ASOCKERR_GENERIC;
+   }
+
+done:
+   AsyncTCPSocketSetState(s, AsyncSocketConnected);
+   s->connectFn(BaseSocket(s), s->clientData);
+
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketGetGenericErrno --
+ *
+ *      Used when an ASOCKERR_GENERIC is returned due to a system error.
+ *      The errno that was returned by the system is stored in the asock
+ *      struct and returned to the user in this function.
+ *
+ *      XXX: This function is not thread-safe.  The errno should be returned
+ *      in a parameter to any function that can return ASOCKERR_GENERIC.
+ *
+ * Results:
+ *      int error code
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketGetGenericErrno(AsyncSocket *base)  // IN:
+{
+   AsyncTCPSocket *asock = TCPSocket(base);
+   ASSERT(asock);
+   return asock->genericErrno;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWaitForConnection --
+ *
+ *      Spins a socket currently listening or connecting until the
+ *      connection completes or the allowed time elapses.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on failures, and
+ *      ASOCKERR_TIMEOUT if nothing happened in the allotted time.
+ *
+ * Side effects:
+ *      None.
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketWaitForConnection(AsyncSocket *base,  // IN:
+                                int timeoutMS)      // IN:
+{
+   AsyncTCPSocket *s = TCPSocket(base);
+   Bool read = FALSE;
+   int error;
+   VmTimeType now, done;
+   Bool removed = FALSE;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   if (AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
+      return ASOCKERR_SUCCESS;
+   }
+
+   if (AsyncTCPSocketGetState(s) != AsyncSocketListening &&
+       AsyncTCPSocketGetState(s) != AsyncSocketConnecting) {
+      return ASOCKERR_GENERIC;
+   }
+
+   read = AsyncTCPSocketGetState(s) == AsyncSocketListening;
+
+#ifdef ASOCK_URING
+   if (!read && s->uring.connectOp.inFlight) {
+      error = AsyncTCPSocketUringWait(s, &s->uring.connectOp, timeoutMS);
+      if (error != ASOCKERR_SUCCESS) {
+         return error;
+      }
+
+      /*
+       * The completion either finished the connect or fell back to the
+       * Poll based connect callback, which is handled below.
+       */
+      switch (AsyncTCPSocketGetState(s)) {
+      case AsyncSocketConnected:
+         return ASOCKERR_SUCCESS;
+      case AsyncSocketConnecting:
+         break;
+      default:
+         return ASOCKERR_GENERIC;
+      }
+   }
+#endif
+
+   /*
+    * For listening sockets, unregister AsyncTCPSocketAcceptCallback before
+    * starting polling and re-register before returning.
+    *
+    * ConnectCallback() is either registered as a device or rtime callback
+    * depending on the prior return value of connect(). So we try to remove it
+    * from both.
+    */
+   if (read) {
+      if (s->fd == -1) {
+         if (s->listenAsock4) {
+            ASSERT(AsyncTCPSocketIsLocked(s->listenAsock4));
+            AsyncTCPSocketCancelListenCb(s->listenAsock4);
+         }
+         if (s->listenAsock6) {
+            ASSERT(AsyncTCPSocketIsLocked(s->listenAsock6));
+            AsyncTCPSocketCancelListenCb(s->listenAsock6);
+         }
+      } else {
+         AsyncTCPSocketCancelListenCb(s);
+      }
+
+      removed = TRUE;
+   } else {
+      removed = (AsyncTCPSocketPollRemove(s, TRUE, POLL_FLAG_WRITE,
+                                          AsyncTCPSocketConnectCallback) ||
+                 AsyncTCPSocketPollRemove(s, FALSE, 0,
+                                          AsyncTCPSocketConnectCallback));
+      ASSERT(removed);
+      if (s->internalConnectFn) {
+         removed = AsyncTCPSocketPollRemove(s, FALSE, POLL_FLAG_PERIODIC,
+                                            AsyncTCPSocketConnectErrorCheck);
+         ASSERT(removed);
+         s->internalConnectFn = NULL;
+      }
+   }
+
+   now = Hostinfo_SystemTimerUS() / 1000;
+   done = now + timeoutMS;
+
+   do {
+      AsyncTCPSocket *asock = NULL;
+
+      error = AsyncTCPSocketPoll(s, read, done - now, &asock);
+      if (error != ASOCKERR_SUCCESS) {
+         goto out;
+      }
+
+      now = Hostinfo_SystemTimerUS() / 1000;
+
+      if (read) {
+         if (AsyncTCPSocketAcceptInternal(asock) != ASOCKERR_SUCCESS) {
+            TCPSOCKLG0(s, ("wait for connection: accept failed\n"));
+
+            /*
+             * Just fall through, we'll loop and try again as long as we still
+             * have time remaining.
+             */
+
+         } else {
+            error = ASOCKERR_SUCCESS;
+            goto out;
+         }
+      } else {
+         error = AsyncTCPSocketConnectInternal(asock);
+         goto out;
+      }
+   } while ((now < done && timeoutMS > 0) || (timeoutMS < 0));
+
+   error = ASOCKERR_TIMEOUT;
+
+out:
+   if (read && removed) {
+      if (s->fd == -1) {
+         if (s->listenAsock4 &&
+             AsyncTCPSocketGetState(s->listenAsock4) != AsyncSocketClosed) {
+            if (!AsyncTCPSocketAddListenCb(s->listenAsock4)) {
+               error = ASOCKERR_POLL;
+            }
+         }
+
+         if (s->listenAsock6 &&
+             AsyncTCPSocketGetState(s->listenAsock6) != AsyncSocketClosed) {
+            if (!AsyncTCPSocketAddListenCb(s->listenAsock6)) {
+               error = ASOCKERR_POLL;
+            }
+         }
+      } else if (AsyncTCPSocketGetState(s) != AsyncSocketClosed) {
+         if (!AsyncTCPSocketAddListenCb(s)) {
+            error = ASOCKERR_POLL;
+         }
+      }
+   }
+
+   return error;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketDoOneMsg --
+ *
+ *      Spins a socket until the specified amount of time has elapsed or
+ *      data has arrived / been sent.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on system call
+ *         failures
+ *      ASOCKERR_BUSY if another thread is in the read callback.
+ *      ASOCKERR_TIMEOUT if nothing happened in the allotted time.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketDoOneMsg(AsyncSocket *base, // IN
+                       Bool read,         // IN
+                       int timeoutMS)     // IN
+{
+   AsyncTCPSocket *s = TCPSocket(base);
+   AsyncTCPSocket *asock = NULL;
+   int retVal;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+
+   if (read) {
+      if (s->inRecvLoop) {
+         /*
+          * The recv loop would read the data if there is any and it is
+          * not safe to proceed and race with the recv loop.
+          */
+         TCPSOCKLG0(s, ("busy: another thread in recv loop\n"));
+         return ASOCKERR_BUSY;
+      }
+
+      /*
+       * Bug 158571: There could other threads polling on the same asyncsocket.
+       * If two threads land up polling  on the same socket at the same time,
+       * the first thread to be scheduled reads the data from the socket,
+       * while the second one blocks infinitely. This hangs the VM. To prevent
+       * this, we temporarily remove the poll callback and then reinstate it
+       * after reading the data.
+       */
+
+      ASSERT(s->recvCb); /* We are supposed to call someone... */
+      AsyncTCPSocketAddRef(s);
+      AsyncTCPSocketCancelRecvCb(s);
+      s->recvCb = TRUE;  /* We need to know if the callback cancel recv. */
+
+      s->inBlockingRecv++;
+      retVal = AsyncTCPSocketPoll(s, read, timeoutMS, &asock);
+      if (retVal != ASOCKERR_SUCCESS) {
+         if (retVal == ASOCKERR_GENERIC) {
+            TCPSOCKWARN(s, ("%s: failed to poll on the socket during read.\n",
+                       __FUNCTION__));
+         }
+      } else {
+         ASSERT(asock == s);
+         retVal = AsyncTCPSocketFillRecvBuffer(s);
+      }
+      s->inBlockingRecv--;
+
+      /*
+       * If socket got closed in AsyncTCPSocketFillRecvBuffer, we
+       * cannot add poll callback - AsyncSocket_Close() would remove
+       * it if we would not remove it above.
+       */
+
+      if (AsyncTCPSocketGetState(s) != AsyncSocketClosed && s->recvCb) {
+         ASSERT(s->base.refCount > 1); /* We shouldn't be last user of socket. */
+         ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+         /*
+          * If AsyncTCPSocketPoll or AsyncTCPSocketFillRecvBuffer fails, do not
+          * add the recv callback as it may never fire.
+          */
+         s->recvCb = FALSE;  /* For re-registering the poll callback. */
+         if (retVal == ASOCKERR_SUCCESS || retVal == ASOCKERR_TIMEOUT) {
+            retVal = AsyncTCPSocketRegisterRecvCb(s);
+            Log("SOCKET reregister recvCb after DoOneMsg (ref %d)\n",
+                BaseSocket(s)->refCount);
+         }
+         if (retVal != ASOCKERR_SUCCESS) {
+            s->base.recvBuf = NULL;
+         }
+      }
+      AsyncTCPSocketRelease(s);
+   } else {
+      AsyncTCPSocketAddRef(s);
+      retVal = AsyncTCPSocketPoll(s, read, timeoutMS, &asock);
+      if (retVal != ASOCKERR_SUCCESS) {
+         if (retVal == ASOCKERR_GENERIC) {
+            TCPSOCKWARN(s, ("%s: failed to poll on the socket during write.\n",
+                            __FUNCTION__));
+         }
+      } else {
+         ASSERT(asock == s);
+         retVal = AsyncTCPSocketWriteBuffers(s);
+      }
+      AsyncTCPSocketRelease(s);
+   }
+
+   return retVal;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
  * AsyncSocket_TCPDrainRecv --
  *
- *      This function can be used to drain all the messages from a socket
- *      disconnected on the remote end.  It spins a socket until the specified
- *      amount of time has elapsed or an error is encountered, with backoff
- *      between read attempts if there is a conflict with another thread.  The
- *      recv callback is restored at the end of this only if not all the
- *      messages have been read, the socket is still connected and recv callack
- *      has not been cancelled.
+ *      This function can be used to drain all the messages from a socket
+ *      disconnected on the remote end.  It spins a socket until the specified
+ *      amount of time has elapsed or an error is encountered, with backoff
+ *      between read attempts if there is a conflict with another thread.  The
+ *      recv callback is restored at the end of this only if not all the
+ *      messages have been read, the socket is still connected and recv callack
+ *      has not been cancelled.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if all messages are have been read, or if the callback
+ *      has canceled the recv, or if the socket is closed
+ *      ASOCKERR_GENERIC on system call failures
+ *      ASOCKERR_TIMEOUT if there may still be unread messages at the end of
+ *      the speccified time.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+AsyncSocket_TCPDrainRecv(AsyncSocket *base, // IN
+                         int timeoutMS)     // IN
+{
+   AsyncTCPSocket *s = TCPSocket(base);
+   int retVal;
+   Bool cbRemoved = FALSE;
+   Bool releaseLock = FALSE;
+   unsigned count = 0;
+   VmTimeType startMS = Hostinfo_SystemTimerMS();
+   VmTimeType nowMS;
+
+   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+   ASSERT(s->recvCb); /* We are supposed to call someone... */
+
+   if (!AsyncTCPSocketIsLocked(s) || !Poll_LockingEnabled()) {
+      AsyncTCPSocketLock(s);
+      releaseLock = TRUE;
+   }
+   AsyncTCPSocketAddRef(s);
+
+   while (TRUE) {
+      AsyncTCPSocket *asock = NULL;
+
+      count++;
+      if (s->inRecvLoop) {
+         /*
+          * The recv loop would read the data if there is any and it is
+          * not safe to proceed and race with the recv loop.
+          */
+         TCPSOCKLG0(s, ("busy: another thread in recv loop\n"));
+         retVal = ASOCKERR_BUSY;
+         /* Add a bit of backoff. */
+         AsyncTCPSocketUnlock(s);
+         Util_Usleep(MIN(100 << (mssb32(count) / 2), timeoutMS));
+         AsyncTCPSocketLock(s);
+         goto retry;
+      }
+
+      if (!cbRemoved) {
+         /*
+          * Cancel the recv callback, but pretend that it is still registered
+          * so we know if the callback cancel recv.
+          */
+         AsyncTCPSocketCancelRecvCb(s);
+         s->recvCb = TRUE;
+         cbRemoved = TRUE;
+      }
+
+      s->inBlockingRecv++;
+      retVal = AsyncTCPSocketPoll(s, TRUE, 0, &asock);
+      if (retVal != ASOCKERR_SUCCESS) {
+         if (retVal == ASOCKERR_GENERIC) {
+            TCPSOCKWARN(s, ("%s: failed to poll on the socket during read.\n",
+                       __FUNCTION__));
+         }
+      } else if (AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
+         ASSERT(asock == s);
+         retVal = AsyncTCPSocketFillRecvBuffer(s);
+      }
+      s->inBlockingRecv--;
+
+retry:
+      if (retVal == ASOCKERR_REMOTE_DISCONNECT ||
+          AsyncTCPSocketGetState(s) == AsyncSocketClosed ||
+          !s->recvCb) {
+         /* No more messages to recv. */
+         retVal = ASOCKERR_SUCCESS;
+         break;
+      }
+      if (retVal == ASOCKERR_GENERIC) {
+         break;
+      }
+
+      nowMS = Hostinfo_SystemTimerMS();
+      if (nowMS >= startMS + timeoutMS) {
+         retVal = ASOCKERR_TIMEOUT;
+         break;
+      }
+      timeoutMS -= nowMS - startMS;
+      startMS = nowMS;
+      ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected && s->recvCb);
+   }
+
+   if (cbRemoved) {
+      s->recvCb = FALSE;
+      /*
+       * If AsyncTCPSocketPoll or AsyncTCPSocketFillRecvBuffer fails, do not
+       * add the recv callback as it may never fire.
+       */
+      if (retVal == ASOCKERR_TIMEOUT) {
+         ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+         ASSERT(s->base.refCount > 1); /* We better not be the last user */
+         retVal = AsyncTCPSocketRegisterRecvCb(s);
+         Log("SOCKET reregister recvCb after DrainRecv (ref %d)\n",
+             BaseSocket(s)->refCount);
+      }
+   }
+   if (!s->recvCb) {
+      s->base.recvBuf = NULL;
+   }
+
+   AsyncTCPSocketRelease(s);
+   if (releaseLock) {
+      AsyncTCPSocketUnlock(s);
+   }
+   return retVal;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketFlush --
+ *
+ *      Try to send any pending out buffers until we run out of buffers, or
+ *      the timeout expires.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on system call
+ *      failures, and ASOCKERR_TIMEOUT if we couldn't send enough data
+ *      before the timeout expired.
+ *
+ * Side effects:
+ *      None.
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketFlush(AsyncSocket *base,  // IN
+                    int timeoutMS)      // IN
+{
+   AsyncTCPSocket *s = TCPSocket(base);
+   VmTimeType now, done;
+   int retVal;
+
+   if (s == NULL) {
+      Warning(ASOCKPREFIX "Flush called with invalid arguments!\n");
+
+      return ASOCKERR_INVAL;
+   }
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   AsyncTCPSocketAddRef(s);
+
+   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
+      TCPSOCKWARN(s, ("flush called but state is not connected!\n"));
+      retVal = ASOCKERR_INVAL;
+      goto outHaveLock;
+   }
+
+#ifdef ASOCK_URING
+   /* Submit a deferred io_uring send now rather than waiting for Poll. */
+   if (s->uring.engaged && s->sendCbTimer &&
+       AsyncTCPSocketPollRemove(s, FALSE, 0, s->internalSendFn)) {
+      s->sendCb = FALSE;
+      s->sendCbTimer = FALSE;
+   }
+#endif
+
+   now = Hostinfo_SystemTimerUS() / 1000;
+   done = now + timeoutMS;
+
+   while (s->sendBufList) {
+      AsyncTCPSocket *asock = NULL;
+
+      retVal = AsyncTCPSocketPoll(s, FALSE, done - now, &asock);
+      if (retVal != ASOCKERR_SUCCESS) {
+         TCPSOCKWARN(s, ("flush failed\n"));
+         goto outHaveLock;
+      }
+
+      ASSERT(asock == s);
+      if ((retVal = AsyncTCPSocketWriteBuffers(s)) != ASOCKERR_SUCCESS) {
+         goto outHaveLock;
+      }
+      ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+
+      /* Setting timeoutMS to -1 means never timeout. */
+      if (timeoutMS >= 0) {
+         now = Hostinfo_SystemTimerUS() / 1000;
+
+         /* Don't timeout if you've sent everything */
+         if (now > done && s->sendBufList) {
+            TCPSOCKWARN(s, ("flush timed out\n"));
+            retVal = ASOCKERR_TIMEOUT;
+            goto outHaveLock;
+         }
+      }
+   }
+
+   retVal = ASOCKERR_SUCCESS;
+
+outHaveLock:
+   AsyncTCPSocketRelease(s);
+
+   return retVal;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocketCancelListenCbSocket --
+ *
+ *      Socket specific code for canceling callbacks for a listening socket.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketCancelListenCb(AsyncTCPSocket *asock)  // IN:
+{
+   Bool removed;
+
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   removed = AsyncTCPSocketPollRemove(asock, TRUE,
+                                      POLL_FLAG_READ | POLL_FLAG_PERIODIC,
+                                      AsyncTCPSocketAcceptCallback);
+   ASSERT(removed);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAddListenCb --
+ *
+ *      Socket specific code for adding callbacks for a listening socket.
+ *
+ * Results:
+ *      TRUE if Poll callback successfully added.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+AsyncTCPSocketAddListenCb(AsyncTCPSocket *asock)  // IN:
+{
+   VMwareStatus pollStatus;
+
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   pollStatus = AsyncTCPSocketPollAdd(asock, TRUE,
+                                      POLL_FLAG_READ | POLL_FLAG_PERIODIC,
+                                      AsyncTCPSocketAcceptCallback);
+
+   if (pollStatus != VMWARE_STATUS_SUCCESS) {
+      TCPSOCKWARN(asock, ("failed to install listen accept callback!\n"));
+   }
+
+   return pollStatus == VMWARE_STATUS_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketCancelRecvCb --
+ *
+ *      Socket specific code for canceling callbacks when a receive
+ *      request is being canceled.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketCancelRecvCb(AsyncTCPSocket *asock)  // IN:
+{
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   if (asock->recvCbTimer) {
+      AsyncTCPSocketPollRemove(asock, FALSE, 0, asock->internalRecvFn);
+      asock->recvCbTimer = FALSE;
+   }
+   if (asock->recvCb) {
+      Bool removed;
+      TCPSOCKLOG(1, asock,
+                 ("Removing poll recv callback while cancelling recv.\n"));
+
+      /*
+       * An io_uring receive in flight is left alone: it only fills the
+       * socket's own buffer.
+       */
+      if (!AsyncTCPSocketUringEngaged(asock)) {
+         removed = AsyncTCPSocketPollRemove(asock, TRUE,
+                                            POLL_FLAG_READ |
+                                            POLL_FLAG_PERIODIC,
+                                            asock->internalRecvFn);
+         ASSERT(removed || AsyncTCPSocketPollParams(asock)->iPoll);
+      }
+      asock->recvCb = FALSE;
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketCancelCbForClose --
+ *
+ *      Cancel future asynchronous send and recv by unregistering
+ *      their Poll callbacks, and change the socket state to
+ *      AsyncTCPSocketCBCancelled if the socket state is AsyncTCPSocketConnected.
+ *
+ *      The function can be called in a send/recv error handler before
+ *      actually closing the socket in a separate thread, to prevent other
+ *      code calling AsyncTCPSocket_Send/Recv from re-registering the
+ *      callbacks again. The next operation should be just AsyncSocket_Close().
+ *      This helps to avoid unnecessary send/recv callbacks before the
+ *      socket is closed.
  *
  * Results:
- *      ASOCKERR_SUCCESS if all messages are have been read, or if the callback
- *      has canceled the recv, or if the socket is closed
- *      ASOCKERR_GENERIC on system call failures
- *      ASOCKERR_TIMEOUT if there may still be unread messages at the end of
- *      the speccified time.
+ *      ASOCKERR_*.
+ *
+ * Side effects:
+ *      Unregisters send/recv Poll callbacks, and fires the send
+ *      triggers for any remaining output buffers. May also change
+ *      the socket state.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketCancelCbForClose(AsyncSocket *base)  // IN:
+{
+   AsyncTCPSocket *asock = TCPSocket(base);
+   Bool removed;
+
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   if (AsyncTCPSocketGetState(asock) == AsyncSocketConnected) {
+      AsyncTCPSocketSetState(asock, AsyncSocketCBCancelled);
+   }
+
+   /*
+    * Remove the read and write poll callbacks.
+    *
+    * We could fire the current recv completion callback here, but in
+    * practice clients won't want to know about partial reads since it just
+    * complicates the common case (i.e. every read callback would need to
+    * check the len parameter).
+    *
+    * For writes, however, we *do* fire all of the callbacks. The argument
+    * here is that the common case for writes is "fire and forget", e.g.
+    * send this buffer and free it. Firing the triggers at close time
+    * simplifies client code, since the clients aren't forced to keep track
+    * of send buffers themselves. Clients can figure out how much data was
+    * actually transmitted (if they care) by checking the len parameter
+    * passed to the send callback.
+    *
+    * A modification suggested by Jeremy is to pass a list of unsent
+    * buffers and their completion callbacks to the error handler if one is
+    * registered, and only fire the callbacks here if there was no error
+    * handler invoked.
+    */
+
+   ASSERT(!asock->base.recvBuf || asock->base.recvFn);
+
+   if (asock->recvCbTimer) {
+      AsyncTCPSocketPollRemove(asock, FALSE, 0, asock->internalRecvFn);
+      asock->recvCbTimer = FALSE;
+   }
+   if (asock->recvCb) {
+      TCPSOCKLOG(1, asock, ("recvCb is non-NULL, removing recv callback\n"));
+      removed = AsyncTCPSocketUringEngaged(asock) ||
+                AsyncTCPSocketPollRemove(asock, TRUE,
+                                         POLL_FLAG_READ | POLL_FLAG_PERIODIC,
+                                         asock->internalRecvFn);
+      /* Callback might be temporarily removed in AsyncSocket_DoOneMsg. */
+      ASSERT_NOT_TESTED(removed ||
+                        asock->inBlockingRecv ||
+                        AsyncTCPSocketPollParams(asock)->iPoll);
+
+      asock->recvCb = FALSE;
+      asock->base.recvBuf = NULL;
+   }
+
+   if (asock->sendCb) {
+      TCPSOCKLOG(1, asock,
+                 ("sendBufList is non-NULL, removing send callback\n"));
+
+      /*
+       * The send callback could be either a device or RTime callback, so
+       * we check the latter if it wasn't the former.
+       */
+
+      if (asock->sendCbTimer) {
+         removed = AsyncTCPSocketPollRemove(asock, FALSE, 0,
+                                         asock->internalSendFn);
+      } else if (AsyncTCPSocketUringEngaged(asock)) {
+         /*
+          * The io_uring send in flight works on a copy of the data and its
+          * completion is ignored once the socket is no longer connected.
+          */
+         removed = TRUE;
+      } else {
+         removed = AsyncTCPSocketPollRemove(asock, TRUE, POLL_FLAG_WRITE,
+                                         asock->internalSendFn);
+      }
+      ASSERT(removed || AsyncTCPSocketPollParams(asock)->iPoll);
+      asock->sendCb = FALSE;
+      asock->sendCbTimer = FALSE;
+   }
+
+   /*
+    * Go through any send buffers on the list and fire their
+    * callbacks, reflecting back how much of each buffer has been
+    * submitted to the kernel.  For the first buffer in the list that
+    * may be non-zero, for subsequent buffers it will be zero.
+    */
+   AsyncTCPSocketAddRef(asock);
+   while (asock->sendBufList) {
+      /*
+       * Pop each remaining buffer and fire its completion callback.
+       */
+
+      SendBufList *cur = asock->sendBufList;
+      int pos = asock->sendPos;
+
+      asock->sendBufList = asock->sendBufList->next;
+      asock->sendPos = 0;
+
+      if (cur->sendFn) {
+         cur->sendFn(cur->buf, pos, BaseSocket(asock), cur->clientData);
+      }
+      free(cur);
+   }
+   AsyncTCPSocketRelease(asock);
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketCancelCbForConnectingClose --
+ *
+ *      Cancels outstanding connect requests for a socket that is going
+ *      away.
+ *
+ * Results:
+ *      TRUE on callback removed. FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+AsyncTCPSocketCancelCbForConnectingClose(AsyncTCPSocket *asock) // IN
+{
+   return (AsyncTCPSocketPollRemove(asock, TRUE, POLL_FLAG_WRITE,
+                                    AsyncTCPSocketConnectCallback) ||
+           AsyncTCPSocketPollRemove(asock, FALSE, 0,
+                                    AsyncTCPSocketConnectCallback));
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketSetCloseOptions --
+ *
+ *      Enables optional behavior for AsyncSocket_Close():
+ *
+ *      - If flushEnabledMaxWaitMsec is non-zero, the output stream
+ *        will be flushed synchronously before the socket is closed.
+ *        (default is zero: close socket right away without flushing)
+ *
+ *      - If closeCb is set, the callback will be called asynchronously
+ *        when the socket is actually destroyed.
+ *        (default is NULL: no callback)
+ *
+ * Results:
+ *      ASOCKERR_*.
  *
  * Side effects:
  *      None.
@@ -4022,1035 +6111,1070 @@ AsyncTCPSocketDoOneMsg(AsyncSocket *base, // IN
  *----------------------------------------------------------------------------
  */
 
-int
-AsyncSocket_TCPDrainRecv(AsyncSocket *base, // IN
-                         int timeoutMS)     // IN
-{
-   AsyncTCPSocket *s = TCPSocket(base);
-   int retVal;
-   Bool cbRemoved = FALSE;
-   Bool releaseLock = FALSE;
-   unsigned count = 0;
-   VmTimeType startMS = Hostinfo_SystemTimerMS();
-   VmTimeType nowMS;
+static int
+AsyncTCPSocketSetCloseOptions(AsyncSocket *base,           // IN
+                              int flushEnabledMaxWaitMsec, // IN
+                              AsyncSocketCloseFn closeCb)  // IN
+{
+   AsyncTCPSocket *asock = TCPSocket(base);
+   asock->flushEnabledMaxWaitMsec = flushEnabledMaxWaitMsec;
+   asock->closeCb = closeCb;
+   VERIFY(closeCb == NULL);
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketClose --
+ *
+ *      AsyncTCPSocket destructor. The destructor should be safe to call at any
+ *      time.  It's invoked automatically for I/O errors on slots that have no
+ *      error handler set, and should be called manually by the error handler
+ *      as necessary. It could also be called as part of the normal program
+ *      flow.
+ *
+ * Results:
+ *      ASOCKERR_*.
+ *
+ * Side effects:
+ *      Closes the socket fd, unregisters all Poll callbacks, and fires the
+ *      send triggers for any remaining output buffers.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketClose(AsyncSocket *base)   // IN
+{
+   AsyncTCPSocket *asock = TCPSocket(base);
+
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   if (AsyncTCPSocketGetState(asock) == AsyncSocketClosed) {
+      Warning("%s() called on already closed asock!\n", __FUNCTION__);
+      return ASOCKERR_CLOSED;
+   }
+
+#ifndef _WIN32
+   if (asock->readMultipleSet != NULL) {
+      AsyncSocket_WaitSetDestroy(asock->readMultipleSet);
+      asock->readMultipleSet = NULL;
+   }
+
+   if (asock->waitSet != NULL) {
+      /*
+       * Stop waiting on the fds before they are closed; the wait set lets
+       * go of the socket during its next wait.
+       */
+      AsyncTCPSocketWaitSetCtl(asock, FALSE);
+      AsyncTCPSocketWaitSetQueue(asock);
+   }
+#endif
+
+   if (asock->listenAsock4 || asock->listenAsock6) {
+      if (asock->listenAsock4) {
+         AsyncSocket_Close(BaseSocket(asock->listenAsock4));
+      }
+      if (asock->listenAsock6) {
+         AsyncSocket_Close(BaseSocket(asock->listenAsock6));
+      }
+   } else {
+      Bool removed;
+      AsyncSocketState oldState;
+
+      /* Flush output if requested via AsyncTCPSocket_SetCloseOptions(). */
+      if (asock->flushEnabledMaxWaitMsec &&
+          AsyncTCPSocketGetState(asock) == AsyncSocketConnected &&
+          !asock->base.errorSeen) {
+         int ret = AsyncTCPSocketFlush(BaseSocket(asock),
+                                       asock->flushEnabledMaxWaitMsec);
+         if (ret != ASOCKERR_SUCCESS) {
+            TCPSOCKWARN(asock,
+                        ("AsyncTCPSocket_Flush failed: %s. Closing now.\n",
+                         AsyncSocket_Err2String(ret)));
+         }
+      }
+
+      /*
+       * Set the new state to closed, and then check the old state and do the
+       * right thing accordingly
+       */
 
-   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
-   ASSERT(s->recvCb); /* We are supposed to call someone... */
+      TCPSOCKLOG(1, asock, ("closing socket\n"));
+      oldState = AsyncTCPSocketGetState(asock);
+      AsyncTCPSocketSetState(asock, AsyncSocketClosed);
 
-   if (!AsyncTCPSocketIsLocked(s) || !Poll_LockingEnabled()) {
-      AsyncTCPSocketLock(s);
-      releaseLock = TRUE;
-   }
-   AsyncTCPSocketAddRef(s);
+      switch(oldState) {
+      case AsyncSocketListening:
+         TCPSOCKLOG(1, asock, ("old state was listening, removing accept "
+                               "callback\n"));
+         AsyncTCPSocketCancelListenCb(asock);
+         break;
 
-   while (TRUE) {
-      AsyncTCPSocket *asock = NULL;
+      case AsyncSocketConnecting:
+         TCPSOCKLOG(1, asock, ("old state was connecting, removing connect "
+                               "callback\n"));
+         removed = AsyncTCPSocketCancelCbForConnectingClose(asock);
+         if (!removed) {
+            TCPSOCKLOG(1, asock, ("connect callback is not present in the poll "
+                                  "list.\n"));
+         }
+         break;
 
-      count++;
-      if (s->inRecvLoop) {
-         /*
-          * The recv loop would read the data if there is any and it is
-          * not safe to proceed and race with the recv loop.
-          */
-         TCPSOCKLG0(s, ("busy: another thread in recv loop\n"));
-         retVal = ASOCKERR_BUSY;
-         /* Add a bit of backoff. */
-         AsyncTCPSocketUnlock(s);
-         Util_Usleep(MIN(100 << (mssb32(count) / 2), timeoutMS));
-         AsyncTCPSocketLock(s);
-         goto retry;
-      }
+      case AsyncSocketConnected:
+         TCPSOCKLOG(1, asock, ("old state was connected\n"));
+         AsyncTCPSocketCancelCbForClose(BaseSocket(asock));
+         break;
 
-      if (!cbRemoved) {
-         /*
-          * Cancel the recv callback, but pretend that it is still registered
-          * so we know if the callback cancel recv.
-          */
-         AsyncTCPSocketCancelRecvCb(s);
-         s->recvCb = TRUE;
-         cbRemoved = TRUE;
-      }
+      case AsyncSocketCBCancelled:
+         TCPSOCKLOG(1, asock, ("old state was CB-cancelled\n"));
+         break;
 
-      s->inBlockingRecv++;
-      retVal = AsyncTCPSocketPoll(s, TRUE, 0, &asock);
-      if (retVal != ASOCKERR_SUCCESS) {
-         if (retVal == ASOCKERR_GENERIC) {
-            TCPSOCKWARN(s, ("%s: failed to poll on the socket during read.\n",
-                       __FUNCTION__));
-         }
-      } else if (AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
-         ASSERT(asock == s);
-         retVal = AsyncTCPSocketFillRecvBuffer(s);
+      default:
+         NOT_REACHED();
       }
-      s->inBlockingRecv--;
 
-retry:
-      if (retVal == ASOCKERR_REMOTE_DISCONNECT ||
-          AsyncTCPSocketGetState(s) == AsyncSocketClosed ||
-          !s->recvCb) {
-         /* No more messages to recv. */
-         retVal = ASOCKERR_SUCCESS;
-         break;
+      if (asock->internalConnectFn) {
+         removed = AsyncTCPSocketPollRemove(asock, FALSE, POLL_FLAG_PERIODIC,
+                                            AsyncTCPSocketConnectErrorCheck);
+         ASSERT(removed);
+         asock->internalConnectFn = NULL;
       }
-      if (retVal == ASOCKERR_GENERIC) {
-         break;
+
+      if (asock->sslConnectFn && asock->sslPollFlags > 0) {
+         removed = AsyncTCPSocketPollRemove(asock, TRUE, asock->sslPollFlags,
+                                            AsyncTCPSocketSslConnectCallback);
+         ASSERT(removed);
       }
 
-      nowMS = Hostinfo_SystemTimerMS();
-      if (nowMS >= startMS + timeoutMS) {
-         retVal = ASOCKERR_TIMEOUT;
-         break;
+      if (asock->sslAcceptFn && asock->sslPollFlags > 0) {
+         removed = AsyncTCPSocketPollRemove(asock, TRUE, asock->sslPollFlags,
+                                            AsyncTCPSocketSslAcceptCallback);
+         ASSERT(removed);
       }
-      timeoutMS -= nowMS - startMS;
-      startMS = nowMS;
-      ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected && s->recvCb);
-   }
+      asock->sslPollFlags = 0;
+
+#ifdef ASOCK_URING
+      AsyncTCPSocketUringCancel(asock);
+#endif
 
-   if (cbRemoved) {
-      s->recvCb = FALSE;
       /*
-       * If AsyncTCPSocketPoll or AsyncTCPSocketFillRecvBuffer fails, do not
-       * add the recv callback as it may never fire.
+       * Close the underlying SSL sockets.
        */
-      if (retVal == ASOCKERR_TIMEOUT) {
-         ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
-         ASSERT(s->base.refCount > 1); /* We better not be the last user */
-         retVal = AsyncTCPSocketRegisterRecvCb(s);
-         Log("SOCKET reregister recvCb after DrainRecv (ref %d)\n",
-             BaseSocket(s)->refCount);
+      SSL_Shutdown(asock->sslSock);
+
+      if (asock->passFd.fd != -1) {
+         SSLGeneric_close(asock->passFd.fd);
       }
    }
-   if (!s->recvCb) {
-      s->base.recvBuf = NULL;
-   }
 
-   AsyncTCPSocketRelease(s);
-   if (releaseLock) {
-      AsyncTCPSocketUnlock(s);
-   }
-   return retVal;
+   AsyncSocketTeardownSocket(base);
+   return ASOCKERR_SUCCESS;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketFlush --
+ * AsyncTCPSocketIsSendBufferFull --
  *
- *      Try to send any pending out buffers until we run out of buffers, or
- *      the timeout expires.
+ *      Indicate if socket send buffer is full.  Note that unless this is
+ *      called from a callback function, the return value should be treated
+ *      as transient.
  *
  * Results:
- *      ASOCKERR_SUCCESS if it worked, ASOCKERR_GENERIC on system call
- *      failures, and ASOCKERR_TIMEOUT if we couldn't send enough data
- *      before the timeout expired.
+ *      0: send space probably available,
+ *      1: send has reached maximum,
+ *      ASOCKERR_GENERIC: null socket.
  *
  * Side effects:
  *      None.
+ *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketFlush(AsyncSocket *base,  // IN
-                    int timeoutMS)      // IN
+AsyncTCPSocketIsSendBufferFull(AsyncSocket *base)         // IN
 {
-   AsyncTCPSocket *s = TCPSocket(base);
-   VmTimeType now, done;
-   int retVal;
+   AsyncTCPSocket *asock = TCPSocket(base);
+   return asock->sendBufFull;
+}
 
-   if (s == NULL) {
-      Warning(ASOCKPREFIX "Flush called with invalid arguments!\n");
 
-      return ASOCKERR_INVAL;
-   }
 
-   ASSERT(AsyncTCPSocketIsLocked(s));
-   AsyncTCPSocketAddRef(s);
 
-   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
-      TCPSOCKWARN(s, ("flush called but state is not connected!\n"));
-      retVal = ASOCKERR_INVAL;
-      goto outHaveLock;
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketHasDataPending --
+ *
+ *      Determine if SSL has any pending/unread data.
+ *
+ * Results:
+ *      TRUE if this socket has pending data.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+AsyncTCPSocketHasDataPending(AsyncTCPSocket *asock)   // IN:
+{
+#ifdef ASOCK_URING
+   /* A pending EOF or error also has to be picked up by a read. */
+   if (asock->uring.recvEof || asock->uring.recvErrno != 0) {
+      return TRUE;
    }
+#endif
 
-   now = Hostinfo_SystemTimerUS() / 1000;
-   done = now + timeoutMS;
+   return SSL_Pending(asock->sslSock) || asock->recvAhead.count > 0;
+}
 
-   while (s->sendBufList) {
-      AsyncTCPSocket *asock = NULL;
 
-      retVal = AsyncTCPSocketPoll(s, FALSE, done - now, &asock);
-      if (retVal != ASOCKERR_SUCCESS) {
-         TCPSOCKWARN(s, ("flush failed\n"));
-         goto outHaveLock;
-      }
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketMakeNonBlocking --
+ *
+ *      Make the specified socket non-blocking if it isn't already.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if the operation succeeded, ASOCKERR_GENERIC otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-      ASSERT(asock == s);
-      if ((retVal = AsyncTCPSocketWriteBuffers(s)) != ASOCKERR_SUCCESS) {
-         goto outHaveLock;
-      }
-      ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+static int
+AsyncTCPSocketMakeNonBlocking(int fd)         // IN
+{
+#ifdef _WIN32
+   int retval;
+   u_long argp = 1; /* non-zero => enable non-blocking mode */
 
-      /* Setting timeoutMS to -1 means never timeout. */
-      if (timeoutMS >= 0) {
-         now = Hostinfo_SystemTimerUS() / 1000;
+   retval = ioctlsocket(fd, FIONBIO, &argp);
 
-         /* Don't timeout if you've sent everything */
-         if (now > done && s->sendBufList) {
-            TCPSOCKWARN(s, ("flush timed out\n"));
-            retVal = ASOCKERR_TIMEOUT;
-            goto outHaveLock;
-         }
-      }
+   if (retval != 0) {
+      ASSERT(retval == SOCKET_ERROR);
+
+      return ASOCKERR_GENERIC;
+   }
+#elif defined(__APPLE__)
+   int argp = 1;
+   if (ioctl(fd, FIONBIO, &argp) < 0) {
+      return ASOCKERR_GENERIC;
    }
+#else
+   int flags;
 
-   retVal = ASOCKERR_SUCCESS;
+   if ((flags = fcntl(fd, F_GETFL)) < 0) {
+      return ASOCKERR_GENERIC;
+   }
 
-outHaveLock:
-   AsyncTCPSocketRelease(s);
+   if (!(flags & O_NONBLOCK) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+   {
+      return ASOCKERR_GENERIC;
+   }
+#endif
 
-   return retVal;
+   return ASOCKERR_SUCCESS;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncSocketCancelListenCbSocket --
+ * AsyncSocketAcceptCallback --
  *
- *      Socket specific code for canceling callbacks for a listening socket.
+ *      Poll callback for listening fd waiting to complete an accept
+ *      operation. We call accept to get the new socket fd, create a new
+ *      asock, and call the newFn callback previously supplied by the call to
+ *      AsyncTCPSocket_Listen.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Accepts on listening fd, creates new asock.
  *
  *----------------------------------------------------------------------------
  */
 
 static void
-AsyncTCPSocketCancelListenCb(AsyncTCPSocket *asock)  // IN:
+AsyncTCPSocketAcceptCallback(void *clientData)         // IN
 {
-   Bool removed;
+   AsyncTCPSocket *asock = clientData;
+   int retval;
 
+   ASSERT(asock);
+   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   removed = AsyncTCPSocketPollRemove(asock, TRUE,
-                                      POLL_FLAG_READ | POLL_FLAG_PERIODIC,
-                                      AsyncTCPSocketAcceptCallback);
-   ASSERT(removed);
+   AsyncTCPSocketAddRef(asock);
+   retval = AsyncTCPSocketAcceptInternal(asock);
+
+   /*
+    * See comment for return value of AsyncTCPSocketAcceptInternal().
+    */
+
+   if (retval == ASOCKERR_ACCEPT) {
+      AsyncTCPSocketHandleError(asock, retval);
+   }
+   AsyncTCPSocketRelease(asock);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketAddListenCb --
+ * AsyncTCPSocketConnectCallback --
  *
- *      Socket specific code for adding callbacks for a listening socket.
+ *      Poll callback for connecting fd. Calls through to
+ *      AsyncTCPSocketConnectInternal to do the real work.
  *
  * Results:
- *      TRUE if Poll callback successfully added.
+ *      None.
  *
  * Side effects:
- *      None.
+ *      Creates new asock, fires newFn callback.
  *
  *----------------------------------------------------------------------------
  */
 
-static Bool
-AsyncTCPSocketAddListenCb(AsyncTCPSocket *asock)  // IN:
+static void
+AsyncTCPSocketConnectCallback(void *clientData)         // IN
 {
-   VMwareStatus pollStatus;
+   AsyncTCPSocket *asock = clientData;
+   int retval;
 
+   ASSERT(asock);
+   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   pollStatus = AsyncTCPSocketPollAdd(asock, TRUE,
-                                      POLL_FLAG_READ | POLL_FLAG_PERIODIC,
-                                      AsyncTCPSocketAcceptCallback);
-
-   if (pollStatus != VMWARE_STATUS_SUCCESS) {
-      TCPSOCKWARN(asock, ("failed to install listen accept callback!\n"));
+   AsyncTCPSocketAddRef(asock);
+   retval = AsyncTCPSocketConnectInternal(asock);
+   if (retval != ASOCKERR_SUCCESS) {
+      ASSERT(retval == ASOCKERR_GENERIC); /* Only one we're expecting */
+      AsyncTCPSocketHandleError(asock, retval);
    }
-
-   return pollStatus == VMWARE_STATUS_SUCCESS;
+   AsyncTCPSocketRelease(asock);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketCancelRecvCb --
+ * AsyncTCPSocketRecvCallback --
  *
- *      Socket specific code for canceling callbacks when a receive
- *      request is being canceled.
+ *      Poll callback for input waiting on the socket. We try to pull off the
+ *      remaining data requested by the current receive function.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Reads data, could fire recv completion or trigger socket destruction.
  *
  *----------------------------------------------------------------------------
  */
 
 static void
-AsyncTCPSocketCancelRecvCb(AsyncTCPSocket *asock)  // IN:
+AsyncTCPSocketRecvCallback(void *clientData)         // IN
 {
+   AsyncTCPSocket *asock = clientData;
+   int error;
+
+   ASSERT(asock);
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   if (asock->recvCbTimer) {
-      AsyncTCPSocketPollRemove(asock, FALSE, 0, asock->internalRecvFn);
-      asock->recvCbTimer = FALSE;
+   AsyncTCPSocketAddRef(asock);
+
+   error = AsyncTCPSocketFillRecvBuffer(asock);
+   if (error == ASOCKERR_GENERIC || error == ASOCKERR_REMOTE_DISCONNECT) {
+      AsyncTCPSocketHandleError(asock, error);
    }
-   if (asock->recvCb) {
-      Bool removed;
-      TCPSOCKLOG(1, asock,
-                 ("Removing poll recv callback while cancelling recv.\n"));
-      removed = AsyncTCPSocketPollRemove(asock, TRUE,
-                                         POLL_FLAG_READ | POLL_FLAG_PERIODIC,
-                                         asock->internalRecvFn);
-      ASSERT(removed || AsyncTCPSocketPollParams(asock)->iPoll);
-      asock->recvCb = FALSE;
+#ifdef ASOCK_URING
+   else if (asock->uring.engaged && asock->recvCb &&
+            AsyncTCPSocketGetState(asock) == AsyncSocketConnected) {
+      /* There is no periodic callback; keep a receive in flight. */
+      AsyncTCPSocketUringArmRecv(asock, FALSE);
    }
+#endif
+
+   AsyncTCPSocketRelease(asock);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketCancelCbForClose --
- *
- *      Cancel future asynchronous send and recv by unregistering
- *      their Poll callbacks, and change the socket state to
- *      AsyncTCPSocketCBCancelled if the socket state is AsyncTCPSocketConnected.
+ * AsyncTCPSocketIPollRecvCallback --
  *
- *      The function can be called in a send/recv error handler before
- *      actually closing the socket in a separate thread, to prevent other
- *      code calling AsyncTCPSocket_Send/Recv from re-registering the
- *      callbacks again. The next operation should be just AsyncSocket_Close().
- *      This helps to avoid unnecessary send/recv callbacks before the
- *      socket is closed.
+ *      Poll callback for input waiting on the socket.  IVmdbPoll does not
+ *      handle callback locks, so this function first locks the asyncsocket
+ *      and verify that the recv callback has not been cancelled before
+ *      calling AsyncTCPSocketFillRecvBuffer to do the real work.
  *
  * Results:
- *      ASOCKERR_*.
+ *      None.
  *
  * Side effects:
- *      Unregisters send/recv Poll callbacks, and fires the send
- *      triggers for any remaining output buffers. May also change
- *      the socket state.
+ *      Reads data, could fire recv completion or trigger socket destruction.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketCancelCbForClose(AsyncSocket *base)  // IN:
+static void
+AsyncTCPSocketIPollRecvCallback(void *clientData)  // IN:
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
-   Bool removed;
-
-   ASSERT(AsyncTCPSocketIsLocked(asock));
-
-   if (AsyncTCPSocketGetState(asock) == AsyncSocketConnected) {
-      AsyncTCPSocketSetState(asock, AsyncSocketCBCancelled);
-   }
-
-   /*
-    * Remove the read and write poll callbacks.
-    *
-    * We could fire the current recv completion callback here, but in
-    * practice clients won't want to know about partial reads since it just
-    * complicates the common case (i.e. every read callback would need to
-    * check the len parameter).
-    *
-    * For writes, however, we *do* fire all of the callbacks. The argument
-    * here is that the common case for writes is "fire and forget", e.g.
-    * send this buffer and free it. Firing the triggers at close time
-    * simplifies client code, since the clients aren't forced to keep track
-    * of send buffers themselves. Clients can figure out how much data was
-    * actually transmitted (if they care) by checking the len parameter
-    * passed to the send callback.
-    *
-    * A modification suggested by Jeremy is to pass a list of unsent
-    * buffers and their completion callbacks to the error handler if one is
-    * registered, and only fire the callbacks here if there was no error
-    * handler invoked.
-    */
+#ifdef VMX86_TOOLS
+   NOT_IMPLEMENTED();
+#else
+   AsyncTCPSocket *asock = clientData;
+   MXUserRecLock *lock;
 
-   ASSERT(!asock->base.recvBuf || asock->base.recvFn);
+   ASSERT(asock);
+   ASSERT(AsyncTCPSocketPollParams(asock)->lock == NULL ||
+          !MXUser_IsCurThreadHoldingRecLock(
+             AsyncTCPSocketPollParams(asock)->lock));
 
+   AsyncTCPSocketLock(asock);
    if (asock->recvCbTimer) {
-      AsyncTCPSocketPollRemove(asock, FALSE, 0, asock->internalRecvFn);
+      /* IVmdbPoll only has periodic timer callbacks. */
+      AsyncTCPSocketIPollRemove(asock, FALSE, 0, asock->internalRecvFn);
       asock->recvCbTimer = FALSE;
    }
-   if (asock->recvCb) {
-      TCPSOCKLOG(1, asock, ("recvCb is non-NULL, removing recv callback\n"));
-      removed = AsyncTCPSocketPollRemove(asock, TRUE,
-                                         POLL_FLAG_READ | POLL_FLAG_PERIODIC,
-                                         asock->internalRecvFn);
-      /* Callback might be temporarily removed in AsyncSocket_DoOneMsg. */
-      ASSERT_NOT_TESTED(removed ||
-                        asock->inBlockingRecv ||
-                        AsyncTCPSocketPollParams(asock)->iPoll);
-
-      asock->recvCb = FALSE;
-      asock->base.recvBuf = NULL;
-   }
-
-   if (asock->sendCb) {
-      TCPSOCKLOG(1, asock,
-                 ("sendBufList is non-NULL, removing send callback\n"));
-
+   lock = AsyncTCPSocketPollParams(asock)->lock;
+   if (asock->recvCb && asock->inBlockingRecv == 0) {
+      asock->inIPollCb |= IN_IPOLL_RECV;
+      AsyncTCPSocketRecvCallback(clientData);
+      asock->inIPollCb &= ~IN_IPOLL_RECV;
       /*
-       * The send callback could be either a device or RTime callback, so
-       * we check the latter if it wasn't the former.
+       * Re-register the callback if it has not been canceled.  Lock may have
+       * been dropped to fire recv callback so re-check inBlockingRecv.
        */
-
-      if (asock->sendCbTimer) {
-         removed = AsyncTCPSocketPollRemove(asock, FALSE, 0,
-                                         asock->internalSendFn);
-      } else {
-         removed = AsyncTCPSocketPollRemove(asock, TRUE, POLL_FLAG_WRITE,
-                                         asock->internalSendFn);
+      if (asock->recvCb && asock->inBlockingRecv == 0) {
+         AsyncTCPSocketIPollAdd(asock, TRUE, POLL_FLAG_READ,
+                                asock->internalRecvFn, asock->fd);
       }
-      ASSERT(removed || AsyncTCPSocketPollParams(asock)->iPoll);
-      asock->sendCb = FALSE;
-      asock->sendCbTimer = FALSE;
+   } else {
+      TCPSOCKLG0(asock, ("Skip recv because %s\n",
+                         asock->recvCb ? "blocking recv is in progress"
+                                       : "recv callback is cancelled"));
    }
 
-   /*
-    * Go through any send buffers on the list and fire their
-    * callbacks, reflecting back how much of each buffer has been
-    * submitted to the kernel.  For the first buffer in the list that
-    * may be non-zero, for subsequent buffers it will be zero.
-    */
-   AsyncTCPSocketAddRef(asock);
-   while (asock->sendBufList) {
-      /*
-       * Pop each remaining buffer and fire its completion callback.
-       */
-
-      SendBufList *cur = asock->sendBufList;
-      int pos = asock->sendPos;
-
-      asock->sendBufList = asock->sendBufList->next;
-      asock->sendPos = 0;
-
-      if (cur->sendFn) {
-         cur->sendFn(cur->buf, pos, BaseSocket(asock), cur->clientData);
-      }
-      free(cur);
-   }
+   /* This is a one-shot callback so we always release the reference taken. */
    AsyncTCPSocketRelease(asock);
-   return ASOCKERR_SUCCESS;
+   AsyncTCPSocketUnlock(asock);
+   if (lock != NULL) {
+      MXUser_DecRefRecLock(lock);
+   }
+#endif
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketCancelCbForConnectingClose --
+ * AsyncTCPSocketSendCallback --
  *
- *      Cancels outstanding connect requests for a socket that is going
- *      away.
+ *      Poll callback for output socket buffer space available (socket is
+ *      writable). We iterate over all the remaining buffers in our queue,
+ *      writing as much as we can until we fill the socket buffer again. If we
+ *      don't finish, we register ourselves as a device write callback.
  *
  * Results:
- *      TRUE on callback removed. FALSE otherwise.
+ *      None.
  *
  * Side effects:
- *      None.
+ *      Writes data, could trigger write completion or socket destruction.
  *
  *----------------------------------------------------------------------------
  */
 
-static Bool
-AsyncTCPSocketCancelCbForConnectingClose(AsyncTCPSocket *asock) // IN
+static void
+AsyncTCPSocketSendCallback(void *clientData)         // IN
 {
-   return (AsyncTCPSocketPollRemove(asock, TRUE, POLL_FLAG_WRITE,
-                                    AsyncTCPSocketConnectCallback) ||
-           AsyncTCPSocketPollRemove(asock, FALSE, 0,
-                                    AsyncTCPSocketConnectCallback));
-}
+   AsyncTCPSocket *s = clientData;
+   int retval;
 
+   ASSERT(s);
+   ASSERT(AsyncTCPSocketIsLocked(s));
 
-/*
- *----------------------------------------------------------------------------
- *
- * AsyncTCPSocketSetCloseOptions --
- *
- *      Enables optional behavior for AsyncSocket_Close():
- *
- *      - If flushEnabledMaxWaitMsec is non-zero, the output stream
- *        will be flushed synchronously before the socket is closed.
- *        (default is zero: close socket right away without flushing)
- *
- *      - If closeCb is set, the callback will be called asynchronously
- *        when the socket is actually destroyed.
- *        (default is NULL: no callback)
- *
- * Results:
- *      ASOCKERR_*.
- *
- * Side effects:
- *      None.
- *
- *----------------------------------------------------------------------------
- */
+   AsyncTCPSocketAddRef(s);
+   s->sendCb = FALSE; /* AsyncTCPSocketSendCallback is never periodic */
+   s->sendCbTimer = FALSE;
+   retval = AsyncTCPSocketWriteBuffers(s);
+   if (retval != ASOCKERR_SUCCESS &&
+       retval != ASOCKERR_CLOSED) {
+      AsyncTCPSocketHandleError(s, retval);
+   } else if (s->sendBufList && !s->sendCb) {
+      VMwareStatus pollStatus;
 
-static int
-AsyncTCPSocketSetCloseOptions(AsyncSocket *base,           // IN
-                              int flushEnabledMaxWaitMsec, // IN
-                              AsyncSocketCloseFn closeCb)  // IN
-{
-   AsyncTCPSocket *asock = TCPSocket(base);
-   asock->flushEnabledMaxWaitMsec = flushEnabledMaxWaitMsec;
-   asock->closeCb = closeCb;
-   VERIFY(closeCb == NULL);
-   return ASOCKERR_SUCCESS;
+      /*
+       * We didn't finish, so we need to reschedule the Poll callback (the
+       * write callback is *not* periodic).
+       */
+
+#ifdef _WIN32
+      /*
+       * If any data has been sent out or read in from the sslSock,
+       * SSL has finished the handshaking. Otherwise,
+       * we have to schedule a realtime callback for write. See bug 37147
+       */
+
+      if (!s->sslConnected) {
+         pollStatus = AsyncTCPSocketPollAdd(s, FALSE, 0,
+                                         s->internalSendFn, 100000);
+         VERIFY(pollStatus == VMWARE_STATUS_SUCCESS);
+         s->sendCbTimer = TRUE;
+      } else
+#endif
+      {
+         pollStatus = AsyncTCPSocketPollAdd(s, TRUE, POLL_FLAG_WRITE,
+                                         s->internalSendFn);
+         VERIFY(pollStatus == VMWARE_STATUS_SUCCESS);
+      }
+      s->sendCb = TRUE;
+   }
+   AsyncTCPSocketRelease(s);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketClose --
+ * AsyncTCPSocketIPollSendCallback --
  *
- *      AsyncTCPSocket destructor. The destructor should be safe to call at any
- *      time.  It's invoked automatically for I/O errors on slots that have no
- *      error handler set, and should be called manually by the error handler
- *      as necessary. It could also be called as part of the normal program
- *      flow.
+ *      IVmdbPoll callback for output socket buffer space available.  IVmdbPoll
+ *      does not handle callback locks, so this function first locks the
+ *      asyncsocket and verify that the send callback has not been cancelled.
+ *      IVmdbPoll only has periodic callbacks, so this function unregisters
+ *      itself before calling AsyncTCPSocketSendCallback to do the real work.
  *
  * Results:
- *      ASOCKERR_*.
+ *      None.
  *
  * Side effects:
- *      Closes the socket fd, unregisters all Poll callbacks, and fires the
- *      send triggers for any remaining output buffers.
+ *      Writes data, could trigger write completion or socket destruction.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketClose(AsyncSocket *base)   // IN
+static void
+AsyncTCPSocketIPollSendCallback(void *clientData)  // IN:
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
+#ifdef VMX86_TOOLS
+   NOT_IMPLEMENTED();
+#else
+   AsyncTCPSocket *s = clientData;
+   MXUserRecLock *lock;
 
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   ASSERT(s);
 
-   if (AsyncTCPSocketGetState(asock) == AsyncSocketClosed) {
-      Warning("%s() called on already closed asock!\n", __FUNCTION__);
-      return ASOCKERR_CLOSED;
+   AsyncTCPSocketLock(s);
+   s->inIPollCb |= IN_IPOLL_SEND;
+   lock = AsyncTCPSocketPollParams(s)->lock;
+   if (s->sendCbTimer) {
+      /* IVmdbPoll only has periodic timer callback. */
+      AsyncTCPSocketIPollRemove(s, FALSE, 0, AsyncTCPSocketIPollSendCallback);
+      s->sendCbTimer = FALSE;
    }
-
-   if (asock->listenAsock4 || asock->listenAsock6) {
-      if (asock->listenAsock4) {
-         AsyncSocket_Close(BaseSocket(asock->listenAsock4));
-      }
-      if (asock->listenAsock6) {
-         AsyncSocket_Close(BaseSocket(asock->listenAsock6));
-      }
+   if (s->sendCb) {
+      AsyncTCPSocketSendCallback(s);
    } else {
-      Bool removed;
-      AsyncSocketState oldState;
-
-      /* Flush output if requested via AsyncTCPSocket_SetCloseOptions(). */
-      if (asock->flushEnabledMaxWaitMsec &&
-          AsyncTCPSocketGetState(asock) == AsyncSocketConnected &&
-          !asock->base.errorSeen) {
-         int ret = AsyncTCPSocketFlush(BaseSocket(asock),
-                                       asock->flushEnabledMaxWaitMsec);
-         if (ret != ASOCKERR_SUCCESS) {
-            TCPSOCKWARN(asock,
-                        ("AsyncTCPSocket_Flush failed: %s. Closing now.\n",
-                         AsyncSocket_Err2String(ret)));
-         }
-      }
-
-      /*
-       * Set the new state to closed, and then check the old state and do the
-       * right thing accordingly
-       */
-
-      TCPSOCKLOG(1, asock, ("closing socket\n"));
-      oldState = AsyncTCPSocketGetState(asock);
-      AsyncTCPSocketSetState(asock, AsyncSocketClosed);
-
-      switch(oldState) {
-      case AsyncSocketListening:
-         TCPSOCKLOG(1, asock, ("old state was listening, removing accept "
-                               "callback\n"));
-         AsyncTCPSocketCancelListenCb(asock);
-         break;
-
-      case AsyncSocketConnecting:
-         TCPSOCKLOG(1, asock, ("old state was connecting, removing connect "
-                               "callback\n"));
-         removed = AsyncTCPSocketCancelCbForConnectingClose(asock);
-         if (!removed) {
-            TCPSOCKLOG(1, asock, ("connect callback is not present in the poll "
-                                  "list.\n"));
-         }
-         break;
-
-      case AsyncSocketConnected:
-         TCPSOCKLOG(1, asock, ("old state was connected\n"));
-         AsyncTCPSocketCancelCbForClose(BaseSocket(asock));
-         break;
-
-      case AsyncSocketCBCancelled:
-         TCPSOCKLOG(1, asock, ("old state was CB-cancelled\n"));
-         break;
-
-      default:
-         NOT_REACHED();
-      }
-
-      if (asock->internalConnectFn) {
-         removed = AsyncTCPSocketPollRemove(asock, FALSE, POLL_FLAG_PERIODIC,
-                                            AsyncTCPSocketConnectErrorCheck);
-         ASSERT(removed);
-         asock->internalConnectFn = NULL;
-      }
-
-      if (asock->sslConnectFn && asock->sslPollFlags > 0) {
-         removed = AsyncTCPSocketPollRemove(asock, TRUE, asock->sslPollFlags,
-                                            AsyncTCPSocketSslConnectCallback);
-         ASSERT(removed);
-      }
-
-      if (asock->sslAcceptFn && asock->sslPollFlags > 0) {
-         removed = AsyncTCPSocketPollRemove(asock, TRUE, asock->sslPollFlags,
-                                            AsyncTCPSocketSslAcceptCallback);
-         ASSERT(removed);
-      }
-      asock->sslPollFlags = 0;
-
-      /*
-       * Close the underlying SSL sockets.
-       */
-      SSL_Shutdown(asock->sslSock);
-
-      if (asock->passFd.fd != -1) {
-         SSLGeneric_close(asock->passFd.fd);
-      }
+      TCPSOCKLG0(s, ("cancelled send callback fired\n"));
    }
 
-   AsyncSocketTeardownSocket(base);
-   return ASOCKERR_SUCCESS;
+   s->inIPollCb &= ~IN_IPOLL_SEND;
+   AsyncTCPSocketRelease(s);
+   AsyncTCPSocketUnlock(s);
+   if (lock != NULL) {
+      MXUser_DecRefRecLock(lock);
+   }
+#endif
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketIsSendBufferFull --
+ * AsyncTCPSocketPollAdd --
  *
- *      Indicate if socket send buffer is full.  Note that unless this is
- *      called from a callback function, the return value should be treated
- *      as transient.
+ *    Add a poll callback.  Wrapper for Poll_Callback since we always call
+ *    it in one of two basic forms.
+ *
+ *    If socket is FALSE, user has to pass in the timeout value
  *
  * Results:
- *      0: send space probably available,
- *      1: send has reached maximum,
- *      ASOCKERR_GENERIC: null socket.
+ *    VMwareStatus result code from Poll_Callback
  *
  * Side effects:
- *      None.
+ *    Only the obvious.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketIsSendBufferFull(AsyncSocket *base)         // IN
+static VMwareStatus
+AsyncTCPSocketPollAdd(AsyncTCPSocket *asock,         // IN
+                      Bool socket,                   // IN
+                      int flags,                     // IN
+                      PollerFunction callback,       // IN
+                      ...)                           // IN
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
-   return asock->sendBufFull;
-}
+   int type, info;
+
+   if (socket) {
+      ASSERT(asock->fd != -1);
+      type = POLL_DEVICE;
+      flags |= POLL_FLAG_SOCKET;
+      info = asock->fd;
+   } else {
+      va_list marker;
+      va_start(marker, callback);
+
+      type = POLL_REALTIME;
+      info = va_arg(marker, int);
 
+      va_end(marker);
+   }
+
+   if (AsyncTCPSocketPollParams(asock)->iPoll != NULL) {
+      return AsyncTCPSocketIPollAdd(asock, socket, flags, callback, info);
+   }
 
+   return Poll_Callback(AsyncTCPSocketPollParams(asock)->pollClass,
+                        flags | AsyncTCPSocketPollParams(asock)->flags,
+                        callback, asock, type, info,
+                        AsyncTCPSocketPollParams(asock)->lock);
+}
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketHasDataPending --
+ * AsyncTCPSocketPollRemove --
  *
- *      Determine if SSL has any pending/unread data.
+ *    Remove a poll callback.  Wrapper for Poll_CallbackRemove since we
+ *    always call it in one of two basic forms.
  *
  * Results:
- *      TRUE if this socket has pending data.
+ *    TRUE if removed, FALSE if not found.
  *
  * Side effects:
- *      None.
+ *    Only the obvious.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
 static Bool
-AsyncTCPSocketHasDataPending(AsyncTCPSocket *asock)   // IN:
+AsyncTCPSocketPollRemove(AsyncTCPSocket *asock,         // IN
+                         Bool socket,                   // IN
+                         int flags,                     // IN
+                         PollerFunction callback)       // IN
 {
-   return SSL_Pending(asock->sslSock);
+   int type;
+
+   if (AsyncTCPSocketPollParams(asock)->iPoll != NULL) {
+      return AsyncTCPSocketIPollRemove(asock, socket, flags, callback);
+   }
+
+   if (socket) {
+      ASSERT(asock->fd != -1);
+      type = POLL_DEVICE;
+      flags |= POLL_FLAG_SOCKET;
+   } else {
+      type = POLL_REALTIME;
+   }
+
+   return Poll_CallbackRemove(AsyncTCPSocketPollParams(asock)->pollClass,
+                              flags | AsyncTCPSocketPollParams(asock)->flags,
+                              callback, asock, type);
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketMakeNonBlocking --
+ * AsyncTCPSocketIPollAdd --
  *
- *      Make the specified socket non-blocking if it isn't already.
+ *    Add a poll callback.  Wrapper for IVmdbPoll.Register[Timer].
+ *
+ *    If socket is FALSE, user has to pass in the timeout value
  *
  * Results:
- *      ASOCKERR_SUCCESS if the operation succeeded, ASOCKERR_GENERIC otherwise.
+ *    VMwareStatus result code.
  *
  * Side effects:
- *      None.
+ *    None.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketMakeNonBlocking(int fd)         // IN
+static VMwareStatus
+AsyncTCPSocketIPollAdd(AsyncTCPSocket *asock,         // IN
+                       Bool socket,                   // IN
+                       int flags,                     // IN
+                       PollerFunction callback,       // IN
+                       int info)                      // IN
 {
-#ifdef _WIN32
-   int retval;
-   u_long argp = 1; /* non-zero => enable non-blocking mode */
-
-   retval = ioctlsocket(fd, FIONBIO, &argp);
+#ifdef VMX86_TOOLS
+   return VMWARE_STATUS_ERROR;
+#else
+   VMwareStatus status = VMWARE_STATUS_SUCCESS;
+   VmdbRet ret;
+   IVmdbPoll *poll;
 
-   if (retval != 0) {
-      ASSERT(retval == SOCKET_ERROR);
+   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll);
+   ASSERT(AsyncTCPSocketIsLocked(asock));
 
-      return ASOCKERR_GENERIC;
-   }
-#elif defined(__APPLE__)
-   int argp = 1;
-   if (ioctl(fd, FIONBIO, &argp) < 0) {
-      return ASOCKERR_GENERIC;
+   /* Protect asyncsocket and lock from disappearing */
+   AsyncTCPSocketAddRef(asock);
+   if (AsyncTCPSocketPollParams(asock)->lock != NULL) {
+      MXUser_IncRefRecLock(AsyncTCPSocketPollParams(asock)->lock);
    }
-#else
-   int flags;
 
-   if ((flags = fcntl(fd, F_GETFL)) < 0) {
-      return ASOCKERR_GENERIC;
+   poll = AsyncTCPSocketPollParams(asock)->iPoll;
+
+   if (socket) {
+      int pollFlags = VMDB_PRF_ONE_SHOT |
+                      ((flags & POLL_FLAG_READ) != 0 ? VMDB_PRF_READ
+                                                     : VMDB_PRF_WRITE);
+
+      ret = poll->Register(poll, pollFlags, callback, asock, info);
+   } else {
+      ret = poll->RegisterTimer(poll, callback, asock, info);
    }
 
-   if (!(flags & O_NONBLOCK) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
-   {
-      return ASOCKERR_GENERIC;
+   if (ret != VMDB_S_OK) {
+      Log(ASOCKPREFIX "failed to register callback (%s %d): error %d\n",
+          socket ? "socket" : "delay", info, ret);
+      if (AsyncTCPSocketPollParams(asock)->lock != NULL) {
+         MXUser_DecRefRecLock(AsyncTCPSocketPollParams(asock)->lock);
+      }
+      AsyncTCPSocketRelease(asock);
+      status = VMWARE_STATUS_ERROR;
    }
-#endif
 
-   return ASOCKERR_SUCCESS;
+   return status;
+#endif
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncSocketAcceptCallback --
+ * AsyncTCPSocketIPollRemove --
  *
- *      Poll callback for listening fd waiting to complete an accept
- *      operation. We call accept to get the new socket fd, create a new
- *      asock, and call the newFn callback previously supplied by the call to
- *      AsyncTCPSocket_Listen.
+ *    Remove a poll callback.  Wrapper for IVmdbPoll.Unregister[Timer].
  *
  * Results:
- *      None.
+ *    TRUE  if the callback was registered and has been cancelled successfully.
+ *    FALSE if the callback was not registered, or the callback is already
+ *          scheduled to fire (and is guaranteed to fire).
  *
  * Side effects:
- *      Accepts on listening fd, creates new asock.
+ *    None.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static void
-AsyncTCPSocketAcceptCallback(void *clientData)         // IN
+static Bool
+AsyncTCPSocketIPollRemove(AsyncTCPSocket *asock,         // IN
+                          Bool socket,                   // IN
+                          int flags,                     // IN
+                          PollerFunction callback)       // IN
 {
-   AsyncTCPSocket *asock = clientData;
-   int retval;
+#ifdef VMX86_TOOLS
+   return FALSE;
+#else
+   IVmdbPoll *poll;
+   Bool ret;
 
-   ASSERT(asock);
-   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
+   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll);
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   AsyncTCPSocketAddRef(asock);
-   retval = AsyncTCPSocketAcceptInternal(asock);
+   poll = AsyncTCPSocketPollParams(asock)->iPoll;
 
-   /*
-    * See comment for return value of AsyncTCPSocketAcceptInternal().
-    */
+   if (socket) {
+      int pollFlags = VMDB_PRF_ONE_SHOT |
+                      ((flags & POLL_FLAG_READ) != 0 ? VMDB_PRF_READ
+                                                     : VMDB_PRF_WRITE);
 
-   if (retval == ASOCKERR_ACCEPT) {
-      AsyncTCPSocketHandleError(asock, retval);
+      ret = poll->Unregister(poll, pollFlags, callback, asock);
+   } else {
+      ret = poll->UnregisterTimer(poll, callback, asock);
    }
-   AsyncTCPSocketRelease(asock);
+
+   if (ret &&
+       !((asock->inIPollCb & IN_IPOLL_RECV) != 0 &&
+         callback == asock->internalRecvFn) &&
+       !((asock->inIPollCb & IN_IPOLL_SEND) != 0 &&
+         callback == asock->internalSendFn)) {
+      MXUserRecLock *lock = AsyncTCPSocketPollParams(asock)->lock;
+
+      /*
+       * As the callback has been unregistered and we are not currently in
+       * the callback being removed, we can safely release the reference taken
+       * when registering the callback.
+       */
+      AsyncTCPSocketRelease(asock);
+      if (lock != NULL) {
+         MXUser_DecRefRecLock(lock);
+      }
+   }
+
+   return ret;
+#endif
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketConnectCallback --
+ * AsyncTCPSocketCancelRecv --
  *
- *      Poll callback for connecting fd. Calls through to
- *      AsyncTCPSocketConnectInternal to do the real work.
+ *    Call this function if you know what you are doing. This should be
+ *    called if you want to synchronously receive the outstanding data on
+ *    the socket. It removes the recv poll callback. It also returns number of
+ *    partially read bytes (if any). A partially read response may exist as
+ *    AsyncTCPSocketRecvCallback calls the recv callback only when all the data
+ *    has been received.
  *
  * Results:
- *      None.
+ *    ASOCKERR_SUCCESS or ASOCKERR_INVAL.
  *
  * Side effects:
- *      Creates new asock, fires newFn callback.
+ *    Subsequent client call to AsyncTCPSocket_Recv can reinstate async behaviour.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static void
-AsyncTCPSocketConnectCallback(void *clientData)         // IN
+static int
+AsyncTCPSocketCancelRecv(AsyncSocket *base,          // IN
+                         int *partialRecvd,          // OUT
+                         void **recvBuf,             // OUT
+                         void **recvFn,              // OUT
+                         Bool cancelOnSend)          // IN
 {
-   AsyncTCPSocket *asock = clientData;
-   int retval;
+   AsyncTCPSocket *asock = TCPSocket(base);
+
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
+      Warning(ASOCKPREFIX "Failed to cancel request on disconnected socket!\n");
+      return ASOCKERR_INVAL;
+   }
+
+   if (asock->inBlockingRecv && !asock->inRecvLoop) {
+      Warning(ASOCKPREFIX "Cannot cancel request while a blocking recv is "
+                          "pending.\n");
+      return ASOCKERR_INVAL;
+   }
 
-   ASSERT(asock);
-   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   if (!cancelOnSend && (asock->sendBufList || asock->sendCb)) {
+      Warning(ASOCKPREFIX "Can't cancel request as socket has send operation "
+              "pending.\n");
+      return ASOCKERR_INVAL;
+   }
 
-   AsyncTCPSocketAddRef(asock);
-   retval = AsyncTCPSocketConnectInternal(asock);
-   if (retval != ASOCKERR_SUCCESS) {
-      ASSERT(retval == ASOCKERR_GENERIC); /* Only one we're expecting */
-      AsyncTCPSocketHandleError(asock, retval);
+   AsyncTCPSocketCancelRecvCb(asock);
+   AsyncSocketCancelRecv(BaseSocket(asock), partialRecvd, recvBuf, recvFn);
+
+   if (asock->passFd.fd != -1) {
+      SSLGeneric_close(asock->passFd.fd);
+      asock->passFd.fd = -1;
    }
-   AsyncTCPSocketRelease(asock);
+   asock->passFd.expected = FALSE;
+
+   return ASOCKERR_SUCCESS;
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketRecvCallback --
+ * AsyncTCPSocketGetReceivedFd --
  *
- *      Poll callback for input waiting on the socket. We try to pull off the
- *      remaining data requested by the current receive function.
+ *    Retrieve received file descriptor from socket.
  *
  * Results:
- *      None.
+ *    File descriptor.  Or -1 if none was received.
  *
  * Side effects:
- *      Reads data, could fire recv completion or trigger socket destruction.
+ *    None.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static void
-AsyncTCPSocketRecvCallback(void *clientData)         // IN
+static int
+AsyncTCPSocketGetReceivedFd(AsyncSocket *base)      // IN
 {
-   AsyncTCPSocket *asock = clientData;
-   int error;
+   AsyncTCPSocket *asock = TCPSocket(base);
+   int fd;
 
-   ASSERT(asock);
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   AsyncTCPSocketAddRef(asock);
-
-   error = AsyncTCPSocketFillRecvBuffer(asock);
-   if (error == ASOCKERR_GENERIC || error == ASOCKERR_REMOTE_DISCONNECT) {
-      AsyncTCPSocketHandleError(asock, error);
+   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
+      Warning(ASOCKPREFIX "Failed to receive fd on disconnected socket!\n");
+      return -1;
    }
+   fd = asock->passFd.fd;
+   asock->passFd.fd = -1;
+   asock->passFd.expected = FALSE;
 
-   AsyncTCPSocketRelease(asock);
+   return fd;
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketIPollRecvCallback --
+ * AsyncTCPSocketConnectSSL --
  *
- *      Poll callback for input waiting on the socket.  IVmdbPoll does not
- *      handle callback locks, so this function first locks the asyncsocket
- *      and verify that the recv callback has not been cancelled before
- *      calling AsyncTCPSocketFillRecvBuffer to do the real work.
+ *    Initialize the socket's SSL object, by calling SSL_ConnectAndVerify.
+ *    NOTE: This call is blocking.
  *
  * Results:
- *      None.
+ *    TRUE if SSL_ConnectAndVerify succeeded, FALSE otherwise.
  *
  * Side effects:
- *      Reads data, could fire recv completion or trigger socket destruction.
+ *    None.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static void
-AsyncTCPSocketIPollRecvCallback(void *clientData)  // IN:
+static Bool
+AsyncTCPSocketConnectSSL(AsyncSocket *base,           // IN
+                         SSLVerifyParam *verifyParam, // IN/OPT
+                         void *sslContext)            // IN/OPT
 {
-#ifdef VMX86_TOOLS
-   NOT_IMPLEMENTED();
-#else
-   AsyncTCPSocket *asock = clientData;
-   MXUserRecLock *lock;
-
+#ifndef USE_SSL_DIRECT
+   AsyncTCPSocket *asock = TCPSocket(base);
    ASSERT(asock);
-   ASSERT(AsyncTCPSocketPollParams(asock)->lock == NULL ||
-          !MXUser_IsCurThreadHoldingRecLock(
-             AsyncTCPSocketPollParams(asock)->lock));
 
-   AsyncTCPSocketLock(asock);
-   if (asock->recvCbTimer) {
-      /* IVmdbPoll only has periodic timer callbacks. */
-      AsyncTCPSocketIPollRemove(asock, FALSE, 0, asock->internalRecvFn);
-      asock->recvCbTimer = FALSE;
-   }
-   lock = AsyncTCPSocketPollParams(asock)->lock;
-   if (asock->recvCb && asock->inBlockingRecv == 0) {
-      asock->inIPollCb |= IN_IPOLL_RECV;
-      AsyncTCPSocketRecvCallback(clientData);
-      asock->inIPollCb &= ~IN_IPOLL_RECV;
-      /*
-       * Re-register the callback if it has not been canceled.  Lock may have
-       * been dropped to fire recv callback so re-check inBlockingRecv.
-       */
-      if (asock->recvCb && asock->inBlockingRecv == 0) {
-         AsyncTCPSocketIPollAdd(asock, TRUE, POLL_FLAG_READ,
-                                asock->internalRecvFn, asock->fd);
-      }
-   } else {
-      TCPSOCKLG0(asock, ("Skip recv because %s\n",
-                         asock->recvCb ? "blocking recv is in progress"
-                                       : "recv callback is cancelled"));
+#ifdef ASOCK_URING
+   if (!AsyncTCPSocketUringDisallow(asock)) {
+      return FALSE;
    }
+#endif
 
-   /* This is a one-shot callback so we always release the reference taken. */
-   AsyncTCPSocketRelease(asock);
-   AsyncTCPSocketUnlock(asock);
-   if (lock != NULL) {
-      MXUser_DecRefRecLock(lock);
+   if (sslContext == NULL) {
+      sslContext = SSL_DefaultContext();
    }
+
+   return SSL_ConnectAndVerifyWithContext(asock->sslSock, verifyParam,
+                                          sslContext);
+#else
+   return FALSE;
 #endif
 }
 
 
 /*
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketSendCallback --
+ * AsyncTCPSocketAcceptSSL --
  *
- *      Poll callback for output socket buffer space available (socket is
- *      writable). We iterate over all the remaining buffers in our queue,
- *      writing as much as we can until we fill the socket buffer again. If we
- *      don't finish, we register ourselves as a device write callback.
+ *    Initialize the socket's SSL object, by calling SSL_Accept or
+ *    SSL_AcceptWithContext.
  *
  * Results:
- *      None.
+ *    TRUE if SSL_Accept/SSL_AcceptWithContext succeeded, FALSE otherwise.
  *
  * Side effects:
- *      Writes data, could trigger write completion or socket destruction.
+ *    None.
  *
- *----------------------------------------------------------------------------
+ *-----------------------------------------------------------------------------
  */
 
-static void
-AsyncTCPSocketSendCallback(void *clientData)         // IN
+static Bool
+AsyncTCPSocketAcceptSSL(AsyncSocket *base,  // IN
+                        void *sslCtx)       // IN: optional
 {
-   AsyncTCPSocket *s = clientData;
-   int retval;
-
-   ASSERT(s);
-   ASSERT(AsyncTCPSocketIsLocked(s));
-
-   AsyncTCPSocketAddRef(s);
-   s->sendCb = FALSE; /* AsyncTCPSocketSendCallback is never periodic */
-   s->sendCbTimer = FALSE;
-   retval = AsyncTCPSocketWriteBuffers(s);
-   if (retval != ASOCKERR_SUCCESS &&
-       retval != ASOCKERR_CLOSED) {
-      AsyncTCPSocketHandleError(s, retval);
-   } else if (s->sendBufList && !s->sendCb) {
-      VMwareStatus pollStatus;
-
-      /*
-       * We didn't finish, so we need to reschedule the Poll callback (the
-       * write callback is *not* periodic).
-       */
-
-#ifdef _WIN32
-      /*
-       * If any data has been sent out or read in from the sslSock,
-       * SSL has finished the handshaking. Otherwise,
-       * we have to schedule a realtime callback for write. See bug 37147
-       */
+#ifndef USE_SSL_DIRECT
+   AsyncTCPSocket *asock = TCPSocket(base);
+   ASSERT(asock);
 
-      if (!s->sslConnected) {
-         pollStatus = AsyncTCPSocketPollAdd(s, FALSE, 0,
-                                         s->internalSendFn, 100000);
-         VERIFY(pollStatus == VMWARE_STATUS_SUCCESS);
-         s->sendCbTimer = TRUE;
-      } else
+#ifdef ASOCK_URING
+   if (!AsyncTCPSocketUringDisallow(asock)) {
+      return FALSE;
+   }
 #endif
-      {
-         pollStatus = AsyncTCPSocketPollAdd(s, TRUE, POLL_FLAG_WRITE,
-                                         s->internalSendFn);
-         VERIFY(pollStatus == VMWARE_STATUS_SUCCESS);
-      }
-      s->sendCb = TRUE;
+
+   if (sslCtx) {
+      return SSL_AcceptWithContext(asock->sslSock, sslCtx);
+   } else {
+      return SSL_Accept(asock->sslSock);
    }
-   AsyncTCPSocketRelease(s);
+#else
+   return FALSE;
+#endif
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketIPollSendCallback --
+ * AsyncTCPSocketSslConnectCallback --
  *
- *      IVmdbPoll callback for output socket buffer space available.  IVmdbPoll
- *      does not handle callback locks, so this function first locks the
- *      asyncsocket and verify that the send callback has not been cancelled.
- *      IVmdbPoll only has periodic callbacks, so this function unregisters
- *      itself before calling AsyncTCPSocketSendCallback to do the real work.
+ *      Poll callback to redrive an outstanding ssl connect operation.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      Writes data, could trigger write completion or socket destruction.
+ *      None.
  *
  *----------------------------------------------------------------------------
  */
 
 static void
-AsyncTCPSocketIPollSendCallback(void *clientData)  // IN:
+AsyncTCPSocketSslConnectCallback(void *clientData)  // IN
 {
-#ifdef VMX86_TOOLS
-   NOT_IMPLEMENTED();
-#else
-   AsyncTCPSocket *s = clientData;
-   MXUserRecLock *lock;
+#ifndef USE_SSL_DIRECT
+   int sslOpCode;
+   VMwareStatus pollStatus;
+   AsyncTCPSocket *asock = clientData;
 
-   ASSERT(s);
+   ASSERT(asock);
+   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
+   ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   AsyncTCPSocketLock(s);
-   s->inIPollCb |= IN_IPOLL_SEND;
-   lock = AsyncTCPSocketPollParams(s)->lock;
-   if (s->sendCbTimer) {
-      /* IVmdbPoll only has periodic timer callback. */
-      AsyncTCPSocketIPollRemove(s, FALSE, 0, AsyncTCPSocketIPollSendCallback);
-      s->sendCbTimer = FALSE;
-   }
-   if (s->sendCb) {
-      AsyncTCPSocketSendCallback(s);
+   AsyncTCPSocketAddRef(asock);
+
+   /* Only set if poll callback is registered */
+   asock->sslPollFlags = 0;
+
+   sslOpCode = SSL_TryCompleteConnect(asock->sslSock);
+   if (sslOpCode > 0) {
+      (*asock->sslConnectFn)(TRUE, BaseSocket(asock), asock->clientData);
+   } else if (sslOpCode < 0) {
+      (*asock->sslConnectFn)(FALSE, BaseSocket(asock), asock->clientData);
    } else {
-      TCPSOCKLG0(s, ("cancelled send callback fired\n"));
-   }
+      asock->sslPollFlags = SSL_WantRead(asock->sslSock) ?
+                            POLL_FLAG_READ : POLL_FLAG_WRITE;
+
+      /* register the poll callback to redrive the SSL connect */
+      pollStatus = AsyncTCPSocketPollAdd(asock, TRUE, asock->sslPollFlags,
+                                      AsyncTCPSocketSslConnectCallback);
 
-   s->inIPollCb &= ~IN_IPOLL_SEND;
-   AsyncTCPSocketRelease(s);
-   AsyncTCPSocketUnlock(s);
-   if (lock != NULL) {
-      MXUser_DecRefRecLock(lock);
+      if (pollStatus != VMWARE_STATUS_SUCCESS) {
+         TCPSOCKWARN(asock, ("failed to reinstall ssl connect callback!\n"));
+         asock->sslPollFlags = 0;
+         (*asock->sslConnectFn)(FALSE, BaseSocket(asock), asock->clientData);
+      }
    }
+
+   AsyncTCPSocketRelease(asock);
+#else
+   NOT_IMPLEMENTED();
 #endif
 }
 
@@ -5058,111 +7182,153 @@ AsyncTCPSocketIPollSendCallback(void *clientData)  // IN:
 /*
  *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketPollAdd --
+ * AsyncTCPSocketStartSslConnect --
  *
- *    Add a poll callback.  Wrapper for Poll_Callback since we always call
- *    it in one of two basic forms.
+ *    Start an asynchronous SSL connect operation.
  *
- *    If socket is FALSE, user has to pass in the timeout value
+ *    The supplied callback function is called when the operation is complete
+ *    or an error occurs.
+ *
+ *    Note: The client callback could be invoked from this function or
+ *          from a poll callback. If there is any requirement to always
+ *          invoke the client callback from outside this function, consider
+ *          changing this code to use a poll timer callback with timeout
+ *          set to zero.
  *
  * Results:
- *    VMwareStatus result code from Poll_Callback
+ *    ASOCKERR_SUCCESS or ASOCKERR_*.
+ *    Errors during async processing are reported using the callback supplied.
  *
  * Side effects:
- *    Only the obvious.
+ *    None.
  *
  *-----------------------------------------------------------------------------
  */
 
-static VMwareStatus
-AsyncTCPSocketPollAdd(AsyncTCPSocket *asock,         // IN
-                      Bool socket,                   // IN
-                      int flags,                     // IN
-                      PollerFunction callback,       // IN
-                      ...)                           // IN
+static int
+AsyncTCPSocketStartSslConnect(AsyncSocket *base,                    // IN
+                              SSLVerifyParam *verifyParam,          // IN/OPT
+                              void *sslCtx,                         // IN
+                              AsyncSocketSslConnectFn sslConnectFn, // IN
+                              void *clientData)                     // IN
 {
-   int type, info;
+#ifndef USE_SSL_DIRECT
+   AsyncTCPSocket *asock = TCPSocket(base);
+   Bool ok;
 
-   if (socket) {
-      ASSERT(asock->fd != -1);
-      type = POLL_DEVICE;
-      flags |= POLL_FLAG_SOCKET;
-      info = asock->fd;
-   } else {
-      va_list marker;
-      va_start(marker, callback);
+   ASSERT(asock);
+   ASSERT(sslConnectFn);
 
-      type = POLL_REALTIME;
-      info = va_arg(marker, int);
+   ASSERT(AsyncTCPSocketIsLocked(asock));
 
-      va_end(marker);
+   if (asock->sslConnectFn || asock->sslAcceptFn) {
+      TCPSOCKWARN(asock, ("An SSL operation was already initiated.\n"));
+      return ASOCKERR_GENERIC;
    }
 
-   if (AsyncTCPSocketPollParams(asock)->iPoll != NULL) {
-      return AsyncTCPSocketIPollAdd(asock, socket, flags, callback, info);
+#ifdef ASOCK_URING
+   if (!AsyncTCPSocketUringDisallow(asock)) {
+      return ASOCKERR_INVAL;
    }
+#endif
 
-   return Poll_Callback(AsyncTCPSocketPollParams(asock)->pollClass,
-                        flags | AsyncTCPSocketPollParams(asock)->flags,
-                        callback, asock, type, info,
-                        AsyncTCPSocketPollParams(asock)->lock);
+   ok = SSL_SetupConnectAndVerifyWithContext(asock->sslSock, verifyParam,
+                                             sslCtx);
+   if (!ok) {
+      /* Something went wrong already */
+      (*sslConnectFn)(FALSE, BaseSocket(asock), clientData);
+      return ASOCKERR_GENERIC;
+   }
+
+   asock->sslConnectFn = sslConnectFn;
+   asock->clientData = clientData;
+
+   AsyncTCPSocketSslConnectCallback(asock);
+   return ASOCKERR_SUCCESS;
+#else
+   return ASOCKERR_INVAL;
+#endif
 }
 
 
 /*
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketPollRemove --
+ * AsyncTCPSocketSslAcceptCallback --
  *
- *    Remove a poll callback.  Wrapper for Poll_CallbackRemove since we
- *    always call it in one of two basic forms.
+ *      Poll callback for redrive an outstanding ssl accept operation
  *
  * Results:
- *    TRUE if removed, FALSE if not found.
+ *      None.
  *
  * Side effects:
- *    Only the obvious.
+ *      None.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
-static Bool
-AsyncTCPSocketPollRemove(AsyncTCPSocket *asock,         // IN
-                         Bool socket,                   // IN
-                         int flags,                     // IN
-                         PollerFunction callback)       // IN
+static void
+AsyncTCPSocketSslAcceptCallback(void *clientData)         // IN
 {
-   int type;
+   int sslOpCode;
+   AsyncTCPSocket *asock = clientData;
+   VMwareStatus pollStatus;
 
-   if (AsyncTCPSocketPollParams(asock)->iPoll != NULL) {
-      return AsyncTCPSocketIPollRemove(asock, socket, flags, callback);
-   }
+   ASSERT(asock);
+   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
+   ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   if (socket) {
-      ASSERT(asock->fd != -1);
-      type = POLL_DEVICE;
-      flags |= POLL_FLAG_SOCKET;
+   AsyncTCPSocketAddRef(asock);
+
+   /* Only set if poll callback is registered */
+   asock->sslPollFlags = 0;
+
+   sslOpCode = SSL_TryCompleteAccept(asock->sslSock);
+   if (sslOpCode > 0) {
+      (*asock->sslAcceptFn)(TRUE, BaseSocket(asock), asock->clientData);
+   } else if (sslOpCode < 0) {
+      (*asock->sslAcceptFn)(FALSE, BaseSocket(asock), asock->clientData);
    } else {
-      type = POLL_REALTIME;
+      asock->sslPollFlags = SSL_WantRead(asock->sslSock) ?
+                            POLL_FLAG_READ : POLL_FLAG_WRITE;
+
+      /* register the poll callback to redrive the SSL accept */
+      pollStatus = AsyncTCPSocketPollAdd(asock, TRUE, asock->sslPollFlags,
+                                      AsyncTCPSocketSslAcceptCallback);
+
+      if (pollStatus != VMWARE_STATUS_SUCCESS) {
+         TCPSOCKWARN(asock, ("failed to reinstall ssl accept callback!\n"));
+         asock->sslPollFlags = 0;
+         (*asock->sslAcceptFn)(FALSE, BaseSocket(asock), asock->clientData);
+      }
    }
 
-   return Poll_CallbackRemove(AsyncTCPSocketPollParams(asock)->pollClass,
-                              flags | AsyncTCPSocketPollParams(asock)->flags,
-                              callback, asock, type);
+   AsyncTCPSocketRelease(asock);
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * AsyncTCPSocketIPollAdd --
+ * AsyncTCPSocketStartSslAccept --
  *
- *    Add a poll callback.  Wrapper for IVmdbPoll.Register[Timer].
+ *    Start an asynchronous SSL accept operation.
  *
- *    If socket is FALSE, user has to pass in the timeout value
+ *    The supplied callback function is called when the operation is complete
+ *    or an error occurs.
+ *
+ *    Note: The client callback could be invoked from this function or
+ *          from a poll callback. If there is any requirement to always
+ *          invoke the client callback from outside this function, consider
+ *          changing this code to use a poll timer callback with timeout
+ *          set to zero.
  *
+ *    Note: sslCtx is typed as void *, so that the async socket code does
+ *          not have to include the openssl header. This is in sync with
+ *          SSL_AcceptWithContext(), where the sslCtx param is typed as void *
  * Results:
- *    VMwareStatus result code.
+ *    ASOCKERR_SUCCESS or ASOCKERR_*.
+ *    Errors during async processing reported using the callback supplied.
  *
  * Side effects:
  *    None.
@@ -5170,796 +7336,753 @@ AsyncTCPSocketPollRemove(AsyncTCPSocket *asock,         // IN
  *-----------------------------------------------------------------------------
  */
 
-static VMwareStatus
-AsyncTCPSocketIPollAdd(AsyncTCPSocket *asock,         // IN
-                       Bool socket,                   // IN
-                       int flags,                     // IN
-                       PollerFunction callback,       // IN
-                       int info)                      // IN
+static int
+AsyncTCPSocketStartSslAccept(AsyncSocket *base,                  // IN
+                             void *sslCtx,                       // IN
+                             AsyncSocketSslAcceptFn sslAcceptFn, // IN
+                             void *clientData)                   // IN
 {
-#ifdef VMX86_TOOLS
-   return VMWARE_STATUS_ERROR;
-#else
-   VMwareStatus status = VMWARE_STATUS_SUCCESS;
-   VmdbRet ret;
-   IVmdbPoll *poll;
+   AsyncTCPSocket *asock = TCPSocket(base);
+   Bool ok;
+
+   ASSERT(asock);
+   ASSERT(sslAcceptFn);
 
-   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll);
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
-   /* Protect asyncsocket and lock from disappearing */
-   AsyncTCPSocketAddRef(asock);
-   if (AsyncTCPSocketPollParams(asock)->lock != NULL) {
-      MXUser_IncRefRecLock(AsyncTCPSocketPollParams(asock)->lock);
+   if (asock->sslAcceptFn || asock->sslConnectFn) {
+      TCPSOCKWARN(asock, ("An SSL operation was already initiated.\n"));
+      return ASOCKERR_GENERIC;
    }
 
-   poll = AsyncTCPSocketPollParams(asock)->iPoll;
-
-   if (socket) {
-      int pollFlags = VMDB_PRF_ONE_SHOT |
-                      ((flags & POLL_FLAG_READ) != 0 ? VMDB_PRF_READ
-                                                     : VMDB_PRF_WRITE);
-
-      ret = poll->Register(poll, pollFlags, callback, asock, info);
-   } else {
-      ret = poll->RegisterTimer(poll, callback, asock, info);
+#ifdef ASOCK_URING
+   if (!AsyncTCPSocketUringDisallow(asock)) {
+      return ASOCKERR_INVAL;
    }
+#endif
 
-   if (ret != VMDB_S_OK) {
-      Log(ASOCKPREFIX "failed to register callback (%s %d): error %d\n",
-          socket ? "socket" : "delay", info, ret);
-      if (AsyncTCPSocketPollParams(asock)->lock != NULL) {
-         MXUser_DecRefRecLock(AsyncTCPSocketPollParams(asock)->lock);
-      }
-      AsyncTCPSocketRelease(asock);
-      status = VMWARE_STATUS_ERROR;
+   ok = SSL_SetupAcceptWithContext(asock->sslSock, sslCtx);
+   if (!ok) {
+      /* Something went wrong already */
+      (*sslAcceptFn)(FALSE, BaseSocket(asock), clientData);
+      return ASOCKERR_GENERIC;
    }
 
-   return status;
-#endif
+   asock->sslAcceptFn = sslAcceptFn;
+   asock->clientData = clientData;
+
+   AsyncTCPSocketSslAcceptCallback(asock);
+   return ASOCKERR_SUCCESS;
 }
 
 
 /*
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketIPollRemove --
+ * AsyncTCPSocketSetOption --
  *
- *    Remove a poll callback.  Wrapper for IVmdbPoll.Unregister[Timer].
+ *      This implementation of ->setOption() supports the following
+ *      options. Exact behavior of each cited optID is documented in the
+ *      comment header for that enum value declaration (for non-native options),
+ *      or `man setsockopt`/equivalent (for native options).
+ *
+ *         - layer = SOL_SOCKET, optID =
+ *           SO_SNDBUF, SO_RCVBUF.
+ *
+ *         - layer = IPPROTO_TCP, optID =
+ *           TCP_NODELAY, TCP_KEEPINTVL, TCP_KEEPIDLE, TCP_KEEPCNT.
+ *
+ *         - layer = ASYNC_SOCKET_OPTS_LAYER_BASE, optID (type) =
+ *           ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE (Bool).
  *
  * Results:
- *    TRUE  if the callback was registered and has been cancelled successfully.
- *    FALSE if the callback was not registered, or the callback is already
- *          scheduled to fire (and is guaranteed to fire).
+ *      ASOCKERR_SUCCESS on success, ASOCKERR_* otherwise.
+ *      Invalid option+layer yields ASOCKERR_INVAL.
+ *      Failure to set a native OS option yields ASOCKERR_GENERIC.
+ *      inBufLen being wrong (for the given option) yields undefined behavior.
  *
  * Side effects:
- *    None.
+ *      Depends on option.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
-static Bool
-AsyncTCPSocketIPollRemove(AsyncTCPSocket *asock,         // IN
-                          Bool socket,                   // IN
-                          int flags,                     // IN
-                          PollerFunction callback)       // IN
+static int
+AsyncTCPSocketSetOption(AsyncSocket *asyncSocket,     // IN/OUT
+                        AsyncSocketOpts_Layer layer,  // IN
+                        AsyncSocketOpts_ID optID,     // IN
+                        const void *valuePtr,         // IN
+                        socklen_t inBufLen)           // IN
 {
-#ifdef VMX86_TOOLS
-   return FALSE;
-#else
-   IVmdbPoll *poll;
-   Bool ret;
+   /* Maintenance: Keep this in sync with ...GetOption(). */
 
-   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll);
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   AsyncTCPSocket *tcpSocket = TCPSocket(asyncSocket);
+   Bool isSupported;
 
-   poll = AsyncTCPSocketPollParams(asock)->iPoll;
+   switch ((int)layer)
+   {
+   case SOL_SOCKET:
+   case IPPROTO_TCP:
+   case ASYNC_SOCKET_OPTS_LAYER_BASE:
+      break;
+   default:
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: Option layer [%d] (option [%d]) is not "
+                     "supported for TCP socket.\n",
+                  __FUNCTION__, (int)layer, optID));
+      return ASOCKERR_INVAL;
+   }
 
-   if (socket) {
-      int pollFlags = VMDB_PRF_ONE_SHOT |
-                      ((flags & POLL_FLAG_READ) != 0 ? VMDB_PRF_READ
-                                                     : VMDB_PRF_WRITE);
+   /*
+    * layer is supported.
+    * Handle non-native options first.
+    */
 
-      ret = poll->Unregister(poll, pollFlags, callback, asock);
-   } else {
-      ret = poll->UnregisterTimer(poll, callback, asock);
+   if ((layer == ASYNC_SOCKET_OPTS_LAYER_BASE) &&
+       (optID == ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE)) {
+      ASSERT(inBufLen == sizeof(Bool));
+      tcpSocket->sendLowLatency = *((const Bool *)valuePtr);
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: sendLowLatencyMode set to [%d].\n",
+                  __FUNCTION__, (int)tcpSocket->sendLowLatency));
+      return ASOCKERR_SUCCESS;
    }
 
-   if (ret &&
-       !((asock->inIPollCb & IN_IPOLL_RECV) != 0 &&
-         callback == asock->internalRecvFn) &&
-       !((asock->inIPollCb & IN_IPOLL_SEND) != 0 &&
-         callback == asock->internalSendFn)) {
-      MXUserRecLock *lock = AsyncTCPSocketPollParams(asock)->lock;
+   /*
+    * Handle native (setsockopt()) options from this point on.
+    *
+    * We need the level and option_name arguments for that call.
+    * Our design dictates that, for native options, simply option_name=optID.
+    * So just determine level from our layer enum (for native layers, the enum's
+    * ordinal value is set to the corresponding int level value). Therefore,
+    * level=layer.
+    *
+    * level and option_name are known. However, we only allow the setting of
+    * certain specific options. Anything else is an error.
+    */
+   isSupported = FALSE;
+   if (layer == SOL_SOCKET) {
+      switch (optID) {
+      case SO_SNDBUF:
+      case SO_RCVBUF:
+         isSupported = TRUE;
+      }
+   } else {
+      ASSERT((int)layer == IPPROTO_TCP);
 
-      /*
-       * As the callback has been unregistered and we are not currently in
-       * the callback being removed, we can safely release the reference taken
-       * when registering the callback.
-       */
-      AsyncTCPSocketRelease(asock);
-      if (lock != NULL) {
-         MXUser_DecRefRecLock(lock);
+      switch (optID) {
+         /*
+          * Note: All but TCP_KEEPIDLE are available in Mac OS X (at least
+          * 10.11). iOS and Android are TBD. For now, let's keep it simple and
+          * make all these available in the two known OS where all 3 exist
+          * together, as they're typically often set as a group.
+          * TODO: Possibly enable for other OS in more fine-grained fashion.
+          */
+#if defined(__linux__) || defined(VMX86_SERVER)
+      case TCP_KEEPIDLE:
+      case TCP_KEEPINTVL:
+      case TCP_KEEPCNT:
+#endif
+      case TCP_NODELAY:
+         isSupported = TRUE;
       }
    }
 
-   return ret;
-#endif
+   if (!isSupported) {
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: Option layer/level [%d], option/name [%d]: "
+                     "could not set OS option for TCP socket; "
+                     "option not supported.\n",
+                  __FUNCTION__, (int)layer, optID));
+      return ASOCKERR_INVAL;
+   }
+
+   /* All good. Ready to actually set the OS option. */
+
+   if (setsockopt(tcpSocket->fd, layer, optID,
+                  valuePtr, inBufLen) != 0) {
+      tcpSocket->genericErrno = Err_Errno();
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: Option layer/level [%d], option/name [%d]: "
+                     "could not set OS option for TCP socket; "
+                     "error [%d: %s].\n",
+                  __FUNCTION__, (int)layer, optID,
+                  tcpSocket->genericErrno,
+                  Err_Errno2String(tcpSocket->genericErrno)));
+      return ASOCKERR_GENERIC;
+   }
+
+   TCPSOCKLG0(tcpSocket,
+              ("%s: Option layer/level [%d], option/name [%d]: successfully "
+                  "set OS option for TCP socket.\n",
+               __FUNCTION__, (int)layer, optID));
+
+   return ASOCKERR_SUCCESS;
 }
 
 
 /*
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketCancelRecv --
+ * AsyncTCPSocketGetOption --
  *
- *    Call this function if you know what you are doing. This should be
- *    called if you want to synchronously receive the outstanding data on
- *    the socket. It removes the recv poll callback. It also returns number of
- *    partially read bytes (if any). A partially read response may exist as
- *    AsyncTCPSocketRecvCallback calls the recv callback only when all the data
- *    has been received.
+ *      This is the reverse of AsyncTCPSocketSetOption().
  *
  * Results:
- *    ASOCKERR_SUCCESS or ASOCKERR_INVAL.
+ *      ASOCKERR_SUCCESS on success, ASOCKERR_* otherwise.
+ *      Invalid option+layer yields ASOCKERR_INVAL.
+ *      Failure to get a native OS option yields ASOCKERR_GENERIC.
+ *      *outBufLen being wrong (for the given option) at entry to function
+ *      yields undefined behavior.
  *
  * Side effects:
- *    Subsequent client call to AsyncTCPSocket_Recv can reinstate async behaviour.
+ *      None.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketCancelRecv(AsyncSocket *base,          // IN
-                         int *partialRecvd,          // OUT
-                         void **recvBuf,             // OUT
-                         void **recvFn,              // OUT
-                         Bool cancelOnSend)          // IN
+AsyncTCPSocketGetOption(AsyncSocket *asyncSocket,     // IN/OUT
+                        AsyncSocketOpts_Layer layer,  // IN
+                        AsyncSocketOpts_ID optID,     // IN
+                        void *valuePtr,               // OUT
+                        socklen_t *outBufLen)         // IN/OUT
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
+   /*
+    * Maintenance: Keep this in sync with ...GetOption().
+    * Substantive comments are kept light to avoid redundancy (refer to the
+    * other function).
+    */
 
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   AsyncTCPSocket *tcpSocket = TCPSocket(asyncSocket);
+   Bool isSupported;
 
-   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
-      Warning(ASOCKPREFIX "Failed to cancel request on disconnected socket!\n");
+   switch ((int)layer) {
+   case SOL_SOCKET:
+   case IPPROTO_TCP:
+   case ASYNC_SOCKET_OPTS_LAYER_BASE:
+      break;
+   default:
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: Option layer [%d] (option [%d]) is not "
+                     "supported for TCP socket.\n",
+                  __FUNCTION__, (int)layer, optID));
       return ASOCKERR_INVAL;
    }
 
-   if (asock->inBlockingRecv && !asock->inRecvLoop) {
-      Warning(ASOCKPREFIX "Cannot cancel request while a blocking recv is "
-                          "pending.\n");
-      return ASOCKERR_INVAL;
+   if ((layer == ASYNC_SOCKET_OPTS_LAYER_BASE) &&
+       (optID == ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE)) {
+      ASSERT(*outBufLen >= sizeof(Bool));
+      *outBufLen = sizeof(Bool);
+      *((Bool *)valuePtr) = tcpSocket->sendLowLatency;
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: sendLowLatencyMode is [%d].\n",
+                  __FUNCTION__, (int)tcpSocket->sendLowLatency));
+      return ASOCKERR_SUCCESS;
    }
 
-   if (!cancelOnSend && (asock->sendBufList || asock->sendCb)) {
-      Warning(ASOCKPREFIX "Can't cancel request as socket has send operation "
-              "pending.\n");
-      return ASOCKERR_INVAL;
+   isSupported = FALSE;
+   if (layer == SOL_SOCKET) {
+      switch (optID) {
+      case SO_SNDBUF:
+      case SO_RCVBUF:
+         isSupported = TRUE;
+      }
+   } else {
+      ASSERT((int)layer == IPPROTO_TCP);
+
+      switch (optID) {
+#ifdef __linux__
+      case TCP_KEEPIDLE:
+      case TCP_KEEPINTVL:
+      case TCP_KEEPCNT:
+#endif
+      case TCP_NODELAY:
+         isSupported = TRUE;
+      }
    }
 
-   AsyncTCPSocketCancelRecvCb(asock);
-   AsyncSocketCancelRecv(BaseSocket(asock), partialRecvd, recvBuf, recvFn);
+   if (!isSupported) {
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: Option layer/level [%d], option/name [%d]: "
+                     "could not get OS option for TCP socket; "
+                     "option not supported.\n",
+                  __FUNCTION__, (int)layer, optID));
+      return ASOCKERR_INVAL;
+   }
 
-   if (asock->passFd.fd != -1) {
-      SSLGeneric_close(asock->passFd.fd);
-      asock->passFd.fd = -1;
+   if (getsockopt(tcpSocket->fd, layer, optID,
+                  valuePtr, outBufLen) != 0) {
+      tcpSocket->genericErrno = Err_Errno();
+      TCPSOCKLG0(tcpSocket,
+                 ("%s: Option layer/level [%d], option/name [%d]: "
+                     "could not get OS option for TCP socket; "
+                     "error [%d: %s].\n",
+                  __FUNCTION__, (int)layer, optID,
+                  tcpSocket->genericErrno,
+                  Err_Errno2String(tcpSocket->genericErrno)));
+      return ASOCKERR_GENERIC;
    }
-   asock->passFd.expected = FALSE;
+
+   TCPSOCKLG0(tcpSocket,
+              ("%s: Option layer/level [%d], option/name [%d]: successfully "
+                  "got OS option for TCP socket.\n",
+               __FUNCTION__, (int)layer, optID));
 
    return ASOCKERR_SUCCESS;
 }
 
 
+#ifdef ASOCK_URING
 /*
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketGetReceivedFd --
+ * AsyncTCPSocketUringEngage --
  *
- *    Retrieve received file descriptor from socket.
+ *      Switch a connected plain socket to the io_uring data path. Done on
+ *      the first Recv/Send rather than at creation, so that the owner can
+ *      still start SSL, which keeps the socket on the Poll path.
  *
  * Results:
- *    File descriptor.  Or -1 if none was received.
+ *      None.
  *
  * Side effects:
- *    None.
+ *      Takes two ring buffers; bytes already read ahead are moved over.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketGetReceivedFd(AsyncSocket *base)      // IN
+static void
+AsyncTCPSocketUringEngage(AsyncTCPSocket *s)     // IN
 {
-   AsyncTCPSocket *asock = TCPSocket(base);
-   int fd;
+   ASSERT_ON_COMPILE(ASOCK_RECV_AHEAD_SIZE == ASYNC_URING_BUF_SIZE);
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(s->uring.allowed && !s->uring.engaged);
+   ASSERT(!s->recvCb && !s->sendCb);
 
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   AsyncUring_GetBuf(&s->uring.recvBuf);
+   AsyncUring_GetBuf(&s->uring.sendBuf);
 
-   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
-      Warning(ASOCKPREFIX "Failed to receive fd on disconnected socket!\n");
-      return -1;
+   if (s->recvAhead.count > 0) {
+      memcpy(s->uring.recvBuf.base, s->recvAhead.buf + s->recvAhead.start,
+             s->recvAhead.count);
    }
-   fd = asock->passFd.fd;
-   asock->passFd.fd = -1;
-   asock->passFd.expected = FALSE;
+   s->recvAhead.start = 0;
+   free(s->recvAhead.buf);
+   s->recvAhead.buf = s->uring.recvBuf.base;
 
-   return fd;
+   if (s->waitSet != NULL) {
+      /* From now on receive completions, not the fd, report new data. */
+      AsyncTCPSocketWaitSetCtl(s, FALSE);
+      s->uring.engaged = TRUE;
+      AsyncTCPSocketWaitSetCtl(s, TRUE);
+   }
+   s->uring.engaged = TRUE;
+   TCPSOCKLOG(1, s, ("using io_uring\n"));
 }
 
 
 /*
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketConnectSSL --
+ * AsyncTCPSocketUringDisallow --
  *
- *    Initialize the socket's SSL object, by calling SSL_ConnectAndVerify.
- *    NOTE: This call is blocking.
+ *      Keep a socket on the Poll path because SSL is about to be started
+ *      on it.
  *
  * Results:
- *    TRUE if SSL_ConnectAndVerify succeeded, FALSE otherwise.
+ *      FALSE if it is too late: the socket already uses io_uring.
  *
  * Side effects:
- *    None.
+ *      None.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
 static Bool
-AsyncTCPSocketConnectSSL(AsyncSocket *base,           // IN
-                         SSLVerifyParam *verifyParam, // IN/OPT
-                         void *sslContext)            // IN/OPT
+AsyncTCPSocketUringDisallow(AsyncTCPSocket *s)   // IN
 {
-#ifndef USE_SSL_DIRECT
-   AsyncTCPSocket *asock = TCPSocket(base);
-   ASSERT(asock);
-
-   if (sslContext == NULL) {
-      sslContext = SSL_DefaultContext();
+   if (s->uring.engaged) {
+      TCPSOCKWARN(s, ("SSL can not be started once io_uring is in use.\n"));
+      return FALSE;
    }
+   s->uring.allowed = FALSE;
 
-   return SSL_ConnectAndVerifyWithContext(asock->sslSock, verifyParam,
-                                          sslContext);
-#else
-   return FALSE;
-#endif
+   return TRUE;
 }
 
 
 /*
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketAcceptSSL --
+ * AsyncTCPSocketUringArmRecv --
  *
- *    Initialize the socket's SSL object, by calling SSL_Accept or
- *    SSL_AcceptWithContext.
+ *      Make sure a receive into the (empty) read-ahead buffer is in flight.
+ *      If afterPoll is set, the receive waits for the socket to become
+ *      readable first.
  *
  * Results:
- *    TRUE if SSL_Accept/SSL_AcceptWithContext succeeded, FALSE otherwise.
+ *      None. If the receive can not be submitted, the socket is failed
+ *      with ENOBUFS, reported by the next read.
  *
  * Side effects:
- *    None.
+ *      Takes a reference that the completion releases.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
-static Bool
-AsyncTCPSocketAcceptSSL(AsyncSocket *base,  // IN
-                        void *sslCtx)       // IN: optional
+static void
+AsyncTCPSocketUringArmRecv(AsyncTCPSocket *s,    // IN
+                           Bool afterPoll)       // IN
 {
-#ifndef USE_SSL_DIRECT
-   AsyncTCPSocket *asock = TCPSocket(base);
-   ASSERT(asock);
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(s->uring.engaged);
 
-   if (sslCtx) {
-      return SSL_AcceptWithContext(asock->sslSock, sslCtx);
-   } else {
-      return SSL_Accept(asock->sslSock);
+   if (s->uring.recvOp.inFlight || s->recvAhead.count > 0 ||
+       s->uring.recvEof || s->uring.recvErrno != 0) {
+      return;
+   }
+
+   AsyncTCPSocketAddRef(s);
+   if (!AsyncUring_Read(&s->uring.recvOp, s->fd, &s->uring.recvBuf,
+                        ASYNC_URING_BUF_SIZE, afterPoll)) {
+      TCPSOCKWARN(s, ("failed to submit io_uring receive\n"));
+      s->uring.recvErrno = ENOBUFS;
+      AsyncTCPSocketRelease(s);
    }
-#else
-   return FALSE;
-#endif
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketSslConnectCallback --
+ * AsyncTCPSocketUringRecvDone --
  *
- *      Poll callback to redrive an outstanding ssl connect operation.
+ *      io_uring receive completion: fills the read-ahead buffer (or records
+ *      EOF / the error) and runs the receive callback if one is registered.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Could fire recv completion or trigger socket destruction.
  *
  *----------------------------------------------------------------------------
  */
 
 static void
-AsyncTCPSocketSslConnectCallback(void *clientData)  // IN
+AsyncTCPSocketUringRecvDone(AsyncUringOp *op,    // IN
+                            int res)             // IN
 {
-#ifndef USE_SSL_DIRECT
-   int sslOpCode;
-   VMwareStatus pollStatus;
-   AsyncTCPSocket *asock = clientData;
-
-   ASSERT(asock);
-   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
-   ASSERT(AsyncTCPSocketIsLocked(asock));
-
-   AsyncTCPSocketAddRef(asock);
-
-   /* Only set if poll callback is registered */
-   asock->sslPollFlags = 0;
+   AsyncTCPSocket *s = op->clientData;
 
-   sslOpCode = SSL_TryCompleteConnect(asock->sslSock);
-   if (sslOpCode > 0) {
-      (*asock->sslConnectFn)(TRUE, BaseSocket(asock), asock->clientData);
-   } else if (sslOpCode < 0) {
-      (*asock->sslConnectFn)(FALSE, BaseSocket(asock), asock->clientData);
-   } else {
-      asock->sslPollFlags = SSL_WantRead(asock->sslSock) ?
-                            POLL_FLAG_READ : POLL_FLAG_WRITE;
+   AsyncTCPSocketLock(s);
+   op->inFlight = FALSE;
 
-      /* register the poll callback to redrive the SSL connect */
-      pollStatus = AsyncTCPSocketPollAdd(asock, TRUE, asock->sslPollFlags,
-                                      AsyncTCPSocketSslConnectCallback);
+   if (AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
+      if (res > 0) {
+         TCPSOCKLOG(3, s, ("io_uring recv\t%d\n", res));
+         s->recvAhead.start = 0;
+         s->recvAhead.count = res;
+      } else if (res == 0) {
+         s->uring.recvEof = TRUE;
+      } else if (res == -EAGAIN) {
+         AsyncTCPSocketUringArmRecv(s, TRUE);
+      } else {
+         s->uring.recvErrno = -res;
+      }
 
-      if (pollStatus != VMWARE_STATUS_SUCCESS) {
-         TCPSOCKWARN(asock, ("failed to reinstall ssl connect callback!\n"));
-         asock->sslPollFlags = 0;
-         (*asock->sslConnectFn)(FALSE, BaseSocket(asock), asock->clientData);
+      if (AsyncTCPSocketHasDataPending(s) && s->recvCb &&
+          s->inBlockingRecv == 0 && !s->inRecvLoop) {
+         AsyncTCPSocketRecvCallback(s);
+      } else if (s->waitSet != NULL && AsyncTCPSocketHasDataPending(s)) {
+         AsyncTCPSocketWaitSetQueue(s);
       }
    }
 
-   AsyncTCPSocketRelease(asock);
-#else
-   NOT_IMPLEMENTED();
-#endif
+   AsyncTCPSocketRelease(s);
+   AsyncTCPSocketUnlock(s);
 }
 
 
 /*
- *-----------------------------------------------------------------------------
- *
- * AsyncTCPSocketStartSslConnect --
- *
- *    Start an asynchronous SSL connect operation.
+ *----------------------------------------------------------------------------
  *
- *    The supplied callback function is called when the operation is complete
- *    or an error occurs.
+ * AsyncTCPSocketUringSend --
  *
- *    Note: The client callback could be invoked from this function or
- *          from a poll callback. If there is any requirement to always
- *          invoke the client callback from outside this function, consider
- *          changing this code to use a poll timer callback with timeout
- *          set to zero.
+ *      Submit an io_uring send for the head of the send buffer list. The
+ *      data is copied into the socket's ring buffer, up to
+ *      ASYNC_URING_BUF_SIZE bytes across as many queued buffers as fit, so
+ *      that owners may reclaim their buffers as soon as their send
+ *      callbacks (or AsyncSocket_Close) run, whatever the kernel is doing.
  *
  * Results:
- *    ASOCKERR_SUCCESS or ASOCKERR_*.
- *    Errors during async processing are reported using the callback supplied.
+ *      TRUE if submitted.
  *
  * Side effects:
- *    None.
+ *      Sets sendCb until the completion runs.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketStartSslConnect(AsyncSocket *base,                    // IN
-                              SSLVerifyParam *verifyParam,          // IN/OPT
-                              void *sslCtx,                         // IN
-                              AsyncSocketSslConnectFn sslConnectFn, // IN
-                              void *clientData)                     // IN
+static Bool
+AsyncTCPSocketUringSend(AsyncTCPSocket *s,       // IN
+                        Bool afterPoll)          // IN
 {
-#ifndef USE_SSL_DIRECT
-   AsyncTCPSocket *asock = TCPSocket(base);
-   Bool ok;
+   SendBufList *cur;
+   int len = 0;
 
-   ASSERT(asock);
-   ASSERT(sslConnectFn);
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(s->uring.engaged && !s->sendCb && s->sendBufList != NULL);
 
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   for (cur = s->sendBufList; cur != NULL && len < ASYNC_URING_BUF_SIZE;
+        cur = cur->next) {
+      int pos = cur == s->sendBufList ? s->sendPos : 0;
+      int n = MIN(cur->len - pos, ASYNC_URING_BUF_SIZE - len);
 
-   if (asock->sslConnectFn || asock->sslAcceptFn) {
-      TCPSOCKWARN(asock, ("An SSL operation was already initiated.\n"));
-      return ASOCKERR_GENERIC;
+      memcpy(s->uring.sendBuf.base + len, (uint8 *) cur->buf + pos, n);
+      len += n;
    }
 
-   ok = SSL_SetupConnectAndVerifyWithContext(asock->sslSock, verifyParam,
-                                             sslCtx);
-   if (!ok) {
-      /* Something went wrong already */
-      (*sslConnectFn)(FALSE, BaseSocket(asock), clientData);
-      return ASOCKERR_GENERIC;
+   AsyncTCPSocketAddRef(s);
+   if (!AsyncUring_Send(&s->uring.sendOp, s->fd, &s->uring.sendBuf, len,
+                        afterPoll)) {
+      AsyncTCPSocketRelease(s);
+      return FALSE;
    }
+   s->sendCb = TRUE;
 
-   asock->sslConnectFn = sslConnectFn;
-   asock->clientData = clientData;
-
-   AsyncTCPSocketSslConnectCallback(asock);
-   return ASOCKERR_SUCCESS;
-#else
-   return ASOCKERR_INVAL;
-#endif
+   return TRUE;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketSslAcceptCallback --
+ * AsyncTCPSocketUringSendDone --
  *
- *      Poll callback for redrive an outstanding ssl accept operation
+ *      io_uring send completion: retires what was sent, firing the send
+ *      callbacks, and submits the rest of the queue.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Could trigger write completion or socket destruction.
  *
  *----------------------------------------------------------------------------
  */
 
 static void
-AsyncTCPSocketSslAcceptCallback(void *clientData)         // IN
+AsyncTCPSocketUringSendDone(AsyncUringOp *op,    // IN
+                            int res)             // IN
 {
-   int sslOpCode;
-   AsyncTCPSocket *asock = clientData;
-   VMwareStatus pollStatus;
-
-   ASSERT(asock);
-   ASSERT(AsyncTCPSocketPollParams(asock)->iPoll == NULL);
-   ASSERT(AsyncTCPSocketIsLocked(asock));
+   AsyncTCPSocket *s = op->clientData;
+   int error = ASOCKERR_SUCCESS;
 
-   AsyncTCPSocketAddRef(asock);
+   AsyncTCPSocketLock(s);
+   op->inFlight = FALSE;
+   s->sendCb = FALSE;
 
-   /* Only set if poll callback is registered */
-   asock->sslPollFlags = 0;
+   if (AsyncTCPSocketGetState(s) != AsyncSocketConnected) {
+      goto exit;
+   }
 
-   sslOpCode = SSL_TryCompleteAccept(asock->sslSock);
-   if (sslOpCode > 0) {
-      (*asock->sslAcceptFn)(TRUE, BaseSocket(asock), asock->clientData);
-   } else if (sslOpCode < 0) {
-      (*asock->sslAcceptFn)(FALSE, BaseSocket(asock), asock->clientData);
+   if (res > 0) {
+      TCPSOCKLOG(3, s, ("io_uring sent\t%d\n", res));
+      s->sendBufFull = FALSE;
+      s->sslConnected = TRUE;
+      if (AsyncTCPSocketRetireSentBuffers(s, res) != ASOCKERR_SUCCESS) {
+         goto exit;
+      }
+      if (s->sendBufList != NULL && !s->sendCb &&
+          AsyncTCPSocketGetState(s) == AsyncSocketConnected &&
+          !AsyncTCPSocketUringSend(s, FALSE)) {
+         s->genericErrno = ENOBUFS;
+         error = ASOCKERR_GENERIC;
+      }
+   } else if (res == -EAGAIN) {
+      s->sendBufFull = TRUE;
+      if (!AsyncTCPSocketUringSend(s, TRUE)) {
+         s->genericErrno = ENOBUFS;
+         error = ASOCKERR_GENERIC;
+      }
    } else {
-      asock->sslPollFlags = SSL_WantRead(asock->sslSock) ?
-                            POLL_FLAG_READ : POLL_FLAG_WRITE;
-
-      /* register the poll callback to redrive the SSL accept */
-      pollStatus = AsyncTCPSocketPollAdd(asock, TRUE, asock->sslPollFlags,
-                                      AsyncTCPSocketSslAcceptCallback);
+      s->genericErrno = -res;
+      TCPSOCKLG0(s, ("io_uring send error %d: %s\n", -res,
+                     Err_Errno2String(-res)));
+      error = (res == -EPIPE || res == -ECONNRESET) ?
+              ASOCKERR_REMOTE_DISCONNECT : ASOCKERR_GENERIC;
+   }
 
-      if (pollStatus != VMWARE_STATUS_SUCCESS) {
-         TCPSOCKWARN(asock, ("failed to reinstall ssl accept callback!\n"));
-         asock->sslPollFlags = 0;
-         (*asock->sslAcceptFn)(FALSE, BaseSocket(asock), asock->clientData);
-      }
+   if (error != ASOCKERR_SUCCESS) {
+      AsyncTCPSocketHandleError(s, error);
    }
 
-   AsyncTCPSocketRelease(asock);
+exit:
+   AsyncTCPSocketRelease(s);
+   AsyncTCPSocketUnlock(s);
 }
 
 
 /*
- *-----------------------------------------------------------------------------
- *
- * AsyncTCPSocketStartSslAccept --
- *
- *    Start an asynchronous SSL accept operation.
+ *----------------------------------------------------------------------------
  *
- *    The supplied callback function is called when the operation is complete
- *    or an error occurs.
+ * AsyncTCPSocketUringConnect --
  *
- *    Note: The client callback could be invoked from this function or
- *          from a poll callback. If there is any requirement to always
- *          invoke the client callback from outside this function, consider
- *          changing this code to use a poll timer callback with timeout
- *          set to zero.
+ *      Submit an io_uring connect to s->remoteAddr.
  *
- *    Note: sslCtx is typed as void *, so that the async socket code does
- *          not have to include the openssl header. This is in sync with
- *          SSL_AcceptWithContext(), where the sslCtx param is typed as void *
  * Results:
- *    ASOCKERR_SUCCESS or ASOCKERR_*.
- *    Errors during async processing reported using the callback supplied.
+ *      TRUE if submitted.
  *
  * Side effects:
- *    None.
+ *      Takes a reference that the completion releases.
  *
- *-----------------------------------------------------------------------------
+ *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketStartSslAccept(AsyncSocket *base,                  // IN
-                             void *sslCtx,                       // IN
-                             AsyncSocketSslAcceptFn sslAcceptFn, // IN
-                             void *clientData)                   // IN
-{
-   AsyncTCPSocket *asock = TCPSocket(base);
-   Bool ok;
-
-   ASSERT(asock);
-   ASSERT(sslAcceptFn);
-
-   ASSERT(AsyncTCPSocketIsLocked(asock));
-
-   if (asock->sslAcceptFn || asock->sslConnectFn) {
-      TCPSOCKWARN(asock, ("An SSL operation was already initiated.\n"));
-      return ASOCKERR_GENERIC;
-   }
-
-   ok = SSL_SetupAcceptWithContext(asock->sslSock, sslCtx);
-   if (!ok) {
-      /* Something went wrong already */
-      (*sslAcceptFn)(FALSE, BaseSocket(asock), clientData);
-      return ASOCKERR_GENERIC;
+static Bool
+AsyncTCPSocketUringConnect(AsyncTCPSocket *s)    // IN
+{
+   AsyncTCPSocketAddRef(s);
+   if (!AsyncUring_Connect(&s->uring.connectOp, s->fd,
+                           (struct sockaddr *)&s->remoteAddr,
+                           s->remoteAddrLen)) {
+      AsyncTCPSocketRelease(s);
+      return FALSE;
    }
 
-   asock->sslAcceptFn = sslAcceptFn;
-   asock->clientData = clientData;
-
-   AsyncTCPSocketSslAcceptCallback(asock);
-   return ASOCKERR_SUCCESS;
+   return TRUE;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketSetOption --
- *
- *      This implementation of ->setOption() supports the following
- *      options. Exact behavior of each cited optID is documented in the
- *      comment header for that enum value declaration (for non-native options),
- *      or `man setsockopt`/equivalent (for native options).
- *
- *         - layer = SOL_SOCKET, optID =
- *           SO_SNDBUF, SO_RCVBUF.
- *
- *         - layer = IPPROTO_TCP, optID =
- *           TCP_NODELAY, TCP_KEEPINTVL, TCP_KEEPIDLE, TCP_KEEPCNT.
+ * AsyncTCPSocketUringConnectDone --
  *
- *         - layer = ASYNC_SOCKET_OPTS_LAYER_BASE, optID (type) =
- *           ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE (Bool).
+ *      io_uring connect completion. Kernels that hand a non-blocking
+ *      connect back as in progress get the regular Poll based connect
+ *      callback.
  *
  * Results:
- *      ASOCKERR_SUCCESS on success, ASOCKERR_* otherwise.
- *      Invalid option+layer yields ASOCKERR_INVAL.
- *      Failure to set a native OS option yields ASOCKERR_GENERIC.
- *      inBufLen being wrong (for the given option) yields undefined behavior.
+ *      None.
  *
  * Side effects:
- *      Depends on option.
+ *      Could fire the connect callback or the error handler.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketSetOption(AsyncSocket *asyncSocket,     // IN/OUT
-                        AsyncSocketOpts_Layer layer,  // IN
-                        AsyncSocketOpts_ID optID,     // IN
-                        const void *valuePtr,         // IN
-                        socklen_t inBufLen)           // IN
+static void
+AsyncTCPSocketUringConnectDone(AsyncUringOp *op,         // IN
+                               int res)                  // IN
 {
-   /* Maintenance: Keep this in sync with ...GetOption(). */
-
-   AsyncTCPSocket *tcpSocket = TCPSocket(asyncSocket);
-   Bool isSupported;
-
-   switch ((int)layer)
-   {
-   case SOL_SOCKET:
-   case IPPROTO_TCP:
-   case ASYNC_SOCKET_OPTS_LAYER_BASE:
-      break;
-   default:
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: Option layer [%d] (option [%d]) is not "
-                     "supported for TCP socket.\n",
-                  __FUNCTION__, (int)layer, optID));
-      return ASOCKERR_INVAL;
-   }
+   AsyncTCPSocket *s = op->clientData;
 
-   /*
-    * layer is supported.
-    * Handle non-native options first.
-    */
+   AsyncTCPSocketLock(s);
+   op->inFlight = FALSE;
 
-   if ((layer == ASYNC_SOCKET_OPTS_LAYER_BASE) &&
-       (optID == ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE)) {
-      ASSERT(inBufLen == sizeof(Bool));
-      tcpSocket->sendLowLatency = *((const Bool *)valuePtr);
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: sendLowLatencyMode set to [%d].\n",
-                  __FUNCTION__, (int)tcpSocket->sendLowLatency));
-      return ASOCKERR_SUCCESS;
-   }
+   if (AsyncTCPSocketGetState(s) == AsyncSocketConnecting) {
+      int error = ASOCKERR_SUCCESS;
 
-   /*
-    * Handle native (setsockopt()) options from this point on.
-    *
-    * We need the level and option_name arguments for that call.
-    * Our design dictates that, for native options, simply option_name=optID.
-    * So just determine level from our layer enum (for native layers, the enum's
-    * ordinal value is set to the corresponding int level value). Therefore,
-    * level=layer.
-    *
-    * level and option_name are known. However, we only allow the setting of
-    * certain specific options. Anything else is an error.
-    */
-   isSupported = FALSE;
-   if (layer == SOL_SOCKET) {
-      switch (optID) {
-      case SO_SNDBUF:
-      case SO_RCVBUF:
-         isSupported = TRUE;
+      if (res == 0) {
+         error = AsyncTCPSocketConnectInternal(s);
+      } else if (res == -EINPROGRESS || res == -EALREADY || res == -EAGAIN) {
+         if (AsyncTCPSocketPollAdd(s, TRUE, POLL_FLAG_WRITE,
+                                   AsyncTCPSocketConnectCallback)
+             != VMWARE_STATUS_SUCCESS) {
+            TCPSOCKWARN(s, ("failed to register callback in connect!\n"));
+            error = ASOCKERR_POLL;
+         }
+      } else {
+         s->genericErrno = -res;
+         TCPSOCKLOG(1, s, ("io_uring connect failed: %s\n",
+                           Err_Errno2String(-res)));
+         error = ASOCKERR_GENERIC;
       }
-   } else {
-      ASSERT((int)layer == IPPROTO_TCP);
 
-      switch (optID) {
-         /*
-          * Note: All but TCP_KEEPIDLE are available in Mac OS X (at least
-          * 10.11). iOS and Android are TBD. For now, let's keep it simple and
-          * make all these available in the two known OS where all 3 exist
-          * together, as they're typically often set as a group.
-          * TODO: Possibly enable for other OS in more fine-grained fashion.
-          */
-#if defined(__linux__) || defined(VMX86_SERVER)
-      case TCP_KEEPIDLE:
-      case TCP_KEEPINTVL:
-      case TCP_KEEPCNT:
-#endif
-      case TCP_NODELAY:
-         isSupported = TRUE;
+      if (error != ASOCKERR_SUCCESS) {
+         AsyncTCPSocketHandleError(s, error);
       }
    }
 
-   if (!isSupported) {
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: Option layer/level [%d], option/name [%d]: "
-                     "could not set OS option for TCP socket; "
-                     "option not supported.\n",
-                  __FUNCTION__, (int)layer, optID));
-      return ASOCKERR_INVAL;
-   }
-
-   /* All good. Ready to actually set the OS option. */
-
-   if (setsockopt(tcpSocket->fd, layer, optID,
-                  valuePtr, inBufLen) != 0) {
-      tcpSocket->genericErrno = Err_Errno();
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: Option layer/level [%d], option/name [%d]: "
-                     "could not set OS option for TCP socket; "
-                     "error [%d: %s].\n",
-                  __FUNCTION__, (int)layer, optID,
-                  tcpSocket->genericErrno,
-                  Err_Errno2String(tcpSocket->genericErrno)));
-      return ASOCKERR_GENERIC;
-   }
-
-   TCPSOCKLG0(tcpSocket,
-              ("%s: Option layer/level [%d], option/name [%d]: successfully "
-                  "set OS option for TCP socket.\n",
-               __FUNCTION__, (int)layer, optID));
-
-   return ASOCKERR_SUCCESS;
+   AsyncTCPSocketRelease(s);
+   AsyncTCPSocketUnlock(s);
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketGetOption --
+ * AsyncTCPSocketUringWait --
  *
- *      This is the reverse of AsyncTCPSocketSetOption().
+ *      Blocking helper: wait for an io_uring operation of this socket to
+ *      complete. The socket lock is dropped while waiting.
  *
  * Results:
- *      ASOCKERR_SUCCESS on success, ASOCKERR_* otherwise.
- *      Invalid option+layer yields ASOCKERR_INVAL.
- *      Failure to get a native OS option yields ASOCKERR_GENERIC.
- *      *outBufLen being wrong (for the given option) at entry to function
- *      yields undefined behavior.
+ *      ASOCKERR_SUCCESS or ASOCKERR_TIMEOUT.
  *
  * Side effects:
- *      None.
+ *      May fire io_uring completion callbacks.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketGetOption(AsyncSocket *asyncSocket,     // IN/OUT
-                        AsyncSocketOpts_Layer layer,  // IN
-                        AsyncSocketOpts_ID optID,     // IN
-                        void *valuePtr,               // OUT
-                        socklen_t *outBufLen)         // IN/OUT
+AsyncTCPSocketUringWait(AsyncTCPSocket *s,       // IN
+                        AsyncUringOp *op,        // IN
+                        int timeoutMS)           // IN
 {
-   /*
-    * Maintenance: Keep this in sync with ...GetOption().
-    * Substantive comments are kept light to avoid redundancy (refer to the
-    * other function).
-    */
+   VmTimeType done = Hostinfo_SystemTimerUS() / 1000 + timeoutMS;
 
-   AsyncTCPSocket *tcpSocket = TCPSocket(asyncSocket);
-   Bool isSupported;
-
-   switch ((int)layer) {
-   case SOL_SOCKET:
-   case IPPROTO_TCP:
-   case ASYNC_SOCKET_OPTS_LAYER_BASE:
-      break;
-   default:
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: Option layer [%d] (option [%d]) is not "
-                     "supported for TCP socket.\n",
-                  __FUNCTION__, (int)layer, optID));
-      return ASOCKERR_INVAL;
-   }
+   while (op->inFlight) {
+      int waitMS = ASOCK_URING_WAIT_SLICE_MS;
 
-   if ((layer == ASYNC_SOCKET_OPTS_LAYER_BASE) &&
-       (optID == ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE)) {
-      ASSERT(*outBufLen >= sizeof(Bool));
-      *outBufLen = sizeof(Bool);
-      *((Bool *)valuePtr) = tcpSocket->sendLowLatency;
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: sendLowLatencyMode is [%d].\n",
-                  __FUNCTION__, (int)tcpSocket->sendLowLatency));
-      return ASOCKERR_SUCCESS;
-   }
+      if (timeoutMS >= 0) {
+         VmTimeType left = done - Hostinfo_SystemTimerUS() / 1000;
 
-   isSupported = FALSE;
-   if (layer == SOL_SOCKET) {
-      switch (optID) {
-      case SO_SNDBUF:
-      case SO_RCVBUF:
-         isSupported = TRUE;
+         if (left <= 0) {
+            return ASOCKERR_TIMEOUT;
+         }
+         waitMS = MIN(waitMS, left);
       }
-   } else {
-      ASSERT((int)layer == IPPROTO_TCP);
 
-      switch (optID) {
-#ifdef __linux__
-      case TCP_KEEPIDLE:
-      case TCP_KEEPINTVL:
-      case TCP_KEEPCNT:
-#endif
-      case TCP_NODELAY:
-         isSupported = TRUE;
-      }
+      AsyncTCPSocketUnlock(s);
+      AsyncUring_Wait(waitMS);
+      AsyncTCPSocketLock(s);
    }
 
-   if (!isSupported) {
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: Option layer/level [%d], option/name [%d]: "
-                     "could not get OS option for TCP socket; "
-                     "option not supported.\n",
-                  __FUNCTION__, (int)layer, optID));
-      return ASOCKERR_INVAL;
-   }
+   return ASOCKERR_SUCCESS;
+}
 
-   if (getsockopt(tcpSocket->fd, layer, optID,
-                  valuePtr, outBufLen) != 0) {
-      tcpSocket->genericErrno = Err_Errno();
-      TCPSOCKLG0(tcpSocket,
-                 ("%s: Option layer/level [%d], option/name [%d]: "
-                     "could not get OS option for TCP socket; "
-                     "error [%d: %s].\n",
-                  __FUNCTION__, (int)layer, optID,
-                  tcpSocket->genericErrno,
-                  Err_Errno2String(tcpSocket->genericErrno)));
-      return ASOCKERR_GENERIC;
-   }
 
-   TCPSOCKLG0(tcpSocket,
-              ("%s: Option layer/level [%d], option/name [%d]: successfully "
-                  "got OS option for TCP socket.\n",
-               __FUNCTION__, (int)layer, optID));
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketUringCancel --
+ *
+ *      Cancel the socket's io_uring operations when it is closed. They
+ *      still complete, releasing their references, before the socket and
+ *      its ring buffers can go away.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-   return ASOCKERR_SUCCESS;
+static void
+AsyncTCPSocketUringCancel(AsyncTCPSocket *s)     // IN
+{
+   AsyncUring_Cancel(&s->uring.connectOp);
+   AsyncUring_Cancel(&s->uring.recvOp);
+   AsyncUring_Cancel(&s->uring.sendOp);
 }
+#endif // ASOCK_URING
 
 
 /*
@@ -5981,6 +8104,17 @@ AsyncTCPSocketGetOption(AsyncSocket *asyncSocket,     // IN/OUT
 static void
 AsyncTCPSocketDestroy(AsyncSocket *base)         // IN/OUT
 {
+   AsyncTCPSocket *s = TCPSocket(base);
+
+#ifdef ASOCK_URING
+   if (s->uring.engaged) {
+      ASSERT(s->recvAhead.buf == s->uring.recvBuf.base);
+      AsyncUring_PutBuf(&s->uring.recvBuf);
+      AsyncUring_PutBuf(&s->uring.sendBuf);
+      s->recvAhead.buf = NULL;
+   }
+#endif
+   free(s->recvAhead.buf);
    free(base);
 }
 
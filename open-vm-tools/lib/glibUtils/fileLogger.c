@@ -20,6 +20,12 @@
  * @file fileLogger.c
  *
  * Logger that uses file streams and provides optional log rotation.
+ *
+ * An asynchronous file logger hands the messages to a writer thread through
+ * a bounded queue, so that logging never waits for the disk. The writer
+ * writes the queued messages in batches, at least every flush interval, and
+ * also does the log rotation. When the queue is full, messages are dropped
+ * and counted; the count is logged once there is room again.
  */
 
 #include "glibUtils.h"
@@ -35,16 +41,44 @@
 #endif
 
 
+/* Size of the I/O channel buffer of an asynchronous logger. */
+#define FILELOGGER_ASYNC_BUFFER_SIZE   (64 * 1024)
+
+
+/*
+ * Messages waiting for the writer thread. Any thread may add messages to the
+ * ring; only the writer thread removes them.
+ */
+typedef struct FileLoggerQueue {
+   GMutex        *lock;
+   GCond         *wakeup;         /* Wakes the writer up. */
+   GCond         *drained;        /* Signalled after each written batch. */
+   GThread       *writer;
+   gchar        **ring;
+   gchar        **batch;          /* Writer only. */
+   guint          size;
+   guint          first;          /* Oldest message in the ring. */
+   guint          count;
+   guint          dropped;        /* Since the writer last looked. */
+   guint          flushInterval;  /* In milliseconds. */
+   guint64        queued;         /* Total messages added to the ring. */
+   guint64        written;        /* Total messages written. */
+   gboolean       flushNow;
+   gboolean       stop;
+} FileLoggerQueue;
+
+
 typedef struct FileLogger {
-   GlibLogger     handler;
-   GIOChannel    *file;
-   gchar         *path;
-   gint           logSize;
-   guint64        maxSize;
-   guint          maxFiles;
-   gboolean       append;
-   gboolean       error;
-   GStaticMutex   lock;
+   GlibLogger        handler;
+   GIOChannel       *file;
+   gchar            *path;
+   gint              logSize;
+   guint64           maxSize;
+   guint             maxFiles;
+   gboolean          append;
+   gboolean          error;
+   GStaticMutex      lock;
+   FileLoggerQueue  *queue;       /* NULL for a synchronous logger. */
 } FileLogger;
 
 
@@ -220,7 +254,8 @@ FileLoggerGetPath(FileLogger *data,
  * Opens a log file for writing, backing up the existing log file if one is
  * present. Only one old log file is preserved.
  *
- * @note Make sure this function is called with the write lock held.
+ * @note Make sure this function is called with the write lock held, or from
+ *       the writer thread of an asynchronous logger.
  *
  * @param[in] data   Log handler data.
  *
@@ -302,6 +337,9 @@ FileLoggerOpen(FileLogger *data)
 
    if (logfile != NULL) {
       g_io_channel_set_encoding(logfile, NULL, NULL);
+      if (data->queue != NULL) {
+         g_io_channel_set_buffer_size(logfile, FILELOGGER_ASYNC_BUFFER_SIZE);
+      }
 #ifdef VMX86_TOOLS
       /*
        * Make the logfile readable only by user and root/administrator.
@@ -326,71 +364,236 @@ FileLoggerOpen(FileLogger *data)
 
 /*
  *******************************************************************************
- * FileLoggerLog --                                                       */ /**
+ * FileLoggerWrite --                                                     */ /**
  *
- * Logs a message to the configured destination file. Also opens the file for
- * writing if it hasn't been done yet.
+ * Writes a message to the log file, without flushing it, and does the log
+ * rotation accounting. Also opens the file for writing if it hasn't been done
+ * yet.
  *
- * @param[in] domain    Log domain.
- * @param[in] level     Log level.
+ * @note Make sure this function is called with the write lock held, or from
+ *       the writer thread of an asynchronous logger.
+ *
+ * @param[in] logger    File logger.
  * @param[in] message   Message to log.
- * @param[in] data      File logger.
+ *
+ * @return Whether the message was written.
  *
  *******************************************************************************
  */
 
-static void
-FileLoggerLog(const gchar *domain,
-              GLogLevelFlags level,
-              const gchar *message,
-              gpointer data)
+static gboolean
+FileLoggerWrite(FileLogger *logger,
+                const gchar *message)
 {
-   FileLogger *logger = data;
    gsize written;
 
-   g_static_mutex_lock(&logger->lock);
-
    if (logger->error) {
-      goto exit;
+      return FALSE;
    }
 
    if (logger->file == NULL) {
-      if (logger->file == NULL) {
-         logger->file = FileLoggerOpen(data);
-      }
+      logger->file = FileLoggerOpen(logger);
       if (logger->file == NULL) {
          logger->error = TRUE;
-         goto exit;
+         return FALSE;
       }
    }
 
    if (!FileLoggerIsValid(logger)) {
       logger->error = TRUE;
-      goto exit;
+      return FALSE;
    }
 
    /* Write the log file and do log rotation accounting. */
-   if (g_io_channel_write_chars(logger->file, message, -1, &written, NULL) ==
+   if (g_io_channel_write_chars(logger->file, message, -1, &written, NULL) !=
        G_IO_STATUS_NORMAL) {
-      if (logger->maxSize > 0) {
-         logger->logSize += (gint) written;
-         if (logger->logSize >= logger->maxSize) {
-            g_io_channel_unref(logger->file);
-            logger->append = FALSE;
-            logger->file = FileLoggerOpen(logger);
-         } else {
-            g_io_channel_flush(logger->file, NULL);
-         }
-      } else {
+      return FALSE;
+   }
+
+   if (logger->maxSize > 0) {
+      logger->logSize += (gint) written;
+      if (logger->logSize >= logger->maxSize) {
+         /* Unref'ing the channel flushes it. */
+         g_io_channel_unref(logger->file);
+         logger->append = FALSE;
+         logger->file = FileLoggerOpen(logger);
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * FileLoggerWriterThread --                                              */ /**
+ *
+ * Writer thread of an asynchronous file logger. Waits for a flush interval,
+ * or until the queue is half full or a flush is requested, then writes all
+ * the queued messages at once. Exits once the queue is empty after the
+ * logger has been destroyed.
+ *
+ * @param[in] data   File logger.
+ *
+ * @return NULL.
+ *
+ *******************************************************************************
+ */
+
+static gpointer
+FileLoggerWriterThread(gpointer data)
+{
+   FileLogger *logger = data;
+   FileLoggerQueue *queue = logger->queue;
+
+   g_mutex_lock(queue->lock);
+
+   while (!queue->stop || queue->count > 0) {
+      guint count;
+      guint dropped;
+      guint i;
+
+      if (!queue->stop && !queue->flushNow &&
+          queue->count < queue->size / 2) {
+         GTimeVal deadline;
+
+         g_get_current_time(&deadline);
+         g_time_val_add(&deadline, queue->flushInterval * 1000L);
+         g_cond_timed_wait(queue->wakeup, queue->lock, &deadline);
+      }
+
+      /* Take the whole batch, so the loggers do not wait on the disk. */
+      count = queue->count;
+      for (i = 0; i < count; i++) {
+         queue->batch[i] = queue->ring[(queue->first + i) % queue->size];
+      }
+      queue->first = (queue->first + count) % queue->size;
+      queue->count = 0;
+      dropped = queue->dropped;
+      queue->dropped = 0;
+      queue->flushNow = FALSE;
+
+      g_mutex_unlock(queue->lock);
+
+      for (i = 0; i < count; i++) {
+         FileLoggerWrite(logger, queue->batch[i]);
+         g_free(queue->batch[i]);
+      }
+
+      if (dropped > 0) {
+         gchar *msg = g_strdup_printf("[%u log messages dropped, the logging "
+                                      "queue was full.]\n", dropped);
+         FileLoggerWrite(logger, msg);
+         g_free(msg);
+      }
+
+      if (logger->file != NULL && (count > 0 || dropped > 0)) {
          g_io_channel_flush(logger->file, NULL);
       }
+
+      g_mutex_lock(queue->lock);
+      queue->written += count;
+      g_cond_broadcast(queue->drained);
+   }
+
+   g_mutex_unlock(queue->lock);
+
+   return NULL;
+}
+
+
+/*
+ *******************************************************************************
+ * FileLoggerLog --                                                       */ /**
+ *
+ * Logs a message to the configured destination file. Also opens the file for
+ * writing if it hasn't been done yet.
+ *
+ * An asynchronous logger only queues the message for the writer thread; the
+ * message is dropped if the queue is full.
+ *
+ * @param[in] domain    Log domain.
+ * @param[in] level     Log level.
+ * @param[in] message   Message to log.
+ * @param[in] data      File logger.
+ *
+ *******************************************************************************
+ */
+
+static void
+FileLoggerLog(const gchar *domain,
+              GLogLevelFlags level,
+              const gchar *message,
+              gpointer data)
+{
+   FileLogger *logger = data;
+   FileLoggerQueue *queue = logger->queue;
+
+   if (queue != NULL) {
+      gchar *copy = g_strdup(message);
+
+      g_mutex_lock(queue->lock);
+      if (queue->count == queue->size) {
+         queue->dropped++;
+      } else {
+         queue->ring[(queue->first + queue->count) % queue->size] = copy;
+         copy = NULL;
+         queue->queued++;
+         if (++queue->count == queue->size / 2) {
+            g_cond_signal(queue->wakeup);
+         }
+      }
+      g_mutex_unlock(queue->lock);
+
+      g_free(copy);
+      return;
+   }
+
+   g_static_mutex_lock(&logger->lock);
+
+   if (FileLoggerWrite(logger, message) && logger->file != NULL) {
+      g_io_channel_flush(logger->file, NULL);
    }
 
-exit:
    g_static_mutex_unlock(&logger->lock);
 }
 
 
+/*
+ *******************************************************************************
+ * FileLoggerFlush --                                                     */ /**
+ *
+ * Waits until the messages queued so far have been written. Synchronous
+ * loggers write each message as it comes, so there is nothing to do for them.
+ *
+ * @param[in] data      File logger.
+ *
+ *******************************************************************************
+ */
+
+static void
+FileLoggerFlush(GlibLogger *data)
+{
+   FileLogger *logger = (FileLogger *) data;
+   FileLoggerQueue *queue = logger->queue;
+   guint64 target;
+
+   /* The writer thread itself would wait forever. */
+   if (queue == NULL || g_thread_self() == queue->writer) {
+      return;
+   }
+
+   g_mutex_lock(queue->lock);
+   target = queue->queued;
+   queue->flushNow = TRUE;
+   g_cond_signal(queue->wakeup);
+   while (queue->written < target) {
+      g_cond_wait(queue->drained, queue->lock);
+   }
+   g_mutex_unlock(queue->lock);
+}
+
+
 /*
  ******************************************************************************
  * FileLoggerDestroy --                                               */ /**
@@ -406,6 +609,25 @@ static void
 FileLoggerDestroy(gpointer data)
 {
    FileLogger *logger = data;
+   FileLoggerQueue *queue = logger->queue;
+
+   if (queue != NULL) {
+      /* Let the writer drain the queue, and wait for it. */
+      if (queue->writer != NULL) {
+         g_mutex_lock(queue->lock);
+         queue->stop = TRUE;
+         g_cond_signal(queue->wakeup);
+         g_mutex_unlock(queue->lock);
+         g_thread_join(queue->writer);
+      }
+      g_free(queue->ring);
+      g_free(queue->batch);
+      g_cond_free(queue->drained);
+      g_cond_free(queue->wakeup);
+      g_mutex_free(queue->lock);
+      g_free(queue);
+   }
+
    if (logger->file != NULL) {
       g_io_channel_unref(logger->file);
    }
@@ -446,6 +668,7 @@ GlibUtils_CreateFileLogger(const char *path,
    data->handler.shared = FALSE;
    data->handler.logfn = FileLoggerLog;
    data->handler.dtor = FileLoggerDestroy;
+   data->handler.flush = FileLoggerFlush;
 
    data->path = g_filename_from_utf8(path, -1, NULL, NULL, NULL);
    if (data->path == NULL) {
@@ -461,3 +684,69 @@ GlibUtils_CreateFileLogger(const char *path,
    return &data->handler;
 }
 
+
+/*
+ *******************************************************************************
+ * GlibUtils_CreateAsyncFileLogger --                                     */ /**
+ *
+ * @brief Creates a new file logger that writes from a background thread.
+ *
+ * Logging a message only adds it to a queue. A writer thread writes the queued
+ * messages every @a flushInterval milliseconds, or as soon as the queue is
+ * half full. If the queue is full, messages are dropped and the number of
+ * dropped messages is logged later. Messages still queued are written when
+ * the logger is destroyed.
+ *
+ * Falls back to a synchronous logger if the writer thread cannot be started.
+ *
+ * @param[in] path            Path to log file.
+ * @param[in] append          Whether to append to existing log file.
+ * @param[in] maxSize         Maximum log file size (in MB, 0 = no limit).
+ * @param[in] maxFiles        Maximum number of old files to be kept.
+ * @param[in] queueSize       Maximum number of queued messages (> 1).
+ * @param[in] flushInterval   Maximum time before a message is written (ms).
+ *
+ * @return A new logger, or NULL on error.
+ *
+ *******************************************************************************
+ */
+
+GlibLogger *
+GlibUtils_CreateAsyncFileLogger(const char *path,
+                                gboolean append,
+                                guint maxSize,
+                                guint maxFiles,
+                                guint queueSize,
+                                guint flushInterval)
+{
+   FileLogger *data;
+   FileLoggerQueue *queue;
+
+   g_return_val_if_fail(queueSize > 1, NULL);
+   g_return_val_if_fail(flushInterval > 0, NULL);
+
+   data = (FileLogger *) GlibUtils_CreateFileLogger(path, append, maxSize,
+                                                    maxFiles);
+   if (data == NULL) {
+      return NULL;
+   }
+
+   queue = g_new0(FileLoggerQueue, 1);
+   queue->lock = g_mutex_new();
+   queue->wakeup = g_cond_new();
+   queue->drained = g_cond_new();
+   queue->size = queueSize;
+   queue->ring = g_new(gchar *, queueSize);
+   queue->batch = g_new(gchar *, queueSize);
+   queue->flushInterval = flushInterval;
+   data->queue = queue;
+
+   queue->writer = g_thread_create(FileLoggerWriterThread, data, TRUE, NULL);
+   if (queue->writer == NULL) {
+      /* The destructor frees the queue. */
+      FileLoggerDestroy(data);
+      return GlibUtils_CreateFileLogger(path, append, maxSize, maxFiles);
+   }
+
+   return &data->handler;
+}
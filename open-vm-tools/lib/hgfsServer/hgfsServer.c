@@ -58,6 +58,7 @@
 #define HGFS_PARENT_DIR "..\\"
 #else
 #include <unistd.h>
+#include <sys/resource.h> // for getrlimit
 #define stricmp strcasecmp
 #define HGFS_PARENT_DIR "../"
 #endif // _WIN32
@@ -122,9 +123,56 @@
 #define NUM_FILE_NODES 100
 #define NUM_SEARCHES 100
 
+/*
+ * Maximum number of directories kept open by the incremental searches of
+ * a session. Beyond that the least recently used search has its directory
+ * closed, and reopened when it is read again.
+ */
+#define HGFS_MAX_SEARCH_DIR_FDS 64
+
+/*
+ * File node handles encode the node's slot in the session nodeArray in the
+ * low bits and the slot's generation in the high bits, so a handle maps to
+ * its node in constant time and a stale handle for a recycled slot is
+ * rejected. Each slot counts its own generations and is retired, i.e. never
+ * put back on the free list, once its generation would wrap, so a stale
+ * handle can never name a later user of its slot.
+ *
+ * The generation in the handle is offset by the server-wide handle counter
+ * as of the slot's first use, and every node allocation advances that
+ * counter. A slot's handles therefore continue where the same slot of any
+ * earlier session left off, and as the counter is checkpointed, handles
+ * the guest kept across a checkpoint restore are not handed out again
+ * (until the counter has advanced by HGFS_FILE_NODE_MAX_GENERATION).
+ * Generation 0 is never used, and neither is the all-ones slot, so that no
+ * node handle can equal HGFS_INVALID_HANDLE.
+ */
+#define HGFS_FILE_NODE_SLOT_BITS   16
+#define HGFS_FILE_NODE_SLOT_MASK   ((1U << HGFS_FILE_NODE_SLOT_BITS) - 1)
+#define HGFS_FILE_NODE_MAX_SLOTS   HGFS_FILE_NODE_SLOT_MASK
+#define HGFS_FILE_NODE_MAX_GENERATION                                     \
+   ((uint32)(~0U >> HGFS_FILE_NODE_SLOT_BITS))
+
+#define HGFS_FILE_NODE_HANDLE(_slot, _base, _gen)                         \
+   ((HgfsHandle)(((((_base) + (_gen) - 1) %                               \
+                   HGFS_FILE_NODE_MAX_GENERATION + 1)                     \
+                  << HGFS_FILE_NODE_SLOT_BITS) |                          \
+                 ((_slot) & HGFS_FILE_NODE_SLOT_MASK)))
+#define HGFS_FILE_NODE_HANDLE_SLOT(_handle)                               \
+   ((uint32)(_handle) & HGFS_FILE_NODE_SLOT_MASK)
+
 /* Default maximun number of open nodes that have server locks. */
 #define MAX_LOCKED_FILENODES 10
 
+/*
+ * Bounds used when sizing the open node cache from the process file
+ * descriptor limit: at most 1/HGFS_CACHED_FILENODES_FD_SHARE of the
+ * descriptors are given to the cache, and never more than
+ * HGFS_MAX_CACHED_FILENODES_LIMIT.
+ */
+#define HGFS_CACHED_FILENODES_FD_SHARE    4
+#define HGFS_MAX_CACHED_FILENODES_LIMIT   4096
+
 
 struct HgfsTransportSessionInfo {
    /* Default session id. */
@@ -323,6 +371,10 @@ static void HgfsRemoveSearchInternal(HgfsSearch *search,
 static HgfsSearch *HgfsSearchHandle2Search(HgfsHandle handle,
                                            HgfsSessionInfo *session);
 static HgfsHandle HgfsSearch2SearchHandle(HgfsSearch const *search);
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+static void HgfsServerLimitSearchDirFds(HgfsSearch *search,
+                                        HgfsSessionInfo *session);
+#endif
 static HgfsSearch *HgfsAddNewSearch(char const *utf8Dir,
                                     DirectorySearchType type,
                                     char const *utf8ShareName,
@@ -595,19 +647,23 @@ static HgfsFileNode *
 HgfsHandle2FileNode(HgfsHandle handle,        // IN: Hgfs file handle
                     HgfsSessionInfo *session) // IN: Session info
 {
-   unsigned int i;
-   HgfsFileNode *fileNode = NULL;
+   uint32 slot = HGFS_FILE_NODE_HANDLE_SLOT(handle);
+   HgfsFileNode *fileNode;
 
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   /* XXX: This O(n) lookup can and should be optimized. */
-   for (i = 0; i < session->numNodes; i++) {
-      if (session->nodeArray[i].state != FILENODE_STATE_UNUSED &&
-          session->nodeArray[i].handle == handle) {
-         fileNode = &session->nodeArray[i];
-         break;
-      }
+   if (slot >= session->numNodes) {
+      return NULL;
+   }
+
+   /*
+    * The slot is only a hint: the node must be in use and carry the exact
+    * handle, otherwise the handle belongs to a previous user of this slot.
+    */
+   fileNode = &session->nodeArray[slot];
+   if (fileNode->state == FILENODE_STATE_UNUSED || fileNode->handle != handle) {
+      return NULL;
    }
 
    return fileNode;
@@ -838,7 +894,7 @@ HgfsFileDesc2Handle(fileDesc fd,              // IN: OS handle (file descriptor)
                     HgfsSessionInfo *session, // IN: Session info
                     HgfsHandle *handle)       // OUT: Hgfs file handle
 {
-   unsigned int i;
+   DblLnkLst_Links *link;
    Bool found = FALSE;
    HgfsFileNode *existingFileNode = NULL;
 
@@ -847,10 +903,17 @@ HgfsFileDesc2Handle(fileDesc fd,              // IN: OS handle (file descriptor)
 
    MXUser_AcquireExclLock(session->nodeArrayLock);
 
-   for (i = 0; i < session->numNodes; i++) {
-      existingFileNode = &session->nodeArray[i];
-      if ((existingFileNode->state == FILENODE_STATE_IN_USE_CACHED) &&
-          (existingFileNode->fileDesc == fd)) {
+   /*
+    * Only cached nodes have an open fd, and they are all on the cached
+    * list. Walk it from the most recently used end: the fd was just
+    * obtained through HgfsPlatformGetFd, which moved its node there.
+    */
+   for (link = session->nodeCachedList.prev;
+        link != &session->nodeCachedList;
+        link = link->prev) {
+      existingFileNode = DblLnkLst_Container(link, HgfsFileNode, links);
+      ASSERT(existingFileNode->state == FILENODE_STATE_IN_USE_CACHED);
+      if (existingFileNode->fileDesc == fd) {
          *handle = HgfsFileNode2Handle(existingFileNode);
          found = TRUE;
          break;
@@ -1509,8 +1572,17 @@ HgfsGetNewNode(HgfsSessionInfo *session)  // IN: session info
          HgfsDumpAllNodes(session);
       }
 
-      /* Try to get twice as much memory as we had */
-      newNumNodes = 2 * session->numNodes;
+      /*
+       * Try to get twice as much memory as we had, without growing past
+       * the number of slots a file node handle can encode.
+       */
+      if (session->numNodes >= HGFS_FILE_NODE_MAX_SLOTS) {
+         LOG(4, ("%s: all %u node slots in use\n", __FUNCTION__,
+                 session->numNodes));
+
+         return NULL;
+      }
+      newNumNodes = MIN(2 * session->numNodes, HGFS_FILE_NODE_MAX_SLOTS);
       newMem = (HgfsFileNode *)realloc(session->nodeArray,
                                        newNumNodes * sizeof *(session->nodeArray));
       if (!newMem) {
@@ -1567,6 +1639,7 @@ HgfsGetNewNode(HgfsSessionInfo *session)  // IN: session info
          DblLnkLst_Init(&newMem[i].links);
 
          newMem[i].state = FILENODE_STATE_UNUSED;
+         newMem[i].generation = 0;
          newMem[i].utf8Name = NULL;
          newMem[i].utf8NameLen = 0;
          newMem[i].fileCtx = NULL;
@@ -1639,6 +1712,16 @@ HgfsRemoveFileNode(HgfsFileNode *node,        // IN: file node
       node->shareInfo.rootDir = NULL;
    }
 
+   /*
+    * A slot whose generation is used up is retired: its next handle would
+    * equal one handed out before.
+    */
+   if (node->generation == HGFS_FILE_NODE_MAX_GENERATION) {
+      LOG(4, ("%s: retiring node slot %u\n", __FUNCTION__,
+              HGFS_FILE_NODE_HANDLE_SLOT(node->handle)));
+      return;
+   }
+
    /* Prepend at the beginning of the list */
    DblLnkLst_LinkFirst(&session->nodeFreeList, &node->links);
 }
@@ -1734,6 +1817,7 @@ HgfsAddNewFileNode(HgfsFileOpenInfo *openInfo,  // IN: open info struct
 {
    HgfsFileNode *newNode;
    char* rootDir;
+   uint32 handleCounter;
 
    ASSERT(openInfo);
    ASSERT(localId);
@@ -1791,7 +1875,15 @@ HgfsAddNewFileNode(HgfsFileOpenInfo *openInfo,  // IN: open info struct
    rootDir[newNode->shareInfo.rootDirLen] = '\0';
    newNode->shareInfo.rootDir = rootDir;
 
-   newNode->handle = HgfsServerGetNextHandleCounter();
+   ASSERT(newNode->generation < HGFS_FILE_NODE_MAX_GENERATION);
+   handleCounter = HgfsServerGetNextHandleCounter();
+   if (newNode->generation == 0) {
+      newNode->generationBase = handleCounter % HGFS_FILE_NODE_MAX_GENERATION;
+   }
+   newNode->generation++;
+   newNode->handle = HGFS_FILE_NODE_HANDLE(newNode - session->nodeArray,
+                                           newNode->generationBase,
+                                           newNode->generation);
    newNode->localId = *localId;
    newNode->fileDesc = fileDesc;
    newNode->shareAccess = (openInfo->mask & HGFS_OPEN_VALID_SHARE_ACCESS) ?
@@ -2166,6 +2258,12 @@ HgfsGetNewSearch(HgfsSessionInfo *session)  // IN: session info
          newMem[i].shareInfo.rootDirLen = 0;
          newMem[i].dents = NULL;
          newMem[i].numDents = 0;
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+         newMem[i].dirIncremental = FALSE;
+         newMem[i].dirFd = -1;
+         newMem[i].dentsBase = 0;
+         newMem[i].dirEof = FALSE;
+#endif
 
          /* Append at the end of the list */
          DblLnkLst_LinkLast(&session->searchFreeList, &newMem[i].links);
@@ -2297,6 +2395,12 @@ HgfsGetSearchCopy(HgfsHandle handle,        // IN: Hgfs search handle
    /* No dents for the copy, they consume too much memory and aren't needed. */
    copy->dents = NULL;
    copy->numDents = 0;
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   copy->dirIncremental = FALSE;
+   copy->dirFd = -1;
+   copy->dentsBase = 0;
+   copy->dirEof = FALSE;
+#endif
 
    copy->handle = original->handle;
    copy->type = original->type;
@@ -2350,6 +2454,12 @@ HgfsAddNewSearch(char const *utf8Dir,       // IN: UTF8 name of dir to search in
 
    newSearch->dents = NULL;
    newSearch->numDents = 0;
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   newSearch->dirIncremental = FALSE;
+   newSearch->dirFd = -1;
+   newSearch->dentsBase = 0;
+   newSearch->dirEof = FALSE;
+#endif
    newSearch->flags = 0;
    newSearch->type = type;
    newSearch->handle = HgfsServerGetNextHandleCounter();
@@ -2374,7 +2484,8 @@ HgfsAddNewSearch(char const *utf8Dir,       // IN: UTF8 name of dir to search in
  *
  * HgfsFreeSearchDirents --
  *
- *    Frees all dirents and dirents pointer array.
+ *    Frees all dirents and dirents pointer array, and closes the directory
+ *    of an incremental search.
  *
  *    Caller should hold the session's searchArrayLock.
  *
@@ -2400,6 +2511,12 @@ HgfsFreeSearchDirents(HgfsSearch *search)       // IN/OUT: search
       free(search->dents);
       search->dents = NULL;
    }
+   search->numDents = 0;
+
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   HgfsPlatformScandirClose(search);
+   search->dentsBase = 0;
+#endif
 }
 
 
@@ -2566,6 +2683,65 @@ exit:
 }
 
 
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerLimitSearchDirFds --
+ *
+ *    Mark a search as used and, if it is about to open its directory while
+ *    HGFS_MAX_SEARCH_DIR_FDS directories are already open for the session's
+ *    searches, close the directory of the least recently used one. That
+ *    search keeps its window and reopens the directory when read again.
+ *
+ *    Caller should hold the session's searchArrayLock.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    May close the directory of another search.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerLimitSearchDirFds(HgfsSearch *search,        // IN/OUT: search to use
+                            HgfsSessionInfo *session)  // IN/OUT: session info
+{
+   HgfsSearch *lru = NULL;
+   uint32 numOpen = 0;
+   uint32 i;
+
+   search->dirLastUse = ++session->searchDirUseCount;
+
+   if (search->dirFd != -1) {
+      return;
+   }
+
+   for (i = 0; i < session->numSearches; i++) {
+      HgfsSearch *other = &session->searchArray[i];
+
+      if (other == search ||
+          DblLnkLst_IsLinked(&other->links) ||
+          other->dirFd == -1) {
+         continue;
+      }
+      numOpen++;
+      if (lru == NULL || other->dirLastUse < lru->dirLastUse) {
+         lru = other;
+      }
+   }
+
+   if (numOpen >= HGFS_MAX_SEARCH_DIR_FDS) {
+      LOG(4, ("%s: closing directory of idle search %u\n", __FUNCTION__,
+              lru->handle));
+      HgfsPlatformScandirSuspend(lru);
+   }
+}
+#endif
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -2604,14 +2780,31 @@ HgfsServerGetDirEntry(HgfsHandle handle,                // IN: Handle to search
       goto out;
    }
 
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   /* Bring the entry into the window of an incremental search. */
+   if (search->dirIncremental) {
+      HgfsServerLimitSearchDirFds(search, session);
+   }
+   status = HgfsPlatformScandirFill(search, index);
+   if (status != HGFS_ERROR_SUCCESS) {
+      goto out;
+   }
+#endif
+
    /* No more entries or none. */
-   if (search->dents == NULL) {
+   if (search->dents == NULL || search->numDents == 0) {
       goto out;
    }
 
    if (HGFS_SEARCH_LAST_ENTRY_INDEX == index) {
       /* Set the index to the final entry. */
       index = search->numDents - 1;
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   } else {
+      /* Index into the window. */
+      ASSERT(index >= search->dentsBase);
+      index -= search->dentsBase;
+#endif
    }
 
    status = HgfsPlatformGetDirEntry(search,
@@ -3895,6 +4088,61 @@ HgfsServerGetShareName(HgfsSharedFolderHandle sharedFolder, // IN: Notify handle
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerSizeNodeCache --
+ *
+ *    Fit the maximum number of cached open nodes to the process file
+ *    descriptor limit. Each cached node holds a host file descriptor open,
+ *    so the cache is given a fixed share of RLIMIT_NOFILE: a configured
+ *    size above that share is lowered, and the stock default is raised to
+ *    it so workloads touching many files do not keep closing and reopening
+ *    them on the host.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    May change config->maxCachedOpenNodes.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerSizeNodeCache(HgfsServerConfig *config)  // IN/OUT: server settings
+{
+#if !defined(_WIN32)
+   struct rlimit fdLimit;
+   uint32 maxNodes;
+
+   if (getrlimit(RLIMIT_NOFILE, &fdLimit) < 0) {
+      LOG(4, ("%s: Could not get file descriptor limit\n", __FUNCTION__));
+      return;
+   }
+
+   if (fdLimit.rlim_cur == RLIM_INFINITY ||
+       fdLimit.rlim_cur / HGFS_CACHED_FILENODES_FD_SHARE >
+          HGFS_MAX_CACHED_FILENODES_LIMIT) {
+      maxNodes = HGFS_MAX_CACHED_FILENODES_LIMIT;
+   } else {
+      maxNodes = (uint32)(fdLimit.rlim_cur / HGFS_CACHED_FILENODES_FD_SHARE);
+   }
+
+   /* Locked nodes are never evicted, always leave room for others. */
+   maxNodes = MAX(maxNodes, MAX_LOCKED_FILENODES + 1);
+
+   if (config->maxCachedOpenNodes == HGFS_MAX_CACHED_FILENODES ||
+       config->maxCachedOpenNodes > maxNodes) {
+      config->maxCachedOpenNodes = maxNodes;
+   }
+
+   LOG(4, ("%s: fd limit %"FMT64"u, caching up to %u open nodes\n",
+           __FUNCTION__, (uint64)fdLimit.rlim_cur, config->maxCachedOpenNodes));
+#endif
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -3926,6 +4174,7 @@ HgfsServer_InitState(const HgfsServerCallbacks **callbackTable,   // IN/OUT: our
    if (NULL != serverCfgData) {
       gHgfsCfgSettings = *serverCfgData;
    }
+   HgfsServerSizeNodeCache(&gHgfsCfgSettings);
 
    /*
     * Initialize the globals for handling the active shared folders.
@@ -4876,6 +5125,12 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
 
    Log("%s: teardown session %p id 0x%"FMT64"x\n", __FUNCTION__, session, session->sessionId);
 
+   LOG(4, ("%s: node cache hits %"FMT64"u misses %"FMT64"u evictions %"FMT64"u "
+           "reopens %"FMT64"u reopen time %"FMT64"u us\n", __FUNCTION__,
+           session->nodeCacheStats.hits, session->nodeCacheStats.misses,
+           session->nodeCacheStats.evictions, session->nodeCacheStats.reopens,
+           session->nodeCacheStats.reopenTimeUS));
+
    /* Recycle all nodes that are still in use, then destroy the node pool. */
    for (i = 0; i < session->numNodes; i++) {
       HgfsHandle handle;
@@ -5883,8 +6138,13 @@ HgfsServerSearchRealDir(char const *baseDir,      // IN: Directory to search
    followSymlinks = HgfsServerPolicy_IsShareOptionSet(configOptions,
                                                       HGFS_SHARE_FOLLOW_SYMLINKS);
 
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   HgfsServerLimitSearchDirFds(search, session);
+   status = HgfsPlatformScandirOpen(baseDir, baseDirLen, followSymlinks, search);
+#else
    status = HgfsPlatformScandir(baseDir, baseDirLen, followSymlinks,
                                 &search->dents, &search->numDents);
+#endif
    if (HGFS_ERROR_SUCCESS != status) {
       LOG(4, ("%s: couldn't scandir\n", __FUNCTION__));
       HgfsRemoveSearchInternal(search, session);
@@ -6093,12 +6353,45 @@ HgfsIsCached(HgfsHandle handle,         // IN: Structure representing file node
 
    MXUser_AcquireExclLock(session->nodeArrayLock);
    cached = HgfsIsCachedInternal(handle, session);
+   if (cached) {
+      session->nodeCacheStats.hits++;
+   } else {
+      session->nodeCacheStats.misses++;
+   }
    MXUser_ReleaseExclLock(session->nodeArrayLock);
 
    return cached;
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeCacheRecordReopen --
+ *
+ *    Account for a node that had to be reopened because it was not in the
+ *    open node cache.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Updates the session node cache statistics.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNodeCacheRecordReopen(HgfsSessionInfo *session,  // IN: Session info
+                          uint64 reopenTimeUS)       // IN: Time spent reopening
+{
+   MXUser_AcquireExclLock(session->nodeArrayLock);
+   session->nodeCacheStats.reopens++;
+   session->nodeCacheStats.reopenTimeUS += reopenTimeUS;
+   MXUser_ReleaseExclLock(session->nodeArrayLock);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -6170,6 +6463,7 @@ HgfsRemoveLruNode(HgfsSessionInfo *session)   // IN: session info
          LOG(4, ("%s: Could not remove the node from cache.\n", __FUNCTION__));
          return FALSE;
       }
+      session->nodeCacheStats.evictions++;
    } else {
       LOG(4, ("%s: Could not find a node to remove from cache.\n", __FUNCTION__));
       return FALSE;
@@ -93,6 +93,15 @@ struct DirectoryEntry;
 
 #define HGFS_DEBUG_ASYNC   (0)
 
+/*
+ * Platforms that read real directory searches incrementally, see
+ * HgfsPlatformScandirFill, instead of loading every entry when the search
+ * is opened.
+ */
+#if defined(__linux__)
+#define HGFS_PLATFORM_INCREMENTAL_SEARCH
+#endif
+
 typedef struct HgfsTransportSessionInfo HgfsTransportSessionInfo;
 
 /* Identifier for a local file */
@@ -178,9 +187,23 @@ typedef struct HgfsFileNode {
    /* Links to place the object on various lists */
    DblLnkLst_Links links;
 
-   /* HGFS handle uniquely identifying this node. */
+   /*
+    * HGFS handle uniquely identifying this node. Encodes the node's index
+    * in the session nodeArray and a generation (see HgfsHandle2FileNode).
+    */
    HgfsHandle handle;
 
+   /* Number of times this nodeArray slot has been handed out. */
+   uint32 generation;
+
+   /*
+    * Server handle counter, modulo the number of generations, when the
+    * slot was first handed out. Handles carry the generation offset by it,
+    * so that a slot does not repeat the handles of the same slot in an
+    * earlier session, or from before a checkpoint restore.
+    */
+   uint32 generationBase;
+
    /* Local filename (in UTF8) */
    char *utf8Name;
 
@@ -271,6 +294,37 @@ typedef struct HgfsSearch {
    /* Number of dents */
    uint32 numDents;
 
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   /*
+    * The directory is read incrementally. dents only holds a window of the
+    * directory starting at directory index dentsBase.
+    */
+   Bool dirIncremental;
+
+   /*
+    * Open directory of an incremental search, or -1. An idle search may
+    * have its directory closed to bound the descriptors held by searches
+    * (see HgfsServerLimitSearchDirFds); it is reopened at dirOffset when
+    * the search reads on.
+    */
+   int dirFd;
+
+   /* getdents(2) position just past the window. */
+   int64 dirOffset;
+
+   /* The directory was opened following symlinks. */
+   Bool dirFollowSymlinks;
+
+   /* Session searchDirUseCount at the last use of the search. */
+   uint64 dirLastUse;
+
+   /* Directory index of dents[0]. */
+   uint32 dentsBase;
+
+   /* The window reaches the end of the directory. */
+   Bool dirEof;
+#endif
+
    /*
     * What type of search is this (what objects does it track)? This is
     * important to know so we can do the right kind of stat operation later
@@ -306,6 +360,17 @@ typedef struct HgfsAsyncRequestInfo {
    MXUserCondVar  *requestCountIsZero;
 } HgfsAsyncRequestInfo;
 
+/*
+ * Open file node cache statistics, kept per session under the nodeArrayLock.
+ */
+typedef struct HgfsNodeCacheStats {
+   uint64 hits;            /* I/O found the node's file descriptor cached. */
+   uint64 misses;          /* I/O had to reopen the file. */
+   uint64 evictions;       /* Nodes closed to make room in the cache. */
+   uint64 reopens;         /* Successful reopens of evicted nodes. */
+   uint64 reopenTimeUS;    /* Total time spent reopening, in microseconds. */
+} HgfsNodeCacheStats;
+
 typedef struct HgfsSessionInfo {
 
    DblLnkLst_Links links;
@@ -337,7 +402,7 @@ typedef struct HgfsSessionInfo {
    /*
     ** START NODE ARRAY **************************************************
     *
-    * Lock for the following 6 fields: the node array,
+    * Lock for the following 7 fields: the node array,
     * counters and lists for this session.
     */
    MXUserExclLock *nodeArrayLock;
@@ -359,6 +424,9 @@ typedef struct HgfsSessionInfo {
 
    /* Number of open nodes having server locks. */
    unsigned int numCachedLockedNodes;
+
+   /* Open node cache statistics. */
+   HgfsNodeCacheStats nodeCacheStats;
    /** END NODE ARRAY ****************************************************/
 
    /*
@@ -377,6 +445,11 @@ typedef struct HgfsSessionInfo {
 
    /* Free list of searches. LIFO. */
    DblLnkLst_Links searchFreeList;
+
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   /* Use counter ordering the searches for closing idle directories. */
+   uint64 searchDirUseCount;
+#endif
    /** END SEARCH ARRAY ****************************************************/
 
    /* Array of session specific capabiities. */
@@ -627,6 +700,10 @@ Bool
 HgfsIsCached(HgfsHandle handle,         // IN: Hgfs handle of the node
              HgfsSessionInfo *session); // IN: Session info
 
+void
+HgfsNodeCacheRecordReopen(HgfsSessionInfo *session,  // IN: Session info
+                          uint64 reopenTimeUS);      // IN: Time spent reopening
+
 Bool
 HgfsIsServerLockAllowed(HgfsSessionInfo *session);  // IN: session info
 
@@ -773,7 +850,21 @@ HgfsPlatformScandir(char const *baseDir,             // IN: Directory to search
                     size_t baseDirLen,               // IN: Length of directory
                     Bool followSymlinks,             // IN: followSymlinks config option
                     struct DirectoryEntry ***dents,  // OUT: Array of DirectoryEntrys
-                    int *numDents);                  // OUT: Number of DirectoryEntrys
+                    uint32 *numDents);               // OUT: Number of DirectoryEntrys
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+HgfsInternalStatus
+HgfsPlatformScandirOpen(char const *baseDir,     // IN: Directory to search in
+                        size_t baseDirLen,       // IN: Length of directory
+                        Bool followSymlinks,     // IN: followSymlinks config option
+                        HgfsSearch *search);     // IN/OUT: search
+HgfsInternalStatus
+HgfsPlatformScandirFill(HgfsSearch *search,      // IN/OUT: search
+                        uint32 index);           // IN: directory index needed
+void
+HgfsPlatformScandirSuspend(HgfsSearch *search);  // IN/OUT: search
+void
+HgfsPlatformScandirClose(HgfsSearch *search);    // IN/OUT: search
+#endif
 HgfsInternalStatus
 HgfsPlatformScanvdir(HgfsServerResEnumGetFunc enumNamesGet,   // IN: Function to get name
                      HgfsServerResEnumInitFunc enumNamesInit, // IN: Setup function
@@ -68,6 +68,8 @@
 #include "codeset.h"
 #include "unicodeOperations.h"
 #include "userlock.h"
+#include "mutexRankLib.h"
+#include "hostinfo.h"
 
 #if defined(__linux__) && !defined(SYS_getdents64)
 /* For DT_UNKNOWN */
@@ -317,6 +319,44 @@ static const int HgfsServerOpenMode[] = {
    O_RDWR,
 };
 
+/*
+ * Cache of case-insensitive lookups of a name in a directory, the results
+ * of HgfsConvertComponentCase, so that a directory is not read in full for
+ * every request naming one of its entries in the wrong case. Entries are
+ * keyed by the directory's device and inode and the name as looked up,
+ * and a result is only used while the directory's change time is the one
+ * it had when the directory was read: adding, removing or renaming an
+ * entry updates it, and it cannot be set back. Names that were not found
+ * are cached as well, as looking them up reads the whole directory too.
+ *
+ * Change times only have a resolution of a second on some platforms, so a
+ * directory that changed less than HGFS_CASE_CACHE_SETTLE_SEC ago is not
+ * cached: another change within the same second would go unnoticed.
+ */
+#define HGFS_CASE_CACHE_BUCKETS      1024
+#define HGFS_CASE_CACHE_MAX_ENTRIES  4096
+#define HGFS_CASE_CACHE_SETTLE_SEC   2
+
+typedef struct HgfsCaseCacheEntry {
+   DblLnkLst_Links hashLinks;       /* Bucket chain. */
+   DblLnkLst_Links lruLinks;        /* LRU list, most recently used last. */
+   uint32 hash;
+   dev_t dev;                       /* Directory looked up in. */
+   ino_t ino;
+   time_t ctime;                    /* Its change time when it was read. */
+   int error;                       /* 0 or ENOENT. */
+   char *convertedComponent;        /* Name found, NULL for ENOENT. */
+   size_t convertedComponentSize;
+   char component[1];               /* Name looked up. */
+} HgfsCaseCacheEntry;
+
+static struct {
+   MXUserExclLock *lock;
+   uint32 numEntries;
+   DblLnkLst_Links lruList;
+   DblLnkLst_Links buckets[HGFS_CASE_CACHE_BUCKETS];
+} gHgfsCaseCache;
+
 /* Local functions. */
 static HgfsInternalStatus HgfsGetattrResolveAlias(char const *fileName,
                                                   char **targetName);
@@ -339,6 +379,8 @@ static void HgfsGetSequentialOnlyFlagFromName(const char *fileName,
 static void HgfsGetSequentialOnlyFlagFromFd(int fd,
                                             HgfsFileAttrInfo *attr);
 
+static void HgfsCaseCacheRemoveEntry(HgfsCaseCacheEntry *entry);
+
 static int HgfsConvertComponentCase(char *currentComponent,
                                     const char *dirPath,
                                     const char **convertedComponent,
@@ -559,6 +601,16 @@ HgfsServerGetOpenFlags(HgfsOpenFlags flagsIn, // IN
 Bool
 HgfsPlatformInit(void)
 {
+   uint32 i;
+
+   gHgfsCaseCache.lock = MXUser_CreateExclLock("HgfsCaseCacheLock",
+                                               RANK_hgfsCaseCacheLock);
+   gHgfsCaseCache.numEntries = 0;
+   DblLnkLst_Init(&gHgfsCaseCache.lruList);
+   for (i = 0; i < ARRAYSIZE(gHgfsCaseCache.buckets); i++) {
+      DblLnkLst_Init(&gHgfsCaseCache.buckets[i]);
+   }
+
    return TRUE;
 }
 
@@ -582,6 +634,18 @@ HgfsPlatformInit(void)
 void
 HgfsPlatformDestroy(void)
 {
+   if (gHgfsCaseCache.lock == NULL) {
+      return;
+   }
+
+   while (DblLnkLst_IsLinked(&gHgfsCaseCache.lruList)) {
+      HgfsCaseCacheRemoveEntry(DblLnkLst_Container(gHgfsCaseCache.lruList.next,
+                                                   HgfsCaseCacheEntry,
+                                                   lruLinks));
+   }
+   ASSERT(gHgfsCaseCache.numEntries == 0);
+   MXUser_DestroyExclLock(gHgfsCaseCache.lock);
+   gHgfsCaseCache.lock = NULL;
 }
 
 
@@ -758,6 +822,7 @@ HgfsPlatformGetFd(HgfsHandle hgfsHandle,    // IN:  HGFS file handle
    int newFd = -1, openFlags = 0;
    HgfsFileNode node;
    HgfsInternalStatus status = 0;
+   VmTimeType reopenStart;
 
    ASSERT(fd);
    ASSERT(session);
@@ -816,6 +881,7 @@ HgfsPlatformGetFd(HgfsHandle hgfsHandle,    // IN:  HGFS file handle
     * reopening. This means we need to open a file. But first, verify
     * that the file we intend to open isn't stale.
     */
+   reopenStart = Hostinfo_SystemTimerUS();
    status = HgfsCheckFileNode(node.utf8Name, &node.localId);
    if (status != 0) {
       goto exit;
@@ -863,6 +929,8 @@ HgfsPlatformGetFd(HgfsHandle hgfsHandle,    // IN:  HGFS file handle
       goto exit;
    }
 
+   HgfsNodeCacheRecordReopen(session, Hostinfo_SystemTimerUS() - reopenStart);
+
   exit:
    if (status == 0) {
       *fd = newFd;
@@ -1401,6 +1469,255 @@ HgfsGetHiddenAttr(char const *fileName,         // IN:  Input filename
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseCacheRemoveEntry --
+ *
+ *    Unlink and free a case lookup cache entry. Cache lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCaseCacheRemoveEntry(HgfsCaseCacheEntry *entry)  // IN: entry to remove
+{
+   DblLnkLst_Unlink1(&entry->hashLinks);
+   DblLnkLst_Unlink1(&entry->lruLinks);
+   gHgfsCaseCache.numEntries--;
+   free(entry);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseCacheFind --
+ *
+ *    Find the entry for a name in a directory. An entry cached before the
+ *    directory last changed is freed on the way. Cache lock must be held.
+ *
+ * Results:
+ *    The entry or NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsCaseCacheEntry *
+HgfsCaseCacheFind(const struct stat *dirStat,  // IN: directory looked up in
+                  const char *component,       // IN: name looked up
+                  uint32 hash)                 // IN: hash of both
+{
+   DblLnkLst_Links *bucket =
+      &gHgfsCaseCache.buckets[hash % HGFS_CASE_CACHE_BUCKETS];
+   DblLnkLst_Links *curr;
+   DblLnkLst_Links *next;
+
+   DblLnkLst_ForEachSafe(curr, next, bucket) {
+      HgfsCaseCacheEntry *entry =
+         DblLnkLst_Container(curr, HgfsCaseCacheEntry, hashLinks);
+
+      if (entry->hash != hash ||
+          entry->dev != dirStat->st_dev ||
+          entry->ino != dirStat->st_ino ||
+          strcmp(entry->component, component) != 0) {
+         continue;
+      }
+      if (entry->ctime != dirStat->st_ctime) {
+         HgfsCaseCacheRemoveEntry(entry);
+         return NULL;
+      }
+      return entry;
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseCacheHash --
+ *
+ *    FNV-1a hash of a name and the inode of its directory.
+ *
+ * Results:
+ *    The hash value.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsCaseCacheHash(const struct stat *dirStat,  // IN: directory looked up in
+                  const char *component)       // IN: name looked up
+{
+   uint32 hash = 2166136261U ^ (uint32)dirStat->st_ino;
+   const char *p;
+
+   for (p = component; *p != '\0'; p++) {
+      hash ^= (uint8)*p;
+      hash *= 16777619U;
+   }
+
+   return hash;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseCacheLookup --
+ *
+ *    Look up the result of a previous case-insensitive lookup of a name in
+ *    a directory that has not changed since.
+ *
+ * Results:
+ *    TRUE on a hit, with the cached error and, if it is 0, an allocated
+ *    copy of the name found. FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsCaseCacheLookup(const struct stat *dirStat,     // IN: directory
+                    const char *component,          // IN: name looked up
+                    int *error,                     // OUT: 0 or ENOENT
+                    char **convertedComponent,      // OUT: name found
+                    size_t *convertedComponentSize) // OUT: its size
+{
+   HgfsCaseCacheEntry *entry;
+   uint32 hash = HgfsCaseCacheHash(dirStat, component);
+   Bool found = FALSE;
+
+   MXUser_AcquireExclLock(gHgfsCaseCache.lock);
+
+   entry = HgfsCaseCacheFind(dirStat, component, hash);
+   if (entry == NULL) {
+      goto exit;
+   }
+
+   *error = entry->error;
+   if (entry->error == 0) {
+      *convertedComponent = Util_SafeMalloc(entry->convertedComponentSize);
+      memcpy(*convertedComponent, entry->convertedComponent,
+             entry->convertedComponentSize);
+      *convertedComponentSize = entry->convertedComponentSize;
+   }
+
+   /* Move to the most recently used end. */
+   DblLnkLst_Unlink1(&entry->lruLinks);
+   DblLnkLst_LinkLast(&gHgfsCaseCache.lruList, &entry->lruLinks);
+   found = TRUE;
+
+exit:
+   MXUser_ReleaseExclLock(gHgfsCaseCache.lock);
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCaseCacheInsert --
+ *
+ *    Remember the result of a case-insensitive lookup of a name in a
+ *    directory, unless the directory changed too recently, see
+ *    HgfsCaseCacheEntry. The least recently used entry is evicted when
+ *    the cache is full.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Memory allocation.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsCaseCacheInsert(const struct stat *dirStat,       // IN: directory
+                    const char *component,            // IN: name looked up
+                    int error,                        // IN: 0 or ENOENT
+                    const char *convertedComponent,   // IN: name found
+                    size_t convertedComponentSize)    // IN: its size
+{
+   HgfsCaseCacheEntry *entry;
+   HgfsCaseCacheEntry *old;
+   size_t componentSize = strlen(component) + 1;
+   uint32 hash;
+
+   ASSERT(error == 0 || error == ENOENT);
+
+   if (dirStat->st_ctime + HGFS_CASE_CACHE_SETTLE_SEC > time(NULL)) {
+      return;
+   }
+
+   if (error != 0) {
+      convertedComponentSize = 0;
+   }
+   entry = malloc(offsetof(HgfsCaseCacheEntry, component) + componentSize +
+                  convertedComponentSize);
+   if (entry == NULL) {
+      return;
+   }
+
+   hash = HgfsCaseCacheHash(dirStat, component);
+   entry->hash = hash;
+   entry->dev = dirStat->st_dev;
+   entry->ino = dirStat->st_ino;
+   entry->ctime = dirStat->st_ctime;
+   entry->error = error;
+   memcpy(entry->component, component, componentSize);
+   if (error == 0) {
+      entry->convertedComponent = entry->component + componentSize;
+      memcpy(entry->convertedComponent, convertedComponent,
+             convertedComponentSize);
+   } else {
+      entry->convertedComponent = NULL;
+   }
+   entry->convertedComponentSize = convertedComponentSize;
+   DblLnkLst_Init(&entry->hashLinks);
+   DblLnkLst_Init(&entry->lruLinks);
+
+   MXUser_AcquireExclLock(gHgfsCaseCache.lock);
+
+   /* A concurrent request may have looked up the same name. */
+   old = HgfsCaseCacheFind(dirStat, component, hash);
+   if (old != NULL) {
+      HgfsCaseCacheRemoveEntry(old);
+   }
+
+   if (gHgfsCaseCache.numEntries >= HGFS_CASE_CACHE_MAX_ENTRIES) {
+      HgfsCaseCacheRemoveEntry(DblLnkLst_Container(gHgfsCaseCache.lruList.next,
+                                                   HgfsCaseCacheEntry,
+                                                   lruLinks));
+   }
+
+   DblLnkLst_LinkLast(&gHgfsCaseCache.buckets[hash % HGFS_CASE_CACHE_BUCKETS],
+                      &entry->hashLinks);
+   DblLnkLst_LinkLast(&gHgfsCaseCache.lruList, &entry->lruLinks);
+   gHgfsCaseCache.numEntries++;
+
+   MXUser_ReleaseExclLock(gHgfsCaseCache.lock);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1420,7 +1737,8 @@ HgfsGetHiddenAttr(char const *fileName,         // IN:  Input filename
  *
  * Side effects:
  *    On success, allocated memory is returned in convertedComponent and needs
- *    to be freed.
+ *    to be freed. The result may come from, and goes to, the case lookup
+ *    cache.
  *
  *-----------------------------------------------------------------------------
  */
@@ -1436,7 +1754,9 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
    char *dentryName;
    size_t dentryNameLen;
    char *myConvertedComponent = NULL;
-   size_t myConvertedComponentSize;
+   size_t myConvertedComponentSize = 0;
+   struct stat dirStat;
+   Bool cacheable;
    int ret;
 
    ASSERT(currentComponent);
@@ -1444,6 +1764,27 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
    ASSERT(convertedComponent);
    ASSERT(convertedComponentSize);
 
+   /* The root share has an empty path, its first component is in "/". */
+   if (*dirPath == '\0') {
+      dirPath = DIRSEPS;
+   }
+
+   /*
+    * The directory is stat'ed before it is read, so that a change made
+    * while it is read leaves it with a change time the entry does not have.
+    */
+   cacheable = gHgfsCaseCache.lock != NULL &&
+               Posix_Stat(dirPath, &dirStat) == 0;
+   if (cacheable &&
+       HgfsCaseCacheLookup(&dirStat, currentComponent, &ret,
+                           &myConvertedComponent, &myConvertedComponentSize)) {
+      if (ret == 0) {
+         *convertedComponentSize = myConvertedComponentSize;
+         *convertedComponent = myConvertedComponent;
+      }
+      goto exit;
+   }
+
    /* Open the specified directory. */
    dir = Posix_OpenDir(dirPath);
    if (!dir) {
@@ -1508,13 +1849,19 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
          ret = 0;
          *convertedComponentSize = myConvertedComponentSize;
          *convertedComponent = myConvertedComponent;
-         goto exit;
+         goto cache;
       }
    }
 
    /* We didn't find a match. Failure. */
    ret = ENOENT;
 
+cache:
+   if (cacheable) {
+      HgfsCaseCacheInsert(&dirStat, currentComponent, ret,
+                          myConvertedComponent, myConvertedComponentSize);
+   }
+
 exit:
    if (dir) {
       closedir(dir);
@@ -3381,7 +3728,12 @@ HgfsPlatformDirDumpDents(HgfsSearch *search)         // IN: search
 
    ASSERT(search != NULL);
 
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+   Log("%s: %u dents from index %u in \"%s\"\n", __FUNCTION__, search->numDents,
+       search->dentsBase, search->utf8Dir);
+#else
    Log("%s: %u dents in \"%s\"\n", __FUNCTION__, search->numDents, search->utf8Dir);
+#endif
 
    for (i = 0; i < search->numDents; i++) {
       Log("\"%s\"\n", search->dents[i]->d_name);
@@ -3733,6 +4085,90 @@ HgfsPlatformSetDirEntry(HgfsSearch *search,              // IN: partially valid
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsScandirAppendBatch --
+ *
+ *    Append the dents of one getdents(2) batch to a dents array. Names that
+ *    can't be converted to UTF8 form C are skipped.
+ *
+ * Results:
+ *    Zero on success, ENOMEM on failure. Dents appended before a failure
+ *    stay in the array and are accounted for in numDents.
+ *
+ * Side effects:
+ *    Memory allocation.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsScandirAppendBatch(char *buffer,                   // IN: getdents batch
+                       size_t bufferLen,               // IN: bytes in buffer
+                       struct DirectoryEntry ***dents, // IN/OUT: Array of DirectoryEntrys
+                       uint32 *numDents)               // IN/OUT: Number of DirectoryEntrys
+{
+   DirectoryEntry **myDents = *dents;
+   uint32 myNumDents = *numDents;
+   HgfsInternalStatus status = 0;
+   size_t offset = 0;
+
+   while (offset < bufferLen) {
+      DirectoryEntry *newDent, **newDents;
+
+      newDent = (DirectoryEntry *)(buffer + offset);
+
+      /* This dent had better fit in the actual space we've got left. */
+      ASSERT(newDent->d_reclen <= bufferLen - offset);
+
+      /* Add another dent pointer to the dents array. */
+      newDents = realloc(myDents, sizeof *myDents * (myNumDents + 1));
+      if (newDents == NULL) {
+         status = ENOMEM;
+         break;
+      }
+      myDents = newDents;
+
+      /*
+       * Allocate the new dent and set it up. We do a straight memcpy of
+       * the entire record to avoid dealing with platform-specific fields.
+       */
+      myDents[myNumDents] = malloc(newDent->d_reclen);
+      if (myDents[myNumDents] == NULL) {
+         status = ENOMEM;
+         break;
+      }
+
+      if (HgfsConvertToUtf8FormC(newDent->d_name,
+                                 newDent->d_reclen - offsetof(DirectoryEntry, d_name))) {
+         memcpy(myDents[myNumDents], newDent, newDent->d_reclen);
+         /*
+          * Dent is done. Bump the offset to the batched buffer to process the
+          * next dent within it.
+          */
+         myNumDents++;
+      } else {
+         /*
+          * XXX:
+          *    HGFS discards all file names that can't be converted to utf8.
+          *    It is not desirable since it causes many problems like
+          *    failure to delete directories which contain such files.
+          *    Need to change this to a more reasonable behavior, similar
+          *    to name escaping which is used to deal with illegal file names.
+          */
+         free(myDents[myNumDents]);
+      }
+      offset += newDent->d_reclen;
+   }
+
+   *dents = myDents;
+   *numDents = myNumDents;
+
+   return status;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -3763,7 +4199,7 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
                     size_t baseDirLen,              // IN: Ignored
                     Bool followSymlinks,            // IN: followSymlinks config option
                     struct DirectoryEntry ***dents, // OUT: Array of DirectoryEntrys
-                    int *numDents)                  // OUT: Number of DirectoryEntrys
+                    uint32 *numDents)               // OUT: Number of DirectoryEntrys
 {
 #if defined(__APPLE__)
    DIR *fd = NULL;
@@ -3773,7 +4209,7 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
 #endif
    int result;
    DirectoryEntry **myDents = NULL;
-   int myNumDents = 0;
+   uint32 myNumDents = 0;
    HgfsInternalStatus status = 0;
 
    /*
@@ -3831,53 +4267,9 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
     * in each call by using a buffer substantially larger than one dent.
     */
    while ((result = getdents(fd, (void *)buffer, sizeof buffer)) > 0) {
-      size_t offset = 0;
-      while (offset < result) {
-         DirectoryEntry *newDent, **newDents;
-
-         newDent = (DirectoryEntry *)(buffer + offset);
-
-         /* This dent had better fit in the actual space we've got left. */
-         ASSERT(newDent->d_reclen <= result - offset);
-
-         /* Add another dent pointer to the dents array. */
-         newDents = realloc(myDents, sizeof *myDents * (myNumDents + 1));
-         if (newDents == NULL) {
-            status = ENOMEM;
-            goto exit;
-         }
-         myDents = newDents;
-
-         /*
-          * Allocate the new dent and set it up. We do a straight memcpy of
-          * the entire record to avoid dealing with platform-specific fields.
-          */
-         myDents[myNumDents] = malloc(newDent->d_reclen);
-         if (myDents[myNumDents] == NULL) {
-            status = ENOMEM;
-            goto exit;
-         }
-
-         if (HgfsConvertToUtf8FormC(newDent->d_name,
-                                    newDent->d_reclen - offsetof(DirectoryEntry, d_name))) {
-            memcpy(myDents[myNumDents], newDent, newDent->d_reclen);
-            /*
-             * Dent is done. Bump the offset to the batched buffer to process the
-             * next dent within it.
-             */
-            myNumDents++;
-         } else {
-            /*
-             * XXX:
-             *    HGFS discards all file names that can't be converted to utf8.
-             *    It is not desirable since it causes many problems like
-             *    failure to delete directories which contain such files.
-             *    Need to change this to a more reasonable behavior, similar
-             *    to name escaping which is used to deal with illegal file names.
-             */
-            free(myDents[myNumDents]);
-         }
-         offset += newDent->d_reclen;
+      status = HgfsScandirAppendBatch(buffer, result, &myDents, &myNumDents);
+      if (status != 0) {
+         goto exit;
       }
    }
 
@@ -3917,6 +4309,292 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
 }
 
 
+#if defined(HGFS_PLATFORM_INCREMENTAL_SEARCH)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsScandirOpenDir --
+ *
+ *    Open the directory of an incremental search and position it at the
+ *    search's dirOffset.
+ *
+ * Results:
+ *    Zero on success, non-zero on error.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsScandirOpenDir(HgfsSearch *search)  // IN/OUT: search
+{
+   int openFlags = O_NONBLOCK | O_RDONLY | O_DIRECTORY | O_NOFOLLOW;
+   HgfsInternalStatus status;
+   int fd;
+
+   ASSERT(search->dirFd == -1);
+
+   /* Follow symlinks if config option is set. */
+   if (search->dirFollowSymlinks) {
+      openFlags &= ~O_NOFOLLOW;
+   }
+
+   /* We want a directory. No FIFOs. Symlinks only if config option is set. */
+   fd = Posix_Open(search->utf8Dir, openFlags);
+   if (fd < 0) {
+      status = errno;
+      LOG(4, ("%s: error in open: %d (%s)\n", __FUNCTION__, status,
+              Err_Errno2String(status)));
+      return status;
+   }
+
+   if (search->dirOffset != 0 &&
+       lseek(fd, search->dirOffset, SEEK_SET) == (off_t)-1) {
+      status = errno;
+      LOG(4, ("%s: error in lseek: %d (%s)\n", __FUNCTION__, status,
+              Err_Errno2String(status)));
+      close(fd);
+      return status;
+   }
+
+   search->dirFd = fd;
+
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirOpen --
+ *
+ *    Open a directory for an incremental search. No entries are read here;
+ *    HgfsPlatformScandirFill pulls getdents(2) batches as the search is
+ *    advanced, so opening a search costs the same for any directory size.
+ *    The directory stays open until HgfsPlatformScandirClose, or until
+ *    HgfsPlatformScandirSuspend if the search goes idle.
+ *
+ * Results:
+ *    Zero on success, non-zero on error.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformScandirOpen(char const *baseDir,     // IN: Directory to search in
+                        size_t baseDirLen,       // IN: Ignored
+                        Bool followSymlinks,     // IN: followSymlinks config option
+                        HgfsSearch *search)      // IN/OUT: search
+{
+   HgfsInternalStatus status;
+
+   ASSERT(strcmp(baseDir, search->utf8Dir) == 0);
+
+   search->dirFollowSymlinks = followSymlinks;
+   search->dirOffset = 0;
+   search->dirEof = FALSE;
+   search->dentsBase = 0;
+
+   status = HgfsScandirOpenDir(search);
+   if (status == 0) {
+      search->dirIncremental = TRUE;
+   }
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirFill --
+ *
+ *    Make sure the dents window of an incremental search holds the entry at
+ *    the given directory index, reading more batches as needed. Entries
+ *    before the index are dropped as the window moves forward, so memory is
+ *    bounded by a few batches regardless of directory size. Asking for an
+ *    index that has already been dropped rewinds the directory, which also
+ *    gives a search restarted at index 0 a fresh view of the directory.
+ *    A directory closed by HgfsPlatformScandirSuspend is reopened when the
+ *    window has to move.
+ *
+ *    HGFS_SEARCH_LAST_ENTRY_INDEX reads the rest of the directory without
+ *    dropping anything.
+ *
+ *    Caller should hold the session's searchArrayLock.
+ *
+ * Results:
+ *    Zero on success (the index may still be past the end of the
+ *    directory), non-zero on error.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformScandirFill(HgfsSearch *search,  // IN/OUT: search
+                        uint32 index)        // IN: directory index needed
+{
+   Bool readAll = (index == HGFS_SEARCH_LAST_ENTRY_INDEX);
+   Bool rewind;
+   HgfsInternalStatus status = 0;
+   off_t offset;
+   uint32 i;
+   int result;
+
+   /*
+    * XXX: glibc uses 8192 (BUFSIZ) when it can't get st_blksize from a stat.
+    * Should we follow its lead and use stat to get st_blksize?
+    */
+   char buffer[8192];
+
+   if (!search->dirIncremental) {
+      return 0;
+   }
+
+   rewind = !readAll && index < search->dentsBase;
+   if (!rewind &&
+       (search->dirEof ||
+        (!readAll && index - search->dentsBase < search->numDents))) {
+      /* The window already holds the entry, or it is past the end. */
+      return 0;
+   }
+
+   if (search->dirFd == -1) {
+      status = HgfsScandirOpenDir(search);
+      if (status != 0) {
+         return status;
+      }
+   }
+
+   if (rewind) {
+      LOG(4, ("%s: rewinding \"%s\" for index %u\n", __FUNCTION__,
+              search->utf8Dir, index));
+      if (lseek(search->dirFd, 0, SEEK_SET) == (off_t)-1) {
+         status = errno;
+         LOG(4, ("%s: error in lseek: %d (%s)\n", __FUNCTION__, status,
+                 Err_Errno2String(status)));
+         return status;
+      }
+      for (i = 0; i < search->numDents; i++) {
+         free(search->dents[i]);
+      }
+      free(search->dents);
+      search->dents = NULL;
+      search->numDents = 0;
+      search->dentsBase = 0;
+      search->dirOffset = 0;
+      search->dirEof = FALSE;
+   }
+
+   while (!search->dirEof &&
+          (readAll || index - search->dentsBase >= search->numDents)) {
+      /* Drop the entries the search has moved past. */
+      if (!readAll && index > search->dentsBase) {
+         uint32 drop = MIN(index - search->dentsBase, search->numDents);
+
+         for (i = 0; i < drop; i++) {
+            free(search->dents[i]);
+         }
+         memmove(search->dents, search->dents + drop,
+                 (search->numDents - drop) * sizeof search->dents[0]);
+         search->numDents -= drop;
+         search->dentsBase += drop;
+      }
+
+      result = getdents(search->dirFd, (void *)buffer, sizeof buffer);
+      if (result == -1) {
+         status = errno;
+         LOG(4, ("%s: error in getdents: %d (%s)\n", __FUNCTION__, status,
+                 Err_Errno2String(status)));
+         break;
+      }
+      if (result == 0) {
+         search->dirEof = TRUE;
+         break;
+      }
+
+      /* Where to resume if the directory gets closed while idle. */
+      offset = lseek(search->dirFd, 0, SEEK_CUR);
+      if (offset != (off_t)-1) {
+         search->dirOffset = offset;
+      }
+
+      status = HgfsScandirAppendBatch(buffer, result, &search->dents,
+                                      &search->numDents);
+      if (status != 0) {
+         break;
+      }
+   }
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirSuspend --
+ *
+ *    Close the directory of an idle incremental search to free its
+ *    descriptor. The search keeps its window and dirOffset, and
+ *    HgfsPlatformScandirFill reopens the directory when needed.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformScandirSuspend(HgfsSearch *search)  // IN/OUT: search
+{
+   if (search->dirFd != -1) {
+      if (close(search->dirFd) < 0) {
+         LOG(4, ("%s: error in close: %d (%s)\n", __FUNCTION__, errno,
+                 Err_Errno2String(errno)));
+      }
+      search->dirFd = -1;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformScandirClose --
+ *
+ *    End the incremental reading of a search, closing its directory if it
+ *    is open.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformScandirClose(HgfsSearch *search)  // IN/OUT: search
+{
+   HgfsPlatformScandirSuspend(search);
+   search->dirIncremental = FALSE;
+}
+#endif
+
+
 /*
  *-----------------------------------------------------------------------------
  *
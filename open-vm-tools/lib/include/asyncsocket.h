@@ -178,6 +178,12 @@ typedef struct AsyncSocketPollParams {
  */
 int AsyncSocket_Init(void);
 
+/*
+ * Opt in to the io_uring data path for sockets created afterwards
+ * (Linux only)
+ */
+int AsyncSocket_EnableIoUring(void);
+
 /*
  * Check the current state of the socket
  */
@@ -587,6 +593,21 @@ int AsyncSocket_WaitForConnection(AsyncSocket *s, int timeoutMS);
 int AsyncSocket_WaitForReadMultiple(AsyncSocket **asock, int numSock,
                                     int timeoutMS, int *outIdx);
 
+/*
+ * Persistent set of sockets to wait on for readable data: sockets are added
+ * once and ready ones are returned in batches. Backed by epoll on Linux;
+ * not available on Windows.
+ */
+typedef struct AsyncSocketWaitSet AsyncSocketWaitSet;
+
+AsyncSocketWaitSet *AsyncSocket_WaitSetCreate(int *outError);
+void AsyncSocket_WaitSetDestroy(AsyncSocketWaitSet *waitSet);
+int AsyncSocket_WaitSetAdd(AsyncSocketWaitSet *waitSet, AsyncSocket *asock);
+int AsyncSocket_WaitSetRemove(AsyncSocketWaitSet *waitSet,
+                              AsyncSocket *asock);
+int AsyncSocket_WaitSetWait(AsyncSocketWaitSet *waitSet, int timeoutMS,
+                            AsyncSocket **ready, int maxReady, int *numReady);
+
 /*
  * Send all pending packets onto the wire or give up after timeoutMS msecs.
  */
@@ -156,6 +156,39 @@
  */
 #define CONFNAME_GUESTINFO_MAXIPV6ROUTES "max-ipv6-routes"
 
+/**
+ * Send the updates of each guest info gather cycle in a single INFO_BATCH
+ * message. The plugin goes back to one message per update if the host
+ * does not accept it.
+ *
+ * @param boolean Set to true to batch the updates.
+ */
+#define CONFNAME_GUESTINFO_BATCHUPDATES "batch-updates"
+
+/**
+ * Only send the guest stats that changed since the last sample. All the
+ * stats are still sent every few samples so the host can resynchronize.
+ *
+ * @param boolean Set to true to send only the changed stats.
+ */
+#define CONFNAME_GUESTINFO_DELTASTATS "delta-stats"
+
+/**
+ * Sample some guest stats at a high resolution, and send their p50, p99
+ * and max over each stats interval along with the stats.
+ *
+ * @param int   Sampling period in milliseconds. 0 disables the sampling.
+ */
+#define CONFNAME_GUESTINFO_HIRESINTERVAL "hires-interval"
+
+/**
+ * Stats sampled in the high resolution mode.
+ *
+ * @param string   List of stat names, e.g. "guest.cpu.runQueue;
+ *                 guest.contextSwapRate".
+ */
+#define CONFNAME_GUESTINFO_HIRESSTATS "hires-stats"
+
 /**
  * Lets user include reserved space in diskInfo space metrics on Linux.
  *
@@ -163,6 +196,15 @@
  */
 #define CONFNAME_DISKINFO_INCLUDERESERVED "diskinfo-include-reserved"
 
+/**
+ * How long, in milliseconds, a gather waits for the space of the partitions
+ * on Linux. Partitions that don't answer in time (e.g., hung NFS mounts) are
+ * reported with their last known values.
+ *
+ * @param int Timeout in milliseconds, defaults to 2000.
+ */
+#define CONFNAME_DISKINFO_TIMEOUT "diskinfo-timeout"
+
 /*
  * END GuestInfo goodies.
  ******************************************************************************
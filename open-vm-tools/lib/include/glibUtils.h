@@ -54,6 +54,8 @@ typedef struct GlibLogger {
    gboolean          addsTimestamp; /**< Output adds timestamp automatically. */
    GLogFunc          logfn;         /**< The function that writes to the output. */
    GDestroyNotify    dtor;          /**< Destructor. */
+   /** Waits until buffered output is written (optional). */
+   void            (*flush)(struct GlibLogger *logger);
 } GlibLogger;
 
 
@@ -63,6 +65,14 @@ GlibUtils_CreateFileLogger(const char *path,
                            guint maxSize,
                            guint maxFiles);
 
+GlibLogger *
+GlibUtils_CreateAsyncFileLogger(const char *path,
+                                gboolean append,
+                                guint maxSize,
+                                guint maxFiles,
+                                guint queueSize,
+                                guint flushInterval);
+
 GlibLogger *
 GlibUtils_CreateStdLogger(void);
 
@@ -71,6 +71,7 @@ typedef enum {
    INFO_MEMORY,
    INFO_IPADDRESS_V2,
    INFO_IPADDRESS_V3,
+   INFO_BATCH,       /* Several of the above in one GuestInfoBatch message. */
    INFO_MAX
 } GuestInfoType;
 
@@ -216,6 +216,7 @@ PollClassSet_Include(PollClassSet set, PollClass c)
 #define POLL_FLAG_FD                    0x80    // device is a Windows file descriptor.
 #define POLL_FLAG_ACCEPT_INVALID_FDS    0x100   // For broken 3rd party libs, e.g. curl
 #define POLL_FLAG_THUNK_TO_WND          0x200   // thunk callback to window message loop
+#define POLL_FLAG_EDGE_TRIGGERED        0x400   // fire on state changes only (epoll)
 
 
 typedef void (*PollerFunction)(void *clientData);
@@ -246,6 +247,7 @@ void Poll_InitDefault(void);
 void Poll_InitDefaultEx(const PollOptions *opts);
 void Poll_InitGtk(void); // On top of glib for Linux
 void Poll_InitCF(void);  // On top of CoreFoundation for OSX
+void Poll_InitEpoll(void); // On top of epoll for Linux
 
 
 /*
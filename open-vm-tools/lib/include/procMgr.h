@@ -134,6 +134,10 @@ typedef int Selectable;
 #endif
 
 ProcMgrProcInfoArray *ProcMgr_ListProcesses(void);
+#if defined(__linux__)
+ProcMgrProcInfoArray *ProcMgr_ListProcessesEx(const ProcMgr_Pid *pids,
+                                              size_t numPids);
+#endif
 void ProcMgr_FreeProcList(ProcMgrProcInfoArray *procList);
 Bool ProcMgr_KillByPid(ProcMgr_Pid procId);
 
@@ -41,6 +41,10 @@ int SSL_TryCompleteAccept(SSLSock sSock);
 ssize_t SSL_Read(SSLSock ssl, char *buf, size_t num);
 ssize_t SSL_RecvDataAndFd(SSLSock ssl, char *buf, size_t num, int *fd);
 ssize_t SSL_Write(SSLSock ssl, const char  *buf, size_t num);
+#ifndef _WIN32
+struct iovec;
+ssize_t SSL_Writev(SSLSock ssl, const struct iovec *iov, int iovcnt);
+#endif
 int SSL_Shutdown(SSLSock ssl);
 int SSL_GetFd(SSLSock sSock);
 int SSL_Pending(SSLSock ssl);
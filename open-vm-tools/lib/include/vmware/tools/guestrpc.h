@@ -133,6 +133,20 @@ typedef void (*RpcChannelResetCb)(RpcChannel *chan,
  */
 typedef void (*RpcChannelFailureCb)(gpointer _state);
 
+/**
+ * Signature for the completion callback of RpcChannel_SendAsync.
+ *
+ * @param[in]  status     Same as the return value of RpcChannel_Send.
+ * @param[in]  result     Response from the other side, freed by the library
+ *                        after the callback returns.
+ * @param[in]  resultLen  Number of bytes in response.
+ * @param[in]  data       Client data.
+ */
+typedef void (*RpcChannelSendCb)(gboolean status,
+                                 char *result,
+                                 size_t resultLen,
+                                 gpointer data);
+
 
 gboolean
 RpcChannel_Start(RpcChannel *chan);
@@ -150,6 +164,13 @@ RpcChannel_Send(RpcChannel *chan,
                 char **result,
                 size_t *resultLen);
 
+gboolean
+RpcChannel_SendAsync(RpcChannel *chan,
+                     char const *data,
+                     size_t dataLen,
+                     RpcChannelSendCb callback,
+                     gpointer clientData);
+
 void
 RpcChannel_Free(void *ptr);
 
@@ -52,6 +52,12 @@
  *      default, at most 10 backed up log files will be kept. Value should be >= 1.
  *    - maxLogSize: maximum size of each log file, defaults to 10 (MB). A value of
  *      0 disables log rotation.
+ *    - queueSize: when larger than 1, messages are queued and written by a
+ *      background thread, so that logging does not wait for the disk. This is
+ *      the maximum number of queued messages; further messages are dropped
+ *      and counted. Defaults to 0 (messages are written synchronously).
+ *    - flushInterval: with a queue, maximum time in milliseconds a message
+ *      waits before being written. Defaults to 1000.
  *
  * When using syslog on Unix, the following options are available:
  *
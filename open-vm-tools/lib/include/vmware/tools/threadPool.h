@@ -39,6 +39,12 @@
  * with the lifecycle of the new thread managed by the thread pool so that it
  * is properly notified of service shutdown.
  *
+ * Tasks have a priority: queued tasks run in priority order, and one thread
+ * is kept for high priority tasks, so that a burst of ordinary tasks cannot
+ * delay them. Tasks may also name a group (usually the plugin's name), and
+ * the number of tasks of a group running at the same time can be limited in
+ * the configuration ("pool.<group>.maxThreads").
+ *
  * Finally, depending on the configuration, the shared thread pool might not
  * be a thread pool at all: if the configuration has disabled threading, tasks
  * destined to the shared thread pool will be executed on the main service
@@ -54,6 +60,14 @@
 typedef void (*ToolsCorePoolCb)(ToolsAppCtx *ctx,
                                 gpointer data);
 
+/** Priority of a task submitted to the pool. */
+typedef enum {
+   TOOLS_CORE_POOL_PRIO_HIGH,    /**< Time critical, e.g. quiescing. */
+   TOOLS_CORE_POOL_PRIO_NORMAL,  /**< Default priority. */
+   TOOLS_CORE_POOL_PRIO_LOW,     /**< Long running or bulk work. */
+   TOOLS_CORE_POOL_PRIO_MAX
+} ToolsCorePoolPriority;
+
 /**
  * @brief Public interface of the shared thread pool.
  *
@@ -74,6 +88,12 @@ typedef struct ToolsCorePool {
                      ToolsCorePoolCb interrupt,
                      gpointer data,
                      GDestroyNotify dtor);
+   guint (*submitEx)(ToolsAppCtx *ctx,
+                     ToolsCorePoolCb cb,
+                     gpointer data,
+                     GDestroyNotify dtor,
+                     ToolsCorePoolPriority priority,
+                     const gchar *group);
 } ToolsCorePool;
 
 
@@ -136,6 +156,44 @@ ToolsCorePool_SubmitTask(ToolsAppCtx *ctx,
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePool_SubmitTaskEx --                                          */ /**
+ *
+ * @brief Submits a task with a priority and a group to the thread pool.
+ *
+ * Same as ToolsCorePool_SubmitTask(), which submits tasks with normal
+ * priority and no group.
+ *
+ * @param[in] ctx       Application context.
+ * @param[in] cb        Function to execute the task.
+ * @param[in] data      Opaque data for the task.
+ * @param[in] dtor      Destructor for the task data.
+ * @param[in] priority  Priority of the task.
+ * @param[in] group     Group the task counts against for the concurrency
+ *                      limits, usually the plugin's name. May be NULL.
+ *
+ * @return An identifier for the task, or 0 on error.
+ *
+ *******************************************************************************
+ */
+
+G_INLINE_FUNC guint
+ToolsCorePool_SubmitTaskEx(ToolsAppCtx *ctx,
+                           ToolsCorePoolCb cb,
+                           gpointer data,
+                           GDestroyNotify dtor,
+                           ToolsCorePoolPriority priority,
+                           const gchar *group)
+{
+   ToolsCorePool *pool = ToolsCorePool_GetPool(ctx);
+   if (pool != NULL) {
+      return pool->submitEx(ctx, cb, data, dtor, priority, group);
+   }
+   return 0;
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePool_CancelTask --                                            */ /**
@@ -113,6 +113,27 @@ Poll_InitWithImpl(const PollImpl *impl)
    pollImpl->Init();
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_IsInitialized --
+ *
+ *      Tells whether a Poll implementation has already been installed.
+ *
+ * Results: TRUE if Poll_InitWithImpl has been called.
+ *
+ * Side effects: None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+Poll_IsInitialized(void)
+{
+   return pollImpl != NULL;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -644,6 +665,7 @@ static unsigned int deviceWCount;
 static unsigned int state;
 static unsigned int successCount;
 static unsigned int failureCount;
+static Bool finished;
 static unsigned int dummyCount;
 static Bool isVMX;
 static Bool useLocking;
@@ -2147,6 +2169,7 @@ PollUnitTest_StateMachine(void *clientData) // IN: Unused
       ASSERT(ret);
       Warning("%s: Poll unit test: stop, %u successes, %u failures\n",
               __FUNCTION__, successCount, failureCount);
+      finished = TRUE;
       if (cbLock) {
          MXUser_DestroyRecLock(cbLock);
       }
@@ -2192,6 +2215,7 @@ PollUnitTest(Bool vmx)  // IN: use vmx-size poll queue
 
    state = 0;
    successCount = failureCount = 0;
+   finished = FALSE;
    useLocking = FALSE;
    isVMX = vmx;
 #ifdef _WIN32
@@ -2229,4 +2253,30 @@ PollUnitTest(Bool vmx)  // IN: use vmx-size poll queue
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollUnitTest_Finished --
+ *
+ *      Tells whether the unit test suite started by PollUnitTest() is over,
+ *      for programs that drive the poll loop themselves.
+ *
+ * Results:
+ *      TRUE once the suite stopped, with its number of failures in
+ *      'failures'.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+PollUnitTest_Finished(unsigned int *failures)  // OUT
+{
+   *failures = failureCount;
+   return finished;
+}
+
+
 #endif // POLL_UNITTEST
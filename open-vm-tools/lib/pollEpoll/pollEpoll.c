@@ -0,0 +1,1679 @@
+/*********************************************************
+ * Copyright (C) 2018 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * pollEpoll.c -- a Poll implementation built on top of epoll(7).
+ *
+ * All device callbacks share a single epoll descriptor, so registering or
+ * removing a callback is an epoll_ctl() plus a couple of table updates,
+ * and a wakeup costs in proportion to the number of ready descriptors
+ * rather than the number of registered ones.
+ *
+ * Timer callbacks (POLL_REALTIME) live in a hashed timer wheel with a
+ * resolution of one millisecond. A single timerfd, armed for the earliest
+ * expiration, wakes the epoll descriptor. Zero-delay callbacks
+ * (POLL_MAIN_LOOP, zero-delay POLL_REALTIME and callbacks that could not
+ * take their lock for the first time) go on a ready list; an eventfd wakes
+ * the loop when that list is fed from another thread. A callback that
+ * keeps failing to take its lock is retried from the timer wheel, with a
+ * delay that doubles up to POLL_EPOLL_MAX_BACKOFF_TICKS.
+ *
+ * The loop can be driven in two ways: directly through Poll_LoopTimeout(),
+ * or from the default GLib main context, where the epoll descriptor is
+ * attached as a single GSource. The latter is how vmtoolsd uses it.
+ *
+ * Devices registered with POLL_FLAG_EDGE_TRIGGERED are added to epoll with
+ * EPOLLET; their callbacks only fire when the device changes state, so
+ * they must drain the device before returning. All other devices are
+ * level-triggered, like in the other Poll implementations.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <glib.h>
+
+#include "vmware.h"
+#include "pollImpl.h"
+#include "mutexRankLib.h"
+#include "dbllnklst.h"
+#include "err.h"
+
+#define LOGLEVEL_MODULE poll
+#include "loglevel_user.h"
+
+
+/* Number of slots in the timer wheel; must be a power of 2. */
+#define POLL_EPOLL_WHEEL_SIZE   1024
+#define POLL_EPOLL_WHEEL_MASK   (POLL_EPOLL_WHEEL_SIZE - 1)
+
+/* Timer wheel resolution, in microseconds. */
+#define POLL_EPOLL_TICK_US      1000
+
+/* Longest delay before retrying a callback whose lock is busy, in ticks. */
+#define POLL_EPOLL_MAX_BACKOFF_TICKS  64
+
+/* Number of events fetched by a single epoll_wait(). */
+#define POLL_EPOLL_MAX_EVENTS   64
+
+/* Minimum number of slots allocated for the device table. */
+#define POLL_EPOLL_MIN_DEVICES  64
+
+#define POLL_EPOLL_READ_EVENTS  (EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP)
+#define POLL_EPOLL_WRITE_EVENTS (EPOLLOUT | EPOLLERR | EPOLLHUP)
+
+
+/*
+ * A single registered callback. Each Poll_Callback() call creates one;
+ * a device with both a read and a write callback has two.
+ */
+typedef struct PollEpollCb {
+   int            flags;
+   PollerFunction cb;
+   void          *clientData;
+   PollClassSet   classSet;
+   MXUserRecLock *cbLock;
+   uint32         timesNotFired;
+
+   PollEventType  type;
+   PollDevHandle  event;          /* POLL_DEVICE file descriptor or
+                                     POLL_REALTIME delay, in ticks. */
+   uint64         expires;        /* Timer wheel tick this callback fires. */
+   DblLnkLst_Links links;         /* Timer wheel slot or ready list. */
+   Bool           inWheel;        /* 'links' is in a timer wheel slot. */
+   struct PollEpollCb *dupNext;   /* Next callback with an identical key. */
+} PollEpollCb;
+
+
+/*
+ * A registered file descriptor.
+ */
+typedef struct PollEpollDevice {
+   PollEpollCb   *read;
+   PollEpollCb   *write;
+   uint32         events;         /* Events currently registered with epoll. */
+   uint32         gen;            /* Bumped each time the fd is (re)added. */
+   Bool           noEpoll;        /* Regular file; always ready. */
+} PollEpollDevice;
+
+
+/*
+ * The global Poll state.
+ */
+typedef struct Poll {
+   MXUserExclLock *lock;
+
+   int             epollFd;
+   int             timerFd;
+   int             wakeFd;
+
+   /* Device callbacks, indexed by file descriptor. */
+   PollEpollDevice *devices;
+   int              numDevices;
+
+   /* All callbacks, keyed by (type, flags, cb, clientData, classSet). */
+   GHashTable     *cbTable;
+
+   /* Callbacks waiting to be fired. */
+   DblLnkLst_Links ready;
+
+   /* The timer wheel. */
+   DblLnkLst_Links wheel[POLL_EPOLL_WHEEL_SIZE];
+   uint64          curTick;       /* Last tick the wheel was advanced to. */
+   uint64          armedTick;     /* Tick the timerfd is armed for, or 0. */
+   uint32          numTimers;
+
+   GSource        *source;
+} Poll;
+
+
+/*
+ * GSource that lets the default GLib main context drive the epoll loop.
+ */
+typedef struct PollEpollSource {
+   GSource        source;
+   GPollFD        pfd;
+} PollEpollSource;
+
+static Poll *pollState;
+
+
+static void PollEpollFireReady(PollClass class);
+static void PollEpollUpdateDevice(int fd);
+
+#define ASSERT_POLL_LOCKED()                                    \
+   ASSERT(!pollState || !pollState->lock ||                     \
+          MXUser_IsCurThreadHoldingExclLock(pollState->lock))
+
+#define LOG_CB(_l, _str, _c)                                                  \
+   LOG(_l, ("POLL: cb %p (f %p, data %p, flags %x, type %x)" _str,            \
+            (_c), (_c)->cb, (_c)->clientData, (_c)->flags, (_c)->type))
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollLock --
+ * PollEpollUnlock --
+ *
+ *      Locking of the internal poll state.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE void
+PollEpollLock(void)
+{
+   MXUser_AcquireExclLock(pollState->lock);
+}
+
+
+static INLINE void
+PollEpollUnlock(void)
+{
+   MXUser_ReleaseExclLock(pollState->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollNowTick --
+ *
+ *      Returns the current monotonic time in timer wheel ticks.
+ *
+ * Results:
+ *      Current tick.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE uint64
+PollEpollNowTick(void)
+{
+   return (uint64)g_get_monotonic_time() / POLL_EPOLL_TICK_US;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollCbHash --
+ * PollEpollCbEqual --
+ *
+ *      Hash and equality functions for the callback table. Two callbacks
+ *      are identical if Poll_CallbackRemove() cannot tell them apart.
+ *
+ * Results:
+ *      Hash value / TRUE if both keys are the same.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static guint
+PollEpollCbHash(gconstpointer key)  // IN
+{
+   const PollEpollCb *cb = key;
+
+   return g_direct_hash(cb->cb) ^ g_direct_hash(cb->clientData) ^
+          (guint)(cb->flags << 8) ^ (guint)cb->type;
+}
+
+
+static gboolean
+PollEpollCbEqual(gconstpointer a,  // IN
+                 gconstpointer b)  // IN
+{
+   const PollEpollCb *cb1 = a;
+   const PollEpollCb *cb2 = b;
+
+   return cb1->cb == cb2->cb &&
+          cb1->clientData == cb2->clientData &&
+          cb1->flags == cb2->flags &&
+          cb1->type == cb2->type &&
+          PollClassSet_Equals(cb1->classSet, cb2->classSet);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollWake --
+ *
+ *      Wakes up the thread sleeping in epoll_wait(), if any.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollWake(void)
+{
+   uint64 one = 1;
+
+   if (write(pollState->wakeFd, &one, sizeof one) < 0 && errno != EAGAIN) {
+      LOG(1, ("POLL: failed to signal wakeup fd: %s\n", Err_ErrString()));
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollDrainFd --
+ *
+ *      Consumes the counter of a signaled eventfd or timerfd.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollDrainFd(int fd)  // IN
+{
+   uint64 count;
+
+   if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN) {
+      LOG(1, ("POLL: failed to read fd %d: %s\n", fd, Err_ErrString()));
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollMakeReady --
+ *
+ *      Queues a callback on the ready list, unless it is already queued.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE void
+PollEpollMakeReady(PollEpollCb *cb)  // IN
+{
+   ASSERT_POLL_LOCKED();
+
+   if (!DblLnkLst_IsLinked(&cb->links)) {
+      DblLnkLst_LinkLast(&pollState->ready, &cb->links);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollArmTimer --
+ *
+ *      Arms the timerfd for the given tick, or disarms it if 'tick' is 0.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollArmTimer(uint64 tick)  // IN
+{
+   Poll *poll = pollState;
+   struct itimerspec its;
+   uint64 us = tick * POLL_EPOLL_TICK_US;
+
+   ASSERT_POLL_LOCKED();
+
+   memset(&its, 0, sizeof its);
+   its.it_value.tv_sec = us / 1000000;
+   its.it_value.tv_nsec = (us % 1000000) * 1000;
+
+   if (timerfd_settime(poll->timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+      Warning("POLL: failed to arm timer: %s\n", Err_ErrString());
+      return;
+   }
+   poll->armedTick = tick;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollRearmTimer --
+ *
+ *      Looks for the earliest expiration within one revolution of the timer
+ *      wheel and arms the timerfd for it. If nothing expires within one
+ *      revolution, the timer is armed for the end of it and the search
+ *      repeated then.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollRearmTimer(void)
+{
+   Poll *poll = pollState;
+   uint64 tick;
+   uint64 last = poll->curTick + POLL_EPOLL_WHEEL_SIZE;
+
+   ASSERT_POLL_LOCKED();
+
+   if (poll->numTimers == 0) {
+      if (poll->armedTick != 0) {
+         PollEpollArmTimer(0);
+      }
+      return;
+   }
+
+   for (tick = poll->curTick + 1; tick < last; tick++) {
+      DblLnkLst_Links *head = &poll->wheel[tick & POLL_EPOLL_WHEEL_MASK];
+      DblLnkLst_Links *cur;
+
+      DblLnkLst_ForEach(cur, head) {
+         PollEpollCb *cb = DblLnkLst_Container(cur, PollEpollCb, links);
+
+         if (cb->expires <= tick) {
+            PollEpollArmTimer(tick);
+            return;
+         }
+      }
+   }
+   PollEpollArmTimer(last);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollQueueTimer --
+ *
+ *      Inserts a callback in the timer wheel, to be moved to the ready list
+ *      in 'ticks' ticks.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The timerfd may be re-armed.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollQueueTimer(PollEpollCb *cb,  // IN
+                    uint64 ticks)     // IN
+{
+   Poll *poll = pollState;
+
+   ASSERT_POLL_LOCKED();
+   ASSERT(!DblLnkLst_IsLinked(&cb->links));
+   ASSERT(ticks > 0);
+
+   cb->expires = PollEpollNowTick() + ticks;
+   DblLnkLst_LinkLast(&poll->wheel[cb->expires & POLL_EPOLL_WHEEL_MASK],
+                      &cb->links);
+   cb->inWheel = TRUE;
+   poll->numTimers++;
+
+   if (poll->armedTick == 0 || cb->expires < poll->armedTick) {
+      PollEpollArmTimer(cb->expires);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollScheduleTimer --
+ *
+ *      Inserts a POLL_REALTIME callback in the timer wheel, or on the ready
+ *      list if its delay is 0.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The timerfd may be re-armed.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollScheduleTimer(PollEpollCb *cb)  // IN
+{
+   ASSERT_POLL_LOCKED();
+   ASSERT(!DblLnkLst_IsLinked(&cb->links));
+
+   if (cb->event == 0) {
+      PollEpollMakeReady(cb);
+      return;
+   }
+
+   PollEpollQueueTimer(cb, cb->event);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollRunTimers --
+ *
+ *      Advances the timer wheel to the current tick, moving every expired
+ *      callback to the ready list. Devices whose callback was waiting for its
+ *      lock are watched again.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The timerfd may be re-armed.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollRunTimers(void)
+{
+   Poll *poll = pollState;
+   uint64 now = PollEpollNowTick();
+   uint64 count;
+   uint64 i;
+
+   ASSERT_POLL_LOCKED();
+
+   if (now <= poll->curTick) {
+      return;
+   }
+
+   count = MIN(now - poll->curTick, POLL_EPOLL_WHEEL_SIZE);
+   for (i = 1; i <= count; i++) {
+      DblLnkLst_Links *head =
+         &poll->wheel[(poll->curTick + i) & POLL_EPOLL_WHEEL_MASK];
+      DblLnkLst_Links *cur;
+      DblLnkLst_Links *next;
+
+      DblLnkLst_ForEachSafe(cur, next, head) {
+         PollEpollCb *cb = DblLnkLst_Container(cur, PollEpollCb, links);
+
+         if (cb->expires <= now) {
+            DblLnkLst_Unlink1(&cb->links);
+            cb->inWheel = FALSE;
+            poll->numTimers--;
+            DblLnkLst_LinkLast(&poll->ready, &cb->links);
+            if (cb->type == POLL_DEVICE &&
+                !poll->devices[cb->event].noEpoll) {
+               PollEpollUpdateDevice(cb->event);
+            }
+         }
+      }
+   }
+   poll->curTick = now;
+
+   if (poll->armedTick != 0 && poll->armedTick <= now) {
+      poll->armedTick = 0;
+      PollEpollRearmTimer();
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollUnlinkCb --
+ *
+ *      Takes a callback off the ready list or the timer wheel.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollUnlinkCb(PollEpollCb *cb)  // IN
+{
+   Poll *poll = pollState;
+
+   ASSERT_POLL_LOCKED();
+
+   if (DblLnkLst_IsLinked(&cb->links)) {
+      /*
+       * The callbacks moved to the ready list were already uncounted by
+       * PollEpollRunTimers().
+       */
+      if (cb->inWheel) {
+         cb->inWheel = FALSE;
+         poll->numTimers--;
+      }
+      DblLnkLst_Unlink1(&cb->links);
+      DblLnkLst_Init(&cb->links);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollGetDevice --
+ *
+ *      Returns the device slot for a file descriptor, growing the device
+ *      table as needed.
+ *
+ * Results:
+ *      The device slot.
+ *
+ * Side effects:
+ *      May reallocate the device table.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static PollEpollDevice *
+PollEpollGetDevice(int fd)  // IN
+{
+   Poll *poll = pollState;
+
+   ASSERT_POLL_LOCKED();
+   ASSERT(fd >= 0);
+
+   if (fd >= poll->numDevices) {
+      int newSize = MAX(poll->numDevices * 2, POLL_EPOLL_MIN_DEVICES);
+
+      while (newSize <= fd) {
+         newSize *= 2;
+      }
+      poll->devices = g_renew(PollEpollDevice, poll->devices, newSize);
+      memset(poll->devices + poll->numDevices, 0,
+             (newSize - poll->numDevices) * sizeof *poll->devices);
+      poll->numDevices = newSize;
+   }
+   return &poll->devices[fd];
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollUpdateDevice --
+ *
+ *      Brings the epoll registration of a device in line with the callbacks
+ *      currently attached to it. Callbacks waiting in the timer wheel for
+ *      their lock are left out, so that a level-triggered device does not
+ *      wake the loop while they cannot fire.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollUpdateDevice(int fd)  // IN
+{
+   Poll *poll = pollState;
+   PollEpollDevice *dev = &poll->devices[fd];
+   struct epoll_event ev;
+   int flags = 0;
+   int op;
+
+   ASSERT_POLL_LOCKED();
+
+   memset(&ev, 0, sizeof ev);
+   if (dev->read != NULL && !dev->read->inWheel) {
+      ev.events |= EPOLLIN | EPOLLPRI;
+      flags |= dev->read->flags;
+   }
+   if (dev->write != NULL && !dev->write->inWheel) {
+      ev.events |= EPOLLOUT;
+      flags |= dev->write->flags;
+   }
+   if (ev.events != 0 && (flags & POLL_FLAG_EDGE_TRIGGERED) != 0) {
+      ev.events |= EPOLLET;
+   }
+
+   if (dev->noEpoll) {
+      if (ev.events == 0) {
+         dev->noEpoll = FALSE;
+      }
+      dev->events = ev.events;
+      return;
+   }
+
+   if (ev.events == dev->events) {
+      /*
+       * Re-arm edge-triggered devices anyway, so that state which changed
+       * while no callback was attached is reported.
+       */
+      if (ev.events == 0 || (ev.events & EPOLLET) == 0) {
+         return;
+      }
+   }
+
+   if (ev.events == 0) {
+      op = EPOLL_CTL_DEL;
+   } else if (dev->events == 0) {
+      op = EPOLL_CTL_ADD;
+      dev->gen++;
+   } else {
+      op = EPOLL_CTL_MOD;
+   }
+   ev.data.u64 = ((uint64)dev->gen << 32) | (uint32)fd;
+
+   if (epoll_ctl(poll->epollFd, op, fd, &ev) < 0) {
+      int err = errno;
+
+      if (op == EPOLL_CTL_ADD && err == EEXIST) {
+         op = EPOLL_CTL_MOD;
+         err = epoll_ctl(poll->epollFd, op, fd, &ev) < 0 ? errno : 0;
+      }
+
+      if (op == EPOLL_CTL_DEL && (err == EBADF || err == ENOENT)) {
+         /* The descriptor was closed before its callback was removed. */
+         err = 0;
+      } else if (op == EPOLL_CTL_ADD && err == EPERM) {
+         /*
+          * epoll does not support regular files and directories, which
+          * poll() always reports ready. Do the same.
+          */
+         LOG(2, ("POLL: fd %d does not support epoll; always ready\n", fd));
+         dev->noEpoll = TRUE;
+         dev->events = ev.events;
+         if (dev->read != NULL) {
+            PollEpollMakeReady(dev->read);
+         }
+         if (dev->write != NULL) {
+            PollEpollMakeReady(dev->write);
+         }
+         PollEpollWake();
+         return;
+      }
+
+      if (err != 0) {
+         Warning("POLL: epoll_ctl(%d) failed for fd %d: %s\n", op, fd,
+                 Err_Errno2String(err));
+      }
+   }
+   dev->events = ev.events;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollAddCb --
+ * PollEpollRemoveCb --
+ *
+ *      Adds a callback to or removes it from the internal structures. A
+ *      removed callback is freed.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Epoll registration and timer wheel are updated.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollAddCb(PollEpollCb *cb)  // IN
+{
+   Poll *poll = pollState;
+   PollEpollCb *head;
+
+   ASSERT_POLL_LOCKED();
+
+   head = g_hash_table_lookup(poll->cbTable, cb);
+   if (head != NULL) {
+      /*
+       * The same flags/f/cs/cd may not be used for two file descriptors,
+       * but identical timers are fine.
+       */
+      ASSERT(cb->type != POLL_DEVICE);
+      cb->dupNext = head->dupNext;
+      head->dupNext = cb;
+   } else {
+      g_hash_table_insert(poll->cbTable, cb, cb);
+   }
+
+   switch (cb->type) {
+   case POLL_MAIN_LOOP:
+      PollEpollMakeReady(cb);
+      PollEpollWake();
+      break;
+
+   case POLL_REALTIME:
+      PollEpollScheduleTimer(cb);
+      if (cb->event == 0) {
+         PollEpollWake();
+      }
+      break;
+
+   case POLL_DEVICE: {
+      PollEpollDevice *dev = PollEpollGetDevice(cb->event);
+
+      /*
+       * Verify that the device does not already wait for the direction we
+       * are registering.
+       */
+      if (cb->flags & POLL_FLAG_WRITE) {
+         ASSERT(dev->write == NULL);
+         dev->write = cb;
+      } else {
+         ASSERT(dev->read == NULL);
+         dev->read = cb;
+      }
+      if (dev->noEpoll) {
+         PollEpollMakeReady(cb);
+         PollEpollWake();
+      }
+      PollEpollUpdateDevice(cb->event);
+      break;
+   }
+
+   case POLL_VIRTUALREALTIME:
+   case POLL_VTIME:
+   default:
+      NOT_IMPLEMENTED();
+   }
+}
+
+
+static void
+PollEpollRemoveCb(PollEpollCb *cb)  // IN
+{
+   Poll *poll = pollState;
+   PollEpollCb *head;
+
+   ASSERT_POLL_LOCKED();
+   LOG_CB(2, " to be removed\n", cb);
+
+   head = g_hash_table_lookup(poll->cbTable, cb);
+   ASSERT(head != NULL);
+   if (head == cb) {
+      if (cb->dupNext != NULL) {
+         g_hash_table_replace(poll->cbTable, cb->dupNext, cb->dupNext);
+      } else {
+         g_hash_table_remove(poll->cbTable, cb);
+      }
+   } else {
+      while (head->dupNext != cb) {
+         head = head->dupNext;
+         ASSERT(head != NULL);
+      }
+      head->dupNext = cb->dupNext;
+   }
+
+   PollEpollUnlinkCb(cb);
+
+   if (cb->type == POLL_DEVICE) {
+      PollEpollDevice *dev = &poll->devices[cb->event];
+
+      if (dev->read == cb) {
+         dev->read = NULL;
+      } else {
+         ASSERT(dev->write == cb);
+         dev->write = NULL;
+      }
+      PollEpollUpdateDevice(cb->event);
+   }
+
+   g_free(cb);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollInit --
+ *
+ *      Module initialization.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Initializes the module-wide state and sets pollState.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollInit(void)
+{
+   Poll *poll;
+   struct epoll_event ev;
+   unsigned int i;
+
+   ASSERT(pollState == NULL);
+   poll = g_new0(Poll, 1);
+
+   poll->lock = MXUser_CreateExclLock("pollEpollLock", RANK_pollDefaultLock);
+
+   poll->epollFd = epoll_create1(EPOLL_CLOEXEC);
+   if (poll->epollFd < 0) {
+      Panic("POLL: epoll_create1 failed: %s\n", Err_ErrString());
+   }
+   poll->timerFd = timerfd_create(CLOCK_MONOTONIC,
+                                  TFD_NONBLOCK | TFD_CLOEXEC);
+   if (poll->timerFd < 0) {
+      Panic("POLL: timerfd_create failed: %s\n", Err_ErrString());
+   }
+   poll->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (poll->wakeFd < 0) {
+      Panic("POLL: eventfd failed: %s\n", Err_ErrString());
+   }
+
+   memset(&ev, 0, sizeof ev);
+   ev.events = EPOLLIN;
+   ev.data.u64 = (uint32)poll->timerFd;
+   if (epoll_ctl(poll->epollFd, EPOLL_CTL_ADD, poll->timerFd, &ev) < 0) {
+      Panic("POLL: failed to add timerfd: %s\n", Err_ErrString());
+   }
+   ev.data.u64 = (uint32)poll->wakeFd;
+   if (epoll_ctl(poll->epollFd, EPOLL_CTL_ADD, poll->wakeFd, &ev) < 0) {
+      Panic("POLL: failed to add eventfd: %s\n", Err_ErrString());
+   }
+
+   poll->cbTable = g_hash_table_new(PollEpollCbHash, PollEpollCbEqual);
+
+   DblLnkLst_Init(&poll->ready);
+   for (i = 0; i < ARRAYSIZE(poll->wheel); i++) {
+      DblLnkLst_Init(&poll->wheel[i]);
+   }
+   poll->curTick = PollEpollNowTick();
+
+   pollState = poll;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollFreeCbChain --
+ *
+ *      GHashTable callback used at exit to free every registered callback.
+ *
+ * Results:
+ *      TRUE (remove the entry).
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static gboolean
+PollEpollFreeCbChain(gpointer key,       // IN
+                     gpointer value,     // IN
+                     gpointer userData)  // IN: unused
+{
+   PollEpollCb *cb = value;
+
+   while (cb != NULL) {
+      PollEpollCb *next = cb->dupNext;
+
+      g_free(cb);
+      cb = next;
+   }
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollExit --
+ *
+ *      Module exit.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Discards the module-wide state and clears pollState.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollExit(void)
+{
+   Poll *poll = pollState;
+
+   ASSERT(poll != NULL);
+
+   if (poll->source != NULL) {
+      g_source_destroy(poll->source);
+      g_source_unref(poll->source);
+      poll->source = NULL;
+   }
+
+   PollEpollLock();
+   g_hash_table_foreach_remove(poll->cbTable, PollEpollFreeCbChain, NULL);
+   g_hash_table_destroy(poll->cbTable);
+   poll->cbTable = NULL;
+   g_free(poll->devices);
+   poll->devices = NULL;
+   poll->numDevices = 0;
+   close(poll->wakeFd);
+   close(poll->timerFd);
+   close(poll->epollFd);
+   PollEpollUnlock();
+
+   MXUser_DestroyExclLock(poll->lock);
+
+   g_free(poll);
+   pollState = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollHasReady --
+ *
+ *      Checks whether the ready list holds a callback of the given class.
+ *
+ * Results:
+ *      TRUE if there is something to fire right away.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollHasReady(PollClass class)  // IN
+{
+   DblLnkLst_Links *cur;
+
+   ASSERT_POLL_LOCKED();
+
+   DblLnkLst_ForEach(cur, &pollState->ready) {
+      PollEpollCb *cb = DblLnkLst_Container(cur, PollEpollCb, links);
+
+      if (PollClassSet_IsMember(cb->classSet, class)) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollDispatch --
+ *
+ *      Waits up to 'timeoutMs' for events, then fires every ready callback
+ *      of class 'class'.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Depends on the fired callbacks.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollDispatch(PollClass class,  // IN
+                  int timeoutMs)    // IN: -1 to wait forever
+{
+   Poll *poll = pollState;
+   struct epoll_event events[POLL_EPOLL_MAX_EVENTS];
+   int numEvents;
+   int i;
+
+   PollEpollLock();
+   if (PollEpollHasReady(class)) {
+      timeoutMs = 0;
+   }
+   PollEpollUnlock();
+
+   numEvents = epoll_wait(poll->epollFd, events, ARRAYSIZE(events),
+                          timeoutMs);
+   if (numEvents < 0) {
+      if (errno != EINTR) {
+         Warning("POLL: epoll_wait failed: %s\n", Err_ErrString());
+      }
+      numEvents = 0;
+   }
+
+   PollEpollLock();
+
+   for (i = 0; i < numEvents; i++) {
+      int fd = (int)(uint32)events[i].data.u64;
+      uint32 gen = (uint32)(events[i].data.u64 >> 32);
+      PollEpollDevice *dev;
+
+      if (fd == poll->wakeFd || fd == poll->timerFd) {
+         PollEpollDrainFd(fd);
+         continue;
+      }
+
+      /*
+       * Skip events for descriptors whose callbacks went away, or were
+       * re-registered for a different file, while we were waiting.
+       */
+      if (fd >= poll->numDevices) {
+         continue;
+      }
+      dev = &poll->devices[fd];
+      if (dev->gen != gen) {
+         continue;
+      }
+
+      if (dev->read != NULL && (events[i].events & POLL_EPOLL_READ_EVENTS)) {
+         PollEpollMakeReady(dev->read);
+      }
+      if (dev->write != NULL &&
+          (events[i].events & POLL_EPOLL_WRITE_EVENTS)) {
+         PollEpollMakeReady(dev->write);
+      }
+   }
+
+   PollEpollRunTimers();
+   PollEpollFireReady(class);
+
+   PollEpollUnlock();
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollFireReady --
+ *
+ *      Fires the callbacks on the ready list that belong to 'class'.
+ *
+ *      Callbacks queued while firing are left for the next pass. A callback
+ *      that cannot take its lock is retried on the next pass the first time,
+ *      then after a delay that doubles with each failure, so that a busy
+ *      lock does not turn the loop into a busy loop. Non-periodic callbacks
+ *      are removed before they fire, in case they re-register themselves;
+ *      periodic timers are rescheduled.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Depends on the fired callbacks. The poll lock is dropped while a
+ *      callback runs.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollFireReady(PollClass class)  // IN
+{
+   Poll *poll = pollState;
+   DblLnkLst_Links firing;
+
+   ASSERT_POLL_LOCKED();
+
+   /*
+    * Work on a private list so that anything queued by the callbacks waits
+    * for the next pass. Callbacks removed meanwhile unlink themselves.
+    */
+   DblLnkLst_Init(&firing);
+   DblLnkLst_Swap(&firing, &poll->ready);
+
+   while (DblLnkLst_IsLinked(&firing)) {
+      PollEpollCb *cb = DblLnkLst_Container(firing.next, PollEpollCb, links);
+      PollerFunction f = cb->cb;
+      void *clientData = cb->clientData;
+      MXUserRecLock *cbLock = cb->cbLock;
+
+      DblLnkLst_Unlink1(&cb->links);
+      DblLnkLst_Init(&cb->links);
+
+      if (!PollClassSet_IsMember(cb->classSet, class)) {
+         DblLnkLst_LinkLast(&poll->ready, &cb->links);
+         continue;
+      }
+
+      if (cbLock != NULL && !MXUser_TryAcquireRecLock(cbLock)) {
+         /*
+          * We cannot fire at this time. The callback must be retried even
+          * if its device is not reported again, which edge-triggered ones
+          * will not be. Its device is not watched while it waits in the
+          * wheel.
+          */
+         LOG_CB(3, " did not fire\n", cb);
+         cb->timesNotFired++;
+         if (cb->timesNotFired == 1) {
+            DblLnkLst_LinkLast(&poll->ready, &cb->links);
+         } else {
+            uint32 shift = MIN(cb->timesNotFired - 1, 31);
+
+            PollEpollQueueTimer(cb, MIN(1ULL << shift,
+                                        POLL_EPOLL_MAX_BACKOFF_TICKS));
+            if (cb->type == POLL_DEVICE &&
+                !poll->devices[cb->event].noEpoll) {
+               PollEpollUpdateDevice(cb->event);
+            }
+         }
+         continue;
+      }
+
+      LOG_CB(3, " about to fire\n", cb);
+      cb->timesNotFired = 0;
+
+      if ((cb->flags & POLL_FLAG_PERIODIC) == 0) {
+         PollEpollRemoveCb(cb);
+      } else if (cb->type == POLL_REALTIME) {
+         PollEpollScheduleTimer(cb);
+      } else if (cb->type == POLL_MAIN_LOOP) {
+         PollEpollMakeReady(cb);
+      } else if (cb->type == POLL_DEVICE &&
+                 poll->devices[cb->event].noEpoll) {
+         PollEpollMakeReady(cb);
+      }
+
+      PollEpollUnlock();
+      f(clientData);
+      if (cbLock != NULL) {
+         MXUser_ReleaseRecLock(cbLock);
+      }
+      PollEpollLock();
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollLoopTimeout --
+ *
+ *      The poll loop.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Depends on the fired callbacks.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollLoopTimeout(Bool loop,          // IN: loop forever if TRUE, else do one pass.
+                     Bool *exit,         // IN: NULL or set to TRUE to end loop.
+                     PollClass class,    // IN: class of events (POLL_CLASS_*)
+                     int timeout)        // IN: maximum time to sleep (us)
+{
+   int timeoutMs = timeout < 0 ? -1 : (timeout + 999) / 1000;
+
+   do {
+      PollEpollDispatch(class, timeoutMs);
+   } while (loop && (exit == NULL || !*exit));
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollCallback --
+ *
+ *      For the POLL_REALTIME or POLL_DEVICE queues, entries can be
+ *      inserted for good, to fire on a periodic basis (by setting the
+ *      POLL_FLAG_PERIODIC flag).
+ *
+ *      Otherwise, the callback fires only once.
+ *
+ *      For periodic POLL_REALTIME callbacks, "info" is the time in
+ *      microseconds between execution of the callback.  For
+ *      POLL_DEVICE callbacks, info is a file descriptor.
+ *
+ * Results:
+ *      VMWARE_STATUS_SUCCESS.
+ *
+ * Side effects:
+ *      The callback is registered.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static VMwareStatus
+PollEpollCallback(PollClassSet classSet,   // IN
+                  int flags,               // IN
+                  PollerFunction f,        // IN
+                  void *clientData,        // IN
+                  PollEventType type,      // IN
+                  PollDevHandle info,      // IN
+                  MXUserRecLock *lock)     // IN
+{
+   PollEpollCb *cb;
+
+   ASSERT(f);
+   ASSERT(pollState != NULL);
+
+   /*
+    * Every callback must be in POLL_CLASS_MAIN (plus possibly others)
+    */
+   ASSERT(PollClassSet_IsMember(classSet, POLL_CLASS_MAIN) != 0);
+   ASSERT(type >= 0 && type < POLL_NUM_QUEUES);
+
+   cb = g_new0(PollEpollCb, 1);
+   cb->flags = flags;
+   cb->cb = f;
+   cb->clientData = clientData;
+   cb->classSet = classSet;
+   cb->cbLock = lock;
+   cb->type = type;
+   DblLnkLst_Init(&cb->links);
+
+   switch (type) {
+   case POLL_MAIN_LOOP:
+      ASSERT(info == 0);
+      break;
+   case POLL_REALTIME:
+      /* info is the delay in microseconds. */
+      ASSERT(info >= 0);
+      cb->event = (info + POLL_EPOLL_TICK_US - 1) / POLL_EPOLL_TICK_US;
+      break;
+   case POLL_DEVICE:
+      /* info is a file descriptor. */
+      ASSERT(info >= 0);
+      cb->event = info;
+      break;
+   case POLL_VIRTUALREALTIME:
+   case POLL_VTIME:
+   default:
+      NOT_IMPLEMENTED();
+   }
+
+   LOG_CB(2, " is being added\n", cb);
+
+   PollEpollLock();
+   PollEpollAddCb(cb);
+   PollEpollUnlock();
+
+   return VMWARE_STATUS_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollFindAnyPredicate --
+ *
+ *      Predicate usable by GHashTable iteration functions to find a
+ *      callback regardless of its client data.
+ *
+ * Results:
+ *      TRUE if the value matches our search criteria, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static gboolean
+PollEpollFindAnyPredicate(gpointer key,   // IN
+                          gpointer value, // IN
+                          gpointer data)  // IN
+{
+   const PollEpollCb *current = value;
+   const PollEpollCb *search = data;
+
+   return current->cb == search->cb &&
+          current->flags == search->flags &&
+          current->type == search->type &&
+          PollClassSet_Equals(current->classSet, search->classSet);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollCallbackRemoveInt --
+ *
+ *      Remove a callback.
+ *
+ *      Lookups by client data are O(1); matching any client data requires
+ *      a scan of the callback table.
+ *
+ * Results:
+ *      TRUE if entry found and removed, FALSE otherwise
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollCallbackRemoveInt(PollClassSet classSet,           // IN
+                           int flags,                       // IN
+                           PollerFunction f,                // IN
+                           void *clientData,                // IN
+                           Bool matchAnyClientData,         // IN
+                           PollEventType type,              // IN
+                           void **foundClientData)          // OUT
+{
+   Poll *poll = pollState;
+   PollEpollCb search;
+   PollEpollCb *found;
+
+   ASSERT(poll);
+   ASSERT(!clientData || !matchAnyClientData);
+   ASSERT(type >= 0 && type < POLL_NUM_QUEUES);
+   ASSERT(foundClientData);
+
+   memset(&search, 0, sizeof search);
+   search.classSet = classSet;
+   search.flags = flags;
+   search.cb = f;
+   search.clientData = clientData;
+   search.type = type;
+
+   PollEpollLock();
+
+   if (matchAnyClientData) {
+      found = g_hash_table_find(poll->cbTable, PollEpollFindAnyPredicate,
+                                &search);
+   } else {
+      found = g_hash_table_lookup(poll->cbTable, &search);
+   }
+   if (found != NULL) {
+      *foundClientData = found->clientData;
+      PollEpollRemoveCb(found);
+   } else {
+      LOG(1, ("POLL: no matching entry for cb %p, data %p, flags %x, type %x\n",
+              f, clientData, flags, type));
+   }
+
+   PollEpollUnlock();
+   return found != NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollCallbackRemove --
+ *
+ *      Remove a callback.
+ *
+ * Results:
+ *      TRUE if entry found and removed, FALSE otherwise
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollCallbackRemove(PollClassSet classSet,   // IN
+                        int flags,               // IN
+                        PollerFunction f,        // IN
+                        void *clientData,        // IN
+                        PollEventType type)      // IN
+{
+   void *foundClientData;
+
+   return PollEpollCallbackRemoveInt(classSet, flags, f, clientData, FALSE,
+                                     type, &foundClientData);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollCallbackRemoveOneByCB --
+ *
+ *      Remove a callback.
+ *
+ * Results:
+ *      TRUE if entry found and removed (*clientData updated), FALSE otherwise
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollCallbackRemoveOneByCB(PollClassSet classSet,   // IN
+                               int flags,               // IN
+                               PollerFunction f,        // IN
+                               PollEventType type,      // IN
+                               void **clientData)       // OUT
+{
+   return PollEpollCallbackRemoveInt(classSet, flags, f, NULL, TRUE, type,
+                                     clientData);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollNotifyChange --
+ *
+ *      Wakes up the poll loop so it re-evaluates its state.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollNotifyChange(PollClassSet classSet)  // IN: unused
+{
+   PollEpollWake();
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollSourcePrepare --
+ * PollEpollSourceCheck --
+ * PollEpollSourceDispatch --
+ *
+ *      GSource functions that run the epoll loop from a GLib main context.
+ *      GLib only ever polls the epoll descriptor, whatever the number of
+ *      registered devices.
+ *
+ * Results:
+ *      See GSourceFuncs.
+ *
+ * Side effects:
+ *      Dispatch fires the ready POLL_CLASS_MAIN callbacks.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static gboolean
+PollEpollSourcePrepare(GSource *source,  // IN
+                       gint *timeout)    // OUT
+{
+   Bool ready;
+
+   PollEpollLock();
+   ready = PollEpollHasReady(POLL_CLASS_MAIN);
+   PollEpollUnlock();
+
+   *timeout = ready ? 0 : -1;
+   return ready;
+}
+
+
+static gboolean
+PollEpollSourceCheck(GSource *source)  // IN
+{
+   PollEpollSource *src = (PollEpollSource *)source;
+   Bool ready;
+
+   if (src->pfd.revents != 0) {
+      return TRUE;
+   }
+
+   PollEpollLock();
+   ready = PollEpollHasReady(POLL_CLASS_MAIN);
+   PollEpollUnlock();
+
+   return ready;
+}
+
+
+static gboolean
+PollEpollSourceDispatch(GSource *source,      // IN
+                        GSourceFunc callback, // IN: unused
+                        gpointer userData)    // IN: unused
+{
+   PollEpollDispatch(POLL_CLASS_MAIN, 0);
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollAttachSource --
+ *
+ *      Attaches the epoll descriptor to the default GLib main context.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Sets pollState->source.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollAttachSource(void)
+{
+   static GSourceFuncs srcFuncs = {
+      PollEpollSourcePrepare,
+      PollEpollSourceCheck,
+      PollEpollSourceDispatch,
+      NULL,
+   };
+   PollEpollSource *src;
+
+   src = (PollEpollSource *)g_source_new(&srcFuncs, sizeof *src);
+   src->pfd.fd = pollState->epollFd;
+   src->pfd.events = G_IO_IN;
+   g_source_add_poll(&src->source, &src->pfd);
+   g_source_set_can_recurse(&src->source, FALSE);
+   g_source_attach(&src->source, NULL);
+
+   pollState->source = &src->source;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Poll_InitEpoll --
+ *
+ *      Public init function for this Poll implementation. Callbacks fire
+ *      from the default GLib main context, or from Poll_Loop().
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Poll_InitEpoll(void)
+{
+   static volatile gsize inited = 0;
+
+   static const PollImpl epollImpl =
+   {
+      PollEpollInit,
+      PollEpollExit,
+      PollEpollLoopTimeout,
+      PollEpollCallback,
+      PollEpollCallbackRemove,
+      PollEpollCallbackRemoveOneByCB,
+      PollLockingAlwaysEnabled,
+      PollEpollNotifyChange,
+   };
+
+   if (g_once_init_enter(&inited)) {
+      gsize didInit = 1;
+      Poll_InitWithImpl(&epollImpl);
+      PollEpollAttachSource();
+      g_once_init_leave(&inited, didInit);
+   }
+}
@@ -1488,7 +1488,14 @@ Poll_InitGtk(void)
 
    if (g_once_init_enter(&inited)) {
       gsize didInit = 1;
-      Poll_InitWithImpl(&gtkImpl);
+
+      /*
+       * The application may have picked another implementation already
+       * (e.g. Poll_InitEpoll); it is driven by the same GLib main loop.
+       */
+      if (!Poll_IsInitialized()) {
+         Poll_InitWithImpl(&gtkImpl);
+      }
       g_once_init_leave(&inited, didInit);
    }
 }
@@ -80,6 +80,8 @@
 #include "strutil.h"
 #include "codeset.h"
 #include "unicode.h"
+#include "hashTable.h"
+#include "userlock.h"
 
 #ifdef USERWORLD
 #include <vm_basic_types.h>
@@ -223,356 +225,725 @@ done:
 }
 
 
+/*
+ * The Linux process list is kept in a table of the processes seen by the
+ * previous listing, keyed by pid. An entry is reused as long as the pid's
+ * start time, name and owner are unchanged, so that only new or changed
+ * processes have their status file read and their owner looked up again.
+ * The cmdline is read every time, since a process can rewrite it.
+ *
+ * Listing all processes drops the entries of the processes that exited.
+ * Listing given pids drops them once the table has grown by
+ * PROCMGR_PROC_TABLE_SLACK entries since it was last pruned.
+ */
+
+#define PROCMGR_PROC_TABLE_SIZE  4096
+#define PROCMGR_PROC_TABLE_SLACK 1024
+
+typedef struct ProcMgrProcEntry {
+   unsigned long long startTicks;   // start time, in ticks since boot
+   char comm[64];                   // name from /proc/<pid>/stat
+   uid_t uid;
+   unsigned int listGen;            // last listing that returned the entry
+   ProcMgrProcInfo info;
+} ProcMgrProcEntry;
+
+static HashTable *procTable = NULL;
+static unsigned int procTableGen = 0;
+static size_t procTablePruned = 0;   // entries left by the last pruning
+static time_t hostStartTime = 0;
+static unsigned long long hertz = 100;
+
+
 /*
  *----------------------------------------------------------------------
  *
- * ProcMgr_ListProcesses --
+ * ProcMgrInitStartTime --
  *
- *      List all the processes that the calling client has privilege to
- *      enumerate. The strings in the returned structure should be all
- *      UTF-8 encoded, although we do not enforce it right now.
+ *      Figure out when the system started.  We need this number to
+ *      compute process start times, which are relative to this number.
+ *      We grab the first float in /proc/uptime, convert it to an integer,
+ *      and then subtract that from the current time.  That leaves us
+ *      with the seconds since epoch that the system booted up.
  *
  * Results:
- *
- *      A ProcMgrProcInfoArray.
+ *      None.
  *
  * Side effects:
+ *      Sets hostStartTime and hertz.
  *
  *----------------------------------------------------------------------
  */
 
-ProcMgrProcInfoArray *
-ProcMgr_ListProcesses(void)
+static void
+ProcMgrInitStartTime(void)
 {
-   ProcMgrProcInfoArray *procList = NULL;
-   ProcMgrProcInfo procInfo;
-   Bool failed = TRUE;
-   DIR *dir;
-   struct dirent *ent;
-   static time_t hostStartTime = 0;
-   static unsigned long long hertz = 100;
-   int numberFound;
-
-   procList = Util_SafeCalloc(1, sizeof *procList);
-   ProcMgrProcInfoArray_Init(procList, 0);
-   procInfo.procCmdName = NULL;
-   procInfo.procCmdLine = NULL;
-   procInfo.procOwner = NULL;
+   FILE *uptimeFile = NULL;
 
-   /*
-    * Figure out when the system started.  We need this number to
-    * compute process start times, which are relative to this number.
-    * We grab the first float in /proc/uptime, convert it to an integer,
-    * and then subtract that from the current time.  That leaves us
-    * with the seconds since epoch that the system booted up.
-    */
-   if (0 == hostStartTime) {
-      FILE *uptimeFile = NULL;
+   if (0 != hostStartTime) {
+      return;
+   }
 
-      uptimeFile = fopen("/proc/uptime", "r");
-      if (NULL != uptimeFile) {
-         double secondsSinceBoot;
-         char *realLocale;
-         char *savedLocale;
+   uptimeFile = fopen("/proc/uptime", "r");
+   if (NULL != uptimeFile) {
+      double secondsSinceBoot;
+      char *realLocale;
+      char *savedLocale;
+      int numberFound;
 
-         /*
-          * Set the locale such that floats are delimited with ".".
-          */
-         realLocale = setlocale(LC_NUMERIC, NULL);
-         /*
-          * On Linux, the returned locale can point to static data,
-          * so make a copy.
-          */
-         savedLocale = Util_SafeStrdup(realLocale);
-         setlocale(LC_NUMERIC, "C");
-         numberFound = fscanf(uptimeFile, "%lf", &secondsSinceBoot);
-         setlocale(LC_NUMERIC, savedLocale);
-         free(savedLocale);
-
-         /*
-          * Figure out system boot time in absolute terms.
-          */
-         if (numberFound) {
-            hostStartTime = time(NULL) - (time_t) secondsSinceBoot;
-         }
-         fclose(uptimeFile);
-      }
+      /*
+       * Set the locale such that floats are delimited with ".".
+       */
+      realLocale = setlocale(LC_NUMERIC, NULL);
+      /*
+       * On Linux, the returned locale can point to static data,
+       * so make a copy.
+       */
+      savedLocale = Util_SafeStrdup(realLocale);
+      setlocale(LC_NUMERIC, "C");
+      numberFound = fscanf(uptimeFile, "%lf", &secondsSinceBoot);
+      setlocale(LC_NUMERIC, savedLocale);
+      free(savedLocale);
 
       /*
-       * Figure out the "hertz" value, which may be radically
-       * different than the actual CPU frequency of the machine.
-       * The process start time is expressed in terms of this value,
-       * so let's compute it now and keep it in a static variable.
+       * Figure out system boot time in absolute terms.
        */
+      if (numberFound) {
+         hostStartTime = time(NULL) - (time_t) secondsSinceBoot;
+      }
+      fclose(uptimeFile);
+   }
+
+   /*
+    * Figure out the "hertz" value, which may be radically
+    * different than the actual CPU frequency of the machine.
+    * The process start time is expressed in terms of this value,
+    * so let's compute it now and keep it in a static variable.
+    */
 #ifdef HZ
-      hertz = (unsigned long long) HZ;
+   hertz = (unsigned long long) HZ;
 #else
-      /*
-       * Don't do anything.  Use the default value of 100.
-       */
+   /*
+    * Don't do anything.  Use the default value of 100.
+    */
 #endif
-   } // if (0 == hostStartTime)
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrFreeProcEntry --
+ *
+ *      Frees an entry of the process table.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
 
+static void
+ProcMgrFreeProcEntry(void *data)  // IN
+{
+   ProcMgrProcEntry *entry = data;
+
+   free(entry->info.procCmdName);
+   free(entry->info.procCmdLine);
+   free(entry->info.procOwner);
+   free(entry);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrReadProcStat --
+ *
+ *      Reads the name and start time of a process from /proc/<pid>/stat.
+ *
+ * Results:
+ *      TRUE on success.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+ProcMgrReadProcStat(const char *pidStr,              // IN
+                    unsigned long long *startTicks,  // OUT
+                    char *comm,                      // OUT
+                    size_t commSize)                 // IN
+{
+   char path[64];
    /*
-    * Scan /proc for any directory that is all numbers.
-    * That represents a process id.
+    * The start time is the 22nd field, it is well within the first 512
+    * bytes since the name is at most 16 bytes long.
     */
-   dir = opendir("/proc");
-   if (NULL == dir) {
-      Warning("ProcMgr_ListProcesses unable to open /proc\n");
-      goto abort;
+   char buf[512];
+   char *nameBegin;
+   char *nameEnd;
+   ssize_t numRead;
+   int fd;
+
+   if (Str_Snprintf(path, sizeof path, "/proc/%s/stat", pidStr) == -1) {
+      Debug("Giant process id '%s'\n", pidStr);
+      return FALSE;
    }
 
-   while ((ent = readdir(dir))) {
-      struct stat fileStat;
-      char cmdFilePath[1024];
-      int statResult;
-      int numRead = 0;   /* number of bytes that read() actually read */
-      int cmdFd;
-      int replaceLoop;
-      struct passwd *pwd;
-      char *cmdLineTemp = NULL;
-      char *cmdStatTemp = NULL;
-      size_t strLen = 0;
-      unsigned long long dummy;
-      unsigned long long relativeStartTime;
-      char *stringBegin;
-      char *cmdNameBegin;
-      Bool cmdNameLookup = TRUE;
+   fd = open(path, O_RDONLY);
+   if (-1 == fd) {
+      return FALSE;
+   }
+   numRead = read(fd, buf, sizeof buf - 1);
+   close(fd);
+   if (0 >= numRead) {
+      return FALSE;
+   }
+   buf[numRead] = '\0';
 
-      /*
-       * We only care about dirs that look like processes.
-       */
-      if (strspn(ent->d_name, "0123456789") != strlen(ent->d_name)) {
-         continue;
-      }
+   /*
+    * "123 (bash) S [...]". The name may itself contain parentheses.
+    */
+   nameBegin = strchr(buf, '(');
+   nameEnd = strrchr(buf, ')');
+   if (NULL == nameBegin || NULL == nameEnd || nameEnd < nameBegin) {
+      return FALSE;
+   }
+   nameBegin++;
+   Str_Strncpy(comm, commSize, nameBegin,
+               MIN(nameEnd - nameBegin, commSize - 1));
 
-      if (snprintf(cmdFilePath,
-                   sizeof cmdFilePath,
-                   "/proc/%s/cmdline",
-                   ent->d_name) == -1) {
-         Debug("Giant process id '%s'\n", ent->d_name);
-         continue;
-      }
+   if (sscanf(nameEnd + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+              "%*u %*u %*d %*d %*d %*d %*d %*d %llu", startTicks) != 1) {
+      return FALSE;
+   }
 
-      cmdFd = open(cmdFilePath, O_RDONLY);
-      if (-1 == cmdFd) {
-         /*
-          * We may not be able to open the file due to the security reason.
-          * In that case, just ignore and continue.
-          */
-         continue;
-      }
+   return TRUE;
+}
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrReadCmdLine --
+ *
+ *      Reads the command line of a process, and extracts the command name
+ *      from it. Falls back to the name in /proc/<pid>/status for processes
+ *      without a command line.
+ *
+ * Results:
+ *      TRUE on success, FALSE if the command line can't be read.
+ *
+ * Side effects:
+ *      The returned strings must be freed by the caller. The command
+ *      name may be NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+ProcMgrReadCmdLine(const char *pidStr,   // IN
+                   char **cmdName,       // OUT
+                   char **cmdLine)       // OUT
+{
+   char cmdFilePath[1024];
+   char *cmdLineTemp = NULL;
+   int numRead;
+   int cmdFd;
+   int replaceLoop;
+   char *cmdNameBegin;
+   Bool cmdNameLookup = TRUE;
+
+   *cmdName = NULL;
+   *cmdLine = NULL;
+
+   if (snprintf(cmdFilePath,
+                sizeof cmdFilePath,
+                "/proc/%s/cmdline",
+                pidStr) == -1) {
+      Debug("Giant process id '%s'\n", pidStr);
+      return FALSE;
+   }
+
+   cmdFd = open(cmdFilePath, O_RDONLY);
+   if (-1 == cmdFd) {
       /*
-       * Read in the command and its arguments.  Arguments are separated
-       * by \0, which we convert to ' '.  Then we add a NULL terminator
-       * at the end.  Example: "perl -cw try.pl" is read in as
-       * "perl\0-cw\0try.pl\0", which we convert to "perl -cw try.pl\0".
-       * It would have been nice to preserve the NUL character so it is easy
-       * to determine what the command line arguments are without
-       * using a quote and space parsing heuristic.  But we do this
-       * to have parity with how Windows reports the command line.
-       * In the future, we could keep the NUL version around and pass it
-       * back to the client for easier parsing when retrieving individual
-       * command line parameters is needed.
+       * We may not be able to open the file due to the security reason.
+       * In that case, just ignore and continue.
        */
-      numRead = ProcMgr_ReadProcFile(cmdFd, &cmdLineTemp);
-      close(cmdFd);
+      return FALSE;
+   }
 
-      if (numRead < 0) {
-         continue;
-      }
+   /*
+    * Read in the command and its arguments.  Arguments are separated
+    * by \0, which we convert to ' '.  Then we add a NULL terminator
+    * at the end.  Example: "perl -cw try.pl" is read in as
+    * "perl\0-cw\0try.pl\0", which we convert to "perl -cw try.pl\0".
+    * It would have been nice to preserve the NUL character so it is easy
+    * to determine what the command line arguments are without
+    * using a quote and space parsing heuristic.  But we do this
+    * to have parity with how Windows reports the command line.
+    * In the future, we could keep the NUL version around and pass it
+    * back to the client for easier parsing when retrieving individual
+    * command line parameters is needed.
+    */
+   numRead = ProcMgr_ReadProcFile(cmdFd, &cmdLineTemp);
+   close(cmdFd);
 
-      if (numRead > 0) {
-         /*
-          * Stop before we hit the final '\0'; want to leave it alone.
-          */
-         for (replaceLoop = 0 ; replaceLoop < (numRead - 1) ; replaceLoop++) {
-            if ('\0' == cmdLineTemp[replaceLoop]) {
-               if (cmdNameLookup) {
+   if (numRead < 0) {
+      return FALSE;
+   }
+
+   if (numRead > 0) {
+      /*
+       * Stop before we hit the final '\0'; want to leave it alone.
+       */
+      for (replaceLoop = 0 ; replaceLoop < (numRead - 1) ; replaceLoop++) {
+         if ('\0' == cmdLineTemp[replaceLoop]) {
+            if (cmdNameLookup) {
+               /*
+                * Store the command name.
+                * Find the last path separator, to get the cmd name.
+                * If no separator is found, then use the whole name.
+                */
+               cmdNameBegin = strrchr(cmdLineTemp, '/');
+               if (NULL == cmdNameBegin) {
+                  cmdNameBegin = cmdLineTemp;
+               } else {
                   /*
-                   * Store the command name.
-                   * Find the last path separator, to get the cmd name.
-                   * If no separator is found, then use the whole name.
+                   * Skip over the last separator.
                    */
-                  cmdNameBegin = strrchr(cmdLineTemp, '/');
-                  if (NULL == cmdNameBegin) {
-                     cmdNameBegin = cmdLineTemp;
-                  } else {
-                     /*
-                      * Skip over the last separator.
-                      */
-                     cmdNameBegin++;
-                  }
-                  procInfo.procCmdName = Unicode_Alloc(cmdNameBegin, STRING_ENCODING_DEFAULT);
-                  cmdNameLookup = FALSE;
+                  cmdNameBegin++;
                }
-               cmdLineTemp[replaceLoop] = ' ';
-            }
-         }
-      } else {
-         /*
-          * Some procs don't have a command line text, so read a name from
-          * the 'status' file (should be the first line). If unable to get a name,
-          * the process is still real, so it should be included in the list, just
-          * without a name.
-          */
-         cmdFd = -1;
-         numRead = 0;
-
-         if (snprintf(cmdFilePath,
-                      sizeof cmdFilePath,
-                      "/proc/%s/status",
-                      ent->d_name) != -1) {
-            cmdFd = open(cmdFilePath, O_RDONLY);
-         }
-         if (cmdFd != -1) {
-            numRead = ProcMgr_ReadProcFile(cmdFd, &cmdLineTemp);
-            close(cmdFd);
-         }
-         if (numRead > 0) {
-            /*
-             * Extract the part with just the name, by reading until the first
-             * space, then reading the next non-space word after that, and
-             * ignoring everything else. The format looks like this:
-             *     "^Name:[ \t]*(.*)$"
-             * for example:
-             *     "Name:    nfsd"
-             */
-            const char *nameStart;
-            char *copyItr;
-
-            /* Skip non-whitespace. */
-            for (nameStart = cmdLineTemp; *nameStart &&
-                                          *nameStart != ' ' &&
-                                          *nameStart != '\t' &&
-                                          *nameStart != '\n'; ++nameStart);
-            /* Skip whitespace. */
-            for (;*nameStart &&
-                  (*nameStart == ' ' ||
-                   *nameStart == '\t' ||
-                   *nameStart == '\n'); ++nameStart);
-            /* Copy the name to the start of the string and null term it. */
-            for (copyItr = cmdLineTemp; *nameStart && *nameStart != '\n';) {
-               *(copyItr++) = *(nameStart++);
+               *cmdName = Unicode_Alloc(cmdNameBegin, STRING_ENCODING_DEFAULT);
+               cmdNameLookup = FALSE;
             }
-            *copyItr = '\0';
-            /*
-             * Store the command name.
-             */
-            procInfo.procCmdName = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
+            cmdLineTemp[replaceLoop] = ' ';
          }
       }
 
       /*
-       * Get the inode information for this process.  This gives us
-       * the process owner.
+       * Store the command line string.
        */
-      if (snprintf(cmdFilePath,
-                   sizeof cmdFilePath,
-                   "/proc/%s",
-                   ent->d_name) == -1) {
-         Debug("Giant process id '%s'\n", ent->d_name);
-         goto next_entry;
-      }
-
+      *cmdLine = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
+   } else {
       /*
-       * stat() /proc/<pid> to get the owner.  We use fileStat.st_uid
-       * later in this code.  If we can't stat(), ignore and continue.
-       * Maybe we don't have enough permission.
+       * Some procs don't have a command line text, so read a name from
+       * the 'status' file (should be the first line). If unable to get a name,
+       * the process is still real, so it should be included in the list, just
+       * without a name.
        */
-      statResult = stat(cmdFilePath, &fileStat);
-      if (0 != statResult) {
-         goto next_entry;
-      }
+      cmdFd = -1;
 
-      /*
-       * Figure out the process start time.  Open /proc/<pid>/stat
-       * and read the start time and compute it in absolute time.
-       */
       if (snprintf(cmdFilePath,
                    sizeof cmdFilePath,
-                   "/proc/%s/stat",
-                   ent->d_name) == -1) {
-         Debug("Giant process id '%s'\n", ent->d_name);
-         goto next_entry;
-      }
-      cmdFd = open(cmdFilePath, O_RDONLY);
-      if (-1 == cmdFd) {
-         goto next_entry;
+                   "/proc/%s/status",
+                   pidStr) != -1) {
+         cmdFd = open(cmdFilePath, O_RDONLY);
       }
-      numRead = ProcMgr_ReadProcFile(cmdFd, &cmdStatTemp);
-      close(cmdFd);
-      if (0 >= numRead) {
-         goto next_entry;
+      if (cmdFd != -1) {
+         numRead = ProcMgr_ReadProcFile(cmdFd, &cmdLineTemp);
+         close(cmdFd);
       }
-      /*
-       * Skip over initial process id and process name.  "123 (bash) [...]".
-       */
-      stringBegin = strchr(cmdStatTemp, ')') + 2;
-
-      numberFound = sscanf(stringBegin, "%c %d %d %d %d %d "
-                           "%lu %lu %lu %lu %lu %Lu %Lu %Lu %Lu %ld %ld "
-                           "%d %ld %Lu",
-                           (char *) &dummy, (int *) &dummy, (int *) &dummy,
-                           (int *) &dummy, (int *) &dummy,  (int *) &dummy,
-                           (unsigned long *) &dummy, (unsigned long *) &dummy,
-                           (unsigned long *) &dummy, (unsigned long *) &dummy,
-                           (unsigned long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (long *) &dummy, (long *) &dummy,
-                           (int *) &dummy, (long *) &dummy,
-                           &relativeStartTime);
-      if (20 != numberFound) {
-         goto next_entry;
+      if (numRead > 0) {
+         /*
+          * Extract the part with just the name, by reading until the first
+          * space, then reading the next non-space word after that, and
+          * ignoring everything else. The format looks like this:
+          *     "^Name:[ \t]*(.*)$"
+          * for example:
+          *     "Name:    nfsd"
+          */
+         const char *nameStart;
+         char *copyItr;
+
+         /* Skip non-whitespace. */
+         for (nameStart = cmdLineTemp; *nameStart &&
+                                       *nameStart != ' ' &&
+                                       *nameStart != '\t' &&
+                                       *nameStart != '\n'; ++nameStart);
+         /* Skip whitespace. */
+         for (;*nameStart &&
+               (*nameStart == ' ' ||
+                *nameStart == '\t' ||
+                *nameStart == '\n'); ++nameStart);
+         /* Copy the name to the start of the string and null term it. */
+         for (copyItr = cmdLineTemp; *nameStart && *nameStart != '\n';) {
+            *(copyItr++) = *(nameStart++);
+         }
+         *copyItr = '\0';
+         /*
+          * Store the command name.
+          */
+         *cmdName = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
       }
+      *cmdLine = Unicode_Alloc("", STRING_ENCODING_UTF8);
+   }
+
+   free(cmdLineTemp);
+   return TRUE;
+}
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrStrEqual --
+ *
+ *      Compares two strings, either of which may be NULL.
+ *
+ * Results:
+ *      TRUE if both are NULL or both have the same contents.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+ProcMgrStrEqual(const char *a,  // IN/OPT
+                const char *b)  // IN/OPT
+{
+   return (NULL == a || NULL == b) ? a == b : strcmp(a, b) == 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrUpdateProcEntry --
+ *
+ *      Brings the entry of the given process in the process table up to
+ *      date. Only /proc/<pid>/stat, /proc/<pid>/cmdline and the owner of
+ *      /proc/<pid> are read if the process hasn't changed since the
+ *      previous listing.
+ *
+ * Results:
+ *      The entry, or NULL if the process doesn't exist or can't be read.
+ *
+ * Side effects:
+ *      Adds, replaces or removes the entry in the table.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ProcMgrProcEntry *
+ProcMgrUpdateProcEntry(HashTable *table,      // IN/OUT
+                       const char *pidStr,    // IN
+                       pid_t pid)             // IN
+{
+   const void *key = (const void *) (uintptr_t) pid;
+   ProcMgrProcEntry *entry = NULL;
+   ProcMgrProcEntry *newEntry;
+   unsigned long long startTicks;
+   char comm[sizeof entry->comm];
+   char procPath[64];
+   struct stat fileStat;
+   char *cmdName;
+   char *cmdLine;
+
+   HashTable_Lookup(table, key, (void **) &entry);
+
+   /*
+    * stat() /proc/<pid> to get the owner. If we can't stat(), ignore
+    * the process. Maybe we don't have enough permission.
+    */
+   if (Str_Snprintf(procPath, sizeof procPath, "/proc/%s", pidStr) == -1 ||
+       0 != stat(procPath, &fileStat) ||
+       !ProcMgrReadProcStat(pidStr, &startTicks, comm, sizeof comm)) {
+      goto gone;
+   }
+
+   if (!ProcMgrReadCmdLine(pidStr, &cmdName, &cmdLine)) {
+      goto gone;
+   }
+
+   if (NULL != entry &&
+       entry->startTicks == startTicks &&
+       entry->uid == fileStat.st_uid &&
+       strcmp(entry->comm, comm) == 0) {
       /*
-       * Store the command line string pointer in dynbuf.
+       * Same process. Only its cmdline may have changed, e.g. a daemon
+       * that shows its state in its arguments.
        */
-      if (cmdLineTemp) {
-         procInfo.procCmdLine = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
+      if (!ProcMgrStrEqual(entry->info.procCmdLine, cmdLine) ||
+          !ProcMgrStrEqual(entry->info.procCmdName, cmdName)) {
+         free(entry->info.procCmdName);
+         free(entry->info.procCmdLine);
+         entry->info.procCmdName = cmdName;
+         entry->info.procCmdLine = cmdLine;
       } else {
-         procInfo.procCmdLine = Unicode_Alloc("", STRING_ENCODING_UTF8);
+         free(cmdName);
+         free(cmdLine);
       }
+      return entry;
+   }
 
-      /*
-       * Store the pid in dynbuf.
-       */
-      procInfo.procId = (pid_t) atoi(ent->d_name);
+   /*
+    * New process, reused pid, or a process that exec'ed or changed owner.
+    */
 
-      /*
-       * Store the owner of the process.
-       */
-      pwd = getpwuid(fileStat.st_uid);
-      procInfo.procOwner = (NULL == pwd)
-                           ? Str_SafeAsprintf(&strLen, "%d", (int) fileStat.st_uid)
-                           : Unicode_Alloc(pwd->pw_name, STRING_ENCODING_DEFAULT);
+   newEntry = Util_SafeCalloc(1, sizeof *newEntry);
+   newEntry->startTicks = startTicks;
+   Str_Strcpy(newEntry->comm, comm, sizeof newEntry->comm);
+   newEntry->uid = fileStat.st_uid;
+   newEntry->info.procId = pid;
+   newEntry->info.procCmdName = cmdName;
+   newEntry->info.procCmdLine = cmdLine;
+   newEntry->info.procStartTime = hostStartTime + (startTicks / hertz);
+
+   if (NULL != entry && entry->uid == fileStat.st_uid) {
+      newEntry->info.procOwner = entry->info.procOwner;
+      entry->info.procOwner = NULL;
+   } else {
+      struct passwd *pwd = getpwuid(fileStat.st_uid);
+      size_t strLen = 0;
 
-      /*
-       * Store the time that the process started.
-       */
-      procInfo.procStartTime = hostStartTime + (relativeStartTime / hertz);
+      newEntry->info.procOwner = (NULL == pwd)
+                                 ? Str_SafeAsprintf(&strLen, "%d",
+                                                    (int) fileStat.st_uid)
+                                 : Unicode_Alloc(pwd->pw_name,
+                                                 STRING_ENCODING_DEFAULT);
+   }
+
+   HashTable_ReplaceOrInsert(table, key, newEntry);
+   return newEntry;
+
+gone:
+   if (NULL != entry) {
+      HashTable_Delete(table, key);
+   }
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrAppendProcEntry --
+ *
+ *      Appends a copy of the info of a process table entry to a process
+ *      list, unless the current listing already returned it.
+ *
+ * Results:
+ *      FALSE if out of memory.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+ProcMgrAppendProcEntry(ProcMgrProcInfoArray *procList,  // IN/OUT
+                       ProcMgrProcEntry *entry)         // IN/OUT
+{
+   ProcMgrProcInfo procInfo = entry->info;
+
+   if (entry->listGen == procTableGen) {
+      return TRUE;
+   }
+   entry->listGen = procTableGen;
+
+   procInfo.procCmdName = Util_SafeStrdup(entry->info.procCmdName);
+   procInfo.procCmdLine = Util_SafeStrdup(entry->info.procCmdLine);
+   procInfo.procOwner = Util_SafeStrdup(entry->info.procOwner);
+
+   if (!ProcMgrProcInfoArray_Push(procList, procInfo)) {
+      free(procInfo.procCmdName);
+      free(procInfo.procCmdLine);
+      free(procInfo.procOwner);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrPruneProcTable --
+ *
+ *      Drops the entries of the processes that exited from the process
+ *      table, once it has grown by PROCMGR_PROC_TABLE_SLACK entries since
+ *      it was last pruned.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ProcMgrPruneProcTable(void)
+{
+   const void **keys;
+   size_t numKeys;
+   size_t i;
+
+   if (HashTable_GetNumElements(procTable) <
+       procTablePruned + PROCMGR_PROC_TABLE_SLACK) {
+      return;
+   }
+
+   HashTable_KeyArray(procTable, &keys, &numKeys);
+   for (i = 0; i < numKeys; i++) {
+      pid_t pid = (pid_t) (uintptr_t) keys[i];
+
+      if (kill(pid, 0) == -1 && errno == ESRCH) {
+         HashTable_Delete(procTable, keys[i]);
+      }
+   }
+   free(keys);
+
+   procTablePruned = HashTable_GetNumElements(procTable);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgr_ListProcesses --
+ *
+ *      List all the processes that the calling client has privilege to
+ *      enumerate. The strings in the returned structure should be all
+ *      UTF-8 encoded, although we do not enforce it right now.
+ *
+ * Results:
+ *
+ *      A ProcMgrProcInfoArray.
+ *
+ * Side effects:
+ *
+ *----------------------------------------------------------------------
+ */
+
+ProcMgrProcInfoArray *
+ProcMgr_ListProcesses(void)
+{
+   return ProcMgr_ListProcessesEx(NULL, 0);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgr_ListProcessesEx --
+ *
+ *      List the given processes, or all the processes that the calling
+ *      client has privilege to enumerate if no pid is given. Processes
+ *      that don't exist are not listed.
+ *
+ *      Listing all the processes scans /proc, and drops the processes
+ *      that exited from the process table. Listing given pids only looks
+ *      at those pids.
+ *
+ * Results:
+ *
+ *      A ProcMgrProcInfoArray. When listing all processes, NULL on error
+ *      or if no process was found.
+ *
+ * Side effects:
+ *
+ *      Updates the process table.
+ *
+ *----------------------------------------------------------------------
+ */
+
+ProcMgrProcInfoArray *
+ProcMgr_ListProcessesEx(const ProcMgr_Pid *pids,  // IN/OPT
+                        size_t numPids)           // IN
+{
+   static Atomic_Ptr lckStorage;
+   MXUserExclLock *lck = MXUser_CreateSingletonExclLock(&lckStorage,
+                                                        "procMgrProcTableLock",
+                                                        RANK_UNRANKED);
+   ProcMgrProcInfoArray *procList = NULL;
+   ProcMgrProcEntry *entry;
+   Bool failed = TRUE;
+   DIR *dir = NULL;
+   struct dirent *ent;
+   HashTable *newTable = NULL;
+   size_t i;
+
+   procList = Util_SafeCalloc(1, sizeof *procList);
+   ProcMgrProcInfoArray_Init(procList, 0);
+
+   MXUser_AcquireExclLock(lck);
+
+   ProcMgrInitStartTime();
+   if (NULL == procTable) {
+      procTable = HashTable_Alloc(PROCMGR_PROC_TABLE_SIZE, HASH_INT_KEY,
+                                  ProcMgrFreeProcEntry);
+   }
+   procTableGen++;
+
+   if (numPids > 0) {
+      for (i = 0; i < numPids; i++) {
+         char pidStr[32];
+
+         Str_Sprintf(pidStr, sizeof pidStr, "%d", (int) pids[i]);
+         entry = ProcMgrUpdateProcEntry(procTable, pidStr, pids[i]);
+         if (NULL != entry && !ProcMgrAppendProcEntry(procList, entry)) {
+            Warning("%s: failed to expand DynArray - out of memory\n",
+                    __FUNCTION__);
+            goto abort;
+         }
+      }
+      ProcMgrPruneProcTable();
+      failed = FALSE;
+      goto abort;
+   }
+
+   /*
+    * Scan /proc for any directory that is all numbers.
+    * That represents a process id.
+    */
+   dir = opendir("/proc");
+   if (NULL == dir) {
+      Warning("ProcMgr_ListProcesses unable to open /proc\n");
+      goto abort;
+   }
+
+   /*
+    * Entries of the processes still running are moved to a new table;
+    * what is left in the old one has exited.
+    */
+   newTable = HashTable_Alloc(PROCMGR_PROC_TABLE_SIZE, HASH_INT_KEY,
+                              ProcMgrFreeProcEntry);
+
+   while ((ent = readdir(dir))) {
+      pid_t pid;
 
       /*
-       * Store the process info pointer into a list buffer.
+       * We only care about dirs that look like processes.
        */
-      if (!ProcMgrProcInfoArray_Push(procList, procInfo)) {
+      if (strspn(ent->d_name, "0123456789") != strlen(ent->d_name)) {
+         continue;
+      }
+
+      pid = (pid_t) atoi(ent->d_name);
+      if (HashTable_LookupAndDelete(procTable, (const void *) (uintptr_t) pid,
+                                    (void **) &entry)) {
+         HashTable_Insert(newTable, (const void *) (uintptr_t) pid, entry);
+      }
+
+      entry = ProcMgrUpdateProcEntry(newTable, ent->d_name, pid);
+      if (NULL != entry && !ProcMgrAppendProcEntry(procList, entry)) {
          Warning("%s: failed to expand DynArray - out of memory\n",
                  __FUNCTION__);
          goto abort;
       }
-      procInfo.procCmdName = NULL;
-      procInfo.procCmdLine = NULL;
-      procInfo.procOwner = NULL;
-
-next_entry:
-      free(cmdLineTemp);
-      free(cmdStatTemp);
    } // while readdir
 
    if (0 < ProcMgrProcInfoArray_Count(procList)) {
@@ -580,11 +951,16 @@ next_entry:
    }
 
 abort:
-   closedir(dir);
+   if (NULL != newTable) {
+      HashTable_Free(procTable);
+      procTable = newTable;
+      procTablePruned = HashTable_GetNumElements(procTable);
+   }
+   MXUser_ReleaseExclLock(lck);
 
-   free(procInfo.procCmdName);
-   free(procInfo.procCmdLine);
-   free(procInfo.procOwner);
+   if (NULL != dir) {
+      closedir(dir);
+   }
 
    if (failed) {
       ProcMgr_FreeProcList(procList);
@@ -593,6 +969,7 @@ abort:
 
    return procList;
 }
+
 #endif // defined(__linux__)
 
 
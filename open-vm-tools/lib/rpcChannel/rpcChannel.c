@@ -24,6 +24,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 #include "debug.h"
 #include "rpcChannelInt.h"
 
@@ -75,6 +78,47 @@ static gboolean gUseBackdoorOnly = FALSE;
  */
 static gboolean gVSocketFailed = FALSE;
 
+/*
+ * Worker threads running RpcChannel_SendAsync requests. Channels that can
+ * carry several RPCIs at once run that many sends in parallel. The count of
+ * requests in flight of a channel is updated under gAsyncPoolLock, and
+ * gAsyncDone is signalled when it drops to zero.
+ */
+#define RPCCHANNEL_ASYNC_THREADS 4
+
+static GThreadPool *gAsyncPool = NULL;
+static GCond *gAsyncDone = NULL;
+static GStaticMutex gAsyncPoolLock = G_STATIC_MUTEX_INIT;
+
+/** An RpcChannel_SendAsync request. */
+typedef struct RpcChannelAsyncOp {
+   RpcChannel          *chan;
+   char                *data;
+   size_t               dataLen;
+   RpcChannelSendCb     callback;
+   gpointer             clientData;
+   gboolean             status;
+   char                *result;
+   size_t               resultLen;
+} RpcChannelAsyncOp;
+
+/*
+ * Channel shared by the RpcChannel_SendOne* calls of a process, so that
+ * callers sending many one-shot RPCIs don't connect for each of them. A
+ * reaper thread closes it once it has been idle for
+ * RPCCHANNEL_SHARED_IDLE_USEC, and it is closed at exit. If the reaper
+ * cannot be started, the channel is closed as soon as it is unused.
+ */
+#define RPCCHANNEL_SHARED_IDLE_USEC (30 * G_USEC_PER_SEC)
+
+static RpcChannel *gSharedChan = NULL;
+static guint gSharedChanUsers = 0;
+static gint64 gSharedChanLastUse = 0;
+static gboolean gSharedChanReaping = FALSE;
+static gboolean gSharedChanHooked = FALSE;
+static GCond gSharedChanCond;
+static GStaticMutex gSharedChanLock = G_STATIC_MUTEX_INIT;
+
 static void RpcChannelStopNoLock(RpcChannel *chan);
 
 
@@ -766,6 +810,13 @@ void
 RpcChannel_Shutdown(RpcChannel *chan)
 {
    if (chan != NULL) {
+      /* Let the RpcChannel_SendAsync requests in flight finish. */
+      g_static_mutex_lock(&gAsyncPoolLock);
+      while (chan->asyncPending > 0) {
+         g_cond_wait(gAsyncDone, g_static_mutex_get_mutex(&gAsyncPoolLock));
+      }
+      g_static_mutex_unlock(&gAsyncPoolLock);
+
       g_static_mutex_free(&chan->outLock);
    }
 
@@ -925,6 +976,14 @@ RpcChannel_Free(void *ptr)
  * non-backdoor Channels. Backdoor channel already tries inside. A second try
  * may create a different type of channel.
  *
+ * Channels that can carry several RPCIs at once run the request on a
+ * connection of their own, so the outLock is only held to reserve and give
+ * back the connection and a slow RPC does not hold up the others. When no
+ * such connection is available, the request is sent on the main connection
+ * with the outLock held. A request that fails on its own connection is
+ * only sent again on the main connection if none of it was sent, since
+ * RPCIs are not necessarily idempotent.
+ *
  * @param[in]  chan        The RPC channel instance.
  * @param[in]  data        Data to send.
  * @param[in]  dataLen     Number of bytes to send.
@@ -964,6 +1023,33 @@ RpcChannel_Send(RpcChannel *chan,
       *resultLen = 0;
    }
 
+   if (funcs->getConn != NULL) {
+      gpointer conn = funcs->getConn(chan);
+
+      if (conn != NULL) {
+         const RpcChannelFuncs *connFuncs = funcs;
+         gboolean unsent = FALSE;
+
+         g_static_mutex_unlock(&chan->outLock);
+         ok = connFuncs->sendConn(conn, data, dataLen, &rpcStatus, &res, &resLen,
+                                  &unsent);
+         g_static_mutex_lock(&chan->outLock);
+
+         /* The channel may have switched from vsocket to backdoor meanwhile. */
+         connFuncs->putConn(chan->funcs == connFuncs ? chan : NULL, conn, ok);
+         if (ok || !unsent) {
+            /* The VMX may have run the request: don't send it again. */
+            goto done;
+         }
+
+         Debug(LGPFX "Pooled connection failed before sending, using the channel ...\n");
+         free(res);
+         res = NULL;
+         resLen = 0;
+         funcs = chan->funcs;
+      }
+   }
+
    ok = funcs->send(chan, data, dataLen, &rpcStatus, &res, &resLen);
 
    if (!ok && (funcs->getType(chan) != RPCCHANNEL_TYPE_BKDOOR) &&
@@ -1009,8 +1095,381 @@ exit:
 
 
 /**
- * Open/close RpcChannel each time for sending a Rpc message, this is a wrapper
- * for RpcChannel APIs.
+ * Completes an RpcChannel_SendAsync request: calls the client callback and
+ * releases the request.
+ *
+ * @param[in]  _op      The request.
+ *
+ * @return FALSE, to remove the idle source when run from the main context.
+ */
+
+static gboolean
+RpcChannelAsyncComplete(gpointer _op)
+{
+   RpcChannelAsyncOp *op = _op;
+
+   op->callback(op->status, op->result, op->resultLen, op->clientData);
+
+   RpcChannel_Free(op->result);
+   g_free(op->data);
+   g_free(op);
+
+   return FALSE;
+}
+
+
+/**
+ * Worker thread function for RpcChannel_SendAsync requests.
+ *
+ * @param[in]  _op      The request.
+ * @param[in]  unused   Unused.
+ */
+
+static void
+RpcChannelAsyncWorker(gpointer _op,
+                      gpointer unused)
+{
+   RpcChannelAsyncOp *op = _op;
+   GMainContext *mainCtx = NULL;
+
+   op->status = RpcChannel_Send(op->chan, op->data, op->dataLen,
+                                &op->result, &op->resultLen);
+
+#if defined(NEED_RPCIN)
+   if (op->chan->mainCtx != NULL) {
+      mainCtx = g_main_context_ref(op->chan->mainCtx);
+   }
+#endif
+
+   /* The channel may go away once the request is no longer pending. */
+   g_static_mutex_lock(&gAsyncPoolLock);
+   if (--op->chan->asyncPending == 0) {
+      g_cond_broadcast(gAsyncDone);
+   }
+   g_static_mutex_unlock(&gAsyncPoolLock);
+   op->chan = NULL;
+
+   if (mainCtx != NULL) {
+      GSource *src = g_idle_source_new();
+
+      g_source_set_callback(src, RpcChannelAsyncComplete, op, NULL);
+      g_source_attach(src, mainCtx);
+      g_source_unref(src);
+      g_main_context_unref(mainCtx);
+   } else {
+      RpcChannelAsyncComplete(op);
+   }
+}
+
+
+/**
+ * Sends an RPC without waiting for the reply. The request runs on a worker
+ * thread, with the same semantics as RpcChannel_Send, and the callback is
+ * called with the outcome: in the main context of the channel if it was set
+ * up with one, otherwise in the worker thread.
+ *
+ * Requests may complete in any order. The channel must not be used for new
+ * requests once RpcChannel_Shutdown is called; RpcChannel_Shutdown waits
+ * for the requests in flight.
+ *
+ * @param[in]  chan        The RPC channel instance.
+ * @param[in]  data        Data to send.
+ * @param[in]  dataLen     Number of bytes to send.
+ * @param[in]  callback    Completion callback.
+ * @param[in]  clientData  Data for the callback.
+ *
+ * @return TRUE if the request was queued. The callback is not called
+ *         otherwise.
+ */
+
+gboolean
+RpcChannel_SendAsync(RpcChannel *chan,
+                     char const *data,
+                     size_t dataLen,
+                     RpcChannelSendCb callback,
+                     gpointer clientData)
+{
+   RpcChannelAsyncOp *op;
+   GError *err = NULL;
+
+   ASSERT(chan && chan->funcs);
+   ASSERT(callback != NULL);
+
+   g_static_mutex_lock(&gAsyncPoolLock);
+   if (gAsyncPool == NULL) {
+      gAsyncPool = g_thread_pool_new(RpcChannelAsyncWorker, NULL,
+                                     RPCCHANNEL_ASYNC_THREADS, FALSE, &err);
+      if (gAsyncPool == NULL) {
+         Warning(LGPFX "Failed to create the async send pool: %s\n",
+                 err != NULL ? err->message : "unknown error");
+         g_clear_error(&err);
+         g_static_mutex_unlock(&gAsyncPoolLock);
+         return FALSE;
+      }
+      gAsyncDone = g_cond_new();
+   }
+   chan->asyncPending++;
+   g_static_mutex_unlock(&gAsyncPoolLock);
+
+   op = g_new0(RpcChannelAsyncOp, 1);
+   op->chan = chan;
+   op->data = g_memdup(data, dataLen);
+   op->dataLen = dataLen;
+   op->callback = callback;
+   op->clientData = clientData;
+
+   g_thread_pool_push(gAsyncPool, op, NULL);
+
+   return TRUE;
+}
+
+
+/**
+ * Stop and destroy a shared channel taken out of gSharedChan.
+ *
+ * @param[in]  chan        The channel, may be NULL.
+ */
+
+static void
+RpcChannelCloseShared(RpcChannel *chan)
+{
+   if (chan != NULL) {
+      Debug(LGPFX "Closing shared channel\n");
+      RpcChannel_Stop(chan);
+      RpcChannel_Destroy(chan);
+   }
+}
+
+
+/**
+ * Reaper thread of the shared channel: closes it once it has been unused
+ * for RPCCHANNEL_SHARED_IDLE_USEC, then exits. A new reaper is started
+ * with the next shared channel.
+ *
+ * @param[in]  data        Unused.
+ *
+ * @return NULL.
+ */
+
+static gpointer
+RpcChannelSharedReaper(gpointer data)
+{
+   GMutex *lock = g_static_mutex_get_mutex(&gSharedChanLock);
+   RpcChannel *idle = NULL;
+
+   g_mutex_lock(lock);
+   while (gSharedChan != NULL) {
+      gint64 wait = RPCCHANNEL_SHARED_IDLE_USEC;
+
+      if (gSharedChanUsers == 0) {
+         gint64 idleTime = g_get_monotonic_time() - gSharedChanLastUse;
+
+         if (idleTime >= RPCCHANNEL_SHARED_IDLE_USEC) {
+            idle = gSharedChan;
+            gSharedChan = NULL;
+            break;
+         }
+         wait -= idleTime;
+      }
+
+      g_cond_wait_until(&gSharedChanCond, lock,
+                        g_get_monotonic_time() + wait);
+   }
+   gSharedChanReaping = FALSE;
+   g_mutex_unlock(lock);
+
+   RpcChannelCloseShared(idle);
+   return NULL;
+}
+
+
+/**
+ * atexit handler: closes the shared channel unless an RPCI is still running
+ * on it, and lets the reaper exit.
+ */
+
+static void
+RpcChannelSharedAtExit(void)
+{
+   RpcChannel *chan = NULL;
+
+   g_static_mutex_lock(&gSharedChanLock);
+   if (gSharedChan != NULL && gSharedChanUsers == 0) {
+      chan = gSharedChan;
+      gSharedChan = NULL;
+      g_cond_signal(&gSharedChanCond);
+   }
+   g_static_mutex_unlock(&gSharedChanLock);
+
+   RpcChannelCloseShared(chan);
+}
+
+
+#if !defined(_WIN32)
+/**
+ * pthread_atfork handlers. The lock is held across fork() so the child
+ * gets it in a known state. Opening the shared channel does not hold the
+ * lock, so fork() does not wait for a connect.
+ */
+
+static void
+RpcChannelSharedPreFork(void)
+{
+   g_static_mutex_lock(&gSharedChanLock);
+}
+
+
+static void
+RpcChannelSharedPostForkParent(void)
+{
+   g_static_mutex_unlock(&gSharedChanLock);
+}
+
+
+/**
+ * The child does not have the reaper thread, and has its own copy of the
+ * parent's shared channel. The condition variable is initialised again
+ * rather than cleared, as the parent's reaper may have been waiting on it.
+ *
+ * The child's copies of the vsocket connections are closed, so that they
+ * don't stay open at the VMX after the parent closes its own. That only
+ * closes file descriptors, unlike stopping a backdoor channel, which would
+ * close the parent's channel at the VMX. A channel an RPCI was running on
+ * is left alone: the thread running it does not exist in the child and
+ * may have held its outLock.
+ */
+
+static void
+RpcChannelSharedPostForkChild(void)
+{
+   RpcChannel *chan = gSharedChan;
+   RpcChannelType type = RpcChannel_GetType(chan);
+
+   if (chan != NULL && gSharedChanUsers == 0 &&
+       (type == RPCCHANNEL_TYPE_PRIV_VSOCK ||
+        type == RPCCHANNEL_TYPE_UNPRIV_VSOCK)) {
+      RpcChannel_Stop(chan);
+      RpcChannel_Destroy(chan);
+   }
+
+   gSharedChan = NULL;
+   gSharedChanUsers = 0;
+   gSharedChanReaping = FALSE;
+   g_cond_init(&gSharedChanCond);
+   g_static_mutex_unlock(&gSharedChanLock);
+}
+#endif
+
+
+/**
+ * Borrow the channel shared by the RpcChannel_SendOne* calls, opening it if
+ * needed. Give it back with RpcChannelPutShared.
+ *
+ * The channel is opened without gSharedChanLock held, since connecting may
+ * scan the privileged ports, and published under the lock. If another
+ * caller published one meanwhile, that one is used and the new one closed.
+ *
+ * @return The started channel, or NULL if it could not be opened.
+ */
+
+static RpcChannel *
+RpcChannelGetShared(void)
+{
+   RpcChannel *chan;
+   RpcChannel *unused = NULL;
+
+   g_static_mutex_lock(&gSharedChanLock);
+
+   if (!gSharedChanHooked) {
+      gSharedChanHooked = TRUE;
+      atexit(RpcChannelSharedAtExit);
+#if !defined(_WIN32)
+      pthread_atfork(RpcChannelSharedPreFork, RpcChannelSharedPostForkParent,
+                     RpcChannelSharedPostForkChild);
+#endif
+   }
+
+   chan = gSharedChan;
+   if (chan != NULL) {
+      gSharedChanUsers++;
+   }
+
+   g_static_mutex_unlock(&gSharedChanLock);
+
+   if (chan != NULL) {
+      return chan;
+   }
+
+   chan = RpcChannel_New();
+   if (chan != NULL && !RpcChannel_Start(chan)) {
+      RpcChannel_Destroy(chan);
+      chan = NULL;
+   }
+
+   g_static_mutex_lock(&gSharedChanLock);
+
+   if (gSharedChan == NULL) {
+      gSharedChan = chan;
+
+      /* The previous reaper, if any, has left its loop. */
+      if (chan != NULL && !gSharedChanReaping && g_thread_supported()) {
+         gSharedChanReaping =
+            g_thread_create(RpcChannelSharedReaper, NULL, FALSE, NULL) != NULL;
+      }
+   } else {
+      unused = chan;
+      chan = gSharedChan;
+   }
+
+   if (chan != NULL) {
+      gSharedChanUsers++;
+   }
+
+   g_static_mutex_unlock(&gSharedChanLock);
+
+   RpcChannelCloseShared(unused);
+
+   return chan;
+}
+
+
+/**
+ * Give back the channel borrowed with RpcChannelGetShared. Without a reaper
+ * the channel is closed once nobody uses it.
+ *
+ * @param[in]  chan        The shared channel.
+ */
+
+static void
+RpcChannelPutShared(RpcChannel *chan)
+{
+   RpcChannel *unused = NULL;
+
+   g_static_mutex_lock(&gSharedChanLock);
+   if (chan == gSharedChan) {
+      ASSERT(gSharedChanUsers > 0);
+      gSharedChanUsers--;
+      gSharedChanLastUse = g_get_monotonic_time();
+      if (gSharedChanUsers == 0) {
+         if (gSharedChanReaping) {
+            g_cond_signal(&gSharedChanCond);
+         } else {
+            unused = gSharedChan;
+            gSharedChan = NULL;
+         }
+      }
+   }
+   g_static_mutex_unlock(&gSharedChanLock);
+
+   RpcChannelCloseShared(unused);
+}
+
+
+/**
+ * Send a Rpc message on the channel shared by the RpcChannel_SendOne* calls
+ * of the process, this is a wrapper for RpcChannel APIs. The channel stays
+ * open between calls, and RpcChannel_Send reconnects it if the VMX dropped
+ * the connection meanwhile.
  *
  * @param[in]  data        request data
  * @param[in]  dataLen     data length
@@ -1031,17 +1490,8 @@ RpcChannel_SendOneRaw(const char *data,
 
    status = FALSE;
 
-   chan = RpcChannel_New();
+   chan = RpcChannelGetShared();
    if (chan == NULL) {
-      if (result != NULL) {
-         *result = Util_SafeStrdup("RpcChannel: Unable to create "
-                                   "the RpcChannel object");
-         if (resultLen != NULL) {
-            *resultLen = strlen(*result);
-         }
-      }
-      goto sent;
-   } else if (!RpcChannel_Start(chan)) {
       if (result != NULL) {
          *result = Util_SafeStrdup("RpcChannel: Unable to open the "
                                    "communication channel");
@@ -1061,8 +1511,7 @@ sent:
    Debug(LGPFX "Request %s: reqlen=%"FMTSZ"u, replyLen=%"FMTSZ"u\n",
          status ? "OK" : "FAILED", dataLen, resultLen ? *resultLen : 0);
    if (chan) {
-      RpcChannel_Stop(chan);
-      RpcChannel_Destroy(chan);
+      RpcChannelPutShared(chan);
    }
 
    return status;
@@ -1070,8 +1519,8 @@ sent:
 
 
 /**
- * Open/close RpcChannel each time for sending a Rpc message, this is a wrapper
- * for RpcChannel APIs.
+ * Send a Rpc message on the channel shared by the RpcChannel_SendOne* calls,
+ * this is a wrapper for RpcChannel APIs.
  *
  * @param[out] reply       reply, should be freed by calling RpcChannel_Free.
  * @param[out] repLen      reply length
@@ -53,6 +53,20 @@ typedef struct _RpcChannelFuncs{
    RpcChannelType (*getType)(RpcChannel *chan);
    void (*onStartErr)(RpcChannel *);
    gboolean (*stopRpcOut)(RpcChannel *);
+   /*
+    * Optional, for channels that can carry several RPCIs at once. getConn
+    * reserves a connection for the caller (NULL if none is available),
+    * sendConn connects it if needed and runs one RPCI on it without
+    * holding the outLock, and putConn gives it back, or just closes it when
+    * chan is NULL. getConn and putConn are called with the outLock held.
+    * On failure, sendConn sets unsent if the other side cannot have seen
+    * any of the request.
+    */
+   gpointer (*getConn)(RpcChannel *);
+   gboolean (*sendConn)(gpointer conn, char const *data, size_t dataLen,
+                        Bool *rpcStatus, char **result, size_t *resultLen,
+                        gboolean *unsent);
+   void (*putConn)(RpcChannel *chan, gpointer conn, gboolean reuse);
 } RpcChannelFuncs;
 
 /**
@@ -75,6 +89,7 @@ struct _RpcChannel {
    gboolean                  inStarted;
 #endif
    gboolean                  outStarted;
+   guint                     asyncPending;  /* RpcChannel_SendAsync in flight */
 };
 
 RpcChannel *VSockChannel_New(void);
@@ -27,6 +27,9 @@
 #if defined(__linux__)
 #include <arpa/inet.h>
 #endif
+#if !defined(_WIN32)
+#include <sys/poll.h>
+#endif
 
 #include "simpleSocket.h"
 #include "vmci_defs.h"
@@ -37,6 +40,12 @@
 
 #define LGPFX "SimpleSock: "
 
+/*
+ * Next privileged port to try. Sockets of this process hold the ports
+ * above it, so starting here avoids rescanning them on every connect.
+ */
+static gint gPrivPortNext = PRIVILEGED_PORT_MAX;
+
 
 static int
 SocketGetLastError(void);
@@ -124,6 +133,77 @@ Socket_Close(SOCKET sock)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Socket_IsIdleConnected --
+ *
+ *      Check, without blocking, that an idle request/reply connection is
+ *      still usable. The peer sends nothing unless asked to, so an idle
+ *      connection that is readable has been closed or reset by the peer,
+ *      or is out of sync.
+ *
+ * Results:
+ *      TRUE if the connection can carry a request, FALSE if it cannot or
+ *      sock is not a valid socket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+gboolean
+Socket_IsIdleConnected(SOCKET sock)    // IN
+{
+   int res;
+
+#if defined(_WIN32)
+   fd_set rfds;
+   fd_set efds;
+   struct timeval tv = { 0, 0 };
+
+   if (sock == INVALID_SOCKET) {
+      return FALSE;
+   }
+
+   FD_ZERO(&rfds);
+   FD_ZERO(&efds);
+   FD_SET(sock, &rfds);
+   FD_SET(sock, &efds);
+   res = select(0, &rfds, NULL, &efds, &tv);
+#else
+   struct pollfd pfd;
+
+   /* poll() ignores a negative fd, which would look idle and connected. */
+   if (sock < 0) {
+      return FALSE;
+   }
+
+   pfd.fd = sock;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   do {
+      res = poll(&pfd, 1, 0);
+   } while (res == SOCKET_ERROR && SocketGetLastError() == SYSERR_EINTR);
+#endif
+
+   if (res == SOCKET_ERROR) {
+      int err = SocketGetLastError();
+      Debug(LGPFX "Error in polling socket %d: %d[%s]\n",
+            sock, err, Err_Errno2String(err));
+      return FALSE;
+   }
+
+   if (res > 0) {
+      Debug(LGPFX "Idle socket %d is readable, dropping it\n", sock);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -208,7 +288,8 @@ Socket_Recv(SOCKET fd,      // IN
  *      Block until the given number of bytes of data is sent or error occurs.
  *
  * Results:
- *      TRUE on success, FALSE on failure.
+ *      TRUE on success, FALSE on failure. The number of bytes sent, also
+ *      on failure, is returned in sentLen if it is not NULL.
  *
  * Side effects:
  *      None.
@@ -219,7 +300,8 @@ Socket_Recv(SOCKET fd,      // IN
 gboolean
 Socket_Send(SOCKET fd,      // IN
             char *buf,      // IN
-            int len)        // IN
+            int len,        // IN
+            int *sentLen)   // OUT optional
 {
    int left = len;
    int sent = 0;
@@ -235,12 +317,19 @@ Socket_Send(SOCKET fd,      // IN
          }
          Warning(LGPFX "Send error for socket %d: %d[%s]", fd, sysErr,
                  Err_Errno2String(sysErr));
+         if (sentLen != NULL) {
+            *sentLen = sent;
+         }
          return FALSE;
       }
       left -= rv;
       sent += rv;
    }
 
+   if (sentLen != NULL) {
+      *sentLen = sent;
+   }
+
    Debug(LGPFX "Sent %d bytes from socket %d\n", len, fd);
    return TRUE;
 }
@@ -342,6 +431,7 @@ Socket_ConnectVMCI(unsigned int cid,                  // IN
 {
    struct sockaddr_vm addr;
    unsigned int localPort;
+   unsigned int numTried;
    SOCKET fd;
    int sysErr = 0;
    ApiError apiErr;
@@ -374,15 +464,28 @@ Socket_ConnectVMCI(unsigned int cid,                  // IN
       goto done;
    }
 
-   /* We are required to use a privileged source port. */
-   localPort = PRIVILEGED_PORT_MAX;
-   while (localPort >= PRIVILEGED_PORT_MIN) {
+   /*
+    * We are required to use a privileged source port. Scan downward from
+    * where the previous connect of this process left off, wrapping around
+    * once through the whole privileged range.
+    */
+   localPort = g_atomic_int_get(&gPrivPortNext);
+   if (localPort < PRIVILEGED_PORT_MIN || localPort > PRIVILEGED_PORT_MAX) {
+      localPort = PRIVILEGED_PORT_MAX;
+   }
+   numTried = 0;
+   while (numTried < PRIVILEGED_PORT_MAX - PRIVILEGED_PORT_MIN + 1) {
       fd = SocketConnectVmciInternal(&addr, localPort, &apiErr, &sysErr);
       if (fd != INVALID_SOCKET) {
+         g_atomic_int_set(&gPrivPortNext,
+                          localPort > PRIVILEGED_PORT_MIN ?
+                          localPort - 1 : PRIVILEGED_PORT_MAX);
          goto done;
       }
       if (apiErr == SOCKERR_BIND && sysErr == SYSERR_EADDRINUSE) {
-         --localPort;
+         localPort = localPort > PRIVILEGED_PORT_MIN ?
+                     localPort - 1 : PRIVILEGED_PORT_MAX;
+         numTried++;
          continue; /* Try next port */
       }
       if (apiErr == SOCKERR_CONNECT && sysErr == SYSERR_ECONNRESET) {
@@ -391,7 +494,9 @@ Socket_ConnectVMCI(unsigned int cid,                  // IN
           * when another client closed the client side end.
           * Simply try next port.
           */
-         --localPort;
+         localPort = localPort > PRIVILEGED_PORT_MIN ?
+                     localPort - 1 : PRIVILEGED_PORT_MAX;
+         numTried++;
          continue;
       }
       if (apiErr == SOCKERR_CONNECT && sysErr == SYSERR_EINTR) {
@@ -632,7 +737,8 @@ Socket_RecvPacket(SOCKET sock,               // IN
  *    Helper function to send a dataMap packet over the socket.
  *
  * Result:
- *    TRUE on sucess, FALSE otherwise.
+ *    TRUE on sucess, FALSE otherwise. On failure nothingSent, if not NULL,
+ *    tells whether the peer cannot have seen any of the packet.
  *
  * Side-effects:
  *    None
@@ -643,18 +749,28 @@ Socket_RecvPacket(SOCKET sock,               // IN
 gboolean
 Socket_SendPacket(SOCKET sock,               // IN
                   const char *payload,       // IN
-                  int payloadLen)            // IN
+                  int payloadLen,            // IN
+                  gboolean *nothingSent)     // OUT optional
 {
    gboolean ok;
    char *sendBuf;
    int sendBufLen;
+   int sentLen = 0;
+
+   if (nothingSent != NULL) {
+      *nothingSent = TRUE;
+   }
 
    if (!Socket_PackSendData(payload, payloadLen, &sendBuf, &sendBufLen)) {
       return FALSE;
    }
 
-   ok = Socket_Send(sock, sendBuf, sendBufLen);
+   ok = Socket_Send(sock, sendBuf, sendBufLen, &sentLen);
    free(sendBuf);
 
+   if (nothingSent != NULL) {
+      *nothingSent = sentLen == 0;
+   }
+
    return ok;
 }
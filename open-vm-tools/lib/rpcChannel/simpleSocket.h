@@ -73,6 +73,7 @@ typedef int SOCKET;
 #define PRIVILEGED_PORT_MIN    1
 
 void Socket_Close(SOCKET sock);
+gboolean Socket_IsIdleConnected(SOCKET sock);
 SOCKET Socket_ConnectVMCI(unsigned int cid,
                           unsigned int port,
                           gboolean isPriv,
@@ -83,12 +84,14 @@ gboolean Socket_Recv(SOCKET fd,
                      int len);
 gboolean Socket_Send(SOCKET fd,
                      char *buf,
-                     int len);
+                     int len,
+                     int *sentLen);
 gboolean Socket_RecvPacket(SOCKET sock,
                            char **payload,
                            int *payloadLen);
 gboolean Socket_SendPacket(SOCKET sock,
                            const char *payload,
-                           int payloadLen);
+                           int payloadLen,
+                           gboolean *nothingSent);
 
 #endif /* _SIMPLESOCKET_H_ */
@@ -33,15 +33,28 @@
 
 #define LGPFX "VSockChan: "
 
+/*
+ * Each connection carries one RPCI at a time. Besides the main connection,
+ * used under the channel outLock, a channel keeps up to this many extra
+ * connections so that concurrent senders don't wait for each other.
+ */
+#define VSOCK_CHANNEL_MAX_CONNS  4
+
 typedef struct VSockOut {
    SOCKET fd;
    char *payload;
    int payloadLen;
    RpcChannelType type;
+   guint generation;    /* VSockChannel generation of a pooled connection */
+   gboolean unsent;     /* The last RPCI failed before any of it was sent */
 } VSockOut;
 
 typedef struct VSockChannel {
    VSockOut          *out;
+   VSockOut          *idle[VSOCK_CHANNEL_MAX_CONNS];
+   int               numIdle;
+   int               numConns;    /* Pooled connections, idle or in use */
+   guint             generation;  /* Bumped when the pool is drained */
 } VSockChannel;
 
 static void VSockChannelShutdown(RpcChannel *chan);
@@ -233,7 +246,8 @@ VSockOutStop(VSockOut *out)    // IN
  *    rpcStatus tells if the RPC command was processed successfully.
  *
  *    FALSE if RPC could not be sent successfully. 'reply' will contain a
- *    description of the error.
+ *    description of the error, and out->unsent tells whether the VMX
+ *    cannot have seen any of the request.
  *
  *    In both cases, the caller should not free the reply.
  *
@@ -256,11 +270,12 @@ VSockOutSend(VSockOut *out,        // IN
 
    *reply = NULL;
    *repLen = 0;
+   out->unsent = FALSE;
 
    Debug(LGPFX "Sending request for conn %d,  reqLen=%d\n",
          out->fd, (int)reqLen);
 
-   if (!Socket_SendPacket(out->fd, request, reqLen)) {
+   if (!Socket_SendPacket(out->fd, request, reqLen, &out->unsent)) {
       *reply = "VSockOut: Unable to send data for the RPCI command";
       goto error;
    }
@@ -295,6 +310,92 @@ error:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VSockOutSendCopy --
+ *
+ *      Run one RPCI on a connection and return a copy of the reply.
+ *      If the caller is not interested in the reply, result and resultLen
+ *      can be set to NULL, otherwise, the caller *must* free the result
+ *      whether the call is successful or not to avoid memory leak.
+ *
+ * Result:
+ *      Same as VSockOutSend.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+VSockOutSendCopy(VSockOut *out,         // IN
+                 char const *data,      // IN
+                 size_t dataLen,        // IN
+                 Bool *rpcStatus,       // OUT
+                 char **result,         // OUT optional
+                 size_t *resultLen)     // OUT optional
+{
+   gboolean ret;
+   const char *reply = NULL;
+   size_t replyLen = 0;
+
+   /*
+    * We propagate all replies from VSockOutSend: either a reply of the RPC
+    * result or a description of the error on failure.
+    */
+   ret = VSockOutSend(out, data, dataLen, rpcStatus, &reply, &replyLen);
+
+   if (result != NULL) {
+      if (reply != NULL) {
+         *result = Util_SafeMalloc(replyLen + 1);
+         memcpy(*result, reply, replyLen);
+         (*result)[replyLen] = '\0';
+      } else {
+         *result = NULL;
+      }
+   }
+
+   if (resultLen != NULL) {
+      *resultLen = replyLen;
+   }
+
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VSockChannelDrainPool --
+ *
+ *      Close the idle pooled connections. Connections in use are closed when
+ *      they are given back, since their generation no longer matches.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VSockChannelDrainPool(VSockChannel *vsock)    // IN
+{
+   while (vsock->numIdle > 0) {
+      VSockOut *out = vsock->idle[--vsock->numIdle];
+
+      VSockOutStop(out);
+      VSockOutDestruct(out);
+   }
+   vsock->numConns = 0;
+   vsock->generation++;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -317,6 +418,7 @@ VSockChannelOnStartErr(RpcChannel *chan)    // IN
    VSockChannel *vsock = chan->_private;
 
    /* destroy VSockOut part only */
+   VSockChannelDrainPool(vsock);
    VSockOutDestruct(vsock->out);
    chan->_private = NULL;
 }
@@ -379,6 +481,8 @@ VSockChannelStop(RpcChannel *chan)   // IN
 {
    VSockChannel *vsock = chan->_private;
 
+   VSockChannelDrainPool(vsock);
+
    if (vsock->out != NULL) {
       if (chan->outStarted) {
          VSockOutStop(vsock->out);
@@ -451,32 +555,26 @@ VSockChannelSend(RpcChannel *chan,      // IN
 {
    gboolean ret = FALSE;
    VSockChannel *vsock = chan->_private;
-   const char *reply = NULL;
-   size_t replyLen = 0;
 
    if (!chan->outStarted) {
       goto exit;
    }
 
    /*
-    * We propagate all replies from VSockOutSend: either a reply of the RPC
-    * result or a description of the error on failure.
+    * The channel may have sat idle long enough for the VMX to drop the
+    * connection. Reconnect up front rather than fail the RPCI and have
+    * the caller send it twice.
     */
-   ret = VSockOutSend(vsock->out, data, dataLen, rpcStatus, &reply, &replyLen);
-
-   if (result != NULL) {
-      if (reply != NULL) {
-         *result = Util_SafeMalloc(replyLen + 1);
-         memcpy(*result, reply, replyLen);
-         (*result)[replyLen] = '\0';
-      } else {
-         *result = NULL;
+   if (!Socket_IsIdleConnected(vsock->out->fd)) {
+      Debug(LGPFX "Reconnecting conn %d\n", vsock->out->fd);
+      VSockOutStop(vsock->out);
+      if (!VSockOutStart(vsock->out)) {
+         goto exit;
       }
    }
 
-   if (resultLen != NULL) {
-      *resultLen = replyLen;
-   }
+   ret = VSockOutSendCopy(vsock->out, data, dataLen, rpcStatus, result,
+                          resultLen);
 
 exit:
    return ret;
@@ -532,6 +630,7 @@ static gboolean
 VSockChannelStopRpcOut(RpcChannel *chan)
 {
    VSockChannel *vsock = chan->_private;
+   VSockChannelDrainPool(vsock);
    VSockOutStop(vsock->out);
    chan->outStarted = FALSE;
 
@@ -539,6 +638,149 @@ VSockChannelStopRpcOut(RpcChannel *chan)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VSockChannelGetConn --
+ *
+ *      Reserve a pooled connection for one RPCI. If no idle connection is
+ *      left and the pool has room, a slot is reserved for a new connection,
+ *      which VSockChannelSendConn opens without the outLock held. Idle
+ *      connections the VMX has closed are dropped. Called with the channel
+ *      outLock held.
+ *
+ * Result:
+ *      The connection, or NULL if the channel is stopped or all pooled
+ *      connections are in use.
+ *
+ * Side-effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+VSockChannelGetConn(RpcChannel *chan)
+{
+   VSockChannel *vsock = chan->_private;
+   VSockOut *out;
+
+   if (!chan->outStarted) {
+      return NULL;
+   }
+
+   while (vsock->numIdle > 0) {
+      out = vsock->idle[--vsock->numIdle];
+      if (Socket_IsIdleConnected(out->fd)) {
+         return out;
+      }
+      vsock->numConns--;
+      VSockOutStop(out);
+      VSockOutDestruct(out);
+   }
+
+   if (vsock->numConns >= VSOCK_CHANNEL_MAX_CONNS) {
+      return NULL;
+   }
+
+   out = VSockOutConstruct();
+   if (out == NULL) {
+      return NULL;
+   }
+
+   out->generation = vsock->generation;
+   vsock->numConns++;
+
+   return out;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VSockChannelSendConn --
+ *
+ *      Run one RPCI on a pooled connection, opening it first if it is new.
+ *      Called without the channel outLock held.
+ *
+ * Result:
+ *      Same as VSockChannelSend. On failure, unsent tells whether the VMX
+ *      cannot have seen any of the request.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+VSockChannelSendConn(gpointer conn,         // IN
+                     char const *data,      // IN
+                     size_t dataLen,        // IN
+                     Bool *rpcStatus,       // OUT
+                     char **result,         // OUT optional
+                     size_t *resultLen,     // OUT optional
+                     gboolean *unsent)      // OUT
+{
+   VSockOut *out = conn;
+   gboolean ret;
+
+   if (out->fd == INVALID_SOCKET) {
+      if (!VSockOutStart(out)) {
+         *unsent = TRUE;
+         return FALSE;
+      }
+      Debug(LGPFX "Opened pooled conn %d\n", out->fd);
+   }
+
+   ret = VSockOutSendCopy(out, data, dataLen, rpcStatus, result, resultLen);
+   *unsent = !ret && out->unsent;
+
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VSockChannelPutConn --
+ *
+ *      Give back a pooled connection. It is kept for reuse only if the last
+ *      RPCI on it succeeded and the pool was not drained in the meantime.
+ *      Called with the channel outLock held; chan is NULL if the channel no
+ *      longer uses vsocket.
+ *
+ * Result:
+ *      None.
+ *
+ * Side-effects:
+ *      May close the connection.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VSockChannelPutConn(RpcChannel *chan,    // IN
+                    gpointer conn,       // IN
+                    gboolean reuse)      // IN
+{
+   VSockOut *out = conn;
+   VSockChannel *vsock = chan != NULL ? chan->_private : NULL;
+
+   if (vsock != NULL && out->generation == vsock->generation) {
+      if (reuse && chan->outStarted) {
+         ASSERT(vsock->numIdle < VSOCK_CHANNEL_MAX_CONNS);
+         vsock->idle[vsock->numIdle++] = out;
+         return;
+      }
+      vsock->numConns--;
+   }
+
+   VSockOutStop(out);
+   VSockOutDestruct(out);
+}
+
+
 
 
 /*
@@ -572,7 +814,10 @@ VSockChannel_New(void)
       VSockChannelShutdown,
       VSockChannelGetType,
       VSockChannelOnStartErr,
-      VSockChannelStopRpcOut
+      VSockChannelStopRpcOut,
+      VSockChannelGetConn,
+      VSockChannelSendConn,
+      VSockChannelPutConn
    };
 
    chan = RpcChannel_Create();
@@ -131,6 +131,28 @@ static void RpcInConnRecvHeader(ConnInfo *conn);
 static Bool RpcInConnRecvPacket(ConnInfo *conn, const char **errmsg);
 #endif  /* VMTOOLS_USE_VSOCKET */
 
+/*
+ * Backdoor polling. After a command the loop keeps polling at the minimum
+ * delay for RPCIN_BURST_POLLS empty polls, since host commands tend to come
+ * in bursts, and then backs off exponentially up to the maximum delay. Once
+ * no command has arrived for RPCIN_PARK_IDLE_MS the back off may continue
+ * up to RPCIN_PARK_FACTOR times the maximum delay.
+ */
+#define RPCIN_BURST_POLLS                     10
+#define RPCIN_PARK_IDLE_MS                    (60 * 1000)      /* 1 minute */
+#define RPCIN_PARK_FACTOR                     2
+
+/* Interval of the wakeup and dispatch statistics log. */
+#define RPCIN_STATS_INTERVAL_MS               (60 * 1000)      /* 1 minute */
+
+typedef struct RpcInStats {
+   uint64 windowStart;   /* Start of the current interval, in ms. */
+   uint32 wakeups;       /* Backdoor polls and vsock receives. */
+   uint32 commands;      /* Commands dispatched. */
+   uint64 dispatchUS;    /* Total dispatch time of the commands. */
+   uint64 maxDispatchUS; /* Longest dispatch time of the commands. */
+} RpcInStats;
+
 
 struct RpcIn {
 #if defined(VMTOOLS_USE_GLIB)
@@ -151,6 +173,9 @@ struct RpcIn {
    Message_Channel *channel;
    unsigned int delay;   /* The delay of the previous iteration of RpcInLoop */
    unsigned int maxDelay;  /* The maximum delay to schedule in RpcInLoop */
+   unsigned int burstPolls; /* Polls left at the minimum delay */
+   uint64 lastCommand;   /* Time of the last command received, in ms */
+   RpcInStats stats;
    RpcIn_ErrorFunc *errorFunc;
    void *errorData;
 
@@ -195,6 +220,7 @@ static Bool RpcInExecRpc(RpcIn *in,            // IN
                          size_t repLen,        // IN
                          const char **errmsg); // OUT
 static Bool RpcInOpenChannel(RpcIn *in, Bool useBackdoorOnly);
+static void RpcInRecordWakeup(RpcIn *in);
 
 /*
  * The following functions are only needed in the non-glib version of the
@@ -943,6 +969,8 @@ RpcInConnRecvedCb(void *buf,            // IN
       Debug("RpcIn: Got msg from conn %d: [%s]\n",
             AsyncSocket_GetFd(conn->asock), payload);
 
+      RpcInRecordWakeup(conn->in);
+
       if (RpcInExecRpc(conn->in, payload, payloadLen, &errmsg)) {
          conn->in->mustSend = TRUE;
          if (RpcInSend(conn->in, 0)) {
@@ -1286,6 +1314,74 @@ RpcIn_stop(RpcIn *in) // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcInGetTimeUS --
+ *
+ *      Monotonic time in microseconds. Without glib the resolution is that of
+ *      System_GetTimeMonotonic (10 ms).
+ *
+ * Result:
+ *      The time.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint64
+RpcInGetTimeUS(void)
+{
+#if defined(VMTOOLS_USE_GLIB)
+   return g_get_monotonic_time();
+#else
+   return System_GetTimeMonotonic() * 10000;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcInRecordWakeup --
+ *
+ *      Account for one wakeup of the receive path and log the statistics
+ *      once per RPCIN_STATS_INTERVAL_MS.
+ *
+ * Result:
+ *      None
+ *
+ * Side-effects:
+ *      Resets the statistics at the end of an interval.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcInRecordWakeup(RpcIn *in)            // IN
+{
+   RpcInStats *stats = &in->stats;
+   uint64 now = RpcInGetTimeUS() / 1000;
+
+   stats->wakeups++;
+
+   if (stats->windowStart == 0) {
+      stats->windowStart = now;
+   } else if (now - stats->windowStart >= RPCIN_STATS_INTERVAL_MS) {
+      Debug("RpcIn: %u wakeups and %u commands in the last %u s, dispatch "
+            "avg %"FMT64"u us max %"FMT64"u us, poll delay %u\n",
+            stats->wakeups, stats->commands,
+            (unsigned int)((now - stats->windowStart) / 1000),
+            stats->commands != 0 ? stats->dispatchUS / stats->commands : 0,
+            stats->maxDispatchUS, in->delay);
+      memset(stats, 0, sizeof *stats);
+      stats->windowStart = now;
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1314,6 +1410,8 @@ RpcInExecRpc(RpcIn *in,            // IN
    char *result;
    size_t resultLen;
    Bool freeResult = FALSE;
+   uint64 start = RpcInGetTimeUS();
+   uint64 elapsed;
 
    /*
     * Execute the RPC
@@ -1355,6 +1453,11 @@ RpcInExecRpc(RpcIn *in,            // IN
    }
 #endif
 
+   elapsed = RpcInGetTimeUS() - start;
+   in->stats.commands++;
+   in->stats.dispatchUS += elapsed;
+   in->stats.maxDispatchUS = MAX(in->stats.maxDispatchUS, elapsed);
+
    statusStr = status ? "OK " : "ERROR ";
    statusLen = strlen(statusStr);
 
@@ -1376,6 +1479,8 @@ RpcInExecRpc(RpcIn *in,            // IN
     * perfoms a time-consuming job) and continue to loop immediately
     */
    in->delay = 0;
+   in->burstPolls = RPCIN_BURST_POLLS;
+   in->lastCommand = (start + elapsed) / 1000;
 
    return TRUE;
 }
@@ -1386,9 +1491,11 @@ RpcInExecRpc(RpcIn *in,            // IN
  *
  * RpcInUpdateDelayTime --
  *
- *      Calculate new delay time.
- *      Use an exponential back-off, doubling the time to wait each time up to
- *      the max delay.
+ *      Calculate new delay time after an empty poll.
+ *      Stay at the minimum delay for the burst polls following a command,
+ *      then use an exponential back-off, doubling the time to wait each time
+ *      up to the max delay, or up to RPCIN_PARK_FACTOR times the max delay
+ *      once the channel has been idle for RPCIN_PARK_IDLE_MS.
  *
  * Result:
  *      None
@@ -1402,16 +1509,29 @@ RpcInExecRpc(RpcIn *in,            // IN
 static void
 RpcInUpdateDelayTime(RpcIn *in)            // IN
 {
-   if (in->delay < in->maxDelay) {
+   unsigned int ceiling = in->maxDelay;
+
+   if (in->burstPolls > 0) {
+      in->burstPolls--;
+      in->delay = MIN(1, in->maxDelay);
+      return;
+   }
+
+   if (RpcInGetTimeUS() / 1000 - in->lastCommand >= RPCIN_PARK_IDLE_MS &&
+       ceiling * RPCIN_PARK_FACTOR > ceiling) {
+      ceiling *= RPCIN_PARK_FACTOR;
+   }
+
+   if (in->delay < ceiling) {
       if (in->delay > 0) {
          /*
           * Catch overflow.
           */
-         in->delay = ((in->delay * 2) > in->delay) ? (in->delay * 2) : in->maxDelay;
+         in->delay = ((in->delay * 2) > in->delay) ? (in->delay * 2) : ceiling;
       } else {
          in->delay = 1;
       }
-      in->delay = MIN(in->delay, in->maxDelay);
+      in->delay = MIN(in->delay, ceiling);
    }
 }
 
@@ -1571,6 +1691,7 @@ RpcInLoop(void *clientData) // IN
 #endif
 
    in->inLoop = TRUE;
+   RpcInRecordWakeup(in);
 
    /*
     * Workaround for bug 780404. Remove if we ever figure out the root cause.
@@ -1853,6 +1974,9 @@ RpcIn_start(RpcIn *in,                                // IN
 
    in->delay = 0;
    in->maxDelay = delay;
+   in->burstPolls = 0;
+   in->lastCommand = RpcInGetTimeUS() / 1000;
+   memset(&in->stats, 0, sizeof in->stats);
    in->errorFunc = errorFunc;
    in->clearErrorFunc = clearErrorFunc;
    in->errorData = errorData;
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include <stdarg.h>
 
 #include "str.h"
@@ -33,6 +34,7 @@
 #include <winsock2.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #endif
@@ -65,6 +67,10 @@ struct SSLSockStruct {
 #endif
 
    int sslIOError;
+
+   /* Coalescing buffer for SSL_Writev; one TLS record worth. */
+   char *writeBuf;
+   size_t writePending;    /* Length of a write that must be retried. */
 };
 
 
@@ -602,6 +608,82 @@ SSL_Write(SSLSock ssl,   // IN
 }
 
 
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------
+ *
+ * SSL_Writev()
+ *
+ *    Functional equivalent of the writev() syscall.
+ *
+ *    Without encryption this is a single writev(). With encryption the
+ *    buffers are gathered into at most one TLS record, so that small
+ *    messages share a record (and a TCP segment) instead of each paying
+ *    for its own. A write that has to be retried is retried with the same
+ *    length, as OpenSSL requires; the caller must pass the same data again.
+ *
+ * Results:
+ *    Returns the number of bytes written, or -1 on error.
+ *
+ * Side effects:
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+SSL_Writev(SSLSock ssl,                // IN
+           const struct iovec *iov,    // IN
+           int iovcnt)                 // IN
+{
+   int ret;
+   size_t len = 0;
+   size_t maxLen;
+   int i;
+
+   ASSERT(ssl);
+   ASSERT(iovcnt > 0);
+
+   if (ssl->connectionFailed) {
+      SSLSetSystemError(SSL_SOCK_LOST_CONNECTION);
+      return SOCKET_ERROR;
+   }
+   if (!ssl->encrypted) {
+      return writev(ssl->fd, iov, iovcnt);
+   }
+
+   if (ssl->writeBuf == NULL) {
+      ssl->writeBuf = malloc(SSL3_RT_MAX_PLAIN_LENGTH);
+      VERIFY(ssl->writeBuf);
+   }
+   maxLen = ssl->writePending != 0 ? ssl->writePending
+                                   : SSL3_RT_MAX_PLAIN_LENGTH;
+   for (i = 0; i < iovcnt && len < maxLen; i++) {
+      size_t n = MIN(iov[i].iov_len, maxLen - len);
+
+      memcpy(ssl->writeBuf + len, iov[i].iov_base, n);
+      len += n;
+   }
+
+   ERR_clear_error();
+   ret = SSL_write(ssl->sslCnx, ssl->writeBuf, (int)len);
+
+   ssl->sslIOError = SSLSetErrorState(ssl->sslCnx, ret);
+   if (ssl->sslIOError != SSL_ERROR_NONE) {
+      SSL_LOG(("SSL: Writev(%d, %"FMTSZ"u)\n", ssl->fd, len));
+      if (ssl->sslIOError == SSL_ERROR_WANT_READ ||
+          ssl->sslIOError == SSL_ERROR_WANT_WRITE) {
+         ssl->writePending = len;
+      }
+      ret = SOCKET_ERROR;
+   } else {
+      ssl->writePending = 0;
+   }
+
+   return ret;
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -703,6 +785,7 @@ SSL_Shutdown(SSLSock ssl)     // IN
       retVal = SSLGeneric_close(ssl->fd);
    }
 
+   free(ssl->writeBuf);
    free(ssl);
    SSL_LOG(("SSL: shutdown done\n"));
 
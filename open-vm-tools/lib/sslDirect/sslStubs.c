@@ -33,6 +33,7 @@
 #include <winsock2.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #endif
@@ -80,6 +81,32 @@ SSL_Write(SSLSock sslSock,   // IN
 }
 
 
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------
+ *
+ * SSL_Writev()
+ *
+ *    Functional equivalent of the writev() syscall.
+ *
+ * Results:
+ *    Returns the number of bytes written, or -1 on error.
+ *
+ * Side effects:
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+SSL_Writev(SSLSock sslSock,            // IN
+           const struct iovec *iov,    // IN
+           int iovcnt)                 // IN
+{
+   return writev(sslSock->fd, iov, iovcnt);
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------
  *
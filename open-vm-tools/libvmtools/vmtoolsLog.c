@@ -67,6 +67,12 @@
  */
 #define DEFAULT_MAX_CACHE_ENTRIES      (4*1024)
 
+/*
+ * Default max time, in milliseconds, a message waits in the queue of an
+ * asynchronous file logger before being written.
+ */
+#define DEFAULT_FLUSH_INTERVAL         (1000)
+
 /** The default handler to use if none is specified by the config data. */
 #define DEFAULT_HANDLER "file+"
 
@@ -417,6 +423,22 @@ VMToolsFreeLogEntry(gpointer data)
 }
 
 
+/**
+ * Waits until the output buffered by a log handler, if any, is written.
+ *
+ * @param[in] handler   Log handler, may be NULL.
+ */
+
+static void
+VMToolsFlushLogHandler(LogHandler *handler)
+{
+   if (handler != NULL && handler->logger != NULL &&
+       handler->logger->flush != NULL) {
+      handler->logger->flush(handler->logger);
+   }
+}
+
+
 /**
  * Function that calls the log handler.
  *
@@ -450,6 +472,15 @@ VMToolsLogMsg(gpointer _data, gpointer userData)
                                   gErrorSyslog->logger);
    }
 
+   /*
+    * The process is about to go away; don't leave the message in the queue
+    * of an asynchronous logger.
+    */
+   if (IS_FATAL(entry->level)) {
+      VMToolsFlushLogHandler(entry->handler);
+      VMToolsFlushLogHandler(gErrorData);
+   }
+
    VMToolsFreeLogEntry(entry);
 }
 
@@ -689,6 +720,8 @@ VMToolsGetLogHandler(const gchar *handler,
       gboolean append = strcmp(handler, "file+") == 0;
       guint maxSize;
       guint maxFiles;
+      gint queueSize;
+      gint flushInterval;
       GError *err = NULL;
 
       /* Use the same type name for both. */
@@ -711,7 +744,24 @@ VMToolsGetLogHandler(const gchar *handler,
             maxFiles = 10;
          }
 
-         glogger = GlibUtils_CreateFileLogger(path, append, maxSize, maxFiles);
+         g_snprintf(key, sizeof key, "%s.queueSize", domain);
+         queueSize = g_key_file_get_integer(cfg, LOGGING_GROUP, key, NULL);
+
+         g_snprintf(key, sizeof key, "%s.flushInterval", domain);
+         flushInterval = g_key_file_get_integer(cfg, LOGGING_GROUP, key, &err);
+         if (err != NULL || flushInterval <= 0) {
+            g_clear_error(&err);
+            flushInterval = DEFAULT_FLUSH_INTERVAL;
+         }
+
+         if (queueSize > 1) {
+            glogger = GlibUtils_CreateAsyncFileLogger(path, append, maxSize,
+                                                      maxFiles, queueSize,
+                                                      flushInterval);
+         } else {
+            glogger = GlibUtils_CreateFileLogger(path, append, maxSize,
+                                                 maxFiles);
+         }
          needsFileIO = TRUE;
       } else {
          g_warning("Missing path for domain '%s'.", domain);
@@ -1370,6 +1420,21 @@ void
 VMTools_SuspendLogIO()
 {
    gLogIOSuspended = TRUE;
+
+   /*
+    * From now on the messages for the file handlers are cached. Write out
+    * what the asynchronous loggers still hold before the IO is frozen.
+    */
+   VMTools_AcquireLogStateLock();
+   VMToolsFlushLogHandler(gDefaultData);
+   VMToolsFlushLogHandler(gErrorData);
+   if (gDomains != NULL) {
+      guint i;
+      for (i = 0; i < gDomains->len; i++) {
+         VMToolsFlushLogHandler(g_ptr_array_index(gDomains, i));
+      }
+   }
+   VMTools_ReleaseLogStateLock();
 }
 
 
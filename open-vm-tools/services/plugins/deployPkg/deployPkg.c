@@ -282,7 +282,8 @@ DeployPkg_TcloDeploy(RpcInData *data)  // IN
    }
 
    pkgName = Util_SafeStrdup(pkgStart);
-   if (!ToolsCorePool_SubmitTask(ctx, DeployPkgExecDeploy, pkgName, free)) {
+   if (!ToolsCorePool_SubmitTaskEx(ctx, DeployPkgExecDeploy, pkgName, free,
+                                   TOOLS_CORE_POOL_PRIO_LOW, "deployPkg")) {
       g_warning("%s: failed to start deploy execution thread\n",
                 __FUNCTION__);
       msg = g_strdup_printf("deployPkg.update.state %d %d %s",
@@ -20,13 +20,319 @@
  * @file diskInfoPosix.c
  *
  * Contains POSIX-specific bits of gettting disk information.
+ *
+ * The list of partitions is cached, and only reloaded when the mount table
+ * changes (on Linux, /proc/self/mountinfo is polled for changes; elsewhere
+ * it's reloaded on every call). The space of the partitions is queried in
+ * a small thread pool, and the report is built from the latest result of
+ * each partition, so that a hung mount (e.g., an unreachable NFS server)
+ * only delays the report by the configured timeout instead of stalling the
+ * gather loop.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/poll.h>
+
 #include "conf.h"
+#include "str.h"
 #include "util.h"
 #include "vmware.h"
+#include "wiper.h"
 #include "guestInfoInt.h"
 
+#define DISKINFO_DEFAULT_TIMEOUT    2000   /* ms */
+#define DISKINFO_MAX_THREADS        8
+#define DISKINFO_MOUNTINFO          "/proc/self/mountinfo"
+
+/* A partition in the cached list. */
+typedef struct GuestInfoMount {
+   guint             refCount;      // Cached list plus in-flight query.
+   WiperPartition    part;
+   guint             queryGen;      // Gather the last query was started by.
+   gboolean          includeReserved;
+   gboolean          busy;          // A query is in flight.
+   gboolean          valid;         // freeBytes and totalBytes are set.
+   uint64            freeBytes;
+   uint64            totalBytes;
+} GuestInfoMount;
+
+typedef struct GuestInfoDiskCache {
+   GMutex           *lock;
+   GCond            *done;
+   GThreadPool      *pool;
+   GPtrArray        *mounts;        // GuestInfoMount, in mount table order.
+   int               mountInfoFd;   // -1 if the mount table isn't watched.
+   gboolean          stale;         // The list needs to be reloaded.
+   guint             gen;           // Current gather.
+   guint             pending;       // Queries of the current gather running.
+} GuestInfoDiskCache;
+
+static GuestInfoDiskCache gDiskCache = { NULL, NULL, NULL, NULL, -1, TRUE, };
+
+
+/*
+ ******************************************************************************
+ * GuestInfoMountUnref --                                                */ /**
+ *
+ * Drops a reference to a cached partition. Must be called with the cache
+ * lock held.
+ *
+ * @param[in] mount     The partition.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoMountUnref(GuestInfoMount *mount)
+{
+   ASSERT(mount->refCount > 0);
+   if (--mount->refCount == 0) {
+      g_free(mount);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskQuery --                                                 */ /**
+ *
+ * Thread pool callback: queries the space of a partition and stores the
+ * result in the cache.
+ *
+ * @param[in] data      The partition.
+ * @param[in] userData  Unused.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoDiskQuery(gpointer data,
+                   gpointer userData)
+{
+   GuestInfoMount *mount = data;
+   uint64 freeBytes = 0;
+   uint64 totalBytes = 0;
+   unsigned char *error;
+   gboolean includeReserved;
+
+   g_mutex_lock(gDiskCache.lock);
+   includeReserved = mount->includeReserved;
+   g_mutex_unlock(gDiskCache.lock);
+
+   if (includeReserved) {
+      error = WiperSinglePartition_GetSpace(&mount->part, NULL,
+                                            &freeBytes, &totalBytes);
+   } else {
+      error = WiperSinglePartition_GetSpace(&mount->part, &freeBytes,
+                                            NULL, &totalBytes);
+   }
+
+   g_mutex_lock(gDiskCache.lock);
+   if (strlen(error)) {
+      g_warning("GetDiskInfo: ERROR: could not get space info for "
+                "partition %s: %s\n", mount->part.mountPoint, error);
+      mount->valid = FALSE;
+   } else {
+      mount->freeBytes = freeBytes;
+      mount->totalBytes = totalBytes;
+      mount->valid = TRUE;
+   }
+   mount->busy = FALSE;
+   if (mount->queryGen == gDiskCache.gen) {
+      gDiskCache.pending--;
+      g_cond_broadcast(gDiskCache.done);
+   }
+   GuestInfoMountUnref(mount);
+   g_mutex_unlock(gDiskCache.lock);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskMountsChanged --                                         */ /**
+ *
+ * Checks whether the mount table changed since the last call. The kernel
+ * flags /proc/self/mountinfo with POLLPRI when a mount is added or removed.
+ *
+ * @return TRUE if the partition list needs to be reloaded.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoDiskMountsChanged(void)
+{
+#if defined(__linux__)
+   struct pollfd pfd;
+
+   if (gDiskCache.mountInfoFd == -1) {
+      gDiskCache.mountInfoFd = open(DISKINFO_MOUNTINFO, O_RDONLY);
+      if (gDiskCache.mountInfoFd == -1) {
+         g_debug("%s: cannot watch %s: %s\n", __FUNCTION__,
+                 DISKINFO_MOUNTINFO, strerror(errno));
+         return TRUE;
+      }
+   }
+
+   pfd.fd = gDiskCache.mountInfoFd;
+   pfd.events = POLLPRI;
+   pfd.revents = 0;
+   if (poll(&pfd, 1, 0) != 0) {
+      return TRUE;
+   }
+
+   return gDiskCache.stale;
+#else
+   return TRUE;
+#endif
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskReload --                                                */ /**
+ *
+ * Reloads the list of partitions. Partitions that are still mounted keep
+ * their last result and in-flight query. Must be called with the cache
+ * lock held.
+ *
+ * @return Whether the list was reloaded.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoDiskReload(void)
+{
+   WiperPartition_List pl;
+   DblLnkLst_Links *curr;
+   GPtrArray *mounts;
+   guint i;
+
+   if (!WiperPartition_Open(&pl, FALSE)) {
+      g_warning("GetDiskInfo: ERROR: could not get partition list\n");
+      return FALSE;
+   }
+
+   mounts = g_ptr_array_new();
+
+   DblLnkLst_ForEach(curr, &pl.link) {
+      WiperPartition *part = DblLnkLst_Container(curr, WiperPartition, link);
+      GuestInfoMount *mount = NULL;
+
+      if (part->type == PARTITION_UNSUPPORTED) {
+         g_debug("%s ignoring unsupported partition %s %s\n",
+                 __FUNCTION__, part->mountPoint,
+                 part->comment ? part->comment : "");
+         continue;
+      }
+
+      for (i = 0; gDiskCache.mounts != NULL && i < gDiskCache.mounts->len; i++) {
+         GuestInfoMount *old = g_ptr_array_index(gDiskCache.mounts, i);
+
+         if (old != NULL &&
+             old->part.type == part->type &&
+             strcmp(old->part.mountPoint, part->mountPoint) == 0) {
+            mount = old;
+            gDiskCache.mounts->pdata[i] = NULL;
+            break;
+         }
+      }
+
+      if (mount == NULL) {
+         mount = g_malloc0(sizeof *mount);
+         mount->refCount = 1;
+         mount->part = *part;
+         mount->part.comment = NULL;
+         DblLnkLst_Init(&mount->part.link);
+      }
+
+      g_ptr_array_add(mounts, mount);
+   }
+
+   WiperPartition_Close(&pl);
+
+   /* Drop the partitions that are gone. */
+   for (i = 0; gDiskCache.mounts != NULL && i < gDiskCache.mounts->len; i++) {
+      GuestInfoMount *old = g_ptr_array_index(gDiskCache.mounts, i);
+
+      if (old != NULL) {
+         GuestInfoMountUnref(old);
+      }
+   }
+   if (gDiskCache.mounts != NULL) {
+      g_ptr_array_free(gDiskCache.mounts, TRUE);
+   }
+
+   gDiskCache.mounts = mounts;
+   gDiskCache.stale = FALSE;
+   g_debug("%s: %u partitions\n", __FUNCTION__, mounts->len);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskSnapshot --                                              */ /**
+ *
+ * Builds a report from the latest result of each cached partition. Must be
+ * called with the cache lock held.
+ *
+ * @return Pointer to a GuestDiskInfo structure on success or NULL on failure.
+ *
+ ******************************************************************************
+ */
+
+static GuestDiskInfo *
+GuestInfoDiskSnapshot(void)
+{
+   GuestDiskInfo *di = Util_SafeCalloc(1, sizeof *di);
+   unsigned int partNameSize = sizeof (di->partitionList)[0].name;
+   unsigned int partCount = 0;
+   guint i;
+
+   if (gDiskCache.mounts->len > 0) {
+      di->partitionList = Util_SafeCalloc(gDiskCache.mounts->len,
+                                          sizeof *di->partitionList);
+   }
+
+   for (i = 0; i < gDiskCache.mounts->len; i++) {
+      GuestInfoMount *mount = g_ptr_array_index(gDiskCache.mounts, i);
+      PPartitionEntry partEntry;
+
+      if (mount->busy && mount->queryGen == gDiskCache.gen) {
+         g_warning("GetDiskInfo: timed out getting space info for "
+                   "partition %s%s\n", mount->part.mountPoint,
+                   mount->valid ? ", reporting last known values" : "");
+      }
+
+      if (!mount->valid) {
+         continue;
+      }
+
+      if (strlen(mount->part.mountPoint) + 1 > partNameSize) {
+         g_warning("GetDiskInfo: ERROR: Partition name buffer too small\n");
+         GuestInfo_FreeDiskInfo(di);
+         return NULL;
+      }
+
+      partEntry = &di->partitionList[partCount++];
+      Str_Strcpy(partEntry->name, mount->part.mountPoint, partNameSize);
+      partEntry->freeBytes = mount->freeBytes;
+      partEntry->totalBytes = mount->totalBytes;
+
+      g_debug("%s added partition #%d %s type %d free %"FMT64"u total %"FMT64"u\n",
+              __FUNCTION__, partCount, partEntry->name, mount->part.type,
+              partEntry->freeBytes, partEntry->totalBytes);
+   }
+
+   di->numEntries = partCount;
+   return di;
+}
+
 
 /*
  ******************************************************************************
@@ -34,6 +340,10 @@
  *
  * Uses wiper library to enumerate fixed volumes and lookup utilization data.
  *
+ * Queries of all partitions run concurrently; the call waits for them for at
+ * most "diskinfo-timeout" milliseconds. Partitions that didn't answer in time
+ * are reported with their previous values, if any.
+ *
  * @return Pointer to a GuestDiskInfo structure on success or NULL on failure.
  *         Caller should free returned pointer with GuestInfoFreeDiskInfo.
  *
@@ -44,6 +354,10 @@ GuestDiskInfo *
 GuestInfo_GetDiskInfo(const ToolsAppCtx *ctx)
 {
    gboolean includeReserved;
+   gint timeout;
+   GTimeVal deadline;
+   GuestDiskInfo *di = NULL;
+   guint i;
 
    /*
     * In order to be consistent with the way 'df' reports
@@ -60,5 +374,122 @@ GuestInfo_GetDiskInfo(const ToolsAppCtx *ctx)
       g_debug("Excluding reserved space from diskInfo stats.\n");
    }
 
-   return GuestInfoGetDiskInfoWiper(includeReserved);
+   timeout = VMTools_ConfigGetInteger(ctx->config,
+                                      CONFGROUPNAME_GUESTINFO,
+                                      CONFNAME_DISKINFO_TIMEOUT,
+                                      DISKINFO_DEFAULT_TIMEOUT);
+   if (timeout <= 0) {
+      timeout = DISKINFO_DEFAULT_TIMEOUT;
+   }
+
+   if (gDiskCache.lock == NULL) {
+      GError *err = NULL;
+
+      gDiskCache.pool = g_thread_pool_new(GuestInfoDiskQuery, NULL,
+                                          DISKINFO_MAX_THREADS, FALSE, &err);
+      if (gDiskCache.pool == NULL) {
+         g_warning("%s: cannot create thread pool: %s\n", __FUNCTION__,
+                   err != NULL ? err->message : "");
+         g_clear_error(&err);
+         return GuestInfoGetDiskInfoWiper(includeReserved);
+      }
+      gDiskCache.lock = g_mutex_new();
+      gDiskCache.done = g_cond_new();
+   }
+
+   g_mutex_lock(gDiskCache.lock);
+
+   if (GuestInfoDiskMountsChanged() && !GuestInfoDiskReload()) {
+      gDiskCache.stale = TRUE;
+      if (gDiskCache.mounts == NULL) {
+         goto exit;
+      }
+   }
+
+   gDiskCache.gen++;
+   gDiskCache.pending = 0;
+
+   for (i = 0; i < gDiskCache.mounts->len; i++) {
+      GuestInfoMount *mount = g_ptr_array_index(gDiskCache.mounts, i);
+      GError *err = NULL;
+
+      if (mount->busy) {
+         /* Still stuck in a previous query. */
+         continue;
+      }
+
+      mount->busy = TRUE;
+      mount->includeReserved = includeReserved;
+      mount->queryGen = gDiskCache.gen;
+      mount->refCount++;
+      gDiskCache.pending++;
+
+      g_thread_pool_push(gDiskCache.pool, mount, &err);
+      if (err != NULL) {
+         g_warning("%s: cannot query partition %s: %s\n", __FUNCTION__,
+                   mount->part.mountPoint, err->message);
+         g_clear_error(&err);
+         mount->busy = FALSE;
+         mount->refCount--;
+         gDiskCache.pending--;
+      }
+   }
+
+   g_get_current_time(&deadline);
+   g_time_val_add(&deadline, (glong) timeout * 1000);
+   while (gDiskCache.pending > 0) {
+      if (!g_cond_timed_wait(gDiskCache.done, gDiskCache.lock, &deadline)) {
+         break;
+      }
+   }
+
+   di = GuestInfoDiskSnapshot();
+
+exit:
+   g_mutex_unlock(gDiskCache.lock);
+   return di;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_ShutdownDiskInfo --                                         */ /**
+ *
+ * Frees the partition cache and stops the query threads. Queries stuck in
+ * the kernel can't be interrupted; their threads are left behind.
+ *
+ ******************************************************************************
+ */
+
+void
+GuestInfo_ShutdownDiskInfo(void)
+{
+   guint i;
+
+   if (gDiskCache.lock == NULL) {
+      return;
+   }
+
+   g_mutex_lock(gDiskCache.lock);
+   if (gDiskCache.mounts != NULL) {
+      for (i = 0; i < gDiskCache.mounts->len; i++) {
+         GuestInfoMountUnref(g_ptr_array_index(gDiskCache.mounts, i));
+      }
+      g_ptr_array_free(gDiskCache.mounts, TRUE);
+      gDiskCache.mounts = NULL;
+   }
+   gDiskCache.stale = TRUE;
+   g_mutex_unlock(gDiskCache.lock);
+
+   /*
+    * Don't wait for the threads, and keep the lock: a thread blocked on a
+    * dead mount still needs it if it ever returns.
+    */
+   g_thread_pool_free(gDiskCache.pool, TRUE, FALSE);
+   gDiskCache.pool = NULL;
+
+   if (gDiskCache.mountInfoFd != -1) {
+      close(gDiskCache.mountInfoFd);
+      gDiskCache.mountInfoFd = -1;
+   }
 }
@@ -0,0 +1,50 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * guestInfoBatch.x --
+ *
+ *    Definition of the data structures used in the INFO_BATCH GuestRpc
+ *    command, which carries several guest info updates in one message.
+ */
+
+enum GuestInfoBatchVersion {
+   GUEST_INFO_BATCH_V1 = 1
+};
+
+/* Arbitrary limits to avoid possible DoS attacks. */
+const GUEST_INFO_BATCH_MAX_ITEMS     = 16;
+const GUEST_INFO_BATCH_MAX_ITEM_SIZE = 1048576;
+
+/*
+ * One update. The data is what a single "SetGuestInfo  <type> " message
+ * of that type carries after its preamble.
+ */
+struct GuestInfoBatchItem {
+   uint32 type;                                  /* GuestInfoType */
+   opaque data<GUEST_INFO_BATCH_MAX_ITEM_SIZE>;
+};
+
+struct GuestInfoBatchV1 {
+   struct GuestInfoBatchItem items<GUEST_INFO_BATCH_MAX_ITEMS>;
+};
+
+union GuestInfoBatch switch (GuestInfoBatchVersion ver) {
+case GUEST_INFO_BATCH_V1:
+   struct GuestInfoBatchV1 *batchV1;
+};
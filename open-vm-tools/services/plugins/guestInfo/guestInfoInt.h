@@ -50,6 +50,9 @@ GuestInfo_GetDiskInfo(const ToolsAppCtx *ctx);
 void
 GuestInfo_FreeDiskInfo(GuestDiskInfo *di);
 
+void
+GuestInfo_ShutdownDiskInfo(void);
+
 void
 GuestInfo_StatProviderShutdown(void);
 
@@ -44,6 +44,7 @@
 #include "dynxdr.h"
 #include "hostinfo.h"
 #include "guestInfoInt.h"
+#include "guestInfoBatch.h"
 #include "guest_msg_def.h" // For GUESTMSG_MAX_IN_SIZE
 #include "netutil.h"
 #include "rpcvmx.h"
@@ -120,6 +121,21 @@ typedef struct _GuestInfoCache {
    NicInfoMethod  method;
 } GuestInfoCache;
 
+/*
+ * Updates of the current gather cycle, to be sent in one INFO_BATCH
+ * message. gInfoCache already holds the batched values; the dirty mask
+ * tells which of its entries to drop if the updates don't make it to the
+ * VMX, so that the next cycle sends them again.
+ */
+
+typedef struct _GuestInfoBatchState {
+   Bool                active;       /* Collecting the cycle's updates */
+   Bool                unsupported;  /* The VMX rejected INFO_BATCH */
+   uint32              dirty;        /* One bit per GuestInfoType batched */
+   u_int               numItems;
+   GuestInfoBatchItem  items[GUEST_INFO_BATCH_MAX_ITEMS];
+} GuestInfoBatchState;
+
 
 /**
  * Defines the current poll interval (in milliseconds).
@@ -153,6 +169,9 @@ static GSource *gatherStatsTimeoutSource = NULL;
 /* Local cache of the guest information that was last sent to vmx. */
 static GuestInfoCache gInfoCache;
 
+/* Guest information updates waiting to be sent in a batch. */
+static GuestInfoBatchState gInfoBatch;
+
 /*
  * A boolean flag that specifies whether the state of the VM was
  * changed since the last time guest info was sent to the VMX.
@@ -175,6 +194,11 @@ static Bool SetGuestInfo(ToolsAppCtx *ctx, GuestInfoType key,
                          const char *value);
 static void SendUptime(ToolsAppCtx *ctx);
 static Bool DiskInfoChanged(const GuestDiskInfo *diskInfo);
+static void GuestInfoBatchBegin(ToolsAppCtx *ctx);
+static Bool GuestInfoBatchAdd(GuestInfoType type, const void *data,
+                              u_int dataLen);
+static Bool GuestInfoBatchAddNicInfo(NicInfoV3 *info);
+static void GuestInfoBatchFlush(ToolsAppCtx *ctx);
 static void GuestInfoClearCache(void);
 static GuestNicList *NicInfoV3ToV2(const NicInfoV3 *infoV3);
 static void TweakGatherLoops(ToolsAppCtx *ctx, gboolean enable);
@@ -490,6 +514,8 @@ GuestInfoGather(gpointer data)
 
    GuestInfoCheckIfRunningSlow(ctx);
 
+   GuestInfoBatchBegin(ctx);
+
    /* Send tools version. */
    if (!GuestInfoUpdateVmdb(ctx, INFO_BUILD_NUMBER, BUILD_NUMBER, 0)) {
       /*
@@ -661,6 +687,8 @@ GuestInfoGather(gpointer data)
    /* Send the uptime to VMX so that it can detect soft resets. */
    SendUptime(ctx);
 
+   GuestInfoBatchFlush(ctx);
+
    return TRUE;
 }
 
@@ -738,17 +766,49 @@ GuestInfoConvertNicInfoToNicInfoV1(NicInfoV3 *info,
 }
 
 
+/*
+ ******************************************************************************
+ * GuestInfoMemoryInfoSent --                                            */ /**
+ *
+ * Completion callback of the GuestMemInfo RPC sent by GuestInfoSendMemoryInfo.
+ *
+ * @param[in] status     Whether the RPC succeeded.
+ * @param[in] result     Reply from the VMX.
+ * @param[in] resultLen  Length of the reply.
+ * @param[in] data       Unused.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoMemoryInfoSent(gboolean status,  // IN
+                        char *result,     // IN
+                        size_t resultLen, // IN
+                        gpointer data)    // IN
+{
+   if (status) {
+      g_debug("GuestMemInfo sent successfully.\n");
+   } else {
+      g_warning("Error sending GuestMemInfo: %s\n",
+                result != NULL ? result : "");
+   }
+}
+
+
 /*
  ******************************************************************************
  * GuestInfoSendMemoryInfo --                                            */ /**
  *
- * Push memory informations about the guest to the vmx
+ * Push memory informations about the guest to the vmx. The stats gather
+ * loop does not use the reply, so the RPC is sent asynchronously and the
+ * outcome is logged by GuestInfoMemoryInfoSent. It is sent synchronously
+ * if it cannot be queued.
  *
  * @param[in] ctx       Application context.
  * @param[in] infoSize  Size of the struct to send
  * @param[in] info      Struct that contains memory info
  *
- * @retval TRUE  Update sent successfully.
+ * @retval TRUE  Update queued or sent successfully.
  * @retval FALSE Had trouble with transmission.
  *
  ******************************************************************************
@@ -783,6 +843,11 @@ GuestInfoSendMemoryInfo(ToolsAppCtx *ctx,  // IN: Application context
       memcpy(request + headerLen, info, infoSize);
 
       /* Send all the information in the message. */
+      if (RpcChannel_SendAsync(ctx->rpc, request, requestSize,
+                               GuestInfoMemoryInfoSent, NULL)) {
+         g_free(request);
+         return TRUE;
+      }
       success = RpcChannel_Send(ctx->rpc, request, requestSize, NULL, NULL);
 
       g_free(request);
@@ -1117,7 +1182,9 @@ GuestInfoUpdateVmdb(ToolsAppCtx *ctx,       // IN: Application context
          break;
       }
 
-      if (!SetGuestInfo(ctx, infoType, (char *)info)) {
+      if (GuestInfoBatchAdd(infoType, info, strlen((char *)info) + 1)) {
+         g_debug("Batched value for infotype %d.\n", infoType);
+      } else if (!SetGuestInfo(ctx, infoType, (char *)info)) {
          g_warning("Failed to update key/value pair for type %d.\n", infoType);
          return FALSE;
       }
@@ -1129,7 +1196,8 @@ GuestInfoUpdateVmdb(ToolsAppCtx *ctx,       // IN: Application context
 
    case INFO_IPADDRESS:
       {
-         if (!GuestInfoSendNicInfo(ctx, (NicInfoV3 *) info)) {
+         if (!GuestInfoBatchAddNicInfo((NicInfoV3 *) info) &&
+             !GuestInfoSendNicInfo(ctx, (NicInfoV3 *) info)) {
             g_warning("Failed to update nic information.\n");
             return FALSE;
          }
@@ -1209,6 +1277,13 @@ GuestInfoUpdateVmdb(ToolsAppCtx *ctx,       // IN: Application context
          }
 
          g_debug("sizeof request is %d\n", requestSize);
+         if (GuestInfoBatchAdd(INFO_DISK_FREE_SPACE, request + offset,
+                               requestSize - offset)) {
+            vm_free(request);
+            g_debug("Batched disk info information\n");
+            break;
+         }
+
          status = RpcChannel_Send(ctx->rpc, request, requestSize, &reply,
                                   &replyLen);
          if (status) {
@@ -1243,6 +1318,304 @@ GuestInfoUpdateVmdb(ToolsAppCtx *ctx,       // IN: Application context
 #endif
 
 
+/*
+ ******************************************************************************
+ * GuestInfoBatchBegin --                                                */ /**
+ *
+ * Starts collecting the updates of a gather cycle into a batch, if batching
+ * is enabled and the VMX has not rejected it.
+ *
+ * @param[in] ctx   Application context.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoBatchBegin(ToolsAppCtx *ctx)
+{
+   ASSERT(gInfoBatch.numItems == 0);
+
+   gInfoBatch.dirty = 0;
+   gInfoBatch.active =
+      !gInfoBatch.unsupported &&
+      g_key_file_get_boolean(ctx->config, CONFGROUPNAME_GUESTINFO,
+                             CONFNAME_GUESTINFO_BATCHUPDATES, NULL);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoBatchAdd --                                                  */ /**
+ *
+ * Queues an update in the current batch.
+ *
+ * @param[in] type     Guest information type.
+ * @param[in] data     Message payload following the RPC preamble.
+ * @param[in] dataLen  Length of the payload.
+ *
+ * @retval TRUE  Update queued; the caller must not send it.
+ * @retval FALSE Not batching, or the batch is full; the caller must send it.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoBatchAdd(GuestInfoType type,     // IN
+                  const void *data,       // IN
+                  u_int dataLen)          // IN
+{
+   GuestInfoBatchItem *item;
+
+   ASSERT(type < INFO_MAX);
+
+   if (!gInfoBatch.active ||
+       gInfoBatch.numItems == GUEST_INFO_BATCH_MAX_ITEMS ||
+       dataLen > GUEST_INFO_BATCH_MAX_ITEM_SIZE) {
+      return FALSE;
+   }
+
+   item = &gInfoBatch.items[gInfoBatch.numItems++];
+   item->type = type;
+   item->data.data_len = dataLen;
+   item->data.data_val = g_malloc(dataLen);
+   memcpy(item->data.data_val, data, dataLen);
+   gInfoBatch.dirty |= 1U << type;
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoBatchAddNicInfo --                                           */ /**
+ *
+ * Queues a nic info update in the current batch. Only done while the VMX
+ * takes the latest nic info format; the fallback sequence of
+ * GuestInfoSendNicInfo needs the individual messages.
+ *
+ * @param[in] info  NicInfoV3 container.
+ *
+ * @retval TRUE  Update queued.
+ * @retval FALSE Update not queued; the caller must send it.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoBatchAddNicInfo(NicInfoV3 *info)         // IN
+{
+   Bool status = FALSE;
+   GuestNicProto message = {0};
+   XDR xdrs;
+
+   if (!gInfoBatch.active ||
+       gInfoCache.method != NIC_INFO_V3_WITH_INFO_IPADDRESS_V3) {
+      return FALSE;
+   }
+
+   if (DynXdr_Create(&xdrs) == NULL) {
+      return FALSE;
+   }
+
+   message.ver = NIC_INFO_V3;
+   message.GuestNicProto_u.nicInfoV3 = info;
+   if (!xdr_GuestNicProto(&xdrs, &message)) {
+      g_warning("Error serializing nic info v%d data.", message.ver);
+   } else {
+      status = GuestInfoBatchAdd(INFO_IPADDRESS_V3, DynXdr_Get(&xdrs),
+                                 xdr_getpos(&xdrs));
+   }
+   DynXdr_Destroy(&xdrs, TRUE);
+
+   return status;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoBatchInvalidate --                                           */ /**
+ *
+ * Drops the cached value of a guest information type, so that it is sent
+ * again in the next gather cycle.
+ *
+ * @param[in] type  Guest information type.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoBatchInvalidate(GuestInfoType type)      // IN
+{
+   switch (type) {
+   case INFO_DISK_FREE_SPACE:
+      GuestInfo_FreeDiskInfo(gInfoCache.diskInfo);
+      gInfoCache.diskInfo = NULL;
+      break;
+   case INFO_IPADDRESS_V3:
+      GuestInfo_FreeNicInfo(gInfoCache.nicInfo);
+      gInfoCache.nicInfo = NULL;
+      break;
+   default:
+      free(gInfoCache.value[type]);
+      gInfoCache.value[type] = NULL;
+      break;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoBatchReplay --                                               */ /**
+ *
+ * Sends a batched update on its own, the way GuestInfoUpdateVmdb sends it
+ * when not batching. Nic info is sent from the cache through
+ * GuestInfoSendNicInfo, so that it gets the older formats fallback.
+ *
+ * @param[in] ctx   Application context.
+ * @param[in] item  Batched update.
+ *
+ * @retval TRUE  Update sent successfully.
+ * @retval FALSE Had trouble with transmission.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoBatchReplay(ToolsAppCtx *ctx,               // IN
+                     GuestInfoBatchItem *item)       // IN
+{
+   Bool status;
+   gchar *request;
+   u_int msgLength;
+   gchar *message;
+   char *reply = NULL;
+   size_t replyLen;
+
+   switch (item->type) {
+   case INFO_IPADDRESS_V3:
+      return gInfoCache.nicInfo != NULL &&
+             GuestInfoSendNicInfo(ctx, gInfoCache.nicInfo);
+   case INFO_DISK_FREE_SPACE:
+      break;
+   default:
+      return SetGuestInfo(ctx, item->type, item->data.data_val);
+   }
+
+   /* Add the RPC preamble: message name, and type. */
+   request = g_strdup_printf("%s  %d ", GUEST_INFO_COMMAND, item->type);
+   msgLength = strlen(request) + item->data.data_len;
+   message = g_malloc(msgLength);
+   memcpy(message, request, strlen(request));
+   memcpy(message + strlen(request), item->data.data_val,
+          item->data.data_len);
+
+   status = RpcChannel_Send(ctx->rpc, message, msgLength, &reply, &replyLen);
+   if (status) {
+      status = (*reply == '\0');
+   }
+   if (!status) {
+      g_warning("%s: update failed: request \"%s\", reply \"%s\".\n",
+                __FUNCTION__, request, reply);
+   }
+   vm_free(reply);
+
+   g_free(message);
+   g_free(request);
+
+   return status;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoBatchFlush --                                                */ /**
+ *
+ * Sends the updates of the gather cycle in one INFO_BATCH message. If the
+ * VMX does not take it, batching is turned off and the updates are sent one
+ * by one. The cached values of the updates that could not be sent are
+ * dropped.
+ *
+ * @param[in] ctx   Application context.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoBatchFlush(ToolsAppCtx *ctx)             // IN
+{
+   Bool status = FALSE;
+   GuestInfoBatch message = {0};
+   GuestInfoBatchV1 batchV1;
+   XDR xdrs;
+   gchar *request;
+   char *reply = NULL;
+   size_t replyLen;
+   u_int i;
+
+   gInfoBatch.active = FALSE;
+
+   if (gInfoBatch.numItems == 0) {
+      return;
+   }
+
+   /* Add the RPC preamble: message name, and type. */
+   request = g_strdup_printf("%s  %d ", GUEST_INFO_COMMAND, INFO_BATCH);
+
+   batchV1.items.items_len = gInfoBatch.numItems;
+   batchV1.items.items_val = gInfoBatch.items;
+   message.ver = GUEST_INFO_BATCH_V1;
+   message.GuestInfoBatch_u.batchV1 = &batchV1;
+
+   if (DynXdr_Create(&xdrs) != NULL) {
+      if (!DynXdr_AppendRaw(&xdrs, request, strlen(request)) ||
+          !xdr_GuestInfoBatch(&xdrs, &message)) {
+         g_warning("Error serializing guest info batch.");
+      } else {
+         status = RpcChannel_Send(ctx->rpc, DynXdr_Get(&xdrs),
+                                  xdr_getpos(&xdrs), &reply, &replyLen);
+         if (!status) {
+            g_debug("%s: batch of %u updates failed: reply \"%s\".\n",
+                    __FUNCTION__, gInfoBatch.numItems, reply);
+         }
+         vm_free(reply);
+      }
+      DynXdr_Destroy(&xdrs, TRUE);
+   }
+
+   if (status) {
+      g_debug("Sent %u guest info updates in one batch.\n",
+              gInfoBatch.numItems);
+      gInfoBatch.dirty = 0;
+   } else {
+      g_message("Batched guest info updates not supported, "
+                "sending them one by one.\n");
+      gInfoBatch.unsupported = TRUE;
+
+      for (i = 0; i < gInfoBatch.numItems; i++) {
+         GuestInfoBatchItem *item = &gInfoBatch.items[i];
+
+         if (GuestInfoBatchReplay(ctx, item)) {
+            gInfoBatch.dirty &= ~(1U << item->type);
+         }
+      }
+   }
+
+   for (i = 0; i < INFO_MAX; i++) {
+      if (gInfoBatch.dirty & (1U << i)) {
+         GuestInfoBatchInvalidate(i);
+      }
+   }
+   gInfoBatch.dirty = 0;
+
+   for (i = 0; i < gInfoBatch.numItems; i++) {
+      g_free(gInfoBatch.items[i].data.data_val);
+   }
+   gInfoBatch.numItems = 0;
+
+   g_free(request);
+}
+
+
 /*
  ******************************************************************************
  * SendUptime --                                                         */ /**
@@ -1448,6 +1821,9 @@ GuestInfoClearCache(void)
    gInfoCache.nicInfo = NULL;
 
    gInfoCache.method = NIC_INFO_V3_WITH_INFO_IPADDRESS_V3;
+
+   /* The VMX may have changed: give batching another try. */
+   gInfoBatch.unsupported = FALSE;
 }
 
 
@@ -1784,6 +2160,10 @@ GuestInfoServerShutdown(gpointer src,
    GuestInfo_StatProviderShutdown();
 #endif
 
+#if !defined(_WIN32) && !defined(USERWORLD)
+   GuestInfo_ShutdownDiskInfo();
+#endif
+
 #ifdef _WIN32
    NetUtil_FreeIpHlpApiDll();
 #endif
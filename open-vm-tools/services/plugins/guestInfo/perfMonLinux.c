@@ -22,6 +22,9 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "vm_basic_defs.h"
 #include "vmware.h"
@@ -32,11 +35,21 @@
 #include "guestStats.h"
 #include "posix.h"
 #include "hashTable.h"
+#include "vmware/tools/threadPool.h"
 #include "conf.h"
 
 #define GUEST_INFO_PREALLOC_SIZE 4096
-#define INT_AS_HASHKEY(x) ((const void *)(uintptr_t)(x))
-#define KEY_FORMAT  "%s|%s"
+
+/*
+ * In delta mode, every stat is sent again after this many samples, in case
+ * the host lost track of some of them. The stats of the samples in between
+ * are sent under their own name space, so that a host that does not know
+ * about delta reports ignores them instead of taking the stats left out as
+ * missing.
+ */
+#define GUEST_INFO_DELTA_RESYNC  15
+
+#define GUEST_INFO_DELTA_NS  GUEST_TOOLS_NAMESPACE "/delta"
 
 #define STAT_FILE        "/proc/stat"
 #define VMSTAT_FILE      "/proc/vmstat"
@@ -48,6 +61,27 @@
 
 #define SYSFS_BLOCK_FOLDER  "/sys/block"
 
+/*
+ * High resolution mode: a subset of the stats is sampled by a dedicated
+ * thread every few hundred milliseconds, and each stat report carries the
+ * p50, p99 and max of those samples under their own name spaces.
+ */
+#define GUEST_INFO_HIRES_MAX_STATS       8
+#ifndef GUEST_INFO_HIRES_RING_SIZE
+#define GUEST_INFO_HIRES_RING_SIZE       512  // Power of 2
+#endif
+#define GUEST_INFO_HIRES_MIN_PERIOD      50   // In milliseconds
+#define GUEST_INFO_HIRES_MAX_PERIOD      5000 // In milliseconds
+#define GUEST_INFO_HIRES_BUDGET_WINDOW   50   // Samples per overhead check
+#define GUEST_INFO_HIRES_BUDGET_PERCENT  1    // Of one CPU
+
+#define GUEST_INFO_HIRES_DEFAULT_STATS \
+   "guest.cpu.runQueue;guest.contextSwapRate;guest.disk.requestQueue"
+
+#define GUEST_INFO_HIRES_NS_P50  GUEST_TOOLS_NAMESPACE "/hires/p50"
+#define GUEST_INFO_HIRES_NS_P99  GUEST_TOOLS_NAMESPACE "/hires/p99"
+#define GUEST_INFO_HIRES_NS_MAX  GUEST_TOOLS_NAMESPACE "/hires/max"
+
 /*
  * For now, all data collection is of uint64 values. Rates are always returned
  * as a double, derived from the uint64 data.
@@ -62,6 +96,9 @@ static Bool gExperimental = PUBLISH_EXPERIMENTAL_STATS;
 static Bool gUnstable = FALSE;
 #endif
 
+/* Only send the stats that changed since the previous sample. */
+static Bool gDeltaStats = FALSE;
+
 #define DECLARE_STAT(publish, file, isRegExp, locatorString, reportID, units, dataType) \
    { file, publish, isRegExp, locatorString, reportID, units, dataType }
 
@@ -145,16 +182,41 @@ typedef struct {
    GuestInfoQuery  *query;
 } GuestInfoStat;
 
+/*
+ * A /proc file parsed line by line, with the stats its fields feed. The
+ * field map is built once with the collector, so that parsing a line only
+ * takes a lookup of its field name.
+ */
+
 typedef struct {
-   HashTable       *exactMatches;
+   const char      *pathName;
+   char             fieldSeparator;  // See GuestInfoProcData
+
+   HashTable       *exactMatches;    // Field name -> GuestInfoStat *
 
    uint32           numRegExps;
    GuestInfoStat  **regExps;
+} GuestInfoSource;
+
+static const struct {
+   const char      *pathName;
+   char             fieldSeparator;
+} guestInfoSourceSpecTable[] = {
+   { MEMINFO_FILE,  ':'  },
+   { VMSTAT_FILE,   '\0' },
+   { STAT_FILE,     '\0' },
+   { ZONEINFO_FILE, '\0' },
+};
+
+#define N_SOURCES ARRAYSIZE(guestInfoSourceSpecTable)
+
+typedef struct {
+   GuestInfoSource  sources[N_SOURCES];
 
    uint32           numStats;
    GuestInfoStat   *stats;
 
-   HashTable       *reportMap;
+   GuestInfoStat   *reportMap[GuestStatID_Max];  // Indexed by report ID
 
    Bool             timeData;
    double           timeStamp;
@@ -163,6 +225,34 @@ typedef struct {
 static GuestInfoCollector *gCurrentCollector = NULL;
 static GuestInfoCollector *gPreviousCollector = NULL;
 
+/*
+ * What was last sent for each query, for the delta mode. The value is the
+ * uint64 stat value, or the bits of the double for rates.
+ */
+typedef struct {
+   Bool             sent;
+   int              err;
+   uint64           value;
+} GuestInfoSentStat;
+
+static GuestInfoSentStat gSentStats[N_QUERIES];
+static uint32 gSamplesSinceResync = 0;
+
+/* Stat buffer, reused from one sample to the next. */
+static DynBuf gStatBuf;
+static Bool gStatBufInited = FALSE;
+
+/* Stat names, as given in the high resolution mode configuration. */
+#define DEFINE_GUEST_STAT(x, y, z) { x, z },
+static const struct {
+   GuestStatToolsID  id;
+   const char       *name;
+} guestInfoStatNameTable[] = {
+   GUEST_STAT_TOOLS_IDS
+};
+#undef DEFINE_GUEST_STAT
+
+
 static void
 GuestInfoDeriveMemNeeded(GuestInfoCollector *collector);
 
@@ -172,7 +262,76 @@ typedef struct GuestInfoDiskStatsList {
    unsigned int                   weightedTime[2];  // In milliseconds
 } GuestInfoDiskStatsList;
 
-static GuestInfoDiskStatsList *gDiskStatsList = NULL;
+/*
+ * What a thread collecting stats needs to read the /proc files. The read
+ * buffer is kept between samples and only grows when a file outgrows it.
+ * The disk stats list keeps the previous sample of each disk.
+ */
+typedef struct {
+   char                   *readBuf;
+   size_t                  readBufSize;
+
+   GuestInfoDiskStatsList *diskStatsList;
+   int                     diskStatsCurr;  // weightedTime index to fill
+} GuestInfoProcReader;
+
+static GuestInfoProcReader gProcReader;
+
+/*
+ * One high resolution sample. Bit i of validMask is set if value[i], the
+ * value of the i-th sampled stat, could be collected.
+ */
+typedef struct {
+   uint32           validMask;
+   double           value[GUEST_INFO_HIRES_MAX_STATS];
+} GuestInfoHiResSample;
+
+/*
+ * The high resolution sampler. The sampler thread pushes its samples to a
+ * single producer, single consumer ring; the stats poll drains it. Neither
+ * side takes a lock: head is only written by the sampler. When the ring is
+ * full, the sampler drops the oldest sample by moving tail on, so that a
+ * late poll still reports the latest samples; tail is only moved with a
+ * compare and exchange, and the poll copies the samples out before it
+ * moves tail, so that it knows whether the sampler overwrote any of them.
+ * The lock and condition variable are only used to sleep between samples
+ * and to stop the thread.
+ */
+typedef struct {
+   /* Set at creation. */
+   uint32                numStats;
+   GuestStatToolsID      ids[GUEST_INFO_HIRES_MAX_STATS];
+   GuestInfoQuery       *queries[GUEST_INFO_HIRES_MAX_STATS];
+   uint32                sourceMask;        // Sources to read
+   Bool                  diskStats;         // Read /proc/diskstats
+
+   /* Sampler thread only. */
+   GuestInfoProcReader   reader;
+   GuestInfoCollector   *current;
+   GuestInfoCollector   *previous;
+   uint64                windowCost;        // Microseconds of CPU
+   uint32                windowSamples;
+
+   /* Shared. */
+   GMutex               *lock;
+   GCond                *cond;
+   Bool                  stop;              // Protected by lock
+   volatile gint         period;            // In milliseconds
+   volatile gint         sampleCost;        // Average, microseconds of CPU
+   volatile gint         dropped;
+   volatile gint         head;              // Free running indexes
+   volatile gint         tail;
+   GuestInfoHiResSample  ring[GUEST_INFO_HIRES_RING_SIZE];
+
+   /* Stats poll only. */
+   gint                  droppedReported;
+} GuestInfoHiRes;
+
+static GuestInfoHiRes *gHiRes = NULL;
+
+/* The configuration gHiRes was set up from. */
+static gint gHiResPeriod = 0;
+static gchar *gHiResStats = NULL;
 
 
 /*
@@ -236,42 +395,150 @@ GuestInfoIsBlockDevice(const char *name)  // IN:
 /*
  *----------------------------------------------------------------------
  *
- * GuestInfoGetUpTime --
+ * GuestInfoReadFile --
  *
- *      What time is it?
+ *      Read a whole /proc file into the reader buffer and NUL-terminate it.
  *
  * Results:
- *      TRUE   Success! *now is populated
- *      FALSE  Failure! *now remains unchanged
+ *      The file contents, valid until the next read. NULL on failure.
  *
  * Side effects:
- *      None.
+ *      The reader buffer may be grown.
  *
  *----------------------------------------------------------------------
  */
 
-static Bool
-GuestInfoGetUpTime(double *now)  // OUT:
+static char *
+GuestInfoReadFile(GuestInfoProcReader *reader,  // IN/OUT:
+                  const char *pathName)         // IN:
 {
-   char line[512];
-   Bool result = FALSE;
-   FILE *fp = Posix_Fopen(UPTIME_FILE, "r");
+   size_t len = 0;
+   int fd = Posix_Open(pathName, O_RDONLY);
 
-   if (fp == NULL) {
-      return result;
+   if (fd < 0) {
+      return NULL;
    }
 
-   if (fgets(line, sizeof line, fp) == line) {
-      double idle;
+   for (;;) {
+      ssize_t n;
+
+      /* Keep room for the terminating NUL. */
+      if (reader->readBufSize - len < 2) {
+         reader->readBufSize = (reader->readBufSize == 0) ?
+                                  4 * GUEST_INFO_PREALLOC_SIZE :
+                                  2 * reader->readBufSize;
+         reader->readBuf = Util_SafeRealloc(reader->readBuf,
+                                            reader->readBufSize);
+      }
 
-      if (sscanf(line, "%lf %lf", now, &idle) == 2) {
-         result = TRUE;
+      n = read(fd, reader->readBuf + len, reader->readBufSize - len - 1);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         close(fd);
+         return NULL;
       }
+      if (n == 0) {
+         break;
+      }
+      len += n;
+   }
+
+   close(fd);
+   reader->readBuf[len] = '\0';
+
+   return reader->readBuf;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoNextLine --
+ *
+ *      Split the next line off a buffer read by GuestInfoReadFile.
+ *
+ * Results:
+ *      The line, NUL-terminated, or NULL at the end of the buffer.
+ *
+ * Side effects:
+ *      *cursor is advanced past the line.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+GuestInfoNextLine(char **cursor)  // IN/OUT:
+{
+   char *line = *cursor;
+   char *end;
+
+   if (line == NULL || *line == '\0') {
+      return NULL;
    }
 
-   fclose(fp);
+   end = strchr(line, '\n');
+   if (end != NULL) {
+      *end++ = '\0';
+   }
+   *cursor = end;
+
+   return line;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoLookupStat --
+ *
+ *      Find the stat of a report ID.
+ *
+ * Results:
+ *      The stat, or NULL if the ID is not collected.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static GuestInfoStat *
+GuestInfoLookupStat(GuestInfoCollector *collector,  // IN:
+                    GuestStatToolsID reportID)      // IN:
+{
+   ASSERT(reportID < GuestStatID_Max);
+
+   return collector->reportMap[reportID];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoGetUpTime --
+ *
+ *      What time is it?
+ *
+ * Results:
+ *      TRUE   Success! *now is populated
+ *      FALSE  Failure! *now remains unchanged
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+GuestInfoGetUpTime(GuestInfoProcReader *reader,  // IN/OUT:
+                   double *now)                  // OUT:
+{
+   double idle;
+   const char *data = GuestInfoReadFile(reader, UPTIME_FILE);
 
-   return result;
+   return data != NULL && sscanf(data, "%lf %lf", now, &idle) == 2;
 }
 
 
@@ -346,13 +613,7 @@ GuestInfoStoreStatByID(GuestStatToolsID reportID,      // IN:
                        GuestInfoCollector *collector,  // IN/OUT:
                        uint64 value)                   // IN:
 {
-   GuestInfoStat *stat = NULL;
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(reportID),
-                    (void **) &stat);
-
-   GuestInfoStoreStat(stat, value);
+   GuestInfoStoreStat(GuestInfoLookupStat(collector, reportID), value);
 }
 
 
@@ -361,7 +622,7 @@ GuestInfoStoreStatByID(GuestStatToolsID reportID,      // IN:
  *
  * GuestInfoCollectStat --
  *
- *      Collect a stat.
+ *      Collect a stat from a field of a /proc file.
  *
  *      NOTE: Exact match data cannot be used in a regExp. This is a
  *            performance choice.
@@ -376,30 +637,25 @@ GuestInfoStoreStatByID(GuestStatToolsID reportID,      // IN:
  */
 
 static void
-GuestInfoCollectStat(const char *pathName,           // IN:
-                     GuestInfoCollector *collector,  // IN/OUT:
+GuestInfoCollectStat(const GuestInfoSource *source,  // IN:
                      const char *fieldName,          // IN:
                      uint64 value)                   // IN:
 {
    GuestInfoStat *stat = NULL;
-   char *key = Str_SafeAsprintf(NULL, KEY_FORMAT, pathName, fieldName);
 
-   if (!HashTable_Lookup(collector->exactMatches, key, (void **) &stat)) {
+   if (!HashTable_Lookup(source->exactMatches, fieldName, (void **) &stat)) {
       uint32 i;
 
-      for (i = 0; i < collector->numRegExps; i++) {
-         GuestInfoStat *thisOne = collector->regExps[i];
+      for (i = 0; i < source->numRegExps; i++) {
+         GuestInfoStat *thisOne = source->regExps[i];
 
-         if (strcmp(pathName, thisOne->query->sourceFile) == 0 &&
-             StrUtil_StartsWith(fieldName, thisOne->query->locatorString)) {
+         if (StrUtil_StartsWith(fieldName, thisOne->query->locatorString)) {
             stat = thisOne;
             break;
          }
       }
    }
 
-   free(key);
-
    if (stat != NULL) {
       GuestInfoStoreStat(stat, value);
    }
@@ -411,7 +667,8 @@ GuestInfoCollectStat(const char *pathName,           // IN:
  *
  * GuestInfoProcData --
  *
- *      Reads a "stat file" and contributes to the collection.
+ *      Reads a "stat file" and contributes to the collection, through the
+ *      field map of the source.
  *
  *      NOTE: If caller specifies a fieldSeparator, it has to be present
  *            in the fieldName being parsed. '\0' represents an unspecified
@@ -428,24 +685,19 @@ GuestInfoCollectStat(const char *pathName,           // IN:
  */
 
 static Bool
-GuestInfoProcData(const char *pathName,           // IN: path name
-                  char fieldSeparator,            // IN/OPT:
-                  GuestInfoCollector *collector)  // IN/OUT:
+GuestInfoProcData(const GuestInfoSource *source,  // IN:
+                  GuestInfoProcReader *reader)    // IN/OUT:
 {
-   char line[4096];  // Close to length of /proc/stat intr line
-   FILE *fp = Posix_Fopen(pathName, "r");
+   char *line;
+   char *cursor = GuestInfoReadFile(reader, source->pathName);
+   char fieldSeparator = source->fieldSeparator;
 
-   if (fp == NULL) {
-      g_warning("%s: Error opening %s.\n", __FUNCTION__, pathName);
+   if (cursor == NULL) {
+      g_warning("%s: Error reading %s.\n", __FUNCTION__, source->pathName);
       return FALSE;
    }
 
-   /*
-    * If a line inside the file is longer than what the buffer can hold,
-    * fgets still succeeds, the next fgets call continues at the previously
-    * stopped location in the line.
-    */
-   while (fgets(line, sizeof line, fp) == line) {
+   while ((line = GuestInfoNextLine(&cursor)) != NULL) {
       uint64 value = 0;
       char *savedPtr = NULL;
       char *fieldName = strtok_r(line, " \t", &savedPtr);
@@ -473,11 +725,9 @@ GuestInfoProcData(const char *pathName,           // IN: path name
          continue;
       }
 
-      GuestInfoCollectStat(pathName, collector, fieldName, value);
+      GuestInfoCollectStat(source, fieldName, value);
    }
 
-   fclose(fp);
-
    return TRUE;
 }
 
@@ -503,44 +753,37 @@ GuestInfoProcData(const char *pathName,           // IN: path name
 
 static Bool
 GuestInfoProcSimpleValue(GuestStatToolsID reportID,      // IN:
-                         GuestInfoCollector *collector)  // IN/OUT:
+                         GuestInfoCollector *collector,  // IN/OUT:
+                         GuestInfoProcReader *reader)    // IN/OUT:
 {
-   char line[512];
+   const char *data;
    uint64 value;
-   FILE *fp;
-   Bool success = FALSE;
-   GuestInfoStat *stat = NULL;
+   GuestInfoStat *stat = GuestInfoLookupStat(collector, reportID);
 
-   HashTable_Lookup(collector->reportMap, INT_AS_HASHKEY(reportID),
-                    (void **) &stat);
    ASSERT(stat);
    if (stat == NULL) {
       g_warning("%s: Error stat ID %d not found.\n", __FUNCTION__, reportID);
-      return success;
+      return FALSE;
    }
 
    ASSERT(stat->query->sourceFile);
-   fp = Posix_Fopen(stat->query->sourceFile, "r");
-   if (fp == NULL) {
-      g_warning("%s: Error opening %s.\n",
+   data = GuestInfoReadFile(reader, stat->query->sourceFile);
+   if (data == NULL) {
+      g_warning("%s: Error reading %s.\n",
                 __FUNCTION__, stat->query->sourceFile);
-      return success;
+      return FALSE;
    }
 
-   if (fgets(line, sizeof line, fp) == line) {
-      value = 0;
-      if (sscanf(line, "%"FMT64"u", &value) == 1) {
-         stat->err = 0;
-         stat->count = 1;
-         stat->value = value;
-
-         success = TRUE;
-      }
+   value = 0;
+   if (sscanf(data, "%"FMT64"u", &value) != 1) {
+      return FALSE;
    }
 
-   fclose(fp);
+   stat->err = 0;
+   stat->count = 1;
+   stat->value = value;
 
-   return success;
+   return TRUE;
 }
 #endif
 
@@ -568,26 +811,14 @@ GuestInfoDeriveSwapData(GuestInfoCollector *collector)  // IN/OUT:
    uint64 swapFree = 0;
    uint64 swapTotal = 0;
    uint64 swapUsed = 0;
-   GuestInfoStat *swapSpaceRemaining = NULL;
-   GuestInfoStat *swapSpaceUsed = NULL;
-   GuestInfoStat *swapFilesCurrent = NULL;
-   GuestInfoStat *swapFilesMax = NULL;
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapFilesMax),
-                    (void **) &swapFilesMax);
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapFilesCurrent),
-                    (void **) &swapFilesCurrent);
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapSpaceUsed),
-                    (void **) &swapSpaceUsed);
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapSpaceRemaining),
-                    (void **) &swapSpaceRemaining);
+   GuestInfoStat *swapSpaceRemaining =
+      GuestInfoLookupStat(collector, GuestStatID_SwapSpaceRemaining);
+   GuestInfoStat *swapSpaceUsed =
+      GuestInfoLookupStat(collector, GuestStatID_SwapSpaceUsed);
+   GuestInfoStat *swapFilesCurrent =
+      GuestInfoLookupStat(collector, GuestStatID_SwapFilesCurrent);
+   GuestInfoStat *swapFilesMax =
+      GuestInfoLookupStat(collector, GuestStatID_SwapFilesMax);
 
    /*
     * Start by getting SwapTotal (from Id_SwapFilesCurrent).
@@ -643,11 +874,8 @@ GuestInfoDeriveSwapData(GuestInfoCollector *collector)  // IN/OUT:
 static void
 GuestInfoDecreaseCpuRunQueueByOne(GuestInfoCollector *collector)  // IN/OUT:
 {
-   GuestInfoStat *stat = NULL;
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_Linux_CpuRunQueue),
-                    (void **) &stat);
+   GuestInfoStat *stat =
+      GuestInfoLookupStat(collector, GuestStatID_Linux_CpuRunQueue);
 
    ASSERT(stat != NULL);
    ASSERT(stat->err == 0);
@@ -679,29 +907,29 @@ GuestInfoDecreaseCpuRunQueueByOne(GuestInfoCollector *collector)  // IN/OUT:
  */
 
 static Bool
-GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
+GuestInfoProcDiskStatsData(GuestInfoCollector *collector,  // IN/OUT:
+                           GuestInfoProcReader *reader)    // IN/OUT:
 {
-   static int curr = 0;
-
+   int curr = reader->diskStatsCurr;
    int prev;
    GuestInfoDiskStatsList **listItem;
    uint64 inflightIOsSum;
    Bool setStats; // Only when no disk device change in between
 
-   char line[512];
-   FILE *fp = Posix_Fopen(DISKSTATS_FILE, "r");
+   char *line;
+   char *cursor = GuestInfoReadFile(reader, DISKSTATS_FILE);
 
-   if (fp == NULL) {
-      g_warning("%s: Error opening " DISKSTATS_FILE ".\n", __FUNCTION__);
+   if (cursor == NULL) {
+      g_warning("%s: Error reading " DISKSTATS_FILE ".\n", __FUNCTION__);
       return FALSE;
    }
 
    prev = curr ^ 1;  // curr = 0 => prev = 1; curr = 1 => prev = 0
-   listItem = &gDiskStatsList;
+   listItem = &reader->diskStatsList;
    inflightIOsSum = 0;
-   setStats = (gDiskStatsList != NULL) ? TRUE : FALSE;
+   setStats = (reader->diskStatsList != NULL) ? TRUE : FALSE;
 
-   while (fgets(line, sizeof line, fp) == line) {
+   while ((line = GuestInfoNextLine(&cursor)) != NULL) {
       /*
        * Linux kernel diskstats_show format string:
        * "%4d %7d %s %lu %lu %lu %u %lu %lu %lu %u %u %u %u\n"
@@ -727,7 +955,12 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
                              &writeIOs,
                              &inflightIOs, &weightedTime);
       if (assignedCount != 5 ||
-          (readIOs == 0 && writeIOs == 0) ||
+          (readIOs == 0 && writeIOs == 0)) {
+         continue;
+      }
+
+      /* Devices already on the list are known to be block devices. */
+      if ((*listItem == NULL || strcmp((*listItem)->diskName, diskName) != 0) &&
           !GuestInfoIsBlockDevice(diskName)) {
          continue;
       }
@@ -759,17 +992,15 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
       listItem = &((*listItem)->next);
    }
 
-   fclose(fp);
-
-   if (listItem == &gDiskStatsList // No qualified disk device found
-       || *listItem != NULL) {     // Disk hot unplug at the end of the list
+   if (listItem == &reader->diskStatsList // No qualified disk device found
+       || *listItem != NULL) {            // Disk hot unplug at end of list
       GuestInfoDeleteDiskStatsList(*listItem);
       *listItem = NULL;
       setStats = FALSE;
    }
 
    if (setStats) {
-      GuestInfoDiskStatsList *currDiskStats = gDiskStatsList;
+      GuestInfoDiskStatsList *currDiskStats = reader->diskStatsList;
       uint64 weightedTimeDeltaSum = 0;
 
       while (currDiskStats != NULL) {
@@ -787,7 +1018,7 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
                              weightedTimeDeltaSum);
    }
 
-   curr = prev;
+   reader->diskStatsCurr = prev;
 
    return TRUE;
 }
@@ -796,9 +1027,9 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
 /*
  *----------------------------------------------------------------------
  *
- * GuestInfoCollect --
+ * GuestInfoResetCollector --
  *
- *      Fill the specified collector with as much sampled data as possible.
+ *      Mark all the stats of a collector as not collected.
  *
  * Results:
  *      None.
@@ -810,13 +1041,10 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
  */
 
 static void
-GuestInfoCollect(GuestInfoCollector *collector)  // IN/OUT:
+GuestInfoResetCollector(GuestInfoCollector *collector)  // IN/OUT:
 {
    uint32 i;
-   GuestInfoStat *stat;
-   uint64 pageSize = sysconf(_SC_PAGESIZE);
 
-   /* Reset all values */
    for (i = 0; i < collector->numStats; i++) {
       GuestInfoStat *stat = &collector->stats[i];
 
@@ -824,18 +1052,45 @@ GuestInfoCollect(GuestInfoCollector *collector)  // IN/OUT:
       stat->count = 0;
       stat->value = 0;
    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoCollect --
+ *
+ *      Fill the specified collector with as much sampled data as possible.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoCollect(GuestInfoCollector *collector,  // IN/OUT:
+                 GuestInfoProcReader *reader)    // IN/OUT:
+{
+   uint32 i;
+   GuestInfoStat *stat;
+   uint64 pageSize = sysconf(_SC_PAGESIZE);
+
+   GuestInfoResetCollector(collector);
 
    /* Collect new values */
-   GuestInfoProcData(MEMINFO_FILE, ':', collector);
-   GuestInfoProcData(VMSTAT_FILE, '\0', collector);
-   GuestInfoProcData(STAT_FILE, '\0', collector);
-   GuestInfoProcData(ZONEINFO_FILE, '\0', collector);
+   for (i = 0; i < N_SOURCES; i++) {
+      GuestInfoProcData(&collector->sources[i], reader);
+   }
 #if PUBLISH_EXPERIMENTAL_STATS
-   GuestInfoProcSimpleValue(GuestStatID_Linux_Swappiness, collector);
+   GuestInfoProcSimpleValue(GuestStatID_Linux_Swappiness, collector, reader);
    GuestInfoDeriveSwapData(collector);
 #endif
 
-   collector->timeData = GuestInfoGetUpTime(&collector->timeStamp);
+   collector->timeData = GuestInfoGetUpTime(reader, &collector->timeStamp);
 
    /*
     * We make sure physical page size is always present.
@@ -848,21 +1103,15 @@ GuestInfoCollect(GuestInfoCollector *collector)  // IN/OUT:
     * Attempt to fix up memPhysUsable if it is not available.
     */
 
-   stat = NULL;
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_MemPhysUsable),
-                    (void **) &stat);
+   stat = GuestInfoLookupStat(collector, GuestStatID_MemPhysUsable);
 
    ASSERT(stat != NULL);  // Must be in table
 
    if (stat->err == 0) {
       stat->value *= (pageSize / 1024); // Convert pages to KiB
    } else {
-      GuestInfoStat *memTotal = NULL;
-
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemTotal),
-                       (void **) &memTotal);
+      GuestInfoStat *memTotal =
+         GuestInfoLookupStat(collector, GuestStatID_Linux_MemTotal);
 
       if ((memTotal != NULL) && (memTotal->err == 0)) {
          stat->err = 0;
@@ -873,7 +1122,7 @@ GuestInfoCollect(GuestInfoCollector *collector)  // IN/OUT:
 
    GuestInfoDeriveMemNeeded(collector);
    GuestInfoDecreaseCpuRunQueueByOne(collector);
-   GuestInfoProcDiskStatsData(collector);
+   GuestInfoProcDiskStatsData(collector, reader);
 }
 
 
@@ -904,20 +1153,14 @@ GuestInfoLegacy(GuestInfoCollector *current,  // IN: current collection
    legacy->version = GUESTMEMINFO_V5;
    legacy->flags   = 0;
 
-   stat = NULL;
-   HashTable_Lookup(current->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_MemPhysUsable),
-                    (void **) &stat);
+   stat = GuestInfoLookupStat(current, GuestStatID_MemPhysUsable);
 
    if ((stat != NULL) && (stat->err == 0)) {
       legacy->memTotal = stat->value;
       legacy->flags |= MEMINFO_MEMTOTAL;
    }
 
-   stat = NULL;
-   HashTable_Lookup(current->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_Linux_HugePagesTotal),
-                    (void **) &stat);
+   stat = GuestInfoLookupStat(current, GuestStatID_Linux_HugePagesTotal);
 
    if ((stat != NULL) && (stat->err == 0)) {
       legacy->hugePagesTotal = stat->value;
@@ -963,7 +1206,8 @@ GuestInfoBytesNeededUIntDatum(uint64 value)  // IN:
  * GuestInfoAppendStat --
  *
  *      Append information about the specified stat to the DynBuf of stat
- *      data.
+ *      data. The name space is only emitted when one is given; the stat
+ *      otherwise belongs to the name space of the previous one.
  *
  * Results:
  *      None.
@@ -976,7 +1220,7 @@ GuestInfoBytesNeededUIntDatum(uint64 value)  // IN:
 
 static void
 GuestInfoAppendStat(int errnoValue,                // IN:
-                    Bool emitNameSpace,            // IN:
+                    const char *nameSpace,         // IN/OPT:
                     GuestStatToolsID reportID,     // IN:
                     GuestValueUnits units,         // IN:
                     GuestValueType valueType,      // IN:
@@ -984,7 +1228,6 @@ GuestInfoAppendStat(int errnoValue,                // IN:
                     size_t valueSize,              // IN:
                     DynBuf *stats)                 // IN/OUT:
 {
-   const char *NameSpace = GUEST_TOOLS_NAMESPACE;
    uint64 value64;
    GuestStatHeader header;
    GuestDatumHeader datum;
@@ -992,7 +1235,7 @@ GuestInfoAppendStat(int errnoValue,                // IN:
    header.datumFlags = GUEST_DATUM_ID |
                        GUEST_DATUM_VALUE_TYPE_ENUM |
                        GUEST_DATUM_VALUE_UNIT_ENUM;
-   if (emitNameSpace) {
+   if (nameSpace != NULL) {
       header.datumFlags |= GUEST_DATUM_NAMESPACE;
    }
    if (errnoValue == 0) {
@@ -1001,10 +1244,10 @@ GuestInfoAppendStat(int errnoValue,                // IN:
    DynBuf_Append(stats, &header, sizeof header);
 
    if (header.datumFlags & GUEST_DATUM_NAMESPACE) {
-      size_t nameSpaceLen = strlen(NameSpace) + 1;
+      size_t nameSpaceLen = strlen(nameSpace) + 1;
       datum.dataSize = nameSpaceLen;
       DynBuf_Append(stats, &datum, sizeof datum);
-      DynBuf_Append(stats, NameSpace, nameSpaceLen);
+      DynBuf_Append(stats, nameSpace, nameSpaceLen);
    }
 
    if (header.datumFlags & GUEST_DATUM_ID) {
@@ -1039,84 +1282,151 @@ GuestInfoAppendStat(int errnoValue,                // IN:
 /*
  *----------------------------------------------------------------------
  *
- * GuestInfoAppendRate --
+ * GuestInfoStatChanged --
  *
- *      Compute a rate and then append it to the stat buffer.
+ *      Check a stat against what was last sent for it, for the delta mode.
  *
  * Results:
- *      None.
+ *      TRUE if the stat must be sent. Always TRUE if sent is NULL.
  *
  * Side effects:
- *      None.
+ *      Records the stat as sent.
  *
  *----------------------------------------------------------------------
  */
 
-static void
-GuestInfoAppendRate(Bool emitNameSpace,             // IN:
-                    GuestStatToolsID reportID,      // IN: ID of the stat
-                    GuestInfoCollector *current,    // IN: current collection
-                    GuestInfoCollector *previous,   // IN: previous collection
-                    DynBuf *statBuf)                // IN/OUT: stat data
+static Bool
+GuestInfoStatChanged(GuestInfoSentStat *sent,  // IN/OUT/OPT:
+                     int errnoValue,           // IN:
+                     uint64 value)             // IN:
 {
-   double valueDouble = 0.0;
-   int errnoValue = ENOENT;
-   GuestInfoStat *currentStat = NULL;
-   GuestInfoStat *previousStat = NULL;
+   if (sent == NULL) {
+      return TRUE;
+   }
+
+   if (sent->sent && sent->err == errnoValue && sent->value == value) {
+      return FALSE;
+   }
+
+   sent->sent = TRUE;
+   sent->err = errnoValue;
+   sent->value = value;
+
+   return TRUE;
+}
 
-   HashTable_Lookup(current->reportMap,
-                    INT_AS_HASHKEY(reportID),
-                    (void **) &currentStat);
 
-   HashTable_Lookup(previous->reportMap,
-                    INT_AS_HASHKEY(reportID),
-                    (void **) &previousStat);
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoComputeRate --
+ *
+ *      Compute a rate from two collections.
+ *
+ * Results:
+ *      0 and *rate set on success, ENOENT if the data is missing.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GuestInfoComputeRate(GuestStatToolsID reportID,      // IN: ID of the stat
+                     GuestInfoCollector *current,    // IN: current collection
+                     GuestInfoCollector *previous,   // IN: previous collection
+                     double *rate)                   // OUT:
+{
+   GuestInfoStat *currentStat = GuestInfoLookupStat(current, reportID);
+   GuestInfoStat *previousStat = GuestInfoLookupStat(previous, reportID);
+   double timeDelta;
+   double valueDelta;
+
+   if (!current->timeData ||
+       !previous->timeData ||
+       ((currentStat == NULL) || (currentStat->err != 0)) ||
+       ((previousStat == NULL) || (previousStat->err != 0))) {
+      return ENOENT;
+   }
 
-   if (current->timeData &&
-       previous->timeData &&
-       ((currentStat != NULL) && (currentStat->err == 0)) &&
-       ((previousStat != NULL) && (previousStat->err == 0))) {
-      double timeDelta = current->timeStamp - previous->timeStamp;
-      double valueDelta;
+   timeDelta = current->timeStamp - previous->timeStamp;
 
+   /*
+    * DiskRequestQueueAvg GuestInfoStat::value is weighted number of
+    * milliseconds delta in uint64 type, need to divide it by 1000 to
+    * turn the number in seconds.
+    *
+    * Host side drops the fraction part of double data type. Therefore,
+    * we preserve 2 decimal points by scaling up the value 100x.
+    * The consumers of this stat need to divide it by 100 to retrieve
+    * two digits after decimal point.
+    *
+    * (value / 1000) * 100 = value / 10
+    */
+   if (reportID == GuestStatID_Linux_DiskRequestQueueAvg) {
+      valueDelta = ((double)(currentStat->value)) / 10;
+   } else {
       /*
-       * DiskRequestQueueAvg GuestInfoStat::value is weighted number of
-       * milliseconds delta in uint64 type, need to divide it by 1000 to
-       * turn the number in seconds.
-       *
-       * Host side drops the fraction part of double data type. Therefore,
-       * we preserve 2 decimal points by scaling up the value 100x.
-       * The consumers of this stat need to divide it by 100 to retrieve
-       * two digits after decimal point.
-       *
-       * (value / 1000) * 100 = value / 10
+       * The /proc FS stat can be uint32 type in the kernel on both x86
+       * and x64 Linux, it is parsed and stored as uint64 in tools, so we
+       * also need to handle uint32 overflow here.
        */
-      if (reportID == GuestStatID_Linux_DiskRequestQueueAvg) {
-         valueDelta = ((double)(currentStat->value)) / 10;
+      if (currentStat->value < previousStat->value &&
+          previousStat->value <= MAX_UINT32) {
+         valueDelta = (uint32)(currentStat->value) -
+                      (uint32)(previousStat->value);
       } else {
-         /*
-          * The /proc FS stat can be uint32 type in the kernel on both x86
-          * and x64 Linux, it is parsed and stored as uint64 in tools, so we
-          * also need to handle uint32 overflow here.
-          */
-         if (currentStat->value < previousStat->value &&
-             previousStat->value <= MAX_UINT32) {
-            valueDelta = (uint32)(currentStat->value) -
-                         (uint32)(previousStat->value);
-         } else {
-            valueDelta = currentStat->value - previousStat->value;
-         }
+         valueDelta = currentStat->value - previousStat->value;
       }
+   }
 
-      valueDouble = valueDelta / timeDelta;
+   *rate = valueDelta / timeDelta;
 
-      errnoValue = 0;
-   }
+   return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoAppendRate --
+ *
+ *      Compute a rate and then append it to the stat buffer, unless it did
+ *      not change since it was last sent.
+ *
+ * Results:
+ *      TRUE if the rate was appended.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+GuestInfoAppendRate(const char *nameSpace,          // IN/OPT:
+                    GuestStatToolsID reportID,      // IN: ID of the stat
+                    GuestInfoCollector *current,    // IN: current collection
+                    GuestInfoCollector *previous,   // IN: previous collection
+                    GuestInfoSentStat *sent,        // IN/OUT/OPT: delta mode
+                    DynBuf *statBuf)                // IN/OUT: stat data
+{
+   double valueDouble = 0.0;
+   GuestInfoStat *currentStat = GuestInfoLookupStat(current, reportID);
+   int errnoValue = GuestInfoComputeRate(reportID, current, previous,
+                                         &valueDouble);
 
    if (currentStat != NULL) {
       float valueFloat;
       void *valuePointer;
       size_t valueSize;
+      uint64 valueBits;
+
+      memcpy(&valueBits, &valueDouble, sizeof valueBits);
+      if (!GuestInfoStatChanged(sent, errnoValue, valueBits)) {
+         return FALSE;
+      }
 
       if (valueDouble == 0) {
          valuePointer = NULL;
@@ -1132,10 +1442,15 @@ GuestInfoAppendRate(Bool emitNameSpace,             // IN:
          }
       }
 
-      GuestInfoAppendStat(errnoValue, emitNameSpace, reportID,
+      GuestInfoAppendStat(errnoValue,
+                          nameSpace,
+                          reportID,
                           currentStat->query->units, GuestTypeDouble,
                           valuePointer, valueSize, statBuf);
+      return TRUE;
    }
+
+   return FALSE;
 }
 
 
@@ -1162,51 +1477,30 @@ GuestInfoDeriveMemNeeded(GuestInfoCollector *collector)  // IN/OUT:
    uint64 memNeeded;
    uint64 memNeededReservation;
    uint64 memAvailable = 0;
-   GuestInfoStat *memAvail = NULL;
-   GuestInfoStat *memPhysUsable = NULL;
-
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_MemPhysUsable),
-                    (void **) &memPhysUsable);
+   GuestInfoStat *memAvail =
+      GuestInfoLookupStat(collector, GuestStatID_Linux_MemAvailable);
+   GuestInfoStat *memPhysUsable =
+      GuestInfoLookupStat(collector, GuestStatID_MemPhysUsable);
 
    ASSERT(memPhysUsable != NULL);
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_Linux_MemAvailable),
-                    (void **) &memAvail);
-
    if ((memAvail != NULL) && (memAvail->err == 0)) {
       memAvailable = memAvail->value;
    } else {
-      GuestInfoStat *memFree = NULL;
-      GuestInfoStat *memCache = NULL;
-      GuestInfoStat *memBuffers = NULL;
-      GuestInfoStat *memActiveFile = NULL;
-      GuestInfoStat *memSlabReclaim = NULL;
-      GuestInfoStat *memInactiveFile = NULL;
-      GuestInfoStat *lowWaterMark = NULL;
-
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_MemFree),
-                       (void **) &memFree);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemCached),
-                       (void **) &memCache);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemBuffers),
-                       (void **) &memBuffers);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_MemActiveFileCache),
-                       (void **) &memActiveFile);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemSlabReclaim),
-                       (void **) &memSlabReclaim);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemInactiveFile),
-                       (void **) &memInactiveFile);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_LowWaterMark),
-                       (void **) &lowWaterMark);
+      GuestInfoStat *memFree =
+         GuestInfoLookupStat(collector, GuestStatID_MemFree);
+      GuestInfoStat *memCache =
+         GuestInfoLookupStat(collector, GuestStatID_Linux_MemCached);
+      GuestInfoStat *memBuffers =
+         GuestInfoLookupStat(collector, GuestStatID_Linux_MemBuffers);
+      GuestInfoStat *memActiveFile =
+         GuestInfoLookupStat(collector, GuestStatID_MemActiveFileCache);
+      GuestInfoStat *memSlabReclaim =
+         GuestInfoLookupStat(collector, GuestStatID_Linux_MemSlabReclaim);
+      GuestInfoStat *memInactiveFile =
+         GuestInfoLookupStat(collector, GuestStatID_Linux_MemInactiveFile);
+      GuestInfoStat *lowWaterMark =
+         GuestInfoLookupStat(collector, GuestStatID_Linux_LowWaterMark);
 
       if (((memFree != NULL) && (memFree->err == 0)) &&
           ((memCache != NULL) && (memCache->err == 0)) &&
@@ -1287,7 +1581,9 @@ GuestInfoDeriveMemNeeded(GuestInfoCollector *collector)  // IN/OUT:
  *
  * GuestInfoEncodeStats --
  *
- *      Encode the guest stats.
+ *      Encode the guest stats. In delta mode, only the stats that changed
+ *      since they were last sent are encoded, under GUEST_INFO_DELTA_NS,
+ *      except every GUEST_INFO_DELTA_RESYNC samples when they all are.
  *
  * Results:
  *      None.
@@ -1306,6 +1602,15 @@ GuestInfoEncodeStats(GuestInfoCollector *current,   // IN: current collection
    uint32 i;
    GuestMemInfoLegacy legacy;
    Bool emitNameSpace = TRUE;
+   const char *nameSpace = GUEST_INFO_DELTA_NS;
+
+   ASSERT(current->numStats == N_QUERIES);
+
+   if (!gDeltaStats || ++gSamplesSinceResync >= GUEST_INFO_DELTA_RESYNC) {
+      memset(gSentStats, 0, sizeof gSentStats);
+      gSamplesSinceResync = 0;
+      nameSpace = GUEST_TOOLS_NAMESPACE;
+   }
 
    /* Provide legacy data for backwards compatibility */
    GuestInfoLegacy(current, &legacy);
@@ -1315,19 +1620,26 @@ GuestInfoEncodeStats(GuestInfoCollector *current,   // IN: current collection
    /* Provide data in the new, extensible format. */
    for (i = 0; i < current->numStats; i++) {
       GuestInfoStat *stat = &current->stats[i];
+      GuestInfoSentStat *sent = gDeltaStats ? &gSentStats[i] : NULL;
 
       if (!*(stat->query->publish)) {
          continue;
       }
 
       if (stat->query->dataType == GuestTypeDouble) {
-         GuestInfoAppendRate(emitNameSpace, stat->query->reportID,
-                             current, previous, statBuf);
+         if (!GuestInfoAppendRate(emitNameSpace ? nameSpace : NULL,
+                                  stat->query->reportID,
+                                  current, previous, sent, statBuf)) {
+            continue;
+         }
       } else {
          ASSERT(stat->query->dataType == GuestTypeUint64);
          ASSERT((stat->query->units & GuestUnitsModifier_Rate) == 0);
+         if (!GuestInfoStatChanged(sent, stat->err, stat->value)) {
+            continue;
+         }
          GuestInfoAppendStat(stat->err,
-                             emitNameSpace,
+                             emitNameSpace ? nameSpace : NULL,
                              stat->query->reportID,
                              stat->query->units,
                              stat->query->dataType,
@@ -1361,9 +1673,14 @@ static void
 GuestInfoDestroyCollector(GuestInfoCollector *collector)  // IN:
 {
    if (collector != NULL) {
-      HashTable_Free(collector->exactMatches);
-      HashTable_Free(collector->reportMap);
-      free(collector->regExps);
+      uint32 i;
+
+      for (i = 0; i < N_SOURCES; i++) {
+         GuestInfoSource *source = &collector->sources[i];
+
+         HashTable_Free(source->exactMatches);
+         free(source->regExps);
+      }
       free(collector->stats);
       free(collector);
    }
@@ -1392,72 +1709,731 @@ GuestInfoConstructCollector(GuestInfoQuery *queries,  // IN:
                             uint32 numQueries)        // IN:
 {
    uint32 i;
-   uint32 regExp = 0;
+   uint32 j;
    GuestInfoCollector *collector = Util_SafeCalloc(1, sizeof *collector);
 
    if (collector == NULL) {
       return NULL;
    }
 
-   collector->reportMap = HashTable_Alloc(256, HASH_INT_KEY, NULL);
+   collector->numStats = numQueries;
+   collector->stats = Util_SafeCalloc(numQueries, sizeof *collector->stats);
 
-   collector->exactMatches = HashTable_Alloc(256,
-                                           HASH_STRING_KEY | HASH_FLAG_COPYKEY,
-                                             NULL);
-
-   collector->numRegExps = 0;
-   for (i = 0; i < numQueries; i++) {
-      if (queries[i].isRegExp) {
-         collector->numRegExps++;
-      }
+   if ((collector->numStats != 0) && (collector->stats == NULL)) {
+      GuestInfoDestroyCollector(collector);
+      return NULL;
    }
 
-   collector->numStats = numQueries;
-   collector->stats = Util_SafeCalloc(numQueries, sizeof *collector->stats);
-   collector->regExps = Util_SafeCalloc(collector->numRegExps,
+   /* Build the field map of each /proc file. */
+   for (j = 0; j < N_SOURCES; j++) {
+      GuestInfoSource *source = &collector->sources[j];
+
+      source->pathName = guestInfoSourceSpecTable[j].pathName;
+      source->fieldSeparator = guestInfoSourceSpecTable[j].fieldSeparator;
+      source->exactMatches = HashTable_Alloc(64, HASH_STRING_KEY, NULL);
+
+      source->numRegExps = 0;
+      for (i = 0; i < numQueries; i++) {
+         if (queries[i].isRegExp &&
+             strcmp(queries[i].sourceFile, source->pathName) == 0) {
+            source->numRegExps++;
+         }
+      }
+      source->regExps = Util_SafeCalloc(source->numRegExps,
                                         sizeof(GuestInfoStat *));
 
-   if ((collector->exactMatches == NULL) ||
-       (collector->reportMap == NULL) ||
-       ((collector->numRegExps != 0) && (collector->regExps == NULL)) ||
-       ((collector->numStats != 0) && (collector->stats == NULL))) {
-      GuestInfoDestroyCollector(collector);
-      return NULL;
-   }
+      if ((source->exactMatches == NULL) ||
+          ((source->numRegExps != 0) && (source->regExps == NULL))) {
+         GuestInfoDestroyCollector(collector);
+         return NULL;
+      }
 
-   regExp = 0;
+      source->numRegExps = 0;
+   }
 
    for (i = 0; i < numQueries; i++) {
       GuestInfoQuery *query = &queries[i];
       GuestInfoStat *stat = &collector->stats[i];
 
       ASSERT(query->reportID);
+      ASSERT(query->reportID < GuestStatID_Max);
 
       stat->query = query;
 
       if (query->isRegExp) {
          ASSERT(query->sourceFile);
          ASSERT(query->locatorString);
+      }
 
-         collector->regExps[regExp++] = stat;
-      } else {
-         if (query->sourceFile != NULL && query->locatorString != NULL) {
-            char *key = Str_SafeAsprintf(NULL, KEY_FORMAT, query->sourceFile,
-                                         query->locatorString);
-            HashTable_Insert(collector->exactMatches, key, stat);
-            free(key);
+      for (j = 0; j < N_SOURCES; j++) {
+         GuestInfoSource *source = &collector->sources[j];
+
+         if (query->sourceFile == NULL || query->locatorString == NULL ||
+             strcmp(query->sourceFile, source->pathName) != 0) {
+            continue;
+         }
+
+         /* The locator strings are static, no need to copy them. */
+         if (query->isRegExp) {
+            source->regExps[source->numRegExps++] = stat;
+         } else {
+            HashTable_Insert(source->exactMatches, query->locatorString,
+                             stat);
          }
       }
 
       /* The report lookup */
-      HashTable_Insert(collector->reportMap, INT_AS_HASHKEY(query->reportID),
-                       stat);
+      collector->reportMap[query->reportID] = stat;
    }
 
    return collector;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResFree --
+ *
+ *      Free a high resolution sampler, once its thread is done.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResFree(gpointer data)  // IN:
+{
+   GuestInfoHiRes *hiRes = data;
+
+   GuestInfoDestroyCollector(hiRes->current);
+   GuestInfoDestroyCollector(hiRes->previous);
+   GuestInfoDeleteDiskStatsList(hiRes->reader.diskStatsList);
+   free(hiRes->reader.readBuf);
+   if (hiRes->cond != NULL) {
+      g_cond_free(hiRes->cond);
+   }
+   if (hiRes->lock != NULL) {
+      g_mutex_free(hiRes->lock);
+   }
+   g_free(hiRes);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResCollect --
+ *
+ *      Collect the stats the high resolution sampler needs. Only the /proc
+ *      files of its stats are read.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResCollect(GuestInfoHiRes *hiRes,          // IN/OUT:
+                      GuestInfoCollector *collector)  // IN/OUT:
+{
+   uint32 i;
+
+   GuestInfoResetCollector(collector);
+
+   for (i = 0; i < N_SOURCES; i++) {
+      if (hiRes->sourceMask & (1 << i)) {
+         GuestInfoProcData(&collector->sources[i], &hiRes->reader);
+      }
+   }
+
+   /* /proc/uptime only has a 10ms resolution. */
+   collector->timeData = TRUE;
+   collector->timeStamp = (double) g_get_monotonic_time() / G_USEC_PER_SEC;
+
+   if (GuestInfoLookupStat(collector,
+                           GuestStatID_Linux_CpuRunQueue)->err == 0) {
+      GuestInfoDecreaseCpuRunQueueByOne(collector);
+   }
+
+   if (hiRes->diskStats) {
+      GuestInfoProcDiskStatsData(collector, &hiRes->reader);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResTakeSample --
+ *
+ *      Take a high resolution sample and push it to the ring. The oldest
+ *      sample is dropped if the ring is full.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResTakeSample(GuestInfoHiRes *hiRes)  // IN/OUT:
+{
+   uint32 i;
+   guint head = (guint) hiRes->head;
+   guint tail;
+   GuestInfoHiResSample *sample;
+   GuestInfoCollector *temp;
+
+   GuestInfoHiResCollect(hiRes, hiRes->current);
+
+   tail = (guint) g_atomic_int_get(&hiRes->tail);
+   if (head - tail >= GUEST_INFO_HIRES_RING_SIZE) {
+      /*
+       * If this fails, the poll just drained the ring, and there is room.
+       */
+      if (g_atomic_int_compare_and_exchange(&hiRes->tail, (gint) tail,
+                                            (gint) (tail + 1))) {
+         g_atomic_int_inc(&hiRes->dropped);
+      }
+   }
+
+   sample = &hiRes->ring[head & (GUEST_INFO_HIRES_RING_SIZE - 1)];
+   sample->validMask = 0;
+
+   for (i = 0; i < hiRes->numStats; i++) {
+      GuestInfoStat *stat = GuestInfoLookupStat(hiRes->current,
+                                                hiRes->ids[i]);
+
+      if (hiRes->queries[i]->dataType == GuestTypeDouble) {
+         if (GuestInfoComputeRate(hiRes->ids[i], hiRes->current,
+                                  hiRes->previous,
+                                  &sample->value[i]) != 0) {
+            continue;
+         }
+      } else if (stat->err == 0) {
+         sample->value[i] = (double) stat->value;
+      } else {
+         continue;
+      }
+      sample->validMask |= 1 << i;
+   }
+
+   /* Publish the sample; the poll does not read past head. */
+   g_atomic_int_set(&hiRes->head, (gint) (head + 1));
+
+   temp = hiRes->current;
+   hiRes->current = hiRes->previous;
+   hiRes->previous = temp;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResCheckBudget --
+ *
+ *      Account for the CPU time of a sample. Every
+ *      GUEST_INFO_HIRES_BUDGET_WINDOW samples, the sampling period is
+ *      doubled if the sampler used more than GUEST_INFO_HIRES_BUDGET_PERCENT
+ *      of a CPU.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May slow the sampler down.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResCheckBudget(GuestInfoHiRes *hiRes,  // IN/OUT:
+                          uint64 cost)            // IN: microseconds
+{
+   gint period = g_atomic_int_get(&hiRes->period);
+   uint64 budget;
+
+   hiRes->windowCost += cost;
+   if (++hiRes->windowSamples < GUEST_INFO_HIRES_BUDGET_WINDOW) {
+      return;
+   }
+
+   g_atomic_int_set(&hiRes->sampleCost,
+                    (gint) (hiRes->windowCost / hiRes->windowSamples));
+
+   budget = (uint64) hiRes->windowSamples * period * 1000 *
+            GUEST_INFO_HIRES_BUDGET_PERCENT / 100;
+   if (hiRes->windowCost > budget && period < GUEST_INFO_HIRES_MAX_PERIOD) {
+      period = MIN(2 * period, GUEST_INFO_HIRES_MAX_PERIOD);
+      g_atomic_int_set(&hiRes->period, period);
+      g_warning("%s: %"FMT64"u us of CPU per sample is over the %d%% budget, "
+                "sampling every %d ms.\n", __FUNCTION__,
+                hiRes->windowCost / hiRes->windowSamples,
+                GUEST_INFO_HIRES_BUDGET_PERCENT, period);
+   }
+
+   hiRes->windowCost = 0;
+   hiRes->windowSamples = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResRun --
+ *
+ *      Body of the high resolution sampler thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Runs until GuestInfoHiResInterrupt is called.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResRun(ToolsAppCtx *ctx,  // IN: unused
+                  gpointer data)     // IN:
+{
+   GuestInfoHiRes *hiRes = data;
+   GTimeVal deadline;
+
+   g_get_current_time(&deadline);
+
+   g_mutex_lock(hiRes->lock);
+   while (!hiRes->stop) {
+      struct timespec start;
+      struct timespec end;
+      GTimeVal now;
+
+      g_mutex_unlock(hiRes->lock);
+
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+      GuestInfoHiResTakeSample(hiRes);
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+      GuestInfoHiResCheckBudget(hiRes,
+                                (end.tv_sec - start.tv_sec) * 1000000LL +
+                                (end.tv_nsec - start.tv_nsec) / 1000);
+
+      /* Keep a steady cadence, unless the sampler fell behind. */
+      g_time_val_add(&deadline, g_atomic_int_get(&hiRes->period) * 1000L);
+      g_get_current_time(&now);
+      if (deadline.tv_sec < now.tv_sec ||
+          (deadline.tv_sec == now.tv_sec && deadline.tv_usec < now.tv_usec)) {
+         deadline = now;
+      }
+
+      g_mutex_lock(hiRes->lock);
+      while (!hiRes->stop &&
+             g_cond_timed_wait(hiRes->cond, hiRes->lock, &deadline)) {
+      }
+   }
+   g_mutex_unlock(hiRes->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResInterrupt --
+ *
+ *      Ask the high resolution sampler thread to stop.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResInterrupt(ToolsAppCtx *ctx,  // IN: unused
+                        gpointer data)     // IN:
+{
+   GuestInfoHiRes *hiRes = data;
+
+   g_mutex_lock(hiRes->lock);
+   hiRes->stop = TRUE;
+   g_cond_signal(hiRes->cond);
+   g_mutex_unlock(hiRes->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResStop --
+ *
+ *      Stop the high resolution sampler, if running. The thread pool frees
+ *      it once its thread is done.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResStop(void)
+{
+   if (gHiRes != NULL) {
+      GuestInfoHiResInterrupt(NULL, gHiRes);
+      gHiRes = NULL;
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResAddStat --
+ *
+ *      Add a stat, by name, to a high resolution sampler being set up.
+ *      Stats derived from other stats, and stats from files the sampler
+ *      does not read, are not supported.
+ *
+ * Results:
+ *      TRUE if the stat was added.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+GuestInfoHiResAddStat(GuestInfoHiRes *hiRes,  // IN/OUT:
+                      const char *name)       // IN:
+{
+   uint32 i;
+   uint32 j;
+   GuestInfoQuery *query = NULL;
+
+   for (i = 0; i < ARRAYSIZE(guestInfoStatNameTable); i++) {
+      if (strcmp(guestInfoStatNameTable[i].name, name) == 0) {
+         break;
+      }
+   }
+
+   if (i < ARRAYSIZE(guestInfoStatNameTable)) {
+      for (j = 0; j < N_QUERIES; j++) {
+         if (guestInfoQuerySpecTable[j].reportID ==
+             guestInfoStatNameTable[i].id) {
+            query = &guestInfoQuerySpecTable[j];
+            break;
+         }
+      }
+   }
+
+   if (query == NULL) {
+      g_warning("%s: Unknown stat %s.\n", __FUNCTION__, name);
+      return FALSE;
+   }
+
+   for (i = 0; i < hiRes->numStats; i++) {
+      if (hiRes->ids[i] == query->reportID) {
+         return TRUE;
+      }
+   }
+
+   if (hiRes->numStats == GUEST_INFO_HIRES_MAX_STATS) {
+      g_warning("%s: Too many stats, %s ignored.\n", __FUNCTION__, name);
+      return FALSE;
+   }
+
+   if (query->reportID == GuestStatID_Linux_DiskRequestQueue ||
+       query->reportID == GuestStatID_Linux_DiskRequestQueueAvg) {
+      hiRes->diskStats = TRUE;
+   } else {
+      /* zoneinfo is costly to parse and its stats are static or derived. */
+      for (j = 0; j < N_SOURCES; j++) {
+         if (query->sourceFile != NULL &&
+             strcmp(query->sourceFile, ZONEINFO_FILE) != 0 &&
+             strcmp(query->sourceFile,
+                    guestInfoSourceSpecTable[j].pathName) == 0) {
+            break;
+         }
+      }
+
+      if (j == N_SOURCES) {
+         g_warning("%s: Stat %s cannot be sampled at high resolution.\n",
+                   __FUNCTION__, name);
+         return FALSE;
+      }
+
+      hiRes->sourceMask |= 1 << j;
+   }
+
+   hiRes->ids[hiRes->numStats] = query->reportID;
+   hiRes->queries[hiRes->numStats] = query;
+   hiRes->numStats++;
+
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResConfigure --
+ *
+ *      Start, stop or restart the high resolution sampler according to the
+ *      configuration.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May start or stop the sampler thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResConfigure(ToolsAppCtx *ctx)  // IN:
+{
+   uint32 i;
+   gchar **names;
+   GuestInfoHiRes *hiRes;
+   gint period = g_key_file_get_integer(ctx->config,
+                                        CONFGROUPNAME_GUESTINFO,
+                                        CONFNAME_GUESTINFO_HIRESINTERVAL,
+                                        NULL);
+   gchar *stats = g_key_file_get_string(ctx->config,
+                                        CONFGROUPNAME_GUESTINFO,
+                                        CONFNAME_GUESTINFO_HIRESSTATS,
+                                        NULL);
+
+   if (stats == NULL) {
+      stats = g_strdup(GUEST_INFO_HIRES_DEFAULT_STATS);
+   }
+   if (period > 0) {
+      period = MAX(period, GUEST_INFO_HIRES_MIN_PERIOD);
+   } else {
+      period = 0;
+   }
+
+   /*
+    * Only act on a configuration change. A configuration that failed is
+    * not retried until it changes.
+    */
+   if (period == gHiResPeriod && g_strcmp0(stats, gHiResStats) == 0) {
+      g_free(stats);
+      return;
+   }
+
+   g_free(gHiResStats);
+   gHiResStats = stats;
+   gHiResPeriod = period;
+
+   GuestInfoHiResStop();
+
+   if (period == 0) {
+      g_info("High resolution stats disabled.\n");
+      return;
+   }
+
+   hiRes = g_malloc0(sizeof *hiRes);
+   hiRes->period = period;
+
+   names = g_strsplit_set(stats, ";, ", -1);
+   for (i = 0; names[i] != NULL; i++) {
+      if (*names[i] != '\0') {
+         GuestInfoHiResAddStat(hiRes, names[i]);
+      }
+   }
+   g_strfreev(names);
+
+   if (hiRes->numStats == 0) {
+      g_warning("%s: No stat to sample at high resolution.\n", __FUNCTION__);
+      goto exit;
+   }
+
+   hiRes->current = GuestInfoConstructCollector(guestInfoQuerySpecTable,
+                                                N_QUERIES);
+   hiRes->previous = GuestInfoConstructCollector(guestInfoQuerySpecTable,
+                                                 N_QUERIES);
+   if (hiRes->current == NULL || hiRes->previous == NULL) {
+      goto exit;
+   }
+
+   hiRes->lock = g_mutex_new();
+   hiRes->cond = g_cond_new();
+
+   if (!ToolsCorePool_StartThread(ctx, GuestInfoHiResRun,
+                                  GuestInfoHiResInterrupt, hiRes,
+                                  GuestInfoHiResFree)) {
+      g_warning("%s: Failed to start the sampler thread.\n", __FUNCTION__);
+      goto exit;
+   }
+
+   g_info("High resolution stats enabled, %u stats every %d ms.\n",
+          hiRes->numStats, period);
+   gHiRes = hiRes;
+   return;
+
+exit:
+   GuestInfoHiResFree(hiRes);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResCompare --
+ *
+ *      qsort comparator for doubles.
+ *
+ * Results:
+ *      <0, 0 or >0.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GuestInfoHiResCompare(const void *a,  // IN:
+                      const void *b)  // IN:
+{
+   double x = *(const double *) a;
+   double y = *(const double *) b;
+
+   return (x > y) - (x < y);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoHiResEncode --
+ *
+ *      Drain the high resolution samples taken since the previous stats
+ *      poll, and append the p50, p99 and max of each stat to the stat
+ *      buffer, each under its own name space.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory may be dynamically allocated (via DynBuf).
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoHiResEncode(DynBuf *statBuf)  // IN/OUT:
+{
+   static const char *nameSpaces[] = {
+      GUEST_INFO_HIRES_NS_P50,
+      GUEST_INFO_HIRES_NS_P99,
+      GUEST_INFO_HIRES_NS_MAX,
+   };
+   static const uint32 percentiles[] = { 50, 99, 100 };
+   static GuestInfoHiResSample samples[GUEST_INFO_HIRES_RING_SIZE];
+   double values[GUEST_INFO_HIRES_RING_SIZE];
+   double results[ARRAYSIZE(percentiles)][GUEST_INFO_HIRES_MAX_STATS];
+   uint32 counts[GUEST_INFO_HIRES_MAX_STATS];
+   GuestInfoHiRes *hiRes = gHiRes;
+   guint head;
+   guint tail;
+   guint numSamples;
+   gint dropped;
+   uint32 i;
+   uint32 k;
+
+   if (hiRes == NULL) {
+      return;
+   }
+
+   /*
+    * Copy the samples out, and hand their slots back to the sampler. If the
+    * sampler moved tail on meanwhile, it may have overwritten the oldest
+    * sample copied: copy again.
+    */
+   do {
+      guint pos;
+
+      tail = (guint) g_atomic_int_get(&hiRes->tail);
+      head = (guint) g_atomic_int_get(&hiRes->head);
+      numSamples = head - tail;
+      for (pos = 0; pos < numSamples; pos++) {
+         samples[pos] =
+            hiRes->ring[(tail + pos) & (GUEST_INFO_HIRES_RING_SIZE - 1)];
+      }
+   } while (!g_atomic_int_compare_and_exchange(&hiRes->tail, (gint) tail,
+                                               (gint) head));
+
+   for (i = 0; i < hiRes->numStats; i++) {
+      guint pos;
+
+      counts[i] = 0;
+      for (pos = 0; pos < numSamples; pos++) {
+         if (samples[pos].validMask & (1 << i)) {
+            values[counts[i]++] = samples[pos].value[i];
+         }
+      }
+
+      if (counts[i] == 0) {
+         continue;
+      }
+
+      /* Nearest rank percentiles. */
+      qsort(values, counts[i], sizeof values[0], GuestInfoHiResCompare);
+      for (k = 0; k < ARRAYSIZE(percentiles); k++) {
+         uint32 rank = (counts[i] * percentiles[k] + 99) / 100;
+
+         results[k][i] = values[MAX(rank, 1) - 1];
+      }
+   }
+
+   for (k = 0; k < ARRAYSIZE(percentiles); k++) {
+      const char *nameSpace = nameSpaces[k];
+
+      for (i = 0; i < hiRes->numStats; i++) {
+         if (counts[i] == 0) {
+            continue;
+         }
+
+         GuestInfoAppendStat(0, nameSpace, hiRes->ids[i],
+                             hiRes->queries[i]->units, GuestTypeDouble,
+                             &results[k][i], sizeof results[k][i], statBuf);
+         nameSpace = NULL;
+      }
+   }
+
+   dropped = g_atomic_int_get(&hiRes->dropped);
+   g_debug("%s: %u samples, %d dropped, %d us of CPU per sample, "
+           "every %d ms.\n", __FUNCTION__, numSamples,
+           dropped - hiRes->droppedReported,
+           g_atomic_int_get(&hiRes->sampleCost),
+           g_atomic_int_get(&hiRes->period));
+   hiRes->droppedReported = dropped;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1506,10 +2482,11 @@ GuestInfoTakeSample(DynBuf *statBuf)  // IN/OUT: inited, ready to fill
    }
 
    /* Collect the current data */
-   GuestInfoCollect(gCurrentCollector);
+   GuestInfoCollect(gCurrentCollector, &gProcReader);
 
    /* Encode the captured data */
    GuestInfoEncodeStats(gCurrentCollector, gPreviousCollector, statBuf);
+   GuestInfoHiResEncode(statBuf);
 
    /* Switch the collections for next time. */
    temp = gCurrentCollector;
@@ -1540,7 +2517,6 @@ gboolean
 GuestInfo_StatProviderPoll(gpointer data)
 {
    ToolsAppCtx *ctx = data;
-   DynBuf stats;
 
    g_debug("Entered guest info stats gather.\n");
 
@@ -1551,16 +2527,26 @@ GuestInfo_StatProviderPoll(gpointer data)
                                       NULL);
 #endif
 
+   gDeltaStats = g_key_file_get_boolean(ctx->config,
+                                        CONFGROUPNAME_GUESTINFO,
+                                        CONFNAME_GUESTINFO_DELTASTATS,
+                                        NULL);
+
+   GuestInfoHiResConfigure(ctx);
+
    /* Send the vmstats to the VMX. */
-   DynBuf_Init(&stats);
+   if (!gStatBufInited) {
+      DynBuf_Init(&gStatBuf);
+      gStatBufInited = TRUE;
+   }
+   DynBuf_SetSize(&gStatBuf, 0);
 
-   if (!GuestInfoTakeSample(&stats)) {
+   if (!GuestInfoTakeSample(&gStatBuf)) {
       g_warning("Failed to get vmstats.\n");
-   } else if (!GuestInfo_ServerReportStats(ctx, &stats)) {
+   } else if (!GuestInfo_ServerReportStats(ctx, &gStatBuf)) {
       g_warning("Failed to send vmstats.\n");
    }
 
-   DynBuf_Destroy(&stats);
    return TRUE;
 }
 
@@ -1571,7 +2557,6 @@ GuestInfo_StatProviderPoll(gpointer data)
  * GuestInfo_StatProviderShutdown --
  *
  *      Clean up the resource acquired by perfMonLinux.
- *      Nothing to do at the moment.
  *
  * Results:
  *      None.
@@ -1585,11 +2570,26 @@ GuestInfo_StatProviderPoll(gpointer data)
 void
 GuestInfo_StatProviderShutdown(void)
 {
-   GuestInfoDeleteDiskStatsList(gDiskStatsList);
-   gDiskStatsList = NULL;
+   GuestInfoHiResStop();
+   g_free(gHiResStats);
+   gHiResStats = NULL;
+   gHiResPeriod = 0;
+
+   GuestInfoDeleteDiskStatsList(gProcReader.diskStatsList);
 
    GuestInfoDestroyCollector(gCurrentCollector);
    gCurrentCollector = NULL;
    GuestInfoDestroyCollector(gPreviousCollector);
    gPreviousCollector = NULL;
+
+   free(gProcReader.readBuf);
+   memset(&gProcReader, 0, sizeof gProcReader);
+
+   if (gStatBufInited) {
+      DynBuf_Destroy(&gStatBuf);
+      gStatBufInited = FALSE;
+   }
+
+   memset(gSentStats, 0, sizeof gSentStats);
+   gSamplesSinceResync = 0;
 }
@@ -64,6 +64,8 @@
 #include <Security.h>
 #else
 #include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #endif
 
 #if defined(sun) || defined(__FreeBSD__) || defined(__APPLE__)
@@ -371,6 +373,50 @@ static uint32 listProcessesResultsKey = 1;
 
 static void VixToolsFreeCachedResult(gpointer p);
 
+/*
+ * Cursors of ListFiles. Paging through a directory sends one request per
+ * page, each with the index of the first entry wanted; the directory is
+ * kept open between pages, and each page reads on from where the previous
+ * one stopped, so that paging through a directory reads it once whatever
+ * its size. A request for an entry before the cursor's position reads the
+ * directory again from the start.
+ *
+ * The listing starts with '.' and '..', followed by the entries in the
+ * order the directory stream returns them. On Windows the cursor keeps
+ * the names of the whole listing instead.
+ *
+ * The protocol has no cursor id, so cursors are looked up by user,
+ * directory and pattern. A request for the first page always starts a
+ * new cursor.
+ */
+#define  VIX_TOOLS_LISTFILES_CURSOR_TTL          30     // seconds
+#define  VIX_TOOLS_LISTFILES_MAX_CURSORS         4
+
+typedef struct VixToolsListFilesCursor {
+   char *userName;
+   char *dirPathName;
+   char *pattern;              // NULL if no pattern
+   GRegex *regex;              // NULL if no pattern
+   Bool listingSingleFile;
+#if defined(_WIN32)
+   char **names;               // the listing without '.' and '..'
+   int numNames;
+#else
+   DIR *dir;                   // NULL if listing a single file
+#endif
+   int next;                   // index of the next entry to read
+   int first;                  // entries from first to next don't match,
+                               // except pending
+   char *pending;              // matching entry next - 1, not returned yet
+   int numMatches;             // matching entries in the whole listing
+   int matchesRead;            // matching entries before pending or next
+   gint64 expires;             // monotonic time, in microseconds
+} VixToolsListFilesCursor;
+
+static GPtrArray *listFilesCursors = NULL;
+
+static void VixToolsFreeListFilesCursor(gpointer p);
+
 /*
  * This structure is designed to implemente CreateTemporaryFile,
  * CreateTemporaryDirectory VI guest operations.
@@ -453,6 +499,13 @@ static void VixToolsPrintFileExtendedInfo(const char *filePathName,
                                           char **destPtr,
                                           char *endDestPtr);
 
+#if !defined(_WIN32)
+static Bool VixToolsPrintFileExtendedInfoAt(int dirFd,
+                                            const char *fileName,
+                                            char **destPtr,
+                                            char *endDestPtr);
+#endif
+
 static const char *fileInfoFormatString = "<FileInfo>"
                                           "<Name>%s</Name>"
                                           "<FileFlags>%d</FileFlags>"
@@ -754,6 +807,8 @@ VixTools_Initialize(Bool thisProcessRunsAsRootParam,
                                                      NULL,
                                                      VixToolsFreeCachedResult);
 
+   listFilesCursors = g_ptr_array_new_with_free_func(VixToolsFreeListFilesCursor);
+
 #if SUPPORT_VGAUTH
    /*
     * We don't set up the VGAuth log handler, since the default
@@ -804,6 +859,11 @@ VixTools_Uninitialize(void) // IN
    }
 
    HgfsServerManager_Unregister(&gVixHgfsBkdrConn);
+
+   if (NULL != listFilesCursors) {
+      g_ptr_array_free(listFilesCursors, TRUE);
+      listFilesCursors = NULL;
+   }
 }
 
 
@@ -5340,12 +5400,24 @@ VixToolsListProcessesExGenerateData(uint32 numPids,          // IN
     * The startedProcess list didn't give everything we need, so
     * ask the OS.
     *
-    * XXX Need a smarter version of ProcMgr_ListProcesses().
-    * It should allow a list of pids for optimization, and
-    * return an error code so there's no risk of errno/LastError
-    * being clobbered.
+    * XXX ProcMgr_ListProcesses() should return an error code so
+    * there's no risk of errno/LastError being clobbered.
     */
+#if defined(__linux__)
+   if (numPids > 0) {
+      ProcMgr_Pid *procPids = Util_SafeMalloc(numPids * sizeof *procPids);
+
+      for (i = 0; i < numPids; i++) {
+         procPids[i] = (ProcMgr_Pid) pids[i];
+      }
+      procList = ProcMgr_ListProcessesEx(procPids, numPids);
+      free(procPids);
+   } else {
+      procList = ProcMgr_ListProcesses();
+   }
+#else
    procList = ProcMgr_ListProcesses();
+#endif
    if (NULL == procList) {
       err = FoundryToolsDaemon_TranslateSystemErr();
       goto abort;
@@ -6272,6 +6344,452 @@ abort:
 } // VixToolsListDirectory
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsFreeListFilesCursor --
+ *
+ *    Frees a ListFiles cursor.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    Closes the directory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsFreeListFilesCursor(gpointer p)  // IN
+{
+   VixToolsListFilesCursor *cursor = p;
+#if defined(_WIN32)
+   int fileNum;
+#endif
+
+   if (NULL == cursor) {
+      return;
+   }
+
+#if defined(_WIN32)
+   for (fileNum = 0; fileNum < cursor->numNames; fileNum++) {
+      free(cursor->names[fileNum]);
+   }
+   free(cursor->names);
+#else
+   if (NULL != cursor->dir) {
+      closedir(cursor->dir);
+   }
+#endif
+   if (NULL != cursor->regex) {
+      g_regex_unref(cursor->regex);
+   }
+   free(cursor->pending);
+   free(cursor->userName);
+   free(cursor->dirPathName);
+   free(cursor->pattern);
+   free(cursor);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDropListFilesCursor --
+ *
+ *    Removes a cursor from listFilesCursors and frees it.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsDropListFilesCursor(int i)  // IN
+{
+   g_ptr_array_remove_index(listFilesCursors, i);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsFindListFilesCursor --
+ *
+ *    Drops the expired ListFiles cursors, and looks up the cursor of the
+ *    current user for the given directory and pattern.
+ *
+ * Return value:
+ *    The index of the cursor in listFilesCursors, or -1 if not found.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+VixToolsFindListFilesCursor(const char *dirPathName,  // IN
+                            const char *pattern)      // IN/OPT
+{
+   gint64 now = g_get_monotonic_time();
+   int i;
+
+   for (i = listFilesCursors->len - 1; i >= 0; i--) {
+      VixToolsListFilesCursor *cursor = g_ptr_array_index(listFilesCursors, i);
+
+      if (cursor->expires <= now) {
+         VixToolsDropListFilesCursor(i);
+      }
+   }
+
+   for (i = 0; i < listFilesCursors->len; i++) {
+      VixToolsListFilesCursor *cursor = g_ptr_array_index(listFilesCursors, i);
+
+      if (strcmp(cursor->userName, IMPERSONATED_USERNAME) == 0 &&
+          strcmp(cursor->dirPathName, dirPathName) == 0 &&
+          g_strcmp0(cursor->pattern, pattern) == 0) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsReadListFilesCursor --
+ *
+ *    Reads the next entry of the listing, whether it matches the pattern
+ *    or not.
+ *
+ * Return value:
+ *    TRUE and the name of the entry, to be freed by the caller, in *name.
+ *    FALSE at the end of the listing.
+ *
+ * Side effects:
+ *    Moves the cursor on by one entry.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsReadListFilesCursor(VixToolsListFilesCursor *cursor,  // IN/OUT
+                            char **name)                      // OUT
+{
+   if (cursor->listingSingleFile) {
+      if (cursor->next > 0) {
+         return FALSE;
+      }
+      *name = Util_SafeStrdup(cursor->dirPathName);
+   } else if (cursor->next < 2) {
+      /*
+       * The directory stream may return '.' and '..' anywhere, but we want
+       * them in front since that's a more normal location.
+       */
+      *name = Unicode_Alloc(cursor->next == 0 ? "." : "..",
+                            STRING_ENCODING_UTF8);
+   } else {
+#if defined(_WIN32)
+      if (cursor->next - 2 >= cursor->numNames) {
+         return FALSE;
+      }
+      *name = Util_SafeStrdup(cursor->names[cursor->next - 2]);
+#else
+      struct dirent *entry;
+
+      do {
+         errno = 0;
+         entry = readdir(cursor->dir);
+         if (NULL == entry) {
+            if (0 != errno) {
+               g_warning("%s: reading '%s' failed (%d)\n",
+                         __FUNCTION__, cursor->dirPathName, errno);
+            }
+            return FALSE;
+         }
+      } while (strcmp(entry->d_name, ".") == 0 ||
+               strcmp(entry->d_name, "..") == 0);
+
+      if (Unicode_IsBufferValid(entry->d_name, -1, STRING_ENCODING_DEFAULT)) {
+         *name = Unicode_Alloc(entry->d_name, STRING_ENCODING_DEFAULT);
+      } else {
+         *name = Unicode_Duplicate(UNICODE_SUBSTITUTION_CHAR
+                                   UNICODE_SUBSTITUTION_CHAR
+                                   UNICODE_SUBSTITUTION_CHAR);
+      }
+#endif
+   }
+
+   cursor->next++;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsRewindListFilesCursor --
+ *
+ *    Moves a cursor back to the start of the listing.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsRewindListFilesCursor(VixToolsListFilesCursor *cursor)  // IN/OUT
+{
+#if !defined(_WIN32)
+   if (NULL != cursor->dir) {
+      rewinddir(cursor->dir);
+   }
+#endif
+   free(cursor->pending);
+   cursor->pending = NULL;
+   cursor->next = 0;
+   cursor->first = 0;
+   cursor->matchesRead = 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsNextListFilesMatch --
+ *
+ *    Reads the next entry of the listing matching the pattern.
+ *
+ * Return value:
+ *    TRUE and the name of the entry, to be freed by the caller, in *name.
+ *    FALSE at the end of the listing.
+ *
+ * Side effects:
+ *    Moves the cursor past the entry.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsNextListFilesMatch(VixToolsListFilesCursor *cursor,  // IN/OUT
+                           char **name)                      // OUT
+{
+   if (NULL != cursor->pending) {
+      *name = cursor->pending;
+      cursor->pending = NULL;
+   } else {
+      while (TRUE) {
+         if (!VixToolsReadListFilesCursor(cursor, name)) {
+            return FALSE;
+         }
+         if (NULL == cursor->regex ||
+             g_regex_match(cursor->regex, *name, 0, NULL)) {
+            break;
+         }
+         free(*name);
+      }
+   }
+
+   cursor->matchesRead++;
+   cursor->first = cursor->next;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsUnreadListFilesMatch --
+ *
+ *    Puts back the entry last returned by VixToolsNextListFilesMatch, so
+ *    that the next page starts with it.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    Takes over name.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsUnreadListFilesMatch(VixToolsListFilesCursor *cursor,  // IN/OUT
+                             char *name)                       // IN
+{
+   ASSERT(NULL == cursor->pending);
+
+   cursor->pending = name;
+   cursor->matchesRead--;
+   cursor->first = cursor->next - 1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsSeekListFilesCursor --
+ *
+ *    Moves a cursor to the given index of the listing, so that the next
+ *    match it returns is the first one at or after that index.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    Reads the directory again from the start if the index is before the
+ *    entries the cursor may still return.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsSeekListFilesCursor(VixToolsListFilesCursor *cursor,  // IN/OUT
+                            int start)                        // IN
+{
+   char *name;
+
+   if (start < cursor->first) {
+      VixToolsRewindListFilesCursor(cursor);
+   }
+
+   if (NULL != cursor->pending && start >= cursor->next) {
+      free(cursor->pending);
+      cursor->pending = NULL;
+      cursor->matchesRead++;
+   }
+
+   while (cursor->next < start && VixToolsReadListFilesCursor(cursor, &name)) {
+      if (NULL == cursor->regex ||
+          g_regex_match(cursor->regex, name, 0, NULL)) {
+         cursor->matchesRead++;
+      }
+      free(name);
+   }
+   cursor->first = start;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsCreateListFilesCursor --
+ *
+ *    Opens a directory (or a single file) for listing, and counts the
+ *    entries matching the given pattern.
+ *
+ * Return value:
+ *    VixError
+ *
+ * Side effects:
+ *    The new cursor replaces any cursor for the same user, directory and
+ *    pattern, and the oldest cursor if there are too many.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VixError
+VixToolsCreateListFilesCursor(const char *dirPathName,             // IN
+                              const char *pattern,                 // IN/OPT
+                              VixToolsListFilesCursor **result)    // OUT
+{
+   VixError err = VIX_OK;
+   VixToolsListFilesCursor *cursor = NULL;
+   GError *gErr = NULL;
+   char *name;
+   int i;
+
+   cursor = Util_SafeCalloc(1, sizeof *cursor);
+
+   if (pattern) {
+      cursor->regex = g_regex_new(pattern, 0, 0, &gErr);
+      if (!cursor->regex) {
+         g_warning("%s: bad regex pattern '%s' (%s);"
+                   "failing with INVALID_ARG\n",
+                   __FUNCTION__, pattern, gErr ? gErr->message : "");
+         g_clear_error(&gErr);
+         err = VIX_E_INVALID_ARG;
+         goto abort;
+      }
+   }
+
+   cursor->userName = Util_SafeStrdup(IMPERSONATED_USERNAME);
+   cursor->dirPathName = Util_SafeStrdup(dirPathName);
+   cursor->pattern = (NULL != pattern) ? Util_SafeStrdup(pattern) : NULL;
+
+   /*
+    * First check for symlink -- File_IsDirectory() will lie
+    * if its a symlink to a directory.
+    */
+   if (!File_IsSymLink(dirPathName) && File_IsDirectory(dirPathName)) {
+#if defined(_WIN32)
+      cursor->numNames = File_ListDirectory(dirPathName, &cursor->names);
+      if (cursor->numNames < 0) {
+         cursor->numNames = 0;
+         err = FoundryToolsDaemon_TranslateSystemErr();
+         goto abort;
+      }
+#else
+      cursor->dir = Posix_OpenDir(dirPathName);
+      if (NULL == cursor->dir) {
+         err = FoundryToolsDaemon_TranslateSystemErr();
+         goto abort;
+      }
+#endif
+   } else if (File_Exists(dirPathName)) {
+      cursor->listingSingleFile = TRUE;
+   } else {
+      /*
+       * We don't know what they intended to list, but we'll
+       * assume file since that gives a fairly sane error.
+       */
+      err = FoundryToolsDaemon_TranslateSystemErr();
+      goto abort;
+   }
+
+   /*
+    * Run the pattern once over the whole listing to count the matches, for
+    * the number of entries remaining after each page.
+    */
+   while (VixToolsNextListFilesMatch(cursor, &name)) {
+      free(name);
+   }
+   cursor->numMatches = cursor->matchesRead;
+   VixToolsRewindListFilesCursor(cursor);
+
+   i = VixToolsFindListFilesCursor(dirPathName, pattern);
+   if (i >= 0) {
+      VixToolsDropListFilesCursor(i);
+   }
+   if (listFilesCursors->len >= VIX_TOOLS_LISTFILES_MAX_CURSORS) {
+      VixToolsDropListFilesCursor(0);
+   }
+   g_ptr_array_add(listFilesCursors, cursor);
+
+   *result = cursor;
+   cursor = NULL;
+
+abort:
+   VixToolsFreeListFilesCursor(cursor);
+
+   return err;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -6279,6 +6797,11 @@ abort:
  *
  *    This function is called to implement ListFilesInGuest VI Guest operation.
  *
+ *    The directory opened for the first page is kept in a cursor for the
+ *    following pages (see VixToolsListFilesCursor). On POSIX systems the
+ *    attributes of the entries are read relative to the open directory,
+ *    and the entries are printed directly into the reply until it is full.
+ *
  * Return value:
  *    VixError
  *
@@ -6296,12 +6819,8 @@ VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
    VixError err = VIX_OK;
    const char *dirPathName = NULL;
    char *fileList = NULL;
-   char **fileNameList = NULL;
-   size_t resultBufferSize = 0;
-   size_t lastGoodResultBufferSize = 0;
-   int numFiles = 0;
-   int fileNum;
    char *currentFileName;
+   char *bodyPtr;
    char *destPtr;
    char *endDestPtr;
    Bool impersonatingVMWareUser = FALSE;
@@ -6309,16 +6828,19 @@ VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
    VixMsgListFilesRequest *listRequest = NULL;
    Bool truncated = FALSE;
    uint64 offset = 0;
-   Bool listingSingleFile = FALSE;
    const char *pattern = NULL;
    int index = 0;
    int maxResults = 0;
    int count = 0;
    int remaining = 0;
-   int numResults;
-   GRegex *regex = NULL;
-   GError *gErr = NULL;
+   int start;
+   int cursorIndex;
+   int headerSize;
    char *pathName;
+   VixToolsListFilesCursor *cursor = NULL;
+#if !defined(_WIN32)
+   int dirFd = -1;
+#endif
    VMAutomationRequestParser parser;
 
    ASSERT(NULL != requestMsg);
@@ -6370,160 +6892,98 @@ VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
            (NULL != pattern) ? pattern : "",
            index, maxResults, (int) offset);
 
-   if (pattern) {
-      regex = g_regex_new(pattern, 0, 0, &gErr);
-      if (!regex) {
-         g_warning("%s: bad regex pattern '%s' (%s);"
-                   "failing with INVALID_ARG\n",
-                   __FUNCTION__, pattern, gErr ? gErr->message : "");
-         err = VIX_E_INVALID_ARG;
-         goto abort;
-      }
-   }
-
    /*
-    * First check for symlink -- File_IsDirectory() will lie
-    * if its a symlink to a directory.
+    * Read on from the previous pages, unless this is the first one.
     */
-   if (!File_IsSymLink(dirPathName) && File_IsDirectory(dirPathName)) {
-      numFiles = File_ListDirectory(dirPathName, &fileNameList);
-      if (numFiles < 0) {
-         err = FoundryToolsDaemon_TranslateSystemErr();
-         goto abort;
-      }
-      /*
-       * File_ListDirectory() doesn't return '.' and '..', but we want them,
-       * so add '.' and '..' to the list.  Place them in front since that's
-       * a more normal location.
-       */
-      numFiles += 2;
-      {
-         char **newFileNameList = NULL;
-
-         newFileNameList = Util_SafeMalloc(numFiles * sizeof(char *));
-         newFileNameList[0] = Unicode_Alloc(".", STRING_ENCODING_UTF8);
-         newFileNameList[1] = Unicode_Alloc("..", STRING_ENCODING_UTF8);
-         memcpy(newFileNameList + 2, fileNameList, (numFiles - 2) * sizeof(char *));
-         free(fileNameList);
-         fileNameList = newFileNameList;
-      }
+   start = offset + index;
+   cursorIndex = VixToolsFindListFilesCursor(dirPathName, pattern);
+   if (start > 0 && cursorIndex >= 0) {
+      cursor = g_ptr_array_index(listFilesCursors, cursorIndex);
    } else {
-      if (File_Exists(dirPathName)) {
-         listingSingleFile = TRUE;
-         numFiles = 1;
-         fileNameList = Util_SafeMalloc(sizeof(char *));
-         fileNameList[0] = Util_SafeStrdup(dirPathName);
-      } else {
-         /*
-          * We don't know what they intended to list, but we'll
-          * assume file since that gives a fairly sane error.
-          */
-         err = FoundryToolsDaemon_TranslateSystemErr();
+      err = VixToolsCreateListFilesCursor(dirPathName, pattern, &cursor);
+      if (VIX_OK != err) {
          goto abort;
       }
    }
+   cursor->expires = g_get_monotonic_time() +
+                     VIX_TOOLS_LISTFILES_CURSOR_TTL * G_USEC_PER_SEC;
+   VixToolsSeekListFilesCursor(cursor, start);
 
    /*
-    * Calculate the size of the result buffer and keep track of the
-    * max number of entries we can store.  Also compute the number
-    * we won't be returning (anything > maxResults).
+    * The header is only known once the entries are printed, so the entries
+    * are printed after room for the largest header, and moved next to the
+    * header at the end.
     */
-   resultBufferSize = 3; // truncation bool + space + '\0'
-   // space for the 'remaining' tag up front
-   resultBufferSize += strlen(listFilesRemainingFormatString) + 10;
-   lastGoodResultBufferSize = resultBufferSize;
-   ASSERT_NOT_IMPLEMENTED(lastGoodResultBufferSize < maxBufferSize);
+   headerSize = 2 + strlen(listFilesRemainingFormatString) + 10;
+   ASSERT_NOT_IMPLEMENTED(headerSize + 1 < maxBufferSize);
 
-   for (fileNum = offset + index;
-        fileNum < numFiles;
-        fileNum++) {
+   fileList = Util_SafeMalloc(maxBufferSize);
+   bodyPtr = fileList + headerSize;
+   destPtr = bodyPtr;
+   endDestPtr = fileList + maxBufferSize - 1;  // room for the final NUL
 
-      currentFileName = fileNameList[fileNum];
+#if !defined(_WIN32)
+   if (NULL != cursor->dir) {
+      dirFd = dirfd(cursor->dir);
+   }
+#endif
 
-      if (regex) {
-         if (!g_regex_match(regex, currentFileName, 0, NULL)) {
-            continue;
-         }
+   for (count = 0; count < maxResults; count++) {
+      if (!VixToolsNextListFilesMatch(cursor, &currentFileName)) {
+         break;
       }
 
-      if (count < maxResults) {
-         count++;
-      } else {
-         remaining++;
-         continue;   // stop computing buffersize
+#if !defined(_WIN32)
+      if (-1 != dirFd) {
+         if (!VixToolsPrintFileExtendedInfoAt(dirFd, currentFileName,
+                                              &destPtr, endDestPtr)) {
+            VixToolsUnreadListFilesMatch(cursor, currentFileName);
+            truncated = TRUE;
+            break;
+         }
+         free(currentFileName);
+         continue;
       }
+#endif
 
-      if (listingSingleFile) {
-         resultBufferSize += VixToolsGetFileExtendedInfoLength(currentFileName,
-                                                               currentFileName);
+      if (cursor->listingSingleFile) {
+         pathName = Util_SafeStrdup(currentFileName);
       } else {
          pathName = Str_SafeAsprintf(NULL, "%s%s%s", dirPathName, DIRSEPS,
                                      currentFileName);
-         resultBufferSize += VixToolsGetFileExtendedInfoLength(pathName,
-                                                               currentFileName);
-         free(pathName);
       }
 
-      if (resultBufferSize < maxBufferSize) {
-         lastGoodResultBufferSize = resultBufferSize;
-      } else {
+      if (VixToolsGetFileExtendedInfoLength(pathName, currentFileName) >=
+          endDestPtr - destPtr) {
+         free(pathName);
+         VixToolsUnreadListFilesMatch(cursor, currentFileName);
          truncated = TRUE;
          break;
       }
+      VixToolsPrintFileExtendedInfo(pathName, currentFileName,
+                                    &destPtr, endDestPtr);
+      free(pathName);
+      free(currentFileName);
    }
-   resultBufferSize = lastGoodResultBufferSize;
-   numResults = count;
 
    /*
-    * Print the result buffer.
+    * Compute the number we won't be returning (anything > maxResults).
+    * The directory may have changed since the matches were counted.
     */
-   fileList = Util_SafeMalloc(resultBufferSize);
-   destPtr = fileList;
-   endDestPtr = fileList + resultBufferSize;
+   if (!truncated && count >= maxResults) {
+      remaining = MAX(cursor->numMatches - cursor->matchesRead, 0);
+   }
 
    /*
     * Indicate if we have a truncated buffer with "1 ", otherwise "0 ".
     * This should only happen for non-legacy requests.
     */
-   if ((destPtr + 2) < endDestPtr) {
-      *destPtr++ = truncated ? '1' : '0';
-      *destPtr++ = ' ';
-   } else {
-      ASSERT(0);
-      err = VIX_E_OUT_OF_MEMORY;
-      goto abort;
-   }
-
-   destPtr += Str_Sprintf(destPtr, endDestPtr - destPtr,
-                          listFilesRemainingFormatString, remaining);
-
-
-   for (fileNum = offset + index, count = 0;
-        count < numResults;
-        fileNum++) {
-
-      currentFileName = fileNameList[fileNum];
-
-      if (regex) {
-         if (!g_regex_match(regex, currentFileName, 0, NULL)) {
-            continue;
-         }
-      }
-
-      if (listingSingleFile) {
-         pathName = Util_SafeStrdup(currentFileName);
-      } else {
-         pathName = Str_SafeAsprintf(NULL, "%s%s%s", dirPathName, DIRSEPS,
-                                     currentFileName);
-      }
-
-      VixToolsPrintFileExtendedInfo(pathName, currentFileName,
-                                    &destPtr, endDestPtr);
-
-      free(pathName);
-      count++;
-   } // for (fileNum = 0; fileNum < lastGoodNumFiles; fileNum++)
-   *destPtr = '\0';
+   fileList[0] = truncated ? '1' : '0';
+   fileList[1] = ' ';
+   headerSize = 2 + Str_Sprintf(fileList + 2, headerSize - 2,
+                                listFilesRemainingFormatString, remaining);
+   memmove(fileList + headerSize, bodyPtr, destPtr - bodyPtr);
+   fileList[headerSize + (destPtr - bodyPtr)] = '\0';
 
 abort:
    if (impersonatingVMWareUser) {
@@ -6531,22 +6991,11 @@ abort:
    }
    VixToolsLogoutUser(userToken);
 
-   if (NULL != regex) {
-      g_regex_unref(regex);
-   }
-
    if (NULL == fileList) {
       fileList = Util_SafeStrdup("");
    }
    *result = fileList;
 
-   if (NULL != fileNameList) {
-      for (fileNum = 0; fileNum < numFiles; fileNum++) {
-         free(fileNameList[fileNum]);
-      }
-      free(fileNameList);
-   }
-
    // XXX result too large for g_debug()
 
    g_message("%s: opcode %d returning %"FMT64"d\n", __FUNCTION__,
@@ -6556,6 +7005,7 @@ abort:
 } // VixToolsListFiles
 
 
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -7155,6 +7605,124 @@ VixToolsPrintFileExtendedInfo(const char *filePathName,     // IN
 } // VixToolsPrintFileExtendedInfo
 
 
+#if !defined(_WIN32)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsPrintFileExtendedInfoAt --
+ *
+ *    Like VixToolsPrintFileExtendedInfo(), but reads the attributes of the
+ *    file relative to an open directory, and doesn't print anything if the
+ *    entry doesn't fit in the buffer.
+ *
+ * Return value:
+ *    FALSE if the entry doesn't fit.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsPrintFileExtendedInfoAt(int dirFd,                    // IN
+                                const char *fileName,         // IN
+                                char **destPtr,               // IN/OUT
+                                char *endDestPtr)             // IN
+{
+   int64 fileSize = 0;
+   int32 fileProperties = 0;
+   char *symlinkTarget = NULL;
+   char *escapedFileName = NULL;
+   char *localName;
+   struct stat statbuf;
+   Bool haveStat;
+   int len;
+
+   localName = Unicode_GetAllocBytes(fileName, STRING_ENCODING_DEFAULT);
+   if (NULL == localName) {
+      haveStat = FALSE;
+   } else {
+      haveStat = fstatat(dirFd, localName, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
+   }
+
+   if (haveStat && S_ISLNK(statbuf.st_mode)) {
+      char target[PATH_MAX];
+      ssize_t targetLen;
+
+      fileProperties |= VIX_FILE_ATTRIBUTES_SYMLINK;
+
+      /*
+       * If the file is a symlink, figure out where it points.
+       */
+      targetLen = readlinkat(dirFd, localName, target, sizeof target - 1);
+      if (targetLen > 0) {
+         target[targetLen] = '\0';
+         symlinkTarget = Unicode_Alloc(target, STRING_ENCODING_DEFAULT);
+      }
+
+      /*
+       * The rest of the attributes are the ones of the target.
+       */
+      haveStat = fstatat(dirFd, localName, &statbuf, 0) == 0;
+   } else if (haveStat && S_ISDIR(statbuf.st_mode)) {
+      fileProperties |= VIX_FILE_ATTRIBUTES_DIRECTORY;
+   } else if (haveStat && S_ISREG(statbuf.st_mode)) {
+      fileSize = statbuf.st_size;
+   }
+
+   if (!haveStat) {
+      g_warning("%s: fstatat(%s) failed with %d\n",
+                __FUNCTION__, fileName, errno);
+      memset(&statbuf, 0, sizeof statbuf);
+   }
+
+   /*
+    * Have a nice empty value if it's not a link or there's some error
+    * reading the link.
+    */
+   if (NULL == symlinkTarget) {
+      symlinkTarget = Util_SafeStrdup("");
+   }
+
+   escapedFileName = VixToolsEscapeXMLString(fileName);
+   ASSERT_MEM_ALLOC(NULL != escapedFileName);
+   {
+      char *tmp = VixToolsEscapeXMLString(symlinkTarget);
+      ASSERT_MEM_ALLOC(NULL != tmp);
+      free(symlinkTarget);
+      symlinkTarget = tmp;
+   }
+
+   len = Str_Snprintf(*destPtr,
+                      endDestPtr - *destPtr,
+                      fileExtendedInfoLinuxFormatString,
+                      escapedFileName,
+                      fileProperties,
+                      fileSize,
+                      (VmTimeType) statbuf.st_mtime,
+                      (VmTimeType) statbuf.st_atime,
+                      (int) statbuf.st_uid,
+                      (int) statbuf.st_gid,
+                      (int) statbuf.st_mode,
+                      symlinkTarget);
+   if (len >= 0) {
+      *destPtr += len;
+   } else {
+      /* Don't leave a partial entry behind. */
+      **destPtr = '\0';
+   }
+
+   free(symlinkTarget);
+   free(escapedFileName);
+   free(localName);
+
+   return len >= 0;
+} // VixToolsPrintFileExtendedInfoAt
+#endif
+
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -30,8 +30,10 @@
 
 #include <stdlib.h>
 #include "toolsCoreInt.h"
+#include "asyncsocket.h"
 #include "conf.h"
 #include "guestApp.h"
+#include "poll.h"
 #include "serviceObj.h"
 #include "str.h"
 #include "system.h"
@@ -71,6 +73,19 @@
 
 #define CONFNAME_MAX_CHANNEL_ATTEMPTS "maxChannelAttempts"
 
+/*
+ * Whether to use the epoll based Poll implementation (Linux only) instead
+ * of the GLib based one for the Poll consumers, e.g. the vsocket RPC
+ * channel.
+ */
+#define CONFNAME_USE_EPOLL "useEpoll"
+
+/*
+ * Whether AsyncSocket should move the data path of plain (non-SSL) TCP and
+ * vsock connections to io_uring, when the kernel supports it (Linux only).
+ */
+#define CONFNAME_USE_IO_URING "useIoUring"
+
 
 /*
  ******************************************************************************
@@ -422,6 +437,7 @@ ToolsCore_DumpState(ToolsServiceState *state)
       }
    }
 
+   ToolsCorePool_DumpState(&state->ctx);
    ToolsCore_DumpPluginInfo(state);
 
    g_signal_emit_by_name(state->ctx.serviceObj,
@@ -592,6 +608,27 @@ ToolsCore_Setup(ToolsServiceState *state)
    g_object_set(state->ctx.serviceObj, TOOLS_CORE_PROP_CTX, &state->ctx, NULL);
    ToolsCorePool_Init(&state->ctx);
 
+#if defined(__linux__)
+   /*
+    * Must happen before the RPC channel and the plugins get to initialize
+    * the GLib based Poll implementation.
+    */
+   if (VMTools_ConfigGetBoolean(state->ctx.config, state->name,
+                                CONFNAME_USE_EPOLL, FALSE)) {
+      g_debug("Using the epoll based Poll implementation.\n");
+      Poll_InitEpoll();
+   }
+
+   if (VMTools_ConfigGetBoolean(state->ctx.config, state->name,
+                                CONFNAME_USE_IO_URING, FALSE)) {
+      if (AsyncSocket_EnableIoUring() == ASOCKERR_SUCCESS) {
+         g_debug("Using io_uring for AsyncSocket connections.\n");
+      } else {
+         g_debug("io_uring is not available, AsyncSocket stays on Poll.\n");
+      }
+   }
+#endif
+
    /* Initializes the debug library if needed. */
    if (state->debugPlugin != NULL) {
       ToolsCoreInitializeDebug(state);
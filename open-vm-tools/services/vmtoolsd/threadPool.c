@@ -33,24 +33,60 @@
 #define DEFAULT_MAX_THREADS         5
 #define DEFAULT_MAX_UNUSED_THREADS  0
 
+/*
+ * Upper bounds, in microseconds, of the buckets of the queue wait and run
+ * time histograms. The last bucket has no upper bound.
+ */
+static const gint64 gHistogramBounds[] = {
+   1000, 10000, 100000, 1000000, 10000000, 60000000,
+};
+static const char *gHistogramLabels[] = {
+   "1ms", "10ms", "100ms", "1s", "10s", "60s", "more",
+};
+
+#define HISTOGRAM_BUCKETS (G_N_ELEMENTS(gHistogramBounds) + 1)
+
+typedef struct ThreadPoolStats {
+   guint64        tasks;
+   guint64        waitTime[HISTOGRAM_BUCKETS];
+   guint64        runTime[HISTOGRAM_BUCKETS];
+} ThreadPoolStats;
+
+
+/* Tasks sharing a concurrency limit. */
+typedef struct ThreadPoolGroup {
+   gchar            *name;
+   guint             maxThreads;    /* 0 means no limit. */
+   guint             running;
+   ThreadPoolStats   stats;
+} ThreadPoolGroup;
+
+
 typedef struct ThreadPoolState {
-   ToolsCorePool  funcs;
-   gboolean       active;
-   ToolsAppCtx   *ctx;
-   GThreadPool   *pool;
-   GQueue        *workQueue;
-   GPtrArray     *threads;
-   GMutex        *lock;
-   guint          nextWorkId;
+   ToolsCorePool     funcs;
+   gboolean          active;
+   ToolsAppCtx      *ctx;
+   GThreadPool      *pool;
+   guint             maxThreads;
+   guint             runningLow;     /* Running tasks that aren't high prio. */
+   GQueue           *workQueues[TOOLS_CORE_POOL_PRIO_MAX];
+   GHashTable       *groups;
+   GPtrArray        *threads;
+   GMutex           *lock;
+   guint             nextWorkId;
+   ThreadPoolStats   stats[TOOLS_CORE_POOL_PRIO_MAX];
 } ThreadPoolState;
 
 
 typedef struct WorkerTask {
-   guint             id;
-   guint             srcId;
-   ToolsCorePoolCb   cb;
-   gpointer          data;
-   GDestroyNotify    dtor;
+   guint                   id;
+   guint                   srcId;
+   ToolsCorePoolCb         cb;
+   gpointer                data;
+   GDestroyNotify          dtor;
+   ToolsCorePoolPriority   priority;
+   ThreadPoolGroup        *group;
+   gint64                  queued;    /* Monotonic time of submission. */
 } WorkerTask;
 
 
@@ -147,6 +183,158 @@ ToolsCorePoolDestroyTask(gpointer data)
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePoolRecord --                                                 */ /**
+ *
+ * Records the queue wait and run times of a task in the given stats. Must be
+ * called with the pool lock held.
+ *
+ * @param[in] stats  Stats to update.
+ * @param[in] wait   Time spent in the queue, in microseconds.
+ * @param[in] run    Time spent running, in microseconds.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolRecord(ThreadPoolStats *stats,
+                    gint64 wait,
+                    gint64 run)
+{
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(gHistogramBounds); i++) {
+      if (wait < gHistogramBounds[i]) {
+         break;
+      }
+   }
+   stats->waitTime[i]++;
+
+   for (i = 0; i < G_N_ELEMENTS(gHistogramBounds); i++) {
+      if (run < gHistogramBounds[i]) {
+         break;
+      }
+   }
+   stats->runTime[i]++;
+
+   stats->tasks++;
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolNextTask --                                               */ /**
+ *
+ * Picks the next task a worker thread should run, and accounts for it as
+ * running. Must be called with the pool lock held.
+ *
+ * The oldest task of the highest priority queue is picked, skipping the tasks
+ * whose group is at its concurrency limit, so that an idle worker picks up
+ * any other runnable task instead of waiting. Tasks that aren't high priority
+ * can only use "pool.maxThreads" threads; the pool has one more thread for
+ * high priority tasks.
+ *
+ * @return A task, or NULL if none can run now.
+ *
+ *******************************************************************************
+ */
+
+static WorkerTask *
+ToolsCorePoolNextTask(void)
+{
+   guint prio;
+
+   for (prio = 0; prio < TOOLS_CORE_POOL_PRIO_MAX; prio++) {
+      GList *lnk;
+
+      if (prio != TOOLS_CORE_POOL_PRIO_HIGH &&
+          gState.runningLow >= gState.maxThreads) {
+         break;
+      }
+
+      /* Tasks are pushed at the head, so the oldest is at the tail. */
+      for (lnk = g_queue_peek_tail_link(gState.workQueues[prio]);
+           lnk != NULL;
+           lnk = lnk->prev) {
+         WorkerTask *work = lnk->data;
+
+         if (work->group == NULL ||
+             work->group->maxThreads == 0 ||
+             work->group->running < work->group->maxThreads) {
+            g_queue_delete_link(gState.workQueues[prio], lnk);
+            if (work->group != NULL) {
+               work->group->running++;
+            }
+            if (prio != TOOLS_CORE_POOL_PRIO_HIGH) {
+               gState.runningLow++;
+            }
+            return work;
+         }
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolGetGroup --                                               */ /**
+ *
+ * Returns the given task group, creating it if needed. The group's limit is
+ * read from the "pool.<group>.maxThreads" configuration key. Must be called
+ * with the pool lock held.
+ *
+ * @param[in] name   Group name.
+ *
+ * @return The group.
+ *
+ *******************************************************************************
+ */
+
+static ThreadPoolGroup *
+ToolsCorePoolGetGroup(const gchar *name)
+{
+   ThreadPoolGroup *group = g_hash_table_lookup(gState.groups, name);
+
+   if (group == NULL) {
+      gchar *key = g_strdup_printf("pool.%s.maxThreads", name);
+      gint maxThreads = g_key_file_get_integer(gState.ctx->config,
+                                               gState.ctx->name, key, NULL);
+
+      group = g_malloc0(sizeof *group);
+      group->name = g_strdup(name);
+      group->maxThreads = MAX(maxThreads, 0);
+      g_hash_table_insert(gState.groups, group->name, group);
+      g_free(key);
+   }
+
+   return group;
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolFreeGroup --                                              */ /**
+ *
+ * Frees a task group.
+ *
+ * @param[in] data   A ThreadPoolGroup.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolFreeGroup(gpointer data)
+{
+   ThreadPoolGroup *group = data;
+
+   g_free(group->name);
+   g_free(group);
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePoolDoWork --                                                 */ /**
@@ -164,6 +352,8 @@ static gboolean
 ToolsCorePoolDoWork(gpointer data)
 {
    WorkerTask *work = data;
+   gint64 start;
+   gint64 end;
 
    /*
     * In single threaded mode, remove the task being executed from the queue.
@@ -171,11 +361,23 @@ ToolsCorePoolDoWork(gpointer data)
     */
    if (gState.pool == NULL) {
       g_mutex_lock(gState.lock);
-      g_queue_remove(gState.workQueue, work);
+      g_queue_remove(gState.workQueues[work->priority], work);
       g_mutex_unlock(gState.lock);
    }
 
+   start = g_get_monotonic_time();
    work->cb(gState.ctx, work->data);
+   end = g_get_monotonic_time();
+
+   g_mutex_lock(gState.lock);
+   ToolsCorePoolRecord(&gState.stats[work->priority], start - work->queued,
+                       end - start);
+   if (work->group != NULL) {
+      ToolsCorePoolRecord(&work->group->stats, start - work->queued,
+                          end - start);
+   }
+   g_mutex_unlock(gState.lock);
+
    return FALSE;
 }
 
@@ -242,8 +444,11 @@ ToolsCorePoolRunThread(gpointer data)
  *******************************************************************************
  * ToolsCorePoolRunWorker --                                              */ /**
  *
- * Thread pool callback function. Dequeues the next work item from the work
- * queue and execute it.
+ * Thread pool callback function. Runs queued tasks until none can run.
+ *
+ * Each submitted task pushes one request to the thread pool, but a task held
+ * back by a concurrency limit is run by the worker that frees the limit, so
+ * a request may find nothing to run.
  *
  * @param[in] state        Description of state.
  * @param[in] clientData   Description of clientData.
@@ -258,28 +463,44 @@ ToolsCorePoolRunWorker(gpointer state,
    WorkerTask *work;
 
    g_mutex_lock(gState.lock);
-   work = g_queue_pop_tail(gState.workQueue);
-   g_mutex_unlock(gState.lock);
 
-   ASSERT(work != NULL);
+   while ((work = ToolsCorePoolNextTask()) != NULL) {
+      g_mutex_unlock(gState.lock);
+
+      ToolsCorePoolDoWork(work);
+
+      g_mutex_lock(gState.lock);
+      if (work->group != NULL) {
+         work->group->running--;
+      }
+      if (work->priority != TOOLS_CORE_POOL_PRIO_HIGH) {
+         gState.runningLow--;
+      }
+      g_mutex_unlock(gState.lock);
+
+      ToolsCorePoolDestroyTask(work);
 
-   ToolsCorePoolDoWork(work);
-   ToolsCorePoolDestroyTask(work);
+      g_mutex_lock(gState.lock);
+   }
+
+   g_mutex_unlock(gState.lock);
 }
 
 
 /*
  *******************************************************************************
- * ToolsCorePoolSubmit --                                                 */ /**
+ * ToolsCorePoolSubmitEx --                                               */ /**
  *
  * Submits a new task for execution in one of the shared worker threads.
  *
- * @see ToolsCorePool_SubmitTask()
+ * @see ToolsCorePool_SubmitTaskEx()
  *
- * @param[in] ctx    Application context.
- * @param[in] cb     Function to execute the task.
- * @param[in] data   Opaque data for the task.
- * @param[in] dtor   Destructor for the task data.
+ * @param[in] ctx       Application context.
+ * @param[in] cb        Function to execute the task.
+ * @param[in] data      Opaque data for the task.
+ * @param[in] dtor      Destructor for the task data.
+ * @param[in] priority  Priority of the task.
+ * @param[in] group     Group of the task, may be NULL.
  *
  * @return New task's ID, or 0 on error.
  *
@@ -287,18 +508,31 @@ ToolsCorePoolRunWorker(gpointer state,
  */
 
 static guint
-ToolsCorePoolSubmit(ToolsAppCtx *ctx,
-                    ToolsCorePoolCb cb,
-                    gpointer data,
-                    GDestroyNotify dtor)
+ToolsCorePoolSubmitEx(ToolsAppCtx *ctx,
+                      ToolsCorePoolCb cb,
+                      gpointer data,
+                      GDestroyNotify dtor,
+                      ToolsCorePoolPriority priority,
+                      const gchar *group)
 {
+   static const gint idlePriorities[] = {
+      G_PRIORITY_HIGH_IDLE,
+      G_PRIORITY_DEFAULT_IDLE,
+      G_PRIORITY_LOW,
+   };
    guint id = 0;
-   WorkerTask *task = g_malloc0(sizeof *task);
+   WorkerTask *task;
+
+   ASSERT_ON_COMPILE(G_N_ELEMENTS(idlePriorities) == TOOLS_CORE_POOL_PRIO_MAX);
+   g_return_val_if_fail(priority < TOOLS_CORE_POOL_PRIO_MAX, 0);
 
+   task = g_malloc0(sizeof *task);
    task->srcId = 0;
    task->cb = cb;
    task->data = data;
    task->dtor = dtor;
+   task->priority = priority;
+   task->queued = g_get_monotonic_time();
 
    g_mutex_lock(gState.lock);
 
@@ -307,6 +541,10 @@ ToolsCorePoolSubmit(ToolsAppCtx *ctx,
       goto exit;
    }
 
+   if (group != NULL) {
+      task->group = ToolsCorePoolGetGroup(group);
+   }
+
    /*
     * XXX: a reeeeeeeeeally long running task could cause clashes (e.g., reusing
     * the same task ID after the counter wraps). That shouldn't really happen in
@@ -328,7 +566,7 @@ ToolsCorePoolSubmit(ToolsAppCtx *ctx,
     * that it can be canceled. In single threaded mode, it's unlikely someone
     * will be able to cancel it before it runs, but they can try.
     */
-   g_queue_push_head(gState.workQueue, task);
+   g_queue_push_head(gState.workQueues[priority], task);
 
    if (gState.pool != NULL) {
       GError *err = NULL;
@@ -344,8 +582,11 @@ ToolsCorePoolSubmit(ToolsAppCtx *ctx,
       }
    }
 
-   /* Run the task in the service's thread. */
-   task->srcId = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+   /*
+    * Run the task in the service's thread. There are no concurrency limits
+    * there, but the priority still orders the tasks.
+    */
+   task->srcId = g_idle_add_full(idlePriorities[priority],
                                  ToolsCorePoolDoWork,
                                  task,
                                  ToolsCorePoolDestroyTask);
@@ -356,6 +597,35 @@ exit:
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePoolSubmit --                                                 */ /**
+ *
+ * Submits a new task with normal priority and no group.
+ *
+ * @see ToolsCorePool_SubmitTask()
+ *
+ * @param[in] ctx    Application context.
+ * @param[in] cb     Function to execute the task.
+ * @param[in] data   Opaque data for the task.
+ * @param[in] dtor   Destructor for the task data.
+ *
+ * @return New task's ID, or 0 on error.
+ *
+ *******************************************************************************
+ */
+
+static guint
+ToolsCorePoolSubmit(ToolsAppCtx *ctx,
+                    ToolsCorePoolCb cb,
+                    gpointer data,
+                    GDestroyNotify dtor)
+{
+   return ToolsCorePoolSubmitEx(ctx, cb, data, dtor,
+                                TOOLS_CORE_POOL_PRIO_NORMAL, NULL);
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePoolCancel --                                                 */ /**
@@ -373,6 +643,7 @@ static void
 ToolsCorePoolCancel(guint id)
 {
    GList *taskLnk;
+   guint prio;
    WorkerTask *task = NULL;
    WorkerTask search = { id, };
 
@@ -383,10 +654,14 @@ ToolsCorePoolCancel(guint id)
       goto exit;
    }
 
-   taskLnk = g_queue_find_custom(gState.workQueue, &search, ToolsCorePoolCompareTask);
-   if (taskLnk != NULL) {
-      task = taskLnk->data;
-      g_queue_delete_link(gState.workQueue, taskLnk);
+   for (prio = 0; prio < TOOLS_CORE_POOL_PRIO_MAX; prio++) {
+      taskLnk = g_queue_find_custom(gState.workQueues[prio], &search,
+                                    ToolsCorePoolCompareTask);
+      if (taskLnk != NULL) {
+         task = taskLnk->data;
+         g_queue_delete_link(gState.workQueues[prio], taskLnk);
+         break;
+      }
    }
 
 exit:
@@ -459,6 +734,98 @@ exit:
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePoolLogStats --                                               */ /**
+ *
+ * Logs the task counters and histograms of a priority level or group.
+ *
+ * @param[in] name   Name of the priority level or group.
+ * @param[in] stats  Stats to log.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolLogStats(const gchar *name,
+                      const ThreadPoolStats *stats)
+{
+   GString *wait = g_string_new(NULL);
+   GString *run = g_string_new(NULL);
+   guint i;
+
+   for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+      g_string_append_printf(wait, " %s:%"FMT64"u", gHistogramLabels[i],
+                             stats->waitTime[i]);
+      g_string_append_printf(run, " %s:%"FMT64"u", gHistogramLabels[i],
+                             stats->runTime[i]);
+   }
+
+   ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                      "%s: %"FMT64"u tasks, wait:%s, run:%s\n",
+                      name, stats->tasks, wait->str, run->str);
+
+   g_string_free(wait, TRUE);
+   g_string_free(run, TRUE);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePool_DumpState --                                             */ /**
+ *
+ * Logs the state of the thread pool: queued and running tasks, and the queue
+ * wait and run time histograms per priority and per group.
+ *
+ * @param[in] ctx    Application context.
+ *
+ *******************************************************************************
+ */
+
+void
+ToolsCorePool_DumpState(ToolsAppCtx *ctx)
+{
+   static const gchar *prioNames[] = { "high", "normal", "low" };
+   GHashTableIter iter;
+   gpointer value;
+   guint i;
+
+   ASSERT_ON_COMPILE(G_N_ELEMENTS(prioNames) == TOOLS_CORE_POOL_PRIO_MAX);
+
+   if (gState.lock == NULL) {
+      return;
+   }
+
+   g_mutex_lock(gState.lock);
+
+   ToolsCore_LogState(TOOLS_STATE_LOG_CONTAINER,
+                      "Thread pool: %u threads (+1 high priority), "
+                      "%u running, %u helper threads\n",
+                      gState.maxThreads, gState.runningLow,
+                      gState.threads != NULL ? gState.threads->len : 0);
+
+   for (i = 0; i < TOOLS_CORE_POOL_PRIO_MAX; i++) {
+      ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                         "Queued %s priority tasks: %u\n",
+                         prioNames[i],
+                         g_queue_get_length(gState.workQueues[i]));
+      ToolsCorePoolLogStats(prioNames[i], &gState.stats[i]);
+   }
+
+   g_hash_table_iter_init(&iter, gState.groups);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      ThreadPoolGroup *group = value;
+
+      ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                         "Group %s: %u running (max %u)\n",
+                         group->name, group->running, group->maxThreads);
+      ToolsCorePoolLogStats(group->name, &group->stats);
+   }
+
+   g_mutex_unlock(gState.lock);
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePool_Init --                                                  */ /**
@@ -476,6 +843,7 @@ exit:
 void
 ToolsCorePool_Init(ToolsAppCtx *ctx)
 {
+   guint i;
    gint maxThreads;
    GError *err = NULL;
 
@@ -484,6 +852,7 @@ ToolsCorePool_Init(ToolsAppCtx *ctx)
    gState.funcs.submit = ToolsCorePoolSubmit;
    gState.funcs.cancel = ToolsCorePoolCancel;
    gState.funcs.start = ToolsCorePoolStart;
+   gState.funcs.submitEx = ToolsCorePoolSubmitEx;
    gState.ctx = ctx;
 
    maxThreads = g_key_file_get_integer(ctx->config, ctx->name,
@@ -494,8 +863,10 @@ ToolsCorePool_Init(ToolsAppCtx *ctx)
    }
 
    if (maxThreads > 0) {
+      /* One more thread, kept for high priority tasks. */
+      gState.maxThreads = maxThreads;
       gState.pool = g_thread_pool_new(ToolsCorePoolRunWorker,
-                                      NULL, maxThreads, FALSE, &err);
+                                      NULL, maxThreads + 1, FALSE, &err);
       if (err == NULL) {
 #if GLIB_CHECK_VERSION(2, 10, 0)
          gint maxIdleTime;
@@ -528,7 +899,11 @@ ToolsCorePool_Init(ToolsAppCtx *ctx)
    gState.active = TRUE;
    gState.lock = g_mutex_new();
    gState.threads = g_ptr_array_new();
-   gState.workQueue = g_queue_new();
+   for (i = 0; i < TOOLS_CORE_POOL_PRIO_MAX; i++) {
+      gState.workQueues[i] = g_queue_new();
+   }
+   gState.groups = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                         ToolsCorePoolFreeGroup);
 
    ToolsCoreService_RegisterProperty(ctx->serviceObj, &prop);
    g_object_set(ctx->serviceObj, TOOLS_CORE_PROP_TPOOL, &gState.funcs, NULL);
@@ -577,18 +952,21 @@ ToolsCorePool_Shutdown(ToolsAppCtx *ctx)
    }
 
    /* Destroy all pending tasks. */
-   while (1) {
-      WorkerTask *task = g_queue_pop_tail(gState.workQueue);
-      if (task != NULL) {
-         ToolsCorePoolDestroyTask(task);
-      } else {
-         break;
+   for (i = 0; i < TOOLS_CORE_POOL_PRIO_MAX; i++) {
+      while (1) {
+         WorkerTask *task = g_queue_pop_tail(gState.workQueues[i]);
+         if (task != NULL) {
+            ToolsCorePoolDestroyTask(task);
+         } else {
+            break;
+         }
       }
+      g_queue_free(gState.workQueues[i]);
    }
 
    /* Cleanup. */
    g_ptr_array_free(gState.threads, TRUE);
-   g_queue_free(gState.workQueue);
+   g_hash_table_destroy(gState.groups);
    g_mutex_free(gState.lock);
    memset(&gState, 0, sizeof gState);
    g_object_set(ctx->serviceObj, TOOLS_CORE_PROP_TPOOL, NULL, NULL);
@@ -157,6 +157,9 @@ void
 ToolsCore_CFRunLoop(ToolsServiceState *state);
 #endif
 
+void
+ToolsCorePool_DumpState(ToolsAppCtx *ctx);
+
 void
 ToolsCorePool_Init(ToolsAppCtx *ctx);
 
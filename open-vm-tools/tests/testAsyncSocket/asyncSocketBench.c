@@ -0,0 +1,554 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * asyncSocketBench.c --
+ *
+ *      Benchmark and checks for the AsyncSocket TCP data path over a
+ *      loopback connection. Prints the read and write system calls per
+ *      message and the throughput of:
+ *
+ *      - small messages, sent in bursts as a header and a body buffer and
+ *        received with one AsyncSocket_Recv() for each, so that messages
+ *        straddle the end of the receive read-ahead buffer,
+ *      - a bulk transfer of large buffers, received with
+ *        AsyncSocket_RecvPartial().
+ *
+ *      Checks that every byte arrives in order, and that queued sends are
+ *      gathered and small receives served from the read-ahead buffer: both
+ *      take well under one system call per message. The system calls are
+ *      counted from /proc/self/io, and not checked if it is missing.
+ *
+ *      Usage: vmware-testasyncsocket [messages] [bulk MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vmware.h"
+#include "poll.h"
+#include "asyncsocket.h"
+#include "testBench.h"
+
+#define BENCH_BURST          32
+#define BENCH_MAX_BODY       1024
+#define BENCH_BULK_SEND      (256 * 1024)
+#define BENCH_BULK_RECV      (1024 * 1024)
+
+typedef struct BenchConn {
+   AsyncSocket *asock;
+   uint32 header;                   // length of the next body
+   uint8 body[BENCH_MAX_BODY];
+   uint8 *bulk;
+   uint64 numMsgs;
+   uint64 numBytes;
+} BenchConn;
+
+static BenchConn benchServer;
+static AsyncSocket *benchClient;
+static Bool benchConnected;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchSyscalls --
+ *
+ *      Read and write system calls made by this process so far.
+ *
+ * Results:
+ *      TRUE if they are known.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BenchSyscalls(uint64 *reads,    // OUT
+              uint64 *writes)   // OUT
+{
+   char line[128];
+   Bool haveReads = FALSE;
+   Bool haveWrites = FALSE;
+   FILE *fp = fopen("/proc/self/io", "r");
+
+   if (fp == NULL) {
+      return FALSE;
+   }
+   while (fgets(line, sizeof line, fp) != NULL) {
+      haveReads |= sscanf(line, "syscr: %" FMT64 "u", reads) == 1;
+      haveWrites |= sscanf(line, "syscw: %" FMT64 "u", writes) == 1;
+   }
+   fclose(fp);
+   return haveReads && haveWrites;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchBodyByte --
+ *
+ *      Contents of a message body.
+ *
+ * Results:
+ *      The byte at offset i of message msg.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE uint8
+BenchBodyByte(uint64 msg,  // IN
+              uint32 i)    // IN
+{
+   return (uint8)(msg * 31 + i);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchBodyLength --
+ *
+ *      Length of a message body, spread over 1..BENCH_MAX_BODY.
+ *
+ * Results:
+ *      The length.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE uint32
+BenchBodyLength(uint64 msg)  // IN
+{
+   return 1 + (uint32)((msg * 7919) % BENCH_MAX_BODY);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchError --
+ *
+ *      Error callback of both ends.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchError(int error,           // IN
+           AsyncSocket *asock,  // IN
+           void *clientData)    // IN: end name
+{
+   printf("FAIL: %s: %s\n", (const char *)clientData,
+          AsyncSocket_Err2String(error));
+   exit(1);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchRecvHeader --
+ * BenchRecvBody --
+ *
+ *      Receive callbacks of the server for small messages: checks each
+ *      body and asks for the next header.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Counts the message.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void BenchRecvHeader(void *buf, int len, AsyncSocket *asock,
+                            void *clientData);
+
+static void
+BenchRecvBody(void *buf,            // IN
+              int len,              // IN
+              AsyncSocket *asock,   // IN
+              void *clientData)     // IN
+{
+   BenchConn *conn = clientData;
+   uint32 i;
+
+   for (i = 0; i < conn->header; i++) {
+      CHECK(conn->body[i] == BenchBodyByte(conn->numMsgs, i));
+   }
+   conn->numMsgs++;
+   conn->numBytes += sizeof conn->header + len;
+   CHECK(AsyncSocket_Recv(asock, &conn->header, sizeof conn->header,
+                          BenchRecvHeader, conn) == ASOCKERR_SUCCESS);
+}
+
+
+static void
+BenchRecvHeader(void *buf,            // IN
+                int len,              // IN
+                AsyncSocket *asock,   // IN
+                void *clientData)     // IN
+{
+   BenchConn *conn = clientData;
+
+   CHECK(conn->header == BenchBodyLength(conn->numMsgs));
+   CHECK(AsyncSocket_Recv(asock, conn->body, conn->header, BenchRecvBody,
+                          conn) == ASOCKERR_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchRecvBulk --
+ *
+ *      Receive callback of the server for the bulk transfer.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Counts the bytes.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchRecvBulk(void *buf,            // IN
+              int len,              // IN
+              AsyncSocket *asock,   // IN
+              void *clientData)     // IN
+{
+   BenchConn *conn = clientData;
+   int i;
+
+   for (i = 0; i < len; i++) {
+      CHECK(conn->bulk[i] == (uint8)((conn->numBytes + i) % 251));
+   }
+   conn->numBytes += len;
+   CHECK(AsyncSocket_RecvPartial(asock, conn->bulk, BENCH_BULK_RECV,
+                                 BenchRecvBulk, conn) == ASOCKERR_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchFreeMsg --
+ *
+ *      Send callback of a message body: frees the message.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchFreeMsg(void *buf,            // IN
+             int len,              // IN
+             AsyncSocket *asock,   // IN
+             void *clientData)     // IN
+{
+   free((uint8 *)buf - sizeof(uint32));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchAccepted --
+ * BenchConnected --
+ *
+ *      Connect callbacks of the server and the client.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchAccepted(AsyncSocket *asock,   // IN
+              void *clientData)     // IN
+{
+   benchServer.asock = asock;
+   AsyncSocket_SetErrorFn(asock, BenchError, "server");
+}
+
+
+static void
+BenchConnected(AsyncSocket *asock,   // IN
+               void *clientData)     // IN
+{
+   benchConnected = TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchLoopUntil --
+ *
+ *      Runs the poll loop until *value reaches target.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Fires callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchLoopUntil(volatile uint64 *value,  // IN
+               uint64 target)           // IN
+{
+   while (*value < target) {
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 1000000);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchSmall --
+ *
+ *      Sends numMsgs small messages from the client to the server, in
+ *      bursts of BENCH_BURST.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the system calls per message and the throughput.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchSmall(uint64 numMsgs)  // IN
+{
+   uint64 reads0, writes0, reads, writes;
+   Bool counted;
+   uint64 start;
+   uint64 elapsed;
+   uint64 msg = 0;
+
+   benchServer.numMsgs = 0;
+   benchServer.numBytes = 0;
+   CHECK(AsyncSocket_Recv(benchServer.asock, &benchServer.header,
+                          sizeof benchServer.header, BenchRecvHeader,
+                          &benchServer) == ASOCKERR_SUCCESS);
+
+   counted = BenchSyscalls(&reads0, &writes0);
+   start = BenchNowNS();
+   while (msg < numMsgs) {
+      uint64 end = MIN(msg + BENCH_BURST, numMsgs);
+
+      for (; msg < end; msg++) {
+         uint32 len = BenchBodyLength(msg);
+         uint8 *buf = malloc(sizeof len + len);
+         uint32 i;
+
+         CHECK(buf != NULL);
+         memcpy(buf, &len, sizeof len);
+         for (i = 0; i < len; i++) {
+            buf[sizeof len + i] = BenchBodyByte(msg, i);
+         }
+         CHECK(AsyncSocket_Send(benchClient, buf, sizeof len, NULL,
+                                NULL) == ASOCKERR_SUCCESS);
+         CHECK(AsyncSocket_Send(benchClient, buf + sizeof len, len,
+                                BenchFreeMsg, NULL) == ASOCKERR_SUCCESS);
+      }
+      BenchLoopUntil(&benchServer.numMsgs, msg);
+   }
+   elapsed = BenchNowNS() - start;
+   counted = counted && BenchSyscalls(&reads, &writes);
+
+   printf("small msgs %8" FMT64 "u %8.1f MB/s %10.0f msgs/s",
+          numMsgs, (double)benchServer.numBytes * 1000 / elapsed,
+          (double)numMsgs * 1000000000 / elapsed);
+   if (counted) {
+      printf(" %6.3f reads/msg %6.3f writes/msg\n",
+             (double)(reads - reads0) / numMsgs,
+             (double)(writes - writes0) / numMsgs);
+
+      /*
+       * Two receives and two sends per message; each burst should take a
+       * couple of system calls on each side.
+       */
+      CHECK(reads - reads0 < numMsgs / 4);
+      CHECK(writes - writes0 < numMsgs / 4);
+   } else {
+      printf("\n");
+   }
+   CHECK(AsyncSocket_CancelRecv(benchServer.asock, NULL, NULL, NULL) ==
+         ASOCKERR_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchBulk --
+ *
+ *      Sends numBytes from the client to the server in BENCH_BULK_SEND
+ *      buffers.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the system calls per MB and the throughput.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchBulk(uint64 numBytes)  // IN
+{
+   uint64 reads0, writes0, reads, writes;
+   uint8 *buf = malloc(BENCH_BULK_SEND + 251);
+   Bool counted;
+   uint64 start;
+   uint64 elapsed;
+   uint64 sent;
+   int i;
+
+   CHECK(buf != NULL);
+   for (i = 0; i < BENCH_BULK_SEND + 251; i++) {
+      buf[i] = i % 251;
+   }
+   benchServer.numBytes = 0;
+   benchServer.bulk = malloc(BENCH_BULK_RECV);
+   CHECK(benchServer.bulk != NULL);
+   CHECK(AsyncSocket_RecvPartial(benchServer.asock, benchServer.bulk,
+                                 BENCH_BULK_RECV, BenchRecvBulk,
+                                 &benchServer) == ASOCKERR_SUCCESS);
+
+   counted = BenchSyscalls(&reads0, &writes0);
+   start = BenchNowNS();
+   for (sent = 0; sent < numBytes; sent += BENCH_BULK_SEND) {
+      /* Start each buffer where the pattern left off. */
+      CHECK(AsyncSocket_Send(benchClient, buf + sent % 251, BENCH_BULK_SEND,
+                             NULL, NULL) == ASOCKERR_SUCCESS);
+   }
+   BenchLoopUntil(&benchServer.numBytes, sent);
+   elapsed = BenchNowNS() - start;
+   counted = counted && BenchSyscalls(&reads, &writes);
+
+   printf("bulk  MB   %8" FMT64 "u %8.1f MB/s", sent >> 20,
+          (double)sent * 1000 / elapsed);
+   if (counted) {
+      printf(" %8.1f reads/MB %8.1f writes/MB\n",
+             (double)(reads - reads0) * (1 << 20) / sent,
+             (double)(writes - writes0) * (1 << 20) / sent);
+   } else {
+      printf("\n");
+   }
+   CHECK(benchServer.numBytes == sent);
+
+   CHECK(AsyncSocket_CancelRecv(benchServer.asock, NULL, NULL, NULL) ==
+         ASOCKERR_SUCCESS);
+   free(benchServer.bulk);
+   free(buf);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Connects the loopback pair and runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numMsgs = argc > 1 ? atoi(argv[1]) : 200000;
+   int bulkMB = argc > 2 ? atoi(argv[2]) : 256;
+   AsyncSocket *listener;
+   int err;
+
+   if (numMsgs < 1 || bulkMB < 1) {
+      printf("Usage: %s [messages] [bulk MB]\n", argv[0]);
+      return 1;
+   }
+
+   Poll_InitEpoll();
+
+   listener = AsyncSocket_Listen("127.0.0.1", 0, BenchAccepted, NULL, NULL,
+                                 &err);
+   CHECK(listener != NULL);
+   benchClient = AsyncSocket_Connect("127.0.0.1",
+                                     AsyncSocket_GetPort(listener),
+                                     BenchConnected, NULL, 0, NULL, &err);
+   CHECK(benchClient != NULL);
+   AsyncSocket_SetErrorFn(benchClient, BenchError, "client");
+   while (!benchConnected || benchServer.asock == NULL) {
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 1000000);
+   }
+
+   BenchSmall(numMsgs);
+   BenchBulk((uint64)bulkMB << 20);
+
+   AsyncSocket_Close(benchClient);
+   AsyncSocket_Close(benchServer.asock);
+   AsyncSocket_Close(listener);
+
+   printf("PASS\n");
+   return 0;
+}
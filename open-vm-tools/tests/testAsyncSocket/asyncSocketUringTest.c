@@ -0,0 +1,490 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * asyncSocketUringTest.c --
+ *
+ *      Checks for the io_uring data path of AsyncSocket over a loopback TCP
+ *      connection. Runs the same exchange first on the Poll driven data
+ *      path, then again after AsyncSocket_EnableIoUring() if the kernel
+ *      supports it:
+ *
+ *      - the client sends numbered messages one at a time and the server
+ *        echoes each back in two sends, which must be gathered; the client
+ *        checks that every echo arrives in order,
+ *      - the server then sends a large buffer that the client receives
+ *        with AsyncSocket_RecvPartial(); the client checks every byte,
+ *      - the client closes, and the server must see exactly one error for
+ *        the remote disconnect.
+ *
+ *      Usage: vmware-testasyncsocketuring [messages] [transfer KB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vmware.h"
+#include "poll.h"
+#include "asyncsocket.h"
+#include "testBench.h"
+
+#define TEST_LAST_MSG     0xffffffff   // asks the server for the transfer
+#define TEST_TIMEOUT_NS   (30 * 1000000000ULL)
+
+typedef struct TestState {
+   AsyncSocket *server;
+   AsyncSocket *client;
+   uint32 serverMsg;
+   uint32 clientMsg;
+   uint32 numMsgs;
+   uint64 numEchoed;
+   uint64 numReceived;
+   uint64 numServerErrors;
+   uint64 numClientErrors;
+   uint8 *transferIn;
+   uint8 *transferOut;
+   int transferSize;
+} TestState;
+
+static TestState test;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestLoopUntil --
+ *
+ *      Runs the poll loop until *value reaches target, or fails after
+ *      TEST_TIMEOUT_NS.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Fires callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestLoopUntil(volatile uint64 *value,  // IN
+              uint64 target)           // IN
+{
+   uint64 start = BenchNowNS();
+
+   while (*value < target) {
+      CHECK(BenchNowNS() - start < TEST_TIMEOUT_NS);
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 100000);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestServerError --
+ * TestClientError --
+ *
+ *      Error callbacks of both ends. Only the server expects one, for the
+ *      remote disconnect at the end.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Closes the socket.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestServerError(int error,           // IN
+                AsyncSocket *asock,  // IN
+                void *clientData)    // IN
+{
+   test.numServerErrors++;
+   if (error != ASOCKERR_REMOTE_DISCONNECT) {
+      printf("FAIL: server: %s\n", AsyncSocket_Err2String(error));
+      exit(1);
+   }
+   AsyncSocket_Close(asock);
+   test.server = NULL;
+}
+
+
+static void
+TestClientError(int error,           // IN
+                AsyncSocket *asock,  // IN
+                void *clientData)    // IN
+{
+   printf("FAIL: client: %s\n", AsyncSocket_Err2String(error));
+   exit(1);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFreeEcho --
+ *
+ *      Send callback of the second part of an echo: frees it.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestFreeEcho(void *buf,            // IN
+             int len,              // IN
+             AsyncSocket *asock,   // IN
+             void *clientData)     // IN
+{
+   free((uint8 *)buf - 1);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFree --
+ *
+ *      Send callback of a client message: frees it.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestFree(void *buf,            // IN
+         int len,              // IN
+         AsyncSocket *asock,   // IN
+         void *clientData)     // IN
+{
+   free(buf);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestServerRecv --
+ *
+ *      Receive callback of the server: echoes the message in two sends, or
+ *      sends the transfer buffer for TEST_LAST_MSG.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestServerRecv(void *buf,            // IN
+               int len,              // IN
+               AsyncSocket *asock,   // IN
+               void *clientData)     // IN
+{
+   uint8 *echo;
+
+   if (test.serverMsg == TEST_LAST_MSG) {
+      CHECK(AsyncSocket_Send(asock, test.transferOut, test.transferSize,
+                             NULL, NULL) == ASOCKERR_SUCCESS);
+   } else {
+      echo = malloc(sizeof test.serverMsg);
+      CHECK(echo != NULL);
+      memcpy(echo, &test.serverMsg, sizeof test.serverMsg);
+      CHECK(AsyncSocket_Send(asock, echo, 1, NULL, NULL) ==
+            ASOCKERR_SUCCESS);
+      CHECK(AsyncSocket_Send(asock, echo + 1, sizeof test.serverMsg - 1,
+                             TestFreeEcho, NULL) == ASOCKERR_SUCCESS);
+   }
+
+   /* Keep a receive posted to see the disconnect. */
+   CHECK(AsyncSocket_Recv(asock, &test.serverMsg, sizeof test.serverMsg,
+                          TestServerRecv, NULL) == ASOCKERR_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestClientSend --
+ *
+ *      Sends a message from the client.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestClientSend(AsyncSocket *asock,  // IN
+               uint32 value)        // IN
+{
+   uint32 *msg = malloc(sizeof *msg);
+
+   CHECK(msg != NULL);
+   *msg = value;
+   CHECK(AsyncSocket_Send(asock, msg, sizeof *msg, TestFree, NULL) ==
+         ASOCKERR_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestClientRecvTransfer --
+ *
+ *      Partial receive callback of the client for the transfer.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestClientRecvTransfer(void *buf,            // IN
+                       int len,              // IN
+                       AsyncSocket *asock,   // IN
+                       void *clientData)     // IN
+{
+   CHECK(len > 0 && test.numReceived + len <= test.transferSize);
+   test.numReceived += len;
+   if (test.numReceived < test.transferSize) {
+      CHECK(AsyncSocket_RecvPartial(asock,
+                                    test.transferIn + test.numReceived,
+                                    test.transferSize - test.numReceived,
+                                    TestClientRecvTransfer, NULL) ==
+            ASOCKERR_SUCCESS);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestClientRecv --
+ *
+ *      Receive callback of the client for an echo: checks it and sends the
+ *      next message, or TEST_LAST_MSG after the last one.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestClientRecv(void *buf,            // IN
+               int len,              // IN
+               AsyncSocket *asock,   // IN
+               void *clientData)     // IN
+{
+   CHECK(test.clientMsg == test.numEchoed);
+   test.numEchoed++;
+
+   if (test.numEchoed < test.numMsgs) {
+      CHECK(AsyncSocket_Recv(asock, &test.clientMsg, sizeof test.clientMsg,
+                             TestClientRecv, NULL) == ASOCKERR_SUCCESS);
+      TestClientSend(asock, test.numEchoed);
+   } else {
+      CHECK(AsyncSocket_RecvPartial(asock, test.transferIn,
+                                    test.transferSize,
+                                    TestClientRecvTransfer, NULL) ==
+            ASOCKERR_SUCCESS);
+      TestClientSend(asock, TEST_LAST_MSG);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestAccepted --
+ * TestConnected --
+ *
+ *      Connect callbacks of the server and the client.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Starts the exchange.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestAccepted(AsyncSocket *asock,   // IN
+             void *clientData)     // IN
+{
+   test.server = asock;
+   AsyncSocket_SetErrorFn(asock, TestServerError, NULL);
+   CHECK(AsyncSocket_Recv(asock, &test.serverMsg, sizeof test.serverMsg,
+                          TestServerRecv, NULL) == ASOCKERR_SUCCESS);
+}
+
+
+static void
+TestConnected(AsyncSocket *asock,   // IN
+              void *clientData)     // IN
+{
+   CHECK(AsyncSocket_Recv(asock, &test.clientMsg, sizeof test.clientMsg,
+                          TestClientRecv, NULL) == ASOCKERR_SUCCESS);
+   TestClientSend(asock, 0);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestExchange --
+ *
+ *      Runs the echo, the transfer and the disconnect over a new loopback
+ *      connection.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the time taken.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestExchange(const char *label,   // IN
+             int numMsgs,         // IN
+             int transferSize)    // IN
+{
+   AsyncSocket *listener;
+   uint64 start;
+   uint64 echoed;
+   int err;
+   int i;
+
+   memset(&test, 0, sizeof test);
+   test.numMsgs = numMsgs;
+   test.transferSize = transferSize;
+   test.transferIn = malloc(transferSize);
+   test.transferOut = malloc(transferSize);
+   CHECK(test.transferIn != NULL && test.transferOut != NULL);
+   for (i = 0; i < transferSize; i++) {
+      test.transferOut[i] = i * 7;
+   }
+
+   listener = AsyncSocket_Listen("127.0.0.1", 0, TestAccepted, NULL, NULL,
+                                 &err);
+   CHECK(listener != NULL);
+   test.client = AsyncSocket_Connect("127.0.0.1",
+                                     AsyncSocket_GetPort(listener),
+                                     TestConnected, NULL, 0, NULL, &err);
+   CHECK(test.client != NULL);
+   AsyncSocket_SetErrorFn(test.client, TestClientError, NULL);
+
+   start = BenchNowNS();
+   TestLoopUntil(&test.numEchoed, numMsgs);
+   echoed = BenchNowNS();
+   TestLoopUntil(&test.numReceived, transferSize);
+   CHECK(memcmp(test.transferIn, test.transferOut, transferSize) == 0);
+
+   printf("%-8s msgs %7d %8.1f us/echo transfer %7d KB %8.1f MB/s\n",
+          label, numMsgs, (double)(echoed - start) / numMsgs / 1000,
+          transferSize >> 10,
+          (double)transferSize * 1000 / (BenchNowNS() - echoed));
+
+   AsyncSocket_Close(test.client);
+   TestLoopUntil(&test.numServerErrors, 1);
+   for (i = 0; i < 10; i++) {
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 10000);
+   }
+   CHECK(test.numServerErrors == 1);
+
+   AsyncSocket_Close(listener);
+   free(test.transferIn);
+   free(test.transferOut);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Runs the exchange on the Poll driven and the io_uring data paths.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numMsgs = argc > 1 ? atoi(argv[1]) : 2000;
+   int transferKB = argc > 2 ? atoi(argv[2]) : 1024;
+
+   if (numMsgs < 1 || transferKB < 1) {
+      printf("Usage: %s [messages] [transfer KB]\n", argv[0]);
+      return 1;
+   }
+
+   Poll_InitEpoll();
+
+   TestExchange("poll", numMsgs, transferKB << 10);
+
+   if (AsyncSocket_EnableIoUring() == ASOCKERR_SUCCESS) {
+      TestExchange("io_uring", numMsgs, transferKB << 10);
+   } else {
+      printf("io_uring not available, skipped\n");
+   }
+
+   printf("PASS\n");
+   return 0;
+}
@@ -0,0 +1,109 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * testBench.h --
+ *
+ *      Helpers shared by the benchmark and check programs under tests/:
+ *      a CHECK() assertion that fails the program, and the clocks and
+ *      counters the benchmarks report with.
+ *
+ *      Programs print "FAIL: ..." and exit with 1 on the first failed
+ *      check, and print "PASS" at the end otherwise.
+ */
+
+#ifndef _TEST_BENCH_H_
+#define _TEST_BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "vm_basic_types.h"
+
+#define CHECK(cond)                                                     \
+   do {                                                                 \
+      if (!(cond)) {                                                    \
+         printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond);        \
+         exit(1);                                                       \
+      }                                                                 \
+   } while (0)
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchNowNS --
+ *
+ *      Monotonic time in nanoseconds.
+ *
+ * Results:
+ *      The time.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE uint64
+BenchNowNS(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchResidentKB --
+ *
+ *      Resident set size of this process.
+ *
+ * Results:
+ *      The size in kB, or 0 if unknown.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE long
+BenchResidentKB(void)
+{
+   char line[256];
+   long rss = 0;
+   FILE *fp = fopen("/proc/self/status", "r");
+
+   if (fp == NULL) {
+      return 0;
+   }
+   while (fgets(line, sizeof line, fp) != NULL) {
+      if (sscanf(line, "VmRSS: %ld", &rss) == 1) {
+         break;
+      }
+   }
+   fclose(fp);
+   return rss;
+}
+
+#endif // _TEST_BENCH_H_
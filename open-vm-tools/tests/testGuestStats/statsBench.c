@@ -0,0 +1,985 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * statsBench.c --
+ *
+ *      Benchmark and checks for the Linux guest stats provider of the
+ *      guestInfo plugin. Takes samples of this guest's /proc through
+ *      GuestInfo_StatProviderPoll, the way the plugin's stats timer does,
+ *      first with full reports and then in delta mode, and prints the time
+ *      per sample and the report sizes. Checks that:
+ *
+ *      - full reports carry the stats in the tools name space only,
+ *      - delta reports carry them in the delta name space, except every
+ *        resync sample which is a full report again.
+ *
+ *      Then takes the same samples of a large guest: the program interposes
+ *      open() and access(), and stands in /proc/stat with TEST_NUM_CPUS
+ *      CPUs and /proc/diskstats with TEST_NUM_DISKS disks, all of them in
+ *      /sys/block.
+ *
+ *      Last, runs the high resolution sampler on the large guest, in a
+ *      stand-in for the tools thread pool, and checks that:
+ *
+ *      - once its ring overflows, the stats poll reports the latest
+ *        samples, not the first ones,
+ *      - over the CPU budget, the sampler slows down.
+ *
+ *      The program is built with a small ring, so that it overflows in a
+ *      couple of seconds.
+ *
+ *      Usage: vmware-testgueststats [samples]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib-object.h>
+
+#include "vmware.h"
+#include "conf.h"
+#include "dynbuf.h"
+#include "str.h"
+#include "strutil.h"
+#include "guestInfoInt.h"
+#include "guestStats.h"
+#include "vmware/tools/threadPool.h"
+#include "testBench.h"
+
+/* Must match GUEST_INFO_DELTA_RESYNC and GUEST_INFO_DELTA_NS. */
+#define TEST_DELTA_RESYNC  15
+#define TEST_DELTA_NS      GUEST_TOOLS_NAMESPACE "/delta"
+
+#define TEST_NUM_CPUS      128
+#define TEST_NUM_DISKS     256
+#define TEST_NUM_IRQS      1024
+
+/* Must match GUEST_INFO_HIRES_BUDGET_WINDOW and _PERCENT. */
+#define TEST_HIRES_BUDGET_WINDOW   50
+#define TEST_HIRES_BUDGET_PERCENT  1
+
+#define TEST_HIRES_PERIOD          50   // In milliseconds
+#define TEST_HIRES_STATS           "guest.cpu.runQueue"
+#define TEST_HIRES_NS_P50          GUEST_TOOLS_NAMESPACE "/hires/p50"
+#define TEST_HIRES_NS_MAX          GUEST_TOOLS_NAMESPACE "/hires/max"
+
+/* A stand-in for the tools service object, with the thread pool. */
+typedef struct TestService {
+   GObject parent;
+} TestService;
+
+typedef struct TestServiceClass {
+   GObjectClass parentClass;
+} TestServiceClass;
+
+/* A thread started through the thread pool. */
+typedef struct TestPoolThread {
+   ToolsAppCtx      *ctx;
+   ToolsCorePoolCb   cb;
+   gpointer          data;
+   GDestroyNotify    dtor;
+} TestPoolThread;
+
+static size_t reportSize;
+static Bool reportFull;
+static Bool reportDelta;
+
+/* Looks up the high resolution stats in the reports, if set. */
+static Bool reportHiRes;
+static Bool hiResFound;
+static double hiResP50;
+static double hiResMax;
+
+/* Where the /proc fixtures are, "" to read this guest's. */
+static char fixtureDir[] = "/tmp/testGuestStats.XXXXXX";
+static Bool useFixtures;
+
+/* Grows with each write of the fixtures. */
+static volatile gint fixtureSample;
+
+/* The sampler thread, and what it does with the /proc/stat fixture. */
+static GThread *samplerThread;
+static volatile gint samplerTid;
+static volatile gint samplerOpens;
+static volatile gint samplerBurnUsec;   // CPU used per open
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFixturePath --
+ *
+ *      Maps a /proc or /sys/block path to its fixture, if fixtures are used.
+ *
+ * Results:
+ *      The path to use.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static const char *
+TestFixturePath(const char *pathName,  // IN
+                char *buf,             // OUT
+                size_t bufSize)        // IN
+{
+   if (!useFixtures) {
+      return pathName;
+   }
+
+   if (strcmp(pathName, "/proc/stat") == 0 ||
+       strcmp(pathName, "/proc/diskstats") == 0) {
+      Str_Snprintf(buf, bufSize, "%s/%s", fixtureDir, pathName + 6);
+      return buf;
+   }
+   if (strncmp(pathName, "/sys/block/", 11) == 0) {
+      Str_Snprintf(buf, bufSize, "%s/block/%s", fixtureDir, pathName + 11);
+      return buf;
+   }
+
+   return pathName;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestBurnCPU --
+ *
+ *      Uses usec microseconds of CPU time of the calling thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestBurnCPU(int usec)  // IN
+{
+   struct timespec start;
+   struct timespec now;
+
+   if (usec <= 0) {
+      return;
+   }
+
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+   do {
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+   } while ((now.tv_sec - start.tv_sec) * 1000000LL +
+            (now.tv_nsec - start.tv_nsec) / 1000 < usec);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * open --
+ *
+ *      Stands in for open(): opens the fixture of the /proc files that have
+ *      one. Built with the same large file flags as the library, this
+ *      stands in for open64() when the library calls that instead. Counts
+ *      the reads of /proc/stat by the sampler thread, and makes them as
+ *      costly as asked.
+ *
+ * Results:
+ *      See open().
+ *
+ * Side effects:
+ *      See open().
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+open(const char *pathName,  // IN
+     int flags,             // IN
+     ...)
+{
+   char buf[PATH_MAX];
+   mode_t mode = 0;
+
+   if (flags & O_CREAT) {
+      va_list args;
+
+      va_start(args, flags);
+      mode = va_arg(args, mode_t);
+      va_end(args);
+   }
+
+   if (samplerTid != 0 && syscall(SYS_gettid) == samplerTid &&
+       strcmp(pathName, "/proc/stat") == 0) {
+      g_atomic_int_inc(&samplerOpens);
+      TestBurnCPU(g_atomic_int_get(&samplerBurnUsec));
+   }
+
+   return syscall(SYS_openat, AT_FDCWD,
+                  TestFixturePath(pathName, buf, sizeof buf),
+                  flags | O_LARGEFILE, mode);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * access --
+ *
+ *      Stands in for access(): checks the fixture of the /sys/block
+ *      entries.
+ *
+ * Results:
+ *      See access().
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+access(const char *pathName,  // IN
+       int mode)              // IN
+{
+   char buf[PATH_MAX];
+
+   return syscall(SYS_faccessat, AT_FDCWD,
+                  TestFixturePath(pathName, buf, sizeof buf), mode);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestWriteFixture --
+ *
+ *      Writes a fixture file. The file is replaced at once, as the sampler
+ *      thread may be reading it.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Creates or replaces the file.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestWriteFixture(const char *name,  // IN
+                 const char *data,  // IN
+                 size_t size)       // IN
+{
+   char *path = Str_SafeAsprintf(NULL, "%s/%s", fixtureDir, name);
+   char *tmpPath = Str_SafeAsprintf(NULL, "%s.tmp", path);
+   FILE *fp = fopen(tmpPath, "w");
+
+   CHECK(fp != NULL);
+   CHECK(fwrite(data, 1, size, fp) == size);
+   CHECK(fclose(fp) == 0);
+   CHECK(rename(tmpPath, path) == 0);
+   free(tmpPath);
+   free(path);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestWriteFixtures --
+ *
+ *      Writes the /proc/stat of a guest with TEST_NUM_CPUS CPUs and
+ *      TEST_NUM_IRQS interrupts, and the /proc/diskstats of a guest with
+ *      TEST_NUM_DISKS disks, in the format of a recent kernel. The counters
+ *      grow with each call, so that the rates are not all 0, and so does
+ *      the run queue, which is fixtureSample.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Creates or replaces the fixtures.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestWriteFixtures(void)
+{
+   uint64 sample = (uint64) g_atomic_int_get(&fixtureSample) + 1;
+   DynBuf buf;
+   int i;
+
+   DynBuf_Init(&buf);
+
+   StrUtil_SafeDynBufPrintf(&buf, "cpu  %"FMT64"u 0 %"FMT64"u %"FMT64"u "
+                            "0 0 0 0 0 0\n", sample * TEST_NUM_CPUS,
+                            sample * TEST_NUM_CPUS, sample * TEST_NUM_CPUS);
+   for (i = 0; i < TEST_NUM_CPUS; i++) {
+      StrUtil_SafeDynBufPrintf(&buf, "cpu%d %"FMT64"u 0 %"FMT64"u %"FMT64"u "
+                               "0 0 0 0 0 0\n", i, sample, sample, sample);
+   }
+   StrUtil_SafeDynBufPrintf(&buf, "intr %"FMT64"u", sample * TEST_NUM_IRQS);
+   for (i = 0; i < TEST_NUM_IRQS; i++) {
+      StrUtil_SafeDynBufPrintf(&buf, " %"FMT64"u", sample);
+   }
+   StrUtil_SafeDynBufPrintf(&buf, "\nctxt %"FMT64"u\n"
+                            "btime 1700000000\n"
+                            "processes %"FMT64"u\n"
+                            "procs_running %"FMT64"u\n"
+                            "procs_blocked 0\n"
+                            "softirq %"FMT64"u 0 0 0 0 0 0 0 0 0 0\n",
+                            sample * 1000, sample * 10, sample + 1,
+                            sample * 100);
+   TestWriteFixture("stat", DynBuf_Get(&buf), DynBuf_GetSize(&buf));
+
+   DynBuf_SetSize(&buf, 0);
+   for (i = 0; i < TEST_NUM_DISKS; i++) {
+      StrUtil_SafeDynBufPrintf(&buf, "%4d %7d vd%03d %"FMT64"u 0 %"FMT64"u "
+                               "%"FMT64"u %"FMT64"u 0 %"FMT64"u %"FMT64"u "
+                               "1 %"FMT64"u %"FMT64"u 0 0 0 0 0 0\n",
+                               252, i * 16, i, sample + 1, sample * 8,
+                               sample, sample, sample * 8, sample, sample,
+                               sample * 2);
+   }
+   TestWriteFixture("diskstats", DynBuf_Get(&buf), DynBuf_GetSize(&buf));
+
+   DynBuf_Destroy(&buf);
+   g_atomic_int_set(&fixtureSample, (gint) sample);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSetupFixtures --
+ *
+ *      Creates the fixture directory, with a /sys/block entry per disk.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Creates files.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestSetupFixtures(void)
+{
+   char path[PATH_MAX];
+   int i;
+
+   CHECK(mkdtemp(fixtureDir) != NULL);
+   Str_Snprintf(path, sizeof path, "%s/block", fixtureDir);
+   CHECK(mkdir(path, 0700) == 0);
+   for (i = 0; i < TEST_NUM_DISKS; i++) {
+      Str_Snprintf(path, sizeof path, "%s/block/vd%03d", fixtureDir, i);
+      CHECK(mkdir(path, 0700) == 0);
+   }
+   TestWriteFixtures();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCleanupFixtures --
+ *
+ *      Removes the fixture directory.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Deletes files.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestCleanupFixtures(void)
+{
+   char path[PATH_MAX];
+   int i;
+
+   for (i = 0; i < TEST_NUM_DISKS; i++) {
+      Str_Snprintf(path, sizeof path, "%s/block/vd%03d", fixtureDir, i);
+      rmdir(path);
+   }
+   Str_Snprintf(path, sizeof path, "%s/block", fixtureDir);
+   rmdir(path);
+   Str_Snprintf(path, sizeof path, "%s/stat", fixtureDir);
+   unlink(path);
+   Str_Snprintf(path, sizeof path, "%s/diskstats", fixtureDir);
+   unlink(path);
+   rmdir(fixtureDir);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFindStat --
+ *
+ *      Looks up a double stat by name space and ID in a report.
+ *
+ * Results:
+ *      TRUE and the value if found.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestFindStat(const char *data,          // IN
+             size_t size,               // IN
+             const char *nameSpace,     // IN
+             GuestStatToolsID reportID, // IN
+             double *value)             // OUT
+{
+   const char *pos = data + sizeof(GuestMemInfoLegacy);
+   const char *end = data + size;
+   const char *statNameSpace = "";
+
+   CHECK(size >= sizeof(GuestMemInfoLegacy));
+
+   while (pos < end) {
+      GuestStatHeader header;
+      const char *statValue = NULL;
+      uint16 valueSize = 0;
+      uint64 statID = 0;
+      uint32 bit;
+
+      CHECK(pos + sizeof header <= end);
+      memcpy(&header, pos, sizeof header);
+      pos += sizeof header;
+
+      /* The data follow in the order of their bits. */
+      for (bit = GUEST_DATUM_PRAGMA; bit <= GUEST_DATUM_VALUE; bit <<= 1) {
+         GuestDatumHeader datum;
+
+         if ((header.datumFlags & bit) == 0) {
+            continue;
+         }
+         CHECK(pos + sizeof datum <= end);
+         memcpy(&datum, pos, sizeof datum);
+         pos += sizeof datum;
+         CHECK(pos + datum.dataSize <= end);
+
+         if (bit == GUEST_DATUM_NAMESPACE) {
+            statNameSpace = pos;
+         } else if (bit == GUEST_DATUM_ID) {
+            CHECK(datum.dataSize <= sizeof statID);
+            memcpy(&statID, pos, datum.dataSize);
+         } else if (bit == GUEST_DATUM_VALUE) {
+            statValue = pos;
+            valueSize = datum.dataSize;
+         }
+         pos += datum.dataSize;
+      }
+
+      if (strcmp(statNameSpace, nameSpace) == 0 && statID == reportID &&
+          statValue != NULL && valueSize == sizeof *value) {
+         memcpy(value, statValue, sizeof *value);
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * GuestInfo_ServerReportStats --
+ *
+ *      Stands in for the guestInfo plugin: records what the report looks
+ *      like instead of sending it to the VMX.
+ *
+ * Results:
+ *      TRUE.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+GuestInfo_ServerReportStats(ToolsAppCtx *ctx,  // IN
+                            DynBuf *stats)     // IN
+{
+   const char *data = DynBuf_Get(stats);
+   size_t size = DynBuf_GetSize(stats);
+
+   reportSize = size;
+   /* The delta name space starts with the tools name space. */
+   reportDelta = memmem(data, size, TEST_DELTA_NS,
+                        strlen(TEST_DELTA_NS)) != NULL;
+   reportFull = !reportDelta &&
+                memmem(data, size, GUEST_TOOLS_NAMESPACE,
+                       strlen(GUEST_TOOLS_NAMESPACE)) != NULL;
+
+   if (reportHiRes) {
+      hiResFound = TestFindStat(data, size, TEST_HIRES_NS_P50,
+                                GuestStatID_Linux_CpuRunQueue, &hiResP50) &&
+                   TestFindStat(data, size, TEST_HIRES_NS_MAX,
+                                GuestStatID_Linux_CpuRunQueue, &hiResMax);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestPoolRunThread --
+ *
+ *      Runs a thread started through the stand-in thread pool.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      Frees the thread data.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+TestPoolRunThread(gpointer data)  // IN
+{
+   TestPoolThread *thread = data;
+
+   g_atomic_int_set(&samplerTid, (gint) syscall(SYS_gettid));
+   thread->cb(thread->ctx, thread->data);
+   g_atomic_int_set(&samplerTid, 0);
+
+   if (thread->dtor != NULL) {
+      thread->dtor(thread->data);
+   }
+   g_free(thread);
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestPoolStart --
+ *
+ *      Stands in for the thread pool's start(): only the sampler thread is
+ *      started, and joined by TestJoinSampler.
+ *
+ * Results:
+ *      TRUE.
+ *
+ * Side effects:
+ *      Starts a thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestPoolStart(ToolsAppCtx *ctx,           // IN
+              ToolsCorePoolCb cb,         // IN
+              ToolsCorePoolCb interrupt,  // IN
+              gpointer data,              // IN
+              GDestroyNotify dtor)        // IN
+{
+   TestPoolThread *thread = g_malloc(sizeof *thread);
+
+   CHECK(samplerThread == NULL);
+
+   thread->ctx = ctx;
+   thread->cb = cb;
+   thread->data = data;
+   thread->dtor = dtor;
+   samplerThread = g_thread_create(TestPoolRunThread, thread, TRUE, NULL);
+   CHECK(samplerThread != NULL);
+   return TRUE;
+}
+
+
+static ToolsCorePool testPool = { NULL, NULL, TestPoolStart, NULL };
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestJoinSampler --
+ *
+ *      Waits for the sampler thread, once it was asked to stop.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestJoinSampler(void)
+{
+   if (samplerThread != NULL) {
+      g_thread_join(samplerThread);
+      samplerThread = NULL;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestServiceGetProperty --
+ *
+ *      Gets the only property of the stand-in service object, the thread
+ *      pool.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestServiceGetProperty(GObject *object,     // IN
+                       guint id,            // IN
+                       GValue *value,       // OUT
+                       GParamSpec *pspec)   // IN
+{
+   g_value_set_pointer(value, &testPool);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestServiceClassInit --
+ *
+ *      Sets up the class of the stand-in service object.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestServiceClassInit(gpointer klass,      // IN
+                     gpointer klassData)  // IN
+{
+   G_OBJECT_CLASS(klass)->get_property = TestServiceGetProperty;
+   g_object_class_install_property(G_OBJECT_CLASS(klass), 1,
+                                   g_param_spec_pointer(TOOLS_CORE_PROP_TPOOL,
+                                                        TOOLS_CORE_PROP_TPOOL,
+                                                        TOOLS_CORE_PROP_TPOOL,
+                                                        G_PARAM_READABLE));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestServiceNew --
+ *
+ *      Creates the stand-in service object.
+ *
+ * Results:
+ *      The object.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+TestServiceNew(void)
+{
+   static const GTypeInfo info = {
+      sizeof (TestServiceClass),
+      NULL,                               /* base_init */
+      NULL,                               /* base_finalize */
+      TestServiceClassInit,
+      NULL,                               /* class_finalize */
+      NULL,                               /* class_data */
+      sizeof (TestService),
+      0,                                  /* n_preallocs */
+      NULL,                               /* instance_init */
+   };
+
+   g_type_init();
+   return g_object_new(g_type_register_static(G_TYPE_OBJECT, "TestService",
+                                              &info, 0), NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchSamples --
+ *
+ *      Takes numSamples samples with the given mode, after one to set up
+ *      the collectors and the rates. With fixtures, they are rewritten
+ *      before each sample, outside of the time measured.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the time per sample and the report sizes.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchSamples(ToolsAppCtx *ctx,    // IN
+             const char *label,   // IN
+             Bool delta,          // IN
+             int numSamples)      // IN
+{
+   uint64 start;
+   uint64 elapsed = 0;
+   uint64 totalSize = 0;
+   size_t fullSize = 0;
+   int numFull = 0;
+   int i;
+
+   g_key_file_set_boolean(ctx->config, CONFGROUPNAME_GUESTINFO,
+                          CONFNAME_GUESTINFO_DELTASTATS, delta);
+   GuestInfo_StatProviderPoll(ctx);
+
+   for (i = 0; i < numSamples; i++) {
+      if (useFixtures) {
+         TestWriteFixtures();
+      }
+      start = BenchNowNS();
+      GuestInfo_StatProviderPoll(ctx);
+      elapsed += BenchNowNS() - start;
+      totalSize += reportSize;
+
+      /* A delta report may have no stats at all, so no name space. */
+      if (!delta) {
+         CHECK(reportFull && !reportDelta);
+      } else if (reportFull) {
+         numFull++;
+         fullSize = MAX(fullSize, reportSize);
+      }
+   }
+
+   printf("%-6s %-6s samples %6d %10.1f us/sample %8.1f bytes/report\n",
+          label, delta ? "delta" : "full", numSamples,
+          (double)elapsed / numSamples / 1000,
+          (double)totalSize / numSamples);
+
+   if (delta) {
+      /* The first full report is at most TEST_DELTA_RESYNC samples away. */
+      CHECK(numFull >= numSamples / TEST_DELTA_RESYNC);
+      CHECK(numFull <= numSamples / TEST_DELTA_RESYNC + 1);
+      printf("%-6s %-6s reports %6d %8" FMTSZ "u bytes/full report\n",
+             label, "resync", numFull, fullSize);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestHiRes --
+ *
+ *      Runs the high resolution sampler on the fixtures, rewritten a few
+ *      times per sample period:
+ *
+ *      - for four times as long as the ring lasts before a stats poll, and
+ *        checks that the poll reports the latest samples: even their p50
+ *        was taken after the ring first filled up,
+ *      - then, restarted, with samples over the CPU budget, and checks that
+ *        the sampler slows down after a budget window.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the stats and sample rates.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestHiRes(ToolsAppCtx *ctx)  // IN
+{
+   uint64 ringNS = (uint64) GUEST_INFO_HIRES_RING_SIZE * TEST_HIRES_PERIOD *
+                   1000000;
+   uint64 start;
+   gint fillSample = 0;
+   gint lastSample;
+   gint numOpens;
+   int burnUsec;
+
+   g_key_file_set_boolean(ctx->config, CONFGROUPNAME_GUESTINFO,
+                          CONFNAME_GUESTINFO_DELTASTATS, FALSE);
+   g_key_file_set_string(ctx->config, CONFGROUPNAME_GUESTINFO,
+                         CONFNAME_GUESTINFO_HIRESSTATS, TEST_HIRES_STATS);
+   g_key_file_set_integer(ctx->config, CONFGROUPNAME_GUESTINFO,
+                          CONFNAME_GUESTINFO_HIRESINTERVAL,
+                          TEST_HIRES_PERIOD);
+
+   /* Overflow the ring. */
+   GuestInfo_StatProviderPoll(ctx);
+   CHECK(samplerThread != NULL);
+   start = BenchNowNS();
+   while (BenchNowNS() - start < 4 * ringNS) {
+      TestWriteFixtures();
+      if (fillSample == 0 && BenchNowNS() - start >= ringNS) {
+         fillSample = fixtureSample;
+      }
+      usleep(TEST_HIRES_PERIOD * 1000 / 5);
+   }
+   lastSample = fixtureSample;
+
+   reportHiRes = TRUE;
+   GuestInfo_StatProviderPoll(ctx);
+   reportHiRes = FALSE;
+   CHECK(hiResFound);
+
+   printf("hires  ring   samples %6d p50 %8.0f max %8.0f full at %d, "
+          "last %d\n", g_atomic_int_get(&samplerOpens), hiResP50,
+          hiResMax, fillSample, lastSample);
+   CHECK(hiResP50 > fillSample);
+   CHECK(hiResMax <= lastSample);
+
+   /* Restart the sampler, over the budget at the configured period. */
+   g_key_file_set_integer(ctx->config, CONFGROUPNAME_GUESTINFO,
+                          CONFNAME_GUESTINFO_HIRESINTERVAL, 0);
+   GuestInfo_StatProviderPoll(ctx);
+   TestJoinSampler();
+
+   burnUsec = TEST_HIRES_PERIOD * 1000 * TEST_HIRES_BUDGET_PERCENT / 100 * 3;
+   g_atomic_int_set(&samplerBurnUsec, burnUsec);
+   g_atomic_int_set(&samplerOpens, 0);
+   g_key_file_set_integer(ctx->config, CONFGROUPNAME_GUESTINFO,
+                          CONFNAME_GUESTINFO_HIRESINTERVAL,
+                          TEST_HIRES_PERIOD);
+   GuestInfo_StatProviderPoll(ctx);
+
+   /* After a window, the period doubles: at most half the samples. */
+   while (g_atomic_int_get(&samplerOpens) < TEST_HIRES_BUDGET_WINDOW) {
+      usleep(TEST_HIRES_PERIOD * 1000);
+   }
+   numOpens = g_atomic_int_get(&samplerOpens);
+   usleep(TEST_HIRES_BUDGET_WINDOW / 2 * TEST_HIRES_PERIOD * 1000);
+   numOpens = g_atomic_int_get(&samplerOpens) - numOpens;
+
+   printf("hires  budget samples %6d in %d ms at %d us/sample\n", numOpens,
+          TEST_HIRES_BUDGET_WINDOW / 2 * TEST_HIRES_PERIOD, burnUsec);
+   CHECK(numOpens > 0);
+   CHECK(numOpens <= TEST_HIRES_BUDGET_WINDOW / 2 * 3 / 4);
+
+   g_key_file_set_integer(ctx->config, CONFGROUPNAME_GUESTINFO,
+                          CONFNAME_GUESTINFO_HIRESINTERVAL, 0);
+   GuestInfo_StatProviderPoll(ctx);
+   TestJoinSampler();
+   g_atomic_int_set(&samplerBurnUsec, 0);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   ToolsAppCtx ctx;
+   int numSamples = argc > 1 ? atoi(argv[1]) : 3 * TEST_DELTA_RESYNC * 10;
+
+   if (numSamples < TEST_DELTA_RESYNC) {
+      printf("Usage: %s [samples >= %d]\n", argv[0], TEST_DELTA_RESYNC);
+      return 1;
+   }
+
+   if (!g_thread_supported()) {
+      g_thread_init(NULL);
+   }
+
+   memset(&ctx, 0, sizeof ctx);
+   ctx.name = "testGuestStats";
+   ctx.config = g_key_file_new();
+   ctx.serviceObj = TestServiceNew();
+
+   BenchSamples(&ctx, "guest", FALSE, numSamples);
+   BenchSamples(&ctx, "guest", TRUE, numSamples);
+
+   TestSetupFixtures();
+   useFixtures = TRUE;
+   BenchSamples(&ctx, "large", FALSE, numSamples);
+   BenchSamples(&ctx, "large", TRUE, numSamples);
+   TestHiRes(&ctx);
+   useFixtures = FALSE;
+   TestCleanupFixtures();
+
+   GuestInfo_StatProviderShutdown();
+   g_object_unref(ctx.serviceObj);
+   g_key_file_free(ctx.config);
+
+   printf("PASS\n");
+   return 0;
+}
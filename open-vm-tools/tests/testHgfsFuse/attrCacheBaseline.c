@@ -0,0 +1,187 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * attrCacheBaseline.c --
+ *
+ *      The vmhgfs-fuse attribute cache as it was before it was sharded and
+ *      bounded: one GHashTable keyed by path behind a single mutex, with
+ *      no negative entries and no size bound other than the purge thread,
+ *      which every 30 seconds trims a table of more than 8184 entries to
+ *      4092. The purge thread is not run here; between two purges the
+ *      table grows with every distinct path looked up.
+ *
+ *      Only used by attrCacheBench.c as the baseline to compare against.
+ */
+
+#include <glib.h>
+
+#include "module.h"
+
+#define CACHE_TIMEOUT HGFS_DEFAULT_TTL
+
+typedef struct BaselineAttrCache {
+   HgfsAttrInfo attr;
+   uint64 changeTime;
+   struct list_head list;   /* unused, kept so entries keep their size */
+   char path[0];
+} BaselineAttrCache;
+
+static GHashTable *baselineTable;
+static pthread_mutex_t baselineLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BaselineInitCache --
+ *
+ *    Creates the hash table.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+BaselineInitCache(void)
+{
+   baselineTable = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BaselineGetAttrCache --
+ *
+ *    Retrieves the attr for a given path.
+ *
+ * Results:
+ *    0 on success else -1 on error
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+BaselineGetAttrCache(const char* path,   //IN: Path of file or directory
+                     HgfsAttrInfo *attr) //OUT: Attribute for a given path
+{
+   BaselineAttrCache *tmp;
+   int res = -1;
+   int diff;
+
+   pthread_mutex_lock(&baselineLock);
+
+   tmp = g_hash_table_lookup(baselineTable, path);
+   if (tmp != NULL) {
+      diff = (HGFS_GET_TIME(time(NULL)) - tmp->changeTime) / 10000000;
+      if (diff <= CACHE_TIMEOUT) {
+         *attr = tmp->attr;
+         res = 0;
+      }
+   }
+
+   pthread_mutex_unlock(&baselineLock);
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BaselineSetAttrCache --
+ *
+ *    Updates the table with the given (key, attr) pair.
+ *
+ * Results:
+ *    0 on success else negative value on error
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+BaselineSetAttrCache(const char* path,   //IN: Path of file or directory
+                     HgfsAttrInfo *attr) //IN: Attribute for a given path
+{
+   BaselineAttrCache *tmp;
+   int res = 0;
+
+   pthread_mutex_lock(&baselineLock);
+
+   tmp = g_hash_table_lookup(baselineTable, path);
+   if (tmp != NULL) {
+      tmp->attr = *attr;
+      tmp->changeTime = HGFS_GET_TIME(time(NULL));
+      goto out;
+   }
+
+   tmp = malloc(sizeof(BaselineAttrCache) + strlen(path) + 1);
+   if (tmp == NULL) {
+      res = -ENOMEM;
+      goto out;
+   }
+
+   Str_Strcpy(tmp->path, path, strlen(path) + 1);
+   tmp->attr = *attr;
+   tmp->changeTime = HGFS_GET_TIME(time(NULL));
+
+   g_hash_table_insert(baselineTable, tmp->path, tmp);
+
+out:
+   pthread_mutex_unlock(&baselineLock);
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BaselineCacheEntries --
+ *
+ *    Number of cached paths.
+ *
+ * Results:
+ *    The count.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+uint32
+BaselineCacheEntries(void)
+{
+   uint32 entries;
+
+   pthread_mutex_lock(&baselineLock);
+   entries = g_hash_table_size(baselineTable);
+   pthread_mutex_unlock(&baselineLock);
+   return entries;
+}
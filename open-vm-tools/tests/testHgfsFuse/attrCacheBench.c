@@ -0,0 +1,443 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * attrCacheBench.c --
+ *
+ *      Microbenchmark for the vmhgfs-fuse attribute cache (cache.c). Runs
+ *      concurrent lookups, a lookup/update/negative mix and an eviction
+ *      churn against the real cache code, and checks that negative entries
+ *      are dropped by invalidation.
+ *
+ *      Without a path count the lookup and mix phases are repeated for
+ *      1k, 100k and 1M distinct paths, reporting hit rate and the memory
+ *      the cache grew by. With -b the same sweep runs against the cache
+ *      as it was before it was sharded and bounded (attrCacheBaseline.c),
+ *      to compare rate and footprint with HGFS_ATTR_CACHE_MAX_ENTRIES.
+ *      Run each mode in its own process so the footprints do not mix.
+ *
+ *      Usage: vmware-testhgfsfuse-attrcache [-b] [threads] [paths]
+ *                                           [ops/thread]
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "module.h"
+#include "cache.h"
+#include "testBench.h"
+
+/* Built in from attrCacheBaseline.c. */
+void BaselineInitCache(void);
+int BaselineGetAttrCache(const char* path, HgfsAttrInfo *attr);
+int BaselineSetAttrCache(const char* path, HgfsAttrInfo *attr);
+uint32 BaselineCacheEntries(void);
+
+typedef struct BenchThread {
+   pthread_t thread;
+   uint32 seed;
+   int mix;            /* 0: lookups only, 1: lookup/update/negative mix */
+   uint64 ops;
+   uint64 found;
+} BenchThread;
+
+static const int sweepPaths[] = { 1000, 100000, 1000000 };
+
+static Bool baseline;
+static int numPaths;
+static uint64 opsPerThread = 1000000;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchRand --
+ *
+ *      xorshift32, cheap enough not to show up in the measurement.
+ *
+ * Results:
+ *      Next pseudo random number.
+ *
+ * Side effects:
+ *      Updates *state.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE uint32
+BenchRand(uint32 *state) // IN/OUT
+{
+   uint32 x = *state;
+
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return *state = x;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchPath --
+ *
+ *      Formats the i-th path, spread over directories like a source tree.
+ *      Each path count gets its own tree, so a sweep step starts cold.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Fills buf.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchPath(char *buf,      // OUT
+          size_t bufSize, // IN
+          int i,          // IN
+          Bool missing)   // IN: name of a file that does not exist
+{
+   snprintf(buf, bufSize, "/mnt/hgfs/src%d/module%03d/include/%s%07d.h",
+            numPaths, i % 512, missing ? "missing" : "file", i);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchGet --
+ * BenchSet --
+ *
+ *      Look up and store attributes in the cache under test.
+ *
+ * Results:
+ *      As HgfsGetAttrCache and HgfsSetAttrCache.
+ *
+ * Side effects:
+ *      Updates the cache.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE int
+BenchGet(const char *path,   // IN
+         HgfsAttrInfo *attr) // OUT
+{
+   return baseline ? BaselineGetAttrCache(path, attr) :
+                     HgfsGetAttrCache(path, attr);
+}
+
+static INLINE int
+BenchSet(const char *path,   // IN
+         HgfsAttrInfo *attr) // IN
+{
+   return baseline ? BaselineSetAttrCache(path, attr) :
+                     HgfsSetAttrCache(path, attr);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchWorker --
+ *
+ *      Issues opsPerThread cache operations on random paths.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      Updates the cache and the thread counters.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+BenchWorker(void *data) // IN
+{
+   BenchThread *t = data;
+   HgfsAttrInfo attr;
+   char path[PATH_MAX];
+   uint64 i;
+
+   memset(&attr, 0, sizeof attr);
+
+   for (i = 0; i < opsPerThread; i++) {
+      uint32 r = BenchRand(&t->seed);
+      uint32 op = r % 10;
+      int idx = (r >> 8) % numPaths;
+
+      if (!t->mix || op < 8) {
+         BenchPath(path, sizeof path, idx, FALSE);
+         if (BenchGet(path, &attr) == 0) {
+            t->found++;
+         } else {
+            /* What hgfs_getattr does with the reply from the host. */
+            BenchSet(path, &attr);
+         }
+      } else if (op == 8) {
+         BenchPath(path, sizeof path, idx, FALSE);
+         attr.size = r;
+         BenchSet(path, &attr);
+      } else {
+         BenchPath(path, sizeof path, idx, TRUE);
+         if (BenchGet(path, &attr) == -ENOENT) {
+            t->found++;
+         } else if (!baseline) {
+            /* The old cache had no negative entries: always a miss. */
+            HgfsSetNegativeAttrCache(path);
+         }
+      }
+      t->ops++;
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchRun --
+ *
+ *      Runs one phase with the given number of threads and prints the
+ *      aggregate rate.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the cache.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchRun(const char *name, // IN
+         int numThreads,   // IN
+         int mix)          // IN
+{
+   BenchThread *threads = calloc(numThreads, sizeof *threads);
+   uint64 start;
+   uint64 elapsed;
+   uint64 ops = 0;
+   uint64 found = 0;
+   int i;
+
+   start = BenchNowNS();
+   for (i = 0; i < numThreads; i++) {
+      threads[i].seed = 2463534242U + i * 7919;
+      threads[i].mix = mix;
+      pthread_create(&threads[i].thread, NULL, BenchWorker, &threads[i]);
+   }
+   for (i = 0; i < numThreads; i++) {
+      pthread_join(threads[i].thread, NULL);
+      ops += threads[i].ops;
+      found += threads[i].found;
+   }
+   elapsed = BenchNowNS() - start;
+
+   printf("%-10s threads %2d ops %10"FMT64"u hits %5.1f%% "
+          "%8.1f ns/op %7.2f Mops/s\n",
+          name, numThreads, ops, found * 100.0 / ops,
+          (double)elapsed * numThreads / ops, ops * 1000.0 / elapsed);
+   free(threads);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchCheckNegative --
+ *
+ *      Checks that a negative entry answers -ENOENT until it is invalidated,
+ *      as done by the create, mkdir, mknod and link paths.
+ *
+ * Results:
+ *      TRUE if the cache behaved as expected.
+ *
+ * Side effects:
+ *      Updates the cache.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BenchCheckNegative(void)
+{
+   const char *path = "/mnt/hgfs/src/negative-check";
+   HgfsAttrInfo attr;
+
+   HgfsSetNegativeAttrCache(path);
+   if (HgfsGetAttrCache(path, &attr) != -ENOENT) {
+      return FALSE;
+   }
+   HgfsInvalidateAttrCache(path);
+   return HgfsGetAttrCache(path, &attr) == -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchSweepStep --
+ *
+ *      Populates the cache with numPaths paths and runs the lookup and
+ *      mixed phases for 1..maxThreads threads.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the cache, prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchSweepStep(int maxThreads) // IN
+{
+   HgfsAttrCacheStats stats;
+   HgfsAttrInfo attr;
+   char path[PATH_MAX];
+   long rssStart = BenchResidentKB();
+   uint64 start;
+   uint32 entries;
+   int n;
+   int i;
+
+   memset(&attr, 0, sizeof attr);
+
+   start = BenchNowNS();
+   for (i = 0; i < numPaths; i++) {
+      BenchPath(path, sizeof path, i, FALSE);
+      BenchSet(path, &attr);
+   }
+   printf("populate   paths %d %.1f ns/insert\n", numPaths,
+          (double)(BenchNowNS() - start) / numPaths);
+
+   for (n = 1; n <= maxThreads; n *= 2) {
+      BenchRun("lookup", n, 0);
+   }
+   for (n = 1; n <= maxThreads; n *= 2) {
+      BenchRun("mixed", n, 1);
+   }
+
+   if (baseline) {
+      entries = BaselineCacheEntries();
+   } else {
+      HgfsGetAttrCacheStats(&stats);
+      entries = stats.entries;
+   }
+   printf("footprint  paths %d entries %u rss +%ld KB\n", numPaths, entries,
+          BenchResidentKB() - rssStart);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Populates the cache and runs the benchmark phases.
+ *
+ * Results:
+ *      0 on success, 1 on bad arguments or a failed check.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int maxThreads = 4;
+   HgfsAttrCacheStats stats;
+   HgfsAttrInfo attr;
+   char path[PATH_MAX];
+   uint64 start;
+   int churn;
+   int arg = 1;
+   int i;
+
+   if (argc > arg && strcmp(argv[arg], "-b") == 0) {
+      baseline = TRUE;
+      arg++;
+   }
+   if (argc > arg) {
+      maxThreads = atoi(argv[arg++]);
+   }
+   if (argc > arg) {
+      numPaths = atoi(argv[arg++]);
+   }
+   if (argc > arg) {
+      opsPerThread = strtoull(argv[arg++], NULL, 10);
+   }
+   if (maxThreads < 1 || numPaths < 0 || opsPerThread == 0) {
+      printf("Usage: %s [-b] [threads] [paths] [ops/thread]\n", argv[0]);
+      return 1;
+   }
+
+   printf("cache      %s\n", baseline ? "baseline (single lock, unbounded)" :
+                                        "sharded LRU");
+   if (baseline) {
+      BaselineInitCache();
+   } else {
+      HgfsInitCache();
+   }
+
+   if (numPaths > 0) {
+      BenchSweepStep(maxThreads);
+   } else {
+      for (i = 0; i < ARRAYSIZE(sweepPaths); i++) {
+         numPaths = sweepPaths[i];
+         BenchSweepStep(maxThreads);
+      }
+   }
+
+   if (baseline) {
+      printf("PASS\n");
+      return 0;
+   }
+
+   /* Twice the bound, so every insert of the second half evicts. */
+   memset(&attr, 0, sizeof attr);
+   churn = 2 * HGFS_ATTR_CACHE_MAX_ENTRIES;
+   start = BenchNowNS();
+   for (i = 0; i < churn; i++) {
+      snprintf(path, sizeof path, "/mnt/hgfs/churn/%08d", i);
+      HgfsSetAttrCache(path, &attr);
+   }
+   printf("churn      inserts %d %.1f ns/insert\n", churn,
+          (double)(BenchNowNS() - start) / churn);
+
+   HgfsGetAttrCacheStats(&stats);
+   printf("stats      entries %u hits %"FMT64"u negative %"FMT64"u "
+          "misses %"FMT64"u evictions %"FMT64"u\n",
+          stats.entries, stats.hits, stats.negativeHits, stats.misses,
+          stats.evictions);
+
+   CHECK(stats.entries <= HGFS_ATTR_CACHE_MAX_ENTRIES);
+   CHECK(BenchCheckNegative());
+   printf("PASS\n");
+   return 0;
+}
@@ -0,0 +1,458 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * streamTest.c --
+ *
+ *      Tests for the vmhgfs-fuse readahead and write-behind streams
+ *      (file.c). HgfsTransportSendRequest is replaced by an in-memory
+ *      server holding a single file that every handle refers to, so the
+ *      tests can change the file "on the host" and fail writes at will.
+ *      Reads can be slowed down to check that a readahead window is
+ *      fetched with several requests in flight.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+
+#include "module.h"
+#include "cache.h"
+#include "file.h"
+#include "testBench.h"
+
+#define TEST_FILE_MAX  (8 << 20)
+#define TEST_PATH      "/share/file"
+
+/* Globals normally provided by main.c and the rest of vmhgfs-fuse. */
+static HgfsFuseState testState;
+HgfsFuseState *gState = &testState;
+int LOGLEVEL_THRESHOLD = 0;
+HgfsOp hgfsVersionOpen = HGFS_OP_OPEN_V3;
+HgfsOp hgfsVersionRead = HGFS_OP_READ_V3;
+HgfsOp hgfsVersionWrite = HGFS_OP_WRITE_V3;
+HgfsOp hgfsVersionClose = HGFS_OP_CLOSE_V3;
+HgfsOp hgfsVersionRename = HGFS_OP_RENAME_V3;
+HgfsOp hgfsVersionSetattr = HGFS_OP_SETATTR_V2;
+
+static char hostFile[TEST_FILE_MAX];
+static size_t hostFileSize;
+static uint64 hostWriteTime = 1;
+static Bool failWrites;
+static int numWrites;
+static unsigned int readDelayUs;
+
+static pthread_mutex_t readLock = PTHREAD_MUTEX_INITIALIZER;
+static int numReads;         // Protected by readLock
+static int readsInFlight;    // Protected by readLock
+static int maxReadsInFlight; // Protected by readLock
+
+
+int HgfsClearReadOnly(const char *path, HgfsAttrInfo *attr) { return 0; }
+int HgfsRestoreReadOnly(const char *path, HgfsAttrInfo *attr) { return 0; }
+int HgfsCreateSession(void) { return 0; }
+int HgfsGetOpenMode(uint32 flags) { return 0; }
+
+int
+HgfsStatusConvertToLinux(HgfsStatus status)
+{
+   return status == HGFS_STATUS_SUCCESS ? 0 : -EIO;
+}
+
+int
+HgfsPrivateGetattr(HgfsHandle handle,  // IN
+                   const char *path,   // IN
+                   HgfsAttrInfo *attr) // OUT
+{
+   memset(attr, 0, sizeof *attr);
+   attr->size = hostFileSize;
+   attr->writeTime = hostWriteTime;
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTransportSendRequest --
+ *
+ *      In-memory server. Reads and writes go to hostFile whatever the
+ *      handle; everything else succeeds.
+ *
+ * Results:
+ *      0.
+ *
+ * Side effects:
+ *      Fills in the reply in req.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+HgfsTransportSendRequest(HgfsReq *req) // IN/OUT
+{
+   HgfsRequest *header = (HgfsRequest *)HGFS_REQ_PAYLOAD(req);
+   HgfsReply *reply = (HgfsReply *)HGFS_REQ_PAYLOAD(req);
+   HgfsHandle id = header->id;
+   HgfsOp op = header->op;
+   HgfsStatus status = HGFS_STATUS_SUCCESS;
+
+   if (op == HGFS_OP_READ_V3) {
+      HgfsRequestReadV3 request = *(HgfsRequestReadV3 *)HGFS_REQ_PAYLOAD_V3(req);
+      HgfsReplyReadV3 *replyV3 = (HgfsReplyReadV3 *)HGFS_REP_PAYLOAD_V3(req);
+      size_t n = 0;
+
+      pthread_mutex_lock(&readLock);
+      numReads++;
+      readsInFlight++;
+      maxReadsInFlight = MAX(maxReadsInFlight, readsInFlight);
+      pthread_mutex_unlock(&readLock);
+
+      if (readDelayUs != 0) {
+         usleep(readDelayUs);
+      }
+      if (request.offset < hostFileSize) {
+         n = MIN(request.requiredSize, hostFileSize - request.offset);
+      }
+      memcpy(replyV3->payload, hostFile + request.offset, n);
+      replyV3->actualSize = n;
+
+      pthread_mutex_lock(&readLock);
+      readsInFlight--;
+      pthread_mutex_unlock(&readLock);
+   } else if (op == HGFS_OP_WRITE_V3) {
+      HgfsRequestWriteV3 *request = (HgfsRequestWriteV3 *)HGFS_REQ_PAYLOAD_V3(req);
+      uint64 offset = request->offset;
+      uint32 n = request->requiredSize;
+
+      numWrites++;
+      if (failWrites || offset + n > TEST_FILE_MAX) {
+         status = HGFS_STATUS_GENERIC_ERROR;
+      } else {
+         memcpy(hostFile + offset, request->payload, n);
+         hostFileSize = MAX(hostFileSize, offset + n);
+         ((HgfsReplyWriteV3 *)HGFS_REP_PAYLOAD_V3(req))->actualSize = n;
+      }
+   }
+
+   reply->id = id;
+   reply->status = status;
+   req->payloadSize = HGFS_LARGE_PACKET_MAX;
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestGetattr --
+ *
+ *      The file changes on the host, and a getattr reaching the host
+ *      caches its current size and new write time.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the attribute cache.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestGetattr(void)
+{
+   HgfsAttrInfo attr;
+
+   hostWriteTime++;
+   HgfsPrivateGetattr(HGFS_INVALID_HANDLE, TEST_PATH, &attr);
+   HgfsSetAttrCache(TEST_PATH, &attr);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestAppendOnHost --
+ *
+ *      A handle that read to the end of the file sees data appended on the
+ *      host afterwards (tail -f).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestAppendOnHost(struct fuse_file_info *fi) // IN
+{
+   char buf[4096];
+   loff_t offset = 0;
+   ssize_t n;
+
+   while ((n = HgfsRead(TEST_PATH, fi, buf, sizeof buf, offset)) > 0) {
+      offset += n;
+   }
+   CHECK(offset == hostFileSize);
+
+   memset(hostFile + hostFileSize, 'Z', 5000);
+   hostFileSize += 5000;
+
+   n = HgfsRead(TEST_PATH, fi, buf, sizeof buf, offset);
+   CHECK(n == sizeof buf && buf[0] == 'Z');
+   printf("append on host: ok (%d server reads)\n", numReads);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestChangeOnHost --
+ *
+ *      Data changed on the host inside the readahead window shows up once
+ *      the attribute cache reports a new write time.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestChangeOnHost(struct fuse_file_info *fi) // IN
+{
+   char buf[16];
+
+   TestGetattr();
+   CHECK(HgfsRead(TEST_PATH, fi, buf, 1, 0) == 1);
+   CHECK(HgfsRead(TEST_PATH, fi, buf, 1, 1) == 1);
+   hostFile[2] = '!';
+
+   TestGetattr();
+   CHECK(HgfsRead(TEST_PATH, fi, buf, 1, 2) == 1);
+   CHECK(buf[0] == '!');
+   printf("change on host: ok\n");
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestAttrEvicted --
+ *
+ *      Once the attribute cache has no entry for the file (expired or
+ *      evicted), the readahead buffer is revalidated with the host, and
+ *      data changed there meanwhile shows up.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestAttrEvicted(struct fuse_file_info *fi) // IN
+{
+   char buf[16];
+
+   TestGetattr();
+   CHECK(HgfsRead(TEST_PATH, fi, buf, 1, 0) == 1);
+   CHECK(HgfsRead(TEST_PATH, fi, buf, 1, 1) == 1);
+   hostFile[2] = '?';
+   hostWriteTime++;
+   HgfsInvalidateAttrCache(TEST_PATH);
+
+   CHECK(HgfsRead(TEST_PATH, fi, buf, 1, 2) == 1);
+   CHECK(buf[0] == '?');
+   printf("attr evicted: ok\n");
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestPipelined --
+ *
+ *      Reads a file sequentially with each server read taking readDelayUs,
+ *      first with one request in flight and then with maxRequests. The
+ *      data must be the same, and the readahead must have kept more than
+ *      one read in flight.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestPipelined(struct fuse_file_info *fi, // IN
+              uint32 maxRequests)        // IN
+{
+   static char buf[128 * 1024];
+   size_t fileSize = 4 << 20;
+   loff_t offset = 0;
+   uint64 start;
+   ssize_t n;
+   size_t i;
+
+   for (i = 0; i < fileSize; i++) {
+      hostFile[i] = 'A' + (i / 4096 + i) % 26;
+   }
+   hostFileSize = fileSize;
+   TestGetattr();
+
+   testState.maxRequests = maxRequests;
+   readDelayUs = 1000;
+   pthread_mutex_lock(&readLock);
+   numReads = 0;
+   maxReadsInFlight = 0;
+   pthread_mutex_unlock(&readLock);
+
+   start = BenchNowNS();
+   while ((n = HgfsRead(TEST_PATH, fi, buf, sizeof buf, offset)) > 0) {
+      CHECK(memcmp(buf, hostFile + offset, n) == 0);
+      offset += n;
+   }
+   CHECK(offset == fileSize);
+   readDelayUs = 0;
+
+   printf("pipelined: max_requests %u, %d server reads, %d in flight, "
+          "%.1f ms\n", maxRequests, numReads, maxReadsInFlight,
+          (BenchNowNS() - start) / 1e6);
+   CHECK(maxRequests == 1 ? maxReadsInFlight == 1 : maxReadsInFlight > 1);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCrossHandle --
+ *
+ *      Writes buffered by one handle are seen by reads through another
+ *      handle of the same file, and deferred write errors are reported to
+ *      the writer, not to the reader that caused the flush.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestCrossHandle(struct fuse_file_info *writer, // IN
+                struct fuse_file_info *reader) // IN
+{
+   char buf[16];
+
+   numWrites = 0;
+   CHECK(HgfsWrite(TEST_PATH, writer, "HELLO", 5, 10) == 5);
+   CHECK(numWrites == 0);
+   CHECK(HgfsRead(TEST_PATH, reader, buf, 5, 10) == 5);
+   CHECK(memcmp(buf, "HELLO", 5) == 0);
+
+   failWrites = TRUE;
+   CHECK(HgfsWrite(TEST_PATH, writer, "WORLD", 5, 20) == 5);
+   CHECK(HgfsRead(TEST_PATH, reader, buf, 5, 20) == 5);
+   failWrites = FALSE;
+   CHECK(HgfsWrite(TEST_PATH, writer, "AGAIN", 5, 30) == -EIO);
+   CHECK(HgfsWrite(TEST_PATH, writer, "AGAIN", 5, 30) == 5);
+   CHECK(HgfsFlush(writer) == 0);
+
+   failWrites = TRUE;
+   CHECK(HgfsWrite(TEST_PATH, writer, "X", 1, 40) == 1);
+   HgfsFlushWrites(TEST_PATH);
+   failWrites = FALSE;
+   CHECK(HgfsFlush(writer) == -EIO);
+   CHECK(HgfsFlush(writer) == 0);
+   printf("cross handle: ok\n");
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Runs the tests.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   struct fuse_file_info first;
+   struct fuse_file_info second;
+   struct fuse_file_info serial;
+   struct fuse_file_info pipelined;
+   size_t i;
+
+   memset(&first, 0, sizeof first);
+   memset(&second, 0, sizeof second);
+   memset(&serial, 0, sizeof serial);
+   memset(&pipelined, 0, sizeof pipelined);
+   first.fh = 1;
+   second.fh = 2;
+   serial.fh = 3;
+   pipelined.fh = 4;
+
+   for (i = 0; i < 100000; i++) {
+      hostFile[i] = 'a' + i % 26;
+   }
+   hostFileSize = 100000;
+
+   HgfsInitCache();
+
+   TestAppendOnHost(&first);
+   TestChangeOnHost(&first);
+   TestAttrEvicted(&first);
+   TestCrossHandle(&first, &second);
+   TestPipelined(&serial, 1);
+   TestPipelined(&pipelined, 4);
+
+   CHECK(HgfsRelease(first.fh) == 0);
+   CHECK(HgfsRelease(second.fh) == 0);
+   CHECK(HgfsRelease(serial.fh) == 0);
+   CHECK(HgfsRelease(pipelined.fh) == 0);
+
+   printf("PASS\n");
+   return 0;
+}
@@ -0,0 +1,439 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * dirBench.c --
+ *
+ *      Benchmark and checks for HGFS server directory searches. Creates a
+ *      directory with many entries and, through
+ *      HgfsServerManager_ProcessPacket:
+ *
+ *      - times opening a search and reading the first page, and the memory
+ *        used by then, which should not depend on the size of the
+ *        directory,
+ *      - reads the rest of the directory, checking that every entry is
+ *        returned once,
+ *      - restarts the search at offset 0, checking that the first entry is
+ *        returned again,
+ *      - opens more searches than the server keeps directories open for,
+ *        and reads two pages of each in turn, checking that searches whose
+ *        directory was closed continue where they stopped and that the
+ *        number of open files stays bounded.
+ *
+ *      A V3 search read returns one entry, so a page here is
+ *      TEST_PAGE_ENTRIES reads at consecutive offsets, about what a client
+ *      asks for to fill one readdir buffer.
+ *
+ *      Usage: vmware-testhgfsserver-dirs [entries] [searches]
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "hgfsProto.h"
+#include "hgfsServerManager.h"
+#include "hgfsServerPolicy.h"
+#include "str.h"
+#include "testBench.h"
+
+#define TEST_PAGE_ENTRIES 128
+
+/* HGFS_MAX_SEARCH_DIR_FDS of the server. */
+#define TEST_MAX_SEARCH_DIR_FDS 64
+
+static HgfsServerMgrData mgrData;
+static char requestBuf[HGFS_LARGE_PACKET_MAX];
+static char replyBuf[HGFS_LARGE_PACKET_MAX];
+static char dirPath[] = "/tmp/hgfsDirBench.XXXXXX";
+static uint32 requestId;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSend --
+ *
+ *      Sends a V3 request whose payload has been written after the header
+ *      in requestBuf.
+ *
+ * Results:
+ *      The reply status.
+ *
+ * Side effects:
+ *      The reply payload is in replyBuf after the header.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+TestSend(HgfsOp op,          // IN
+         size_t payloadSize) // IN
+{
+   HgfsRequest *request = (HgfsRequest *)requestBuf;
+   size_t replySize = sizeof replyBuf;
+
+   request->id = ++requestId;
+   request->op = op;
+   CHECK(HgfsServerManager_ProcessPacket(&mgrData, requestBuf,
+                                         sizeof *request + payloadSize,
+                                         replyBuf, &replySize));
+   CHECK(replySize >= sizeof(HgfsReply));
+   CHECK(((HgfsReply *)replyBuf)->id == request->id);
+   return ((HgfsReply *)replyBuf)->status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSearchOpen --
+ *
+ *      Opens a search on the test directory.
+ *
+ * Results:
+ *      The search handle.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsHandle
+TestSearchOpen(void)
+{
+   HgfsRequestSearchOpenV3 *openReq =
+      (HgfsRequestSearchOpenV3 *)(requestBuf + sizeof(HgfsRequest));
+   uint32 nameLen;
+   uint32 i;
+
+   memset(openReq, 0, sizeof *openReq);
+   openReq->dirName.caseType = HGFS_FILE_NAME_CASE_SENSITIVE;
+   openReq->dirName.fid = HGFS_INVALID_HANDLE;
+
+   /* The guest policy shares the whole file system as "root". */
+   nameLen = Str_Snprintf(openReq->dirName.name, PATH_MAX, "%s%s",
+                          HGFS_SERVER_POLICY_ROOT_SHARE_NAME, dirPath);
+   for (i = 0; i < nameLen; i++) {
+      if (openReq->dirName.name[i] == '/') {
+         openReq->dirName.name[i] = '\0';
+      }
+   }
+   openReq->dirName.length = nameLen;
+
+   CHECK(TestSend(HGFS_OP_SEARCH_OPEN_V3, sizeof *openReq + nameLen) ==
+         HGFS_STATUS_SUCCESS);
+   return ((HgfsReplySearchOpenV3 *)(replyBuf + sizeof(HgfsReply)))->search;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSearchRead --
+ *
+ *      Reads the entry at offset.
+ *
+ * Results:
+ *      TRUE and the entry's name, FALSE at the end of the directory.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestSearchRead(HgfsHandle search,  // IN
+               uint32 offset,      // IN
+               char *name,         // OUT
+               size_t nameSize)    // IN
+{
+   HgfsRequestSearchReadV3 *readReq =
+      (HgfsRequestSearchReadV3 *)(requestBuf + sizeof(HgfsRequest));
+   HgfsReplySearchReadV3 *reply;
+   HgfsDirEntry *dirent;
+
+   memset(readReq, 0, sizeof *readReq);
+   readReq->search = search;
+   readReq->offset = offset;
+   CHECK(TestSend(HGFS_OP_SEARCH_READ_V3, sizeof *readReq) ==
+         HGFS_STATUS_SUCCESS);
+
+   /* Past the end, the server returns either no entry or an empty name. */
+   reply = (HgfsReplySearchReadV3 *)(replyBuf + sizeof(HgfsReply));
+   dirent = (HgfsDirEntry *)reply->payload;
+   if (reply->count == 0 || dirent->fileName.length == 0) {
+      return FALSE;
+   }
+   CHECK(reply->count == 1);
+   CHECK(dirent->fileName.length < nameSize);
+   memcpy(name, dirent->fileName.name, dirent->fileName.length);
+   name[dirent->fileName.length] = '\0';
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSearchReadPage --
+ *
+ *      Reads TEST_PAGE_ENTRIES entries starting at offset, or up to the end
+ *      of the directory.
+ *
+ * Results:
+ *      The number of entries read, the name of the first in firstName.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+TestSearchReadPage(HgfsHandle search,     // IN
+                   uint32 offset,         // IN
+                   char *firstName,       // OUT
+                   size_t firstNameSize)  // IN
+{
+   char name[NAME_MAX + 1];
+   uint32 count;
+
+   for (count = 0; count < TEST_PAGE_ENTRIES; count++) {
+      if (!TestSearchRead(search, offset + count, name, sizeof name)) {
+         break;
+      }
+      if (count == 0) {
+         Str_Snprintf(firstName, firstNameSize, "%s", name);
+      }
+   }
+
+   return count;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSearchClose --
+ *
+ *      Closes a search.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestSearchClose(HgfsHandle search) // IN
+{
+   HgfsRequestSearchCloseV3 *closeReq =
+      (HgfsRequestSearchCloseV3 *)(requestBuf + sizeof(HgfsRequest));
+
+   memset(closeReq, 0, sizeof *closeReq);
+   closeReq->search = search;
+   CHECK(TestSend(HGFS_OP_SEARCH_CLOSE_V3, sizeof *closeReq) ==
+         HGFS_STATUS_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestOpenFds --
+ *
+ *      Counts the open file descriptors of the process.
+ *
+ * Results:
+ *      The count.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+TestOpenFds(void)
+{
+   DIR *dir = opendir("/proc/self/fd");
+   int count = 0;
+
+   CHECK(dir != NULL);
+   while (readdir(dir) != NULL) {
+      count++;
+   }
+   closedir(dir);
+
+   /* ".", ".." and the descriptor of dir itself. */
+   return count - 3;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Creates the test directory and runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   uint32 numEntries = argc > 1 ? atoi(argv[1]) : 1000000;
+   int numSearches = argc > 2 ? atoi(argv[2]) : 100;
+   char path[PATH_MAX];
+   char firstName[NAME_MAX + 1];
+   char secondPageName[NAME_MAX + 1];
+   char name[NAME_MAX + 1];
+   HgfsHandle *searches;
+   HgfsHandle search;
+   uint8 *seen;
+   uint64 start;
+   long rssKB;
+   uint32 offset;
+   uint32 index;
+   size_t dirLen;
+   int baseFds;
+   int maxFds;
+   uint32 i;
+
+   if (numEntries < TEST_PAGE_ENTRIES || numSearches < 1) {
+      printf("Usage: %s [entries >= %d] [searches]\n", argv[0],
+             TEST_PAGE_ENTRIES);
+      return 1;
+   }
+
+   CHECK(mkdtemp(dirPath) != NULL);
+   dirLen = Str_Snprintf(path, sizeof path, "%s/", dirPath);
+   start = BenchNowNS();
+   for (i = 0; i < numEntries; i++) {
+      int fd;
+
+      Str_Snprintf(path + dirLen, sizeof path - dirLen, "File%u", i);
+      fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+      CHECK(fd >= 0);
+      close(fd);
+   }
+   printf("create      entries %8u %10.1f ms\n", numEntries,
+          (BenchNowNS() - start) / 1e6);
+
+   seen = calloc(numEntries, sizeof *seen);
+   CHECK(seen != NULL);
+
+   HgfsServerManager_DataInit(&mgrData, "testHgfsServer", NULL, NULL);
+   CHECK(HgfsServerManager_Register(&mgrData));
+
+   /* Time to the first page, and the memory it takes. */
+   rssKB = BenchResidentKB();
+   start = BenchNowNS();
+   search = TestSearchOpen();
+   CHECK(TestSearchReadPage(search, 0, firstName, sizeof firstName) ==
+         TEST_PAGE_ENTRIES);
+   printf("first page  entries %8u %10.3f ms %6ld KB RSS growth\n",
+          numEntries, (BenchNowNS() - start) / 1e6,
+          BenchResidentKB() - rssKB);
+
+   /* The whole directory, every entry exactly once. */
+   start = BenchNowNS();
+   for (offset = 0; TestSearchRead(search, offset, name, sizeof name);
+        offset++) {
+      if (offset == TEST_PAGE_ENTRIES) {
+         Str_Snprintf(secondPageName, sizeof secondPageName, "%s", name);
+      }
+      if (sscanf(name, "File%u", &index) == 1) {
+         CHECK(index < numEntries && !seen[index]);
+         seen[index] = 1;
+      }
+   }
+   printf("all entries entries %8u %10.1f ms %6ld KB RSS growth\n",
+          numEntries, (BenchNowNS() - start) / 1e6,
+          BenchResidentKB() - rssKB);
+   CHECK(offset == numEntries + 2);   /* Plus "." and "..". */
+   for (i = 0; i < numEntries; i++) {
+      CHECK(seen[i]);
+   }
+
+   /* A restart at offset 0 rereads the directory from the start. */
+   CHECK(TestSearchRead(search, 0, name, sizeof name));
+   CHECK(strcmp(name, firstName) == 0);
+   TestSearchClose(search);
+
+   /*
+    * More searches than directories held open, a page of each read in
+    * turn, so that every search has its directory closed before its second
+    * page is read.
+    */
+   searches = calloc(numSearches, sizeof *searches);
+   CHECK(searches != NULL);
+   baseFds = TestOpenFds();
+   maxFds = baseFds;
+   for (i = 0; i < numSearches; i++) {
+      searches[i] = TestSearchOpen();
+      CHECK(TestSearchReadPage(searches[i], 0, name, sizeof name) ==
+            TEST_PAGE_ENTRIES);
+      CHECK(strcmp(name, firstName) == 0);
+      maxFds = MAX(maxFds, TestOpenFds());
+   }
+   for (i = 0; i < numSearches; i++) {
+      CHECK(TestSearchReadPage(searches[i], TEST_PAGE_ENTRIES, name,
+                               sizeof name) > 0);
+      CHECK(strcmp(name, secondPageName) == 0);
+      maxFds = MAX(maxFds, TestOpenFds());
+   }
+   printf("searches    open    %8d %10d fds at most\n", numSearches,
+          maxFds - baseFds);
+   CHECK(maxFds - baseFds <= TEST_MAX_SEARCH_DIR_FDS);
+   for (i = 0; i < numSearches; i++) {
+      TestSearchClose(searches[i]);
+   }
+
+   free(searches);
+   free(seen);
+   HgfsServerManager_Unregister(&mgrData);
+
+   for (i = 0; i < numEntries; i++) {
+      Str_Snprintf(path + dirLen, sizeof path - dirLen, "File%u", i);
+      unlink(path);
+   }
+   rmdir(dirPath);
+
+   printf("PASS\n");
+   return 0;
+}
@@ -0,0 +1,349 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * handleBench.c --
+ *
+ *      Benchmark and checks for the HGFS server file node handles. Drives
+ *      the guest HGFS server through HgfsServerManager_ProcessPacket, the
+ *      way the tools hgfsServer plugin does:
+ *
+ *      - reads through the last opened handle with one and with many files
+ *        open, to show that a handle lookup does not depend on the number
+ *        of open files (the last opened node is in the open node cache, so
+ *        no reopen is measured),
+ *      - opens and closes a file many more times than a handle's
+ *        generation can count, checking that the first handle is rejected
+ *        all along and never handed out again,
+ *      - starts a new session with the handle counter put back, as after a
+ *        checkpoint restore, checking that it does not reissue the handles
+ *        of the first session.
+ *
+ *      Usage: vmware-testhgfsserver-handles [handles] [reads] [reopens]
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerManager.h"
+#include "hgfsServerPolicy.h"
+#include "str.h"
+#include "testBench.h"
+
+#define TEST_READ_SIZE 4096
+
+static HgfsServerMgrData mgrData;
+static char requestBuf[HGFS_LARGE_PACKET_MAX];
+static char replyBuf[HGFS_LARGE_PACKET_MAX];
+static char cpName[PATH_MAX];
+static uint32 cpNameLen;
+static uint32 requestId;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSend --
+ *
+ *      Sends a V3 request whose payload has been written after the header
+ *      in requestBuf.
+ *
+ * Results:
+ *      The reply status.
+ *
+ * Side effects:
+ *      The reply payload is in replyBuf after the header.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+TestSend(HgfsOp op,          // IN
+         size_t payloadSize) // IN
+{
+   HgfsRequest *request = (HgfsRequest *)requestBuf;
+   size_t replySize = sizeof replyBuf;
+
+   request->id = ++requestId;
+   request->op = op;
+   CHECK(HgfsServerManager_ProcessPacket(&mgrData, requestBuf,
+                                         sizeof *request + payloadSize,
+                                         replyBuf, &replySize));
+   CHECK(replySize >= sizeof(HgfsReply));
+   CHECK(((HgfsReply *)replyBuf)->id == request->id);
+   return ((HgfsReply *)replyBuf)->status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestOpen --
+ *
+ *      Opens the test file read only.
+ *
+ * Results:
+ *      The server handle.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsHandle
+TestOpen(void)
+{
+   HgfsRequestOpenV3 *openReq =
+      (HgfsRequestOpenV3 *)(requestBuf + sizeof(HgfsRequest));
+   HgfsHandle handle;
+
+   memset(openReq, 0, sizeof *openReq);
+   openReq->mask = HGFS_OPEN_VALID_MODE | HGFS_OPEN_VALID_FLAGS |
+                HGFS_OPEN_VALID_FILE_NAME;
+   openReq->mode = HGFS_OPEN_MODE_READ_ONLY;
+   openReq->flags = HGFS_OPEN;
+   openReq->desiredLock = HGFS_LOCK_NONE;
+   openReq->fileName.caseType = HGFS_FILE_NAME_CASE_SENSITIVE;
+   openReq->fileName.fid = HGFS_INVALID_HANDLE;
+   openReq->fileName.length = cpNameLen;
+   memcpy(openReq->fileName.name, cpName, cpNameLen + 1);
+
+   CHECK(TestSend(HGFS_OP_OPEN_V3, sizeof *openReq + cpNameLen) ==
+         HGFS_STATUS_SUCCESS);
+   handle = ((HgfsReplyOpenV3 *)(replyBuf + sizeof(HgfsReply)))->file;
+   CHECK(handle != HGFS_INVALID_HANDLE);
+   return handle;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRead --
+ *
+ *      Reads TEST_READ_SIZE bytes at offset through handle.
+ *
+ * Results:
+ *      The reply status.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+TestRead(HgfsHandle handle, // IN
+         uint64 offset)     // IN
+{
+   HgfsRequestReadV3 *readReq =
+      (HgfsRequestReadV3 *)(requestBuf + sizeof(HgfsRequest));
+
+   memset(readReq, 0, sizeof *readReq);
+   readReq->file = handle;
+   readReq->offset = offset;
+   readReq->requiredSize = TEST_READ_SIZE;
+   return TestSend(HGFS_OP_READ_V3, sizeof *readReq);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestClose --
+ *
+ *      Closes handle.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Exits on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestClose(HgfsHandle handle) // IN
+{
+   HgfsRequestCloseV3 *closeReq =
+      (HgfsRequestCloseV3 *)(requestBuf + sizeof(HgfsRequest));
+
+   memset(closeReq, 0, sizeof *closeReq);
+   closeReq->file = handle;
+   CHECK(TestSend(HGFS_OP_CLOSE_V3, sizeof *closeReq) == HGFS_STATUS_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchReads --
+ *
+ *      Issues numReads reads through handle.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the rate.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchReads(HgfsHandle handle, // IN
+           int numOpen,       // IN: number of open handles
+           int numReads)      // IN
+{
+   uint64 start;
+   int i;
+
+   start = BenchNowNS();
+   for (i = 0; i < numReads; i++) {
+      CHECK(TestRead(handle, i % 16 * TEST_READ_SIZE) == HGFS_STATUS_SUCCESS);
+   }
+   printf("read       open %6d reads %8d %8.1f ns/read\n",
+          numOpen, numReads, (double)(BenchNowNS() - start) / numReads);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Creates the test file and runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   char path[] = "/tmp/hgfsHandleBench.XXXXXX";
+   char data[16 * TEST_READ_SIZE];
+   int numHandles = argc > 1 ? atoi(argv[1]) : 10000;
+   int numReads = argc > 2 ? atoi(argv[2]) : 200000;
+   int numReopens = argc > 3 ? atoi(argv[3]) : 140000;
+   HgfsHandle *handles;
+   HgfsHandle stale;
+   HgfsHandle last;
+   HgfsHandle handle;
+   uint32 counter;
+   uint64 start;
+   uint32 i;
+   int fd;
+
+   if (numHandles < 1 || numReads < 1 || numReopens < 1) {
+      printf("Usage: %s [handles] [reads] [reopens]\n", argv[0]);
+      return 1;
+   }
+
+   fd = mkstemp(path);
+   CHECK(fd >= 0);
+   memset(data, 'h', sizeof data);
+   CHECK(write(fd, data, sizeof data) == sizeof data);
+   close(fd);
+
+   /* The guest policy shares the whole file system as "root". */
+   cpNameLen = Str_Snprintf(cpName, sizeof cpName, "%s%s",
+                            HGFS_SERVER_POLICY_ROOT_SHARE_NAME, path);
+   for (i = 0; i < cpNameLen; i++) {
+      if (cpName[i] == '/') {
+         cpName[i] = '\0';
+      }
+   }
+
+   HgfsServerManager_DataInit(&mgrData, "testHgfsServer", NULL, NULL);
+   CHECK(HgfsServerManager_Register(&mgrData));
+
+   handles = calloc(numHandles, sizeof *handles);
+   CHECK(handles != NULL);
+   handles[0] = TestOpen();
+   BenchReads(handles[0], 1, numReads);
+
+   start = BenchNowNS();
+   for (i = 1; i < numHandles; i++) {
+      handles[i] = TestOpen();
+   }
+   printf("open       open %6d %8.1f ns/open\n", numHandles,
+          (double)(BenchNowNS() - start) / MAX(numHandles - 1, 1));
+   BenchReads(handles[numHandles - 1], numHandles, numReads);
+
+   for (i = 0; i < numHandles; i++) {
+      TestClose(handles[i]);
+   }
+   CHECK(TestRead(handles[0], 0) == HGFS_STATUS_INVALID_HANDLE);
+
+   /*
+    * The node of a closed handle goes back to the head of the free list,
+    * so this reuses one slot over and over.
+    */
+   stale = TestOpen();
+   TestClose(stale);
+   last = stale;
+   start = BenchNowNS();
+   for (i = 0; i < numReopens; i++) {
+      handle = TestOpen();
+
+      CHECK(handle != stale && handle != last);
+      CHECK(TestRead(stale, 0) == HGFS_STATUS_INVALID_HANDLE);
+      TestClose(handle);
+      last = handle;
+   }
+   printf("reopen     reopens %6d %8.1f ns/open+read+close\n", numReopens,
+          (double)(BenchNowNS() - start) / numReopens);
+
+   /*
+    * The new session starts over with slot 0, which the first session
+    * used for handles[0] and for every reopen.
+    */
+   counter = HgfsServer_GetHandleCounter();
+   HgfsServerManager_Unregister(&mgrData);
+   HgfsServer_SetHandleCounter(counter);
+   CHECK(HgfsServerManager_Register(&mgrData));
+   handle = TestOpen();
+   printf("session    first handle %#x, previous session %#x\n",
+          handle, handles[0]);
+   CHECK(handle != handles[0] && handle != stale && handle != last);
+   CHECK(TestRead(handles[0], 0) == HGFS_STATUS_INVALID_HANDLE);
+   TestClose(handle);
+
+   free(handles);
+   HgfsServerManager_Unregister(&mgrData);
+   unlink(path);
+
+   printf("PASS\n");
+   return 0;
+}
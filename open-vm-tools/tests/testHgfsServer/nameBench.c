@@ -0,0 +1,292 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * nameBench.c --
+ *
+ *      Benchmark and checks for the HGFS server name resolution. Creates a
+ *      directory tree TEST_DEPTH levels deep with many files at the bottom,
+ *      then gets the attributes of files by name through
+ *      HgfsServerManager_ProcessPacket:
+ *
+ *      - with the case the files have on the host,
+ *      - case-insensitively, in lower case, so that every component has to
+ *        be looked up in its directory,
+ *      - after renaming a file on the host, checking that the old name no
+ *        longer resolves and the new one does.
+ *
+ *      The lookups start a few seconds after the tree was created, as the
+ *      server does not cache case-insensitive lookups in a directory that
+ *      has just changed.
+ *
+ *      Usage: vmware-testhgfsserver-names [entries] [lookups]
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "hgfsProto.h"
+#include "hgfsServerManager.h"
+#include "hgfsServerPolicy.h"
+#include "str.h"
+#include "testBench.h"
+
+#define TEST_DEPTH       6
+#define TEST_WORKING_SET 64
+
+static HgfsServerMgrData mgrData;
+static char requestBuf[HGFS_LARGE_PACKET_MAX];
+static char replyBuf[HGFS_LARGE_PACKET_MAX];
+static char rootDir[] = "/tmp/hgfsNameBench.XXXXXX";
+static uint32 requestId;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestGetattr --
+ *
+ *      Gets the attributes of the file at relPath, a path relative to
+ *      rootDir, by name.
+ *
+ * Results:
+ *      The reply status.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+TestGetattr(const char *relPath,   // IN
+            HgfsCaseType caseType) // IN
+{
+   HgfsRequest *request = (HgfsRequest *)requestBuf;
+   HgfsRequestGetattrV3 *getattrReq =
+      (HgfsRequestGetattrV3 *)(requestBuf + sizeof *request);
+   size_t replySize = sizeof replyBuf;
+   uint32 nameLen;
+   uint32 i;
+
+   memset(getattrReq, 0, sizeof *getattrReq);
+   getattrReq->fileName.caseType = caseType;
+   getattrReq->fileName.fid = HGFS_INVALID_HANDLE;
+
+   /* The guest policy shares the whole file system as "root". */
+   nameLen = Str_Snprintf(getattrReq->fileName.name, PATH_MAX, "%s%s/%s",
+                          HGFS_SERVER_POLICY_ROOT_SHARE_NAME, rootDir,
+                          relPath);
+   CHECK(nameLen > 0);
+   for (i = 0; i < nameLen; i++) {
+      if (getattrReq->fileName.name[i] == '/') {
+         getattrReq->fileName.name[i] = '\0';
+      }
+   }
+   getattrReq->fileName.length = nameLen;
+
+   request->id = ++requestId;
+   request->op = HGFS_OP_GETATTR_V3;
+   CHECK(HgfsServerManager_ProcessPacket(&mgrData, requestBuf,
+                                         sizeof *request + sizeof *getattrReq +
+                                         nameLen,
+                                         replyBuf, &replySize));
+   CHECK(replySize >= sizeof(HgfsReply));
+   CHECK(((HgfsReply *)replyBuf)->id == request->id);
+   return ((HgfsReply *)replyBuf)->status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFilePath --
+ *
+ *      Formats the path of file number i relative to rootDir, lower cased
+ *      if requested.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestFilePath(char *buf,      // OUT
+             size_t bufSize, // IN
+             int i,          // IN
+             Bool lower)     // IN
+{
+   size_t len = 0;
+   int level;
+
+   for (level = 0; level < TEST_DEPTH; level++) {
+      len += Str_Snprintf(buf + len, bufSize - len, "Dir%d/", level);
+   }
+   Str_Snprintf(buf + len, bufSize - len, "File%06d", i);
+
+   if (lower) {
+      for (len = 0; buf[len] != '\0'; len++) {
+         buf[len] = tolower(buf[len]);
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchGetattr --
+ *
+ *      Gets the attributes of the files of the working set, numLookups
+ *      times in all.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the rate.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchGetattr(const char *what,      // IN
+             HgfsCaseType caseType, // IN
+             Bool lower,            // IN
+             int numEntries,        // IN
+             int numLookups)        // IN
+{
+   char relPath[PATH_MAX];
+   uint64 start;
+   int i;
+
+   start = BenchNowNS();
+   for (i = 0; i < numLookups; i++) {
+      TestFilePath(relPath, sizeof relPath,
+                   i % TEST_WORKING_SET * (numEntries / TEST_WORKING_SET),
+                   lower);
+      CHECK(TestGetattr(relPath, caseType) == HGFS_STATUS_SUCCESS);
+   }
+   printf("getattr    %-12s entries %7d lookups %7d %10.1f ns/lookup\n",
+          what, numEntries, numLookups,
+          (double)(BenchNowNS() - start) / numLookups);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Creates the test tree and runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numEntries = argc > 1 ? atoi(argv[1]) : 20000;
+   int numLookups = argc > 2 ? atoi(argv[2]) : 20000;
+   char path[PATH_MAX];
+   char newPath[PATH_MAX];
+   char relPath[PATH_MAX];
+   size_t dirLen;
+   int level;
+   int i;
+
+   if (numEntries < TEST_WORKING_SET || numLookups < 1) {
+      printf("Usage: %s [entries >= %d] [lookups]\n", argv[0],
+             TEST_WORKING_SET);
+      return 1;
+   }
+
+   CHECK(mkdtemp(rootDir) != NULL);
+   dirLen = Str_Snprintf(path, sizeof path, "%s", rootDir);
+   for (level = 0; level < TEST_DEPTH; level++) {
+      dirLen += Str_Snprintf(path + dirLen, sizeof path - dirLen, "/Dir%d",
+                             level);
+      CHECK(mkdir(path, 0700) == 0);
+   }
+   for (i = 0; i < numEntries; i++) {
+      FILE *f;
+
+      Str_Snprintf(path + dirLen, sizeof path - dirLen, "/File%06d", i);
+      f = fopen(path, "w");
+      CHECK(f != NULL);
+      fclose(f);
+   }
+   sleep(3);
+
+   HgfsServerManager_DataInit(&mgrData, "testHgfsServer", NULL, NULL);
+   CHECK(HgfsServerManager_Register(&mgrData));
+
+   BenchGetattr("exact case", HGFS_FILE_NAME_CASE_SENSITIVE, FALSE,
+                numEntries, numLookups);
+   BenchGetattr("insensitive", HGFS_FILE_NAME_CASE_INSENSITIVE, TRUE,
+                numEntries, numLookups);
+
+   /* A rename on the host must show through a case-insensitive lookup. */
+   TestFilePath(relPath, sizeof relPath, 0, TRUE);
+   CHECK(TestGetattr(relPath, HGFS_FILE_NAME_CASE_INSENSITIVE) ==
+         HGFS_STATUS_SUCCESS);
+   Str_Snprintf(path + dirLen, sizeof path - dirLen, "/File%06d", 0);
+   Str_Snprintf(newPath, sizeof newPath, "%s", path);
+   Str_Snprintf(newPath + dirLen, sizeof newPath - dirLen, "/Renamed");
+   CHECK(rename(path, newPath) == 0);
+   CHECK(TestGetattr(relPath, HGFS_FILE_NAME_CASE_INSENSITIVE) ==
+         HGFS_STATUS_NO_SUCH_FILE_OR_DIR);
+   *strrchr(relPath, '/') = '\0';
+   Str_Strcat(relPath, "/renamed", sizeof relPath);
+   CHECK(TestGetattr(relPath, HGFS_FILE_NAME_CASE_INSENSITIVE) ==
+         HGFS_STATUS_SUCCESS);
+   CHECK(rename(newPath, path) == 0);
+
+   HgfsServerManager_Unregister(&mgrData);
+
+   for (i = 0; i < numEntries; i++) {
+      Str_Snprintf(path + dirLen, sizeof path - dirLen, "/File%06d", i);
+      unlink(path);
+   }
+   for (level = TEST_DEPTH; level >= 0; level--) {
+      path[dirLen] = '\0';
+      rmdir(path);
+      dirLen = strrchr(path, '/') - path;
+   }
+
+   printf("PASS\n");
+   return 0;
+}
@@ -0,0 +1,382 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * pollEpollTest.c --
+ *
+ *      Checks and benchmark for the epoll Poll implementation, driven
+ *      through Poll_LoopTimeout():
+ *
+ *      - a device and a main loop callback whose lock is held by another
+ *        thread are retried without spinning, and fire once the lock is
+ *        released,
+ *      - with a large number of devices registered, each readable device
+ *        fires its own callback only; the time to register, fire and
+ *        remove callbacks is printed for a small and a large number of
+ *        devices,
+ *      - the Poll unit test suite of lib/poll passes.
+ *
+ *      Usage: vmware-testpollepoll [devices]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "vmware.h"
+#include "poll.h"
+#include "userlock.h"
+#include "mutexRank.h"
+#include "testBench.h"
+
+#define TEST_SMALL_DEVICES   100
+#define TEST_FIRE_ROUNDS     2000
+#define TEST_LOCK_HOLD_US    500000
+
+/* Built in from lib/poll/poll.c with POLL_UNITTEST. */
+void PollUnitTest(Bool vmx);
+Bool PollUnitTest_Finished(unsigned int *failures);
+
+typedef struct TestDevice {
+   int fds[2];
+   unsigned int fired;
+} TestDevice;
+
+static unsigned int testFired;
+static MXUserRecLock *testLock;
+static volatile gint testLockState;   // 1 while held, 2 once released
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchThreadCpuNS --
+ *
+ *      CPU time used by the calling thread, in nanoseconds.
+ *
+ * Results:
+ *      The time.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint64
+BenchThreadCpuNS(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestReadCb --
+ *
+ *      Device callback: consumes the byte written to the device.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Counts the callback.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestReadCb(void *clientData)  // IN: TestDevice
+{
+   TestDevice *dev = clientData;
+   char c;
+
+   CHECK(read(dev->fds[1], &c, 1) == 1);
+   dev->fired++;
+   testFired++;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCountCb --
+ *
+ *      Main loop callback: counts the times it fired.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestCountCb(void *clientData)  // IN: counter
+{
+   (*(unsigned int *)clientData)++;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestLockHolder --
+ *
+ *      Thread holding testLock for TEST_LOCK_HOLD_US.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      Updates testLockState.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+TestLockHolder(gpointer data)  // IN: unused
+{
+   MXUser_AcquireRecLock(testLock);
+   g_atomic_int_set(&testLockState, 1);
+   g_usleep(TEST_LOCK_HOLD_US);
+   g_atomic_int_set(&testLockState, 2);
+   MXUser_ReleaseRecLock(testLock);
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestLockContention --
+ *
+ *      Registers a readable device and a main loop callback that both take
+ *      a lock held by another thread, and runs the loop until they fire.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the loop passes and CPU time spent while the lock was held.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestLockContention(void)
+{
+   TestDevice dev;
+   unsigned int mainLoopCount = 0;
+   unsigned int heldPasses = 0;
+   uint64 heldCpu = 0;
+   uint64 start;
+   uint64 released = 0;
+   GThread *holder;
+
+   memset(&dev, 0, sizeof dev);
+   CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, dev.fds) == 0);
+   CHECK(write(dev.fds[0], "x", 1) == 1);
+
+   testLock = MXUser_CreateRecLock("testPollEpollLock", RANK_UNRANKED);
+   holder = g_thread_create(TestLockHolder, NULL, TRUE, NULL);
+   CHECK(holder != NULL);
+   while (g_atomic_int_get(&testLockState) == 0) {
+      g_usleep(1000);
+   }
+
+   Poll_Callback(POLL_CS_MAIN, POLL_FLAG_PERIODIC | POLL_FLAG_READ |
+                 POLL_FLAG_SOCKET, TestReadCb, &dev, POLL_DEVICE,
+                 dev.fds[1], testLock);
+   Poll_Callback(POLL_CS_MAIN, POLL_FLAG_PERIODIC, TestCountCb,
+                 &mainLoopCount, POLL_MAIN_LOOP, 0, testLock);
+
+   start = BenchThreadCpuNS();
+   while (dev.fired == 0 || mainLoopCount == 0) {
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 1000000);
+
+      /* The state changes before the lock is released. */
+      if (g_atomic_int_get(&testLockState) == 1) {
+         CHECK(dev.fired == 0 && mainLoopCount == 0);
+         heldPasses++;
+      } else if (released == 0) {
+         heldCpu = BenchThreadCpuNS() - start;
+         released = BenchNowNS();
+      }
+   }
+   printf("busy lock %6u passes %8.1f ms cpu in %d ms, fired %.1f ms "
+          "after release\n", heldPasses, (double)heldCpu / 1000000,
+          TEST_LOCK_HOLD_US / 1000, (double)(BenchNowNS() - released) / 1000000);
+
+   /* The loop must have slept while the lock was held. */
+   CHECK(heldCpu < TEST_LOCK_HOLD_US * 1000ULL / 4);
+   CHECK(heldPasses < 200);
+
+   CHECK(Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_PERIODIC, TestCountCb,
+                             &mainLoopCount, POLL_MAIN_LOOP));
+   CHECK(Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_PERIODIC |
+                             POLL_FLAG_READ | POLL_FLAG_SOCKET, TestReadCb,
+                             &dev, POLL_DEVICE));
+   g_thread_join(holder);
+   MXUser_DestroyRecLock(testLock);
+   close(dev.fds[0]);
+   close(dev.fds[1]);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchDevices --
+ *
+ *      Registers a read callback on numDevices socket pairs, then makes one
+ *      device at a time readable and runs the loop until its callback
+ *      fired.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the time to register, fire and remove a callback.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchDevices(int numDevices)  // IN
+{
+   TestDevice *devs = calloc(numDevices, sizeof *devs);
+   uint64 addTime;
+   uint64 fireTime;
+   uint64 start;
+   int i;
+
+   CHECK(devs != NULL);
+   for (i = 0; i < numDevices; i++) {
+      CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, devs[i].fds) == 0);
+   }
+
+   start = BenchNowNS();
+   for (i = 0; i < numDevices; i++) {
+      Poll_Callback(POLL_CS_MAIN, POLL_FLAG_PERIODIC | POLL_FLAG_READ |
+                    POLL_FLAG_SOCKET, TestReadCb, &devs[i], POLL_DEVICE,
+                    devs[i].fds[1], NULL);
+   }
+   addTime = BenchNowNS() - start;
+
+   testFired = 0;
+   start = BenchNowNS();
+   for (i = 0; i < TEST_FIRE_ROUNDS; i++) {
+      TestDevice *dev = &devs[(i * 7919) % numDevices];
+      unsigned int fired = dev->fired;
+
+      CHECK(write(dev->fds[0], "x", 1) == 1);
+      while (dev->fired == fired) {
+         Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 1000000);
+      }
+      CHECK(testFired == i + 1);
+   }
+   fireTime = BenchNowNS() - start;
+
+   start = BenchNowNS();
+   for (i = 0; i < numDevices; i++) {
+      CHECK(Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_PERIODIC |
+                                POLL_FLAG_READ | POLL_FLAG_SOCKET,
+                                TestReadCb, &devs[i], POLL_DEVICE));
+   }
+   printf("devices %6d %8.2f us/add %8.2f us/fire %8.2f us/remove\n",
+          numDevices, (double)addTime / numDevices / 1000,
+          (double)fireTime / TEST_FIRE_ROUNDS / 1000,
+          (double)(BenchNowNS() - start) / numDevices / 1000);
+
+   for (i = 0; i < numDevices; i++) {
+      close(devs[i].fds[0]);
+      close(devs[i].fds[1]);
+   }
+   free(devs);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Runs the checks and the benchmark.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numDevices = argc > 1 ? atoi(argv[1]) : 10000;
+   unsigned int failures;
+   struct rlimit rl;
+
+   if (numDevices < TEST_SMALL_DEVICES) {
+      printf("Usage: %s [devices >= %d]\n", argv[0], TEST_SMALL_DEVICES);
+      return 1;
+   }
+
+   /* Two descriptors per device, and the unit test's own socket pairs. */
+   CHECK(getrlimit(RLIMIT_NOFILE, &rl) == 0);
+   rl.rlim_cur = MIN(rl.rlim_max, MAX(2 * (rlim_t)numDevices, 8192) + 256);
+   CHECK(setrlimit(RLIMIT_NOFILE, &rl) == 0);
+   if (rl.rlim_cur < 2 * (rlim_t)numDevices + 256) {
+      numDevices = (rl.rlim_cur - 256) / 2;
+      printf("devices limited to %d by RLIMIT_NOFILE\n", numDevices);
+      CHECK(numDevices >= TEST_SMALL_DEVICES);
+   }
+
+   Poll_InitEpoll();
+
+   TestLockContention();
+   BenchDevices(TEST_SMALL_DEVICES);
+   BenchDevices(numDevices);
+
+   PollUnitTest(FALSE);
+   while (!PollUnitTest_Finished(&failures)) {
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, 1000000);
+   }
+   printf("unit test suite: %u failures\n", failures);
+   CHECK(failures == 0);
+
+   printf("PASS\n");
+   return 0;
+}
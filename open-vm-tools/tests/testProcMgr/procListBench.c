@@ -0,0 +1,244 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * procListBench.c --
+ *
+ *      Benchmark and checks for the Linux process listing of procMgr.
+ *      Starts a number of idle child processes so that /proc holds a known,
+ *      large set of processes, then:
+ *
+ *      - times the first listing, which reads every process, against the
+ *        following ones, which reuse the process table,
+ *      - times listing a single pid,
+ *      - checks that a process that rewrites its arguments is listed with
+ *        its new command line,
+ *      - checks that processes that exited are no longer listed, by pid
+ *        or in a full listing.
+ *
+ *      Usage: vmware-testprocmgr [children] [listings]
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "procMgr.h"
+#include "testBench.h"
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFind --
+ *
+ *      Looks a pid up in a process list.
+ *
+ * Results:
+ *      The process info, or NULL if the pid is not listed.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ProcMgrProcInfo *
+TestFind(ProcMgrProcInfoArray *procList,  // IN
+         pid_t pid)                       // IN
+{
+   size_t i;
+
+   for (i = 0; procList != NULL && i < ProcMgrProcInfoArray_Count(procList);
+        i++) {
+      ProcMgrProcInfo *info = ProcMgrProcInfoArray_AddressOf(procList, i);
+
+      if (info->procId == pid) {
+         return info;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRewriterChild --
+ *
+ *      Body of the child that rewrites its arguments when told to through
+ *      its pipe, then acks through the other.
+ *
+ * Results:
+ *      Does not return.
+ *
+ * Side effects:
+ *      Changes /proc/self/cmdline.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestRewriterChild(char *arg0,    // IN/OUT
+                  int cmdFd,     // IN
+                  int ackFd)     // IN
+{
+   char c;
+
+   if (read(cmdFd, &c, 1) == 1) {
+      memset(arg0, 'x', strlen(arg0));
+      if (write(ackFd, &c, 1) != 1) {
+         _exit(1);
+      }
+   }
+   for (;;) {
+      pause();
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Starts the children and runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numChildren = argc > 1 ? atoi(argv[1]) : 2000;
+   int numListings = argc > 2 ? atoi(argv[2]) : 20;
+   ProcMgrProcInfoArray *procList;
+   ProcMgrProcInfo *info;
+   ProcMgr_Pid rewriter;
+   ProcMgr_Pid *children;
+   int cmdPipe[2];
+   int ackPipe[2];
+   uint64 start;
+   size_t numProcs;
+   char c = 'r';
+   int i;
+
+   if (numChildren < 1 || numListings < 1) {
+      printf("Usage: %s [children] [listings]\n", argv[0]);
+      return 1;
+   }
+
+   CHECK(pipe(cmdPipe) == 0 && pipe(ackPipe) == 0);
+   rewriter = fork();
+   CHECK(rewriter >= 0);
+   if (rewriter == 0) {
+      TestRewriterChild(argv[0], cmdPipe[0], ackPipe[1]);
+   }
+
+   children = calloc(numChildren, sizeof *children);
+   CHECK(children != NULL);
+   for (i = 0; i < numChildren; i++) {
+      children[i] = fork();
+      CHECK(children[i] >= 0);
+      if (children[i] == 0) {
+         for (;;) {
+            pause();
+         }
+      }
+   }
+
+   start = BenchNowNS();
+   procList = ProcMgr_ListProcesses();
+   printf("list cold  children %6d %10.1f us/list\n", numChildren,
+          (double)(BenchNowNS() - start) / 1000);
+   CHECK(procList != NULL);
+   numProcs = ProcMgrProcInfoArray_Count(procList);
+   for (i = 0; i < numChildren; i++) {
+      CHECK(TestFind(procList, children[i]) != NULL);
+   }
+   info = TestFind(procList, rewriter);
+   CHECK(info != NULL &&
+         strncmp(info->procCmdLine, argv[0], strlen(argv[0])) == 0);
+   ProcMgr_FreeProcList(procList);
+
+   start = BenchNowNS();
+   for (i = 0; i < numListings; i++) {
+      procList = ProcMgr_ListProcesses();
+      CHECK(procList != NULL);
+      ProcMgr_FreeProcList(procList);
+   }
+   printf("list warm  children %6d %10.1f us/list (%" FMTSZ "u processes)\n",
+          numChildren, (double)(BenchNowNS() - start) / numListings / 1000,
+          numProcs);
+
+   start = BenchNowNS();
+   for (i = 0; i < numListings; i++) {
+      procList = ProcMgr_ListProcessesEx(&rewriter, 1);
+      CHECK(TestFind(procList, rewriter) != NULL);
+      ProcMgr_FreeProcList(procList);
+   }
+   printf("list pid   children %6d %10.1f us/list\n", numChildren,
+          (double)(BenchNowNS() - start) / numListings / 1000);
+
+   /* Same process, name and owner: only the command line changes. */
+   CHECK(write(cmdPipe[1], &c, 1) == 1 && read(ackPipe[0], &c, 1) == 1);
+   procList = ProcMgr_ListProcessesEx(&rewriter, 1);
+   info = TestFind(procList, rewriter);
+   CHECK(info != NULL && info->procCmdLine[0] == 'x');
+   ProcMgr_FreeProcList(procList);
+   procList = ProcMgr_ListProcesses();
+   info = TestFind(procList, rewriter);
+   CHECK(info != NULL && info->procCmdLine[0] == 'x');
+   ProcMgr_FreeProcList(procList);
+
+   for (i = 0; i < numChildren; i++) {
+      kill(children[i], SIGKILL);
+      CHECK(waitpid(children[i], NULL, 0) == children[i]);
+   }
+
+   procList = ProcMgr_ListProcessesEx(children, numChildren);
+   CHECK(procList != NULL && ProcMgrProcInfoArray_Count(procList) == 0);
+   ProcMgr_FreeProcList(procList);
+
+   procList = ProcMgr_ListProcesses();
+   CHECK(procList != NULL);
+   for (i = 0; i < numChildren; i++) {
+      CHECK(TestFind(procList, children[i]) == NULL);
+   }
+   ProcMgr_FreeProcList(procList);
+
+   kill(rewriter, SIGKILL);
+   waitpid(rewriter, NULL, 0);
+   free(children);
+
+   printf("PASS\n");
+   return 0;
+}
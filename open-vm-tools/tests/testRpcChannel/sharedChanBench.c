@@ -0,0 +1,547 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * sharedChanBench.c --
+ *
+ *      Benchmark and checks for the channel shared by the
+ *      RpcChannel_SendOne* calls. The program stands in for the VMX: it
+ *      interposes socket(), bind(), connect() and close(), and hands the
+ *      library one end of a socketpair for every vsocket, served by a
+ *      thread that answers each RPCI. Connects take TEST_CONNECT_USEC, and
+ *      the privileged source ports above TEST_FREE_PORT_MAX are in use, so
+ *      the first connect scans them.
+ *
+ *      Prints the connects and binds per RPCI and the time per RPCI:
+ *
+ *      - from several threads at once, starting without a channel,
+ *      - from one thread, on the open channel.
+ *
+ *      Checks that fork() does not wait for a connect in progress, that
+ *      the child does not keep the parent's connection open, and that the
+ *      parent's channel still works after the child is gone.
+ *
+ *      Usage: vmware-testrpcchannel [rpcs] [threads]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "vmci_sockets.h"
+#include "vmware/tools/guestrpc.h"
+#include "simpleSocket.h"
+#include "testBench.h"
+
+#define TEST_AF_VSOCK        40
+#define TEST_MAX_FDS         4096
+#define TEST_CONNECT_USEC    (50 * 1000)
+#define TEST_FREE_PORT_MAX   (PRIVILEGED_PORT_MAX - 64)
+#define TEST_RPC             "info-get guestinfo.test"
+
+/* VSOCK_CHANNEL_MAX_CONNS, the pooled connections of a vsocket channel. */
+#define TEST_MAX_POOLED_CONNS 4
+
+static Bool fakeFds[TEST_MAX_FDS];
+static volatile int numConnects;
+static volatile int numBinds;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestIsFake --
+ *
+ *      Whether fd is a vsocket handed out by socket() below.
+ *
+ * Results:
+ *      TRUE if it is.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestIsFake(int fd)  // IN
+{
+   return fd >= 0 && fd < TEST_MAX_FDS && fakeFds[fd];
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSetFake --
+ *
+ *      Records whether fd is a vsocket handed out by socket() below.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestSetFake(int fd,     // IN
+            Bool fake)  // IN
+{
+   CHECK(fd < TEST_MAX_FDS);
+   if (fd >= 0) {
+      fakeFds[fd] = fake;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestVmxServe --
+ *
+ *      Thread answering the RPCIs sent on one connection, until the
+ *      library closes it.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      Closes the connection.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+TestVmxServe(void *data)  // IN
+{
+   int fd = (int)(intptr_t)data;
+   char *payload;
+   int payloadLen;
+
+   while (Socket_RecvPacket(fd, &payload, &payloadLen)) {
+      free(payload);
+      if (!Socket_SendPacket(fd, "1 ", 2, NULL)) {
+         break;
+      }
+   }
+   syscall(SYS_close, fd);
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * socket --
+ *
+ *      Interposed socket(). A vsocket stream is one end of a socketpair,
+ *      the other end being served by TestVmxServe. The vsocket family probe
+ *      gets a datagram socket of another family, so that the library finds
+ *      vsockets whether or not the kernel has them.
+ *
+ * Results:
+ *      The socket, or -1 on error.
+ *
+ * Side effects:
+ *      May start a server thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+socket(int domain,    // IN
+       int type,      // IN
+       int protocol)  // IN
+{
+   pthread_t thread;
+   int sv[2];
+
+   if (domain != TEST_AF_VSOCK) {
+      int fd = syscall(SYS_socket, domain, type, protocol);
+
+      TestSetFake(fd, FALSE);
+      return fd;
+   }
+
+   if ((type & 0xf) != SOCK_STREAM) {
+      return syscall(SYS_socket, AF_UNIX, SOCK_DGRAM, 0);
+   }
+
+   if (syscall(SYS_socketpair, AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      return -1;
+   }
+   TestSetFake(sv[0], TRUE);
+   TestSetFake(sv[1], FALSE);
+   CHECK(pthread_create(&thread, NULL, TestVmxServe,
+                        (void *)(intptr_t)sv[1]) == 0);
+   pthread_detach(thread);
+
+   return sv[0];
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * bind --
+ *
+ *      Interposed bind(). Binding a vsocket fails with EADDRINUSE for the
+ *      privileged ports above TEST_FREE_PORT_MAX.
+ *
+ * Results:
+ *      0 on success, -1 on error.
+ *
+ * Side effects:
+ *      Counts the vsocket binds.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+bind(int fd,                      // IN
+     const struct sockaddr *addr, // IN
+     socklen_t addrLen)           // IN
+{
+   const struct sockaddr_vm *vmAddr = (const struct sockaddr_vm *)addr;
+
+   if (!TestIsFake(fd)) {
+      return syscall(SYS_bind, fd, addr, addrLen);
+   }
+
+   __sync_fetch_and_add(&numBinds, 1);
+   if (vmAddr->svm_port > TEST_FREE_PORT_MAX &&
+       vmAddr->svm_port <= PRIVILEGED_PORT_MAX) {
+      errno = EADDRINUSE;
+      return -1;
+   }
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * connect --
+ *
+ *      Interposed connect(). Connecting a vsocket takes TEST_CONNECT_USEC.
+ *
+ * Results:
+ *      0 on success, -1 on error.
+ *
+ * Side effects:
+ *      Counts the vsocket connects.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+connect(int fd,                      // IN
+        const struct sockaddr *addr, // IN
+        socklen_t addrLen)           // IN
+{
+   if (!TestIsFake(fd)) {
+      return syscall(SYS_connect, fd, addr, addrLen);
+   }
+
+   __sync_fetch_and_add(&numConnects, 1);
+   usleep(TEST_CONNECT_USEC);
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * close --
+ *
+ *      Interposed close(), forgetting vsockets.
+ *
+ * Results:
+ *      0 on success, -1 on error.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+close(int fd)  // IN
+{
+   if (TestIsFake(fd)) {
+      TestSetFake(fd, FALSE);
+   }
+   return syscall(SYS_close, fd);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSendRpcs --
+ *
+ *      Thread sending numRpcs RPCIs on the shared channel.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+TestSendRpcs(void *data)  // IN
+{
+   int numRpcs = (int)(intptr_t)data;
+   int i;
+
+   for (i = 0; i < numRpcs; i++) {
+      char *reply = NULL;
+      size_t replyLen = 0;
+
+      CHECK(RpcChannel_SendOneRaw(TEST_RPC, sizeof TEST_RPC, &reply,
+                                  &replyLen));
+      RpcChannel_Free(reply);
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchSend --
+ *
+ *      Sends numRpcs RPCIs from numThreads threads at once.
+ *
+ * Results:
+ *      The number of connects.
+ *
+ * Side effects:
+ *      Prints the connects and binds per RPCI, and the time per RPCI.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+BenchSend(const char *what,  // IN
+          int numRpcs,       // IN
+          int numThreads)    // IN
+{
+   pthread_t threads[64];
+   int connects = numConnects;
+   int binds = numBinds;
+   uint64 start;
+   int i;
+
+   CHECK(numThreads <= ARRAYSIZE(threads));
+
+   start = BenchNowNS();
+   for (i = 0; i < numThreads; i++) {
+      CHECK(pthread_create(&threads[i], NULL, TestSendRpcs,
+                           (void *)(intptr_t)(numRpcs / numThreads)) == 0);
+   }
+   for (i = 0; i < numThreads; i++) {
+      pthread_join(threads[i], NULL);
+   }
+   numRpcs = numRpcs / numThreads * numThreads;
+
+   printf("%-10s threads %3d rpcs %7d connects %4d binds %5d "
+          "%8.4f connects/rpc %10.1f us/rpc\n",
+          what, numThreads, numRpcs, numConnects - connects,
+          numBinds - binds, (double)(numConnects - connects) / numRpcs,
+          (double)(BenchNowNS() - start) / numRpcs / 1000);
+   return numConnects - connects;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestForkDuringConnect --
+ *
+ *      Forks while the shared channel is being opened. Runs in a child
+ *      of its own, so that the benchmark starts without a channel.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the time fork() took.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestForkDuringConnect(void)
+{
+   pthread_t thread;
+   uint64 start;
+   uint64 forkNS;
+   int status;
+   pid_t pid;
+
+   CHECK(pthread_create(&thread, NULL, TestSendRpcs, (void *)1) == 0);
+   usleep(TEST_CONNECT_USEC / 5);
+
+   start = BenchNowNS();
+   pid = fork();
+   if (pid == 0) {
+      _exit(0);
+   }
+   forkNS = BenchNowNS() - start;
+   CHECK(pid > 0);
+   CHECK(waitpid(pid, &status, 0) == pid);
+   pthread_join(thread, NULL);
+
+   printf("fork       during connect %10.1f us, connect %d us\n",
+          (double)forkNS / 1000, TEST_CONNECT_USEC);
+   CHECK(forkNS < TEST_CONNECT_USEC / 2 * 1000ULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestForkCloses --
+ *
+ *      Forks while the shared channel is open and idle, and checks that
+ *      the child does not have the channel's connection, and that the
+ *      parent's channel still works without connecting again.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestForkCloses(void)
+{
+   int fds[TEST_MAX_FDS];
+   int numFds = 0;
+   int connects;
+   int status;
+   pid_t pid;
+   int fd;
+
+   for (fd = 0; fd < TEST_MAX_FDS; fd++) {
+      if (TestIsFake(fd) && fcntl(fd, F_GETFD) != -1) {
+         fds[numFds++] = fd;
+      }
+   }
+   CHECK(numFds > 0);
+
+   pid = fork();
+   if (pid == 0) {
+      int i;
+
+      for (i = 0; i < numFds; i++) {
+         if (fcntl(fds[i], F_GETFD) != -1 || errno != EBADF) {
+            _exit(1);
+         }
+      }
+      _exit(0);
+   }
+   CHECK(pid > 0);
+   CHECK(waitpid(pid, &status, 0) == pid);
+   CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+   connects = numConnects;
+   TestSendRpcs((void *)1);
+   CHECK(numConnects == connects);
+
+   printf("fork       child closed %d inherited connection(s)\n", numFds);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numRpcs = argc > 1 ? atoi(argv[1]) : 10000;
+   int numThreads = argc > 2 ? atoi(argv[2]) : 8;
+   int status;
+   pid_t pid;
+
+   if (numRpcs < 1 || numThreads < 1 || numThreads > 64 ||
+       numRpcs < numThreads) {
+      printf("Usage: %s [rpcs] [threads <= 64]\n", argv[0]);
+      return 1;
+   }
+
+   fflush(stdout);
+   pid = fork();
+   if (pid == 0) {
+      TestForkDuringConnect();
+      exit(0);
+   }
+   CHECK(pid > 0);
+   CHECK(waitpid(pid, &status, 0) == pid);
+   CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+   /*
+    * Threads racing to open the channel may each connect, and only one
+    * keeps its connection; the channel then opens its pooled connections.
+    * Once open, the channel and its pool are used for everything.
+    */
+   CHECK(BenchSend("threads", numRpcs, numThreads) <=
+         numThreads + TEST_MAX_POOLED_CONNS);
+   CHECK(BenchSend("one", numRpcs, 1) == 0);
+
+   /* Each connect scans the busy ports at most once. */
+   CHECK(numBinds <= numConnects *
+                     (PRIVILEGED_PORT_MAX - TEST_FREE_PORT_MAX + 1));
+
+   TestForkCloses();
+
+   printf("PASS\n");
+   return 0;
+}
@@ -0,0 +1,336 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * listFilesBench.c --
+ *
+ *      Benchmark and checks for the paged ListFiles guest operation of the
+ *      vix plugin. Creates directories with known numbers of files and
+ *      pages through them with VIX_COMMAND_LIST_FILES requests, the way
+ *      the VMX does, and prints the time per page and the growth of the
+ *      resident set. Checks that:
+ *
+ *      - every page reports the right number of remaining entries, and the
+ *        pages together return '.', '..' and every file exactly once,
+ *      - this holds for a directory of a million entries, in time linear
+ *        in its size,
+ *      - this holds when more directories are paged through at the same
+ *        time than there are cursors.
+ *
+ *      The requests use the root credential when run as root and the
+ *      console user credential otherwise.
+ *
+ *      Usage: vmware-testvixlistfiles [large files] [small files] [page]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "str.h"
+#include "util.h"
+#include "file.h"
+#include "vixCommands.h"
+#include "vixOpenSource.h"
+#include "vixToolsInt.h"
+#include "vmware/tools/plugin.h"
+#include "testBench.h"
+
+#define TEST_NUM_SMALL_DIRS  6       // more than the cursors
+#define TEST_RESULT_SIZE     65536
+
+typedef struct TestDir {
+   char *path;
+   int numFiles;
+   int numListed;              // entries, with '.' and '..'
+   int numPages;
+   uint8 *seen;
+} TestDir;
+
+static GKeyFile *testConf;
+static int testCredentialType;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCreateDir --
+ *
+ *      Creates a directory holding numFiles empty files named f<n>.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Creates the directory and the files.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestCreateDir(TestDir *dir,       // OUT
+              const char *base,   // IN
+              const char *name,   // IN
+              int numFiles)       // IN
+{
+   int i;
+
+   memset(dir, 0, sizeof *dir);
+   dir->path = Str_SafeAsprintf(NULL, "%s/%s", base, name);
+   dir->numFiles = numFiles;
+   dir->seen = Util_SafeCalloc(numFiles, 1);
+   CHECK(File_CreateDirectory(dir->path));
+
+   for (i = 0; i < numFiles; i++) {
+      char *path = Str_SafeAsprintf(NULL, "%s/f%d", dir->path, i);
+      FILE *fp = fopen(path, "w");
+
+      CHECK(fp != NULL);
+      fclose(fp);
+      free(path);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestListPage --
+ *
+ *      Sends the request for the page of dir starting after the entries
+ *      already listed, and checks the reply. The listing starts with '.'
+ *      and '..'.
+ *
+ * Results:
+ *      TRUE if there are more pages.
+ *
+ * Side effects:
+ *      Updates the listed entries of dir.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestListPage(TestDir *dir,      // IN/OUT
+             int pageSize)      // IN
+{
+   size_t pathLength = strlen(dir->path);
+   VixCommandRequestHeader *request;
+   VixMsgListFilesRequest *listRequest;
+   char *result = NULL;
+   size_t resultLength = 0;
+   Bool deleteResult = FALSE;
+   const char *p;
+   int numEntries = dir->numFiles + 2;
+   int remaining;
+   int count = 0;
+   VixError err;
+
+   request = VixMsg_AllocRequestMsg(sizeof *listRequest + pathLength + 1,
+                                    VIX_COMMAND_LIST_FILES, 0,
+                                    testCredentialType, NULL);
+   CHECK(request != NULL);
+   listRequest = (VixMsgListFilesRequest *) request;
+   listRequest->guestPathNameLength = pathLength;
+   listRequest->patternLength = 0;
+   listRequest->index = dir->numListed;
+   listRequest->maxResults = pageSize;
+   listRequest->offset = 0;
+   memcpy(listRequest + 1, dir->path, pathLength + 1);
+
+   err = VixTools_ProcessVixCommand(request, "1", TEST_RESULT_SIZE, testConf,
+                                    NULL, &result, &resultLength,
+                                    &deleteResult);
+   CHECK(err == VIX_OK && result != NULL);
+   CHECK(result[0] == '0');
+   CHECK(sscanf(result + 2, "<rem>%d</rem>", &remaining) == 1);
+
+   for (p = strstr(result, "<Name>"); p != NULL;
+        p = strstr(p, "<Name>")) {
+      int n;
+
+      p += strlen("<Name>");
+      count++;
+      if (strncmp(p, ".<", 2) == 0 || strncmp(p, "..<", 3) == 0) {
+         CHECK(dir->numListed + count <= 2);
+         continue;
+      }
+      CHECK(sscanf(p, "f%d<", &n) == 1 && n >= 0 && n < dir->numFiles);
+      CHECK(!dir->seen[n]);
+      dir->seen[n] = 1;
+   }
+
+   CHECK(count == MIN(pageSize, numEntries - dir->numListed));
+   dir->numListed += count;
+   dir->numPages++;
+   CHECK(remaining == numEntries - dir->numListed);
+
+   if (deleteResult) {
+      free(result);
+   }
+   free(request);
+   return remaining > 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BenchListDirs --
+ *
+ *      Pages through the given directories, one page of each in turn.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints the time per page and the growth of the resident set.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BenchListDirs(const char *label,   // IN
+              TestDir *dirs,       // IN/OUT
+              int numDirs,         // IN
+              int pageSize)        // IN
+{
+   long rss = BenchResidentKB();
+   long maxRss = rss;
+   int numPages = 0;
+   int numFiles = 0;
+   Bool more = TRUE;
+   uint64 start;
+   int i;
+
+   for (i = 0; i < numDirs; i++) {
+      dirs[i].numListed = 0;
+      dirs[i].numPages = 0;
+      memset(dirs[i].seen, 0, dirs[i].numFiles);
+      numFiles += dirs[i].numFiles;
+   }
+
+   start = BenchNowNS();
+   while (more) {
+      more = FALSE;
+      for (i = 0; i < numDirs; i++) {
+         if (dirs[i].numPages == 0 ||
+             dirs[i].numListed < dirs[i].numFiles + 2) {
+            more = TestListPage(&dirs[i], pageSize) || more;
+         }
+      }
+      maxRss = MAX(maxRss, BenchResidentKB());
+   }
+
+   for (i = 0; i < numDirs; i++) {
+      CHECK(dirs[i].numListed == dirs[i].numFiles + 2);
+      CHECK(memchr(dirs[i].seen, 0, dirs[i].numFiles) == NULL);
+      numPages += dirs[i].numPages;
+   }
+
+   printf("%-6s dirs %2d files %7d %10.1f us/page %8ld kB rss growth\n",
+          label, numDirs, numFiles,
+          (double)(BenchNowNS() - start) / numPages / 1000, maxRss - rss);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Creates the directories and runs the benchmark and the checks.
+ *
+ * Results:
+ *      0 on success, 1 on failure.
+ *
+ * Side effects:
+ *      Prints results to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,
+     char *argv[])
+{
+   int numLarge = argc > 1 ? atoi(argv[1]) : 1000000;
+   int numSmall = argc > 2 ? atoi(argv[2]) : 20000;
+   int pageSize = argc > 3 ? atoi(argv[3]) : 100;
+   TestDir large;
+   TestDir small[TEST_NUM_SMALL_DIRS];
+   TestDir mixed[3];
+   ToolsAppCtx ctx;
+   char *tmpDir;
+   char *base;
+   char *name;
+   int i;
+
+   if (numLarge < 1 || numSmall < 1 || pageSize < 1) {
+      printf("Usage: %s [large files] [small files] [page]\n", argv[0]);
+      return 1;
+   }
+
+   tmpDir = File_GetSafeRandomTmpDir(TRUE);
+   CHECK(tmpDir != NULL);
+   base = Str_SafeAsprintf(NULL, "%s/testVixListFiles%d", tmpDir, getpid());
+   CHECK(File_CreateDirectory(base));
+   TestCreateDir(&large, base, "large", numLarge);
+   for (i = 0; i < TEST_NUM_SMALL_DIRS; i++) {
+      name = Str_SafeAsprintf(NULL, "small%d", i);
+      TestCreateDir(&small[i], base, name, numSmall);
+      free(name);
+   }
+
+   memset(&ctx, 0, sizeof ctx);
+   ctx.name = "testVixListFiles";
+   ctx.config = g_key_file_new();
+   testConf = ctx.config;
+   testCredentialType = geteuid() == 0 ? VIX_USER_CREDENTIAL_ROOT :
+                                         VIX_USER_CREDENTIAL_CONSOLE_USER;
+   CHECK(VixTools_Initialize(geteuid() == 0, NULL, NULL, &ctx) == VIX_OK);
+
+   BenchListDirs("small", small, 1, pageSize);
+   BenchListDirs("large", &large, 1, pageSize);
+   BenchListDirs("many", small, TEST_NUM_SMALL_DIRS, pageSize);
+
+   /* Paging through the large directory must not slow down the others. */
+   mixed[0] = large;
+   mixed[1] = small[0];
+   mixed[2] = small[1];
+   BenchListDirs("mixed", mixed, ARRAYSIZE(mixed), pageSize);
+
+   VixTools_Uninitialize();
+   g_key_file_free(ctx.config);
+
+   CHECK(File_DeleteDirectoryTree(base));
+   free(base);
+   free(tmpDir);
+   free(large.path);
+   free(large.seen);
+   for (i = 0; i < TEST_NUM_SMALL_DIRS; i++) {
+      free(small[i].path);
+      free(small[i].seen);
+   }
+
+   printf("PASS\n");
+   return 0;
+}
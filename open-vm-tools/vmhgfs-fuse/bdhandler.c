@@ -25,6 +25,7 @@
 /* Must come before any kernel header file. */
 
 
+#include <time.h>
 #include "bdhandler.h"
 #include "hgfsBd.h"
 #include "hgfsProto.h"
@@ -34,7 +35,95 @@
 #include "transport.h"
 #include "vm_assert.h"
 
+/*
+ * The backdoor completes a request synchronously on the calling vCPU, so to
+ * have several requests outstanding we open up to maxRequests RPC channels
+ * and give each request in flight its own. The first channel is opened (and
+ * HGFS checked to be enabled) when the transport channel is opened, further
+ * ones lazily when all existing channels are busy.
+ */
+typedef struct HgfsBdChannelPool {
+   RpcOut *out[HGFS_BD_MAX_REQUESTS];  /* Open RPC channels, NULL if not */
+   Bool busy[HGFS_BD_MAX_REQUESTS];    /* A request is using out[i] */
+   uint32 numOpen;                     /* Entries of out[] in use */
+   Bool opening;                       /* out[numOpen] is being opened */
+   Bool openFailed;                    /* Stop trying to add channels */
+   pthread_cond_t idleCond;            /* Signalled when a channel is freed */
+} HgfsBdChannelPool;
+
 static HgfsTransportChannel bdChannel;
+static HgfsBdChannelPool bdPool;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBdChannelGetOut --
+ *
+ *      Reserve an idle RPC channel of the pool, opening a new one if all are
+ *      busy and the queue depth allows it, else waiting for one to be freed.
+ *      Called with the channel lock held. The lock is dropped while a new
+ *      RPC channel is opened, so requests on the channels already open are
+ *      not held up by the open.
+ *
+ * Results:
+ *      Index of the reserved RPC channel, or -1 if the backdoor got closed.
+ *
+ * Side effects:
+ *      May open a new RPC channel.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsBdChannelGetOut(HgfsTransportChannel *channel) // IN: Channel
+{
+   HgfsBdChannelPool *pool = channel->priv;
+   uint32 i;
+
+   while (channel->status == HGFS_CHANNEL_CONNECTED) {
+      for (i = 0; i < pool->numOpen; i++) {
+         if (!pool->busy[i]) {
+            pool->busy[i] = TRUE;
+            return i;
+         }
+      }
+
+      if (pool->numOpen < MIN(channel->maxRequests, HGFS_BD_MAX_REQUESTS) &&
+          !pool->opening && !pool->openFailed) {
+         RpcOut *out = NULL;
+         Bool opened;
+
+         pool->opening = TRUE;
+         pthread_mutex_unlock(&channel->connLock);
+         opened = HgfsBd_OpenBackdoor(&out);
+         pthread_mutex_lock(&channel->connLock);
+         pool->opening = FALSE;
+         pthread_cond_broadcast(&pool->idleCond);
+
+         i = pool->numOpen;
+         if (opened) {
+            LOG(8, ("Backdoor RPC channel %u opened.\n", i));
+            pool->out[i] = out;
+            pool->numOpen++;
+            /* If the channel got closed meanwhile, close will reap it. */
+            if (channel->status == HGFS_CHANNEL_CONNECTED) {
+               pool->busy[i] = TRUE;
+               return i;
+            }
+            continue;
+         }
+         LOG(4, ("Cannot open backdoor RPC channel %u, using %u.\n",
+                 i, pool->numOpen));
+         pool->openFailed = TRUE;
+         continue;
+      }
+
+      pthread_cond_wait(&pool->idleCond, &channel->connLock);
+   }
+
+   return -1;
+}
 
 
 /*
@@ -56,6 +145,8 @@ static HgfsTransportChannel bdChannel;
 static HgfsChannelStatus
 HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
 {
+   HgfsBdChannelPool *pool = channel->priv;
+
    pthread_mutex_lock(&channel->connLock);
    switch (channel->status) {
    case HGFS_CHANNEL_UNINITIALIZED:
@@ -65,10 +156,14 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
       LOG(8, ("Backdoor already connected.\n"));
       break;
    case HGFS_CHANNEL_NOTCONNECTED:
-      if (HgfsBd_OpenBackdoor((RpcOut **)&channel->priv)) {
+      ASSERT(pool->numOpen == 0);
+      if (HgfsBd_OpenBackdoor(&pool->out[0])) {
          LOG(8, ("Backdoor opened and connected.\n"));
          channel->status = HGFS_CHANNEL_CONNECTED;
-         ASSERT(channel->priv != NULL);
+         ASSERT(pool->out[0] != NULL);
+         pool->busy[0] = FALSE;
+         pool->numOpen = 1;
+         pool->openFailed = FALSE;
       } else {
          LOG(8, ("ERROR: Backdoor cannot connect.\n"));
       }
@@ -90,7 +185,8 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
  *
  * HgfsBdChannelCloseInt --
  *
- *      Close the backdoor in an idempotent way.
+ *      Close the backdoor in an idempotent way. Waits for the requests in
+ *      flight on it to finish.
  *
  * Results:
  *      None
@@ -104,11 +200,25 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
 static void
 HgfsBdChannelCloseInt(HgfsTransportChannel *channel) // IN: Channel
 {
+   HgfsBdChannelPool *pool = channel->priv;
+   uint32 i;
+
    if (channel->status == HGFS_CHANNEL_CONNECTED) {
-      ASSERT(channel->priv != NULL);
-      HgfsBd_CloseBackdoor((RpcOut **)&channel->priv);
-      ASSERT(channel->priv == NULL);
       channel->status = HGFS_CHANNEL_NOTCONNECTED;
+      pthread_cond_broadcast(&pool->idleCond);
+
+      while (pool->opening) {
+         pthread_cond_wait(&pool->idleCond, &channel->connLock);
+      }
+      for (i = 0; i < pool->numOpen; i++) {
+         while (pool->busy[i]) {
+            pthread_cond_wait(&pool->idleCond, &channel->connLock);
+         }
+         ASSERT(pool->out[i] != NULL);
+         HgfsBd_CloseBackdoor(&pool->out[i]);
+         ASSERT(pool->out[i] == NULL);
+      }
+      pool->numOpen = 0;
    }
    LOG(8, ("Backdoor closed.\n"));
 }
@@ -145,7 +255,9 @@ HgfsBdChannelClose(HgfsTransportChannel *channel) // IN: Channel
  *
  * HgfsBdChannelSend --
  *
- *     Send a request via backdoor.
+ *     Send a request via backdoor. The channel lock is only held to pick
+ *     an RPC channel, so requests on different RPC channels proceed in
+ *     parallel.
  *
  * Results:
  *     0 on success, negative error on failure.
@@ -160,8 +272,11 @@ static int
 HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
                   HgfsReq *req)                  // IN: request to send
 {
+   HgfsBdChannelPool *pool = channel->priv;
    char const *replyPacket = NULL;
+   struct timespec start;
    size_t payloadSize;
+   int outIdx;
    int ret;
 
    ASSERT(req);
@@ -169,20 +284,26 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
    ASSERT(req->payloadSize <= HGFS_LARGE_PACKET_MAX);
 
    pthread_mutex_lock(&channel->connLock);
+   outIdx = HgfsBdChannelGetOut(channel);
+   pthread_mutex_unlock(&channel->connLock);
 
-   if (channel->status != HGFS_CHANNEL_CONNECTED) {
+   if (outIdx < 0) {
       LOG(6, ("Backdoor not opened.\n"));
-      pthread_mutex_unlock(&channel->connLock);
       return -ENOTCONN;
    }
 
    payloadSize = req->payloadSize;
-   LOG(8, ("Backdoor sending.\n"));
-   ret = HgfsBd_Dispatch(channel->priv, HGFS_REQ_PAYLOAD(req), &payloadSize,
-                         &replyPacket);
+   LOG(8, ("Backdoor sending on RPC channel %d.\n", outIdx));
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   ret = HgfsBd_Dispatch(pool->out[outIdx], HGFS_REQ_PAYLOAD(req),
+                         &payloadSize, &replyPacket);
    if (ret == 0) {
       LOG(8, ("Backdoor reply received.\n"));
-      /* Request sent successfully. Copy the reply and wake the client. */
+      HgfsTransportRecordRtt(&start);
+      /*
+       * Request sent successfully. Copy the reply, which lives in the RPC
+       * channel's buffer, before releasing the RPC channel.
+       */
       ASSERT(replyPacket);
       HgfsCompleteReq(req, replyPacket, payloadSize);
    } else {
@@ -190,6 +311,9 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
       ret = -EIO;
    }
 
+   pthread_mutex_lock(&channel->connLock);
+   pool->busy[outIdx] = FALSE;
+   pthread_cond_broadcast(&pool->idleCond);
    pthread_mutex_unlock(&channel->connLock);
 
    return ret;
@@ -247,7 +371,10 @@ HgfsBdChannelInit(void)
    bdChannel.ops.send = HgfsBdChannelSend;
    bdChannel.ops.recv = NULL;
    bdChannel.ops.exit = HgfsBdChannelExit;
-   bdChannel.priv = NULL;
+   memset(&bdPool, 0, sizeof bdPool);
+   pthread_cond_init(&bdPool.idleCond, NULL);
+   bdChannel.priv = &bdPool;
+   bdChannel.maxRequests = HGFS_BD_MAX_REQUESTS;
    pthread_mutex_init(&bdChannel.connLock, NULL);
    bdChannel.status = HGFS_CHANNEL_NOTCONNECTED;
    return &bdChannel;
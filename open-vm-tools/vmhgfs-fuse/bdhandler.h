@@ -27,6 +27,9 @@
 
 #include "transport.h"
 
+/* Upper bound on backdoor RPC channels, i.e. requests in flight. */
+#define HGFS_BD_MAX_REQUESTS HGFS_TRANSPORT_MAX_REQUESTS
+
 HgfsTransportChannel *HgfsBdChannelInit(void);
 
 #endif // _HGFS_DRIVER_BDHANDLER_H_
@@ -22,9 +22,7 @@
  * Module-specific components of the vmhgfs driver.
  */
 #include "module.h"
-#if !defined(__FreeBSD__) && !defined(__SOLARIS__)
-#include <glib.h>
-#endif
+#include <time.h>
 
 /*
  * We make the default attribute cache timeout 1 second which is the same
@@ -34,8 +32,15 @@
 #define CACHE_TIMEOUT HGFS_DEFAULT_TTL
 #define CACHE_PURGE_TIME 10
 #define CACHE_PURGE_SLEEP_TIME 30
-#define HASH_THRESHOLD_SIZE (2046 * 4)
-#define HASH_PURGE_SIZE (HASH_THRESHOLD_SIZE / 2)
+
+/*
+ * The cache is split into shards, each with its own lock, hash buckets and
+ * LRU list, so that FUSE worker threads looking up different paths do not
+ * serialize on a single mutex. Both values must be powers of two.
+ */
+#define CACHE_SHARD_COUNT 16
+#define CACHE_SHARD_BUCKETS 4096
+#define CACHE_SHARD_MAX_ENTRIES (HGFS_ATTR_CACHE_MAX_ENTRIES / CACHE_SHARD_COUNT)
 #include "cache.h"
 
 /*
@@ -44,60 +49,68 @@
 
 typedef struct HgfsAttrCache {
    HgfsAttrInfo attr; /* Attribute of a file or directory */
-   uint64 changeTime; /* time the attribute was last updated */
-   struct list_head list; /* used in linked list implementation */
+   time_t changeTime; /* time the attribute was last updated */
+   Bool negative;     /* the path is known not to exist on the host */
+   uint32 hash;       /* hash of path, avoids strcmp on most mismatches */
+   struct list_head bucket; /* hash chain of the owning shard */
+   struct list_head lru;    /* LRU list of the owning shard, MRU first */
    char path[0];      /* path of the file corresponding the the attr */
 } HgfsAttrCache;
 
 
-/* Head of the list */
-struct HgfsAttrCache attrList;
+typedef struct HgfsAttrCacheShard {
+   pthread_mutex_t lock;       /* Lock for accessing this shard */
+   struct list_head buckets[CACHE_SHARD_BUCKETS];
+   struct list_head lruList;   /* Entries, most recently used first */
+   uint32 numEntries;
+   HgfsAttrCacheStats stats;
+} HgfsAttrCacheShard;
 
-/*Lock for accessing the attribute cache*/
-static pthread_mutex_t HgfsAttrCacheLock = PTHREAD_MUTEX_INITIALIZER;
 
-/*
- * Lists are used to manage attribute cache in Solaris and FreeBSD,
- * HashTables are used in Linux. HashTables perform better and hence
- * once newer version of glib with hash tables are packaged for Solaris
- * and FreeBSD, this section will go away.
- */
+static HgfsAttrCacheShard attrCache[CACHE_SHARD_COUNT];
 
-#if defined(__FreeBSD__) || defined(__SOLARIS__)
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsInitCache
+ * HgfsAttrCacheNow
  *
- *    Initializes the list attrList to cache attributes.
+ *    Returns the current time in seconds for entry aging. Uses the coarse
+ *    monotonic clock where available since it is considerably cheaper than
+ *    time() and is not affected by the guest clock being stepped.
  *
  * Results:
- *    None
+ *    Current time in seconds.
  *
  * Side effects:
  *    None
  *
  *----------------------------------------------------------------------
- *
  */
 
-void
-HgfsInitCache()
+static time_t
+HgfsAttrCacheNow(void)
 {
-   INIT_LIST_HEAD(&attrList.list);
+#if defined(CLOCK_MONOTONIC_COARSE)
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+      return ts.tv_sec;
+   }
+#endif
+   return time(NULL);
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsGetAttrCache
+ * HgfsAttrCacheHash
  *
- *    Retrieves the attr from the list for a given path.
+ *    Computes the FNV-1a hash of a path.
  *
  * Results:
- *    0 on success else -1 on error
+ *    The hash value.
  *
  * Side effects:
  *    None
@@ -105,47 +118,29 @@ HgfsInitCache()
  *----------------------------------------------------------------------
  */
 
-int
-HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
-                 HgfsAttrInfo *attr) //IN: Attribute for a given path
+static uint32
+HgfsAttrCacheHash(const char *path) //IN: Path of file or directory
 {
-   HgfsAttrCache *tmp;
-   int res = -1;
-   int diff;
-
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-
-   attrList.changeTime = HGFS_GET_TIME(time(NULL));
-   list_for_each_entry(tmp, &attrList.list, list) {
-      LOG(4, ("tmp->path = %d\n", tmp->path));
-      if (strcmp(path, tmp->path) == 0) {
-         LOG(4, ("cache hit. path = %s\n", tmp->path));
+   uint32 hash = 2166136261U;
 
-         diff = (HGFS_GET_TIME(time(NULL)) - tmp->changeTime) / 10000000;
-
-         LOG(4, ("time since last updated is %d seconds\n", diff));
-         if (diff <= CACHE_TIMEOUT) {
-            *attr = tmp->attr;
-            res = 0;
-         }
-         break;
-      }
+   while (*path != '\0') {
+      hash ^= (unsigned char)*path++;
+      hash *= 16777619U;
    }
-
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
-   return res;
+   return hash;
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsSetAttrCache
+ * HgfsAttrCacheGetShard
  *
- *    Updates the list with the given (key, attr)pair.
+ *    Returns the shard owning the given hash. The low bits pick the
+ *    bucket, so the shard is selected from the high bits.
  *
  * Results:
- *    0 on success else negative value on error
+ *    The shard.
  *
  * Side effects:
  *    None
@@ -153,52 +148,22 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
  *----------------------------------------------------------------------
  */
 
-int
-HgfsSetAttrCache(const char* path,   //IN: Path of file or directory
-                 HgfsAttrInfo *attr) //IN: Attribute for a given path
+static INLINE HgfsAttrCacheShard *
+HgfsAttrCacheGetShard(uint32 hash) //IN: hash of the path
 {
-   HgfsAttrCache *tmp;
-   int res = 0;
-
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-
-   attrList.changeTime = HGFS_GET_TIME(time(NULL));
-   list_for_each_entry (tmp, &attrList.list, list) {
-      if (strcmp(path, tmp->path) == 0) {
-         tmp->attr = *attr;
-         tmp->changeTime = HGFS_GET_TIME(time(NULL));
-         LOG(4, ("cache entry updated. path = %s\n", tmp->path));
-         goto out;
-      }
-   }
-
-   tmp = malloc(sizeof(HgfsAttrCache) + strlen(path) + 1);
-   if (tmp == NULL) {
-      res = -ENOMEM;
-      goto out;
-   }
-   INIT_LIST_HEAD(&tmp->list);
-   Str_Strcpy(tmp->path, path, strlen(path) + 1);
-   tmp->attr = *attr;
-   tmp->changeTime = HGFS_GET_TIME(time(NULL));
-   list_add(&tmp->list, &attrList.list);
-   LOG(4, ("cache entry added. path = %s\n", tmp->path));
-
-out:
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
-   return res;
+   return &attrCache[(hash >> 24) & (CACHE_SHARD_COUNT - 1)];
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsInvalidateAttrCache
+ * HgfsAttrCacheLookup
  *
- *    Invalidate the attribute list entry for a given path.
+ *    Finds the entry for a path within a shard. Caller holds the shard lock.
  *
  * Results:
- *    None
+ *    The entry or NULL if not found.
  *
  * Side effects:
  *    None
@@ -206,32 +171,29 @@ out:
  *----------------------------------------------------------------------
  */
 
-void
-HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
+static HgfsAttrCache *
+HgfsAttrCacheLookup(HgfsAttrCacheShard *shard, //IN: shard to search
+                    uint32 hash,               //IN: hash of path
+                    const char *path)          //IN: Path of file or directory
 {
    HgfsAttrCache *tmp;
+   struct list_head *bucket = &shard->buckets[hash & (CACHE_SHARD_BUCKETS - 1)];
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-
-   list_for_each_entry (tmp, &attrList.list, list) {
-      if (strcmp(path, tmp->path) == 0) {
-         list_del(&tmp->list);
-         free(tmp);
-         break;
+   list_for_each_entry(tmp, bucket, bucket) {
+      if (tmp->hash == hash && strcmp(path, tmp->path) == 0) {
+         return tmp;
       }
    }
-
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   return NULL;
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsPurgeCache:
+ * HgfsAttrCacheRemove
  *
- *    This routine is called by an independent thread to purge the cache,
- *    deletion is based on time of last update.
+ *    Unlinks and frees an entry. Caller holds the shard lock.
  *
  * Results:
  *    None
@@ -242,49 +204,85 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
  *----------------------------------------------------------------------
  */
 
-void*
-HgfsPurgeCache(void* unused) //IN: Thread argument
+static void
+HgfsAttrCacheRemove(HgfsAttrCacheShard *shard, //IN: owning shard
+                    HgfsAttrCache *entry)      //IN: entry to free
 {
-   HgfsAttrCache *tmp;
-   HgfsAttrCache *prev;
-   int diff;
+   list_del(&entry->bucket);
+   list_del(&entry->lru);
+   shard->numEntries--;
+   free(entry);
+}
 
-   while (1)
-   {
-      sleep(CACHE_PURGE_SLEEP_TIME);
 
-      pthread_mutex_lock(&HgfsAttrCacheLock);
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheInsert
+ *
+ *    Looks up or creates the entry for a path, evicting the least
+ *    recently used entry of the shard if it is full, and marks it
+ *    most recently used. Caller holds the shard lock.
+ *
+ * Results:
+ *    The entry or NULL if out of memory.
+ *
+ * Side effects:
+ *    May evict an entry.
+ *
+ *----------------------------------------------------------------------
+ */
 
-      list_for_each_entry_safe (tmp, prev, &attrList.list, list) {
-         diff = (HGFS_GET_TIME(time(NULL)) - tmp->changeTime) / 10000000;
-         if (diff > CACHE_PURGE_TIME) {
-            list_del (&tmp->list);
-            free (tmp);
-         }
-      }
+static HgfsAttrCache *
+HgfsAttrCacheInsert(HgfsAttrCacheShard *shard, //IN: owning shard
+                    uint32 hash,               //IN: hash of path
+                    const char *path)          //IN: Path of file or directory
+{
+   HgfsAttrCache *tmp;
+   size_t pathLen;
 
-      pthread_mutex_unlock(&HgfsAttrCacheLock);
+   tmp = HgfsAttrCacheLookup(shard, hash, path);
+   if (tmp != NULL) {
+      list_move(&tmp->lru, &shard->lruList);
+      return tmp;
+   }
+
+   if (shard->numEntries >= CACHE_SHARD_MAX_ENTRIES) {
+      tmp = list_entry(shard->lruList.prev, HgfsAttrCache, lru);
+      LOG(4, ("cache entry evicted. path = %s\n", tmp->path));
+      HgfsAttrCacheRemove(shard, tmp);
+      shard->stats.evictions++;
    }
-   return 0;
-}
 
-#else
+   pathLen = strlen(path);
+   tmp = malloc(sizeof(HgfsAttrCache) + pathLen + 1);
+   if (tmp == NULL) {
+      return NULL;
+   }
 
+   Str_Strcpy(tmp->path, path, pathLen + 1);
+   tmp->hash = hash;
+   list_add(&tmp->bucket, &shard->buckets[hash & (CACHE_SHARD_BUCKETS - 1)]);
+   list_add(&tmp->lru, &shard->lruList);
+   shard->numEntries++;
+   LOG(4, ("cache entry added. path = %s\n", tmp->path));
+   return tmp;
+}
 
-GHashTable *g_hash_table;
 
 /*
  *----------------------------------------------------------------------
  *
  * HgfsInitCache
  *
- *    Creates a hash table with string as a key.
+ *    Initializes the attribute cache shards.
  *
  * Results:
  *    None
  *
  * Side effects:
  *    None
+ *
  *----------------------------------------------------------------------
  *
  */
@@ -292,7 +290,20 @@ GHashTable *g_hash_table;
 void
 HgfsInitCache()
 {
-   g_hash_table = g_hash_table_new(g_str_hash, g_str_equal);
+   int i;
+   int j;
+
+   for (i = 0; i < CACHE_SHARD_COUNT; i++) {
+      HgfsAttrCacheShard *shard = &attrCache[i];
+
+      pthread_mutex_init(&shard->lock, NULL);
+      for (j = 0; j < CACHE_SHARD_BUCKETS; j++) {
+         INIT_LIST_HEAD(&shard->buckets[j]);
+      }
+      INIT_LIST_HEAD(&shard->lruList);
+      shard->numEntries = 0;
+      memset(&shard->stats, 0, sizeof shard->stats);
+   }
 }
 
 
@@ -301,10 +312,11 @@ HgfsInitCache()
  *
  * HgfsGetAttrCache
  *
- *    Retrieves the attr from the HashTable for a given path.
+ *    Retrieves the attr from the cache for a given path.
  *
  * Results:
- *    0 on success else -1 on error
+ *    0 on success, -ENOENT if the path is cached as non-existent,
+ *    else -1 if there is no valid entry.
  *
  * Side effects:
  *    None
@@ -314,27 +326,41 @@ HgfsInitCache()
 
 int
 HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
-                 HgfsAttrInfo *attr) //IN: Attribute for a given path
+                 HgfsAttrInfo *attr) //OUT: Attribute for a given path
 {
    HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   uint32 hash = HgfsAttrCacheHash(path);
    int res = -1;
-   int diff;
+   time_t diff;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
+   shard = HgfsAttrCacheGetShard(hash);
+   pthread_mutex_lock(&shard->lock);
 
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   tmp = HgfsAttrCacheLookup(shard, hash, path);
    if (tmp != NULL) {
       LOG(4, ("cache hit. path = %s\n", tmp->path));
 
-      diff = (HGFS_GET_TIME(time(NULL)) - tmp->changeTime) / 10000000;
-      LOG(4, ("time since last updated is %d seconds\n", diff));
-      if ( diff <= CACHE_TIMEOUT ) {
-         *attr = tmp->attr;
-         res = 0;
+      diff = HgfsAttrCacheNow() - tmp->changeTime;
+      LOG(4, ("time since last updated is %d seconds\n", (int)diff));
+      if (diff <= CACHE_TIMEOUT) {
+         list_move(&tmp->lru, &shard->lruList);
+         if (tmp->negative) {
+            shard->stats.negativeHits++;
+            res = -ENOENT;
+         } else {
+            shard->stats.hits++;
+            *attr = tmp->attr;
+            res = 0;
+         }
       }
    }
 
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   if (res == -1) {
+      shard->stats.misses++;
+   }
+
+   pthread_mutex_unlock(&shard->lock);
    return res;
 }
 
@@ -344,47 +370,84 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
  *
  * HgfsSetAttrCache
  *
- *    Updates the HashTable with the given (key, attr) pair.
+ *    Updates the cache with the given (key, attr) pair.
  *
  * Results:
  *    0 on success else negative value on error
  *
  * Side effects:
- *    None
+ *    May evict the least recently used entry of the shard.
  *
  *----------------------------------------------------------------------
  */
 
 int
-HgfsSetAttrCache(const char* path,         //IN: Path of file or directory
-                 HgfsAttrInfo *attr)       //IN: Attribute for a given path
+HgfsSetAttrCache(const char* path,   //IN: Path of file or directory
+                 HgfsAttrInfo *attr) //IN: Attribute for a given path
 {
    HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   uint32 hash = HgfsAttrCacheHash(path);
    int res = 0;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
+   shard = HgfsAttrCacheGetShard(hash);
+   pthread_mutex_lock(&shard->lock);
 
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
-   if (tmp != NULL) {
-      tmp->attr = *attr;
-      tmp->changeTime = HGFS_GET_TIME(time(NULL));
+   tmp = HgfsAttrCacheInsert(shard, hash, path);
+   if (tmp == NULL) {
+      res = -ENOMEM;
       goto out;
    }
+   tmp->attr = *attr;
+   tmp->negative = FALSE;
+   tmp->changeTime = HgfsAttrCacheNow();
+
+out:
+   pthread_mutex_unlock(&shard->lock);
+   return res;
+}
+
 
-   tmp = malloc(sizeof(HgfsAttrCache) + strlen(path) + 1);
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetNegativeAttrCache
+ *
+ *    Records that the given path does not exist on the host, so repeated
+ *    lookups of missing files (e.g. search path probing by compilers) are
+ *    answered locally until the entry times out or is invalidated.
+ *
+ * Results:
+ *    0 on success else negative value on error
+ *
+ * Side effects:
+ *    May evict the least recently used entry of the shard.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsSetNegativeAttrCache(const char* path) //IN: Path of file or directory
+{
+   HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   uint32 hash = HgfsAttrCacheHash(path);
+   int res = 0;
+
+   shard = HgfsAttrCacheGetShard(hash);
+   pthread_mutex_lock(&shard->lock);
+
+   tmp = HgfsAttrCacheInsert(shard, hash, path);
    if (tmp == NULL) {
       res = -ENOMEM;
       goto out;
    }
-
-   Str_Strcpy(tmp->path, path, strlen(path) + 1);
-   tmp->attr = *attr;
-   tmp->changeTime = HGFS_GET_TIME(time(NULL));
-
-   g_hash_table_insert(g_hash_table, (gpointer)tmp->path, (gpointer)tmp);
+   memset(&tmp->attr, 0, sizeof tmp->attr);
+   tmp->negative = TRUE;
+   tmp->changeTime = HgfsAttrCacheNow();
 
 out:
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   pthread_mutex_unlock(&shard->lock);
    return res;
 }
 
@@ -394,7 +457,7 @@ out:
  *
  * HgfsInvalidateAttrCache
  *
- *    Invalidate the HashTable entry for a path.
+ *    Invalidate the cache entry for a given path, positive or negative.
  *
  * Results:
  *    None
@@ -409,23 +472,66 @@ void
 HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
 {
    HgfsAttrCache *tmp;
+   HgfsAttrCacheShard *shard;
+   uint32 hash = HgfsAttrCacheHash(path);
+
+   shard = HgfsAttrCacheGetShard(hash);
+   pthread_mutex_lock(&shard->lock);
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   tmp = HgfsAttrCacheLookup(shard, hash, path);
    if (tmp != NULL) {
-      tmp->changeTime = 0;
+      HgfsAttrCacheRemove(shard, tmp);
+   }
+
+   pthread_mutex_unlock(&shard->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetAttrCacheStats
+ *
+ *    Sums the hit, miss and eviction counters over all shards.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsGetAttrCacheStats(HgfsAttrCacheStats *stats) //OUT: cache counters
+{
+   int i;
+
+   memset(stats, 0, sizeof *stats);
+
+   for (i = 0; i < CACHE_SHARD_COUNT; i++) {
+      HgfsAttrCacheShard *shard = &attrCache[i];
+
+      pthread_mutex_lock(&shard->lock);
+      stats->hits += shard->stats.hits;
+      stats->negativeHits += shard->stats.negativeHits;
+      stats->misses += shard->stats.misses;
+      stats->evictions += shard->stats.evictions;
+      stats->entries += shard->numEntries;
+      pthread_mutex_unlock(&shard->lock);
    }
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
 }
 
+
 /*
  *----------------------------------------------------------------------
  *
- * HgfsPurgeCache
+ * HgfsPurgeCache:
  *
  *    This routine is called by an independent thread to purge the cache,
- *    for performance reasons, the deletion is done in random based
- *    on the order of iteration.
+ *    deletion is based on time of last update. Shards are purged one at
+ *    a time so lookups in the other shards proceed meanwhile.
  *
  * Results:
  *    None
@@ -437,27 +543,38 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
  */
 
 void*
-HgfsPurgeCache(void* unused)      //IN: Thread argument
+HgfsPurgeCache(void* unused) //IN: Thread argument
 {
-   gpointer key, value;
-   GHashTableIter iter;
+   HgfsAttrCache *tmp;
+   HgfsAttrCache *prev;
+   HgfsAttrCacheStats stats;
+   time_t now;
+   int i;
 
-   while (1) {
+   while (1)
+   {
       sleep(CACHE_PURGE_SLEEP_TIME);
 
-      pthread_mutex_lock(&HgfsAttrCacheLock);
+      for (i = 0; i < CACHE_SHARD_COUNT; i++) {
+         HgfsAttrCacheShard *shard = &attrCache[i];
+
+         pthread_mutex_lock(&shard->lock);
 
-      if (g_hash_table_size(g_hash_table) >= HASH_THRESHOLD_SIZE) {
-         g_hash_table_iter_init(&iter, g_hash_table);
-         while (g_hash_table_iter_next(&iter, &key, &value) &&
-               (g_hash_table_size(g_hash_table) >= HASH_PURGE_SIZE)) {
-            g_hash_table_iter_remove(&iter);
-            free(value);
+         now = HgfsAttrCacheNow();
+         list_for_each_entry_safe (tmp, prev, &shard->lruList, lru) {
+            if (now - tmp->changeTime > CACHE_PURGE_TIME) {
+               HgfsAttrCacheRemove(shard, tmp);
+            }
          }
+
+         pthread_mutex_unlock(&shard->lock);
       }
 
-      pthread_mutex_unlock(&HgfsAttrCacheLock);
+      HgfsGetAttrCacheStats(&stats);
+      LOG(4, ("entries %u hits %"FMT64"u negative hits %"FMT64"u "
+              "misses %"FMT64"u evictions %"FMT64"u\n",
+              stats.entries, stats.hits, stats.negativeHits,
+              stats.misses, stats.evictions));
    }
    return 0;
 }
-#endif
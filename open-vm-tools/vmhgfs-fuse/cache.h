@@ -25,10 +25,23 @@
 #ifndef _HGFS_DRIVER_CACHE_H_
 #define _HGFS_DRIVER_CACHE_H_
 
+/* Upper bound on the number of cached paths, positive and negative. */
+#define HGFS_ATTR_CACHE_MAX_ENTRIES (64 * 1024)
+
+typedef struct HgfsAttrCacheStats {
+   uint64 hits;          /* lookups answered with cached attributes */
+   uint64 negativeHits;  /* lookups answered with a cached -ENOENT */
+   uint64 misses;        /* lookups with no valid entry */
+   uint64 evictions;     /* entries dropped to honour the size bound */
+   uint32 entries;       /* entries currently cached */
+} HgfsAttrCacheStats;
+
 int HgfsGetAttrCache(const char* path, HgfsAttrInfo *attr);
 int HgfsSetAttrCache(const char* path, HgfsAttrInfo *attr);
+int HgfsSetNegativeAttrCache(const char* path);
 void HgfsInitCache();
 void* HgfsPurgeCache(void*);
 void HgfsInvalidateAttrCache(const char* path);
+void HgfsGetAttrCacheStats(HgfsAttrCacheStats *stats);
 
 #endif
@@ -78,6 +78,7 @@ const struct fuse_opt vmhgfsOpts[] = {
      /* We will change the default value, unless it is specified explicitly. */
      FUSE_OPT_KEY("big_writes",     KEY_BIG_WRITES),
      FUSE_OPT_KEY("nobig_writes",   KEY_NO_BIG_WRITES),
+     VMHGFS_OPT("max_requests=%u", maxRequests, 0),
 
      FUSE_OPT_KEY("-V",             KEY_VERSION),
      FUSE_OPT_KEY("--version",      KEY_VERSION),
@@ -121,12 +122,16 @@ Usage(char *prog_name)  // IN
            "                           1 - system OS version is not supported for HGFS FUSE\n"
            "                           2 - system needs FUSE packages for HGFS FUSE\n"
            "\n"
-#ifdef VMX86_DEVEL
            "vmhgfs options:\n"
+           "    -o max_requests=N      number of requests in flight to the host\n"
+           "                           (1-%d, default %d)\n"
+           "\n"
+#ifdef VMX86_DEVEL
            "    -l   --loglevel NUM    set loglevel=NUM only available in debug build.\n"
            "\n"
 #endif
-           , prog_name, prog_name, prog_name);
+           , prog_name, prog_name, prog_name,
+           HGFS_TRANSPORT_MAX_REQUESTS, HGFS_TRANSPORT_DEFAULT_REQUESTS);
 }
 
 #define LIB_MODULEPATH         "/lib/modules"
@@ -502,6 +507,7 @@ vmhgfsPreprocessArgs(struct fuse_args *outargs)    // IN/OUT
 #else
    config.addBigWrites = TRUE;
 #endif
+   config.maxRequests = HGFS_TRANSPORT_DEFAULT_REQUESTS;
 
    res = fuse_opt_parse(outargs, &config, vmhgfsOpts, vmhgfsOptProc);
    if (res != 0) {
@@ -511,6 +517,15 @@ vmhgfsPreprocessArgs(struct fuse_args *outargs)    // IN/OUT
 #ifdef VMX86_DEVEL
    LOGLEVEL_THRESHOLD = config.logLevel;
 #endif
+   if (config.maxRequests < 1 ||
+       config.maxRequests > HGFS_TRANSPORT_MAX_REQUESTS) {
+      fprintf(stderr, "max_requests must be between 1 and %d\n",
+              HGFS_TRANSPORT_MAX_REQUESTS);
+      res = -1;
+      goto exit;
+   }
+   gState->maxRequests = config.maxRequests;
+
    /* Default option changes for vmhgfs fuse client. */
    if (config.addBigWrites) {
       res = fuse_opt_add_arg(outargs, "-obig_writes");
@@ -32,6 +32,7 @@ struct vmhgfsConfig {
 #endif
    int addBigWrites;
    int addAllowOther;
+   unsigned int maxRequests;
 };
 
 int vmhgfsOptProc(void *data, const char *arg,
@@ -22,6 +22,7 @@
  * File operations for the hgfs driver.
  */
 #include "module.h"
+#include "cache.h"
 
 
 #define HGFS_CREATE_DIR_MASK (HGFS_CREATE_DIR_VALID_FILE_NAME | \
@@ -230,6 +231,10 @@ out:
  *    server, while for V3 we may have multiple directory entries. The
  *    number of entries can be read from the reply packet.
  *
+ *    The attributes carried by V2 and V3 replies are also added to the
+ *    attribute cache, so the getattr calls that typically follow a
+ *    readdir (ls -l, find, stat) do not need a round trip each.
+ *
  * Results:
  *    0 on success, anything else on failure.
  *
@@ -241,6 +246,7 @@ out:
 
 static int
 HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
+                     const char *path,  // IN:  Absolute path of the dir
                      void *vfsDirent,   // OUT: Buffer to copy dentries into
                      fuse_fill_dir_t filldir, // IN:  Filler function
                      HgfsReq *req,      // IN:  The request containing reply
@@ -253,15 +259,26 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
    HgfsDirEntry *hgfsDirent = NULL; /* Only for V3. */
    char *escName = NULL;            /* Buffer for escaped version of name */
    size_t escNameLength = NAME_MAX + 1;
+   char *childPath = NULL;          /* path/escName, for the attr cache */
+   size_t pathLength;
+   Bool cacheAttr = opUsed != HGFS_OP_SEARCH_READ;
    int result = 0;
 
    ASSERT(req);
+   ASSERT(path);
 
-   escName = malloc(escNameLength);
-   if (!escName) {
-      LOG(4, ("Out of memory allocating escaped name buffer.\n"));
+   pathLength = strlen(path);
+   if (pathLength > 0 && path[pathLength - 1] == '/') {
+      pathLength--;
+   }
+   childPath = malloc(pathLength + 1 + escNameLength);
+   if (!childPath) {
+      LOG(4, ("Out of memory allocating child path buffer.\n"));
       return  -ENOMEM;
    }
+   memcpy(childPath, path, pathLength);
+   childPath[pathLength] = '/';
+   escName = childPath + pathLength + 1;
 
    replyCount = 1;
    if (opUsed == HGFS_OP_SEARCH_READ_V3) {
@@ -393,13 +410,19 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
          break;
       }
 
-      ino = attr.hostFileId;
-      memset(&st, 0, sizeof(st));
-      st.st_blksize = HGFS_BLOCKSIZE;
-      st.st_blocks = HgfsCalcBlockSize(attr.size);
-      st.st_size = attr.size;
-      st.st_ino = ino;
-      st.st_mode = d_type << 12;
+      if (cacheAttr &&
+          strcmp(escName, ".") != 0 && strcmp(escName, "..") != 0) {
+         HgfsSetAttrCache(childPath, &attr);
+         HgfsAttrToStat(&attr, &st);
+      } else {
+         ino = attr.hostFileId;
+         memset(&st, 0, sizeof(st));
+         st.st_blksize = HGFS_BLOCKSIZE;
+         st.st_blocks = HgfsCalcBlockSize(attr.size);
+         st.st_size = attr.size;
+         st.st_ino = ino;
+         st.st_mode = d_type << 12;
+      }
       result = filldir(vfsDirent, escName, &st, 0);
 
       if (result) {
@@ -430,7 +453,7 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
    }
 
 out:
-   free(escName);
+   free(childPath);
    return result;
 }
 
@@ -554,6 +577,7 @@ HgfsRequestDirEntries(HgfsHandle searchHandle, // IN: Handle to dir
 
 int
 HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
+            const char *path,         // IN:  Absolute path of the directory
             void *dirent,             // OUT: Buffer to copy dentries into
             fuse_fill_dir_t filldir)  // IN:  Filler function
 {
@@ -581,8 +605,8 @@ HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
          break;
       }
 
-      result = HgfsReadDirFromReply(&f_pos, dirent, filldir, request, opUsed,
-                                    &done);
+      result = HgfsReadDirFromReply(&f_pos, path, dirent, filldir, request,
+                                    opUsed, &done);
 
       LOG(4, ("f_pos = %d\n", f_pos));
       if (result == -ENAMETOOLONG) {
@@ -29,6 +29,7 @@
 #include "hgfsUtil.h"
 #include "fsutil.h"
 #include "file.h"
+#include "cache.h"
 #include "vm_assert.h"
 #include "vm_basic_types.h"
 
@@ -37,6 +38,93 @@
 static int
 HgfsGetOpenFlags(uint32 flags);
 
+/*
+ * Readahead and write-behind.
+ *
+ * A single HGFS read or write moves at most HGFS_LARGE_IO_MAX bytes, which
+ * is less than the 128k the kernel hands us per FUSE read or big write.
+ * For each open handle we therefore keep a stream state: sequential reads
+ * grow a readahead window whose data is fetched into a page-aligned buffer
+ * and served to the following reads, and contiguous writes are coalesced
+ * into a write-behind buffer that is flushed when it fills up, when the
+ * access pattern breaks, and on flush/fsync/release.
+ */
+#define HGFS_PAGE_SIZE        4096
+#define HGFS_READAHEAD_MIN    (2 * HGFS_LARGE_IO_MAX)
+#define HGFS_READAHEAD_MAX    (16 * HGFS_LARGE_IO_MAX)
+#define HGFS_WRITEBEHIND_MAX  (16 * HGFS_LARGE_IO_MAX)
+#define HGFS_STREAM_BUCKETS   64
+#define HGFS_STREAM_FLUSH_BATCH 16
+
+typedef struct HgfsFileStream {
+   struct list_head list;     /* Hash chain of gHgfsStreams, by handle */
+   struct list_head pathList; /* Hash chain of gHgfsStreamPaths, by path */
+   HgfsHandle handle;         /* Server file handle */
+   int refCount;              /* Protected by gHgfsStreamsLock */
+   Bool dirty;                /* wbLen > 0, protected by gHgfsStreamsLock */
+   char *path;                /* Path the handle was last used with and */
+   uint32 pathHash;           /* its hash, changed under both locks */
+   pthread_mutex_t lock;      /* Protects everything below */
+
+   loff_t nextReadOffset;     /* Where a sequential read would start */
+   size_t raWindow;           /* Current readahead window, 0 if random */
+   char *raBuf;               /* HGFS_READAHEAD_MAX + HGFS_PAGE_SIZE bytes,
+                                 allocated on the first readahead */
+   loff_t raOffset;           /* File offset of raBuf[0], page aligned */
+   size_t raLen;              /* Valid bytes in raBuf */
+   Bool raAttrValid;          /* raSize and raWriteTime are set */
+   uint64 raSize;             /* Cached size and write time of the file */
+   uint64 raWriteTime;        /* around the time raBuf was filled */
+
+   char *wbBuf;               /* HGFS_WRITEBEHIND_MAX bytes, allocated on
+                                 the first buffered write */
+   loff_t wbOffset;           /* File offset of wbBuf[0] */
+   size_t wbLen;              /* Dirty bytes in wbBuf */
+   int wbError;               /* Error of a buffered write, not reported yet */
+} HgfsFileStream;
+
+static struct list_head gHgfsStreams[HGFS_STREAM_BUCKETS];
+static struct list_head gHgfsStreamPaths[HGFS_STREAM_BUCKETS];
+static pthread_mutex_t gHgfsStreamsLock = PTHREAD_MUTEX_INITIALIZER;
+static Bool gHgfsStreamsInited = FALSE;
+static uint32 gHgfsDirtyStreams;   /* Streams with dirty set */
+
+/*
+ * A readahead fill is split into HGFS_LARGE_IO_MAX chunks. The reading
+ * thread and up to gState->maxRequests - 1 readahead workers claim the
+ * chunks of a queued fill and read them in parallel, each with its own
+ * transport request, so a window has as many reads in flight as the
+ * transport pool allows.
+ */
+#define HGFS_READAHEAD_CHUNKS (HGFS_READAHEAD_MAX / HGFS_LARGE_IO_MAX + 1)
+
+typedef struct HgfsReadaheadFill {
+   struct list_head list;     /* On gHgfsRaQueue while chunks are unclaimed */
+   HgfsHandle handle;         /* Server file handle */
+   char *buf;                 /* Destination, len bytes */
+   loff_t start;              /* File offset of buf[0] */
+   size_t len;                /* Bytes to fetch */
+   uint32 numChunks;          /* Chunks of the fill */
+   uint32 nextChunk;          /* First chunk not claimed yet */
+   uint32 doneChunks;         /* Chunks whose read returned */
+   Bool stopped;              /* A chunk came back short or failed */
+   int result[HGFS_READAHEAD_CHUNKS]; /* HgfsDoRead result per chunk */
+   pthread_cond_t doneCond;   /* Signalled when all chunks are done */
+} HgfsReadaheadFill;
+
+static struct list_head gHgfsRaQueue = LIST_HEAD_INIT(gHgfsRaQueue);
+static pthread_mutex_t gHgfsRaLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gHgfsRaCond = PTHREAD_COND_INITIALIZER;
+static uint32 gHgfsRaWorkers;      /* Protected by gHgfsRaLock */
+
+static int
+HgfsDoRead(HgfsHandle handle, char *buf, size_t count, loff_t offset);
+static ssize_t
+HgfsDirectRead(HgfsHandle handle, char *buf, size_t count, loff_t offset);
+static ssize_t
+HgfsDirectWrite(HgfsHandle handle, const char *buf, size_t count,
+                loff_t offset);
+
 
 /*
  * Private functions.
@@ -321,143 +409,1127 @@ HgfsGetOpenFlags(uint32 flags) // IN: Open flags
       result = HGFS_OPEN_CREATE_SAFE;
       break;
 
-   case (O_CREAT | O_TRUNC):
-      /* Create file; if it exists already, truncate it. */
-      result = HGFS_OPEN_CREATE_EMPTY;
-      break;
+   case (O_CREAT | O_TRUNC):
+      /* Create file; if it exists already, truncate it. */
+      result = HGFS_OPEN_CREATE_EMPTY;
+      break;
+
+   default:
+      /*
+       * This can only happen if all three flags are set, which
+       * conceptually makes no sense because O_EXCL and O_TRUNC are
+       * mutually exclusive if O_CREAT is set.
+       *
+       * However, the open(2) man page doesn't say you can't set all
+       * three flags, and certain apps (*cough* Nautilus *cough*) do
+       * so. To be friendly to those apps, we just silenty drop the
+       * O_TRUNC flag on the assumption that it's safer to honor
+       * O_EXCL.
+       */
+      LOG(4, ("Invalid open flags %o. Ignoring the O_TRUNC flag.\n", flags));
+      result = HGFS_OPEN_CREATE_SAFE;
+      break;
+   }
+
+   return result;
+}
+
+
+/*
+ * HGFS file operations for files.
+ */
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsOpenInt --
+ *
+ *    We send an "Open" request to the server with the file path
+ *    If the Open succeeds, we store the filehandle sent by the server
+ *    in the file info struct so it can be accessed by
+ *    read/write/close.
+ *
+ * Results:
+ *    Returns zero if on success, error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsOpenInt(const char *path,           //IN: Path to a file
+            struct fuse_file_info *fi,  //OUT: File info structure
+            mode_t permsMode,           //IN: Permissions, in this context
+            HgfsOpenValid mask)         //IN: Open validation mask
+{
+   HgfsReq *req;
+   HgfsOp opUsed;
+   HgfsStatus replyStatus;
+   HgfsHandle replyFile;
+   HgfsLockType replyLock;
+   int result = 0;
+
+   ASSERT(NULL != path);
+   ASSERT(NULL != fi);
+
+   LOG(4, ("Entry(%s)\n", path));
+
+   req = HgfsGetNewRequest();
+   if (!req) {
+      LOG(4, ("Out of memory while getting new request.\n"));
+      result = -ENOMEM;
+      goto out;
+   }
+
+   fi->fh = HGFS_INVALID_HANDLE;
+
+retry:
+   /*
+    * Set up pointers using the proper struct This lets us check the
+    * version exactly once and use the pointers later.
+    */
+
+   opUsed = hgfsVersionOpen;
+   result = HgfsPackOpenRequest(path, fi, permsMode, mask, opUsed, req);
+   if (result != 0) {
+      LOG(4, ("Error packing request.\n"));
+      goto out;
+   }
+
+   /* Send the request and process the reply. */
+   result = HgfsSendRequest(req);
+   if (result == 0) {
+      /* Get the reply and check return status. */
+      replyStatus = HgfsGetReplyStatus(req);
+      result = HgfsStatusConvertToLinux(replyStatus);
+
+      switch (result) {
+      case 0:
+         result = HgfsUnpackOpenReply(req, opUsed, &replyFile, &replyLock);
+         if (result != 0) {
+            break;
+         }
+
+         fi->fh = (uint64_t)replyFile;
+         LOG( 4,("Server file handle: %"FMT64"u\n", fi->fh));
+
+         break;
+
+      case -EPROTO:
+         /* Retry with older version(s). Set globally. */
+         if (opUsed == HGFS_OP_OPEN_V3) {
+            LOG(4, ("Version 3 not supported. Falling back to version 2.\n"));
+            hgfsVersionOpen = HGFS_OP_OPEN_V2;
+            goto retry;
+         }
+
+         /* Retry with Version 1 of Open. Set globally. */
+         if (opUsed == HGFS_OP_OPEN_V2) {
+            LOG(4, ("Version 2 not supported. Falling back to version 1.\n"));
+            hgfsVersionOpen = HGFS_OP_OPEN;
+            goto retry;
+         }
+
+         /* Fallthrough. */
+      default:
+         break;
+      }
+   } else if (result == -EIO) {
+      LOG(8, ("Timed out. error: %d\n", result));
+   } else if (result == -EPROTO) {
+      LOG(4, ("Server returned error: %d\n", result));
+   } else {
+      LOG(4, ("Unknown error: %d\n", result));
+   }
+out:
+   HgfsFreeRequest(req);
+   LOG(4, ("Exit(0x%"FMT64"x -> %d)\n",fi->fh, result));
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsOpen --
+ *
+ *    Called whenever a process opens a file in our filesystem.
+ *
+ * Results:
+ *    Returns zero if on success, error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsOpen(const char *path,             //IN: Path to a file
+            struct fuse_file_info *fi) //OUT: File info structure
+{
+     return HgfsOpenInt(path, fi, 0, HGFS_FILE_OPEN_MASK);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsCreate --
+ *
+ *    Called whenever a process request to create a file
+ *
+ * Results:
+ *    Returns zero if on success, error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsCreate(const char *path,          //IN: Path to a file
+           mode_t permsMode,          //IN: Permission to open the file
+           struct fuse_file_info *fi) //OUT: File info structure
+{
+     return HgfsOpenInt(path, fi, permsMode, HGFS_FILE_CREATE_MASK);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamHash --
+ *
+ *    Computes the FNV-1a hash of a path, used to find the streams of all
+ *    handles open on the same file.
+ *
+ * Results:
+ *    The hash value.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint32
+HgfsFileStreamHash(const char *path) // IN: Path of the file
+{
+   uint32 hash = 2166136261U;
+
+   while (*path != '\0') {
+      hash ^= (unsigned char)*path++;
+      hash *= 16777619U;
+   }
+   return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamInitTables --
+ *
+ *    Initialize the stream hash tables on first use. Called with
+ *    gHgfsStreamsLock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsFileStreamInitTables(void)
+{
+   int i;
+
+   if (!gHgfsStreamsInited) {
+      for (i = 0; i < HGFS_STREAM_BUCKETS; i++) {
+         INIT_LIST_HEAD(&gHgfsStreams[i]);
+         INIT_LIST_HEAD(&gHgfsStreamPaths[i]);
+      }
+      gHgfsStreamsInited = TRUE;
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamAcquire --
+ *
+ *    Look up the stream state of a handle, creating it if needed, and
+ *    take a reference to it. Only the small stream state is allocated
+ *    here; the readahead and write-behind buffers are allocated once the
+ *    handle is seen reading sequentially or writing.
+ *
+ * Results:
+ *    The stream, or NULL if the handle has none and path is NULL or we
+ *    are out of memory.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsFileStream *
+HgfsFileStreamAcquire(HgfsHandle handle, // IN: Server file handle
+                      const char *path)  // IN: Path to create the stream
+                                         //     with, NULL to not create
+{
+   HgfsFileStream *stream;
+   struct list_head *bucket;
+
+   pthread_mutex_lock(&gHgfsStreamsLock);
+   HgfsFileStreamInitTables();
+
+   bucket = &gHgfsStreams[handle % HGFS_STREAM_BUCKETS];
+   list_for_each_entry(stream, bucket, list) {
+      if (stream->handle == handle) {
+         stream->refCount++;
+         goto out;
+      }
+   }
+
+   stream = NULL;
+   if (path == NULL) {
+      goto out;
+   }
+
+   stream = calloc(1, sizeof *stream);
+   if (stream == NULL) {
+      goto out;
+   }
+   stream->path = strdup(path);
+   if (stream->path == NULL) {
+      free(stream);
+      stream = NULL;
+      goto out;
+   }
+   stream->pathHash = HgfsFileStreamHash(path);
+   stream->handle = handle;
+   stream->refCount = 2; /* One for the table, one for the caller. */
+   pthread_mutex_init(&stream->lock, NULL);
+   list_add(&stream->list, bucket);
+   list_add(&stream->pathList,
+            &gHgfsStreamPaths[stream->pathHash % HGFS_STREAM_BUCKETS]);
+
+out:
+   pthread_mutex_unlock(&gHgfsStreamsLock);
+   return stream;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamPut --
+ *
+ *    Drop a reference to a stream, freeing it and its buffers with the
+ *    last one.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsFileStreamPut(HgfsFileStream *stream) // IN: Stream
+{
+   Bool last;
+
+   pthread_mutex_lock(&gHgfsStreamsLock);
+   last = --stream->refCount == 0;
+   pthread_mutex_unlock(&gHgfsStreamsLock);
+
+   if (last) {
+      ASSERT(stream->wbLen == 0);
+      pthread_mutex_destroy(&stream->lock);
+      free(stream->path);
+      free(stream->raBuf);
+      free(stream->wbBuf);
+      free(stream);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamUpdatePath --
+ *
+ *    Record the path a handle is used with, which changes when the file
+ *    is renamed while open. Called with the stream lock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsFileStreamUpdatePath(HgfsFileStream *stream, // IN: Stream
+                         const char *path)       // IN: Current path
+{
+   char *newPath;
+
+   if (strcmp(stream->path, path) == 0) {
+      return;
+   }
+
+   newPath = strdup(path);
+   if (newPath == NULL) {
+      return;
+   }
+
+   pthread_mutex_lock(&gHgfsStreamsLock);
+   free(stream->path);
+   stream->path = newPath;
+   stream->pathHash = HgfsFileStreamHash(path);
+   list_del(&stream->pathList);
+   list_add(&stream->pathList,
+            &gHgfsStreamPaths[stream->pathHash % HGFS_STREAM_BUCKETS]);
+   pthread_mutex_unlock(&gHgfsStreamsLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamSetDirty --
+ *
+ *    Track whether the stream has buffered writes, so that flushes by
+ *    path only visit streams that need it. Called with the stream lock
+ *    held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsFileStreamSetDirty(HgfsFileStream *stream, // IN: Stream
+                       Bool dirty)             // IN: Has buffered writes
+{
+   pthread_mutex_lock(&gHgfsStreamsLock);
+   if (stream->dirty != dirty) {
+      stream->dirty = dirty;
+      if (dirty) {
+         gHgfsDirtyStreams++;
+      } else {
+         ASSERT(gHgfsDirtyStreams > 0);
+         gHgfsDirtyStreams--;
+      }
+   }
+   pthread_mutex_unlock(&gHgfsStreamsLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamFlushWrites --
+ *
+ *    Write the write-behind buffer out to the server. Called with the
+ *    stream lock held.
+ *
+ * Results:
+ *    Zero on success, or a negative error on failure. The buffered data
+ *    is dropped either way; a failure is also kept in wbError until the
+ *    next write, flush or fsync on the handle reports it.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HgfsFileStreamFlushWrites(HgfsFileStream *stream) // IN: Stream
+{
+   ssize_t written;
+   int result = 0;
+
+   if (stream->wbLen == 0) {
+      return 0;
+   }
+
+   LOG(6, ("Flushing 0x%"FMTSZ"x bytes @ 0x%"FMT64"x for handle %u\n",
+           stream->wbLen, stream->wbOffset, stream->handle));
+
+   written = HgfsDirectWrite(stream->handle, stream->wbBuf, stream->wbLen,
+                             stream->wbOffset);
+   if (written < 0) {
+      result = written;
+   } else if (written < stream->wbLen) {
+      result = -EIO;
+   }
+   stream->wbLen = 0;
+   HgfsFileStreamSetDirty(stream, FALSE);
+
+   if (result < 0 && stream->wbError == 0) {
+      stream->wbError = result;
+   }
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamFlushPath --
+ *
+ *    Push the buffered writes of every handle open on a path (or, for
+ *    subtree, on anything below it) to the server. Must not be called
+ *    with a stream lock held.
+ *
+ * Results:
+ *    None. Errors are kept on the handle that buffered the data.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsFileStreamFlushPath(const char *path,     // IN: Path of the file
+                        HgfsFileStream *self, // IN: Stream to skip or NULL
+                        Bool subtree)         // IN: Include paths below
+{
+   HgfsFileStream *batch[HGFS_STREAM_FLUSH_BATCH];
+   HgfsFileStream *stream;
+   size_t pathLen = strlen(path);
+   uint32 hash = HgfsFileStreamHash(path);
+   int first;
+   int last;
+   int n;
+   int i;
+
+   /* The whole table for renames of directories, one chain otherwise. */
+   first = subtree ? 0 : hash % HGFS_STREAM_BUCKETS;
+   last = subtree ? HGFS_STREAM_BUCKETS - 1 : first;
+
+   do {
+      n = 0;
+
+      pthread_mutex_lock(&gHgfsStreamsLock);
+      if (gHgfsDirtyStreams == 0) {
+         pthread_mutex_unlock(&gHgfsStreamsLock);
+         return;
+      }
+      for (i = first; i <= last; i++) {
+         list_for_each_entry(stream, &gHgfsStreamPaths[i], pathList) {
+            if (stream == self || !stream->dirty) {
+               continue;
+            }
+            if (subtree ?
+                strncmp(stream->path, path, pathLen) != 0 ||
+                (stream->path[pathLen] != '\0' &&
+                 stream->path[pathLen] != '/') :
+                stream->pathHash != hash || strcmp(stream->path, path) != 0) {
+               continue;
+            }
+            stream->refCount++;
+            batch[n++] = stream;
+            if (n == HGFS_STREAM_FLUSH_BATCH) {
+               goto collected;
+            }
+         }
+      }
+collected:
+      pthread_mutex_unlock(&gHgfsStreamsLock);
+
+      for (i = 0; i < n; i++) {
+         pthread_mutex_lock(&batch[i]->lock);
+         HgfsFileStreamFlushWrites(batch[i]);
+         pthread_mutex_unlock(&batch[i]->lock);
+         HgfsFileStreamPut(batch[i]);
+      }
+   } while (n == HGFS_STREAM_FLUSH_BATCH);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamGetAttr --
+ *
+ *    Get the attributes of the stream's file: the attribute cache entry
+ *    if there is a valid one, else fetched from the host by handle and
+ *    cached.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure.
+ *
+ * Side effects:
+ *    May send a getattr request and update the attribute cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HgfsFileStreamGetAttr(HgfsFileStream *stream, // IN: Stream
+                      HgfsAttrInfo *attr)     // OUT: Attributes
+{
+   int result;
+
+   if (HgfsGetAttrCache(stream->path, attr) == 0) {
+      return 0;
+   }
+
+   result = HgfsPrivateGetattr(stream->handle, stream->path, attr);
+   if (result == 0) {
+      HgfsSetAttrCache(stream->path, attr);
+   }
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamRecordAttr --
+ *
+ *    Record the size and write time of the file as the readahead buffer
+ *    is about to be filled. Called with the stream lock held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    See HgfsFileStreamGetAttr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsFileStreamRecordAttr(HgfsFileStream *stream) // IN: Stream
+{
+   HgfsAttrInfo attr;
+
+   stream->raAttrValid = HgfsFileStreamGetAttr(stream, &attr) == 0;
+   if (stream->raAttrValid) {
+      stream->raSize = attr.size;
+      stream->raWriteTime = attr.writeTime;
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamCheckAttr --
+ *
+ *    Revalidate the readahead buffer: compare the current size and write
+ *    time of the file with those recorded when the buffer was filled. A
+ *    change means the file was modified, possibly on the host. If the
+ *    attribute cache has no entry for the file, they are fetched from
+ *    the host; if that fails too, nothing vouches for the buffer.
+ *    Called with the stream lock held.
+ *
+ * Results:
+ *    TRUE if the buffer may be stale.
+ *
+ * Side effects:
+ *    See HgfsFileStreamGetAttr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsFileStreamCheckAttr(HgfsFileStream *stream) // IN: Stream
+{
+   HgfsAttrInfo attr;
+
+   if (!stream->raAttrValid || HgfsFileStreamGetAttr(stream, &attr) != 0) {
+      return TRUE;
+   }
+
+   return attr.size != stream->raSize ||
+          attr.writeTime != stream->raWriteTime;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadClaim --
+ *
+ *    Claim the next unclaimed chunk of a fill. Once a chunk has come back
+ *    short, at end of file, or failed, the chunks after it are not read.
+ *    The fill leaves the queue when no chunk is left to claim. Called
+ *    with gHgfsRaLock held.
+ *
+ * Results:
+ *    The chunk index, or -1 if no chunk is left.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HgfsReadaheadClaim(HgfsReadaheadFill *fill) // IN: Fill
+{
+   if (fill->stopped || fill->nextChunk == fill->numChunks) {
+      list_del_init(&fill->list);
+      return -1;
+   }
+   return fill->nextChunk++;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadRunChunk --
+ *
+ *    Read one chunk of a fill from the server. Called without locks.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Fills part of the fill buffer, wakes the filler once no claimed
+ *    chunk is outstanding.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsReadaheadRunChunk(HgfsReadaheadFill *fill, // IN: Fill
+                      int i)                   // IN: Chunk index
+{
+   size_t offset = (size_t)i * HGFS_LARGE_IO_MAX;
+   size_t count = MIN(fill->len - offset, HGFS_LARGE_IO_MAX);
+   int result;
+
+   result = HgfsDoRead(fill->handle, fill->buf + offset, count,
+                       fill->start + offset);
+
+   pthread_mutex_lock(&gHgfsRaLock);
+   fill->result[i] = result;
+   if (result < 0 || (size_t)result < count) {
+      fill->stopped = TRUE;
+   }
+   if (++fill->doneChunks == fill->nextChunk) {
+      pthread_cond_signal(&fill->doneCond);
+   }
+   pthread_mutex_unlock(&gHgfsRaLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadWorker --
+ *
+ *    Readahead worker thread: reads chunks of queued fills.
+ *
+ * Results:
+ *    Does not return.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+HgfsReadaheadWorker(void *unused) // IN: Thread argument
+{
+   for (;;) {
+      HgfsReadaheadFill *fill;
+      int i;
+
+      pthread_mutex_lock(&gHgfsRaLock);
+      while (list_empty(&gHgfsRaQueue)) {
+         pthread_cond_wait(&gHgfsRaCond, &gHgfsRaLock);
+      }
+      fill = list_entry(gHgfsRaQueue.next, HgfsReadaheadFill, list);
+      i = HgfsReadaheadClaim(fill);
+      pthread_mutex_unlock(&gHgfsRaLock);
+
+      if (i >= 0) {
+         HgfsReadaheadRunChunk(fill, i);
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadaheadStartWorkers --
+ *
+ *    Start readahead workers until there is one less than the number of
+ *    requests the transport keeps in flight; the reading thread makes up
+ *    the last one. Called with gHgfsRaLock held.
+ *
+ * Results:
+ *    The number of workers.
+ *
+ * Side effects:
+ *    Starts detached threads, which never exit.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint32
+HgfsReadaheadStartWorkers(void)
+{
+   uint32 wanted = gState->maxRequests > 1 ? gState->maxRequests - 1 : 0;
+
+   while (gHgfsRaWorkers < wanted) {
+      pthread_attr_t attr;
+      pthread_t thread;
+      int res;
+
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      res = pthread_create(&thread, &attr, HgfsReadaheadWorker, NULL);
+      pthread_attr_destroy(&attr);
+      if (res != 0) {
+         LOG(4, ("Failed to start a readahead worker: %d\n", res));
+         break;
+      }
+      gHgfsRaWorkers++;
+   }
+   return gHgfsRaWorkers;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamFill --
+ *
+ *    Fetch len bytes starting at the page aligned offset start into the
+ *    readahead buffer, HGFS_LARGE_IO_MAX bytes per server request. The
+ *    requests are queued for the readahead workers and this thread reads
+ *    whatever chunks they have not claimed, so up to gState->maxRequests
+ *    of them are in flight. Called with the stream lock held.
+ *
+ * Results:
+ *    Number of bytes now buffered, less than len at end of file, or a
+ *    negative error if nothing could be read.
+ *
+ * Side effects:
+ *    Replaces the previous readahead contents.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ssize_t
+HgfsFileStreamFill(HgfsFileStream *stream, // IN: Stream
+                   loff_t start,           // IN: Offset to fetch from
+                   size_t len)             // IN: Bytes to fetch
+{
+   HgfsReadaheadFill fill;
+   size_t filled = 0;
+   int result = 0;
+   uint32 i;
+
+   ASSERT(len <= HGFS_READAHEAD_MAX + HGFS_PAGE_SIZE);
+   ASSERT(stream->raBuf != NULL);
+
+   stream->raOffset = start;
+   stream->raLen = 0;
+   HgfsFileStreamRecordAttr(stream);
+
+   memset(&fill, 0, sizeof fill);
+   INIT_LIST_HEAD(&fill.list);
+   fill.handle = stream->handle;
+   fill.buf = stream->raBuf;
+   fill.start = start;
+   fill.len = len;
+   fill.numChunks = (len + HGFS_LARGE_IO_MAX - 1) / HGFS_LARGE_IO_MAX;
+   pthread_cond_init(&fill.doneCond, NULL);
+
+   pthread_mutex_lock(&gHgfsRaLock);
+   if (fill.numChunks > 1 && HgfsReadaheadStartWorkers() > 0) {
+      list_add_tail(&fill.list, &gHgfsRaQueue);
+      pthread_cond_broadcast(&gHgfsRaCond);
+   }
+   while ((result = HgfsReadaheadClaim(&fill)) >= 0) {
+      pthread_mutex_unlock(&gHgfsRaLock);
+      HgfsReadaheadRunChunk(&fill, result);
+      pthread_mutex_lock(&gHgfsRaLock);
+   }
+   /* Nothing is left to claim, wait for the chunks the workers took. */
+   while (fill.doneChunks < fill.nextChunk) {
+      pthread_cond_wait(&fill.doneCond, &gHgfsRaLock);
+   }
+   pthread_mutex_unlock(&gHgfsRaLock);
+   pthread_cond_destroy(&fill.doneCond);
+
+   /* The data ends at the first short or failed chunk. */
+   for (i = 0; i < fill.nextChunk; i++) {
+      size_t count = MIN(len - filled, HGFS_LARGE_IO_MAX);
+
+      result = fill.result[i];
+      if (result < 0) {
+         break;
+      }
+      filled += result;
+      if ((size_t)result < count) {
+         break;
+      }
+   }
+
+   stream->raLen = filled;
+   LOG(6, ("Readahead 0x%"FMTSZ"x bytes @ 0x%"FMT64"x -> 0x%"FMTSZ"x\n",
+           len, start, filled));
+
+   return (result < 0 && filled == 0) ? (ssize_t)result : (ssize_t)filled;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFileStreamRead --
+ *
+ *    Satisfy a read from the readahead buffer, refilling it as needed
+ *    while the access pattern is sequential. Called with the stream lock
+ *    held.
+ *
+ *    End of file is not remembered across reads: a read at the end of
+ *    the buffered data always asks the server again, so data appended
+ *    on the host (log files, tail -f) shows up through the handle.
+ *
+ * Results:
+ *    Returns the number of bytes read on success, or an error on
+ *    failure.
+ *
+ * Side effects:
+ *    Pending writes of the stream are flushed first.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static ssize_t
+HgfsFileStreamRead(HgfsFileStream *stream, // IN: Stream
+                   char *buf,              // OUT: Buffer to copy data into
+                   size_t count,           // IN:  Number of bytes to read
+                   loff_t offset)          // IN:  Offset at which to read
+{
+   size_t copied = 0;
+   ssize_t result = 0;
+   Bool shortFill = FALSE;
+
+   /* A failure belongs to the writer and is reported to it, not here. */
+   HgfsFileStreamFlushWrites(stream);
+
+   if (offset == stream->nextReadOffset) {
+      stream->raWindow = (stream->raWindow == 0) ?
+                            HGFS_READAHEAD_MIN :
+                            MIN(stream->raWindow * 2, HGFS_READAHEAD_MAX);
+   } else {
+      stream->raWindow = 0;
+   }
+
+   if (stream->raLen > 0 && HgfsFileStreamCheckAttr(stream)) {
+      LOG(6, ("Dropping readahead of handle %u, file changed\n",
+              stream->handle));
+      stream->raLen = 0;
+   }
+
+   while (copied < count) {
+      loff_t curOffset = offset + copied;
+      loff_t raEnd = stream->raOffset + stream->raLen;
+      loff_t start;
+      size_t len;
+
+      if (curOffset >= stream->raOffset && curOffset < raEnd) {
+         size_t n = MIN(count - copied, raEnd - curOffset);
+
+         memcpy(buf + copied, stream->raBuf + (curOffset - stream->raOffset),
+                n);
+         copied += n;
+         continue;
+      }
+
+      /* The fill made by this read already hit the end of the file. */
+      if (shortFill && curOffset == raEnd) {
+         break;
+      }
+
+      if (stream->raWindow > count - copied && stream->raBuf == NULL) {
+         void *raBuf;
+
+         if (posix_memalign(&raBuf, HGFS_PAGE_SIZE,
+                            HGFS_READAHEAD_MAX + HGFS_PAGE_SIZE) == 0) {
+            stream->raBuf = raBuf;
+         }
+      }
+
+      if (stream->raWindow <= count - copied || stream->raBuf == NULL) {
+         /*
+          * Random access, a request larger than the window, or no memory
+          * for the readahead buffer.
+          */
+         result = HgfsDirectRead(stream->handle, buf + copied, count - copied,
+                                 curOffset);
+         if (result > 0) {
+            copied += result;
+         }
+         break;
+      }
+
+      start = curOffset & ~((loff_t)HGFS_PAGE_SIZE - 1);
+      len = (curOffset - start) + stream->raWindow;
+      result = HgfsFileStreamFill(stream, start, len);
+      if (result < 0 || result <= curOffset - start) {
+         break;
+      }
+      shortFill = (size_t)result < len;
+   }
+
+   stream->nextReadOffset = offset + copied;
 
-   default:
-      /*
-       * This can only happen if all three flags are set, which
-       * conceptually makes no sense because O_EXCL and O_TRUNC are
-       * mutually exclusive if O_CREAT is set.
-       *
-       * However, the open(2) man page doesn't say you can't set all
-       * three flags, and certain apps (*cough* Nautilus *cough*) do
-       * so. To be friendly to those apps, we just silenty drop the
-       * O_TRUNC flag on the assumption that it's safer to honor
-       * O_EXCL.
-       */
-      LOG(4, ("Invalid open flags %o. Ignoring the O_TRUNC flag.\n", flags));
-      result = HGFS_OPEN_CREATE_SAFE;
-      break;
+   if (copied == 0 && result < 0) {
+      return result;
    }
 
-   return result;
+   memset(buf + copied, 0, count - copied);
+   return copied;
 }
 
 
-/*
- * HGFS file operations for files.
- */
-
 /*
  *----------------------------------------------------------------------
  *
- * HgfsOpenInt --
+ * HgfsFileStreamWrite --
  *
- *    We send an "Open" request to the server with the file path
- *    If the Open succeeds, we store the filehandle sent by the server
- *    in the file info struct so it can be accessed by
- *    read/write/close.
+ *    Add a write to the write-behind buffer if it continues the buffered
+ *    data, flushing the buffer when it cannot. Called with the stream
+ *    lock held.
  *
  * Results:
- *    Returns zero if on success, error on failure.
+ *    Returns the number of bytes written on success, or an error on
+ *    failure. If an earlier buffered write of the handle failed, its
+ *    error is returned and this write is not performed.
  *
  * Side effects:
- *    None
+ *    Drops the readahead buffer.
  *
  *----------------------------------------------------------------------
  */
 
-int
-HgfsOpenInt(const char *path,           //IN: Path to a file
-            struct fuse_file_info *fi,  //OUT: File info structure
-            mode_t permsMode,           //IN: Permissions, in this context
-            HgfsOpenValid mask)         //IN: Open validation mask
+static ssize_t
+HgfsFileStreamWrite(HgfsFileStream *stream, // IN: Stream
+                    const char *buf,        // IN: Data to write
+                    size_t count,           // IN: Number of bytes to write
+                    loff_t offset)          // IN: Offset to begin writing at
 {
-   HgfsReq *req;
-   HgfsOp opUsed;
-   HgfsStatus replyStatus;
-   HgfsHandle replyFile;
-   HgfsLockType replyLock;
-   int result = 0;
-
-   ASSERT(NULL != path);
-   ASSERT(NULL != fi);
+   int result;
 
-   LOG(4, ("Entry(%s)\n", path));
+   /* Any data read ahead may be stale from now on. */
+   stream->raLen = 0;
 
-   req = HgfsGetNewRequest();
-   if (!req) {
-      LOG(4, ("Out of memory while getting new request.\n"));
-      result = -ENOMEM;
-      goto out;
+   if (stream->wbLen > 0 &&
+       (offset != stream->wbOffset + stream->wbLen ||
+        stream->wbLen + count > HGFS_WRITEBEHIND_MAX)) {
+      HgfsFileStreamFlushWrites(stream);
    }
 
-   fi->fh = HGFS_INVALID_HANDLE;
+   if (stream->wbError != 0) {
+      result = stream->wbError;
+      stream->wbError = 0;
+      return result;
+   }
 
-retry:
-   /*
-    * Set up pointers using the proper struct This lets us check the
-    * version exactly once and use the pointers later.
-    */
+   if (count >= HGFS_WRITEBEHIND_MAX) {
+      return HgfsDirectWrite(stream->handle, buf, count, offset);
+   }
 
-   opUsed = hgfsVersionOpen;
-   result = HgfsPackOpenRequest(path, fi, permsMode, mask, opUsed, req);
-   if (result != 0) {
-      LOG(4, ("Error packing request.\n"));
-      goto out;
+   if (stream->wbBuf == NULL) {
+      stream->wbBuf = malloc(HGFS_WRITEBEHIND_MAX);
+      if (stream->wbBuf == NULL) {
+         return HgfsDirectWrite(stream->handle, buf, count, offset);
+      }
    }
 
-   /* Send the request and process the reply. */
-   result = HgfsSendRequest(req);
-   if (result == 0) {
-      /* Get the reply and check return status. */
-      replyStatus = HgfsGetReplyStatus(req);
-      result = HgfsStatusConvertToLinux(replyStatus);
+   if (stream->wbLen == 0) {
+      stream->wbOffset = offset;
+      HgfsFileStreamSetDirty(stream, TRUE);
+   }
+   memcpy(stream->wbBuf + stream->wbLen, buf, count);
+   stream->wbLen += count;
 
-      switch (result) {
-      case 0:
-         result = HgfsUnpackOpenReply(req, opUsed, &replyFile, &replyLock);
-         if (result != 0) {
-            break;
-         }
+   if (stream->wbLen == HGFS_WRITEBEHIND_MAX) {
+      result = HgfsFileStreamFlushWrites(stream);
+      if (result < 0) {
+         /* Reported right here, this write's data was part of it. */
+         stream->wbError = 0;
+         return result;
+      }
+   }
 
-         fi->fh = (uint64_t)replyFile;
-         LOG( 4,("Server file handle: %"FMT64"u\n", fi->fh));
+   return count;
+}
 
-         break;
 
-      case -EPROTO:
-         /* Retry with older version(s). Set globally. */
-         if (opUsed == HGFS_OP_OPEN_V3) {
-            LOG(4, ("Version 3 not supported. Falling back to version 2.\n"));
-            hgfsVersionOpen = HGFS_OP_OPEN_V2;
-            goto retry;
-         }
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFlush --
+ *
+ *    Push the buffered writes of a file handle to the server. Called on
+ *    flush and fsync.
+ *
+ * Results:
+ *    Zero on success, or a negative error, possibly that of an earlier
+ *    buffered write.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
 
-         /* Retry with Version 1 of Open. Set globally. */
-         if (opUsed == HGFS_OP_OPEN_V2) {
-            LOG(4, ("Version 2 not supported. Falling back to version 1.\n"));
-            hgfsVersionOpen = HGFS_OP_OPEN;
-            goto retry;
-         }
+int
+HgfsFlush(struct fuse_file_info *fi)  // IN: File info structure
+{
+   HgfsFileStream *stream;
+   int result;
 
-         /* Fallthrough. */
-      default:
-         break;
-      }
-   } else if (result == -EIO) {
-      LOG(8, ("Timed out. error: %d\n", result));
-   } else if (result == -EPROTO) {
-      LOG(4, ("Server returned error: %d\n", result));
-   } else {
-      LOG(4, ("Unknown error: %d\n", result));
+   stream = HgfsFileStreamAcquire(fi->fh, NULL);
+   if (stream == NULL) {
+      return 0;
    }
-out:
-   HgfsFreeRequest(req);
-   LOG(4, ("Exit(0x%"FMT64"x -> %d)\n",fi->fh, result));
+
+   pthread_mutex_lock(&stream->lock);
+   HgfsFileStreamFlushWrites(stream);
+   result = stream->wbError;
+   stream->wbError = 0;
+   pthread_mutex_unlock(&stream->lock);
+
+   HgfsFileStreamPut(stream);
    return result;
 }
 
@@ -465,12 +1537,15 @@ out:
 /*
  *----------------------------------------------------------------------
  *
- * HgfsOpen --
+ * HgfsFlushWrites --
  *
- *    Called whenever a process opens a file in our filesystem.
+ *    Push the writes buffered by any handle open on a file to the
+ *    server, so that attributes fetched or changed by path see all data
+ *    written so far. Errors are kept and reported on the handle's next
+ *    write or flush.
  *
  * Results:
- *    Returns zero if on success, error on failure.
+ *    None
  *
  * Side effects:
  *    None
@@ -478,36 +1553,56 @@ out:
  *----------------------------------------------------------------------
  */
 
-int
-HgfsOpen(const char *path,             //IN: Path to a file
-            struct fuse_file_info *fi) //OUT: File info structure
+void
+HgfsFlushWrites(const char *path) // IN: Path of the file
 {
-     return HgfsOpenInt(path, fi, 0, HGFS_FILE_OPEN_MASK);
+   HgfsFileStreamFlushPath(path, NULL, FALSE);
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsCreate --
+ * HgfsFileStreamRelease --
  *
- *    Called whenever a process request to create a file
+ *    Flush and drop the stream state of a handle about to be closed.
  *
  * Results:
- *    Returns zero if on success, error on failure.
+ *    Zero on success, or a negative error of a buffered write that was
+ *    not reported yet.
  *
  * Side effects:
- *    None
+ *    Frees the stream and its buffers, or leaves that to a concurrent
+ *    operation still holding a reference.
  *
  *----------------------------------------------------------------------
  */
 
-int
-HgfsCreate(const char *path,          //IN: Path to a file
-           mode_t permsMode,          //IN: Permission to open the file
-           struct fuse_file_info *fi) //OUT: File info structure
+static int
+HgfsFileStreamRelease(HgfsHandle handle) // IN: Server file handle
 {
-     return HgfsOpenInt(path, fi, permsMode, HGFS_FILE_CREATE_MASK);
+   HgfsFileStream *stream;
+   int result;
+
+   stream = HgfsFileStreamAcquire(handle, NULL);
+   if (stream == NULL) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&gHgfsStreamsLock);
+   list_del_init(&stream->list);
+   list_del_init(&stream->pathList);
+   stream->refCount--; /* The table's reference. */
+   pthread_mutex_unlock(&gHgfsStreamsLock);
+
+   pthread_mutex_lock(&stream->lock);
+   HgfsFileStreamFlushWrites(stream);
+   result = stream->wbError;
+   stream->wbError = 0;
+   pthread_mutex_unlock(&stream->lock);
+
+   HgfsFileStreamPut(stream);
+   return result;
 }
 
 
@@ -650,9 +1745,10 @@ out:
 /*
  *----------------------------------------------------------------------
  *
- * HgfsRead --
+ * HgfsDirectRead --
  *
- *    Called whenever a process reads from a file in our filesystem.
+ *    Read straight from the server, splitting the read into as many
+ *    requests as needed.
  *
  * Results:
  *    Returns the number of bytes read on success, or an error on
@@ -664,29 +1760,25 @@ out:
  *----------------------------------------------------------------------
  */
 
-ssize_t
-HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
-         char  *buf,                 // OUT: User buffer to copy data into
-         size_t count,               // IN:  Number of bytes to read
-         loff_t offset)              // IN:  Offset at which to read
+static ssize_t
+HgfsDirectRead(HgfsHandle handle,  // IN:  Handle for this file
+               char  *buf,         // OUT: User buffer to copy data into
+               size_t count,       // IN:  Number of bytes to read
+               loff_t offset)      // IN:  Offset at which to read
 {
    int result = 0;
    char *buffer = buf;
    loff_t curOffset = offset;
    size_t nextCount, remainingCount = count;
 
-   ASSERT(NULL != fi);
    ASSERT(NULL != buf);
 
-   LOG(4, ("Entry(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
-           fi->fh, count, offset));
-
     do {
       nextCount = (remainingCount > HGFS_LARGE_IO_MAX) ?
                                      HGFS_LARGE_IO_MAX : remainingCount;
-      LOG(4, ("Issue DoRead(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
-              fi->fh, nextCount, curOffset));
-      result = HgfsDoRead(fi->fh, buffer, nextCount, curOffset);
+      LOG(4, ("Issue DoRead(0x%x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
+              handle, nextCount, curOffset));
+      result = HgfsDoRead(handle, buffer, nextCount, curOffset);
       if (result < 0) {
          LOG(8, ("Error: DoRead: -> %d\n", result));
          goto out;
@@ -700,11 +1792,66 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
   memset(buffer, 0, remainingCount);
 
   out:
-   LOG(4, ("Exit(%"FMTSZ"d)\n", count - remainingCount));
    return (count - remainingCount);
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsRead --
+ *
+ *    Called whenever a process reads from a file in our filesystem.
+ *
+ * Results:
+ *    Returns the number of bytes read on success, or an error on
+ *    failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+HgfsRead(const char *path,           // IN:  Path to the file
+         struct fuse_file_info *fi,  // IN:  File info struct
+         char  *buf,                 // OUT: User buffer to copy data into
+         size_t count,               // IN:  Number of bytes to read
+         loff_t offset)              // IN:  Offset at which to read
+{
+   HgfsFileStream *stream;
+   ssize_t result;
+
+   ASSERT(NULL != path);
+   ASSERT(NULL != fi);
+   ASSERT(NULL != buf);
+
+   LOG(4, ("Entry(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
+           fi->fh, count, offset));
+
+   stream = HgfsFileStreamAcquire(fi->fh, path);
+
+   /* Writes still buffered by other handles of the file must be visible. */
+   HgfsFileStreamFlushPath(path, stream, FALSE);
+
+   if (stream == NULL) {
+      result = HgfsDirectRead(fi->fh, buf, count, offset);
+      goto out;
+   }
+
+   pthread_mutex_lock(&stream->lock);
+   HgfsFileStreamUpdatePath(stream, path);
+   result = HgfsFileStreamRead(stream, buf, count, offset);
+   pthread_mutex_unlock(&stream->lock);
+   HgfsFileStreamPut(stream);
+
+out:
+   LOG(4, ("Exit(%"FMTSZ"d)\n", result));
+   return result;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -835,9 +1982,10 @@ out:
 /*
  *----------------------------------------------------------------------
  *
- * HgfsWrite --
+ * HgfsDirectWrite --
  *
- *    Called whenever a process writes to a file in our filesystem.
+ *    Write straight to the server, splitting the write into as many
+ *    requests as needed.
  *
  * Results:
  *    Returns the number of bytes written on success, or an error on
@@ -849,11 +1997,11 @@ out:
  *----------------------------------------------------------------------
  */
 
-ssize_t
-HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
-         const char  *buf,            // OUT: User buffer to copy data into
-         size_t count,                // IN:  Number of bytes to read
-         loff_t offset)               // IN:  Offset at which to read
+static ssize_t
+HgfsDirectWrite(HgfsHandle handle,   // IN: Handle for the file
+                const char  *buf,    // IN: Data to write
+                size_t count,        // IN: Number of bytes to write
+                loff_t offset)       // IN: Offset to begin writing at
 {
    int result;
    const char *buffer = buf;
@@ -862,19 +2010,15 @@ HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
    ssize_t bytesWritten = 0;
 
    ASSERT(NULL != buf);
-   ASSERT(NULL != fi);
-
-   LOG(6, ("Entry(0x%"FMT64"x off bytes 0x%"FMTSZ"x @ 0x%"FMT64"x)\n",
-           fi->fh, count, offset));
 
    do {
       nextCount = (remainingCount > HGFS_LARGE_IO_MAX) ?
                                      HGFS_LARGE_IO_MAX : remainingCount;
 
-      LOG(4, ("Issue DoWrite(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
-              fi->fh, nextCount, curOffset));
+      LOG(4, ("Issue DoWrite(0x%x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
+              handle, nextCount, curOffset));
 
-      result = HgfsDoWrite(fi->fh, buffer, nextCount, curOffset);
+      result = HgfsDoWrite(handle, buffer, nextCount, curOffset);
       if (result < 0) {
          bytesWritten = result;
          LOG(4, ("Error: written 0x%"FMTSZ"x bytes DoWrite -> %d\n",
@@ -889,6 +2033,57 @@ HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
 
    bytesWritten = count - remainingCount;
 
+out:
+   return bytesWritten;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWrite --
+ *
+ *    Called whenever a process writes to a file in our filesystem.
+ *
+ * Results:
+ *    Returns the number of bytes written on success, or an error on
+ *    failure.
+ *
+ * Side effects:
+ *    The data may only be buffered, see HgfsFlush.
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+HgfsWrite(const char *path,           // IN: Path to the file
+          struct fuse_file_info *fi,  // IN: File info structure
+          const char  *buf,           // IN: User buffer to copy data from
+          size_t count,               // IN: Number of bytes to write
+          loff_t offset)              // IN: Offset at which to write
+{
+   HgfsFileStream *stream;
+   ssize_t bytesWritten;
+
+   ASSERT(NULL != path);
+   ASSERT(NULL != buf);
+   ASSERT(NULL != fi);
+
+   LOG(6, ("Entry(0x%"FMT64"x off bytes 0x%"FMTSZ"x @ 0x%"FMT64"x)\n",
+           fi->fh, count, offset));
+
+   stream = HgfsFileStreamAcquire(fi->fh, path);
+   if (stream == NULL) {
+      bytesWritten = HgfsDirectWrite(fi->fh, buf, count, offset);
+      goto out;
+   }
+
+   pthread_mutex_lock(&stream->lock);
+   HgfsFileStreamUpdatePath(stream, path);
+   bytesWritten = HgfsFileStreamWrite(stream, buf, count, offset);
+   pthread_mutex_unlock(&stream->lock);
+   HgfsFileStreamPut(stream);
+
 out:
    LOG(6, ("Exit(0x%"FMTSZ"x)\n", bytesWritten));
    return bytesWritten;
@@ -930,6 +2125,13 @@ HgfsRename(const char* from, const char* to)
    ASSERT(from);
    ASSERT(to);
 
+   /*
+    * Data buffered under either name goes out before the names change,
+    * as the streams only learn their new path on their next use.
+    */
+   HgfsFileStreamFlushPath(from, NULL, TRUE);
+   HgfsFileStreamFlushPath(to, NULL, TRUE);
+
    req = HgfsGetNewRequest();
    if (!req) {
       LOG(4, ("Out of memory while getting new request\n"));
@@ -1334,6 +2536,9 @@ HgfsSetattr(const char* path,       //IN: Path to file
 
    LOG(4, ("Entry(%s)\n", path));
 
+   /* Buffered writes must not land after e.g. a truncate. */
+   HgfsFlushWrites(path);
+
    req = HgfsGetNewRequest();
    if (!req) {
       result = -ENOMEM;
@@ -1411,6 +2616,11 @@ HgfsRelease(HgfsHandle handle)  //IN:File handle to close
 
    LOG(6, ("Entry(handle = %u)\n", handle));
 
+   result = HgfsFileStreamRelease(handle);
+   if (result < 0) {
+      LOG(4, ("Flushing buffered writes failed. handle = %u\n", handle));
+   }
+
    req = HgfsGetNewRequest();
    if (!req) {
       LOG(4, ("Out of memory while getting new request\n"));
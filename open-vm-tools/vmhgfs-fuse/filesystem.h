@@ -47,6 +47,8 @@ typedef struct HgfsFuseState {
 
    GKeyFile *conf;
 
+   uint32 maxRequests;  /* Transport queue depth, 0 for the default. */
+
 } HgfsFuseState;
 
 /* Public functions (with respect to the entire module). */
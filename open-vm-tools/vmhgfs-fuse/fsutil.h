@@ -70,7 +70,8 @@ HgfsRestoreReadOnly(const char* path,
                     HgfsAttrInfo *enableWrite);
 
 ssize_t
-HgfsWrite(struct fuse_file_info *fi,
+HgfsWrite(const char *path,
+          struct fuse_file_info *fi,
           const char  *buf,
           size_t count,
           loff_t offset);
@@ -90,11 +91,18 @@ HgfsCreate(const char *path,
            struct fuse_file_info *fi);
 
 ssize_t
-HgfsRead(struct fuse_file_info *fi,
+HgfsRead(const char *path,
+         struct fuse_file_info *fi,
          char  *buf,
          size_t count,
          loff_t offset);
 
+int
+HgfsFlush(struct fuse_file_info *fi);
+
+void
+HgfsFlushWrites(const char *path);
+
 int
 HgfsSetattr(const char* path,
             HgfsAttrInfo *attr);
@@ -121,6 +129,7 @@ HgfsDirOpen(const char* path, HgfsHandle* handle);
 
 int
 HgfsReaddir(HgfsHandle handle,
+            const char *path,
             void *dirent,
             fuse_fill_dir_t filldir);
 
@@ -142,4 +151,8 @@ HgfsResetOps(void);
 unsigned long
 HgfsCalcBlockSize(uint64 tsize);
 
+void
+HgfsAttrToStat(const HgfsAttrInfo *attr,
+               struct stat *stbuf);
+
 #endif // _HGFS_DRIVER_FSUTIL_H_
@@ -126,7 +126,6 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
    HgfsHandle fileHandle = HGFS_INVALID_HANDLE;
    HgfsAttrInfo newAttr = {0};
    HgfsAttrInfo *attr = &newAttr;
-   uint32 d_type;
    char *abspath = NULL;
    int res;
 
@@ -138,12 +137,17 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
 
    res = HgfsGetAttrCache(abspath, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
-   if (res != 0) {
+   if (res != 0 && res != -ENOENT) {
+      /* The size and times from the server must include buffered writes. */
+      HgfsFlushWrites(abspath);
+
       /* Retrieve new complete attribute settings and update the cache. */
       res = HgfsPrivateGetattr(fileHandle, abspath, attr);
       LOG(4, ("Retrieve attr from server. result = %d \n", res));
       if (res == 0 ) {
          HgfsSetAttrCache(abspath, attr);
+      } else if (res == -ENOENT) {
+         HgfsSetNegativeAttrCache(abspath);
       }
    }
 
@@ -153,59 +157,7 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
 
    LOG(4, ("fill stat for %s\n", abspath));
 
-   memset(stbuf, 0, sizeof *stbuf);
-
-   if (attr->mask & HGFS_ATTR_VALID_SPECIAL_PERMS) {
-      stbuf->st_mode |= (attr->specialPerms << 9);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_OWNER_PERMS) {
-      stbuf->st_mode |= (attr->ownerPerms << 6);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_GROUP_PERMS) {
-      stbuf->st_mode |= (attr->groupPerms << 3);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_OTHER_PERMS) {
-      stbuf->st_mode |= (attr->otherPerms);
-   }
-
-   /* Mask the access mode. */
-   switch (attr->type) {
-   case HGFS_FILE_TYPE_SYMLINK:
-      d_type = DT_LNK;
-      break;
-
-   case HGFS_FILE_TYPE_REGULAR:
-      d_type = DT_REG;
-      break;
-
-   case HGFS_FILE_TYPE_DIRECTORY:
-      d_type = DT_DIR;
-      break;
-
-   default:
-      d_type = DT_UNKNOWN;
-      break;
-   }
-
-   stbuf->st_mode |= d_type << 12;
-   stbuf->st_blksize = HGFS_BLOCKSIZE;
-   stbuf->st_blocks = HgfsCalcBlockSize(attr->size);
-   stbuf->st_size = attr->size;
-   stbuf->st_ino = attr->hostFileId;
-   stbuf->st_nlink = 1;
-   stbuf->st_uid = attr->userId;
-   stbuf->st_gid = attr->groupId;
-   stbuf->st_rdev = 0;
-
-   if (attr->mask & HGFS_ATTR_VALID_ACCESS_TIME) {
-      HGFS_SET_TIME(stbuf->st_atime, attr->accessTime);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_WRITE_TIME) {
-      HGFS_SET_TIME(stbuf->st_mtime, attr->writeTime);
-   }
-   if (attr->mask & HGFS_ATTR_VALID_CHANGE_TIME) {
-      HGFS_SET_TIME(stbuf->st_ctime, attr->attrChangeTime);
-   }
+   HgfsAttrToStat(attr, stbuf);
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -247,9 +199,9 @@ hgfs_access(const char *path,  //IN: Path to a file.
       goto exit;
    }
 
-   res = HgfsGetAttrCache(path, attr);
+   res = HgfsGetAttrCache(abspath, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
-   if (res != 0) {
+   if (res != 0 && res != -ENOENT) {
       /* Retrieve new complete attribute settings and update the cache. */
       res = HgfsPrivateGetattr(fileHandle, abspath, attr);
       LOG(4, ("Retrieve attr from server. result = %d \n", res));
@@ -388,7 +340,7 @@ hgfs_readdir(const char *path,          //IN: path to a directory
    }
 
    fi->fh = fileHandle;
-   res = HgfsReaddir(fileHandle, buf, filler);
+   res = HgfsReaddir(fileHandle, abspath, buf, filler);
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -418,12 +370,24 @@ hgfs_mknod(const char *path,   //IN: Path to a file
            mode_t mode,        //IN: Mode to set
            dev_t rdev)         //IN: Device type
 {
+   char *abspath = NULL;
+
 #if defined(__APPLE__)
    LOG(4, ("Entry(path = %s, mode = %#o, %u)\n", path, mode, rdev));
 #else
    LOG(4, ("Entry(path = %s, mode = %#o, %"FMT64"u)\n", path, mode, rdev));
 #endif
    LOG(4, ("Dummy routine. Not implemented!"));
+
+   /*
+    * Nothing is created, but the kernel follows up with a lookup of the
+    * new name, which must go to the host rather than to a negative entry.
+    */
+   if (getAbsPath(path, &abspath) == 0) {
+      HgfsInvalidateAttrCache(abspath);
+   }
+   freeAbsPath(abspath);
+
    LOG(4, ("Exit(0)\n"));
    return 0;
 }
@@ -459,6 +423,9 @@ hgfs_mkdir(const char *path,  //IN: path to a new dir
    }
 
    res = HgfsMkdir(abspath, mode);
+   if (res == 0) {
+      HgfsInvalidateAttrCache(abspath);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -578,6 +545,9 @@ hgfs_symlink(const char *symname,   //IN: symname target
 
    LOG(4, ("symname = %s, abs source = %s)\n", symname, absSource));
    res = HgfsSymlink(absSource, symname);
+   if (res == 0) {
+      HgfsInvalidateAttrCache(absSource);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -668,7 +638,11 @@ hgfs_link(const char *from,  //IN: From path
       goto exit;
    }
 
-   /*Do nothing.*/
+   /*
+    * Do nothing, but forget whatever is cached for the target name so
+    * that the next lookup of it asks the host.
+    */
+   HgfsInvalidateAttrCache(absto);
    res = -1;
 
 exit:
@@ -1001,6 +975,9 @@ hgfs_open(const char *path,          //IN: path to a file
    }
 
    res = HgfsOpen(abspath, fi);
+   if (res == 0 && (fi->flags & O_CREAT) != 0) {
+      HgfsInvalidateAttrCache(abspath);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1040,6 +1017,9 @@ hgfs_create(const char *path,          //IN: path to a file
    }
 
    res = HgfsCreate(abspath, mode, fi);
+   if (res == 0) {
+      HgfsInvalidateAttrCache(abspath);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1088,7 +1068,7 @@ hgfs_read(const char *path,          //IN: path to a file
          goto exit;
       }
    }
-   res = HgfsRead(fi, buf, size, offset);
+   res = HgfsRead(abspath, fi, buf, size, offset);
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1138,7 +1118,7 @@ hgfs_write(const char *path,          //IN: path to a file
       }
    }
 
-   res = HgfsWrite(fi, buf, size, offset);
+   res = HgfsWrite(abspath, fi, buf, size, offset);
    if (res >= 0) {
       /*
        * Positive result indicates the number of bytes written.
@@ -1192,6 +1172,71 @@ exit:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_flush
+ *
+ *    Called on each close of a file descriptor. Writes out the data
+ *    buffered for the file handle.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_flush(const char *path,                //IN: path to a file
+           struct fuse_file_info *fi)       //IN: file info structure
+{
+   int res;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x)\n", path, fi->fh));
+
+   res = HgfsFlush(fi);
+
+   LOG(4, ("Exit(%d)\n", res));
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_fsync
+ *
+ *    Writes out the data buffered for the file handle.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_fsync(const char *path,                //IN: path to a file
+           int datasync,                    //IN: only sync data
+           struct fuse_file_info *fi)       //IN: file info structure
+{
+   int res;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x, %d)\n",
+           path, fi->fh, datasync));
+
+   res = HgfsFlush(fi);
+
+   LOG(4, ("Exit(%d)\n", res));
+   return res;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1297,15 +1342,22 @@ hgfs_init(struct fuse_conn_info *conn) // IN: unused
 static void
 hgfs_destroy(void *data) // IN: unused
 {
+   HgfsAttrCacheStats stats;
    int res;
 
    LOG(4, ("Entry()\n"));
 
+   HgfsGetAttrCacheStats(&stats);
+   LOG(4, ("attr cache: hits %"FMT64"u negative hits %"FMT64"u "
+           "misses %"FMT64"u evictions %"FMT64"u\n",
+           stats.hits, stats.negativeHits, stats.misses, stats.evictions));
+
    res = HgfsDestroySession();
    if (res < 0) {
       LOG(4, ("Destroy session failed. error = %d\n", res));
    }
 
+   HgfsTransportDumpStats();
    HgfsTransportExit();
 
    free(gState->basePath);
@@ -1344,7 +1396,9 @@ static struct fuse_operations vmhgfs_operations = {
    .read        = hgfs_read,
    .write       = hgfs_write,
    .statfs      = hgfs_statfs,
+   .flush       = hgfs_flush,
    .release     = hgfs_release,
+   .fsync       = hgfs_fsync,
    .create      = hgfs_create,
    .init        = hgfs_init,
    .destroy     = hgfs_destroy,
@@ -419,7 +419,8 @@ out:
  * HgfsCompleteReq --
  *
  *    Copies the reply packet into the request structure and wakes up
- *    the associated client.
+ *    the associated client. Removing the request from the transport's
+ *    pending table is up to the caller, which holds the table's lock.
  *
  * Results:
  *    None
@@ -442,7 +443,4 @@ HgfsCompleteReq(HgfsReq *req,       // IN: Request
    memcpy(HGFS_REQ_PAYLOAD(req), reply, replySize);
    req->payloadSize = replySize;
    req->state = HGFS_REQ_STATE_COMPLETED;
-   if (!list_empty(&req->list)) {
-      list_del_init(&req->list);
-   }
 }
@@ -24,13 +24,16 @@
  * actual transport channels (backdoor, tcp, vsock, ...).
  *
  * The sends happen in the process context, where as a thread
- * handles the asynchronous replies. A queue of pending replies is
- * maintained and is protected by a lock. The channel opens and close
- * is protected by a mutex.
+ * handles the asynchronous replies. Pending requests are kept in a
+ * table hashed by request id, protected by a lock. Sends share the
+ * active channel under a read lock so several requests can be in flight
+ * at once (up to the channel's queue depth); opening, resetting and
+ * closing the channel take the lock for writing.
  */
 
 
 
+#include <time.h>
 #include "bdhandler.h"
 #include "hgfsProto.h"
 #include "module.h"
@@ -38,16 +41,22 @@
 #include "transport.h"
 #include "vm_assert.h"
 
+#define HGFS_PENDING_BUCKETS 64
+
 static HgfsTransportChannel *gHgfsActiveChannel;     /* Current active channel. */
-static pthread_mutex_t gHgfsActiveChannelLock;       /* Current active channel lock. */
+static pthread_rwlock_t gHgfsActiveChannelLock;      /* Current active channel lock. */
 static Bool gHgfsActiveChannelLockInited;
+static uint32 gHgfsActiveChannelGen;                 /* Bumped on each reset. */
 
-static struct list_head gHgfsPendingRequests;        /* Pending requests queue. */
+/* Pending requests, hashed by request id. */
+static struct list_head gHgfsPendingRequests[HGFS_PENDING_BUCKETS];
 static pthread_mutex_t gHgfsPendingRequestsLock;     /* Pending requests queue lock. */
 static Bool gHgfsPendingRequestsLockInited;
+static HgfsTransportStats gHgfsTransportStats;       /* Protected by the above. */
 
 
 #define HgfsRequestId(req) ((HgfsRequest *)req)->id
+#define HgfsPendingBucket(id) (&gHgfsPendingRequests[(id) % HGFS_PENDING_BUCKETS])
 
 static void HgfsTransportChannelClose(HgfsTransportChannel **channel);
 
@@ -78,11 +87,20 @@ HgfsTransportChannelOpen(HgfsTransportChannel **channel) // IN: active channel
 
    *channel = HgfsBdChannelInit();
    if (NULL != *channel) {
-      HgfsChannelStatus status = (*channel)->ops.open(*channel);
+      HgfsChannelStatus status;
+
+      if (gState->maxRequests != 0) {
+         (*channel)->maxRequests = MIN(gState->maxRequests,
+                                       HGFS_TRANSPORT_MAX_REQUESTS);
+      }
+      status = (*channel)->ops.open(*channel);
       if (status != HGFS_CHANNEL_CONNECTED) {
          HgfsTransportChannelClose(channel);
          result = -ENOTCONN;
          *channel = NULL;
+      } else {
+         LOG(4, ("Channel %s open, queue depth %u.\n", (*channel)->name,
+                 (*channel)->maxRequests));
       }
    }
 
@@ -158,7 +176,7 @@ HgfsTransportChannelReset(HgfsTransportChannel **channel) // IN: active channel
  *
  * HgfsTransportEnqueueRequest --
  *
- *     Add the request to the gHgfsPendingRequests queue.
+ *     Add the request to the gHgfsPendingRequests table.
  *
  *
  * Side effects:
@@ -170,10 +188,16 @@ HgfsTransportChannelReset(HgfsTransportChannel **channel) // IN: active channel
 static void
 HgfsTransportEnqueueRequest(HgfsReq *req)   // IN: Request to add
 {
+   HgfsTransportStats *stats = &gHgfsTransportStats;
+
    ASSERT(req);
 
    pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   list_add_tail(&req->list, &gHgfsPendingRequests);
+   list_add_tail(&req->list, HgfsPendingBucket(req->id));
+   stats->requests++;
+   stats->depthHist[MIN(stats->inFlight, HGFS_TRANSPORT_MAX_REQUESTS)]++;
+   stats->inFlight++;
+   stats->maxInFlight = MAX(stats->maxInFlight, stats->inFlight);
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
 }
 
@@ -202,6 +226,8 @@ HgfsTransportDequeueRequest(HgfsReq *req)   // IN: Request to dequeue
    pthread_mutex_lock(&gHgfsPendingRequestsLock);
    if (!list_empty(&req->list)) {
       list_del_init(&req->list);
+      ASSERT(gHgfsTransportStats.inFlight > 0);
+      gHgfsTransportStats.inFlight--;
    }
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
 }
@@ -211,6 +237,45 @@ HgfsTransportDequeueRequest(HgfsReq *req)   // IN: Request to dequeue
  * Public function implementations.
  */
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportRecordRtt --
+ *
+ *     Account a request round trip in the RTT histogram. Called by the
+ *     channels around the exchange of a request and its reply only, so
+ *     waiting for a free RPC channel, opening one or resetting the
+ *     channel after a failure are not part of the sample.
+ *
+ * Results:
+ *     None
+ *
+ * Side effects:
+ *     None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsTransportRecordRtt(const struct timespec *start)   // IN: send time
+{
+   struct timespec end;
+   uint64 usecs;
+   uint32 bucket = 0;
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   usecs = (uint64)(end.tv_sec - start->tv_sec) * 1000000 +
+           (end.tv_nsec - start->tv_nsec) / 1000;
+   while (bucket < HGFS_TRANSPORT_RTT_BUCKETS - 1 && (usecs >> bucket) != 0) {
+      bucket++;
+   }
+
+   pthread_mutex_lock(&gHgfsPendingRequestsLock);
+   gHgfsTransportStats.rttHist[bucket]++;
+   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -243,15 +308,17 @@ HgfsTransportProcessPacket(char *receivedPacket,    //IN: received packet
    LOG(8, ("Entered.\n"));
    LOG(6, ("Req id: %d\n", id));
    /*
-    * Search through gHgfsPendingRequests queue for the matching id and wake up
-    * the associated waiting process. Delete the req from the queue.
+    * Search through the gHgfsPendingRequests bucket for the matching id and
+    * wake up the associated waiting process. Delete the req from the table.
     */
    pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   list_for_each_safe(cur, next, &gHgfsPendingRequests) {
+   list_for_each_safe(cur, next, HgfsPendingBucket(id)) {
       HgfsReq *req;
       req = list_entry(cur, HgfsReq, list);
       if (req->id == id) {
          ASSERT(req->state == HGFS_REQ_STATE_SUBMITTED);
+         list_del_init(&req->list);
+         gHgfsTransportStats.inFlight--;
          HgfsCompleteReq(req, receivedPacket, receivedSize);
          found = TRUE;
          break;
@@ -287,16 +354,21 @@ void
 HgfsTransportBeforeExitingRecvThread(void)
 {
    struct list_head *cur, *next;
+   int i;
 
-   /* Walk through gHgfsPendingRequests queue and reply them with error. */
+   /* Walk through gHgfsPendingRequests table and reply them with error. */
    pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   list_for_each_safe(cur, next, &gHgfsPendingRequests) {
-      HgfsReq *req;
-      HgfsReply reply;
-
-      req = list_entry(cur, HgfsReq, list);
-      LOG(6, ("Injecting error reply to req id: %d\n", req->id));
-      HgfsCompleteReq(req, (char *)&reply, sizeof reply);
+   for (i = 0; i < HGFS_PENDING_BUCKETS; i++) {
+      list_for_each_safe(cur, next, &gHgfsPendingRequests[i]) {
+         HgfsReq *req;
+         HgfsReply reply;
+
+         req = list_entry(cur, HgfsReq, list);
+         LOG(6, ("Injecting error reply to req id: %d\n", req->id));
+         list_del_init(&req->list);
+         gHgfsTransportStats.inFlight--;
+         HgfsCompleteReq(req, (char *)&reply, sizeof reply);
+      }
    }
    pthread_mutex_unlock(&gHgfsPendingRequestsLock);
 }
@@ -321,42 +393,71 @@ HgfsTransportBeforeExitingRecvThread(void)
 int
 HgfsTransportSendRequest(HgfsReq *req)   // IN: Request to send
 {
+   uint32 gen;
    int ret;
+
    ASSERT(req);
    ASSERT(req->state == HGFS_REQ_STATE_UNSENT);
    ASSERT(req->payloadSize <= HGFS_LARGE_PACKET_MAX);
 
-   pthread_mutex_lock(&gHgfsActiveChannelLock);
+   pthread_rwlock_rdlock(&gHgfsActiveChannelLock);
 
    /* Try opening the channel. */
-   if (NULL == gHgfsActiveChannel) {
-      ret = HgfsTransportChannelOpen(&gHgfsActiveChannel);
-      if (ret != 0) {
-         goto exit;
+   while (NULL == gHgfsActiveChannel) {
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_wrlock(&gHgfsActiveChannelLock);
+      if (NULL == gHgfsActiveChannel) {
+         ret = HgfsTransportChannelOpen(&gHgfsActiveChannel);
+         if (ret != 0) {
+            pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+            return ret;
+         }
+         gHgfsActiveChannelGen++;
       }
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_rdlock(&gHgfsActiveChannelLock);
    }
 
    ASSERT(gHgfsActiveChannel->ops.send);
 
    HgfsTransportEnqueueRequest(req);
 
+   gen = gHgfsActiveChannelGen;
    ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+   pthread_rwlock_unlock(&gHgfsActiveChannelLock);
+
    if (ret < 0) {
       LOG(4, ("Send failed, status = %d. Try reopening the channel ...\n",
               ret));
-      if (HgfsTransportChannelReset(&gHgfsActiveChannel)) {
-         ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+      /*
+       * Other senders may have failed too; only the first one to get the
+       * write lock resets the channel, the others just retry on the new one.
+       */
+      pthread_rwlock_wrlock(&gHgfsActiveChannelLock);
+      if (gen != gHgfsActiveChannelGen ||
+          HgfsTransportChannelReset(&gHgfsActiveChannel)) {
+         if (gen == gHgfsActiveChannelGen) {
+            gHgfsActiveChannelGen++;
+         }
+         if (NULL != gHgfsActiveChannel) {
+            ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+         }
       }
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
    }
 
-exit:
    ASSERT(req->state == HGFS_REQ_STATE_COMPLETED ||
           req->state == HGFS_REQ_STATE_SUBMITTED ||
           req->state == HGFS_REQ_STATE_UNSENT);
 
-   pthread_mutex_unlock(&gHgfsActiveChannelLock);
-
    if (ret < 0) {
+      pthread_mutex_lock(&gHgfsPendingRequestsLock);
+      gHgfsTransportStats.failures++;
+      pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+   }
+
+   /* Synchronous channels complete the request in their send op. */
+   if (ret < 0 || req->state == HGFS_REQ_STATE_COMPLETED) {
       HgfsTransportDequeueRequest(req);
    }
 
@@ -364,6 +465,74 @@ exit:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportGetStats --
+ *
+ *     Snapshot the transport counters and histograms.
+ *
+ * Results:
+ *     None
+ *
+ * Side effects:
+ *     None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsTransportGetStats(HgfsTransportStats *stats)   // OUT: statistics
+{
+   pthread_mutex_lock(&gHgfsPendingRequestsLock);
+   *stats = gHgfsTransportStats;
+   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsTransportDumpStats --
+ *
+ *     Log the queue depth and round trip time histograms.
+ *
+ * Results:
+ *     None
+ *
+ * Side effects:
+ *     None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsTransportDumpStats(void)
+{
+   HgfsTransportStats stats;
+   int i;
+
+   HgfsTransportGetStats(&stats);
+
+   Log("HGFS transport: %"FMT64"u requests, %"FMT64"u failures, "
+       "max in flight %u\n", stats.requests, stats.failures,
+       stats.maxInFlight);
+   for (i = 0; i <= HGFS_TRANSPORT_MAX_REQUESTS; i++) {
+      if (stats.depthHist[i] != 0) {
+         Log("HGFS transport: depth %s%d: %"FMT64"u\n",
+             i == HGFS_TRANSPORT_MAX_REQUESTS ? ">=" : "", i,
+             stats.depthHist[i]);
+      }
+   }
+   for (i = 0; i < HGFS_TRANSPORT_RTT_BUCKETS; i++) {
+      if (stats.rttHist[i] != 0) {
+         Log("HGFS transport: rtt < %"FMT64"u us: %"FMT64"u\n",
+             CONST64U(1) << i, stats.rttHist[i]);
+      }
+   }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -387,11 +556,15 @@ int
 HgfsTransportInit(void)
 {
    int res;
+   int i;
 
    gHgfsActiveChannel = NULL;
    gHgfsPendingRequestsLockInited = FALSE;
    gHgfsActiveChannelLockInited = FALSE;
-   INIT_LIST_HEAD(&gHgfsPendingRequests);
+   for (i = 0; i < HGFS_PENDING_BUCKETS; i++) {
+      INIT_LIST_HEAD(&gHgfsPendingRequests[i]);
+   }
+   memset(&gHgfsTransportStats, 0, sizeof gHgfsTransportStats);
 
    res = pthread_mutex_init(&gHgfsPendingRequestsLock, NULL);
    if (res != 0) {
@@ -400,7 +573,7 @@ HgfsTransportInit(void)
    }
    gHgfsPendingRequestsLockInited = TRUE;
 
-   res = pthread_mutex_init(&gHgfsActiveChannelLock, NULL);
+   res = pthread_rwlock_init(&gHgfsActiveChannelLock, NULL);
    if (res != 0) {
       res = -res;
       goto exit;
@@ -439,15 +612,15 @@ HgfsTransportExit(void)
    LOG(8, ("Entered.\n"));
 
    if (gHgfsActiveChannelLockInited) {
-      pthread_mutex_lock(&gHgfsActiveChannelLock);
+      pthread_rwlock_wrlock(&gHgfsActiveChannelLock);
       HgfsTransportChannelClose(&gHgfsActiveChannel);
-      pthread_mutex_unlock(&gHgfsActiveChannelLock);
+      pthread_rwlock_unlock(&gHgfsActiveChannelLock);
 
-      pthread_mutex_destroy(&gHgfsActiveChannelLock);
+      pthread_rwlock_destroy(&gHgfsActiveChannelLock);
       gHgfsActiveChannelLockInited = FALSE;
    }
 
-   ASSERT(list_empty(&gHgfsPendingRequests));
+   ASSERT(gHgfsTransportStats.inFlight == 0);
 
    if (gHgfsPendingRequestsLockInited) {
       pthread_mutex_destroy(&gHgfsPendingRequestsLock);
@@ -25,6 +25,7 @@
 
 #include "request.h"
 #include <pthread.h>
+#include <time.h>
 
 typedef enum {
    HGFS_CHANNEL_UNINITIALIZED,
@@ -32,6 +33,12 @@ typedef enum {
    HGFS_CHANNEL_CONNECTED,
 } HgfsChannelStatus;
 
+/*
+ * Limits of the per-channel queue depth, set with -o max_requests=N.
+ */
+#define HGFS_TRANSPORT_MAX_REQUESTS      8
+#define HGFS_TRANSPORT_DEFAULT_REQUESTS  2
+
 /*
  * There are the operations a channel should implement.
  */
@@ -49,9 +56,22 @@ typedef struct HgfsTransportChannel {
    HgfsTransportChannelOps ops;    /* Channel ops. */
    HgfsChannelStatus status;       /* Connection status. */
    void *priv;                     /* Channel private data. */
+   uint32 maxRequests;             /* Queue depth, requests in flight. */
    pthread_mutex_t connLock;       /* Protect _this_ struct. */
 } HgfsTransportChannel;
 
+/* Round trip times are bucketed by powers of two microseconds. */
+#define HGFS_TRANSPORT_RTT_BUCKETS 24
+
+typedef struct HgfsTransportStats {
+   uint64 requests;                /* Requests sent. */
+   uint64 failures;                /* Sends that failed. */
+   uint32 inFlight;                /* Requests currently outstanding. */
+   uint32 maxInFlight;             /* High water mark of inFlight. */
+   uint64 depthHist[HGFS_TRANSPORT_MAX_REQUESTS + 1]; /* inFlight at send. */
+   uint64 rttHist[HGFS_TRANSPORT_RTT_BUCKETS];    /* [i]: rtt < 2^i us. */
+} HgfsTransportStats;
+
 /* Public functions (with respect to the entire module). */
 int HgfsTransportInit(void);
 void HgfsTransportExit(void);
@@ -59,5 +79,8 @@ int HgfsTransportSendRequest(HgfsReq *req);
 void HgfsTransportProcessPacket(char *receivedPacket,
                                 size_t receivedSize);
 void HgfsTransportBeforeExitingRecvThread(void);
+void HgfsTransportRecordRtt(const struct timespec *start);
+void HgfsTransportGetStats(HgfsTransportStats *stats);
+void HgfsTransportDumpStats(void);
 
 #endif // _HGFS_DRIVER_TRANSPORT_H_